@@ -52,19 +52,77 @@
 #include <gtk/gtkx.h>
 #include <syslog.h>
 #include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "localfilechooserdialog.h"
+#include "sandboxutilschoices.h"
+#include "sandboxutilsfileinfo.h"
+#include "sandboxutilsfilter.h"
+#include "sandboxutilsshm.h"
+#include "sandboxutilsthumbnails.h"
 #include "sandboxutilsmarshals.h"
+#include "sandboxutilstrace.h"
+
+// How long changes to choices are gathered before being reported, in ms
+#define LFCD_CHOICES_CHANGED_DELAY 100
+
+/* Configuration of a dialog whose widget was destroyed by lfcd_hibernate() */
+typedef struct _LfcdHibernation {
+  gchar                 *title;
+  GtkFileChooserAction   action;
+  gboolean               local_only;
+  gboolean               select_multiple;
+  gboolean               show_hidden;
+  gboolean               do_overwrite_confirmation;
+  gboolean               create_folders;
+  gboolean               destroy_with_parent;
+  gboolean               modal;
+  gchar                 *current_name;
+  gchar                 *current_folder_uri;
+  GSList                *uris;
+  GSList                *shortcut_uris;
+  GSList                *filters;
+  GtkFileFilter         *filter;
+} LfcdHibernation;
 
 struct _LocalFileChooserDialogPrivate
 {
   GtkWidget             *dialog;        /* pointer to the #GtkFileChooserDialog */
+  LfcdHibernation       *hibernation;   /* configuration while hibernated, or NULL */
+  GPtrArray             *button_labels; /* buttons of the dialog, to rebuild it */
+  GArray                *button_ids;    /* response ids of these buttons */
+  gboolean               selecting;     /* files selected since the last run */
   SfcdState              state;         /* state of the instance */
   GMutex                 stateMutex;    /* a mutex to provide thread-safety */
   gchar                 *remote_parent; /* id of a remote parent's window */
   gchar                 *id;            /* id of this instace */
+  SfcdTimings            timings;       /* phases of the current or last run */
+  SfcdTimings            origin;        /* client-side phases of the next run */
+  GVariant              *choices;       /* description of the choices, or NULL */
+  GtkWidget             *choices_widget; /* extra widget built from choices */
+  GHashTable            *choice_values; /* id -> current value of each choice */
+  GHashTable            *choice_changes; /* id -> value not reported yet */
+  guint                  choices_changed_id; /* source reporting changes */
+  cairo_surface_t       *preview_surface; /* image in the preview area, or NULL */
+  GtkWidget             *preview_area;  /* widget showing the preview surface */
+  LfcdPreviewFunc        preview_func;  /* told about highlighted files */
+  gpointer               preview_data;  /* data for the preview function */
+  GDestroyNotify         preview_notify; /* frees the preview data */
+  LfcdValidateFunc       validate_func; /* vets files before they are returned */
+  gpointer               validate_data; /* data for the validate function */
+  GDestroyNotify         validate_notify; /* frees the validate data */
 };
 
+/* Application function drawing the previews of a dialog run in-process */
+typedef struct {
+  SfcdPreviewFunc        func;
+  gpointer               user_data;
+  GDestroyNotify         notify;
+} LfcdPreviewRenderer;
+
 G_DEFINE_TYPE_WITH_PRIVATE (LocalFileChooserDialog, lfcd, SANDBOX_TYPE_FILE_CHOOSER_DIALOG)
 
 static guint64 __lfcd_instance_counter = 0;
@@ -75,13 +133,20 @@ static const gchar *        lfcd_get_state_printable           (SandboxFileChoos
 static const gchar *        lfcd_get_dialog_title              (SandboxFileChooserDialog *);
 static gboolean             lfcd_is_running                    (SandboxFileChooserDialog *);
 static const gchar *        lfcd_get_id                        (SandboxFileChooserDialog *);
+static gboolean             lfcd_get_timings                   (SandboxFileChooserDialog *, SfcdTimings *);
 static void                 lfcd_run                           (SandboxFileChooserDialog *, GError **);
 static void                 lfcd_present                       (SandboxFileChooserDialog *, GError **);
 static void                 lfcd_cancel_run                    (SandboxFileChooserDialog *, GError **);
+static void                 lfcd_reset                         (SandboxFileChooserDialog *, SfcdResetFlags, GError **);
 static void                 lfcd_set_destroy_with_parent       (SandboxFileChooserDialog *, gboolean);
 static gboolean             lfcd_get_destroy_with_parent       (SandboxFileChooserDialog *);
 static void                 lfcd_set_extra_widget              (SandboxFileChooserDialog *, GtkWidget *, GError **);
 static GtkWidget *          lfcd_get_extra_widget              (SandboxFileChooserDialog *, GError **);
+static void                 lfcd_set_choices                   (SandboxFileChooserDialog *, GVariant *, GError **);
+static GVariant *           lfcd_get_choice_values             (SandboxFileChooserDialog *, GError **);
+static void                 lfcd_set_preview_func              (SandboxFileChooserDialog *, gint, gint, SfcdPreviewFunc, gpointer, GDestroyNotify, GError **);
+static SfcdThumbnails *     lfcd_get_thumbnails                (SandboxFileChooserDialog *, gint, GError **);
+static GVariant *           lfcd_get_selection_info            (SandboxFileChooserDialog *, const gchar *, GError **);
 static void                 lfcd_select_filename               (SandboxFileChooserDialog *, const gchar *, GError **);
 static void                 lfcd_unselect_filename             (SandboxFileChooserDialog *, const gchar *, GError **);
 static void                 lfcd_select_all                    (SandboxFileChooserDialog *, GError **);
@@ -111,6 +176,11 @@ static GSList *             lfcd_list_shortcut_folders         (SandboxFileChoos
 static gboolean             lfcd_add_shortcut_folder_uri       (SandboxFileChooserDialog *, const gchar *, GError **);
 static gboolean             lfcd_remove_shortcut_folder_uri    (SandboxFileChooserDialog *, const gchar *, GError **);
 static GSList *             lfcd_list_shortcut_folder_uris     (SandboxFileChooserDialog *, GError **);
+static gboolean             lfcd_add_filter                    (SandboxFileChooserDialog *, const gchar *, const gchar * const *, const gchar * const *, GError **);
+static gboolean             lfcd_remove_filter                 (SandboxFileChooserDialog *, const gchar *, GError **);
+static GSList *             lfcd_list_filters                  (SandboxFileChooserDialog *, GError **);
+static void                 lfcd_set_filter                    (SandboxFileChooserDialog *, const gchar *, GError **);
+static gchar *              lfcd_get_filter                    (SandboxFileChooserDialog *, GError **);
 static gchar *              lfcd_get_current_name              (SandboxFileChooserDialog *, GError **);
 static gchar *              lfcd_get_filename                  (SandboxFileChooserDialog *, GError **);
 static GSList *             lfcd_get_filenames                 (SandboxFileChooserDialog *, GError **);
@@ -125,14 +195,64 @@ lfcd_init (LocalFileChooserDialog *self)
   self->priv = lfcd_get_instance_private (self);
 
   self->priv->dialog        = NULL;
+  self->priv->hibernation   = NULL;
+  self->priv->button_labels = g_ptr_array_new_with_free_func (g_free);
+  self->priv->button_ids    = g_array_new (FALSE, FALSE, sizeof (gint));
+  self->priv->selecting     = FALSE;
   self->priv->state         = SFCD_CONFIGURATION;
   self->priv->remote_parent = NULL;
+  self->priv->choices       = NULL;
+  self->priv->choices_widget = NULL;
+  self->priv->choice_values = _sandboxutils_choices_get_defaults (NULL);
+  self->priv->choice_changes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_variant_unref);
+  self->priv->choices_changed_id = 0;
+  self->priv->preview_surface = NULL;
+  self->priv->preview_area  = NULL;
+  self->priv->preview_func  = NULL;
+  self->priv->preview_data  = NULL;
+  self->priv->preview_notify = NULL;
+  self->priv->validate_func = NULL;
+  self->priv->validate_data = NULL;
+  self->priv->validate_notify = NULL;
 
   self->priv->id            = g_strdup_printf ("%lu", __lfcd_instance_counter++);
 
+  memset (&self->priv->timings, 0, sizeof (SfcdTimings));
+  memset (&self->priv->origin, 0, sizeof (SfcdTimings));
+
   g_mutex_init (&self->priv->stateMutex);
 }
 
+static void
+_lfcd_hibernation_free (LfcdHibernation *hibernation)
+{
+  g_free (hibernation->title);
+  g_free (hibernation->current_name);
+  g_free (hibernation->current_folder_uri);
+  g_slist_free_full (hibernation->uris, g_free);
+  g_slist_free_full (hibernation->shortcut_uris, g_free);
+  g_slist_free_full (hibernation->filters, g_object_unref);
+  if (hibernation->filter)
+    g_object_unref (hibernation->filter);
+  g_free (hibernation);
+}
+
+/* Forgets the preview surface and whoever draws into it */
+static void
+_lfcd_clear_preview (LocalFileChooserDialog *self)
+{
+  if (self->priv->preview_notify)
+    self->priv->preview_notify (self->priv->preview_data);
+
+  if (self->priv->preview_surface)
+    cairo_surface_destroy (self->priv->preview_surface);
+
+  self->priv->preview_surface = NULL;
+  self->priv->preview_func    = NULL;
+  self->priv->preview_data    = NULL;
+  self->priv->preview_notify  = NULL;
+}
+
 static void
 lfcd_dispose (GObject* object)
 {
@@ -149,9 +269,18 @@ lfcd_dispose (GObject* object)
                                         0, NULL, NULL, NULL);
   g_signal_handlers_disconnect_matched (self, G_SIGNAL_MATCH_ID, klass->show_signal,
                                         0, NULL, NULL, NULL);
+  g_signal_handlers_disconnect_matched (self, G_SIGNAL_MATCH_ID, klass->choices_changed_signal,
+                                        0, NULL, NULL, NULL);
 
   g_mutex_clear (&self->priv->stateMutex);
 
+  if (self->priv->choices_changed_id)
+    g_source_remove (self->priv->choices_changed_id);
+  if (self->priv->choices)
+    g_variant_unref (self->priv->choices);
+  g_hash_table_unref (self->priv->choice_values);
+  g_hash_table_unref (self->priv->choice_changes);
+
   if (self->priv->dialog)
   {
     // Remove our own ref and then destroy the dialog
@@ -159,6 +288,18 @@ lfcd_dispose (GObject* object)
     gtk_widget_destroy (self->priv->dialog);
   }
 
+  // Only once the preview area is gone, as it paints the surface
+  _lfcd_clear_preview (self);
+
+  if (self->priv->validate_notify)
+    self->priv->validate_notify (self->priv->validate_data);
+
+  if (self->priv->hibernation)
+    _lfcd_hibernation_free (self->priv->hibernation);
+
+  g_ptr_array_unref (self->priv->button_labels);
+  g_array_unref (self->priv->button_ids);
+
   if (self->priv->remote_parent)
     g_free (self->priv->remote_parent);
 
@@ -166,6 +307,8 @@ lfcd_dispose (GObject* object)
               self->priv->id);
 
   g_free (self->priv->id);
+
+  G_OBJECT_CLASS (lfcd_parent_class)->dispose (object);
 }
 
 static void
@@ -188,11 +331,49 @@ _lfcd_on_show (SandboxFileChooserDialog *sfcd,
                 gpointer ignore)
 {
   SandboxFileChooserDialogClass *klass = SANDBOX_FILE_CHOOSER_DIALOG_GET_CLASS (sfcd);
+  LocalFileChooserDialog        *self  = LOCAL_FILE_CHOOSER_DIALOG (sfcd);
+
+  if (self->priv->state == SFCD_RUNNING && !self->priv->timings.shown)
+    self->priv->timings.shown = g_get_monotonic_time ();
+
   g_signal_emit (sfcd,
                  klass->show_signal,
                  0);
 }
 
+static void
+_lfcd_on_after_paint (GdkFrameClock *clock,
+                      gpointer       data)
+{
+  LocalFileChooserDialog *self = data;
+
+  if (self->priv->state == SFCD_RUNNING && !self->priv->timings.painted)
+    self->priv->timings.painted = g_get_monotonic_time ();
+
+  // Only the first frame matters to us
+  g_signal_handlers_disconnect_by_func (clock, _lfcd_on_after_paint, data);
+}
+
+static void
+_lfcd_on_map (LocalFileChooserDialog *self,
+              gpointer                ignore)
+{
+  GdkFrameClock *clock;
+
+  if (self->priv->state != SFCD_RUNNING || self->priv->timings.mapped)
+    return;
+
+  self->priv->timings.mapped = g_get_monotonic_time ();
+
+  // Catch the end of the first frame painted after mapping the window
+  clock = gtk_widget_get_frame_clock (self->priv->dialog);
+  if (clock)
+  {
+    g_signal_handlers_disconnect_by_func (clock, _lfcd_on_after_paint, self);
+    g_signal_connect_object (clock, "after-paint", G_CALLBACK (_lfcd_on_after_paint), self, 0);
+  }
+}
+
 static gboolean
 _lfcd_is_stock_accept_response_id (int response_id)
 {
@@ -202,6 +383,39 @@ _lfcd_is_stock_accept_response_id (int response_id)
 	  || response_id == GTK_RESPONSE_APPLY);
 }
 
+/* Adds a button to the dialog, unless it is unsafe, and remembers it */
+static void
+_lfcd_add_button (LocalFileChooserDialog *lfcd,
+                  const gchar            *button_text,
+                  gint                    response_id)
+{
+  gchar *label;
+
+  if (!_lfcd_is_stock_accept_response_id (response_id) || sfcd_is_accept_label (button_text))
+  {
+    gtk_dialog_add_button (GTK_DIALOG (lfcd->priv->dialog), button_text, response_id);
+
+    label = g_strdup (button_text);
+    g_ptr_array_add (lfcd->priv->button_labels, label);
+    g_array_append_val (lfcd->priv->button_ids, response_id);
+  }
+  else
+    syslog (LOG_CRIT, "SandboxFileChooserDialog.New: dialog '%s' will not contain button '%s':'%d' for security reasons (acceptance state with label not known to convey acceptance meaning). If you think this is a bug, please report it indicating the application used and your current locale settings.",
+            lfcd->priv->id, button_text, response_id);
+}
+
+static void
+_lfcd_connect_dialog (LocalFileChooserDialog *lfcd)
+{
+  // Connecting signals here - we do not connect to signals like close or destroy
+  // that occur only when we are already cleaning up the dialog. Instead we emit
+  // them ourselves.
+  SandboxFileChooserDialog *sfcd = SANDBOX_FILE_CHOOSER_DIALOG (lfcd);
+  g_signal_connect_swapped (lfcd->priv->dialog, "hide", (GCallback) _lfcd_on_hide, sfcd);
+  g_signal_connect_swapped (lfcd->priv->dialog, "show", (GCallback) _lfcd_on_show, sfcd);
+  g_signal_connect_swapped (lfcd->priv->dialog, "map", (GCallback) _lfcd_on_map, lfcd);
+}
+
 /**
  * lfcd_new_valist:
  * @title: (allow-none): Title of the dialog, or %NULL
@@ -257,11 +471,7 @@ lfcd_new_valist (const gchar          *title,
   while (button_text)
   {
     response_id = va_arg (varargs, gint);
-    if (!_lfcd_is_stock_accept_response_id (response_id) || sfcd_is_accept_label (button_text))
-      gtk_dialog_add_button (GTK_DIALOG (lfcd->priv->dialog), button_text, response_id);
-    else
-      syslog (LOG_CRIT, "SandboxFileChooserDialog.New: dialog '%s' will not contain button '%s':'%d' for security reasons (acceptance state with label not known to convey acceptance meaning). If you think this is a bug, please report it indicating the application used and your current locale settings.",
-              lfcd->priv->id, button_text, response_id);
+    _lfcd_add_button (lfcd, button_text, response_id);
     button_text = va_arg (varargs, const gchar *);
   }
 
@@ -272,12 +482,9 @@ lfcd_new_valist (const gchar          *title,
     lfcd->priv->remote_parent = g_strdup (parentWinId);
   }
 
-  // Connecting signals here - we do not connect to signals like close or destroy
-  // that occur only when we are already cleaning up the dialog. Instead we emit
-  // them ourselves.
-  SandboxFileChooserDialog *sfcd = SANDBOX_FILE_CHOOSER_DIALOG (lfcd);
-  g_signal_connect_swapped (lfcd->priv->dialog, "hide", (GCallback) _lfcd_on_hide, sfcd);
-  g_signal_connect_swapped (lfcd->priv->dialog, "show", (GCallback) _lfcd_on_show, sfcd);
+  _lfcd_connect_dialog (lfcd);
+
+  SU_TRACE2 (lfcd_new, lfcd->priv->id, action);
   
   syslog (LOG_DEBUG, "SandboxFileChooserDialog.New: dialog '%s' ('%s') has just been created.\n",
             lfcd->priv->id, title);
@@ -343,11 +550,7 @@ lfcd_new_variant (const gchar          *title,
     GVariant *value;
 
     g_variant_get (item, "{sv}", &key, &value);
-    if (!_lfcd_is_stock_accept_response_id (g_variant_get_int32 (value)) || sfcd_is_accept_label (key))
-      gtk_dialog_add_button (GTK_DIALOG (lfcd->priv->dialog), key, g_variant_get_int32 (value));
-    else
-      syslog (LOG_CRIT, "SandboxFileChooserDialog.New: dialog '%s' will not contain button '%s':'%d' for security reasons (acceptance state with label not known to convey acceptance meaning). If you think this is a bug, please report it indicating the application used and your current locale settings.",
-              lfcd->priv->id, key, g_variant_get_int32 (value));
+    _lfcd_add_button (lfcd, key, g_variant_get_int32 (value));
     g_free (key);
   }
   g_variant_iter_free (iter);
@@ -504,6 +707,11 @@ lfcd_get_dialog_title (SandboxFileChooserDialog *sfcd)
 {
   LocalFileChooserDialog *self = LOCAL_FILE_CHOOSER_DIALOG (sfcd);
   g_return_val_if_fail (LOCAL_IS_FILE_CHOOSER_DIALOG (self), NULL);
+
+  // Do not wake a hibernated dialog up just to log its title
+  if (self->priv->hibernation)
+    return self->priv->hibernation->title;
+
   g_return_val_if_fail (GTK_IS_FILE_CHOOSER_DIALOG (self->priv->dialog), NULL);
 
   return gtk_window_get_title (GTK_WINDOW (self->priv->dialog));
@@ -527,6 +735,286 @@ lfcd_get_id (SandboxFileChooserDialog *sfcd)
   return self->priv->id;
 }
 
+static gboolean
+lfcd_get_timings (SandboxFileChooserDialog *sfcd,
+                  SfcdTimings              *timings)
+{
+  LocalFileChooserDialog *self = LOCAL_FILE_CHOOSER_DIALOG (sfcd);
+  g_return_val_if_fail (LOCAL_IS_FILE_CHOOSER_DIALOG (self), FALSE);
+
+  *timings = self->priv->timings;
+
+  return self->priv->timings.run_received != 0;
+}
+
+/**
+ * lfcd_set_run_origin:
+ * @dialog: a #LocalFileChooserDialog
+ * @correlation_id: identifier of the run, chosen by the client
+ * @run_called: when the client called sfcd_run(), or 0 if unknown
+ * @run_received: when the Run call was received, or 0 if unknown
+ *
+ * Tells the @dialog where its next run originates from, so that its timings
+ * cover the whole way from the client to the dialog. Servers should call this
+ * right before calling sfcd_run(). When not called, the run is assumed to
+ * originate from the local process when sfcd_run() is called.
+ *
+ * Since: 0.7
+ **/
+void
+lfcd_set_run_origin (SandboxFileChooserDialog *sfcd,
+                     guint64                   correlation_id,
+                     gint64                    run_called,
+                     gint64                    run_received)
+{
+  LocalFileChooserDialog *self = LOCAL_FILE_CHOOSER_DIALOG (sfcd);
+  g_return_if_fail (LOCAL_IS_FILE_CHOOSER_DIALOG (self));
+
+  self->priv->origin.correlation_id = correlation_id;
+  self->priv->origin.run_called     = run_called;
+  self->priv->origin.run_received   = run_received;
+}
+
+/*
+ * Reports the choices the user changed since the last report, all at once.
+ * Must be called without holding the state mutex.
+ */
+static gboolean
+_lfcd_report_choices (gpointer data)
+{
+  LocalFileChooserDialog        *self  = data;
+  SandboxFileChooserDialog      *sfcd  = SANDBOX_FILE_CHOOSER_DIALOG (self);
+  SandboxFileChooserDialogClass *klass = SANDBOX_FILE_CHOOSER_DIALOG_GET_CLASS (sfcd);
+  GVariant                      *changes = NULL;
+
+  g_mutex_lock (&self->priv->stateMutex);
+
+  if (self->priv->choices_changed_id)
+  {
+    g_source_remove (self->priv->choices_changed_id);
+    self->priv->choices_changed_id = 0;
+  }
+
+  if (g_hash_table_size (self->priv->choice_changes))
+  {
+    changes = g_variant_ref_sink (_sandboxutils_choices_to_variant (self->priv->choice_changes));
+    g_hash_table_remove_all (self->priv->choice_changes);
+  }
+
+  g_mutex_unlock (&self->priv->stateMutex);
+
+  if (changes)
+  {
+    g_signal_emit (sfcd, klass->choices_changed_signal, 0, changes);
+    g_variant_unref (changes);
+  }
+
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+_lfcd_on_choices_timeout (gpointer data)
+{
+  LocalFileChooserDialog *self = data;
+
+  g_mutex_lock (&self->priv->stateMutex);
+  self->priv->choices_changed_id = 0;
+  g_mutex_unlock (&self->priv->stateMutex);
+
+  return _lfcd_report_choices (self);
+}
+
+/* Remembers a choice changed by the user, to report shortly */
+static void
+_lfcd_on_choice_changed (const gchar *id,
+                         GVariant    *value,
+                         gpointer     data)
+{
+  LocalFileChooserDialog *self = data;
+
+  g_variant_ref_sink (value);
+  g_mutex_lock (&self->priv->stateMutex);
+
+  g_hash_table_insert (self->priv->choice_values, g_strdup (id), g_variant_ref (value));
+  g_hash_table_insert (self->priv->choice_changes, g_strdup (id), g_variant_ref (value));
+
+  // Toggling through a list of options only reports where the user ended up
+  if (!self->priv->choices_changed_id)
+    self->priv->choices_changed_id = g_timeout_add (LFCD_CHOICES_CHANGED_DELAY, _lfcd_on_choices_timeout, self);
+
+  g_mutex_unlock (&self->priv->stateMutex);
+  g_variant_unref (value);
+}
+
+/* Builds the widgets of the choices into the dialog, replacing its extra widget */
+static void
+_lfcd_install_choices (LocalFileChooserDialog *self)
+{
+  if (self->priv->choices)
+    self->priv->choices_widget = _sandboxutils_choices_build (self->priv->choices,
+                                                              self->priv->choice_values,
+                                                              _lfcd_on_choice_changed,
+                                                              self);
+  else
+    self->priv->choices_widget = NULL;
+
+  gtk_file_chooser_set_extra_widget (GTK_FILE_CHOOSER (self->priv->dialog), self->priv->choices_widget);
+}
+
+/* Forgets the choices and their values, or gives them their initial values */
+static void
+_lfcd_clear_choices (LocalFileChooserDialog *self,
+                     gboolean                keep_description)
+{
+  if (!keep_description && self->priv->choices)
+  {
+    g_variant_unref (self->priv->choices);
+    self->priv->choices = NULL;
+  }
+
+  if (self->priv->choices_changed_id)
+  {
+    g_source_remove (self->priv->choices_changed_id);
+    self->priv->choices_changed_id = 0;
+  }
+
+  g_hash_table_remove_all (self->priv->choice_changes);
+  g_hash_table_unref (self->priv->choice_values);
+  self->priv->choice_values = _sandboxutils_choices_get_defaults (self->priv->choices);
+}
+
+/* Paints the preview surface, the preview area being exactly its size */
+static gboolean
+_lfcd_on_preview_draw (GtkWidget *widget,
+                       cairo_t   *cr,
+                       gpointer   user_data)
+{
+  LocalFileChooserDialog *self = user_data;
+
+  if (self->priv->preview_surface)
+  {
+    cairo_set_source_surface (cr, self->priv->preview_surface, 0, 0);
+    cairo_paint (cr);
+  }
+
+  return TRUE;
+}
+
+/* Tells whoever draws previews that the user highlighted another file */
+static void
+_lfcd_on_update_preview (GtkFileChooser *chooser,
+                         gpointer        user_data)
+{
+  LocalFileChooserDialog *self     = user_data;
+  gchar                  *filename = gtk_file_chooser_get_preview_filename (chooser);
+
+  // Nothing is shown until the new preview is drawn, rather than the old one
+  gtk_file_chooser_set_preview_widget_active (chooser, FALSE);
+
+  if (self->priv->preview_func)
+    self->priv->preview_func (SANDBOX_FILE_CHOOSER_DIALOG (self), filename, self->priv->preview_data);
+
+  g_free (filename);
+}
+
+/* Puts an area showing the preview surface in the dialog, or takes it out */
+static void
+_lfcd_install_preview (LocalFileChooserDialog *self)
+{
+  GtkFileChooser *chooser = GTK_FILE_CHOOSER (self->priv->dialog);
+
+  g_signal_handlers_disconnect_by_func (chooser, _lfcd_on_update_preview, self);
+  self->priv->preview_area = NULL;
+
+  if (self->priv->preview_surface)
+  {
+    self->priv->preview_area = gtk_drawing_area_new ();
+    gtk_widget_set_size_request (self->priv->preview_area,
+                                 cairo_image_surface_get_width (self->priv->preview_surface),
+                                 cairo_image_surface_get_height (self->priv->preview_surface));
+    gtk_widget_set_halign (self->priv->preview_area, GTK_ALIGN_CENTER);
+    gtk_widget_set_valign (self->priv->preview_area, GTK_ALIGN_START);
+    g_signal_connect (self->priv->preview_area, "draw", G_CALLBACK (_lfcd_on_preview_draw), self);
+    gtk_widget_show (self->priv->preview_area);
+
+    g_signal_connect (chooser, "update-preview", G_CALLBACK (_lfcd_on_update_preview), self);
+  }
+
+  gtk_file_chooser_set_use_preview_label (chooser, self->priv->preview_surface == NULL);
+  gtk_file_chooser_set_preview_widget (chooser, self->priv->preview_area);
+  gtk_file_chooser_set_preview_widget_active (chooser, FALSE);
+}
+
+/* Rebuilds the widget of a hibernated dialog, with the same configuration */
+static void
+_lfcd_wake (LocalFileChooserDialog *self)
+{
+  LfcdHibernation *h = self->priv->hibernation;
+  GtkFileChooser  *chooser;
+  GSList          *iter;
+  guint            i;
+
+  self->priv->hibernation = NULL;
+  self->priv->dialog = gtk_file_chooser_dialog_new (h->title, NULL, h->action, NULL, NULL);
+
+  for (i = 0; i < self->priv->button_ids->len; i++)
+    gtk_dialog_add_button (GTK_DIALOG (self->priv->dialog),
+                           g_ptr_array_index (self->priv->button_labels, i),
+                           g_array_index (self->priv->button_ids, gint, i));
+
+  g_object_ref_sink (self->priv->dialog);
+  _lfcd_connect_dialog (self);
+
+  gtk_window_set_destroy_with_parent (GTK_WINDOW (self->priv->dialog), h->destroy_with_parent);
+  gtk_window_set_modal (GTK_WINDOW (self->priv->dialog), h->modal);
+
+  chooser = GTK_FILE_CHOOSER (self->priv->dialog);
+  gtk_file_chooser_set_local_only (chooser, h->local_only);
+  gtk_file_chooser_set_select_multiple (chooser, h->select_multiple);
+  gtk_file_chooser_set_show_hidden (chooser, h->show_hidden);
+  gtk_file_chooser_set_do_overwrite_confirmation (chooser, h->do_overwrite_confirmation);
+  gtk_file_chooser_set_create_folders (chooser, h->create_folders);
+
+  for (iter = h->shortcut_uris; iter; iter = iter->next)
+    gtk_file_chooser_add_shortcut_folder_uri (chooser, iter->data, NULL);
+
+  for (iter = h->filters; iter; iter = iter->next)
+    gtk_file_chooser_add_filter (chooser, iter->data);
+
+  if (h->filter)
+    gtk_file_chooser_set_filter (chooser, h->filter);
+
+  if (h->current_folder_uri)
+    gtk_file_chooser_set_current_folder_uri (chooser, h->current_folder_uri);
+
+  if (h->current_name)
+    gtk_file_chooser_set_current_name (chooser, h->current_name);
+
+  for (iter = h->uris; iter; iter = iter->next)
+    gtk_file_chooser_select_uri (chooser, iter->data);
+
+  if (self->priv->choices)
+    _lfcd_install_choices (self);
+
+  if (self->priv->preview_surface)
+    _lfcd_install_preview (self);
+
+  syslog (LOG_DEBUG, "SandboxFileChooserDialog._Wake: dialog '%s' ('%s') was rebuilt after hibernating.\n",
+          self->priv->id, h->title);
+
+  _lfcd_hibernation_free (h);
+}
+
+/* The widget of the dialog, rebuilt first if the dialog hibernates */
+static GtkWidget *
+_lfcd_get_dialog (LocalFileChooserDialog *self)
+{
+  if (self->priv->hibernation)
+    _lfcd_wake (self);
+
+  return self->priv->dialog;
+}
+
 static gboolean
 _lfcd_entry_sanity_check (LocalFileChooserDialog    *self,
                           GError                  **error)
@@ -569,7 +1057,7 @@ lfcd_set_destroy_with_parent (SandboxFileChooserDialog  *sfcd,
 
   g_mutex_lock (&self->priv->stateMutex);
 
-  gtk_window_set_destroy_with_parent (GTK_WINDOW (self->priv->dialog), setting);
+  gtk_window_set_destroy_with_parent (GTK_WINDOW (_lfcd_get_dialog (self)), setting);
 
   syslog (LOG_DEBUG,
           "SandboxFileChooserDialog.SetDestroyWithParent: dialog '%s' ('%s') now has destroy-with-parent '%d'.\n",
@@ -588,7 +1076,7 @@ lfcd_get_destroy_with_parent (SandboxFileChooserDialog *sfcd)
 
   g_mutex_lock (&self->priv->stateMutex);
 
-  gboolean result = gtk_window_get_destroy_with_parent (GTK_WINDOW (self->priv->dialog));
+  gboolean result = gtk_window_get_destroy_with_parent (GTK_WINDOW (_lfcd_get_dialog (self)));
 
   syslog (LOG_DEBUG,
           "SandboxFileChooserDialog.GetDestroyWithParent: dialog '%s' ('%s') has destroy-with-parent '%d'.\n",
@@ -633,6 +1121,52 @@ run_unmap_handler (GtkDialog *dialog,
   shutdown_loop (d);
 }
 
+/*
+ * Asks the validate function whether the files chosen in @self may be
+ * returned, and tells the user why not if they may not. Must not take the
+ * state mutex, which lfcd_respond() holds when responding on its own.
+ */
+static gboolean
+_lfcd_validate (LocalFileChooserDialog *self)
+{
+  SandboxFileChooserDialog *sfcd    = SANDBOX_FILE_CHOOSER_DIALOG (self);
+  GtkWidget                *error_dialog;
+  GSList                   *filenames;
+  gchar                    *message = NULL;
+  gboolean                  valid;
+
+  if (!self->priv->validate_func)
+    return TRUE;
+
+  filenames = gtk_file_chooser_get_filenames (GTK_FILE_CHOOSER (self->priv->dialog));
+  valid     = self->priv->validate_func (sfcd, filenames, &message, self->priv->validate_data);
+  g_slist_free_full (filenames, g_free);
+
+  if (!valid)
+  {
+    syslog (LOG_NOTICE,
+            "SandboxFileChooserDialog._Validate: dialog '%s' ('%s') refused the files chosen by the user -- %s\n",
+            sfcd_get_id (sfcd),
+            gtk_window_get_title (GTK_WINDOW (self->priv->dialog)),
+            message ? message : "no reason given");
+
+    error_dialog = gtk_message_dialog_new (GTK_WINDOW (self->priv->dialog),
+                                           GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT,
+                                           GTK_MESSAGE_ERROR,
+                                           GTK_BUTTONS_CLOSE,
+                                           "These files cannot be given to the application");
+    if (message)
+      gtk_message_dialog_format_secondary_text (GTK_MESSAGE_DIALOG (error_dialog), "%s", message);
+
+    g_signal_connect (error_dialog, "response", G_CALLBACK (gtk_widget_destroy), NULL);
+    gtk_widget_show (error_dialog);
+  }
+
+  g_free (message);
+
+  return valid;
+}
+
 static void
 run_response_handler (GtkDialog *dialog,
                       gint       response_id,
@@ -640,6 +1174,10 @@ run_response_handler (GtkDialog *dialog,
 {
   LfcdRunFuncData *d = data;
 
+  // The user chooses again if the files may not be returned
+  if (_lfcd_is_stock_accept_response_id (response_id) && !_lfcd_validate (d->lfcd))
+    return;
+
   d->response_id = response_id;
 
   shutdown_loop (d);
@@ -680,6 +1218,9 @@ _lfcd_run_func (gpointer data)
   SandboxFileChooserDialog      *sfcd  = SANDBOX_FILE_CHOOSER_DIALOG (self);
   SandboxFileChooserDialogClass *klass = SANDBOX_FILE_CHOOSER_DIALOG_GET_CLASS (sfcd);
 
+  self->priv->timings.run_dispatched = g_get_monotonic_time ();
+  SU_TRACE2 (lfcd_run_dispatched, sfcd_get_id (sfcd),
+             self->priv->timings.run_dispatched - self->priv->timings.run_received);
 
 G_GNUC_BEGIN_IGNORE_DEPRECATIONS
   gdk_threads_leave ();
@@ -687,6 +1228,10 @@ G_GNUC_BEGIN_IGNORE_DEPRECATIONS
   gdk_threads_enter ();
 G_GNUC_END_IGNORE_DEPRECATIONS
 
+  self->priv->timings.responded = g_get_monotonic_time ();
+  SU_TRACE3 (lfcd_run_finished, sfcd_get_id (sfcd), d->response_id,
+             self->priv->timings.responded - self->priv->timings.run_dispatched);
+
   syslog (LOG_DEBUG, "SandboxFileChooserDialog._RunFunc: dialog '%s' ('%s') has finished running (return code is %d).\n",
           sfcd_get_id (sfcd), gtk_window_get_title (GTK_WINDOW (self->priv->dialog)), d->response_id);
 
@@ -736,6 +1281,7 @@ G_GNUC_END_IGNORE_DEPRECATIONS
               gtk_window_get_title (GTK_WINDOW (self->priv->dialog)),
               SfcdStatePrintable [SFCD_CONFIGURATION]);
 
+      SU_TRACE3 (lfcd_state, sfcd_get_id (sfcd), self->priv->state, SFCD_CONFIGURATION);
       self->priv->state = SFCD_CONFIGURATION;
     }
     else
@@ -746,10 +1292,16 @@ G_GNUC_END_IGNORE_DEPRECATIONS
               gtk_window_get_title (GTK_WINDOW (self->priv->dialog)),
               SfcdStatePrintable [SFCD_DATA_RETRIEVAL]);
 
+      SU_TRACE3 (lfcd_state, sfcd_get_id (sfcd), self->priv->state, SFCD_DATA_RETRIEVAL);
       self->priv->state = SFCD_DATA_RETRIEVAL;
     }
 
     g_mutex_unlock (&self->priv->stateMutex);
+    _sfcd_record_timings (&self->priv->timings);
+
+    // Changes not reported yet come before the response, not after it
+    _lfcd_report_choices (self);
+
     g_signal_emit (sfcd,
                    klass->response_signal,
                    0,
@@ -797,48 +1349,67 @@ lfcd_run (SandboxFileChooserDialog *sfcd,
 
     // Now running, prevent destruction - refs are used to allow keeping the 
     // dialog alive until the very end!
+    SU_TRACE3 (lfcd_state, sfcd_get_id (sfcd), self->priv->state, SFCD_RUNNING);
     self->priv->state = SFCD_RUNNING;
     g_object_ref (self);
+
+    // Once shown, the dialog reports pending selections as its own
+    self->priv->selecting = FALSE;
+
+    // Start timing this run, from where the server says it originates if known
+    memset (&self->priv->timings, 0, sizeof (SfcdTimings));
+    if (self->priv->origin.run_received)
+    {
+      self->priv->timings = self->priv->origin;
+      memset (&self->priv->origin, 0, sizeof (SfcdTimings));
+    }
+    else
+    {
+      self->priv->timings.run_called   = g_get_monotonic_time ();
+      self->priv->timings.run_received = self->priv->timings.run_called;
+    }
             
     // Data shared between Run call and the idle func running the dialog
     LfcdRunFuncData *d = g_malloc (sizeof (LfcdRunFuncData));
     d->lfcd = self;
     d->loop = g_main_loop_new (NULL, FALSE);
     d->response_id = GTK_RESPONSE_NONE;
-    d->was_modal = gtk_window_get_modal (GTK_WINDOW (self->priv->dialog));
+    d->was_modal = gtk_window_get_modal (GTK_WINDOW (_lfcd_get_dialog (self)));
 
-    d->response_handler = g_signal_connect (self->priv->dialog,
+    d->response_handler = g_signal_connect (_lfcd_get_dialog (self),
                                             "response",
                                             G_CALLBACK (run_response_handler),
                                             d);
 
-    d->unmap_handler = g_signal_connect (self->priv->dialog,
+    d->unmap_handler = g_signal_connect (_lfcd_get_dialog (self),
                                          "unmap",
                                          G_CALLBACK (run_unmap_handler),
                                          d);
 
-    d->delete_handler = g_signal_connect (self->priv->dialog,
+    d->delete_handler = g_signal_connect (_lfcd_get_dialog (self),
                                           "delete-event",
                                           G_CALLBACK (run_delete_handler),
                                           d);
 
-    d->destroy_handler = g_signal_connect (self->priv->dialog,
+    d->destroy_handler = g_signal_connect (_lfcd_get_dialog (self),
                                            "destroy",
                                            G_CALLBACK (run_destroy_handler),
                                            d);
 
     // TODO tell the compo to make the dialog modal, if requested by the client
     if (!d->was_modal)
-      gtk_window_set_modal (GTK_WINDOW (self->priv->dialog), TRUE);
+      gtk_window_set_modal (GTK_WINDOW (_lfcd_get_dialog (self)), TRUE);
 
     // TODO tell the compo to show the dialog as if it were the client's child
-    if (!gtk_widget_get_visible (GTK_WIDGET (self->priv->dialog)))
-      gtk_widget_show (GTK_WIDGET (self->priv->dialog));    
+    if (!gtk_widget_get_visible (GTK_WIDGET (_lfcd_get_dialog (self))))
+      gtk_widget_show (GTK_WIDGET (_lfcd_get_dialog (self)));    
 
     syslog (LOG_DEBUG, "SandboxFileChooserDialog.Run: dialog '%s' ('%s') is about to run.\n",
           sfcd_get_id (sfcd), sfcd_get_dialog_title (sfcd));
 
-    gdk_threads_add_idle_full (G_PRIORITY_DEFAULT, _lfcd_run_func, d, NULL);
+    // The user is waiting for this dialog, start its loop before other
+    // pending work on the main loop gets processed
+    gdk_threads_add_idle_full (G_PRIORITY_HIGH, _lfcd_run_func, d, NULL);
   }
 
   g_mutex_unlock (&self->priv->stateMutex);
@@ -871,7 +1442,7 @@ lfcd_present (SandboxFileChooserDialog  *sfcd,
             sfcd_get_id (sfcd),
             sfcd_get_dialog_title (sfcd));
 
-    gtk_window_present (GTK_WINDOW (self->priv->dialog));
+    gtk_window_present (GTK_WINDOW (_lfcd_get_dialog (self)));
   }
 
   g_mutex_unlock (&self->priv->stateMutex);
@@ -904,48 +1475,841 @@ lfcd_cancel_run (SandboxFileChooserDialog  *sfcd,
             sfcd_get_id (sfcd),
             sfcd_get_dialog_title (sfcd));
 
-    // This is enough to cause the run method to issue a GTK_RESPONSE_NONE
-    gtk_widget_hide (self->priv->dialog);
+    // This is enough to cause the run method to issue a GTK_RESPONSE_NONE
+    gtk_widget_hide (_lfcd_get_dialog (self));
+  }
+
+  g_mutex_unlock (&self->priv->stateMutex);
+}
+
+static void
+lfcd_reset (SandboxFileChooserDialog  *sfcd,
+            SfcdResetFlags             flags,
+            GError                   **error)
+{
+  LocalFileChooserDialog *self = LOCAL_FILE_CHOOSER_DIALOG (sfcd);
+  LfcdHibernation        *h;
+  GtkFileChooser         *chooser;
+  GtkFileChooserAction    action;
+  GSList                 *shortcuts;
+  GSList                 *filters;
+  GSList                 *iter;
+
+  g_return_if_fail (_lfcd_entry_sanity_check (self, error));
+
+  g_mutex_lock (&self->priv->stateMutex);
+
+  if (sfcd_is_running (sfcd))
+  {
+    g_set_error (error,
+                 g_quark_from_static_string (SFCD_ERROR_DOMAIN),
+                 SFCD_ERROR_FORBIDDEN_CHANGE,
+                 "SandboxFileChooserDialog.Reset: dialog '%s' ('%s') is already running and cannot be reset.\n",
+                 sfcd_get_id (sfcd),
+                 sfcd_get_dialog_title (sfcd));
+
+    syslog (LOG_WARNING, "%s", _sandboxutils_error_get_message (*error));
+  }
+  else if ((h = self->priv->hibernation) != NULL)
+  {
+    // No need to wake a hibernating dialog, its saved configuration is reset
+    SU_TRACE3 (lfcd_state, sfcd_get_id (sfcd), self->priv->state, SFCD_CONFIGURATION);
+    self->priv->state = SFCD_CONFIGURATION;
+
+    if (flags & SFCD_RESET_SELECTION)
+    {
+      g_slist_free_full (h->uris, g_free);
+      h->uris = NULL;
+    }
+
+    if ((flags & SFCD_RESET_CURRENT_NAME) && h->current_name)
+    {
+      g_free (h->current_name);
+      h->current_name = g_strdup ("");
+    }
+
+    if (flags & SFCD_RESET_SHORTCUTS)
+    {
+      g_slist_free_full (h->shortcut_uris, g_free);
+      h->shortcut_uris = NULL;
+    }
+
+    if (flags & SFCD_RESET_FILTERS)
+    {
+      g_slist_free_full (h->filters, g_object_unref);
+      h->filters = NULL;
+      if (h->filter)
+        g_object_unref (h->filter);
+      h->filter = NULL;
+    }
+
+    // The widgets are built with the values when the dialog wakes up
+    if (flags & SFCD_RESET_CHOICES)
+      _lfcd_clear_choices (self, TRUE);
+
+    syslog (LOG_DEBUG,
+            "SandboxFileChooserDialog.Reset: hibernating dialog '%s' ('%s') has been reset (flags %x).\n",
+            sfcd_get_id (sfcd),
+            sfcd_get_dialog_title (sfcd),
+            flags);
+  }
+  else
+  {
+    SU_TRACE3 (lfcd_state, sfcd_get_id (sfcd), self->priv->state, SFCD_CONFIGURATION);
+    self->priv->state = SFCD_CONFIGURATION;
+
+    chooser = GTK_FILE_CHOOSER (self->priv->dialog);
+    action  = gtk_file_chooser_get_action (chooser);
+
+    if (flags & SFCD_RESET_SELECTION)
+    {
+      gtk_file_chooser_unselect_all (chooser);
+      self->priv->selecting = FALSE;
+    }
+
+    // Only save dialogs have a name typed in by the user
+    if ((flags & SFCD_RESET_CURRENT_NAME) &&
+        (action == GTK_FILE_CHOOSER_ACTION_SAVE || action == GTK_FILE_CHOOSER_ACTION_CREATE_FOLDER))
+      gtk_file_chooser_set_current_name (chooser, "");
+
+    if (flags & SFCD_RESET_SHORTCUTS)
+    {
+      shortcuts = gtk_file_chooser_list_shortcut_folder_uris (chooser);
+      for (iter = shortcuts; iter; iter = iter->next)
+        gtk_file_chooser_remove_shortcut_folder_uri (chooser, iter->data, NULL);
+      g_slist_free_full (shortcuts, g_free);
+    }
+
+    if (flags & SFCD_RESET_FILTERS)
+    {
+      filters = gtk_file_chooser_list_filters (chooser);
+      for (iter = filters; iter; iter = iter->next)
+        gtk_file_chooser_remove_filter (chooser, iter->data);
+      g_slist_free (filters);
+    }
+
+    if ((flags & SFCD_RESET_CHOICES) && self->priv->choices)
+    {
+      _lfcd_clear_choices (self, TRUE);
+      _lfcd_install_choices (self);
+    }
+
+    syslog (LOG_DEBUG,
+            "SandboxFileChooserDialog.Reset: dialog '%s' ('%s') has been reset (flags %x) and can be reused.\n",
+            sfcd_get_id (sfcd),
+            sfcd_get_dialog_title (sfcd),
+            flags);
+  }
+
+  g_mutex_unlock (&self->priv->stateMutex);
+}
+
+/**
+ * lfcd_respond:
+ * @dialog: a running #LocalFileChooserDialog
+ * @response_id: the response to give, e.g. %GTK_RESPONSE_ACCEPT
+ * @error: (allow-none): return location for a #GError, or %NULL
+ *
+ * Answers a running @dialog on behalf of the user, as if they had clicked the
+ * button of @response_id. This is meant for servers that are scripted for
+ * benchmarks and automated tests, where there is nobody to use the dialog.
+ *
+ * Since: 0.7
+ **/
+void
+lfcd_respond (SandboxFileChooserDialog  *sfcd,
+              gint                       response_id,
+              GError                   **error)
+{
+  LocalFileChooserDialog *self = LOCAL_FILE_CHOOSER_DIALOG (sfcd);
+  g_return_if_fail (_lfcd_entry_sanity_check (self, error));
+
+  g_mutex_lock (&self->priv->stateMutex);
+
+  if (!sfcd_is_running (sfcd))
+  {
+    g_set_error (error,
+                g_quark_from_static_string (SFCD_ERROR_DOMAIN),
+                SFCD_ERROR_FORBIDDEN_CHANGE,
+                "SandboxFileChooserDialog.Respond: dialog '%s' ('%s') is not running and cannot be responded to.\n",
+                sfcd_get_id (sfcd),
+                sfcd_get_dialog_title (sfcd));
+
+    syslog (LOG_WARNING, "%s", _sandboxutils_error_get_message (*error));
+  }
+  else
+  {
+    syslog (LOG_DEBUG,
+            "SandboxFileChooserDialog.Respond: dialog '%s' ('%s') is being given response %d.\n",
+            sfcd_get_id (sfcd),
+            sfcd_get_dialog_title (sfcd),
+            response_id);
+
+    gtk_dialog_response (GTK_DIALOG (_lfcd_get_dialog (self)), response_id);
+  }
+
+  g_mutex_unlock (&self->priv->stateMutex);
+}
+
+/**
+ * lfcd_hibernate:
+ * @dialog: a #LocalFileChooserDialog
+ *
+ * Destroys the GTK+ widget of an idle @dialog to give its memory back, while
+ * keeping its configuration. The widget is rebuilt transparently the next time
+ * the @dialog is used. This is meant for servers running low on memory.
+ *
+ * Only dialogs in configuration state can hibernate. Dialogs with an extra
+ * widget other than choices or a local transient parent cannot, and neither can dialogs in which
+ * files were selected since they last ran, as GTK+ does not report selections
+ * until the dialog is shown.
+ *
+ * Return value: %TRUE if the widget was destroyed, %FALSE otherwise
+ *
+ * Since: 0.7
+ **/
+gboolean
+lfcd_hibernate (SandboxFileChooserDialog *sfcd)
+{
+  LocalFileChooserDialog *self = LOCAL_FILE_CHOOSER_DIALOG (sfcd);
+  LfcdHibernation        *h;
+  GtkFileChooser         *chooser;
+  gboolean                hibernated = FALSE;
+
+  g_return_val_if_fail (LOCAL_IS_FILE_CHOOSER_DIALOG (self), FALSE);
+
+  g_mutex_lock (&self->priv->stateMutex);
+
+  if (self->priv->hibernation)
+    hibernated = TRUE;
+  else if (self->priv->state == SFCD_CONFIGURATION &&
+           !self->priv->selecting &&
+           !gtk_window_get_transient_for (GTK_WINDOW (self->priv->dialog)) &&
+           gtk_file_chooser_get_extra_widget (GTK_FILE_CHOOSER (self->priv->dialog)) == self->priv->choices_widget)
+  {
+    chooser = GTK_FILE_CHOOSER (self->priv->dialog);
+
+    h = g_malloc0 (sizeof (LfcdHibernation));
+    h->title                     = g_strdup (gtk_window_get_title (GTK_WINDOW (self->priv->dialog)));
+    h->destroy_with_parent       = gtk_window_get_destroy_with_parent (GTK_WINDOW (self->priv->dialog));
+    h->modal                     = gtk_window_get_modal (GTK_WINDOW (self->priv->dialog));
+    h->action                    = gtk_file_chooser_get_action (chooser);
+    h->local_only                = gtk_file_chooser_get_local_only (chooser);
+    h->select_multiple           = gtk_file_chooser_get_select_multiple (chooser);
+    h->show_hidden               = gtk_file_chooser_get_show_hidden (chooser);
+    h->do_overwrite_confirmation = gtk_file_chooser_get_do_overwrite_confirmation (chooser);
+    h->create_folders            = gtk_file_chooser_get_create_folders (chooser);
+    h->current_folder_uri        = gtk_file_chooser_get_current_folder_uri (chooser);
+    h->uris                      = gtk_file_chooser_get_uris (chooser);
+    h->shortcut_uris             = gtk_file_chooser_list_shortcut_folder_uris (chooser);
+    h->filters                   = gtk_file_chooser_list_filters (chooser);
+    h->filter                    = gtk_file_chooser_get_filter (chooser);
+
+    // Filters outlive the widget, along with their compiled matchers
+    g_slist_foreach (h->filters, (GFunc) g_object_ref, NULL);
+    if (h->filter)
+      g_object_ref (h->filter);
+
+    // Only save dialogs have a name typed in by the user
+    if (h->action == GTK_FILE_CHOOSER_ACTION_SAVE ||
+        h->action == GTK_FILE_CHOOSER_ACTION_CREATE_FOLDER)
+      h->current_name = gtk_file_chooser_get_current_name (chooser);
+
+    g_object_unref (self->priv->dialog);
+    gtk_widget_destroy (self->priv->dialog);
+    self->priv->dialog         = NULL;
+    self->priv->choices_widget = NULL;
+    self->priv->preview_area   = NULL;
+    self->priv->hibernation    = h;
+    hibernated              = TRUE;
+
+    syslog (LOG_DEBUG, "SandboxFileChooserDialog.Hibernate: dialog '%s' ('%s')'s widget was destroyed to save memory.\n",
+            self->priv->id, h->title);
+  }
+
+  g_mutex_unlock (&self->priv->stateMutex);
+
+  return hibernated;
+}
+
+/**
+ * lfcd_prepare:
+ * @dialog: a #LocalFileChooserDialog
+ *
+ * Realizes the GTK+ widget of an idle @dialog without showing it, so that its
+ * windows, style and size allocation are ready by the time it runs. This lets
+ * servers do the expensive part of showing a dialog while its client is still
+ * busy configuring it.
+ *
+ * Only dialogs in configuration state that are not hibernating are prepared.
+ * Changes made to the @dialog afterwards are applied to the realized widget as
+ * usual, and lfcd_unprepare() gives the memory back if the @dialog ends up not
+ * being run.
+ *
+ * Return value: %TRUE if the widget was realized by this call, %FALSE otherwise
+ *
+ * Since: 0.7
+ **/
+gboolean
+lfcd_prepare (SandboxFileChooserDialog *sfcd)
+{
+  LocalFileChooserDialog *self = LOCAL_FILE_CHOOSER_DIALOG (sfcd);
+  gboolean                prepared = FALSE;
+
+  g_return_val_if_fail (LOCAL_IS_FILE_CHOOSER_DIALOG (self), FALSE);
+
+  g_mutex_lock (&self->priv->stateMutex);
+
+  if (self->priv->state == SFCD_CONFIGURATION &&
+      !self->priv->hibernation &&
+      !gtk_widget_get_realized (self->priv->dialog))
+  {
+    // Resolves styles and measures the widget tree, then creates its windows
+    gtk_widget_get_preferred_size (self->priv->dialog, NULL, NULL);
+    gtk_widget_realize (self->priv->dialog);
+    prepared = gtk_widget_get_realized (self->priv->dialog);
+
+    syslog (LOG_DEBUG, "SandboxFileChooserDialog.Prepare: dialog '%s' ('%s')'s widget was realized ahead of running.\n",
+            self->priv->id, gtk_window_get_title (GTK_WINDOW (self->priv->dialog)));
+  }
+
+  g_mutex_unlock (&self->priv->stateMutex);
+
+  return prepared;
+}
+
+/**
+ * lfcd_unprepare:
+ * @dialog: a #LocalFileChooserDialog
+ *
+ * Unrealizes the GTK+ widget of a @dialog prepared with lfcd_prepare(), if it
+ * has not been shown since. The widget itself and its configuration are kept.
+ *
+ * Return value: %TRUE if the widget was unrealized, %FALSE otherwise
+ *
+ * Since: 0.7
+ **/
+gboolean
+lfcd_unprepare (SandboxFileChooserDialog *sfcd)
+{
+  LocalFileChooserDialog *self = LOCAL_FILE_CHOOSER_DIALOG (sfcd);
+  gboolean                unprepared = FALSE;
+
+  g_return_val_if_fail (LOCAL_IS_FILE_CHOOSER_DIALOG (self), FALSE);
+
+  g_mutex_lock (&self->priv->stateMutex);
+
+  if (self->priv->state == SFCD_CONFIGURATION &&
+      !self->priv->hibernation &&
+      gtk_widget_get_realized (self->priv->dialog) &&
+      !gtk_widget_get_visible (self->priv->dialog))
+  {
+    gtk_widget_unrealize (self->priv->dialog);
+    unprepared = TRUE;
+
+    syslog (LOG_DEBUG, "SandboxFileChooserDialog.Unprepare: dialog '%s' ('%s')'s widget was unrealized.\n",
+            self->priv->id, gtk_window_get_title (GTK_WINDOW (self->priv->dialog)));
+  }
+
+  g_mutex_unlock (&self->priv->stateMutex);
+
+  return unprepared;
+}
+
+/* Sets the preview surface, with the dialog's mutex held */
+static void
+_lfcd_set_preview (LocalFileChooserDialog  *self,
+                   cairo_surface_t         *surface,
+                   LfcdPreviewFunc          func,
+                   gpointer                 user_data,
+                   GDestroyNotify           notify,
+                   GError                 **error)
+{
+  SandboxFileChooserDialog *sfcd = SANDBOX_FILE_CHOOSER_DIALOG (self);
+
+  if (sfcd_is_running (sfcd))
+  {
+    g_set_error (error,
+                 g_quark_from_static_string (SFCD_ERROR_DOMAIN),
+                 SFCD_ERROR_FORBIDDEN_CHANGE,
+                 "SandboxFileChooserDialog.SetPreview: dialog '%s' ('%s') is already running and cannot be modified.\n",
+                 sfcd_get_id (sfcd),
+                 sfcd_get_dialog_title (sfcd));
+
+      syslog (LOG_WARNING, "%s", _sandboxutils_error_get_message (*error));
+  }
+  else
+  {
+    if (self->priv->state == SFCD_DATA_RETRIEVAL)
+    {
+      syslog (LOG_DEBUG,
+              "SandboxFileChooserDialog.SetPreview: dialog '%s' ('%s') being put back into 'configuration' state.\n",
+              sfcd_get_id (sfcd),
+              sfcd_get_dialog_title (sfcd));
+    }
+
+    self->priv->state = SFCD_CONFIGURATION;
+    _lfcd_get_dialog (self);
+
+    _lfcd_clear_preview (self);
+    if (surface)
+    {
+      self->priv->preview_surface = cairo_surface_reference (surface);
+      self->priv->preview_func    = func;
+      self->priv->preview_data    = user_data;
+      self->priv->preview_notify  = notify;
+    }
+    _lfcd_install_preview (self);
+
+    syslog (LOG_DEBUG,
+            "SandboxFileChooserDialog.SetPreview: dialog '%s' ('%s') %s.\n",
+            sfcd_get_id (sfcd),
+            sfcd_get_dialog_title (sfcd),
+            surface ? "now has a preview area" : "no longer has a preview area");
+
+    return;
+  }
+
+  // The caller's data is ours from now on, even if we cannot use it
+  if (notify)
+    notify (user_data);
+}
+
+/**
+ * lfcd_set_preview_surface:
+ * @dialog: a #LocalFileChooserDialog
+ * @surface: (allow-none): an image #cairo_surface_t to show in the preview
+ *  area, or %NULL to remove the preview area
+ * @func: (allow-none): a #LfcdPreviewFunc told about the files the user
+ *  highlights, or %NULL
+ * @user_data: (allow-none): data to pass to @func
+ * @notify: (allow-none): a function to free @user_data, or %NULL
+ * @error: a placeholder for a #GError
+ *
+ * Gives @dialog a preview area showing @surface, at its size. Whoever draws
+ * into @surface, be it in this process or in a client sharing its memory,
+ * is told what file to preview through @func and reports what changed with
+ * lfcd_damage_preview(). The preview area survives lfcd_hibernate().
+ *
+ * This is meant for servers, applications want sfcd_set_preview_func(). It
+ * can be called from any #SfcdState but %SFCD_RUNNING.
+ *
+ * Since: 0.7
+ **/
+void
+lfcd_set_preview_surface (SandboxFileChooserDialog  *sfcd,
+                          cairo_surface_t           *surface,
+                          LfcdPreviewFunc            func,
+                          gpointer                   user_data,
+                          GDestroyNotify             notify,
+                          GError                   **error)
+{
+  LocalFileChooserDialog *self = LOCAL_FILE_CHOOSER_DIALOG (sfcd);
+  g_return_if_fail (_lfcd_entry_sanity_check (self, error));
+  g_return_if_fail (surface == NULL || cairo_surface_get_type (surface) == CAIRO_SURFACE_TYPE_IMAGE);
+
+  g_mutex_lock (&self->priv->stateMutex);
+  _lfcd_set_preview (self, surface, func, user_data, notify, error);
+  g_mutex_unlock (&self->priv->stateMutex);
+}
+
+/**
+ * lfcd_set_validate_func:
+ * @dialog: a #LocalFileChooserDialog
+ * @func: (allow-none): a #LfcdValidateFunc vetting the files the user
+ *  accepts, or %NULL to accept any
+ * @user_data: (allow-none): data to pass to @func
+ * @notify: (allow-none): a function to free @user_data, or %NULL
+ *
+ * Makes @dialog check the files the user chose with @func when they are
+ * accepted, and refuse to return them unless @func agrees. This lets a
+ * server enforce a policy on what may leave it, e.g. no device files. The
+ * validate function survives lfcd_hibernate() and sfcd_reset().
+ *
+ * This is meant for servers. Must be called from the thread running GTK+.
+ *
+ * Since: 0.7
+ **/
+void
+lfcd_set_validate_func (SandboxFileChooserDialog  *sfcd,
+                        LfcdValidateFunc           func,
+                        gpointer                   user_data,
+                        GDestroyNotify             notify)
+{
+  LocalFileChooserDialog *self = LOCAL_FILE_CHOOSER_DIALOG (sfcd);
+  g_return_if_fail (LOCAL_IS_FILE_CHOOSER_DIALOG (self));
+
+  if (self->priv->validate_notify)
+    self->priv->validate_notify (self->priv->validate_data);
+
+  self->priv->validate_func   = func;
+  self->priv->validate_data   = user_data;
+  self->priv->validate_notify = notify;
+}
+
+/**
+ * lfcd_damage_preview:
+ * @dialog: a #LocalFileChooserDialog
+ * @active: whether there is a preview to show
+ * @rects: (allow-none) (array length=n_rects): the parts of the preview
+ *  surface that were drawn, or %NULL if it was drawn all over
+ * @n_rects: the number of rectangles in @rects
+ *
+ * Repaints the parts of the preview area of @dialog that changed since the
+ * last call, and shows the preview area if @active or hides it otherwise.
+ * Parts outside of the preview surface are ignored. Must be called from the
+ * thread running GTK+.
+ *
+ * Since: 0.7
+ **/
+void
+lfcd_damage_preview (SandboxFileChooserDialog     *sfcd,
+                     gboolean                      active,
+                     const cairo_rectangle_int_t  *rects,
+                     guint                         n_rects)
+{
+  LocalFileChooserDialog *self = LOCAL_FILE_CHOOSER_DIALOG (sfcd);
+  cairo_rectangle_int_t   bounds = { 0, 0, 0, 0 };
+  cairo_rectangle_int_t   damage;
+  guint                   i;
+
+  g_return_if_fail (LOCAL_IS_FILE_CHOOSER_DIALOG (self));
+
+  // No locking: GTK+ may ask for a preview while the mutex is held, and the
+  // preview area only ever changes in the thread running GTK+, like this call
+  if (self->priv->preview_surface && self->priv->preview_area)
+  {
+    if (active && rects)
+    {
+      bounds.width  = cairo_image_surface_get_width (self->priv->preview_surface);
+      bounds.height = cairo_image_surface_get_height (self->priv->preview_surface);
+
+      for (i = 0; i < n_rects; i++)
+      {
+        if (!gdk_rectangle_intersect (&rects[i], &bounds, &damage))
+          continue;
+
+        cairo_surface_mark_dirty_rectangle (self->priv->preview_surface,
+                                            damage.x, damage.y, damage.width, damage.height);
+        gtk_widget_queue_draw_area (self->priv->preview_area,
+                                    damage.x, damage.y, damage.width, damage.height);
+      }
+    }
+    else if (active)
+    {
+      cairo_surface_mark_dirty (self->priv->preview_surface);
+      gtk_widget_queue_draw (self->priv->preview_area);
+    }
+
+    gtk_file_chooser_set_preview_widget_active (GTK_FILE_CHOOSER (self->priv->dialog), active);
+  }
+}
+
+static void
+lfcd_set_extra_widget (SandboxFileChooserDialog  *sfcd,
+                       GtkWidget                 *widget,
+                       GError                   **error)
+{
+  LocalFileChooserDialog *self = LOCAL_FILE_CHOOSER_DIALOG (sfcd);
+  g_return_if_fail (_lfcd_entry_sanity_check (self, error));
+
+  g_mutex_lock (&self->priv->stateMutex);
+
+  // An extra widget replaces the choices
+  _lfcd_clear_choices (self, FALSE);
+  self->priv->choices_widget = NULL;
+
+  gtk_file_chooser_set_extra_widget (GTK_FILE_CHOOSER (_lfcd_get_dialog (self)), widget);
+
+  syslog (LOG_DEBUG,
+          "SandboxFileChooserDialog.SetExtraWidget: dialog '%s' ('%s') has been assigned a new extra widget.\n",
+          sfcd_get_id (sfcd),
+          sfcd_get_dialog_title (sfcd));
+
+  g_mutex_unlock (&self->priv->stateMutex);
+}
+
+static GtkWidget *
+lfcd_get_extra_widget (SandboxFileChooserDialog *sfcd,
+                       GError                  **error)
+{
+  LocalFileChooserDialog *self = LOCAL_FILE_CHOOSER_DIALOG (sfcd);
+
+  g_return_val_if_fail (_lfcd_entry_sanity_check (self, error), NULL);
+
+  g_mutex_lock (&self->priv->stateMutex);
+
+  GtkWidget *result = gtk_file_chooser_get_extra_widget (GTK_FILE_CHOOSER (_lfcd_get_dialog (self)));
+
+  g_mutex_unlock (&self->priv->stateMutex);
+
+  return result;
+}
+
+static void
+lfcd_set_choices (SandboxFileChooserDialog  *sfcd,
+                  GVariant                  *choices,
+                  GError                   **error)
+{
+  LocalFileChooserDialog *self = LOCAL_FILE_CHOOSER_DIALOG (sfcd);
+  g_return_if_fail (_lfcd_entry_sanity_check (self, error));
+
+  // Nothing in the description can make building the widgets fail later on
+  if (choices)
+  {
+    g_variant_ref_sink (choices);
+
+    if (!_sandboxutils_choices_validate (choices, error))
+    {
+      syslog (LOG_WARNING, "%s", _sandboxutils_error_get_message (*error));
+      g_variant_unref (choices);
+      return;
+    }
+  }
+
+  g_mutex_lock (&self->priv->stateMutex);
+
+  if (sfcd_is_running (sfcd))
+  {
+    g_set_error (error,
+                 g_quark_from_static_string (SFCD_ERROR_DOMAIN),
+                 SFCD_ERROR_FORBIDDEN_CHANGE,
+                 "SandboxFileChooserDialog.SetChoices: dialog '%s' ('%s') is already running and cannot be modified.\n",
+                 sfcd_get_id (sfcd),
+                 sfcd_get_dialog_title (sfcd));
+
+      syslog (LOG_WARNING, "%s", _sandboxutils_error_get_message (*error));
+  }
+  else
+  {
+    if (self->priv->state == SFCD_DATA_RETRIEVAL)
+    {
+      syslog (LOG_DEBUG,
+              "SandboxFileChooserDialog.SetChoices: dialog '%s' ('%s') being put back into 'configuration' state.\n",
+              sfcd_get_id (sfcd),
+              sfcd_get_dialog_title (sfcd));
+    }
+
+    self->priv->state = SFCD_CONFIGURATION;
+    _lfcd_get_dialog (self);
+
+    // An empty description removes the choices, like %NULL
+    _lfcd_clear_choices (self, FALSE);
+    if (choices && g_variant_n_children (choices))
+      self->priv->choices = g_variant_ref (choices);
+    _lfcd_clear_choices (self, TRUE);
+    _lfcd_install_choices (self);
+
+    syslog (LOG_DEBUG,
+            "SandboxFileChooserDialog.SetChoices: dialog '%s' ('%s') now has %" G_GSIZE_FORMAT " rows of choices.\n",
+            sfcd_get_id (sfcd),
+            sfcd_get_dialog_title (sfcd),
+            self->priv->choices ? g_variant_n_children (self->priv->choices) : 0);
+  }
+
+  g_mutex_unlock (&self->priv->stateMutex);
+
+  if (choices)
+    g_variant_unref (choices);
+}
+
+static GVariant *
+lfcd_get_choice_values (SandboxFileChooserDialog  *sfcd,
+                        GError                   **error)
+{
+  LocalFileChooserDialog *self = LOCAL_FILE_CHOOSER_DIALOG (sfcd);
+  GVariant               *values;
+
+  g_return_val_if_fail (_lfcd_entry_sanity_check (self, error), NULL);
+
+  // Values are kept up to date as the user changes them, even while running
+  g_mutex_lock (&self->priv->stateMutex);
+  values = g_variant_ref_sink (_sandboxutils_choices_to_variant (self->priv->choice_values));
+  g_mutex_unlock (&self->priv->stateMutex);
+
+  return values;
+}
+
+static void
+_lfcd_preview_renderer_free (gpointer data)
+{
+  LfcdPreviewRenderer *renderer = data;
+
+  if (renderer->notify)
+    renderer->notify (renderer->user_data);
+
+  g_free (renderer);
+}
+
+/* Has the application draw the preview of a file, for in-process dialogs */
+static void
+_lfcd_render_preview (SandboxFileChooserDialog *sfcd,
+                      const gchar              *filename,
+                      gpointer                  user_data)
+{
+  LocalFileChooserDialog *self     = LOCAL_FILE_CHOOSER_DIALOG (sfcd);
+  LfcdPreviewRenderer    *renderer = user_data;
+  cairo_surface_t        *surface  = self->priv->preview_surface;
+  gboolean                drawn    = FALSE;
+  struct stat             st;
+  cairo_t                *cr;
+  gint                    fd;
+
+  // Not blocking on FIFOs, which are not worth a preview anyway
+  if (filename && (fd = open (filename, O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NONBLOCK)) != -1)
+  {
+    if (fstat (fd, &st) == 0 && S_ISREG (st.st_mode))
+    {
+      cr = cairo_create (surface);
+      cairo_set_operator (cr, CAIRO_OPERATOR_CLEAR);
+      cairo_paint (cr);
+      cairo_set_operator (cr, CAIRO_OPERATOR_OVER);
+
+      drawn = renderer->func (sfcd, fd, cr,
+                              cairo_image_surface_get_width (surface),
+                              cairo_image_surface_get_height (surface),
+                              renderer->user_data);
+      cairo_destroy (cr);
+    }
+
+    close (fd);
+  }
+
+  lfcd_damage_preview (sfcd, drawn, NULL, 0);
+}
+
+static void
+lfcd_set_preview_func (SandboxFileChooserDialog  *sfcd,
+                       gint                       width,
+                       gint                       height,
+                       SfcdPreviewFunc            func,
+                       gpointer                   user_data,
+                       GDestroyNotify             notify,
+                       GError                   **error)
+{
+  LocalFileChooserDialog *self = LOCAL_FILE_CHOOSER_DIALOG (sfcd);
+  LfcdPreviewRenderer    *renderer = NULL;
+  cairo_surface_t        *surface  = NULL;
+
+  g_return_if_fail (_lfcd_entry_sanity_check (self, error));
+
+  if (func)
+  {
+    if (!_sandboxutils_shm_check_image (width, height,
+                                        cairo_format_stride_for_width (CAIRO_FORMAT_ARGB32, width),
+                                        error))
+    {
+      syslog (LOG_WARNING, "%s", _sandboxutils_error_get_message (*error));
+      if (notify)
+        notify (user_data);
+      return;
+    }
+
+    surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, width, height);
+
+    renderer = g_malloc (sizeof (LfcdPreviewRenderer));
+    renderer->func      = func;
+    renderer->user_data = user_data;
+    renderer->notify    = notify;
   }
 
+  g_mutex_lock (&self->priv->stateMutex);
+
+  if (surface)
+    _lfcd_set_preview (self, surface, _lfcd_render_preview, renderer, _lfcd_preview_renderer_free, error);
+  else
+    _lfcd_set_preview (self, NULL, NULL, NULL, NULL, error);
+
   g_mutex_unlock (&self->priv->stateMutex);
+
+  if (surface)
+    cairo_surface_destroy (surface);
 }
 
-static void
-lfcd_set_extra_widget (SandboxFileChooserDialog  *sfcd,
-                       GtkWidget                 *widget,
-                       GError                   **error)
+/* Local dialogs run in the application, which can read the files anyway */
+static SfcdThumbnails *
+lfcd_get_thumbnails (SandboxFileChooserDialog  *sfcd,
+                     gint                       size,
+                     GError                   **error)
 {
   LocalFileChooserDialog *self = LOCAL_FILE_CHOOSER_DIALOG (sfcd);
-  g_return_if_fail (_lfcd_entry_sanity_check (self, error));
+  SfcdThumbnails         *thumbnails;
+  cairo_surface_t        *surface;
+  GdkPixbuf              *pixbuf;
+  GSList                 *uris, *iter;
+  GError                 *tmp_error = NULL;
+  gchar                  *filename;
+  guint                   n = 0;
+  cairo_t                *cr;
 
-  g_mutex_lock (&self->priv->stateMutex);
+  g_return_val_if_fail (_lfcd_entry_sanity_check (self, error), NULL);
+
+  uris = sfcd_get_uris (sfcd, &tmp_error);
+  if (tmp_error)
+  {
+    g_propagate_error (error, tmp_error);
+    return NULL;
+  }
 
-  gtk_file_chooser_set_extra_widget (GTK_FILE_CHOOSER (self->priv->dialog), widget);
+  thumbnails = _sandboxutils_thumbnails_new ();
 
-  syslog (LOG_DEBUG,
-          "SandboxFileChooserDialog.SetExtraWidget: dialog '%s' ('%s') has been assigned a new extra widget.\n",
-          sfcd_get_id (sfcd),
-          sfcd_get_dialog_title (sfcd));
+  for (iter = uris; iter && n < SANDBOXUTILS_THUMBNAILS_MAX_FILES; iter = iter->next, n++)
+  {
+    surface  = NULL;
+    filename = g_filename_from_uri (iter->data, NULL, NULL);
+    pixbuf   = filename ? gdk_pixbuf_new_from_file_at_scale (filename, size, size, TRUE, NULL) : NULL;
 
-  g_mutex_unlock (&self->priv->stateMutex);
+    if (pixbuf)
+    {
+      surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+                                            gdk_pixbuf_get_width (pixbuf),
+                                            gdk_pixbuf_get_height (pixbuf));
+      cr = cairo_create (surface);
+      gdk_cairo_set_source_pixbuf (cr, pixbuf, 0, 0);
+      cairo_paint (cr);
+      cairo_destroy (cr);
+      g_object_unref (pixbuf);
+    }
+
+    _sandboxutils_thumbnails_add (thumbnails, iter->data, surface);
+    g_free (filename);
+  }
+
+  g_slist_free_full (uris, g_free);
+
+  return thumbnails;
 }
 
-static GtkWidget *
-lfcd_get_extra_widget (SandboxFileChooserDialog *sfcd,
-                       GError                  **error)
+/* Local dialogs query files one by one, as the application would have */
+static GVariant *
+lfcd_get_selection_info (SandboxFileChooserDialog  *sfcd,
+                         const gchar               *attributes,
+                         GError                   **error)
 {
   LocalFileChooserDialog *self = LOCAL_FILE_CHOOSER_DIALOG (sfcd);
+  GVariantBuilder         builder;
+  GSList                 *uris, *iter;
+  GError                 *tmp_error = NULL;
 
   g_return_val_if_fail (_lfcd_entry_sanity_check (self, error), NULL);
 
-  g_mutex_lock (&self->priv->stateMutex);
+  if (!_sandboxutils_file_info_check_attributes (attributes, error))
+    return NULL;
+
+  uris = sfcd_get_uris (sfcd, &tmp_error);
+  if (tmp_error)
+  {
+    g_propagate_error (error, tmp_error);
+    return NULL;
+  }
 
-  GtkWidget *result = gtk_file_chooser_get_extra_widget (GTK_FILE_CHOOSER (self->priv->dialog));
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(sa{sv})"));
+  for (iter = uris; iter; iter = iter->next)
+    g_variant_builder_add_value (&builder, _sandboxutils_file_info_query (iter->data, attributes, NULL));
 
-  g_mutex_unlock (&self->priv->stateMutex);
+  g_slist_free_full (uris, g_free);
 
-  return result;
+  return g_variant_ref_sink (g_variant_builder_end (&builder));
 }
 
 static void
@@ -981,7 +2345,8 @@ lfcd_select_filename (SandboxFileChooserDialog  *sfcd,
     }
 
     self->priv->state = SFCD_CONFIGURATION;
-    gtk_file_chooser_select_filename (GTK_FILE_CHOOSER (self->priv->dialog), filename);
+    gtk_file_chooser_select_filename (GTK_FILE_CHOOSER (_lfcd_get_dialog (self)), filename);
+    self->priv->selecting = TRUE;
 
     syslog (LOG_DEBUG,
             "SandboxFileChooserDialog.SelectFilename: dialog '%s' ('%s')'s file named '%s' has been selected (provided it exists).\n",
@@ -1026,7 +2391,7 @@ lfcd_unselect_filename (SandboxFileChooserDialog  *sfcd,
     }
 
     self->priv->state = SFCD_CONFIGURATION;
-    gtk_file_chooser_unselect_filename (GTK_FILE_CHOOSER (self->priv->dialog), filename);
+    gtk_file_chooser_unselect_filename (GTK_FILE_CHOOSER (_lfcd_get_dialog (self)), filename);
 
     syslog (LOG_DEBUG,
             "SandboxFileChooserDialog.UnselectFilename: dialog '%s' ('%s')'s file named '%s' has been unselected (provided it exists).\n",
@@ -1068,7 +2433,8 @@ lfcd_select_all (SandboxFileChooserDialog  *sfcd,
     }
 
     self->priv->state = SFCD_CONFIGURATION;
-    gtk_file_chooser_select_all (GTK_FILE_CHOOSER (self->priv->dialog));
+    gtk_file_chooser_select_all (GTK_FILE_CHOOSER (_lfcd_get_dialog (self)));
+    self->priv->selecting = TRUE;
 
     syslog (LOG_DEBUG,
             "SandboxFileChooserDialog.SelectAll: dialog '%s' ('%s')'s current folder has been selected.\n",
@@ -1110,7 +2476,7 @@ lfcd_unselect_all (SandboxFileChooserDialog  *sfcd,
     }
 
     self->priv->state = SFCD_CONFIGURATION;
-    gtk_file_chooser_unselect_all (GTK_FILE_CHOOSER (self->priv->dialog));
+    gtk_file_chooser_unselect_all (GTK_FILE_CHOOSER (_lfcd_get_dialog (self)));
 
     syslog (LOG_DEBUG,
             "SandboxFileChooserDialog.UnselectAll: dialog '%s' ('%s')'s current folder has been unselected.\n",
@@ -1153,7 +2519,8 @@ lfcd_select_uri (SandboxFileChooserDialog  *sfcd,
     }
 
     self->priv->state = SFCD_CONFIGURATION;
-    gtk_file_chooser_select_uri (GTK_FILE_CHOOSER (self->priv->dialog), uri);
+    gtk_file_chooser_select_uri (GTK_FILE_CHOOSER (_lfcd_get_dialog (self)), uri);
+    self->priv->selecting = TRUE;
 
     syslog (LOG_DEBUG,
             "SandboxFileChooserDialog.SelectUri: dialog '%s' ('%s')'s uri '%s' has been selected (provided it exists).\n",
@@ -1198,7 +2565,7 @@ lfcd_unselect_uri (SandboxFileChooserDialog  *sfcd,
     }
 
     self->priv->state = SFCD_CONFIGURATION;
-    gtk_file_chooser_unselect_uri (GTK_FILE_CHOOSER (self->priv->dialog), uri);
+    gtk_file_chooser_unselect_uri (GTK_FILE_CHOOSER (_lfcd_get_dialog (self)), uri);
 
     syslog (LOG_DEBUG,
             "SandboxFileChooserDialog.UnselectUri: dialog '%s' ('%s')'s uri '%s' has been unselected (provided it exists).\n",
@@ -1243,7 +2610,7 @@ lfcd_set_action (SandboxFileChooserDialog  *sfcd,
     }
 
     self->priv->state = SFCD_CONFIGURATION;
-    gtk_file_chooser_set_action (GTK_FILE_CHOOSER (self->priv->dialog), action);
+    gtk_file_chooser_set_action (GTK_FILE_CHOOSER (_lfcd_get_dialog (self)), action);
 
     syslog (LOG_DEBUG,
             "SandboxFileChooserDialog.SetAction: dialog '%s' ('%s') now has action '%d'.\n",
@@ -1279,7 +2646,7 @@ lfcd_get_action (SandboxFileChooserDialog *sfcd,
   }
   else
   {
-    result = gtk_file_chooser_get_action (GTK_FILE_CHOOSER (self->priv->dialog));
+    result = gtk_file_chooser_get_action (GTK_FILE_CHOOSER (_lfcd_get_dialog (self)));
 
     syslog (LOG_DEBUG,
             "SandboxFileChooserDialog.GetAction: dialog '%s' ('%s') has action '%d'.\n",
@@ -1326,7 +2693,7 @@ lfcd_set_local_only (SandboxFileChooserDialog  *sfcd,
     }
 
     self->priv->state = SFCD_CONFIGURATION;
-    gtk_file_chooser_set_local_only (GTK_FILE_CHOOSER (self->priv->dialog), local_only);
+    gtk_file_chooser_set_local_only (GTK_FILE_CHOOSER (_lfcd_get_dialog (self)), local_only);
 
     syslog (LOG_DEBUG,
             "SandboxFileChooserDialog.SetLocalOnly: dialog '%s' ('%s') now has local-only '%s'.\n",
@@ -1362,7 +2729,7 @@ lfcd_get_local_only (SandboxFileChooserDialog  *sfcd,
   }
   else
   {
-    result = gtk_file_chooser_get_local_only (GTK_FILE_CHOOSER (self->priv->dialog));
+    result = gtk_file_chooser_get_local_only (GTK_FILE_CHOOSER (_lfcd_get_dialog (self)));
 
     syslog (LOG_DEBUG,
             "SandboxFileChooserDialog.GetLocalOnly: dialog '%s' ('%s') has local-only '%s'.\n",
@@ -1409,7 +2776,7 @@ lfcd_set_select_multiple (SandboxFileChooserDialog *sfcd,
     }
 
     self->priv->state = SFCD_CONFIGURATION;
-    gtk_file_chooser_set_select_multiple (GTK_FILE_CHOOSER (self->priv->dialog), select_multiple);
+    gtk_file_chooser_set_select_multiple (GTK_FILE_CHOOSER (_lfcd_get_dialog (self)), select_multiple);
 
     syslog (LOG_DEBUG,
             "SandboxFileChooserDialog.SetSelectMultiple: dialog '%s' ('%s') now has select-multiple '%s'.\n",
@@ -1445,7 +2812,7 @@ lfcd_get_select_multiple (SandboxFileChooserDialog  *sfcd,
   }
   else
   {
-    result = gtk_file_chooser_get_select_multiple (GTK_FILE_CHOOSER (self->priv->dialog));
+    result = gtk_file_chooser_get_select_multiple (GTK_FILE_CHOOSER (_lfcd_get_dialog (self)));
 
     syslog (LOG_DEBUG,
             "SandboxFileChooserDialog.GetSelectMultiple: dialog '%s' ('%s') has select-multiple '%s'.\n",
@@ -1492,7 +2859,7 @@ lfcd_set_show_hidden (SandboxFileChooserDialog  *sfcd,
     }
 
     self->priv->state = SFCD_CONFIGURATION;
-    gtk_file_chooser_set_show_hidden (GTK_FILE_CHOOSER (self->priv->dialog), show_hidden);
+    gtk_file_chooser_set_show_hidden (GTK_FILE_CHOOSER (_lfcd_get_dialog (self)), show_hidden);
 
     syslog (LOG_DEBUG,
             "SandboxFileChooserDialog.SetShowHidden: dialog '%s' ('%s') now has show-hidden '%s'.\n",
@@ -1528,7 +2895,7 @@ lfcd_get_show_hidden (SandboxFileChooserDialog *sfcd,
   }
   else
   {
-    result = gtk_file_chooser_get_show_hidden (GTK_FILE_CHOOSER (self->priv->dialog));
+    result = gtk_file_chooser_get_show_hidden (GTK_FILE_CHOOSER (_lfcd_get_dialog (self)));
 
     syslog (LOG_DEBUG,
             "SandboxFileChooserDialog.GetShowHidden: dialog '%s' ('%s') has show-hidden '%s'.\n",
@@ -1575,7 +2942,7 @@ lfcd_set_do_overwrite_confirmation (SandboxFileChooserDialog  *sfcd,
     }
 
     self->priv->state = SFCD_CONFIGURATION;
-    gtk_file_chooser_set_do_overwrite_confirmation (GTK_FILE_CHOOSER (self->priv->dialog), do_overwrite_confirmation);
+    gtk_file_chooser_set_do_overwrite_confirmation (GTK_FILE_CHOOSER (_lfcd_get_dialog (self)), do_overwrite_confirmation);
 
     syslog (LOG_DEBUG,
             "SandboxFileChooserDialog.SetDoOverwriteConfirmation: dialog '%s' ('%s') now has show-hidden '%s'.\n",
@@ -1611,7 +2978,7 @@ lfcd_get_do_overwrite_confirmation (SandboxFileChooserDialog  *sfcd,
   }
   else
   {
-    result = gtk_file_chooser_get_do_overwrite_confirmation (GTK_FILE_CHOOSER (self->priv->dialog));
+    result = gtk_file_chooser_get_do_overwrite_confirmation (GTK_FILE_CHOOSER (_lfcd_get_dialog (self)));
 
     syslog (LOG_DEBUG,
             "SandboxFileChooserDialog.GetDoOverwriteConfirmation: dialog '%s' ('%s') has show-hidden '%s'.\n",
@@ -1658,7 +3025,7 @@ lfcd_set_create_folders (SandboxFileChooserDialog  *sfcd,
     }
 
     self->priv->state = SFCD_CONFIGURATION;
-    gtk_file_chooser_set_create_folders (GTK_FILE_CHOOSER (self->priv->dialog), create_folders);
+    gtk_file_chooser_set_create_folders (GTK_FILE_CHOOSER (_lfcd_get_dialog (self)), create_folders);
 
     syslog (LOG_DEBUG,
             "SandboxFileChooserDialog.SetCreateFolders: dialog '%s' ('%s') now has show-hidden '%s'.\n",
@@ -1694,7 +3061,7 @@ lfcd_get_create_folders (SandboxFileChooserDialog  *sfcd,
   }
   else
   {
-    result = gtk_file_chooser_get_create_folders (GTK_FILE_CHOOSER (self->priv->dialog));
+    result = gtk_file_chooser_get_create_folders (GTK_FILE_CHOOSER (_lfcd_get_dialog (self)));
 
     syslog (LOG_DEBUG,
             "SandboxFileChooserDialog.GetCreateFolders: dialog '%s' ('%s') has show-hidden '%s'.\n",
@@ -1741,7 +3108,7 @@ lfcd_set_current_name (SandboxFileChooserDialog  *sfcd,
     }
 
     self->priv->state = SFCD_CONFIGURATION;
-    gtk_file_chooser_set_current_name (GTK_FILE_CHOOSER (self->priv->dialog), name);
+    gtk_file_chooser_set_current_name (GTK_FILE_CHOOSER (_lfcd_get_dialog (self)), name);
 
     syslog (LOG_DEBUG,
             "SandboxFileChooserDialog.SetCurrentName: dialog '%s' ('%s')'s typed name is now '%s'.\n",
@@ -1786,7 +3153,8 @@ lfcd_set_filename (SandboxFileChooserDialog  *sfcd,
     }
 
     self->priv->state = SFCD_CONFIGURATION;
-    gtk_file_chooser_set_filename (GTK_FILE_CHOOSER (self->priv->dialog), filename);
+    gtk_file_chooser_set_filename (GTK_FILE_CHOOSER (_lfcd_get_dialog (self)), filename);
+    self->priv->selecting = TRUE;
 
     syslog (LOG_DEBUG,
             "SandboxFileChooserDialog.SetFilename: dialog '%s' ('%s')'s current file name now is '%s'.\n",
@@ -1831,7 +3199,7 @@ lfcd_set_current_folder (SandboxFileChooserDialog  *sfcd,
     }
 
     self->priv->state = SFCD_CONFIGURATION;
-    gtk_file_chooser_set_current_folder (GTK_FILE_CHOOSER (self->priv->dialog), filename);
+    gtk_file_chooser_set_current_folder (GTK_FILE_CHOOSER (_lfcd_get_dialog (self)), filename);
 
     syslog (LOG_DEBUG,
             "SandboxFileChooserDialog.SetCurrentFolder: dialog '%s' ('%s')'s current folder now is '%s'.\n",
@@ -1876,7 +3244,8 @@ lfcd_set_uri (SandboxFileChooserDialog  *sfcd,
     }
 
     self->priv->state = SFCD_CONFIGURATION;
-    gtk_file_chooser_set_uri (GTK_FILE_CHOOSER (self->priv->dialog), uri);
+    gtk_file_chooser_set_uri (GTK_FILE_CHOOSER (_lfcd_get_dialog (self)), uri);
+    self->priv->selecting = TRUE;
 
     syslog (LOG_DEBUG,
             "SandboxFileChooserDialog.SetUri: dialog '%s' ('%s')'s current file uri now is '%s'.\n",
@@ -1921,7 +3290,7 @@ lfcd_set_current_folder_uri (SandboxFileChooserDialog  *sfcd,
     }
 
     self->priv->state = SFCD_CONFIGURATION;
-    gtk_file_chooser_set_current_folder_uri (GTK_FILE_CHOOSER (self->priv->dialog), uri);
+    gtk_file_chooser_set_current_folder_uri (GTK_FILE_CHOOSER (_lfcd_get_dialog (self)), uri);
 
     syslog (LOG_DEBUG,
             "SandboxFileChooserDialog.SetCurrentFolderUri: dialog '%s' ('%s')'s current folder uri now is '%s'.\n",
@@ -1968,7 +3337,7 @@ lfcd_add_shortcut_folder (SandboxFileChooserDialog  *sfcd,
     }
 
     self->priv->state = SFCD_CONFIGURATION;
-    succeeded = gtk_file_chooser_add_shortcut_folder (GTK_FILE_CHOOSER (self->priv->dialog), folder, error);
+    succeeded = gtk_file_chooser_add_shortcut_folder (GTK_FILE_CHOOSER (_lfcd_get_dialog (self)), folder, error);
 
     if (succeeded)
       syslog (LOG_DEBUG,
@@ -2028,7 +3397,7 @@ lfcd_remove_shortcut_folder (SandboxFileChooserDialog  *sfcd,
     }
 
     self->priv->state = SFCD_CONFIGURATION;
-    succeeded = gtk_file_chooser_remove_shortcut_folder (GTK_FILE_CHOOSER (self->priv->dialog), folder, error);
+    succeeded = gtk_file_chooser_remove_shortcut_folder (GTK_FILE_CHOOSER (_lfcd_get_dialog (self)), folder, error);
 
     if (succeeded)
       syslog (LOG_DEBUG,
@@ -2076,7 +3445,7 @@ lfcd_list_shortcut_folders (SandboxFileChooserDialog *sfcd,
   }
   else
   {
-    list = gtk_file_chooser_list_shortcut_folders (GTK_FILE_CHOOSER (self->priv->dialog));
+    list = gtk_file_chooser_list_shortcut_folders (GTK_FILE_CHOOSER (_lfcd_get_dialog (self)));
 
     syslog (LOG_DEBUG,
             "SandboxFileChooserDialog.ListShortcutFolders: dialog '%s' ('%s')'s list of shortcuts contains %u elements.\n",
@@ -2125,7 +3494,7 @@ lfcd_add_shortcut_folder_uri (SandboxFileChooserDialog  *sfcd,
     }
 
     self->priv->state = SFCD_CONFIGURATION;
-    succeeded = gtk_file_chooser_add_shortcut_folder_uri (GTK_FILE_CHOOSER (self->priv->dialog), uri, error);
+    succeeded = gtk_file_chooser_add_shortcut_folder_uri (GTK_FILE_CHOOSER (_lfcd_get_dialog (self)), uri, error);
 
     if (succeeded)
       syslog (LOG_DEBUG,
@@ -2185,7 +3554,7 @@ lfcd_remove_shortcut_folder_uri (SandboxFileChooserDialog *sfcd,
     }
 
     self->priv->state = SFCD_CONFIGURATION;
-    succeeded = gtk_file_chooser_remove_shortcut_folder_uri (GTK_FILE_CHOOSER (self->priv->dialog), uri, error);
+    succeeded = gtk_file_chooser_remove_shortcut_folder_uri (GTK_FILE_CHOOSER (_lfcd_get_dialog (self)), uri, error);
 
     if (succeeded)
       syslog (LOG_DEBUG,
@@ -2233,7 +3602,7 @@ lfcd_list_shortcut_folder_uris (SandboxFileChooserDialog *sfcd,
   }
   else
   {
-    list = gtk_file_chooser_list_shortcut_folder_uris (GTK_FILE_CHOOSER (self->priv->dialog));
+    list = gtk_file_chooser_list_shortcut_folder_uris (GTK_FILE_CHOOSER (_lfcd_get_dialog (self)));
 
     syslog (LOG_DEBUG,
             "SandboxFileChooserDialog.ListShortcutFoldersUri: dialog '%s' ('%s')'s list of shortcuts contains %u elements.\n",
@@ -2247,6 +3616,331 @@ lfcd_list_shortcut_folder_uris (SandboxFileChooserDialog *sfcd,
   return list;
 }
 
+static gboolean
+_lfcd_filter_func (const GtkFileFilterInfo *info,
+                   gpointer                 data)
+{
+  return _sandboxutils_filter_match (data, info->filename, info->display_name);
+}
+
+/* The filter of @chooser named @name, or NULL */
+static GtkFileFilter *
+_lfcd_find_filter (GtkFileChooser *chooser,
+                   const gchar    *name)
+{
+  GtkFileFilter *found = NULL;
+  GSList        *filters;
+  GSList        *iter;
+
+  filters = gtk_file_chooser_list_filters (chooser);
+  for (iter = filters; iter && !found; iter = iter->next)
+    if (g_strcmp0 (gtk_file_filter_get_name (iter->data), name) == 0)
+      found = iter->data;
+  g_slist_free (filters);
+
+  return found;
+}
+
+static gboolean
+lfcd_add_filter (SandboxFileChooserDialog *sfcd,
+                 const gchar               *name,
+                 const gchar * const       *patterns,
+                 const gchar * const       *mime_types,
+                 GError                   **error)
+{
+  LocalFileChooserDialog *self = LOCAL_FILE_CHOOSER_DIALOG (sfcd);
+  g_return_val_if_fail (_lfcd_entry_sanity_check (self, error), FALSE);
+
+  GtkFileChooser *chooser;
+  GtkFileFilter  *filter;
+  gboolean        succeeded = FALSE;
+
+  g_mutex_lock (&self->priv->stateMutex);
+
+  if (sfcd_is_running (sfcd))
+  {
+    g_set_error (error,
+                 g_quark_from_static_string (SFCD_ERROR_DOMAIN),
+                 SFCD_ERROR_FORBIDDEN_CHANGE,
+                 "SandboxFileChooserDialog.AddFilter: dialog '%s' ('%s') is already running and cannot be modified (parameter was '%s').\n",
+                 sfcd_get_id (sfcd),
+                 sfcd_get_dialog_title (sfcd),
+                 name);
+
+      syslog (LOG_WARNING, "%s", _sandboxutils_error_get_message (*error));
+  }
+  else
+  {
+    if (self->priv->state == SFCD_DATA_RETRIEVAL)
+    {
+      syslog (LOG_DEBUG,
+              "SandboxFileChooserDialog.AddFilter: dialog '%s' ('%s') being put back into 'configuration' state.\n",
+              sfcd_get_id (sfcd),
+              sfcd_get_dialog_title (sfcd));
+    }
+
+    self->priv->state = SFCD_CONFIGURATION;
+    chooser = GTK_FILE_CHOOSER (_lfcd_get_dialog (self));
+
+    // Filters are told apart by their name, which clients see
+    if (name == NULL || *name == '\0' || _lfcd_find_filter (chooser, name))
+    {
+      g_set_error (error,
+                   g_quark_from_static_string (SFCD_ERROR_DOMAIN),
+                   SFCD_ERROR_TOOLKIT_CALL_FAILED,
+                   "SandboxFileChooserDialog.AddFilter: dialog '%s' ('%s') did not allow adding a filter named '%s', as filters need a unique name.\n",
+                   sfcd_get_id (sfcd),
+                   sfcd_get_dialog_title (sfcd),
+                   name);
+
+      syslog (LOG_WARNING, "%s", _sandboxutils_error_get_message (*error));
+    }
+    else
+    {
+      // One custom rule replaces GTK+'s per-pattern and per-type rules
+      filter = gtk_file_filter_new ();
+      gtk_file_filter_set_name (filter, name);
+      gtk_file_filter_add_custom (filter,
+                                  GTK_FILE_FILTER_FILENAME | GTK_FILE_FILTER_DISPLAY_NAME,
+                                  _lfcd_filter_func,
+                                  _sandboxutils_filter_new (patterns, mime_types),
+                                  _sandboxutils_filter_free);
+      gtk_file_chooser_add_filter (chooser, filter);
+      succeeded = TRUE;
+
+      syslog (LOG_DEBUG,
+              "SandboxFileChooserDialog.AddFilter: dialog '%s' ('%s') has a new filter named '%s' (%u patterns, %u MIME types).\n",
+              sfcd_get_id (sfcd),
+              sfcd_get_dialog_title (sfcd),
+              name,
+              patterns ? g_strv_length ((gchar **) patterns) : 0,
+              mime_types ? g_strv_length ((gchar **) mime_types) : 0);
+    }
+  }
+
+  g_mutex_unlock (&self->priv->stateMutex);
+
+  return succeeded;
+}
+
+static gboolean
+lfcd_remove_filter (SandboxFileChooserDialog *sfcd,
+                    const gchar               *name,
+                    GError                   **error)
+{
+  LocalFileChooserDialog *self = LOCAL_FILE_CHOOSER_DIALOG (sfcd);
+  g_return_val_if_fail (_lfcd_entry_sanity_check (self, error), FALSE);
+
+  GtkFileChooser *chooser;
+  GtkFileFilter  *filter;
+  gboolean        succeeded = FALSE;
+
+  g_mutex_lock (&self->priv->stateMutex);
+
+  if (sfcd_is_running (sfcd))
+  {
+    g_set_error (error,
+                 g_quark_from_static_string (SFCD_ERROR_DOMAIN),
+                 SFCD_ERROR_FORBIDDEN_CHANGE,
+                 "SandboxFileChooserDialog.RemoveFilter: dialog '%s' ('%s') is already running and cannot be modified (parameter was '%s').\n",
+                 sfcd_get_id (sfcd),
+                 sfcd_get_dialog_title (sfcd),
+                 name);
+
+      syslog (LOG_WARNING, "%s", _sandboxutils_error_get_message (*error));
+  }
+  else
+  {
+    if (self->priv->state == SFCD_DATA_RETRIEVAL)
+    {
+      syslog (LOG_DEBUG,
+              "SandboxFileChooserDialog.RemoveFilter: dialog '%s' ('%s') being put back into 'configuration' state.\n",
+              sfcd_get_id (sfcd),
+              sfcd_get_dialog_title (sfcd));
+    }
+
+    self->priv->state = SFCD_CONFIGURATION;
+    chooser = GTK_FILE_CHOOSER (_lfcd_get_dialog (self));
+
+    if ((filter = _lfcd_find_filter (chooser, name)) != NULL)
+    {
+      gtk_file_chooser_remove_filter (chooser, filter);
+      succeeded = TRUE;
+
+      syslog (LOG_DEBUG,
+              "SandboxFileChooserDialog.RemoveFilter: dialog '%s' ('%s')'s filter named '%s' has been removed.\n",
+              sfcd_get_id (sfcd),
+              sfcd_get_dialog_title (sfcd),
+              name);
+    }
+    else
+    {
+      g_set_error (error,
+                   g_quark_from_static_string (SFCD_ERROR_DOMAIN),
+                   SFCD_ERROR_TOOLKIT_CALL_FAILED,
+                   "SandboxFileChooserDialog.RemoveFilter: dialog '%s' ('%s') has no filter named '%s'.\n",
+                   sfcd_get_id (sfcd),
+                   sfcd_get_dialog_title (sfcd),
+                   name);
+
+      syslog (LOG_WARNING, "%s", _sandboxutils_error_get_message (*error));
+    }
+  }
+
+  g_mutex_unlock (&self->priv->stateMutex);
+
+  return succeeded;
+}
+
+static GSList *
+lfcd_list_filters (SandboxFileChooserDialog *sfcd,
+                   GError                    **error)
+{
+  LocalFileChooserDialog *self = LOCAL_FILE_CHOOSER_DIALOG (sfcd);
+  g_return_val_if_fail (_lfcd_entry_sanity_check (self, error), NULL);
+
+  g_mutex_lock (&self->priv->stateMutex);
+  GSList *filters = NULL;
+  GSList *iter;
+  GSList *list = NULL;
+
+  if (sfcd_is_running (sfcd))
+  {
+    g_set_error (error,
+                 g_quark_from_static_string (SFCD_ERROR_DOMAIN),
+                 SFCD_ERROR_FORBIDDEN_CHANGE,
+                 "SandboxFileChooserDialog.ListFilters: dialog '%s' ('%s') is already running and cannot be queried.\n",
+                 sfcd_get_id (sfcd),
+                 sfcd_get_dialog_title (sfcd));
+
+      syslog (LOG_WARNING, "%s", _sandboxutils_error_get_message (*error));
+  }
+  else
+  {
+    filters = gtk_file_chooser_list_filters (GTK_FILE_CHOOSER (_lfcd_get_dialog (self)));
+    for (iter = filters; iter; iter = iter->next)
+      list = g_slist_prepend (list, g_strdup (gtk_file_filter_get_name (iter->data)));
+    list = g_slist_reverse (list);
+    g_slist_free (filters);
+
+    syslog (LOG_DEBUG,
+            "SandboxFileChooserDialog.ListFilters: dialog '%s' ('%s')'s list of filters contains %u elements.\n",
+            sfcd_get_id (sfcd),
+            sfcd_get_dialog_title (sfcd),
+            g_slist_length (list));
+  }
+
+  g_mutex_unlock (&self->priv->stateMutex);
+
+  return list;
+}
+
+static void
+lfcd_set_filter (SandboxFileChooserDialog *sfcd,
+                 const gchar               *name,
+                 GError                   **error)
+{
+  LocalFileChooserDialog *self = LOCAL_FILE_CHOOSER_DIALOG (sfcd);
+  g_return_if_fail (_lfcd_entry_sanity_check (self, error));
+
+  GtkFileChooser *chooser;
+  GtkFileFilter  *filter;
+
+  g_mutex_lock (&self->priv->stateMutex);
+
+  if (sfcd_is_running (sfcd))
+  {
+    g_set_error (error,
+                 g_quark_from_static_string (SFCD_ERROR_DOMAIN),
+                 SFCD_ERROR_FORBIDDEN_CHANGE,
+                 "SandboxFileChooserDialog.SetFilter: dialog '%s' ('%s') is already running and cannot be modified (parameter was '%s').\n",
+                 sfcd_get_id (sfcd),
+                 sfcd_get_dialog_title (sfcd),
+                 name);
+
+      syslog (LOG_WARNING, "%s", _sandboxutils_error_get_message (*error));
+  }
+  else
+  {
+    if (self->priv->state == SFCD_DATA_RETRIEVAL)
+    {
+      syslog (LOG_DEBUG,
+              "SandboxFileChooserDialog.SetFilter: dialog '%s' ('%s') being put back into 'configuration' state.\n",
+              sfcd_get_id (sfcd),
+              sfcd_get_dialog_title (sfcd));
+    }
+
+    self->priv->state = SFCD_CONFIGURATION;
+    chooser = GTK_FILE_CHOOSER (_lfcd_get_dialog (self));
+
+    if ((filter = _lfcd_find_filter (chooser, name)) != NULL)
+    {
+      gtk_file_chooser_set_filter (chooser, filter);
+
+      syslog (LOG_DEBUG,
+              "SandboxFileChooserDialog.SetFilter: dialog '%s' ('%s') now shows files matching filter '%s'.\n",
+              sfcd_get_id (sfcd),
+              sfcd_get_dialog_title (sfcd),
+              name);
+    }
+    else
+    {
+      g_set_error (error,
+                   g_quark_from_static_string (SFCD_ERROR_DOMAIN),
+                   SFCD_ERROR_TOOLKIT_CALL_FAILED,
+                   "SandboxFileChooserDialog.SetFilter: dialog '%s' ('%s') has no filter named '%s'.\n",
+                   sfcd_get_id (sfcd),
+                   sfcd_get_dialog_title (sfcd),
+                   name);
+
+      syslog (LOG_WARNING, "%s", _sandboxutils_error_get_message (*error));
+    }
+  }
+
+  g_mutex_unlock (&self->priv->stateMutex);
+}
+
+static gchar *
+lfcd_get_filter (SandboxFileChooserDialog *sfcd,
+                 GError                    **error)
+{
+  LocalFileChooserDialog *self = LOCAL_FILE_CHOOSER_DIALOG (sfcd);
+  g_return_val_if_fail (_lfcd_entry_sanity_check (self, error), NULL);
+
+  g_mutex_lock (&self->priv->stateMutex);
+  GtkFileFilter *filter;
+  gchar         *name = NULL;
+
+  if (sfcd_is_running (sfcd))
+  {
+    g_set_error (error,
+                 g_quark_from_static_string (SFCD_ERROR_DOMAIN),
+                 SFCD_ERROR_FORBIDDEN_CHANGE,
+                 "SandboxFileChooserDialog.GetFilter: dialog '%s' ('%s') is already running and cannot be queried.\n",
+                 sfcd_get_id (sfcd),
+                 sfcd_get_dialog_title (sfcd));
+
+      syslog (LOG_WARNING, "%s", _sandboxutils_error_get_message (*error));
+  }
+  else
+  {
+    // Users may have picked another filter than the one set by the client
+    filter = gtk_file_chooser_get_filter (GTK_FILE_CHOOSER (_lfcd_get_dialog (self)));
+    if (filter)
+      name = g_strdup (gtk_file_filter_get_name (filter));
+
+    syslog (LOG_DEBUG,
+            "SandboxFileChooserDialog.GetFilter: dialog '%s' ('%s')'s current filter is '%s'.\n",
+            sfcd_get_id (sfcd),
+            sfcd_get_dialog_title (sfcd),
+            name);
+  }
+
+  g_mutex_unlock (&self->priv->stateMutex);
+
+  return name;
+}
+
 static gchar *
 lfcd_get_current_name (SandboxFileChooserDialog *sfcd,
                        GError                    **error)
@@ -2271,7 +3965,7 @@ lfcd_get_current_name (SandboxFileChooserDialog *sfcd,
   }
   else
   {
-    name = gtk_file_chooser_get_current_name (GTK_FILE_CHOOSER (self->priv->dialog));
+    name = gtk_file_chooser_get_current_name (GTK_FILE_CHOOSER (_lfcd_get_dialog (self)));
 
     syslog (LOG_DEBUG,
             "SandboxFileChooserDialog.GetCurrentName: dialog '%s' ('%s')'s typed name currently is '%s'.\n",
@@ -2309,7 +4003,7 @@ lfcd_get_filename (SandboxFileChooserDialog *sfcd,
   }
   else
   {
-    name = gtk_file_chooser_get_filename (GTK_FILE_CHOOSER (self->priv->dialog));
+    name = gtk_file_chooser_get_filename (GTK_FILE_CHOOSER (_lfcd_get_dialog (self)));
 
     syslog (LOG_DEBUG,
             "SandboxFileChooserDialog.GetFilename: dialog '%s' ('%s')'s current file name is '%s'.\n",
@@ -2347,7 +4041,7 @@ lfcd_get_filenames (SandboxFileChooserDialog *sfcd,
   }
   else
   {
-    list = gtk_file_chooser_get_filenames (GTK_FILE_CHOOSER (self->priv->dialog));
+    list = gtk_file_chooser_get_filenames (GTK_FILE_CHOOSER (_lfcd_get_dialog (self)));
 
     syslog (LOG_DEBUG,
             "SandboxFileChooserDialog.GetFilenames: dialog '%s' ('%s')'s list of current file names contains %u elements.\n",
@@ -2385,7 +4079,7 @@ lfcd_get_current_folder (SandboxFileChooserDialog *sfcd,
   }
   else
   {
-    folder = gtk_file_chooser_get_current_folder (GTK_FILE_CHOOSER (self->priv->dialog));
+    folder = gtk_file_chooser_get_current_folder (GTK_FILE_CHOOSER (_lfcd_get_dialog (self)));
 
     syslog (LOG_DEBUG,
             "SandboxFileChooserDialog.GetCurrentFolder: dialog '%s' ('%s')'s current folder is '%s'.\n",
@@ -2422,7 +4116,7 @@ lfcd_get_uri (SandboxFileChooserDialog *sfcd,
   }
   else
   {
-    uri = gtk_file_chooser_get_uri (GTK_FILE_CHOOSER (self->priv->dialog));
+    uri = gtk_file_chooser_get_uri (GTK_FILE_CHOOSER (_lfcd_get_dialog (self)));
 
     syslog (LOG_DEBUG,
             "SandboxFileChooserDialog.GetUri: dialog '%s' ('%s')'s current file uri is '%s'.\n",
@@ -2460,7 +4154,7 @@ lfcd_get_uris (SandboxFileChooserDialog *sfcd,
   }
   else
   {
-    list = gtk_file_chooser_get_uris (GTK_FILE_CHOOSER (self->priv->dialog));
+    list = gtk_file_chooser_get_uris (GTK_FILE_CHOOSER (_lfcd_get_dialog (self)));
 
     syslog (LOG_DEBUG,
             "SandboxFileChooserDialog.GetUris: dialog '%s' ('%s')'s list of current file uris contains %u elements.\n",
@@ -2499,7 +4193,7 @@ lfcd_get_current_folder_uri (SandboxFileChooserDialog *sfcd,
   
   else
   {
-    uri = gtk_file_chooser_get_current_folder_uri (GTK_FILE_CHOOSER (self->priv->dialog));
+    uri = gtk_file_chooser_get_current_folder_uri (GTK_FILE_CHOOSER (_lfcd_get_dialog (self)));
 
     syslog (LOG_DEBUG,
             "SandboxFileChooserDialog.GetCurrentFolderUri: dialog '%s' ('%s')'s current folder uri is '%s'.\n",
@@ -2530,13 +4224,20 @@ lfcd_class_init (LocalFileChooserDialogClass *klass)
   sfcd_class->destroy = lfcd_destroy;
   sfcd_class->get_dialog_title = lfcd_get_dialog_title;
   sfcd_class->get_id = lfcd_get_id;
+  sfcd_class->get_timings = lfcd_get_timings;
   sfcd_class->run = lfcd_run;
   sfcd_class->present = lfcd_present;
   sfcd_class->cancel_run = lfcd_cancel_run;
+  sfcd_class->reset = lfcd_reset;
   sfcd_class->set_destroy_with_parent = lfcd_set_destroy_with_parent;
   sfcd_class->get_destroy_with_parent = lfcd_get_destroy_with_parent;
   sfcd_class->set_extra_widget = lfcd_set_extra_widget;
   sfcd_class->get_extra_widget = lfcd_get_extra_widget;
+  sfcd_class->set_choices = lfcd_set_choices;
+  sfcd_class->get_choice_values = lfcd_get_choice_values;
+  sfcd_class->set_preview_func = lfcd_set_preview_func;
+  sfcd_class->get_thumbnails = lfcd_get_thumbnails;
+  sfcd_class->get_selection_info = lfcd_get_selection_info;
   sfcd_class->select_filename = lfcd_select_filename;
   sfcd_class->unselect_filename = lfcd_unselect_filename;
   sfcd_class->select_all = lfcd_select_all;
@@ -2566,6 +4267,11 @@ lfcd_class_init (LocalFileChooserDialogClass *klass)
   sfcd_class->add_shortcut_folder_uri = lfcd_add_shortcut_folder_uri;
   sfcd_class->remove_shortcut_folder_uri = lfcd_remove_shortcut_folder_uri;
   sfcd_class->list_shortcut_folder_uris = lfcd_list_shortcut_folder_uris;
+  sfcd_class->add_filter = lfcd_add_filter;
+  sfcd_class->remove_filter = lfcd_remove_filter;
+  sfcd_class->list_filters = lfcd_list_filters;
+  sfcd_class->set_filter = lfcd_set_filter;
+  sfcd_class->get_filter = lfcd_get_filter;
   sfcd_class->get_current_name = lfcd_get_current_name;
   sfcd_class->get_filename = lfcd_get_filename;
   sfcd_class->get_filenames = lfcd_get_filenames;
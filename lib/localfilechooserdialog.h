@@ -56,6 +56,44 @@ struct _LocalFileChooserDialogClass
 
 GType lfcd_get_type (void);
 
+/**
+ * LfcdPreviewFunc:
+ * @dialog: the #LocalFileChooserDialog whose highlighted file changed
+ * @filename: (allow-none): the highlighted file, or %NULL if there is none
+ * @user_data: the data passed to lfcd_set_preview_surface()
+ *
+ * Told when the user highlights another file in a dialog with a preview
+ * surface, so that a new preview gets drawn. Reports what was drawn with
+ * lfcd_damage_preview(), which may be called later on.
+ *
+ * Since: 0.7
+ */
+typedef void (*LfcdPreviewFunc) (SandboxFileChooserDialog *dialog,
+                                 const gchar              *filename,
+                                 gpointer                  user_data);
+
+/**
+ * LfcdValidateFunc:
+ * @dialog: the #LocalFileChooserDialog in which the user accepted files
+ * @filenames: (element-type filename): the files the user chose
+ * @message: (out) (allow-none): where to store why the files are refused,
+ *  to show to the user, or %NULL
+ * @user_data: the data passed to lfcd_set_validate_func()
+ *
+ * Decides whether the files a user chose may be handed to the owner of a
+ * dialog, before the dialog switches to %SFCD_DATA_RETRIEVAL. When they are
+ * refused, the dialog keeps running and tells the user why, so that they
+ * can choose other files. Called on the thread running GTK+.
+ *
+ * Return value: %TRUE to accept the files, %FALSE to refuse them
+ *
+ * Since: 0.7
+ */
+typedef gboolean (*LfcdValidateFunc) (SandboxFileChooserDialog  *dialog,
+                                      GSList                    *filenames,
+                                      gchar                    **message,
+                                      gpointer                   user_data);
+
 SandboxFileChooserDialog *
 lfcd_new_valist (const gchar          *title,
                  const gchar          *parentWinId,
@@ -85,6 +123,46 @@ lfcd_new_with_remote_parent (const gchar          *title,
                              const gchar          *first_button_text,
                              ...);
 
+void
+lfcd_set_run_origin (SandboxFileChooserDialog *dialog,
+                     guint64                   correlation_id,
+                     gint64                    run_called,
+                     gint64                    run_received);
+
+void
+lfcd_respond (SandboxFileChooserDialog  *dialog,
+              gint                       response_id,
+              GError                   **error);
+
+gboolean
+lfcd_hibernate (SandboxFileChooserDialog *dialog);
+
+gboolean
+lfcd_prepare (SandboxFileChooserDialog *dialog);
+
+gboolean
+lfcd_unprepare (SandboxFileChooserDialog *dialog);
+
+void
+lfcd_set_preview_surface (SandboxFileChooserDialog  *dialog,
+                          cairo_surface_t           *surface,
+                          LfcdPreviewFunc            func,
+                          gpointer                   user_data,
+                          GDestroyNotify             notify,
+                          GError                   **error);
+
+void
+lfcd_set_validate_func (SandboxFileChooserDialog  *dialog,
+                        LfcdValidateFunc           func,
+                        gpointer                   user_data,
+                        GDestroyNotify             notify);
+
+void
+lfcd_damage_preview (SandboxFileChooserDialog     *dialog,
+                     gboolean                      active,
+                     const cairo_rectangle_int_t  *rects,
+                     guint                         n_rects);
+
 G_END_DECLS
 
 #endif /* __LOCAL_FILE_CHOOSER_DIALOG_H__ */
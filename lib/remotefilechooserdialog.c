@@ -49,11 +49,20 @@
 #include <gtk/gtkx.h>
 #include <syslog.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <gio/gunixfdlist.h>
 
 #include "sandboxfilechooserdialogdbusobject.h"
 #include "remotefilechooserdialog.h"
 #include "sandboxutilsmarshals.h"
+#include "sandboxutilschoices.h"
 #include "sandboxutilscommon.h"
+#include "sandboxutilsconnection.h"
+#include "sandboxutilsshm.h"
+#include "sandboxutilsthumbnails.h"
+#include "sandboxutilstrace.h"
 
 struct _RemoteFileChooserDialogPrivate
 {
@@ -63,23 +72,43 @@ struct _RemoteFileChooserDialogPrivate
   gboolean              destroy_with_parent;  /* whether to destroy this dialog with its parent (allow-none) */
   gchar                 *remote_id;     /* id of this instance */
   gchar                 *cached_title;  /* cached version of the dialog title */
+  SfcdTimings            timings;       /* phases of the current or last run */
+  GVariant              *choices;       /* description of the choices, or NULL */
+  GHashTable            *choice_values; /* last known values of the choices */
+  SfcdPreviewFunc        preview_func;  /* draws previews, or NULL */
+  gpointer               preview_data;  /* data for the preview function */
+  GDestroyNotify         preview_notify; /* frees the preview data */
+  cairo_surface_t       *preview_back;  /* where previews are drawn first */
+  guchar                *preview_shared; /* memfd shared with the server */
 };
 
 G_DEFINE_TYPE_WITH_PRIVATE (RemoteFileChooserDialog, rfcd, SANDBOX_TYPE_FILE_CHOOSER_DIALOG)
 
+static guint32 __rfcd_run_counter = 0;
+
+// Where the proxy created in the background is handed over, see _rfcd_class_get_proxy()
+static GMainContext *__rfcd_proxy_context = NULL;
+
 static void                 rfcd_destroy                       (SandboxFileChooserDialog *);
 static SfcdState            rfcd_get_state                     (SandboxFileChooserDialog *);
 static const gchar *        rfcd_get_state_printable           (SandboxFileChooserDialog *);
 static const gchar *        rfcd_get_dialog_title              (SandboxFileChooserDialog *);
 static gboolean             rfcd_is_running                    (SandboxFileChooserDialog *);
 static const gchar *        rfcd_get_id                        (SandboxFileChooserDialog *);
+static gboolean             rfcd_get_timings                   (SandboxFileChooserDialog *, SfcdTimings *);
 static void                 rfcd_run                           (SandboxFileChooserDialog *, GError **);
 static void                 rfcd_present                       (SandboxFileChooserDialog *, GError **);
 static void                 rfcd_cancel_run                    (SandboxFileChooserDialog *, GError **);
+static void                 rfcd_reset                         (SandboxFileChooserDialog *, SfcdResetFlags, GError **);
 static void                 rfcd_set_destroy_with_parent       (SandboxFileChooserDialog *, gboolean);
 static gboolean             rfcd_get_destroy_with_parent       (SandboxFileChooserDialog *);
 static void                 rfcd_set_extra_widget              (SandboxFileChooserDialog *, GtkWidget *, GError **);
 static GtkWidget *          rfcd_get_extra_widget              (SandboxFileChooserDialog *, GError **);
+static void                 rfcd_set_choices                   (SandboxFileChooserDialog *, GVariant *, GError **);
+static GVariant *           rfcd_get_choice_values             (SandboxFileChooserDialog *, GError **);
+static void                 rfcd_set_preview_func              (SandboxFileChooserDialog *, gint, gint, SfcdPreviewFunc, gpointer, GDestroyNotify, GError **);
+static SfcdThumbnails *     rfcd_get_thumbnails                (SandboxFileChooserDialog *, gint, GError **);
+static GVariant *           rfcd_get_selection_info            (SandboxFileChooserDialog *, const gchar *, GError **);
 static void                 rfcd_select_filename               (SandboxFileChooserDialog *, const gchar *, GError **);
 static void                 rfcd_unselect_filename             (SandboxFileChooserDialog *, const gchar *, GError **);
 static void                 rfcd_select_all                    (SandboxFileChooserDialog *, GError **);
@@ -109,6 +138,11 @@ static GSList *             rfcd_list_shortcut_folders         (SandboxFileChoos
 static gboolean             rfcd_add_shortcut_folder_uri       (SandboxFileChooserDialog *, const gchar *, GError **);
 static gboolean             rfcd_remove_shortcut_folder_uri    (SandboxFileChooserDialog *, const gchar *, GError **);
 static GSList *             rfcd_list_shortcut_folder_uris     (SandboxFileChooserDialog *, GError **);
+static gboolean             rfcd_add_filter                    (SandboxFileChooserDialog *, const gchar *, const gchar * const *, const gchar * const *, GError **);
+static gboolean             rfcd_remove_filter                 (SandboxFileChooserDialog *, const gchar *, GError **);
+static GSList *             rfcd_list_filters                  (SandboxFileChooserDialog *, GError **);
+static void                 rfcd_set_filter                    (SandboxFileChooserDialog *, const gchar *, GError **);
+static gchar *              rfcd_get_filter                    (SandboxFileChooserDialog *, GError **);
 static gchar *              rfcd_get_current_name              (SandboxFileChooserDialog *, GError **);
 static gchar *              rfcd_get_filename                  (SandboxFileChooserDialog *, GError **);
 static GSList *             rfcd_get_filenames                 (SandboxFileChooserDialog *, GError **);
@@ -117,37 +151,32 @@ static gchar *              rfcd_get_uri                       (SandboxFileChoos
 static GSList *             rfcd_get_uris                      (SandboxFileChooserDialog *, GError **);
 static gchar *              rfcd_get_current_folder_uri        (SandboxFileChooserDialog *, GError **);
 
-static SandboxFileChooserDialog *
-_rfcd_class_lookup (RemoteFileChooserDialogClass  *klass,
-                    const gchar                   *dialog_id)
-{
-  SandboxFileChooserDialog *sfcd = NULL;
-
-  g_return_val_if_fail (klass != NULL, NULL);
-  g_return_val_if_fail (dialog_id != NULL, NULL);
-
-  sfcd = g_hash_table_lookup (klass->instances, dialog_id);
-
-	if (sfcd == NULL)
-	{
-	  syslog (LOG_WARNING,
-	          "RemoteFileChooserDialogClass._Lookup: dialog '%s' was not found.\n",
-	          dialog_id);
-	}
-
-  return sfcd;
-}
-
 static void
 _rfcd_class_on_response (SfcdDbusWrapper *proxy,
                          const gchar     *dialog_id,
                          gint             response_id,
                          gint             state,
+                         GVariant        *timings,
+                         GVariant        *choices,
                          gpointer         user_data)
 {
   RemoteFileChooserDialogClass *klass = user_data;
-  SandboxFileChooserDialog *sfcd = _rfcd_class_lookup (klass, dialog_id);
+  SandboxFileChooserDialog *sfcd;
+
+  // Dialogs already gone, or those of other clients on older servers
+  if ((sfcd = g_hash_table_lookup (klass->instances, dialog_id)) == NULL)
+    return;
+
   SandboxFileChooserDialogClass *sfcd_class = SANDBOX_FILE_CHOOSER_DIALOG_GET_CLASS (sfcd);
+  RemoteFileChooserDialog *rfcd = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
+
+  // Complete our own timings with the phases that happened on the server
+  rfcd->priv->timings.response_received = g_get_monotonic_time ();
+  _sfcd_timings_from_variant (&rfcd->priv->timings, timings);
+  _sfcd_record_timings (&rfcd->priv->timings);
+
+  // Choices come with the response, so reading them needs no call
+  _sandboxutils_choices_merge (rfcd->priv->choice_values, choices);
 
   syslog (LOG_DEBUG, "RemoteFileChooserDialogClass.OnResponse: dialog '%s' will now emit a 'response' signal with response id %d and state %d.\n",
           dialog_id, response_id, state);
@@ -159,6 +188,176 @@ _rfcd_class_on_response (SfcdDbusWrapper *proxy,
                  state);
 }
 
+static void
+_rfcd_class_on_choices_changed (SfcdDbusWrapper *proxy,
+                                const gchar     *dialog_id,
+                                GVariant        *changes,
+                                gpointer         user_data)
+{
+  RemoteFileChooserDialogClass *klass = user_data;
+  SandboxFileChooserDialog *sfcd;
+
+  if ((sfcd = g_hash_table_lookup (klass->instances, dialog_id)) == NULL)
+    return;
+
+  SandboxFileChooserDialogClass *sfcd_class = SANDBOX_FILE_CHOOSER_DIALOG_GET_CLASS (sfcd);
+  RemoteFileChooserDialog *rfcd = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
+
+  _sandboxutils_choices_merge (rfcd->priv->choice_values, changes);
+
+  g_signal_emit (sfcd,
+                 sfcd_class->choices_changed_signal,
+                 0,
+                 changes);
+}
+
+/*
+ * Copies the rows of the back buffer that changed to the memory shared with
+ * the server, and lists the parts that changed as an a(iiii). Only what was
+ * drawn differently from the previous preview is sent to be repainted.
+ */
+static GVariant *
+_rfcd_preview_publish (RemoteFileChooserDialog *self)
+{
+  cairo_surface_t *back   = self->priv->preview_back;
+  gint             width  = cairo_image_surface_get_width (back);
+  gint             height = cairo_image_surface_get_height (back);
+  gint             stride = cairo_image_surface_get_stride (back);
+  const guint32   *drawn;
+  guint32         *shared;
+  GVariantBuilder  builder;
+  gint             band = -1, left = width, right = -1;
+  gint             y, first, last;
+
+  cairo_surface_flush (back);
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(iiii)"));
+
+  // Consecutive changed rows make up a band, as wide as their changes
+  for (y = 0; y <= height; y++)
+  {
+    first = -1;
+
+    if (y < height)
+    {
+      drawn  = (const guint32 *) (cairo_image_surface_get_data (back) + y * stride);
+      shared = (guint32 *) (self->priv->preview_shared + y * stride);
+
+      if (memcmp (drawn, shared, width * 4) != 0)
+      {
+        for (first = 0; drawn[first] == shared[first]; first++);
+        for (last = width - 1; drawn[last] == shared[last]; last--);
+
+        memcpy (shared + first, drawn + first, (last - first + 1) * 4);
+
+        if (band == -1)
+          band = y;
+        left  = MIN (left, first);
+        right = MAX (right, last);
+      }
+    }
+
+    if (first == -1 && band != -1)
+    {
+      g_variant_builder_add (&builder, "(iiii)", left, band, right - left + 1, y - band);
+      band  = -1;
+      left  = width;
+      right = -1;
+    }
+  }
+
+  return g_variant_builder_end (&builder);
+}
+
+static void
+_rfcd_on_preview_file_opened (GObject      *source,
+                              GAsyncResult *res,
+                              gpointer      user_data)
+{
+  RemoteFileChooserDialog *self    = user_data;
+  GUnixFDList             *fd_list = NULL;
+  GError                  *error   = NULL;
+  GVariant                *rects;
+  cairo_t                 *cr;
+  guint64                  serial;
+  gboolean                 drawn;
+  gint                     handle;
+  gint                     fd = -1;
+
+  if (sfcd_dbus_wrapper__call_open_preview_file_finish (SFCD_DBUS_WRAPPER_ (source),
+                                                         &serial, &handle, &fd_list,
+                                                         res, &error))
+    fd = g_unix_fd_list_get (fd_list, handle, &error);
+
+  // The user moved on, or the preview function was removed in the meantime
+  if (fd == -1 || !self->priv->preview_func)
+  {
+    syslog (LOG_DEBUG, "SandboxFileChooserDialog._OnPreviewFileOpened: no preview for dialog %s -- %s",
+            self->priv->remote_id, error ? _sandboxutils_error_get_message (error) : "preview removed");
+    g_clear_error (&error);
+  }
+  else
+  {
+    cr = cairo_create (self->priv->preview_back);
+    cairo_set_operator (cr, CAIRO_OPERATOR_CLEAR);
+    cairo_paint (cr);
+    cairo_set_operator (cr, CAIRO_OPERATOR_OVER);
+
+    drawn = self->priv->preview_func (SANDBOX_FILE_CHOOSER_DIALOG (self), fd, cr,
+                                      cairo_image_surface_get_width (self->priv->preview_back),
+                                      cairo_image_surface_get_height (self->priv->preview_back),
+                                      self->priv->preview_data);
+    cairo_destroy (cr);
+
+    // A hidden preview area needs no repainting
+    if (drawn)
+      rects = _rfcd_preview_publish (self);
+    else
+      rects = g_variant_new_array (G_VARIANT_TYPE ("(iiii)"), NULL, 0);
+
+    sfcd_dbus_wrapper__call_preview_damage (SFCD_DBUS_WRAPPER_ (source),
+                                            self->priv->remote_id,
+                                            serial,
+                                            drawn,
+                                            rects,
+                                            NULL,
+                                            NULL,
+                                            NULL);
+  }
+
+  if (fd != -1)
+    close (fd);
+  if (fd_list)
+    g_object_unref (fd_list);
+
+  g_object_unref (self);
+}
+
+static void
+_rfcd_class_on_preview_requested (SfcdDbusWrapper *proxy,
+                                  const gchar     *dialog_id,
+                                  gpointer         user_data)
+{
+  RemoteFileChooserDialogClass *klass = user_data;
+  SandboxFileChooserDialog *sfcd;
+  RemoteFileChooserDialog  *rfcd;
+
+  // Every client hears about every preview, most have no such dialog
+  if ((sfcd = g_hash_table_lookup (klass->instances, dialog_id)) == NULL)
+    return;
+
+  rfcd = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
+  if (!rfcd->priv->preview_func)
+    return;
+
+  // Asynchronous, so that the application keeps running while the file opens
+  sfcd_dbus_wrapper__call_open_preview_file (proxy,
+                                             dialog_id,
+                                             NULL,
+                                             NULL,
+                                             _rfcd_on_preview_file_opened,
+                                             g_object_ref (rfcd));
+}
+
 static void
 _rfcd_class_on_destroy (SfcdDbusWrapper *proxy,
                         const gchar     *dialog_id,
@@ -168,9 +367,13 @@ _rfcd_class_on_destroy (SfcdDbusWrapper *proxy,
   g_return_if_fail (dialog_id != NULL);
   g_return_if_fail (klass != NULL);
 
-  SandboxFileChooserDialog *sfcd = _rfcd_class_lookup (klass, dialog_id);
+  SandboxFileChooserDialog *sfcd;
+
+  // Every client hears about every dialog being destroyed, most are not ours
+  if ((sfcd = g_hash_table_lookup (klass->instances, dialog_id)) == NULL)
+    return;
+
   SandboxFileChooserDialogClass *sfcd_class = SANDBOX_FILE_CHOOSER_DIALOG_GET_CLASS (sfcd);
-  g_return_if_fail (sfcd != NULL);
   g_return_if_fail (sfcd_class != NULL);
 
   syslog (LOG_DEBUG, "RemoteFileChooserDialogClass.OnDestroy: dialog '%s' will now emit a 'destroy' signal.\n",
@@ -187,36 +390,222 @@ _rfcd_class_on_destroy (SfcdDbusWrapper *proxy,
   g_object_unref (sfcd);
 }
 
+#if SU_TRACE_ENABLED
+/*
+ * Sees every message of the bus connection, in the GDBus worker thread. Fires
+ * a probe when a call leaves for the server and another when a reply comes
+ * back, so tracers can pair them up by serial. This catches all the calls
+ * made by rfcd_* methods without instrumenting each of them.
+ */
+static GDBusMessage *
+_rfcd_class_trace_filter (GDBusConnection *connection,
+                          GDBusMessage    *message,
+                          gboolean         incoming,
+                          gpointer         user_data)
+{
+  GDBusMessageType type = g_dbus_message_get_message_type (message);
+
+  if (!incoming && type == G_DBUS_MESSAGE_TYPE_METHOD_CALL)
+  {
+    if (g_strcmp0 (g_dbus_message_get_interface (message), SFCD_IFACE) == 0)
+      SU_TRACE2 (rfcd_call_start,
+                 g_dbus_message_get_member (message),
+                 g_dbus_message_get_serial (message));
+  }
+  else if (incoming && (type == G_DBUS_MESSAGE_TYPE_METHOD_RETURN ||
+                        type == G_DBUS_MESSAGE_TYPE_ERROR))
+  {
+    SU_TRACE2 (rfcd_call_finish,
+               g_dbus_message_get_reply_serial (message),
+               type == G_DBUS_MESSAGE_TYPE_ERROR);
+  }
+
+  return message;
+}
+#endif
+
+/* Hooks a freshly created proxy up to the class, unless it has one already */
+static void
+_rfcd_class_proxy_setup (RemoteFileChooserDialogClass *klass,
+                         SfcdDbusWrapper              *proxy)
+{
+  if (klass->proxy)
+  {
+    g_object_unref (proxy);
+    return;
+  }
+
+  klass->proxy = (GDBusProxy *) proxy;
+
+  g_signal_connect (proxy, "destroy", (GCallback) _rfcd_class_on_destroy, klass);
+  g_signal_connect (proxy, "response", (GCallback) _rfcd_class_on_response, klass);
+  g_signal_connect (proxy, "choices-changed", (GCallback) _rfcd_class_on_choices_changed, klass);
+  g_signal_connect (proxy, "preview-requested", (GCallback) _rfcd_class_on_preview_requested, klass);
+
+#if SU_TRACE_ENABLED
+  // The connection is shared and outlives our proxies, only filter it once
+  GDBusConnection *connection = g_dbus_proxy_get_connection (klass->proxy);
+  if (!g_object_get_data (G_OBJECT (connection), "rfcd-trace-filter"))
+  {
+    g_dbus_connection_add_filter (connection, _rfcd_class_trace_filter, NULL, NULL);
+    g_object_set_data (G_OBJECT (connection), "rfcd-trace-filter", GINT_TO_POINTER (TRUE));
+  }
+#endif
+}
+
+static void
+_rfcd_class_on_proxy_ready (GObject      *source,
+                            GAsyncResult *res,
+                            gpointer      user_data)
+{
+  RemoteFileChooserDialogClass *klass = user_data;
+  SfcdDbusWrapper              *proxy;
+  GError                       *error = NULL;
+
+  klass->proxy_pending = FALSE;
+
+  proxy = g_task_propagate_pointer (G_TASK (res), &error);
+  if (proxy)
+    _rfcd_class_proxy_setup (klass, proxy);
+  else
+  {
+    // Not fatal, the first dialog will try again synchronously
+    syslog (LOG_WARNING, "SandboxFileChooserDialog._ClassOnProxyReady: could not create proxy in the background (%s).\n",
+            _sandboxutils_error_get_message (error));
+    g_error_free (error);
+  }
+}
+
+/*
+ * Creates the proxy in a worker thread. That thread has no main context of its
+ * own, so the proxy's signals are still dispatched by the application's.
+ */
+static void
+_rfcd_class_proxy_thread (GTask        *task,
+                          gpointer      source_object,
+                          gpointer      task_data,
+                          GCancellable *cancellable)
+{
+  SfcdDbusWrapper *proxy;
+  GError          *error = NULL;
+
+  proxy = sfcd_dbus_wrapper__proxy_new_sync (task_data,
+                                             G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES,
+                                             SFCD_IFACE,
+                                             SANDBOXUTILS_PATH,
+                                             cancellable,
+                                             &error);
+  if (proxy)
+    g_task_return_pointer (task, proxy, g_object_unref);
+  else
+    g_task_return_error (task, error);
+}
+
+/*
+ * Starts creating the proxy once the shared connection is up, so that it is
+ * ready by the time the application creates its first dialog. Properties are
+ * not loaded, as the interface has none we use. The result is delivered to a
+ * private main context, which _rfcd_class_get_proxy() iterates when it needs
+ * the proxy, so that waiting for it does not run the application's callbacks.
+ */
+static void
+_rfcd_class_proxy_prefetch (GDBusConnection *connection,
+                            gpointer         user_data)
+{
+  RemoteFileChooserDialogClass *klass = user_data;
+  GTask                        *task;
+
+  if (klass->proxy || klass->proxy_pending)
+    return;
+
+  if (!__rfcd_proxy_context)
+    __rfcd_proxy_context = g_main_context_new ();
+
+  klass->proxy_pending = TRUE;
+
+  g_main_context_push_thread_default (__rfcd_proxy_context);
+  task = g_task_new (NULL, NULL, _rfcd_class_on_proxy_ready, klass);
+  g_main_context_pop_thread_default (__rfcd_proxy_context);
+
+  g_task_set_task_data (task, g_object_ref (connection), g_object_unref);
+  g_task_run_in_thread (task, _rfcd_class_proxy_thread);
+  g_object_unref (task);
+}
+
+static gboolean
+_rfcd_class_on_proxy_wait_timeout (gpointer user_data)
+{
+  gboolean *timed_out = user_data;
+
+  *timed_out = TRUE;
+  return G_SOURCE_REMOVE;
+}
+
+/*
+ * Waits for the proxy being created in the background, for at most @timeout
+ * milliseconds, or until it is created or has failed if @timeout is -1.
+ */
+static void
+_rfcd_class_proxy_wait (RemoteFileChooserDialogClass *klass,
+                        gint                          timeout)
+{
+  GSource  *source    = NULL;
+  gboolean  timed_out = FALSE;
+
+  if (!klass->proxy_pending)
+    return;
+
+  if (timeout >= 0)
+  {
+    source = g_timeout_source_new (timeout);
+    g_source_set_callback (source, _rfcd_class_on_proxy_wait_timeout, &timed_out, NULL);
+    g_source_attach (source, __rfcd_proxy_context);
+  }
+
+  while (klass->proxy_pending && !timed_out)
+    g_main_context_iteration (__rfcd_proxy_context, TRUE);
+
+  if (source)
+  {
+    g_source_destroy (source);
+    g_source_unref (source);
+  }
+}
+
+/*
+ * Creates the proxy right away, for when a dialog is needed and nothing is
+ * creating it in the background, or that failed. This still reuses the
+ * shared connection, waiting for its handshake to finish if it is underway.
+ */
 static gboolean
 _rfcd_class_proxy_init (RemoteFileChooserDialogClass *klass)
 {
   g_return_val_if_fail (REMOTE_IS_FILE_CHOOSER_DIALOG_CLASS (klass), FALSE);
 
-  GError *error = NULL;
-  klass->proxy = (GDBusProxy *) sfcd_dbus_wrapper__proxy_new_for_bus_sync (
-                                  G_BUS_TYPE_SESSION,
-                                  G_DBUS_PROXY_FLAGS_NONE,
-                                  SFCD_IFACE,
-                                  SANDBOXUTILS_PATH,
-                                  NULL,
-                                  &error);
-  if (error)
+  GDBusConnection *connection;
+  SfcdDbusWrapper *proxy = NULL;
+  GError          *error = NULL;
+
+  connection = _sandboxutils_connection_get (&error);
+  if (connection)
+    proxy = sfcd_dbus_wrapper__proxy_new_sync (connection,
+                                               G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES,
+                                               SFCD_IFACE,
+                                               SANDBOXUTILS_PATH,
+                                               NULL,
+                                               &error);
+  if (!proxy)
   {
-    klass->proxy = NULL;
-
     syslog (LOG_ALERT, "SandboxFileChooserDialog._ClassProxyInit: could not create proxy (%s).",
             _sandboxutils_error_get_message (error));
     g_error_free (error);
 
     return FALSE;
   }
-  else
-  {
-    g_signal_connect (SFCD_DBUS_WRAPPER_ (klass->proxy), "destroy", (GCallback) _rfcd_class_on_destroy, klass);
-    g_signal_connect (SFCD_DBUS_WRAPPER_ (klass->proxy), "response", (GCallback) _rfcd_class_on_response, klass);
 
-    return TRUE;
-  }
+  _rfcd_class_proxy_setup (klass, proxy);
+
+  return TRUE;
 }
 
 static void
@@ -230,15 +619,35 @@ _rfcd_class_proxy_clear (RemoteFileChooserDialogClass *klass)
   klass->proxy = NULL;
 }
 
+/*
+ * Gets the proxy, waiting at most @timeout milliseconds (-1 for no limit) for
+ * the one being created in the background. If it takes longer, the caller
+ * gets no proxy rather than a second one, and it is picked up by a later call.
+ */
 static SfcdDbusWrapper *
-_rfcd_get_proxy (RemoteFileChooserDialog *self)
+_rfcd_class_get_proxy (RemoteFileChooserDialogClass *klass,
+                       gint                          timeout)
 {
-  g_return_val_if_fail (REMOTE_IS_FILE_CHOOSER_DIALOG (self), NULL);
-  RemoteFileChooserDialogClass *klass = REMOTE_FILE_CHOOSER_DIALOG_GET_CLASS (self);
+  g_return_val_if_fail (REMOTE_IS_FILE_CHOOSER_DIALOG_CLASS (klass), NULL);
 
   if (!klass->proxy)
   {
-    if (!_rfcd_class_proxy_init (klass))
+    gint64   started   = SU_TRACE_NOW ();
+    gboolean succeeded;
+
+    _rfcd_class_proxy_wait (klass, timeout);
+
+    if (klass->proxy_pending)
+    {
+      syslog (LOG_WARNING, "SandboxFileChooserDialog._GetProxy: timed out waiting for the proxy to be created.\n");
+      return NULL;
+    }
+
+    succeeded = klass->proxy || _rfcd_class_proxy_init (klass);
+
+    SU_TRACE2 (rfcd_proxy_init, succeeded, SU_TRACE_NOW () - started);
+
+    if (!succeeded)
     {
       syslog (LOG_ALERT, "SandboxFileChooserDialog._GetProxy: failed to get proxy, and then failed to reinitialize it.");
       return NULL;
@@ -248,6 +657,15 @@ _rfcd_get_proxy (RemoteFileChooserDialog *self)
   return (SFCD_DBUS_WRAPPER_ (klass->proxy));
 }
 
+static SfcdDbusWrapper *
+_rfcd_get_proxy (RemoteFileChooserDialog *self)
+{
+  g_return_val_if_fail (REMOTE_IS_FILE_CHOOSER_DIALOG (self), NULL);
+
+  return _rfcd_class_get_proxy (REMOTE_FILE_CHOOSER_DIALOG_GET_CLASS (self),
+                                _sfcd_get_call_timeout (SANDBOX_FILE_CHOOSER_DIALOG (self)));
+}
+
 static SfcdDbusWrapper *
 _rfcd_reset_proxy (RemoteFileChooserDialog *self)
 {
@@ -258,6 +676,59 @@ _rfcd_reset_proxy (RemoteFileChooserDialog *self)
   return _rfcd_get_proxy (self);
 }
 
+/*
+ * Gets the proxy, ready for a call made on behalf of @self: the call will wait
+ * for its reply for as long as the dialog's timeout and the deadline of the
+ * calling thread allow. The proxy is shared, but dialogs are only used from
+ * the thread running GTK+, so its timeout cannot change under our feet.
+ */
+static SfcdDbusWrapper *
+_rfcd_call_begin (RemoteFileChooserDialog *self)
+{
+  SfcdDbusWrapper *proxy = _rfcd_get_proxy (self);
+
+  if (proxy)
+    g_dbus_proxy_set_default_timeout (G_DBUS_PROXY (proxy),
+                                      _sfcd_get_call_timeout (SANDBOX_FILE_CHOOSER_DIALOG (self)));
+
+  return proxy;
+}
+
+static GCancellable *
+_rfcd_get_cancellable (RemoteFileChooserDialog *self)
+{
+  return _sfcd_get_call_cancellable (SANDBOX_FILE_CHOOSER_DIALOG (self));
+}
+
+/*
+ * Called when a call made on behalf of @self failed. If we gave up on it,
+ * tells the server so that it does not process the calls of this dialog that
+ * are still waiting in its queues. No reply is expected, as there is no one
+ * left to wait for it. Calls that create dialogs use an empty dialog id.
+ */
+static void
+_rfcd_call_failed (RemoteFileChooserDialog *self,
+                   const GError            *error)
+{
+  RemoteFileChooserDialogClass *klass = REMOTE_FILE_CHOOSER_DIALOG_GET_CLASS (self);
+
+  if (!klass->proxy || !error)
+    return;
+
+  if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED) &&
+      !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT))
+    return;
+
+  syslog (LOG_DEBUG, "SandboxFileChooserDialog._CallFailed: gave up on a call for dialog '%s', telling the server.\n",
+          self->priv->remote_id);
+
+  sfcd_dbus_wrapper__call_abandon_calls (SFCD_DBUS_WRAPPER_ (klass->proxy),
+                                         self->priv->remote_id ? self->priv->remote_id : "",
+                                         NULL,
+                                         NULL,
+                                         NULL);
+}
+
 static void
 rfcd_init (RemoteFileChooserDialog *self)
 {
@@ -269,6 +740,37 @@ rfcd_init (RemoteFileChooserDialog *self)
   self->priv->destroy_with_parent  = FALSE;
   self->priv->remote_id     = NULL;
   self->priv->cached_title  = NULL;
+  self->priv->choices       = NULL;
+  self->priv->choice_values = _sandboxutils_choices_get_defaults (NULL);
+  self->priv->preview_func  = NULL;
+  self->priv->preview_data  = NULL;
+  self->priv->preview_notify = NULL;
+  self->priv->preview_back  = NULL;
+  self->priv->preview_shared = NULL;
+
+  memset (&self->priv->timings, 0, sizeof (SfcdTimings));
+}
+
+/* Forgets the preview function and unmaps the memory shared for previews */
+static void
+_rfcd_clear_preview (RemoteFileChooserDialog *self)
+{
+  if (self->priv->preview_notify)
+    self->priv->preview_notify (self->priv->preview_data);
+
+  if (self->priv->preview_shared)
+    munmap (self->priv->preview_shared,
+            cairo_image_surface_get_stride (self->priv->preview_back) *
+            cairo_image_surface_get_height (self->priv->preview_back));
+
+  if (self->priv->preview_back)
+    cairo_surface_destroy (self->priv->preview_back);
+
+  self->priv->preview_func   = NULL;
+  self->priv->preview_data   = NULL;
+  self->priv->preview_notify = NULL;
+  self->priv->preview_back   = NULL;
+  self->priv->preview_shared = NULL;
 }
 
 static gboolean
@@ -305,11 +807,19 @@ rfcd_dispose (GObject* object)
   if (self->priv->cached_title)
     g_free (self->priv->cached_title);
 
+  if (self->priv->choices)
+    g_variant_unref (self->priv->choices);
+  g_hash_table_unref (self->priv->choice_values);
+
+  _rfcd_clear_preview (self);
+
   syslog (LOG_DEBUG, "SandboxFileChooserDialog.Dispose: dialog '%s' was disposed.\n",
               self->priv->remote_id);
 
   if (self->priv->remote_id)
     g_free (self->priv->remote_id);
+
+  G_OBJECT_CLASS (rfcd_parent_class)->dispose (object);
 }
 
 static void
@@ -378,19 +888,20 @@ rfcd_new_valist (const gchar          *title,
   g_variant_ref_sink (button_list);
 
   GError *error = NULL;
-  sfcd_dbus_wrapper__call_new_sync (_rfcd_get_proxy (rfcd),
+  sfcd_dbus_wrapper__call_new_sync (_rfcd_call_begin (rfcd),
                                     title,
                                     parentWinId, //TODO
                                     action,
                                     button_list,
                                     &rfcd->priv->remote_id,
-                                    NULL,
+                                    _rfcd_get_cancellable (rfcd),
                                     &error);
   g_variant_unref (button_list);
   g_free (parentWinId);
 
   if (error)
   {
+    _rfcd_call_failed (rfcd, error);
     rfcd->priv->remote_id = NULL;
     g_object_unref (rfcd);
     rfcd = NULL;
@@ -459,6 +970,259 @@ rfcd_new (const gchar          *title,
   return rfcd;
 }
 
+/* Asks the server for thumbnails of a dialog's selection or of @uris */
+static SfcdThumbnails *
+_rfcd_get_thumbnails (SfcdDbusWrapper     *proxy,
+                      const gchar         *dialog_id,
+                      const gchar * const *uris,
+                      gint                 size,
+                      GCancellable        *cancellable,
+                      GError             **error)
+{
+  SfcdThumbnails *thumbnails = NULL;
+  GUnixFDList    *fd_list    = NULL;
+  GVariant       *metadata   = NULL;
+  gint            handle;
+  gint            fd;
+
+  if (!sfcd_dbus_wrapper__call_get_thumbnails_sync (proxy,
+                                                    dialog_id,
+                                                    uris,
+                                                    size,
+                                                    NULL,
+                                                    &metadata,
+                                                    &handle,
+                                                    &fd_list,
+                                                    cancellable,
+                                                    error))
+    return NULL;
+
+  if ((fd = g_unix_fd_list_get (fd_list, handle, error)) != -1)
+  {
+    thumbnails = _sandboxutils_thumbnails_new_from_fd (metadata, fd, error);
+    close (fd);
+  }
+
+  g_variant_unref (metadata);
+  g_object_unref (fd_list);
+
+  return thumbnails;
+}
+
+/**
+ * rfcd_get_thumbnails_for_uris:
+ * @uris: (array zero-terminated=1): the URIs of files to get thumbnails of
+ * @size: the size of the square the thumbnails must fit in, up to 256 pixels
+ * @error: (allow-none): return location for a #GError, or %NULL
+ *
+ * Gets thumbnails of files the user chose in earlier dialogs, e.g. to list
+ * recently opened files, without reading and decoding them through the
+ * sandbox. The server refuses files that were not chosen in a dialog run by
+ * the calling process, and needs its grant ledger to tell. See
+ * sfcd_get_thumbnails(); at most 64 files may be asked for.
+ *
+ * Return value: (transfer full): the thumbnails of @uris, in the same order,
+ *   to free with sfcd_thumbnails_free(), or %NULL if the call failed
+ *
+ * Since: 0.7
+ **/
+SfcdThumbnails *
+rfcd_get_thumbnails_for_uris (const gchar * const  *uris,
+                              gint                  size,
+                              GError              **error)
+{
+  g_return_val_if_fail (uris != NULL, NULL);
+  g_return_val_if_fail (size > 0 && size <= 256, NULL);
+
+  RemoteFileChooserDialogClass *klass = g_type_class_ref (REMOTE_TYPE_FILE_CHOOSER_DIALOG);
+  SfcdThumbnails               *thumbnails;
+  GError                       *tmp_error = NULL;
+
+  thumbnails = _rfcd_get_thumbnails (_rfcd_class_get_proxy (klass, -1), "", uris, size, NULL, &tmp_error);
+
+  if (tmp_error)
+  {
+    syslog (LOG_ALERT, "SandboxFileChooserDialog.GetThumbnailsForUris: error when querying thumbnails -- %s",
+            _sandboxutils_error_get_message (tmp_error));
+    g_propagate_error (error, tmp_error);
+  }
+
+  g_type_class_unref (klass);
+
+  return thumbnails;
+}
+
+/**
+ * rfcd_register_template:
+ * @config: a floating or owned a{sv} #GVariant describing the dialog
+ * @error: (allow-none): return location for a #GError, or %NULL
+ *
+ * Registers a dialog configuration with the server, so that dialogs can later
+ * be created from it with rfcd_new_from_template() in a single call, rather
+ * than with rfcd_new() followed by a call for every setting. This is worth it
+ * for applications that often show similar dialogs.
+ *
+ * @config may hold a title ("title", s), an action ("action", i), buttons
+ * ("buttons", a{sv} of labels to int32 response ids), the options of the
+ * dialog ("local-only", "select-multiple", "show-hidden",
+ * "do-overwrite-confirmation" and "create-folders", all b), a current folder
+ * ("current-folder" or "current-folder-uri", s), a current name
+ * ("current-name", s), shortcut folders ("shortcut-folders" or
+ * "shortcut-folder-uris", as), filters ("filters", a(sasas) of names,
+ * patterns and MIME types) and the filter to select ("filter", s). It is
+ * checked when registered, so mistakes are reported here rather than when
+ * creating dialogs.
+ *
+ * Return value: (transfer full): the id of the template, to free with
+ * g_free(), or %NULL if @config was refused or the call failed
+ *
+ * Since: 0.7
+ **/
+gchar *
+rfcd_register_template (GVariant  *config,
+                        GError   **error)
+{
+  g_return_val_if_fail (config != NULL, NULL);
+
+  RemoteFileChooserDialogClass *klass = g_type_class_ref (REMOTE_TYPE_FILE_CHOOSER_DIALOG);
+  gchar                        *template_id = NULL;
+  const gchar                  *title = NULL;
+
+  g_variant_ref_sink (config);
+
+  if (sfcd_dbus_wrapper__call_register_template_sync (_rfcd_class_get_proxy (klass, -1),
+                                                      config,
+                                                      &template_id,
+                                                      NULL,
+                                                      error))
+  {
+    if (!g_variant_lookup (config, "title", "&s", &title))
+      title = NULL;
+
+    g_hash_table_insert (klass->template_titles, g_strdup (template_id), g_strdup (title));
+
+    syslog (LOG_DEBUG, "SandboxFileChooserDialog.RegisterTemplate: template '%s' has just been registered.\n",
+            template_id);
+  }
+  else
+  {
+    syslog (LOG_ALERT, "SandboxFileChooserDialog.RegisterTemplate: error when registering template -- %s",
+            _sandboxutils_error_get_message (error ? *error : NULL));
+  }
+
+  g_variant_unref (config);
+  g_type_class_unref (klass);
+
+  return template_id;
+}
+
+/**
+ * rfcd_unregister_template:
+ * @template_id: the id of a template registered with rfcd_register_template()
+ * @error: (allow-none): return location for a #GError, or %NULL
+ *
+ * Tells the server that no more dialogs will be created from a template.
+ * Dialogs already created from it are not affected.
+ *
+ * Return value: %TRUE if the template was unregistered, %FALSE otherwise
+ *
+ * Since: 0.7
+ **/
+gboolean
+rfcd_unregister_template (const gchar  *template_id,
+                          GError      **error)
+{
+  g_return_val_if_fail (template_id != NULL, FALSE);
+
+  RemoteFileChooserDialogClass *klass = g_type_class_ref (REMOTE_TYPE_FILE_CHOOSER_DIALOG);
+  gboolean                      succeeded;
+
+  succeeded = sfcd_dbus_wrapper__call_unregister_template_sync (_rfcd_class_get_proxy (klass, -1),
+                                                                template_id,
+                                                                NULL,
+                                                                error);
+  if (succeeded)
+    g_hash_table_remove (klass->template_titles, template_id);
+  else
+    syslog (LOG_ALERT, "SandboxFileChooserDialog.UnregisterTemplate: error when unregistering template '%s' -- %s",
+            template_id, _sandboxutils_error_get_message (error ? *error : NULL));
+
+  g_type_class_unref (klass);
+
+  return succeeded;
+}
+
+/**
+ * rfcd_new_from_template:
+ * @template_id: the id of a template registered with rfcd_register_template()
+ * @overrides: (allow-none): a floating or owned a{sv} #GVariant, or %NULL
+ * @error: (allow-none): return location for a #GError, or %NULL
+ *
+ * Creates a new #RemoteFileChooserDialog configured as described by a
+ * template, in a single call to the server. @overrides takes the same keys as
+ * the template but "action" and "buttons". Its settings replace those of the
+ * template, except for shortcut folders and filters which are added to the
+ * template's.
+ *
+ * Return value: a new #SandboxFileChooserDialog, or %NULL on failure
+ *
+ * See also: rfcd_register_template() to register templates.
+ *
+ * Since: 0.7
+ **/
+SandboxFileChooserDialog *
+rfcd_new_from_template (const gchar  *template_id,
+                        GVariant     *overrides,
+                        GError      **error)
+{
+  g_return_val_if_fail (template_id != NULL, NULL);
+
+  RemoteFileChooserDialog *rfcd = g_object_new (REMOTE_TYPE_FILE_CHOOSER_DIALOG, NULL);
+  g_return_val_if_fail (rfcd != NULL, NULL);
+
+  RemoteFileChooserDialogClass *klass = REMOTE_FILE_CHOOSER_DIALOG_GET_CLASS (rfcd);
+  const gchar                  *title = NULL;
+  GError                       *tmp_error = NULL;
+
+  if (overrides)
+    g_variant_ref_sink (overrides);
+  else
+    overrides = g_variant_ref_sink (g_variant_new_array (G_VARIANT_TYPE ("{sv}"), NULL, 0));
+
+  sfcd_dbus_wrapper__call_new_from_template_sync (_rfcd_call_begin (rfcd),
+                                                  template_id,
+                                                  overrides,
+                                                  &rfcd->priv->remote_id,
+                                                  _rfcd_get_cancellable (rfcd),
+                                                  &tmp_error);
+
+  if (tmp_error)
+  {
+    _rfcd_call_failed (rfcd, tmp_error);
+    rfcd->priv->remote_id = NULL;
+    g_object_unref (rfcd);
+    syslog (LOG_ALERT, "SandboxFileChooserDialog.NewFromTemplate: error when creating dialog -- %s",
+            _sandboxutils_error_get_message (tmp_error));
+    g_propagate_error (error, tmp_error);
+    g_variant_unref (overrides);
+
+    return NULL;
+  }
+
+  if (!g_variant_lookup (overrides, "title", "&s", &title))
+    title = g_hash_table_lookup (klass->template_titles, template_id);
+
+  rfcd->priv->cached_title = g_strdup (title);
+  g_variant_unref (overrides);
+
+  syslog (LOG_DEBUG, "SandboxFileChooserDialog.NewFromTemplate: dialog '%s' ('%s') has just been created from template '%s'.\n",
+          rfcd->priv->remote_id, rfcd->priv->cached_title, template_id);
+
+  g_hash_table_insert (klass->instances, rfcd->priv->remote_id, SANDBOX_FILE_CHOOSER_DIALOG (rfcd));
+
+  return SANDBOX_FILE_CHOOSER_DIALOG (rfcd);
+}
+
 static void
 rfcd_destroy (SandboxFileChooserDialog *sfcd)
 {
@@ -466,11 +1230,12 @@ rfcd_destroy (SandboxFileChooserDialog *sfcd)
   RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
 
   GError *error = NULL;
-  if (!sfcd_dbus_wrapper__call_destroy_sync (_rfcd_get_proxy (self),
+  if (!sfcd_dbus_wrapper__call_destroy_sync (_rfcd_call_begin (self),
                                              self->priv->remote_id,
-                                             NULL,
+                                             _rfcd_get_cancellable (self),
                                              &error))
   {
+    _rfcd_call_failed (self, error);
     syslog (LOG_ALERT, "SandboxFileChooserDialog.Destroy: error when destroying dialog %s -- %s",
             self->priv->remote_id, _sandboxutils_error_get_message (error));
     g_error_free (error);
@@ -490,12 +1255,13 @@ rfcd_get_state (SandboxFileChooserDialog *sfcd)
   g_return_val_if_fail (REMOTE_IS_FILE_CHOOSER_DIALOG (self), SFCD_WRONG_STATE);
 
   GError *error = NULL;
-  if (!sfcd_dbus_wrapper__call_get_state_sync (_rfcd_get_proxy (self),
+  if (!sfcd_dbus_wrapper__call_get_state_sync (_rfcd_call_begin (self),
                                              self->priv->remote_id,
                                              &stateHolder,
-                                             NULL,
+                                             _rfcd_get_cancellable (self),
                                              &error))
   {
+    _rfcd_call_failed (self, error);
     syslog (LOG_ALERT, "SandboxFileChooserDialog.GetState: error when querying dialog %s -- %s",
             self->priv->remote_id, _sandboxutils_error_get_message (error));
     g_error_free (error);
@@ -536,6 +1302,18 @@ rfcd_get_id (SandboxFileChooserDialog *sfcd)
   return self->priv->remote_id;
 }
 
+static gboolean
+rfcd_get_timings (SandboxFileChooserDialog *sfcd,
+                  SfcdTimings              *timings)
+{
+  RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
+  g_return_val_if_fail (REMOTE_IS_FILE_CHOOSER_DIALOG (self), FALSE);
+
+  *timings = self->priv->timings;
+
+  return self->priv->timings.run_called != 0;
+}
+
 static gboolean
 _rfcd_entry_sanity_check (RemoteFileChooserDialog    *self,
                           GError                  **error)
@@ -588,6 +1366,21 @@ rfcd_get_destroy_with_parent (SandboxFileChooserDialog  *sfcd)
   return self->priv->destroy_with_parent;
 }
 
+/* Remembers what choices the server shows, with their initial values */
+static void
+_rfcd_set_cached_choices (RemoteFileChooserDialog *self,
+                          GVariant                *choices)
+{
+  if (choices)
+    g_variant_ref (choices);
+  if (self->priv->choices)
+    g_variant_unref (self->priv->choices);
+  self->priv->choices = choices;
+
+  g_hash_table_unref (self->priv->choice_values);
+  self->priv->choice_values = _sandboxutils_choices_get_defaults (choices);
+}
+
 static void
 rfcd_set_extra_widget (SandboxFileChooserDialog *sfcd,
                        GtkWidget                *widget,
@@ -605,12 +1398,13 @@ rfcd_set_extra_widget (SandboxFileChooserDialog *sfcd,
   GtkWidget *plug = gtk_plug_new (0);
   gulong plug_id = gtk_plug_get_id (GTK_PLUG (plug));
 
-  if (!sfcd_dbus_wrapper__call_set_extra_widget_sync (_rfcd_get_proxy (self),
+  if (!sfcd_dbus_wrapper__call_set_extra_widget_sync (_rfcd_call_begin (self),
                                                       self->priv->remote_id,
                                                       plug_id,
-                                                      NULL,
+                                                      _rfcd_get_cancellable (self),
                                                       error))
   {
+    _rfcd_call_failed (self, *error);
     syslog (LOG_ALERT, "SandboxFileChooserDialog.SetExtraWidget: error when modifying dialog %s -- %s",
             self->priv->remote_id, _sandboxutils_error_get_message (*error));
 
@@ -627,6 +1421,9 @@ rfcd_set_extra_widget (SandboxFileChooserDialog *sfcd,
 
     self->priv->local_bits = plug;
     self->priv->extra_widget = widget;
+
+    // The server dropped the choices along with its previous extra widget
+    _rfcd_set_cached_choices (self, NULL);
   }
 }
 
@@ -640,6 +1437,181 @@ rfcd_get_extra_widget (SandboxFileChooserDialog  *sfcd,
   return self->priv->extra_widget;
 }
 
+static void
+rfcd_set_choices (SandboxFileChooserDialog  *sfcd,
+                  GVariant                  *choices,
+                  GError                   **error)
+{
+  RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
+  g_return_if_fail (_rfcd_entry_sanity_check (self, error));
+
+  if (choices)
+    g_variant_ref_sink (choices);
+  else
+    choices = g_variant_ref_sink (g_variant_new_array (G_VARIANT_TYPE_VARDICT, NULL, 0));
+
+  // The server would refuse it anyway, no need to ask
+  if (!_sandboxutils_choices_validate (choices, error))
+  {
+    syslog (LOG_WARNING, "SandboxFileChooserDialog.SetChoices: refusing choices for dialog %s -- %s",
+            self->priv->remote_id, _sandboxutils_error_get_message (*error));
+  }
+  else if (!sfcd_dbus_wrapper__call_set_choices_sync (_rfcd_call_begin (self),
+                                                      self->priv->remote_id,
+                                                      choices,
+                                                      _rfcd_get_cancellable (self),
+                                                      error))
+  {
+    _rfcd_call_failed (self, *error);
+    syslog (LOG_ALERT, "SandboxFileChooserDialog.SetChoices: error when modifying dialog %s -- %s",
+            self->priv->remote_id, _sandboxutils_error_get_message (*error));
+  }
+  else
+  {
+    // The choices replaced the extra widget on the server
+    if (self->priv->local_bits)
+    {
+      gtk_widget_destroy (self->priv->local_bits);
+      self->priv->local_bits = NULL;
+    }
+    if (self->priv->extra_widget)
+    {
+      g_object_unref (self->priv->extra_widget);
+      self->priv->extra_widget = NULL;
+    }
+
+    _rfcd_set_cached_choices (self, g_variant_n_children (choices) ? choices : NULL);
+  }
+
+  g_variant_unref (choices);
+}
+
+static GVariant *
+rfcd_get_choice_values (SandboxFileChooserDialog  *sfcd,
+                        GError                   **error)
+{
+  RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
+  g_return_val_if_fail (_rfcd_entry_sanity_check (self, error), NULL);
+
+  return g_variant_ref_sink (_sandboxutils_choices_to_variant (self->priv->choice_values));
+}
+
+static void
+rfcd_set_preview_func (SandboxFileChooserDialog  *sfcd,
+                       gint                       width,
+                       gint                       height,
+                       SfcdPreviewFunc            func,
+                       gpointer                   user_data,
+                       GDestroyNotify             notify,
+                       GError                   **error)
+{
+  RemoteFileChooserDialog *self   = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
+  cairo_surface_t         *back   = NULL;
+  guchar                  *shared = NULL;
+  GUnixFDList             *fd_list;
+  gsize                    size   = 0;
+  gint                     fd;
+
+  g_return_if_fail (_rfcd_entry_sanity_check (self, error));
+
+  if (func)
+  {
+    // The server would refuse it anyway, no need to ask
+    if (!_sandboxutils_shm_check_image (width, height,
+                                        cairo_format_stride_for_width (CAIRO_FORMAT_ARGB32, width),
+                                        error))
+    {
+      syslog (LOG_WARNING, "SandboxFileChooserDialog.SetPreviewFunc: refusing preview for dialog %s -- %s",
+              self->priv->remote_id, _sandboxutils_error_get_message (*error));
+      goto failed;
+    }
+
+    // Previews are drawn aside, so that only what changed gets shared
+    back = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, width, height);
+    size = cairo_image_surface_get_stride (back) * height;
+
+    // The buffer is written to for as long as the preview is used
+    fd = _sandboxutils_shm_new ("sfcd-preview", size, error);
+    if (fd != -1 && !_sandboxutils_shm_seal (fd, FALSE, error))
+    {
+      close (fd);
+      fd = -1;
+    }
+
+    if (fd == -1)
+    {
+      syslog (LOG_ALERT, "SandboxFileChooserDialog.SetPreviewFunc: no shared memory for dialog %s -- %s",
+              self->priv->remote_id, _sandboxutils_error_get_message (*error));
+      goto failed;
+    }
+
+    shared = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (shared == MAP_FAILED)
+    {
+      shared = NULL;
+      close (fd);
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "SandboxFileChooserDialog.SetPreviewFunc: could not map the preview buffer of dialog %s.\n",
+                   self->priv->remote_id);
+      syslog (LOG_ALERT, "%s", _sandboxutils_error_get_message (*error));
+      goto failed;
+    }
+
+    // The list takes the descriptor over, the mapping stays valid without it
+    fd_list = g_unix_fd_list_new_from_array (&fd, 1);
+
+    if (!sfcd_dbus_wrapper__call_set_preview_buffer_sync (_rfcd_call_begin (self),
+                                                          self->priv->remote_id,
+                                                          0,
+                                                          width,
+                                                          height,
+                                                          cairo_image_surface_get_stride (back),
+                                                          fd_list,
+                                                          NULL,
+                                                          _rfcd_get_cancellable (self),
+                                                          error))
+    {
+      g_object_unref (fd_list);
+      _rfcd_call_failed (self, *error);
+      syslog (LOG_ALERT, "SandboxFileChooserDialog.SetPreviewFunc: error when modifying dialog %s -- %s",
+              self->priv->remote_id, _sandboxutils_error_get_message (*error));
+      goto failed;
+    }
+
+    g_object_unref (fd_list);
+  }
+  else if (self->priv->preview_func &&
+           !sfcd_dbus_wrapper__call_unset_preview_buffer_sync (_rfcd_call_begin (self),
+                                                               self->priv->remote_id,
+                                                               _rfcd_get_cancellable (self),
+                                                               error))
+  {
+    _rfcd_call_failed (self, *error);
+    syslog (LOG_ALERT, "SandboxFileChooserDialog.SetPreviewFunc: error when modifying dialog %s -- %s",
+            self->priv->remote_id, _sandboxutils_error_get_message (*error));
+    return;
+  }
+
+  _rfcd_clear_preview (self);
+  self->priv->preview_func   = func;
+  self->priv->preview_data   = user_data;
+  self->priv->preview_notify = notify;
+  self->priv->preview_back   = back;
+  self->priv->preview_shared = shared;
+
+  return;
+
+failed:
+  if (shared)
+    munmap (shared, size);
+  if (back)
+    cairo_surface_destroy (back);
+
+  // The caller's data is ours from now on, even if we cannot use it
+  if (notify)
+    notify (user_data);
+}
+
 /* RUNNING METHODS */
 //TODO handlers for GDBus signals
 
@@ -650,11 +1622,19 @@ rfcd_run (SandboxFileChooserDialog *sfcd,
   RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
   g_return_if_fail (_rfcd_entry_sanity_check (self, error));
 
-  if (!sfcd_dbus_wrapper__call_run_sync (_rfcd_get_proxy (self),
+  // The server sends these back along with the other phases in the response
+  memset (&self->priv->timings, 0, sizeof (SfcdTimings));
+  self->priv->timings.correlation_id = ((guint64) getpid () << 32) | ++__rfcd_run_counter;
+  self->priv->timings.run_called     = g_get_monotonic_time ();
+
+  if (!sfcd_dbus_wrapper__call_run_sync (_rfcd_call_begin (self),
                                          self->priv->remote_id,
-                                         NULL,
+                                         self->priv->timings.correlation_id,
+                                         self->priv->timings.run_called,
+                                         _rfcd_get_cancellable (self),
                                          error))
   {
+    _rfcd_call_failed (self, *error);
     syslog (LOG_ALERT, "SandboxFileChooserDialog.Run: error when running dialog %s -- %s",
             self->priv->remote_id, _sandboxutils_error_get_message (*error));
   }
@@ -667,11 +1647,12 @@ rfcd_present (SandboxFileChooserDialog  *sfcd,
   RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
   g_return_if_fail (_rfcd_entry_sanity_check (self, error));
 
-  if (!sfcd_dbus_wrapper__call_present_sync (_rfcd_get_proxy (self),
+  if (!sfcd_dbus_wrapper__call_present_sync (_rfcd_call_begin (self),
                                              self->priv->remote_id,
-                                             NULL,
+                                             _rfcd_get_cancellable (self),
                                              error))
   {
+    _rfcd_call_failed (self, *error);
     syslog (LOG_ALERT, "SandboxFileChooserDialog.Present: error when presenting dialog %s -- %s",
             self->priv->remote_id, _sandboxutils_error_get_message (*error));
   }
@@ -684,16 +1665,41 @@ rfcd_cancel_run (SandboxFileChooserDialog  *sfcd,
   RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
   g_return_if_fail (_rfcd_entry_sanity_check (self, error));
 
-  if (!sfcd_dbus_wrapper__call_cancel_run_sync (_rfcd_get_proxy (self),
+  if (!sfcd_dbus_wrapper__call_cancel_run_sync (_rfcd_call_begin (self),
                                                 self->priv->remote_id,
-                                                NULL,
+                                                _rfcd_get_cancellable (self),
                                                 error))
   {
+    _rfcd_call_failed (self, *error);
     syslog (LOG_ALERT, "SandboxFileChooserDialog.CancelRun: error when cancelling the run of dialog %s -- %s",
             self->priv->remote_id, _sandboxutils_error_get_message (*error));
   }
 }
 
+static void
+rfcd_reset (SandboxFileChooserDialog  *sfcd,
+            SfcdResetFlags             flags,
+            GError                   **error)
+{
+  RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
+  g_return_if_fail (_rfcd_entry_sanity_check (self, error));
+
+  if (!sfcd_dbus_wrapper__call_reset_sync (_rfcd_call_begin (self),
+                                           self->priv->remote_id,
+                                           flags,
+                                           _rfcd_get_cancellable (self),
+                                           error))
+  {
+    _rfcd_call_failed (self, *error);
+    syslog (LOG_ALERT, "SandboxFileChooserDialog.Reset: error when resetting dialog %s -- %s",
+            self->priv->remote_id, _sandboxutils_error_get_message (*error));
+  }
+  else if (flags & SFCD_RESET_CHOICES)
+  {
+    _rfcd_set_cached_choices (self, self->priv->choices);
+  }
+}
+
 static void
 rfcd_select_filename (SandboxFileChooserDialog  *sfcd,
                       const gchar               *filename,
@@ -702,12 +1708,13 @@ rfcd_select_filename (SandboxFileChooserDialog  *sfcd,
   RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
   g_return_if_fail (_rfcd_entry_sanity_check (self, error));
 
-  if (!sfcd_dbus_wrapper__call_select_filename_sync (_rfcd_get_proxy (self),
+  if (!sfcd_dbus_wrapper__call_select_filename_sync (_rfcd_call_begin (self),
                                                      self->priv->remote_id,
                                                      filename,
-                                                     NULL,
+                                                     _rfcd_get_cancellable (self),
                                                      error))
   {
+    _rfcd_call_failed (self, *error);
     syslog (LOG_ALERT, "SandboxFileChooserDialog.SelectFilename: error when modifying dialog %s -- %s",
             self->priv->remote_id, _sandboxutils_error_get_message (*error));
   }
@@ -721,12 +1728,13 @@ rfcd_unselect_filename (SandboxFileChooserDialog  *sfcd,
   RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
   g_return_if_fail (_rfcd_entry_sanity_check (self, error));
 
-  if (!sfcd_dbus_wrapper__call_unselect_filename_sync (_rfcd_get_proxy (self),
+  if (!sfcd_dbus_wrapper__call_unselect_filename_sync (_rfcd_call_begin (self),
                                                        self->priv->remote_id,
                                                        filename,
-                                                       NULL,
+                                                       _rfcd_get_cancellable (self),
                                                        error))
   {
+    _rfcd_call_failed (self, *error);
     syslog (LOG_ALERT, "SandboxFileChooserDialog.UnselectFilename: error when modifying dialog %s -- %s",
             self->priv->remote_id, _sandboxutils_error_get_message (*error));
   }
@@ -739,11 +1747,12 @@ rfcd_select_all (SandboxFileChooserDialog  *sfcd,
   RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
   g_return_if_fail (_rfcd_entry_sanity_check (self, error));
 
-  if (!sfcd_dbus_wrapper__call_select_all_sync (_rfcd_get_proxy (self),
+  if (!sfcd_dbus_wrapper__call_select_all_sync (_rfcd_call_begin (self),
                                                 self->priv->remote_id,
-                                                NULL,
+                                                _rfcd_get_cancellable (self),
                                                 error))
   {
+    _rfcd_call_failed (self, *error);
     syslog (LOG_ALERT, "SandboxFileChooserDialog.SelectAll: error when modifying dialog %s -- %s",
             self->priv->remote_id, _sandboxutils_error_get_message (*error));
   }
@@ -756,11 +1765,12 @@ rfcd_unselect_all (SandboxFileChooserDialog  *sfcd,
   RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
   g_return_if_fail (_rfcd_entry_sanity_check (self, error));
 
-  if (!sfcd_dbus_wrapper__call_unselect_all_sync (_rfcd_get_proxy (self),
+  if (!sfcd_dbus_wrapper__call_unselect_all_sync (_rfcd_call_begin (self),
                                                   self->priv->remote_id,
-                                                  NULL,
+                                                  _rfcd_get_cancellable (self),
                                                   error))
   {
+    _rfcd_call_failed (self, *error);
     syslog (LOG_ALERT, "SandboxFileChooserDialog.UnselectAll: error when modifying dialog %s -- %s",
             self->priv->remote_id, _sandboxutils_error_get_message (*error));
   }
@@ -774,12 +1784,13 @@ rfcd_select_uri (SandboxFileChooserDialog  *sfcd,
   RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
   g_return_if_fail (_rfcd_entry_sanity_check (self, error));
 
-  if (!sfcd_dbus_wrapper__call_select_uri_sync (_rfcd_get_proxy (self),
+  if (!sfcd_dbus_wrapper__call_select_uri_sync (_rfcd_call_begin (self),
                                                 self->priv->remote_id,
                                                 uri,
-                                                NULL,
+                                                _rfcd_get_cancellable (self),
                                                 error))
   {
+    _rfcd_call_failed (self, *error);
     syslog (LOG_ALERT, "SandboxFileChooserDialog.SelectUri: error when modifying dialog %s -- %s",
             self->priv->remote_id, _sandboxutils_error_get_message (*error));
   }
@@ -793,12 +1804,13 @@ rfcd_unselect_uri (SandboxFileChooserDialog  *sfcd,
   RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
   g_return_if_fail (_rfcd_entry_sanity_check (self, error));
 
-  if (!sfcd_dbus_wrapper__call_unselect_uri_sync (_rfcd_get_proxy (self),
+  if (!sfcd_dbus_wrapper__call_unselect_uri_sync (_rfcd_call_begin (self),
                                                   self->priv->remote_id,
                                                   uri,
-                                                  NULL,
+                                                  _rfcd_get_cancellable (self),
                                                   error))
   {
+    _rfcd_call_failed (self, *error);
     syslog (LOG_ALERT, "SandboxFileChooserDialog.UnselectUri: error when modifying dialog %s -- %s",
             self->priv->remote_id, _sandboxutils_error_get_message (*error));
   }
@@ -812,12 +1824,13 @@ rfcd_set_action (SandboxFileChooserDialog  *sfcd,
   RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
   g_return_if_fail (_rfcd_entry_sanity_check (self, error));
 
-  if (!sfcd_dbus_wrapper__call_set_action_sync (_rfcd_get_proxy (self),
+  if (!sfcd_dbus_wrapper__call_set_action_sync (_rfcd_call_begin (self),
                                                 self->priv->remote_id,
                                                 action,
-                                                NULL,
+                                                _rfcd_get_cancellable (self),
                                                 error))
   {
+    _rfcd_call_failed (self, *error);
     syslog (LOG_ALERT, "SandboxFileChooserDialog.SetAction: error when modifying dialog %s -- %s",
             self->priv->remote_id, _sandboxutils_error_get_message (*error));
   }
@@ -831,12 +1844,13 @@ rfcd_get_action (SandboxFileChooserDialog *sfcd,
   RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
   g_return_val_if_fail (REMOTE_IS_FILE_CHOOSER_DIALOG (self), result);
 
-  if (!sfcd_dbus_wrapper__call_get_action_sync (_rfcd_get_proxy (self),
+  if (!sfcd_dbus_wrapper__call_get_action_sync (_rfcd_call_begin (self),
                                                 self->priv->remote_id,
                                                 &result,
-                                                NULL,
+                                                _rfcd_get_cancellable (self),
                                                 error))
   {
+    _rfcd_call_failed (self, *error);
     syslog (LOG_ALERT, "SandboxFileChooserDialog.GetAction: error when querying dialog %s -- %s",
             self->priv->remote_id, _sandboxutils_error_get_message (*error));
   }
@@ -852,12 +1866,13 @@ rfcd_set_local_only (SandboxFileChooserDialog  *sfcd,
   RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
   g_return_if_fail (_rfcd_entry_sanity_check (self, error));
 
-  if (!sfcd_dbus_wrapper__call_set_local_only_sync (_rfcd_get_proxy (self),
+  if (!sfcd_dbus_wrapper__call_set_local_only_sync (_rfcd_call_begin (self),
                                                     self->priv->remote_id,
                                                     local_only,
-                                                    NULL,
+                                                    _rfcd_get_cancellable (self),
                                                     error))
   {
+    _rfcd_call_failed (self, *error);
     syslog (LOG_ALERT, "SandboxFileChooserDialog.SetLocalOnly: error when modifying dialog %s -- %s",
             self->priv->remote_id, _sandboxutils_error_get_message (*error));
   }
@@ -871,12 +1886,13 @@ rfcd_get_local_only (SandboxFileChooserDialog  *sfcd,
   RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
   g_return_val_if_fail (REMOTE_IS_FILE_CHOOSER_DIALOG (self), result);
 
-  if (!sfcd_dbus_wrapper__call_get_local_only_sync (_rfcd_get_proxy (self),
+  if (!sfcd_dbus_wrapper__call_get_local_only_sync (_rfcd_call_begin (self),
                                                     self->priv->remote_id,
                                                     &result,
-                                                    NULL,
+                                                    _rfcd_get_cancellable (self),
                                                     error))
   {
+    _rfcd_call_failed (self, *error);
     syslog (LOG_ALERT, "SandboxFileChooserDialog.GetLocalOnly: error when querying dialog %s -- %s",
             self->priv->remote_id, _sandboxutils_error_get_message (*error));
   }
@@ -892,12 +1908,13 @@ rfcd_set_select_multiple (SandboxFileChooserDialog *sfcd,
   RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
   g_return_if_fail (_rfcd_entry_sanity_check (self, error));
 
-  if (!sfcd_dbus_wrapper__call_set_select_multiple_sync (_rfcd_get_proxy (self),
+  if (!sfcd_dbus_wrapper__call_set_select_multiple_sync (_rfcd_call_begin (self),
                                                          self->priv->remote_id,
                                                          select_multiple,
-                                                         NULL,
+                                                         _rfcd_get_cancellable (self),
                                                          error))
   {
+    _rfcd_call_failed (self, *error);
     syslog (LOG_ALERT, "SandboxFileChooserDialog.SetSelectMultiple: error when modifying dialog %s -- %s",
             self->priv->remote_id, _sandboxutils_error_get_message (*error));
   }
@@ -911,12 +1928,13 @@ rfcd_get_select_multiple (SandboxFileChooserDialog  *sfcd,
   RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
   g_return_val_if_fail (REMOTE_IS_FILE_CHOOSER_DIALOG (self), result);
 
-  if (!sfcd_dbus_wrapper__call_get_select_multiple_sync (_rfcd_get_proxy (self),
+  if (!sfcd_dbus_wrapper__call_get_select_multiple_sync (_rfcd_call_begin (self),
                                                          self->priv->remote_id,
                                                         &result,
-                                                         NULL,
+                                                         _rfcd_get_cancellable (self),
                                                          error))
   {
+    _rfcd_call_failed (self, *error);
     syslog (LOG_ALERT, "SandboxFileChooserDialog.GetSelectMultiple: error when querying dialog %s -- %s",
             self->priv->remote_id, _sandboxutils_error_get_message (*error));
   }
@@ -932,12 +1950,13 @@ rfcd_set_show_hidden (SandboxFileChooserDialog  *sfcd,
   RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
   g_return_if_fail (_rfcd_entry_sanity_check (self, error));
 
-  if (!sfcd_dbus_wrapper__call_set_show_hidden_sync (_rfcd_get_proxy (self),
+  if (!sfcd_dbus_wrapper__call_set_show_hidden_sync (_rfcd_call_begin (self),
                                                      self->priv->remote_id,
                                                      show_hidden,
-                                                     NULL,
+                                                     _rfcd_get_cancellable (self),
                                                      error))
   {
+    _rfcd_call_failed (self, *error);
     syslog (LOG_ALERT, "SandboxFileChooserDialog.SetShowHidden: error when modifying dialog %s -- %s",
             self->priv->remote_id, _sandboxutils_error_get_message (*error));
   }
@@ -951,12 +1970,13 @@ rfcd_get_show_hidden (SandboxFileChooserDialog *sfcd,
   RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
   g_return_val_if_fail (REMOTE_IS_FILE_CHOOSER_DIALOG (self), result);
 
-  if (!sfcd_dbus_wrapper__call_get_show_hidden_sync (_rfcd_get_proxy (self),
+  if (!sfcd_dbus_wrapper__call_get_show_hidden_sync (_rfcd_call_begin (self),
                                                      self->priv->remote_id,
                                                      &result,
-                                                     NULL,
+                                                     _rfcd_get_cancellable (self),
                                                      error))
   {
+    _rfcd_call_failed (self, *error);
     syslog (LOG_ALERT, "SandboxFileChooserDialog.GetShowHidden: error when querying dialog %s -- %s",
             self->priv->remote_id, _sandboxutils_error_get_message (*error));
   }
@@ -972,12 +1992,13 @@ rfcd_set_do_overwrite_confirmation (SandboxFileChooserDialog  *sfcd,
   RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
   g_return_if_fail (_rfcd_entry_sanity_check (self, error));
 
-  if (!sfcd_dbus_wrapper__call_set_do_overwrite_confirmation_sync (_rfcd_get_proxy (self),
+  if (!sfcd_dbus_wrapper__call_set_do_overwrite_confirmation_sync (_rfcd_call_begin (self),
                                                                    self->priv->remote_id,
                                                                    do_overwrite_confirmation,
-                                                                   NULL,
+                                                                   _rfcd_get_cancellable (self),
                                                                    error))
   {
+    _rfcd_call_failed (self, *error);
     syslog (LOG_ALERT, "SandboxFileChooserDialog.SetDoOverwriteConfirmation: error when modifying dialog %s -- %s",
             self->priv->remote_id, _sandboxutils_error_get_message (*error));
   }
@@ -992,12 +2013,13 @@ rfcd_get_do_overwrite_confirmation (SandboxFileChooserDialog  *sfcd,
   RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
   g_return_val_if_fail (REMOTE_IS_FILE_CHOOSER_DIALOG (self), result);
 
-  if (!sfcd_dbus_wrapper__call_get_do_overwrite_confirmation_sync (_rfcd_get_proxy (self),
+  if (!sfcd_dbus_wrapper__call_get_do_overwrite_confirmation_sync (_rfcd_call_begin (self),
                                                                    self->priv->remote_id,
                                                                    &result,
-                                                                   NULL,
+                                                                   _rfcd_get_cancellable (self),
                                                                    error))
   {
+    _rfcd_call_failed (self, *error);
     syslog (LOG_ALERT, "SandboxFileChooserDialog.GetDoOverwriteConfirmation: error when querying dialog %s -- %s",
             self->priv->remote_id, _sandboxutils_error_get_message (*error));
   }
@@ -1013,12 +2035,13 @@ rfcd_set_create_folders (SandboxFileChooserDialog  *sfcd,
   RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
   g_return_if_fail (_rfcd_entry_sanity_check (self, error));
 
-  if (!sfcd_dbus_wrapper__call_set_create_folders_sync (_rfcd_get_proxy (self),
+  if (!sfcd_dbus_wrapper__call_set_create_folders_sync (_rfcd_call_begin (self),
                                                         self->priv->remote_id,
                                                         create_folders,
-                                                        NULL,
+                                                        _rfcd_get_cancellable (self),
                                                         error))
   {
+    _rfcd_call_failed (self, *error);
     syslog (LOG_ALERT, "SandboxFileChooserDialog.SetCreateFolders: error when modifying dialog %s -- %s",
             self->priv->remote_id, _sandboxutils_error_get_message (*error));
   }
@@ -1032,12 +2055,13 @@ rfcd_get_create_folders (SandboxFileChooserDialog  *sfcd,
   RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
   g_return_val_if_fail (REMOTE_IS_FILE_CHOOSER_DIALOG (self), result);
 
-  if (!sfcd_dbus_wrapper__call_get_create_folders_sync (_rfcd_get_proxy (self),
+  if (!sfcd_dbus_wrapper__call_get_create_folders_sync (_rfcd_call_begin (self),
                                                     self->priv->remote_id,
                                                     &result,
-                                                    NULL,
+                                                    _rfcd_get_cancellable (self),
                                                     error))
   {
+    _rfcd_call_failed (self, *error);
     syslog (LOG_ALERT, "SandboxFileChooserDialog.GetCreateFolders: error when querying dialog %s -- %s",
             self->priv->remote_id, _sandboxutils_error_get_message (*error));
   }
@@ -1053,12 +2077,13 @@ rfcd_set_current_name (SandboxFileChooserDialog  *sfcd,
   RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
   g_return_if_fail (_rfcd_entry_sanity_check (self, error));
 
-  if (!sfcd_dbus_wrapper__call_set_current_name_sync (_rfcd_get_proxy (self),
+  if (!sfcd_dbus_wrapper__call_set_current_name_sync (_rfcd_call_begin (self),
                                                       self->priv->remote_id,
                                                       name,
-                                                      NULL,
+                                                      _rfcd_get_cancellable (self),
                                                       error))
   {
+    _rfcd_call_failed (self, *error);
     syslog (LOG_ALERT, "SandboxFileChooserDialog.SetCurrentName: error when modifying dialog %s -- %s",
             self->priv->remote_id, _sandboxutils_error_get_message (*error));
   }
@@ -1072,12 +2097,13 @@ rfcd_set_filename (SandboxFileChooserDialog  *sfcd,
   RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
   g_return_if_fail (_rfcd_entry_sanity_check (self, error));
 
-  if (!sfcd_dbus_wrapper__call_set_filename_sync (_rfcd_get_proxy (self),
+  if (!sfcd_dbus_wrapper__call_set_filename_sync (_rfcd_call_begin (self),
                                                   self->priv->remote_id,
                                                   filename,
-                                                  NULL,
+                                                  _rfcd_get_cancellable (self),
                                                   error))
   {
+    _rfcd_call_failed (self, *error);
     syslog (LOG_ALERT, "SandboxFileChooserDialog.SetFilename: error when modifying dialog %s -- %s",
             self->priv->remote_id, _sandboxutils_error_get_message (*error));
   }
@@ -1091,12 +2117,13 @@ rfcd_set_current_folder (SandboxFileChooserDialog  *sfcd,
   RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
   g_return_if_fail (_rfcd_entry_sanity_check (self, error));
 
-  if (!sfcd_dbus_wrapper__call_set_current_folder_sync (_rfcd_get_proxy (self),
+  if (!sfcd_dbus_wrapper__call_set_current_folder_sync (_rfcd_call_begin (self),
                                                         self->priv->remote_id,
                                                         filename,
-                                                        NULL,
+                                                        _rfcd_get_cancellable (self),
                                                         error))
   {
+    _rfcd_call_failed (self, *error);
     syslog (LOG_ALERT, "SandboxFileChooserDialog.SetCurrentFolder: error when modifying dialog %s -- %s",
             self->priv->remote_id, _sandboxutils_error_get_message (*error));
   }
@@ -1110,12 +2137,13 @@ rfcd_set_uri (SandboxFileChooserDialog  *sfcd,
   RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
   g_return_if_fail (_rfcd_entry_sanity_check (self, error));
 
-  if (!sfcd_dbus_wrapper__call_set_uri_sync (_rfcd_get_proxy (self),
+  if (!sfcd_dbus_wrapper__call_set_uri_sync (_rfcd_call_begin (self),
                                              self->priv->remote_id,
                                              uri,
-                                             NULL,
+                                             _rfcd_get_cancellable (self),
                                              error))
   {
+    _rfcd_call_failed (self, *error);
     syslog (LOG_ALERT, "SandboxFileChooserDialog.SetUri: error when modifying dialog %s -- %s",
             self->priv->remote_id, _sandboxutils_error_get_message (*error));
   }
@@ -1129,12 +2157,13 @@ rfcd_set_current_folder_uri (SandboxFileChooserDialog  *sfcd,
   RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
   g_return_if_fail (_rfcd_entry_sanity_check (self, error));
 
-  if (!sfcd_dbus_wrapper__call_set_current_folder_uri_sync (_rfcd_get_proxy (self),
+  if (!sfcd_dbus_wrapper__call_set_current_folder_uri_sync (_rfcd_call_begin (self),
                                                             self->priv->remote_id,
                                                             uri,
-                                                            NULL,
+                                                            _rfcd_get_cancellable (self),
                                                             error))
   {
+    _rfcd_call_failed (self, *error);
     syslog (LOG_ALERT, "SandboxFileChooserDialog.SetCurrentFolderUri: error when modifying dialog %s -- %s",
             self->priv->remote_id, _sandboxutils_error_get_message (*error));
   }
@@ -1149,12 +2178,13 @@ rfcd_add_shortcut_folder (SandboxFileChooserDialog  *sfcd,
   RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
   g_return_val_if_fail (_rfcd_entry_sanity_check (self, error), FALSE);
 
-  if (!(succeeded = sfcd_dbus_wrapper__call_add_shortcut_folder_sync (_rfcd_get_proxy (self),
+  if (!(succeeded = sfcd_dbus_wrapper__call_add_shortcut_folder_sync (_rfcd_call_begin (self),
                                                                       self->priv->remote_id,
                                                                       folder,
-                                                                      NULL,
+                                                                      _rfcd_get_cancellable (self),
                                                                       error)))
   {
+    _rfcd_call_failed (self, *error);
     syslog (LOG_ALERT, "SandboxFileChooserDialog.AddShortcutFolder: error when modifying dialog %s -- %s",
             self->priv->remote_id, _sandboxutils_error_get_message (*error));
   }
@@ -1171,12 +2201,13 @@ rfcd_remove_shortcut_folder (SandboxFileChooserDialog  *sfcd,
   RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
   g_return_val_if_fail (_rfcd_entry_sanity_check (self, error), FALSE);
 
-  if (!(succeeded = sfcd_dbus_wrapper__call_remove_shortcut_folder_sync (_rfcd_get_proxy (self),
+  if (!(succeeded = sfcd_dbus_wrapper__call_remove_shortcut_folder_sync (_rfcd_call_begin (self),
                                                                          self->priv->remote_id,
                                                                          folder,
-                                                                         NULL,
+                                                                         _rfcd_get_cancellable (self),
                                                                          error)))
   {
+    _rfcd_call_failed (self, *error);
     syslog (LOG_ALERT, "SandboxFileChooserDialog.RemoveShortcutFolder: error when modifying dialog %s -- %s",
             self->priv->remote_id, _sandboxutils_error_get_message (*error));
   }
@@ -1193,12 +2224,13 @@ rfcd_list_shortcut_folders (SandboxFileChooserDialog *sfcd,
   RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
   g_return_val_if_fail (_rfcd_entry_sanity_check (self, error), NULL);
 
-  if (!sfcd_dbus_wrapper__call_list_shortcut_folders_sync (_rfcd_get_proxy (self),
+  if (!sfcd_dbus_wrapper__call_list_shortcut_folders_sync (_rfcd_call_begin (self),
                                                            self->priv->remote_id,
                                                            &array,
-                                                           NULL,
+                                                           _rfcd_get_cancellable (self),
                                                            error))
   {
+    _rfcd_call_failed (self, *error);
     syslog (LOG_ALERT, "SandboxFileChooserDialog.ListShortcutFolders: error when querying dialog %s -- %s",
             self->priv->remote_id, _sandboxutils_error_get_message (*error));
   }
@@ -1222,12 +2254,13 @@ rfcd_add_shortcut_folder_uri (SandboxFileChooserDialog  *sfcd,
   RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
   g_return_val_if_fail (_rfcd_entry_sanity_check (self, error), FALSE);
 
-  if (!(succeeded = sfcd_dbus_wrapper__call_add_shortcut_folder_uri_sync (_rfcd_get_proxy (self),
+  if (!(succeeded = sfcd_dbus_wrapper__call_add_shortcut_folder_uri_sync (_rfcd_call_begin (self),
                                                                           self->priv->remote_id,
                                                                           uri,
-                                                                          NULL,
+                                                                          _rfcd_get_cancellable (self),
                                                                           error)))
   {
+    _rfcd_call_failed (self, *error);
     syslog (LOG_ALERT, "SandboxFileChooserDialog.AddShortcutFolderUri: error when modifying dialog %s -- %s",
             self->priv->remote_id, _sandboxutils_error_get_message (*error));
   }
@@ -1244,12 +2277,13 @@ rfcd_remove_shortcut_folder_uri (SandboxFileChooserDialog *sfcd,
   RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
   g_return_val_if_fail (_rfcd_entry_sanity_check (self, error), FALSE);
 
-  if (!(succeeded = sfcd_dbus_wrapper__call_remove_shortcut_folder_uri_sync (_rfcd_get_proxy (self),
+  if (!(succeeded = sfcd_dbus_wrapper__call_remove_shortcut_folder_uri_sync (_rfcd_call_begin (self),
                                                                              self->priv->remote_id,
                                                                              uri,
-                                                                             NULL,
+                                                                             _rfcd_get_cancellable (self),
                                                                              error)))
   {
+    _rfcd_call_failed (self, *error);
     syslog (LOG_ALERT, "SandboxFileChooserDialog.RemoveShortcutFolderUri: error when modifying dialog %s -- %s",
             self->priv->remote_id, _sandboxutils_error_get_message (*error));
   }
@@ -1266,12 +2300,13 @@ rfcd_list_shortcut_folder_uris (SandboxFileChooserDialog *sfcd,
   RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
   g_return_val_if_fail (_rfcd_entry_sanity_check (self, error), NULL);
 
-  if (!sfcd_dbus_wrapper__call_list_shortcut_folder_uris_sync (_rfcd_get_proxy (self),
+  if (!sfcd_dbus_wrapper__call_list_shortcut_folder_uris_sync (_rfcd_call_begin (self),
                                                                self->priv->remote_id,
                                                                &array,
-                                                               NULL,
+                                                               _rfcd_get_cancellable (self),
                                                                error))
   {
+    _rfcd_call_failed (self, *error);
     syslog (LOG_ALERT, "SandboxFileChooserDialog.ListShortcutFolderUris: error when querying dialog %s -- %s",
             self->priv->remote_id, _sandboxutils_error_get_message (*error));
   }
@@ -1286,6 +2321,138 @@ rfcd_list_shortcut_folder_uris (SandboxFileChooserDialog *sfcd,
   return list;
 }
 
+static gboolean
+rfcd_add_filter (SandboxFileChooserDialog  *sfcd,
+                 const gchar               *name,
+                 const gchar * const       *patterns,
+                 const gchar * const       *mime_types,
+                 GError                   **error)
+{
+  const gchar *none[] = { NULL };
+  gboolean succeeded = FALSE;
+  RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
+  g_return_val_if_fail (_rfcd_entry_sanity_check (self, error), FALSE);
+
+  // D-Bus has no NULL arrays
+  if (!(succeeded = sfcd_dbus_wrapper__call_add_filter_sync (_rfcd_call_begin (self),
+                                                             self->priv->remote_id,
+                                                             name,
+                                                             patterns ? patterns : none,
+                                                             mime_types ? mime_types : none,
+                                                             _rfcd_get_cancellable (self),
+                                                             error)))
+  {
+    _rfcd_call_failed (self, *error);
+    syslog (LOG_ALERT, "SandboxFileChooserDialog.AddFilter: error when modifying dialog %s -- %s",
+            self->priv->remote_id, _sandboxutils_error_get_message (*error));
+  }
+
+  return succeeded;
+}
+
+static gboolean
+rfcd_remove_filter (SandboxFileChooserDialog  *sfcd,
+                    const gchar               *name,
+                    GError                   **error)
+{
+  gboolean succeeded = FALSE;
+  RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
+  g_return_val_if_fail (_rfcd_entry_sanity_check (self, error), FALSE);
+
+  if (!(succeeded = sfcd_dbus_wrapper__call_remove_filter_sync (_rfcd_call_begin (self),
+                                                                self->priv->remote_id,
+                                                                name,
+                                                                _rfcd_get_cancellable (self),
+                                                                error)))
+  {
+    _rfcd_call_failed (self, *error);
+    syslog (LOG_ALERT, "SandboxFileChooserDialog.RemoveFilter: error when modifying dialog %s -- %s",
+            self->priv->remote_id, _sandboxutils_error_get_message (*error));
+  }
+
+  return succeeded;
+}
+
+static GSList *
+rfcd_list_filters (SandboxFileChooserDialog *sfcd,
+                   GError                    **error)
+{
+  GSList *list  = NULL;
+  gchar **array = NULL;
+  guint   i;
+  RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
+  g_return_val_if_fail (_rfcd_entry_sanity_check (self, error), NULL);
+
+  if (!sfcd_dbus_wrapper__call_list_filters_sync (_rfcd_call_begin (self),
+                                                  self->priv->remote_id,
+                                                  &array,
+                                                  _rfcd_get_cancellable (self),
+                                                  error))
+  {
+    _rfcd_call_failed (self, *error);
+    syslog (LOG_ALERT, "SandboxFileChooserDialog.ListFilters: error when querying dialog %s -- %s",
+            self->priv->remote_id, _sandboxutils_error_get_message (*error));
+  }
+  else
+  {
+    // The list takes the strings over, only the array is freed
+    for (i = 0; array[i]; i++)
+      list = g_slist_prepend (list, array[i]);
+    list = g_slist_reverse (list);
+    g_free (array);
+  }
+
+  return list;
+}
+
+static void
+rfcd_set_filter (SandboxFileChooserDialog  *sfcd,
+                 const gchar               *name,
+                 GError                   **error)
+{
+  RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
+  g_return_if_fail (_rfcd_entry_sanity_check (self, error));
+
+  if (!sfcd_dbus_wrapper__call_set_filter_sync (_rfcd_call_begin (self),
+                                                self->priv->remote_id,
+                                                name,
+                                                _rfcd_get_cancellable (self),
+                                                error))
+  {
+    _rfcd_call_failed (self, *error);
+    syslog (LOG_ALERT, "SandboxFileChooserDialog.SetFilter: error when modifying dialog %s -- %s",
+            self->priv->remote_id, _sandboxutils_error_get_message (*error));
+  }
+}
+
+static gchar *
+rfcd_get_filter (SandboxFileChooserDialog *sfcd,
+                 GError                    **error)
+{
+  gchar *name = NULL;
+  RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
+  g_return_val_if_fail (_rfcd_entry_sanity_check (self, error), NULL);
+
+  if (!sfcd_dbus_wrapper__call_get_filter_sync (_rfcd_call_begin (self),
+                                                self->priv->remote_id,
+                                                &name,
+                                                _rfcd_get_cancellable (self),
+                                                error))
+  {
+    _rfcd_call_failed (self, *error);
+    syslog (LOG_ALERT, "SandboxFileChooserDialog.GetFilter: error when querying dialog %s -- %s",
+            self->priv->remote_id, _sandboxutils_error_get_message (*error));
+  }
+  // The server sends an empty name for dialogs without a filter
+  else if (name && *name == '\0')
+  {
+    g_free (name);
+    name = NULL;
+  }
+
+  return name;
+}
+
 static gchar *
 rfcd_get_current_name (SandboxFileChooserDialog *sfcd,
                        GError                    **error)
@@ -1294,12 +2461,13 @@ rfcd_get_current_name (SandboxFileChooserDialog *sfcd,
   RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
   g_return_val_if_fail (_rfcd_entry_sanity_check (self, error), NULL);
 
-  if (!sfcd_dbus_wrapper__call_get_current_name_sync (_rfcd_get_proxy (self),
+  if (!sfcd_dbus_wrapper__call_get_current_name_sync (_rfcd_call_begin (self),
                                                       self->priv->remote_id,
                                                       &name,
-                                                      NULL,
+                                                      _rfcd_get_cancellable (self),
                                                       error))
   {
+    _rfcd_call_failed (self, *error);
     syslog (LOG_ALERT, "SandboxFileChooserDialog.GetCurrentName: error when querying dialog %s -- %s",
             self->priv->remote_id, _sandboxutils_error_get_message (*error));
   }
@@ -1315,12 +2483,13 @@ rfcd_get_filename (SandboxFileChooserDialog *sfcd,
   RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
   g_return_val_if_fail (_rfcd_entry_sanity_check (self, error), NULL);
 
-  if (!sfcd_dbus_wrapper__call_get_filename_sync (_rfcd_get_proxy (self),
+  if (!sfcd_dbus_wrapper__call_get_filename_sync (_rfcd_call_begin (self),
                                                   self->priv->remote_id,
                                                   &filename,
-                                                  NULL,
+                                                  _rfcd_get_cancellable (self),
                                                   error))
   {
+    _rfcd_call_failed (self, *error);
     syslog (LOG_ALERT, "SandboxFileChooserDialog.GetFilename: error when running dialog %s -- %s",
             self->priv->remote_id, _sandboxutils_error_get_message (*error));
   }
@@ -1337,12 +2506,13 @@ rfcd_get_filenames (SandboxFileChooserDialog *sfcd,
   RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
   g_return_val_if_fail (_rfcd_entry_sanity_check (self, error), NULL);
 
-  if (!sfcd_dbus_wrapper__call_get_filenames_sync (_rfcd_get_proxy (self),
+  if (!sfcd_dbus_wrapper__call_get_filenames_sync (_rfcd_call_begin (self),
                                                    self->priv->remote_id,
                                                    &array,
-                                                   NULL,
+                                                   _rfcd_get_cancellable (self),
                                                    error))
   {
+    _rfcd_call_failed (self, *error);
     syslog (LOG_ALERT, "SandboxFileChooserDialog.GetFilenames: error when querying dialog %s -- %s",
             self->priv->remote_id, _sandboxutils_error_get_message (*error));
   }
@@ -1365,12 +2535,13 @@ rfcd_get_current_folder (SandboxFileChooserDialog *sfcd,
   RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
   g_return_val_if_fail (_rfcd_entry_sanity_check (self, error), NULL);
 
-  if (!sfcd_dbus_wrapper__call_get_current_folder_sync (_rfcd_get_proxy (self),
+  if (!sfcd_dbus_wrapper__call_get_current_folder_sync (_rfcd_call_begin (self),
                                                         self->priv->remote_id,
                                                         &filename,
-                                                        NULL,
+                                                        _rfcd_get_cancellable (self),
                                                         error))
   {
+    _rfcd_call_failed (self, *error);
     syslog (LOG_ALERT, "SandboxFileChooserDialog.GetCurrentFolder: error when running dialog %s -- %s",
             self->priv->remote_id, _sandboxutils_error_get_message (*error));
   }
@@ -1386,12 +2557,13 @@ rfcd_get_uri (SandboxFileChooserDialog *sfcd,
   RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
   g_return_val_if_fail (_rfcd_entry_sanity_check (self, error), NULL);
 
-  if (!sfcd_dbus_wrapper__call_get_uri_sync (_rfcd_get_proxy (self),
+  if (!sfcd_dbus_wrapper__call_get_uri_sync (_rfcd_call_begin (self),
                                              self->priv->remote_id,
                                              &uri,
-                                             NULL,
+                                             _rfcd_get_cancellable (self),
                                              error))
   {
+    _rfcd_call_failed (self, *error);
     syslog (LOG_ALERT, "SandboxFileChooserDialog.GetUri: error when running dialog %s -- %s",
             self->priv->remote_id, _sandboxutils_error_get_message (*error));
   }
@@ -1408,12 +2580,13 @@ rfcd_get_uris (SandboxFileChooserDialog *sfcd,
   RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
   g_return_val_if_fail (_rfcd_entry_sanity_check (self, error), NULL);
 
-  if (!sfcd_dbus_wrapper__call_get_uris_sync (_rfcd_get_proxy (self),
+  if (!sfcd_dbus_wrapper__call_get_uris_sync (_rfcd_call_begin (self),
                                               self->priv->remote_id,
                                               &array,
-                                              NULL,
+                                              _rfcd_get_cancellable (self),
                                               error))
   {
+    _rfcd_call_failed (self, *error);
     syslog (LOG_ALERT, "SandboxFileChooserDialog.GetUris: error when querying dialog %s -- %s",
             self->priv->remote_id, _sandboxutils_error_get_message (*error));
   }
@@ -1428,6 +2601,57 @@ rfcd_get_uris (SandboxFileChooserDialog *sfcd,
   return list;
 }
 
+static SfcdThumbnails *
+rfcd_get_thumbnails (SandboxFileChooserDialog  *sfcd,
+                     gint                       size,
+                     GError                   **error)
+{
+  SfcdThumbnails          *thumbnails;
+  const gchar             *none[] = { NULL };
+  RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
+  g_return_val_if_fail (_rfcd_entry_sanity_check (self, error), NULL);
+
+  thumbnails = _rfcd_get_thumbnails (_rfcd_call_begin (self),
+                                     self->priv->remote_id,
+                                     none,
+                                     size,
+                                     _rfcd_get_cancellable (self),
+                                     error);
+
+  if (!thumbnails)
+  {
+    _rfcd_call_failed (self, *error);
+    syslog (LOG_ALERT, "SandboxFileChooserDialog.GetThumbnails: error when querying dialog %s -- %s",
+            self->priv->remote_id, _sandboxutils_error_get_message (*error));
+  }
+
+  return thumbnails;
+}
+
+static GVariant *
+rfcd_get_selection_info (SandboxFileChooserDialog  *sfcd,
+                         const gchar               *attributes,
+                         GError                   **error)
+{
+  GVariant                *files = NULL;
+  RemoteFileChooserDialog *self  = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
+  g_return_val_if_fail (_rfcd_entry_sanity_check (self, error), NULL);
+
+  if (!sfcd_dbus_wrapper__call_get_selection_info_sync (_rfcd_call_begin (self),
+                                                        self->priv->remote_id,
+                                                        attributes,
+                                                        &files,
+                                                        _rfcd_get_cancellable (self),
+                                                        error))
+  {
+    _rfcd_call_failed (self, *error);
+    syslog (LOG_ALERT, "SandboxFileChooserDialog.GetSelectionInfo: error when querying dialog %s -- %s",
+            self->priv->remote_id, _sandboxutils_error_get_message (*error));
+  }
+
+  return files;
+}
+
 static gchar *
 rfcd_get_current_folder_uri (SandboxFileChooserDialog *sfcd,
                              GError                    **error)
@@ -1436,12 +2660,13 @@ rfcd_get_current_folder_uri (SandboxFileChooserDialog *sfcd,
   RemoteFileChooserDialog *self = REMOTE_FILE_CHOOSER_DIALOG (sfcd);
   g_return_val_if_fail (_rfcd_entry_sanity_check (self, error), NULL);
 
-  if (!sfcd_dbus_wrapper__call_get_current_folder_uri_sync (_rfcd_get_proxy (self),
+  if (!sfcd_dbus_wrapper__call_get_current_folder_uri_sync (_rfcd_call_begin (self),
                                                             self->priv->remote_id,
                                                             &uri,
-                                                            NULL,
+                                                            _rfcd_get_cancellable (self),
                                                             error))
   {
+    _rfcd_call_failed (self, *error);
     syslog (LOG_ALERT, "SandboxFileChooserDialog.GetCurrentFolderUri: error when running dialog %s -- %s",
             self->priv->remote_id, _sandboxutils_error_get_message (*error));
   }
@@ -1461,6 +2686,12 @@ rfcd_class_init (RemoteFileChooserDialogClass *klass)
                                             NULL,
                                             NULL);
 
+  /* Titles of registered templates, since dialogs cache their title */
+  klass->template_titles = g_hash_table_new_full (g_str_hash,
+                                                  g_str_equal,
+                                                  g_free,
+                                                  g_free);
+
   /* Hook finalization functions */
   g_object_class->dispose = rfcd_dispose; /* instance destructor, reverse of init */
   g_object_class->finalize = rfcd_finalize; /* class finalization, reverse of class init */
@@ -1472,13 +2703,20 @@ rfcd_class_init (RemoteFileChooserDialogClass *klass)
   sfcd_class->destroy = rfcd_destroy;
   sfcd_class->get_dialog_title = rfcd_get_dialog_title;
   sfcd_class->get_id = rfcd_get_id;
+  sfcd_class->get_timings = rfcd_get_timings;
   sfcd_class->run = rfcd_run;
   sfcd_class->present = rfcd_present;
   sfcd_class->cancel_run = rfcd_cancel_run;
+  sfcd_class->reset = rfcd_reset;
   sfcd_class->set_destroy_with_parent = rfcd_set_destroy_with_parent;
   sfcd_class->get_destroy_with_parent = rfcd_get_destroy_with_parent;
   sfcd_class->set_extra_widget = rfcd_set_extra_widget;
   sfcd_class->get_extra_widget = rfcd_get_extra_widget;
+  sfcd_class->set_choices = rfcd_set_choices;
+  sfcd_class->get_choice_values = rfcd_get_choice_values;
+  sfcd_class->set_preview_func = rfcd_set_preview_func;
+  sfcd_class->get_thumbnails = rfcd_get_thumbnails;
+  sfcd_class->get_selection_info = rfcd_get_selection_info;
   sfcd_class->select_filename = rfcd_select_filename;
   sfcd_class->unselect_filename = rfcd_unselect_filename;
   sfcd_class->select_all = rfcd_select_all;
@@ -1508,6 +2746,11 @@ rfcd_class_init (RemoteFileChooserDialogClass *klass)
   sfcd_class->add_shortcut_folder_uri = rfcd_add_shortcut_folder_uri;
   sfcd_class->remove_shortcut_folder_uri = rfcd_remove_shortcut_folder_uri;
   sfcd_class->list_shortcut_folder_uris = rfcd_list_shortcut_folder_uris;
+  sfcd_class->add_filter = rfcd_add_filter;
+  sfcd_class->remove_filter = rfcd_remove_filter;
+  sfcd_class->list_filters = rfcd_list_filters;
+  sfcd_class->set_filter = rfcd_set_filter;
+  sfcd_class->get_filter = rfcd_get_filter;
   sfcd_class->get_current_name = rfcd_get_current_name;
   sfcd_class->get_filename = rfcd_get_filename;
   sfcd_class->get_filenames = rfcd_get_filenames;
@@ -1517,5 +2760,9 @@ rfcd_class_init (RemoteFileChooserDialogClass *klass)
   sfcd_class->get_current_folder_uri = rfcd_get_current_folder_uri;
 
   klass->proxy = NULL;
-  _rfcd_class_proxy_init (klass);
+  klass->proxy_pending = FALSE;
+
+  // Create the proxy in the background once connected, which happens early
+  // if sandboxutils_init() was called, and lazily on first use otherwise
+  _sandboxutils_connection_when_ready (_rfcd_class_proxy_prefetch, klass);
 }
@@ -55,6 +55,10 @@ struct _RemoteFileChooserDialogClass
 
   GHashTable *instances;
   GDBusProxy *proxy;
+
+  /* Since 0.7 */
+  GHashTable *template_titles;
+  gboolean    proxy_pending;
 };
 
 GType rfcd_get_type (void);
@@ -73,6 +77,24 @@ rfcd_new (const gchar          *title,
           const gchar          *first_button_text,
           ...);
 
+gchar *
+rfcd_register_template (GVariant  *config,
+                        GError   **error);
+
+gboolean
+rfcd_unregister_template (const gchar  *template_id,
+                          GError      **error);
+
+SandboxFileChooserDialog *
+rfcd_new_from_template (const gchar  *template_id,
+                        GVariant     *overrides,
+                        GError      **error);
+
+SfcdThumbnails *
+rfcd_get_thumbnails_for_uris (const gchar * const  *uris,
+                              gint                  size,
+                              GError              **error);
+
 G_END_DECLS
 
 #endif /* __REMOTE_FILE_CHOOSER_DIALOG_H__ */
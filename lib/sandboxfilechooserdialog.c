@@ -94,13 +94,21 @@
 
 #include <glib.h>
 #include <gtk/gtk.h>
+#include <string.h>
+#include <syslog.h>
 
 #include "sandboxfilechooserdialog.h"
 #include "sandboxutilsmarshals.h"
 #include "localfilechooserdialog.h"
 #include "remotefilechooserdialog.h"
 
-G_DEFINE_TYPE (SandboxFileChooserDialog, sfcd, G_TYPE_OBJECT)
+typedef struct _SandboxFileChooserDialogPrivate
+{
+  gint                  timeout;      /* ms to wait for remote calls, -1 for default */
+  GCancellable         *cancellable;  /* cancels remote calls (allow-none) */
+} SandboxFileChooserDialogPrivate;
+
+G_DEFINE_TYPE_WITH_PRIVATE (SandboxFileChooserDialog, sfcd, G_TYPE_OBJECT)
 
 /**
  * SandboxFileChooserDialog:SfcdAcceptLabels:
@@ -256,11 +264,19 @@ gboolean sfcd_is_accept_label (const gchar *label)
 static void
 sfcd_init (SandboxFileChooserDialog *self)
 {
+  SandboxFileChooserDialogPrivate *priv = sfcd_get_instance_private (self);
+
+  priv->timeout     = -1;
+  priv->cancellable = NULL;
 }
 
 static void
 sfcd_dispose (GObject* object)
 {
+  SandboxFileChooserDialogPrivate *priv = sfcd_get_instance_private (SANDBOX_FILE_CHOOSER_DIALOG (object));
+
+  g_clear_object (&priv->cancellable);
+
   G_OBJECT_CLASS (sfcd_parent_class)->dispose (object);
 }
 
@@ -337,6 +353,28 @@ sfcd_class_init (SandboxFileChooserDialogClass *klass)
 		  G_TYPE_INT,
 		  G_TYPE_INT);
 
+  /**
+   * SandboxFileChooserDialog::choices-changed:
+   * @dialog: the dialog on which the signal is emitted
+   * @changes: an a{sv} #GVariant of the ids and new values of the choices
+   *
+   * Emitted when the user changes the choices set with sfcd_set_choices().
+   * Changes made in quick succession are reported together. The values of
+   * all choices can be read with sfcd_get_choice_values() once the dialog
+   * responded, without waiting for this signal.
+   *
+   * Since: 0.7
+   */
+  klass->choices_changed_signal  =
+    g_signal_new ("choices-changed",
+		  G_OBJECT_CLASS_TYPE (g_object_class),
+		  G_SIGNAL_RUN_LAST,
+		  0,
+		  NULL, NULL,
+      sandboxutils_marshal_VOID__VARIANT,
+		  G_TYPE_NONE, 1,
+		  G_TYPE_VARIANT);
+
   /**
    * SandboxFileChooserDialog::show:
    * @dialog: the dialog on which the signal is emitted
@@ -369,10 +407,13 @@ sfcd_class_init (SandboxFileChooserDialogClass *klass)
  * Creates a new #SandboxFileChooserDialog. Depending on the settings of Sandbox
  * Utils (see sandboxutils_init()), this may either spawn a locally-owned
  * GTK+ dialog or a handle to a remotely-owned dialog controlled over D-Bus.
+ *
+ * If remote dialogs are enabled but their server is not running, this fails
+ * right away or creates a local dialog, as set with sandboxutils_set_fallback().
  * 
  * This is equivalent to gtk_file_chooser_dialog_new() in the GTK+ API.
  *
- * Return value: a new #SandboxFileChooserDialog
+ * Return value: a new #SandboxFileChooserDialog, or %NULL on failure
  *
  * Since: 0.5
  **/
@@ -388,10 +429,18 @@ sfcd_new (const gchar *title,
   va_list varargs;
   va_start(varargs, first_button_text);
 
-  if (sandboxutils_get_sandboxed ())
+  // Do not wait for a server that is known to be missing
+  if (sandboxutils_get_sandboxed () && sandboxutils_get_server_available ())
     sfcd = rfcd_new_valist (title, parent, action, first_button_text, varargs);
-  else
+  else if (!sandboxutils_get_sandboxed ())
+    sfcd = lfcd_new_valist (title, NULL, parent, action, first_button_text, varargs);
+  else if (sandboxutils_get_fallback () == SANDBOXUTILS_FALLBACK_LOCAL)
+  {
+    syslog (LOG_WARNING, "SandboxFileChooserDialog.New: no server is running, using a local dialog instead.\n");
     sfcd = lfcd_new_valist (title, NULL, parent, action, first_button_text, varargs);
+  }
+  else
+    syslog (LOG_WARNING, "SandboxFileChooserDialog.New: no server is running, cannot create a dialog.\n");
 
   va_end(varargs);
 
@@ -526,6 +575,400 @@ sfcd_get_id (SandboxFileChooserDialog *self)
   return SANDBOX_FILE_CHOOSER_DIALOG_GET_CLASS (self)->get_id (self);
 }
 
+/**
+ * sfcd_get_timings:
+ * @dialog: a #SandboxFileChooserDialog
+ * @timings: (out caller-allocates): a #SfcdTimings to fill
+ * 
+ * Gets the phases of the current or last run of the @dialog, from the call to
+ * sfcd_run() to the response of the user. Use this to measure how long users
+ * wait for a dialog to appear, and how long they spend in the dialog.
+ *
+ * This method can be called from any #SfcdState. It has no GTK+ equivalent.
+ * 
+ * Returns: %TRUE if @dialog has been run at least once, %FALSE otherwise.
+ *
+ * Since: 0.7
+ **/
+gboolean
+sfcd_get_timings (SandboxFileChooserDialog *self,
+                  SfcdTimings              *timings)
+{
+  g_return_val_if_fail (SANDBOX_IS_FILE_CHOOSER_DIALOG (self), FALSE);
+  g_return_val_if_fail (timings != NULL, FALSE);
+
+  return SANDBOX_FILE_CHOOSER_DIALOG_GET_CLASS (self)->get_timings (self, timings);
+}
+
+G_LOCK_DEFINE_STATIC (_sfcd_timing_stats);
+static SfcdTimingStats _sfcd_timing_stats;
+
+/**
+ * sfcd_get_timing_stats:
+ * @stats: (out caller-allocates): a #SfcdTimingStats to fill
+ * 
+ * Gets aggregate timings of all the dialogs that were run by this process
+ * since it started, or since the last call to sfcd_reset_timing_stats().
+ *
+ * Since: 0.7
+ **/
+void
+sfcd_get_timing_stats (SfcdTimingStats *stats)
+{
+  g_return_if_fail (stats != NULL);
+
+  G_LOCK (_sfcd_timing_stats);
+  *stats = _sfcd_timing_stats;
+  G_UNLOCK (_sfcd_timing_stats);
+}
+
+/**
+ * sfcd_reset_timing_stats:
+ * 
+ * Resets the aggregate timings returned by sfcd_get_timing_stats().
+ *
+ * Since: 0.7
+ **/
+void
+sfcd_reset_timing_stats (void)
+{
+  G_LOCK (_sfcd_timing_stats);
+  memset (&_sfcd_timing_stats, 0, sizeof (SfcdTimingStats));
+  G_UNLOCK (_sfcd_timing_stats);
+}
+
+/**
+ * _sfcd_record_timings:
+ * @timings: the #SfcdTimings of a run that just reached a response
+ * 
+ * Adds the timings of a run to the aggregate timings of the process. Called
+ * by #SandboxFileChooserDialog implementations when a run is over.
+ *
+ * Since: 0.7
+ */
+void
+_sfcd_record_timings (const SfcdTimings *timings)
+{
+  gint64 delay;
+
+  g_return_if_fail (timings != NULL);
+
+  G_LOCK (_sfcd_timing_stats);
+  _sfcd_timing_stats.runs++;
+
+  if (timings->run_called && timings->painted)
+  {
+    delay = timings->painted - timings->run_called;
+    _sfcd_timing_stats.time_to_paint_total += delay;
+    _sfcd_timing_stats.time_to_paint_max = MAX (_sfcd_timing_stats.time_to_paint_max, delay);
+  }
+
+  if (timings->painted && timings->responded)
+    _sfcd_timing_stats.think_time_total += timings->responded - timings->painted;
+
+  if (timings->responded && timings->response_received)
+    _sfcd_timing_stats.response_latency_total += timings->response_received - timings->responded;
+
+  G_UNLOCK (_sfcd_timing_stats);
+}
+
+/**
+ * _sfcd_timings_to_variant:
+ * @timings: a #SfcdTimings
+ * 
+ * Serialises @timings so they can be sent over GDBus.
+ *
+ * Returns: (transfer floating): a #GVariant of type a{sx}
+ *
+ * Since: 0.7
+ */
+GVariant *
+_sfcd_timings_to_variant (const SfcdTimings *timings)
+{
+  GVariantBuilder builder;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sx}"));
+  g_variant_builder_add (&builder, "{sx}", "correlation-id", (gint64) timings->correlation_id);
+  g_variant_builder_add (&builder, "{sx}", "run-called", timings->run_called);
+  g_variant_builder_add (&builder, "{sx}", "run-received", timings->run_received);
+  g_variant_builder_add (&builder, "{sx}", "run-dispatched", timings->run_dispatched);
+  g_variant_builder_add (&builder, "{sx}", "shown", timings->shown);
+  g_variant_builder_add (&builder, "{sx}", "mapped", timings->mapped);
+  g_variant_builder_add (&builder, "{sx}", "painted", timings->painted);
+  g_variant_builder_add (&builder, "{sx}", "responded", timings->responded);
+
+  return g_variant_builder_end (&builder);
+}
+
+/**
+ * _sfcd_timings_from_variant:
+ * @timings: a #SfcdTimings to update
+ * @variant: a #GVariant of type a{sx} made by _sfcd_timings_to_variant()
+ * 
+ * Updates @timings with the phases found in @variant. Phases missing from
+ * @variant are left untouched.
+ *
+ * Since: 0.7
+ */
+void
+_sfcd_timings_from_variant (SfcdTimings *timings,
+                            GVariant    *variant)
+{
+  GVariantIter  iter;
+  const gchar  *key;
+  gint64        value;
+
+  g_return_if_fail (timings != NULL);
+  g_return_if_fail (variant != NULL);
+
+  g_variant_iter_init (&iter, variant);
+  while (g_variant_iter_next (&iter, "{&sx}", &key, &value))
+  {
+    if (g_strcmp0 (key, "correlation-id") == 0)
+      timings->correlation_id = (guint64) value;
+    else if (g_strcmp0 (key, "run-called") == 0)
+      timings->run_called = value;
+    else if (g_strcmp0 (key, "run-received") == 0)
+      timings->run_received = value;
+    else if (g_strcmp0 (key, "run-dispatched") == 0)
+      timings->run_dispatched = value;
+    else if (g_strcmp0 (key, "shown") == 0)
+      timings->shown = value;
+    else if (g_strcmp0 (key, "mapped") == 0)
+      timings->mapped = value;
+    else if (g_strcmp0 (key, "painted") == 0)
+      timings->painted = value;
+    else if (g_strcmp0 (key, "responded") == 0)
+      timings->responded = value;
+  }
+}
+
+/**
+ * sfcd_set_timeout:
+ * @dialog: a #SandboxFileChooserDialog
+ * @timeout_msec: how long to wait for each call, in milliseconds, -1 for the
+ *  default timeout of D-Bus (25 seconds) or %G_MAXINT to wait forever
+ * 
+ * Sets how long the methods of a #RemoteFileChooserDialog may wait for the
+ * server to answer before failing with %G_IO_ERROR_TIMED_OUT. The server is
+ * then told to skip the calls of this @dialog that it has not processed yet.
+ * Calls to a #LocalFileChooserDialog do not wait for another process and are
+ * not affected.
+ *
+ * This method can be called from any #SfcdState. It has no GTK+ equivalent.
+ *
+ * See also: sfcd_push_deadline() to bound a group of calls.
+ *
+ * Since: 0.7
+ **/
+void
+sfcd_set_timeout (SandboxFileChooserDialog *self,
+                  gint                      timeout_msec)
+{
+  SandboxFileChooserDialogPrivate *priv;
+
+  g_return_if_fail (SANDBOX_IS_FILE_CHOOSER_DIALOG (self));
+  g_return_if_fail (timeout_msec >= -1);
+
+  priv = sfcd_get_instance_private (self);
+  priv->timeout = timeout_msec;
+}
+
+/**
+ * sfcd_get_timeout:
+ * @dialog: a #SandboxFileChooserDialog
+ * 
+ * Gets the timeout set with sfcd_set_timeout().
+ *
+ * Returns: the timeout of the calls made on behalf of @dialog, in
+ * milliseconds, or -1 if the default timeout is used
+ *
+ * Since: 0.7
+ **/
+gint
+sfcd_get_timeout (SandboxFileChooserDialog *self)
+{
+  SandboxFileChooserDialogPrivate *priv;
+
+  g_return_val_if_fail (SANDBOX_IS_FILE_CHOOSER_DIALOG (self), -1);
+
+  priv = sfcd_get_instance_private (self);
+  return priv->timeout;
+}
+
+/**
+ * sfcd_set_cancellable:
+ * @dialog: a #SandboxFileChooserDialog
+ * @cancellable: (allow-none): a #GCancellable, or %NULL
+ * 
+ * Sets a #GCancellable that makes the pending and future calls made on behalf
+ * of a #RemoteFileChooserDialog fail with %G_IO_ERROR_CANCELLED once
+ * cancelled, e.g. when the window that needed the @dialog is closed. The
+ * server is then told to skip the calls of this @dialog that it has not
+ * processed yet.
+ *
+ * When @dialog has no #GCancellable, the one pushed on the calling thread
+ * with g_cancellable_push_current() is used, if any. This allows cancelling
+ * individual calls.
+ *
+ * This method can be called from any #SfcdState. It has no GTK+ equivalent.
+ *
+ * Since: 0.7
+ **/
+void
+sfcd_set_cancellable (SandboxFileChooserDialog *self,
+                      GCancellable             *cancellable)
+{
+  SandboxFileChooserDialogPrivate *priv;
+
+  g_return_if_fail (SANDBOX_IS_FILE_CHOOSER_DIALOG (self));
+  g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+
+  priv = sfcd_get_instance_private (self);
+
+  if (cancellable)
+    g_object_ref (cancellable);
+  g_clear_object (&priv->cancellable);
+  priv->cancellable = cancellable;
+}
+
+/**
+ * sfcd_get_cancellable:
+ * @dialog: a #SandboxFileChooserDialog
+ * 
+ * Gets the #GCancellable set with sfcd_set_cancellable().
+ *
+ * Returns: (transfer none): the #GCancellable of @dialog, or %NULL
+ *
+ * Since: 0.7
+ **/
+GCancellable *
+sfcd_get_cancellable (SandboxFileChooserDialog *self)
+{
+  SandboxFileChooserDialogPrivate *priv;
+
+  g_return_val_if_fail (SANDBOX_IS_FILE_CHOOSER_DIALOG (self), NULL);
+
+  priv = sfcd_get_instance_private (self);
+  return priv->cancellable;
+}
+
+// Stack of deadlines of the calling thread, each no later than the previous
+static GPrivate _sfcd_deadlines = G_PRIVATE_INIT ((GDestroyNotify) g_array_unref);
+
+/**
+ * sfcd_push_deadline:
+ * @deadline: a time from the monotonic clock (see g_get_monotonic_time()),
+ *  in microseconds
+ * 
+ * Makes the calls made by the current thread on behalf of any
+ * #RemoteFileChooserDialog fail with %G_IO_ERROR_TIMED_OUT if they are not
+ * answered by @deadline, until sfcd_pop_deadline() is called. Use this to
+ * bound the time spent on a sequence of calls, e.g. to configure and run a
+ * dialog within a UI frame budget.
+ *
+ * Deadlines can be nested, and an inner deadline cannot extend an outer one.
+ * The timeout of each dialog (see sfcd_set_timeout()) still applies if it is
+ * shorter.
+ *
+ * Since: 0.7
+ **/
+void
+sfcd_push_deadline (gint64 deadline)
+{
+  GArray *deadlines = g_private_get (&_sfcd_deadlines);
+
+  if (!deadlines)
+  {
+    deadlines = g_array_new (FALSE, FALSE, sizeof (gint64));
+    g_private_set (&_sfcd_deadlines, deadlines);
+  }
+
+  if (deadlines->len)
+    deadline = MIN (deadline, g_array_index (deadlines, gint64, deadlines->len - 1));
+
+  g_array_append_val (deadlines, deadline);
+}
+
+/**
+ * sfcd_pop_deadline:
+ * 
+ * Removes the deadline last set by the current thread with
+ * sfcd_push_deadline().
+ *
+ * Since: 0.7
+ **/
+void
+sfcd_pop_deadline (void)
+{
+  GArray *deadlines = g_private_get (&_sfcd_deadlines);
+
+  g_return_if_fail (deadlines != NULL && deadlines->len > 0);
+
+  g_array_set_size (deadlines, deadlines->len - 1);
+}
+
+/**
+ * _sfcd_get_call_timeout:
+ * @dialog: a #SandboxFileChooserDialog
+ * 
+ * Computes how long a call made now on behalf of @dialog may wait, given the
+ * timeout of @dialog and the deadline of the calling thread.
+ *
+ * Returns: a timeout in milliseconds, or -1 for the default timeout
+ *
+ * Since: 0.7
+ */
+gint
+_sfcd_get_call_timeout (SandboxFileChooserDialog *self)
+{
+  SandboxFileChooserDialogPrivate *priv;
+  GArray                          *deadlines;
+  gint64                           remaining;
+  gint                             timeout;
+
+  g_return_val_if_fail (SANDBOX_IS_FILE_CHOOSER_DIALOG (self), -1);
+
+  priv      = sfcd_get_instance_private (self);
+  deadlines = g_private_get (&_sfcd_deadlines);
+  timeout   = priv->timeout;
+
+  if (deadlines && deadlines->len)
+  {
+    remaining = g_array_index (deadlines, gint64, deadlines->len - 1) - g_get_monotonic_time ();
+
+    // A passed deadline still needs a timeout, 0 would mean the default one
+    remaining = CLAMP (remaining / 1000, 1, G_MAXINT);
+
+    if (timeout < 0 || remaining < timeout)
+      timeout = remaining;
+  }
+
+  return timeout;
+}
+
+/**
+ * _sfcd_get_call_cancellable:
+ * @dialog: a #SandboxFileChooserDialog
+ * 
+ * Gets the #GCancellable to pass to a call made now on behalf of @dialog.
+ *
+ * Returns: (transfer none): the #GCancellable of @dialog, or else the one of
+ * the calling thread, or %NULL
+ *
+ * Since: 0.7
+ */
+GCancellable *
+_sfcd_get_call_cancellable (SandboxFileChooserDialog *self)
+{
+  SandboxFileChooserDialogPrivate *priv;
+
+  g_return_val_if_fail (SANDBOX_IS_FILE_CHOOSER_DIALOG (self), NULL);
+
+  priv = sfcd_get_instance_private (self);
+  return priv->cancellable ? priv->cancellable : g_cancellable_get_current ();
+}
+
 /**
  * _sfcd_entry_sanity_check:
  * @dialog: a #SandboxFileChooserDialog
@@ -798,6 +1241,35 @@ sfcd_cancel_run (SandboxFileChooserDialog  *self,
   SANDBOX_FILE_CHOOSER_DIALOG_GET_CLASS (self)->cancel_run (self, error);
 }
 
+/**
+ * sfcd_reset:
+ * @dialog: a #SandboxFileChooserDialog
+ * @flags: what to clear, see #SfcdResetFlags
+ * @error: a placeholder for a #GError
+ * 
+ * Puts a @dialog that is not running back into the %SFCD_CONFIGURATION
+ * #SfcdState, clearing what @flags ask for, so that it can be used again.
+ * This is much cheaper than destroying it and creating a new one: the
+ * underlying GTK+ dialog is kept, along with its sidebar and the contents of
+ * the folders it already loaded, so it shows up faster next time. Use this
+ * for dialogs that an application opens again and again, e.g. "Save As".
+ *
+ * This method can be called from the %SFCD_CONFIGURATION and
+ * %SFCD_DATA_RETRIEVAL states. It has no GTK+ equivalent. Do remember to check
+ * if @error is set after running this method.
+ *
+ * Since: 0.7
+ **/
+void
+sfcd_reset (SandboxFileChooserDialog  *self,
+            SfcdResetFlags             flags,
+            GError                   **error)
+{
+  g_return_if_fail (_sfcd_entry_sanity_check (self, error));
+
+  SANDBOX_FILE_CHOOSER_DIALOG_GET_CLASS (self)->reset (self, flags, error);
+}
+
 
 /* CONFIGURATION METHODS */
 /**
@@ -851,6 +1323,113 @@ sfcd_get_extra_widget (SandboxFileChooserDialog *self,
   return SANDBOX_FILE_CHOOSER_DIALOG_GET_CLASS (self)->get_extra_widget (self, error);
 }
 
+/**
+ * sfcd_set_choices:
+ * @dialog: a #SandboxFileChooserDialog
+ * @choices: (allow-none): a floating or owned aa{sv} #GVariant describing the
+ *  choices, or %NULL to remove them
+ * @error: a placeholder for a #GError
+ *
+ * Adds a panel of choices to @dialog, built by the process that shows the
+ * dialog rather than by your application. Unlike sfcd_set_extra_widget(),
+ * this needs no widget embedding, works on any display server, and does not
+ * slow down the dialog when it is remote. It replaces the extra widget.
+ *
+ * @choices holds one a{sv} per row of the panel. Each row has a "type",
+ * which is "label" for a line of text, "toggle" for a check box or "choice"
+ * for a drop-down list. Toggles and choices have an "id", a "label" and an
+ * optional initial "value": a boolean for toggles, the id of an option for
+ * choices. Choices list their "options" as an a(ss) of ids and labels, and
+ * start on the first one by default.
+ *
+ * The values of the choices can be read with sfcd_get_choice_values(), and
+ * their changes are reported by the #SandboxFileChooserDialog::choices-changed
+ * signal.
+ *
+ * This method can be called from any #SfcdState but %SFCD_RUNNING. Do
+ * remember to check if @error is set after running this method.
+ *
+ * Since: 0.7
+ **/
+void
+sfcd_set_choices (SandboxFileChooserDialog  *self,
+                  GVariant                  *choices,
+                  GError                   **error)
+{
+  g_return_if_fail (_sfcd_entry_sanity_check (self, error));
+
+  SANDBOX_FILE_CHOOSER_DIALOG_GET_CLASS (self)->set_choices (self, choices, error);
+}
+
+/**
+ * sfcd_get_choice_values:
+ * @dialog: a #SandboxFileChooserDialog
+ * @error: a placeholder for a #GError
+ *
+ * Gets the values of the choices set with sfcd_set_choices(): the ids of the
+ * toggles and choices, along with a boolean for toggles and the id of the
+ * selected option for choices. Values are sent along with the response of
+ * remote dialogs, so reading them does not contact the server.
+ *
+ * This method can be called from any #SfcdState. Do remember to check if
+ * @error is set after running this method. If set, the return value is
+ * undefined.
+ *
+ * Return value: (transfer full): an a{sv} #GVariant, empty if @dialog has no
+ * choices, to free with g_variant_unref()
+ *
+ * Since: 0.7
+ **/
+GVariant *
+sfcd_get_choice_values (SandboxFileChooserDialog  *self,
+                        GError                   **error)
+{
+  g_return_val_if_fail (_sfcd_entry_sanity_check (self, error), NULL);
+
+  return SANDBOX_FILE_CHOOSER_DIALOG_GET_CLASS (self)->get_choice_values (self, error);
+}
+
+/**
+ * sfcd_set_preview_func:
+ * @dialog: a #SandboxFileChooserDialog
+ * @width: width of the preview area, in pixels
+ * @height: height of the preview area, in pixels
+ * @func: (allow-none): a #SfcdPreviewFunc drawing previews, or %NULL to
+ *  remove the preview area
+ * @user_data: (allow-none): data to pass to @func
+ * @notify: (allow-none): a function to free @user_data, or %NULL
+ * @error: a placeholder for a #GError
+ *
+ * Gives @dialog a preview area drawn by your application. Whenever the user
+ * highlights a file, @func is called with a read-only descriptor of that file
+ * and a cairo context of @width by @height pixels. This lets applications
+ * preview formats only they understand, such as CAD drawings or RAW photos,
+ * without being told the names of the files the user browses through.
+ *
+ * Remote dialogs draw into memory shared with the server and only tell it
+ * which parts changed. Previews of files the user quickly moved past are
+ * skipped, so @func may not be called for every highlighted file. Neither
+ * side of the preview area may exceed 1024 pixels.
+ *
+ * This method can be called from any #SfcdState but %SFCD_RUNNING. Do
+ * remember to check if @error is set after running this method.
+ *
+ * Since: 0.7
+ **/
+void
+sfcd_set_preview_func (SandboxFileChooserDialog  *self,
+                       gint                       width,
+                       gint                       height,
+                       SfcdPreviewFunc            func,
+                       gpointer                   user_data,
+                       GDestroyNotify             notify,
+                       GError                   **error)
+{
+  g_return_if_fail (_sfcd_entry_sanity_check (self, error));
+
+  SANDBOX_FILE_CHOOSER_DIALOG_GET_CLASS (self)->set_preview_func (self, width, height, func, user_data, notify, error);
+}
+
 /**
  * sfcd_select_filename:
  * @dialog: a #SandboxFileChooserDialog
@@ -1708,6 +2287,157 @@ sfcd_list_shortcut_folder_uris (SandboxFileChooserDialog   *self,
   return SANDBOX_FILE_CHOOSER_DIALOG_GET_CLASS (self)->list_shortcut_folder_uris (self, error);
 }
 
+/**
+ * sfcd_add_filter:
+ * @dialog: a #SandboxFileChooserDialog
+ * @name: a unique, human-readable name for the filter, e.g. "Images"
+ * @patterns: (array zero-terminated=1) (allow-none): shell-style glob patterns
+ * that file names may match, e.g. "*.png"
+ * @mime_types: (array zero-terminated=1) (allow-none): MIME types that files
+ * may have, e.g. "image/*"
+ * @error: a placeholder for a #GError
+ * 
+ * Adds a filter to the list of filters that the user can select between.
+ * When a filter is selected, only files that are passed by that filter
+ * are displayed. Files pass a filter if their name matches one of @patterns,
+ * regardless of case, or if their content type is one of @mime_types or a
+ * subtype of one. The first filter added is selected by default.
+ *
+ * Filters are compiled once when they are added, so that even folders with
+ * many files get filtered quickly. Filters are told apart by their @name, which
+ * is shown to users and must not already be used by another filter.
+ *
+ * This method belongs to the %SFCD_CONFIGURATION state. It is equivalent to
+ * gtk_file_filter_add_pattern(), gtk_file_filter_add_mime_type() and
+ * gtk_file_chooser_add_filter() in the GTK+ API. Do remember to check if
+ * @error is set after running this method.
+ * 
+ * Return value: %TRUE if the filter could be added successfully, %FALSE
+ * otherwise.  In the latter case, the @error will be set as appropriate.
+ *
+ * Since: 0.7
+ **/
+gboolean
+sfcd_add_filter (SandboxFileChooserDialog  *self,
+                 const gchar               *name,
+                 const gchar * const       *patterns,
+                 const gchar * const       *mime_types,
+                 GError                   **error)
+{
+  g_return_val_if_fail (_sfcd_entry_sanity_check (self, error), FALSE);
+
+  return SANDBOX_FILE_CHOOSER_DIALOG_GET_CLASS (self)->add_filter (self, name, patterns, mime_types, error);
+}
+
+/**
+ * sfcd_remove_filter:
+ * @dialog: a #SandboxFileChooserDialog
+ * @name: name of the filter to remove
+ * @error: a placeholder for a #GError
+ * 
+ * Removes a filter from the list of filters that the user can select between.
+ *
+ * This method belongs to the %SFCD_CONFIGURATION state. It is equivalent to
+ * gtk_file_chooser_remove_filter() in the GTK+ API. Do remember to check if
+ * @error is set after running this method.
+ * 
+ * Return value: %TRUE if the operation succeeds, %FALSE otherwise.  
+ * In the latter case, the @error will be set as appropriate.
+ *
+ * See also: sfcd_add_filter()
+ * Since: 0.7
+ **/
+gboolean
+sfcd_remove_filter (SandboxFileChooserDialog  *self,
+                    const gchar               *name,
+                    GError                   **error)
+{
+  g_return_val_if_fail (_sfcd_entry_sanity_check (self, error), FALSE);
+
+  return SANDBOX_FILE_CHOOSER_DIALOG_GET_CLASS (self)->remove_filter (self, name, error);
+}
+
+/**
+ * sfcd_list_filters:
+ * @dialog: a #SandboxFileChooserDialog
+ * @error: a placeholder for a #GError
+ * 
+ * Lists the names of the current set of user-selectable filters, as set by
+ * sfcd_add_filter().
+ *
+ * This method belongs to the %SFCD_CONFIGURATION state. It is equivalent to
+ * gtk_file_chooser_list_filters() in the GTK+ API. Do remember to check if
+ * @error is set after running this method.
+ *
+ * Return value: (element-type utf8) (transfer full): A list of filter names,
+ * or %NULL if there are no filters.  Free the returned list with
+ * g_slist_free(), and the names with g_free().
+ *
+ * See also: sfcd_add_filter()
+ *
+ * Since: 0.7
+ **/
+GSList *
+sfcd_list_filters (SandboxFileChooserDialog   *self,
+                   GError                    **error)
+{
+  g_return_val_if_fail (_sfcd_entry_sanity_check (self, error), NULL);
+
+  return SANDBOX_FILE_CHOOSER_DIALOG_GET_CLASS (self)->list_filters (self, error);
+}
+
+/**
+ * sfcd_set_filter:
+ * @dialog: a #SandboxFileChooserDialog
+ * @name: name of the filter to select
+ * @error: a placeholder for a #GError
+ * 
+ * Sets the current filter; only the files that pass the filter will be
+ * displayed. The filter must have been added with sfcd_add_filter() first.
+ *
+ * This method belongs to the %SFCD_CONFIGURATION state. It is equivalent to
+ * gtk_file_chooser_set_filter() in the GTK+ API. Do remember to check if
+ * @error is set after running this method.
+ *
+ * Since: 0.7
+ **/
+void
+sfcd_set_filter (SandboxFileChooserDialog  *self,
+                 const gchar               *name,
+                 GError                   **error)
+{
+  g_return_if_fail (_sfcd_entry_sanity_check (self, error));
+
+  SANDBOX_FILE_CHOOSER_DIALOG_GET_CLASS (self)->set_filter (self, name, error);
+}
+
+/**
+ * sfcd_get_filter:
+ * @dialog: a #SandboxFileChooserDialog
+ * @error: a placeholder for a #GError
+ * 
+ * Gets the name of the current filter. After the @dialog ran, this is the
+ * filter that the user last picked.
+ *
+ * This method can be called from the %SFCD_CONFIGURATION and
+ * %SFCD_DATA_RETRIEVAL states. It is equivalent to
+ * gtk_file_chooser_get_filter() in the GTK+ API. Do remember to check if
+ * @error is set after running this method.
+ *
+ * Return value: (transfer full): the name of the current filter, or %NULL if
+ * the @dialog has no filter. Free it with g_free().
+ *
+ * Since: 0.7
+ **/
+gchar *
+sfcd_get_filter (SandboxFileChooserDialog   *self,
+                 GError                    **error)
+{
+  g_return_val_if_fail (_sfcd_entry_sanity_check (self, error), NULL);
+
+  return SANDBOX_FILE_CHOOSER_DIALOG_GET_CLASS (self)->get_filter (self, error);
+}
+
 /**
  * sfcd_get_current_name:
  * @dialog: a #SandboxFileChooserDialog
@@ -1910,6 +2640,76 @@ sfcd_get_uris (SandboxFileChooserDialog   *self,
   return SANDBOX_FILE_CHOOSER_DIALOG_GET_CLASS (self)->get_uris (self, error);
 }
 
+/**
+ * sfcd_get_thumbnails:
+ * @dialog: a #SandboxFileChooserDialog
+ * @size: the size of the square the thumbnails must fit in, up to 256 pixels
+ * @error: a placeholder for a #GError
+ *
+ * Gets thumbnails of the files selected in @dialog, e.g. to show the files a
+ * user recently chose. Remote dialogs get them from the server, which makes
+ * them in parallel and keeps them cached, so your application does not need
+ * to read and decode images through the sandbox. They come in memory shared
+ * with the server and are never copied. Only the first 64 selected files are
+ * considered.
+ *
+ * This method belongs to the %SFCD_DATA_RETRIEVAL state. Do remember to
+ * check if @error is set after running this method.
+ *
+ * Return value: (transfer full): the thumbnails of the selected files, in
+ *   the order of sfcd_get_uris(), to free with sfcd_thumbnails_free(), or
+ *   %NULL on error
+ *
+ * Since: 0.7
+ **/
+SfcdThumbnails *
+sfcd_get_thumbnails (SandboxFileChooserDialog   *self,
+                     gint                        size,
+                     GError                    **error)
+{
+  g_return_val_if_fail (_sfcd_entry_sanity_check (self, error), NULL);
+  g_return_val_if_fail (size > 0 && size <= 256, NULL);
+
+  return SANDBOX_FILE_CHOOSER_DIALOG_GET_CLASS (self)->get_thumbnails (self, size, error);
+}
+
+/**
+ * sfcd_get_selection_info:
+ * @dialog: a #SandboxFileChooserDialog
+ * @attributes: the attributes to query, in the format of g_file_query_info(),
+ *  e.g. "standard::size,time::modified"
+ * @error: a placeholder for a #GError
+ *
+ * Gets the names, URIs and attributes of all the files selected in @dialog
+ * at once, so your application need not stat them one by one through the
+ * sandbox. Remote dialogs have the server query the files in parallel.
+ * Symbolic links are not followed.
+ *
+ * Only attributes of the "standard", "time", "access" and "unix" namespaces
+ * may be queried, whole namespaces being asked for as in "time::*".
+ *
+ * This method belongs to the %SFCD_DATA_RETRIEVAL state. Do remember to
+ * check if @error is set after running this method.
+ *
+ * Return value: (transfer full): a #GVariant of type a(sa{sv}) holding the
+ *   URI of each selected file, in the order of sfcd_get_uris(), and a
+ *   dictionary with its "filename" and the attributes that could be read
+ *   under their GIO names, or an "error" string if the file could not be
+ *   queried. Free with g_variant_unref(), or %NULL on error.
+ *
+ * Since: 0.7
+ **/
+GVariant *
+sfcd_get_selection_info (SandboxFileChooserDialog   *self,
+                         const gchar                *attributes,
+                         GError                    **error)
+{
+  g_return_val_if_fail (_sfcd_entry_sanity_check (self, error), NULL);
+  g_return_val_if_fail (attributes != NULL, NULL);
+
+  return SANDBOX_FILE_CHOOSER_DIALOG_GET_CLASS (self)->get_selection_info (self, attributes, error);
+}
+
 /**
  * sfcd_get_current_folder_uri:
  * @dialog: a #SandboxFileChooserDialog
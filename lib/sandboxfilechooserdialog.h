@@ -76,6 +76,9 @@ gchar *SfcdStatePrintable[5] = {"Wrong State (an error occurred)",
  * @SFCD_ERROR_UNKNOWN: Occurs if the cause of an error cannot be determined.
     Usually you get this error when a sanity check failed, probably indicating a
     bug in #SandboxUtils.
+ * @SFCD_ERROR_LIMIT_EXCEEDED: Occurs when the server refuses a call because the
+ *  client owns or runs too many dialogs, or sends calls too fast. The call can
+ *  be retried later. Not used within #SandboxFileChooserDialog.
  *
  * Describes an error related to the manipulation of a
  * #SandboxFileChooserDialog instance.
@@ -86,9 +89,90 @@ typedef enum {
   SFCD_ERROR_FORBIDDEN_CHANGE,
   SFCD_ERROR_FORBIDDEN_QUERY,
   SFCD_ERROR_TOOLKIT_CALL_FAILED,
-  SFCD_ERROR_UNKNOWN
+  SFCD_ERROR_UNKNOWN,
+  SFCD_ERROR_LIMIT_EXCEEDED
 } SfcdErrorCode;
 
+/**
+ * SfcdTimings:
+ * @correlation_id: identifies the sfcd_run() call these timings belong to.
+ * @run_called: when the application called sfcd_run().
+ * @run_received: when the process providing the dialog received the call.
+ * @run_dispatched: when the dialog started running its own loop.
+ * @shown: when the dialog's window was shown.
+ * @mapped: when the dialog's window was mapped.
+ * @painted: when the dialog's window was first painted after being mapped.
+ * @responded: when the user answered the dialog, or the run was cancelled.
+ * @response_received: when the application was notified of the answer. Only
+ *  set for remote dialogs.
+ *
+ * Describes the phases of the last run of a #SandboxFileChooserDialog. Each
+ * phase is a timestamp in microseconds taken from the monotonic clock (see
+ * g_get_monotonic_time()), which is shared by all processes of a machine.
+ * Phases that did not happen (yet) are set to 0.
+ *
+ * Since: 0.7
+ */
+typedef struct {
+  guint64 correlation_id;
+  gint64  run_called;
+  gint64  run_received;
+  gint64  run_dispatched;
+  gint64  shown;
+  gint64  mapped;
+  gint64  painted;
+  gint64  responded;
+  gint64  response_received;
+} SfcdTimings;
+
+/**
+ * SfcdTimingStats:
+ * @runs: number of runs that reached a response.
+ * @time_to_paint_total: sum of the delays between sfcd_run() being called and
+ *  the dialog being painted.
+ * @time_to_paint_max: longest of these delays.
+ * @think_time_total: sum of the delays between the dialog being painted and
+ *  the user answering it.
+ * @response_latency_total: sum of the delays between the user answering a
+ *  remote dialog and the application being notified.
+ *
+ * Aggregates the #SfcdTimings of all the dialogs that ran in the current
+ * process. Delays are in microseconds. Runs for which a phase is missing do
+ * not contribute to the delays that depend on that phase.
+ *
+ * Since: 0.7
+ */
+typedef struct {
+  guint   runs;
+  gint64  time_to_paint_total;
+  gint64  time_to_paint_max;
+  gint64  think_time_total;
+  gint64  response_latency_total;
+} SfcdTimingStats;
+
+/**
+ * SfcdResetFlags:
+ * @SFCD_RESET_SELECTION: unselects all files.
+ * @SFCD_RESET_CURRENT_NAME: clears the name typed in save dialogs.
+ * @SFCD_RESET_SHORTCUTS: removes the shortcut folders added to the dialog.
+ * @SFCD_RESET_FILTERS: removes the filters added to the dialog.
+ * @SFCD_RESET_CHOICES: gives the choices of the dialog their initial values.
+ * @SFCD_RESET_ALL: resets everything that can be reset.
+ *
+ * Describes what sfcd_reset() clears before a #SandboxFileChooserDialog is
+ * reused. Settings such as the title, action and buttons are always kept.
+ *
+ * Since: 0.7
+ */
+typedef enum {
+  SFCD_RESET_SELECTION     = 1 << 0,
+  SFCD_RESET_CURRENT_NAME  = 1 << 1,
+  SFCD_RESET_SHORTCUTS     = 1 << 2,
+  SFCD_RESET_FILTERS       = 1 << 3,
+  SFCD_RESET_CHOICES       = 1 << 4,
+  SFCD_RESET_ALL           = 0xff,
+} SfcdResetFlags;
+
 #define SANDBOX_TYPE_FILE_CHOOSER_DIALOG            (sfcd_get_type ())
 #define SANDBOX_FILE_CHOOSER_DIALOG(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), SANDBOX_TYPE_FILE_CHOOSER_DIALOG, SandboxFileChooserDialog))
 #define SANDBOX_IS_FILE_CHOOSER_DIALOG(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), SANDBOX_TYPE_FILE_CHOOSER_DIALOG))
@@ -99,6 +183,43 @@ typedef enum {
 typedef struct _SandboxFileChooserDialog        SandboxFileChooserDialog;
 typedef struct _SandboxFileChooserDialogClass   SandboxFileChooserDialogClass;
 
+/**
+ * SfcdPreviewFunc:
+ * @dialog: the #SandboxFileChooserDialog whose highlighted file changed
+ * @fd: a read-only file descriptor of the highlighted file, closed once the
+ *  function returns
+ * @cr: a cairo context to draw the preview with, on a transparent surface
+ * @width: the width of the preview, as passed to sfcd_set_preview_func()
+ * @height: the height of the preview, as passed to sfcd_set_preview_func()
+ * @user_data: the data passed to sfcd_set_preview_func()
+ *
+ * Draws the preview of the file highlighted in a dialog. Your application
+ * gets to read the file through @fd but not to know its name.
+ *
+ * Return value: %TRUE if a preview was drawn, %FALSE if the file cannot be
+ * previewed and the preview area should be hidden
+ *
+ * Since: 0.7
+ */
+typedef gboolean (*SfcdPreviewFunc) (SandboxFileChooserDialog *dialog,
+                                     gint                      fd,
+                                     cairo_t                  *cr,
+                                     gint                      width,
+                                     gint                      height,
+                                     gpointer                  user_data);
+
+/**
+ * SfcdThumbnails:
+ *
+ * Thumbnails of the files chosen in a dialog, as returned by
+ * sfcd_get_thumbnails(). An opaque structure, whose contents are read with
+ * sfcd_thumbnails_get_uri() and sfcd_thumbnails_get_surface(), and which is
+ * freed with sfcd_thumbnails_free().
+ *
+ * Since: 0.7
+ */
+typedef struct _SfcdThumbnails SfcdThumbnails;
+
 struct _SandboxFileChooserDialog
 {
   GObject                             parent_instance;
@@ -152,6 +273,11 @@ struct _SandboxFileChooserDialogClass
   gboolean             (*add_shortcut_folder_uri)       (SandboxFileChooserDialog *, const gchar *, GError **);
   gboolean             (*remove_shortcut_folder_uri)    (SandboxFileChooserDialog *, const gchar *, GError **);
   GSList *             (*list_shortcut_folder_uris)     (SandboxFileChooserDialog *, GError **);
+  gboolean             (*add_filter)                    (SandboxFileChooserDialog *, const gchar *, const gchar * const *, const gchar * const *, GError **);
+  gboolean             (*remove_filter)                 (SandboxFileChooserDialog *, const gchar *, GError **);
+  GSList *             (*list_filters)                  (SandboxFileChooserDialog *, GError **);
+  void                 (*set_filter)                    (SandboxFileChooserDialog *, const gchar *, GError **);
+  gchar *              (*get_filter)                    (SandboxFileChooserDialog *, GError **);
   gchar *              (*get_current_name)              (SandboxFileChooserDialog *, GError **);
   gchar *              (*get_filename)                  (SandboxFileChooserDialog *, GError **);
   GSList *             (*get_filenames)                 (SandboxFileChooserDialog *, GError **);
@@ -160,6 +286,15 @@ struct _SandboxFileChooserDialogClass
   GSList *             (*get_uris)                      (SandboxFileChooserDialog *, GError **);
   gchar *              (*get_current_folder_uri)        (SandboxFileChooserDialog *, GError **);
 
+  /* Since 0.7 */
+  gboolean             (*get_timings)                   (SandboxFileChooserDialog *, SfcdTimings *);
+  void                 (*set_choices)                   (SandboxFileChooserDialog *, GVariant *, GError **);
+  GVariant *           (*get_choice_values)             (SandboxFileChooserDialog *, GError **);
+  void                 (*set_preview_func)              (SandboxFileChooserDialog *, gint, gint, SfcdPreviewFunc, gpointer, GDestroyNotify, GError **);
+  SfcdThumbnails *     (*get_thumbnails)                (SandboxFileChooserDialog *, gint, GError **);
+  GVariant *           (*get_selection_info)            (SandboxFileChooserDialog *, const gchar *, GError **);
+  void                 (*reset)                         (SandboxFileChooserDialog *, SfcdResetFlags, GError **);
+
 
   /* Class signals */
   //TODO whole signal thing
@@ -167,6 +302,7 @@ struct _SandboxFileChooserDialogClass
   guint hide_signal;
   guint response_signal;
   guint show_signal;
+  guint choices_changed_signal;
 };
 
 GType sfcd_get_type (void);
@@ -199,6 +335,52 @@ sfcd_is_running           (SandboxFileChooserDialog *dialog);
 const gchar *
 sfcd_get_id               (SandboxFileChooserDialog *dialog);
 
+gboolean
+sfcd_get_timings          (SandboxFileChooserDialog *dialog,
+                           SfcdTimings              *timings);
+
+void
+sfcd_get_timing_stats     (SfcdTimingStats          *stats);
+
+void
+sfcd_reset_timing_stats   (void);
+
+void
+_sfcd_record_timings      (const SfcdTimings        *timings);
+
+GVariant *
+_sfcd_timings_to_variant  (const SfcdTimings        *timings);
+
+void
+_sfcd_timings_from_variant (SfcdTimings             *timings,
+                            GVariant                *variant);
+
+void
+sfcd_set_timeout          (SandboxFileChooserDialog *dialog,
+                           gint                      timeout_msec);
+
+gint
+sfcd_get_timeout          (SandboxFileChooserDialog *dialog);
+
+void
+sfcd_set_cancellable      (SandboxFileChooserDialog *dialog,
+                           GCancellable             *cancellable);
+
+GCancellable *
+sfcd_get_cancellable      (SandboxFileChooserDialog *dialog);
+
+void
+sfcd_push_deadline        (gint64                    deadline);
+
+void
+sfcd_pop_deadline         (void);
+
+gint
+_sfcd_get_call_timeout    (SandboxFileChooserDialog *dialog);
+
+GCancellable *
+_sfcd_get_call_cancellable (SandboxFileChooserDialog *dialog);
+
 
 /* RUNNING METHODS */
 void
@@ -213,6 +395,11 @@ void
 sfcd_cancel_run                    (SandboxFileChooserDialog  *dialog,
                                     GError                   **error);
 
+void
+sfcd_reset                         (SandboxFileChooserDialog  *dialog,
+                                    SfcdResetFlags             flags,
+                                    GError                   **error);
+
 
 /* CONFIGURATION / MANAGEMENT METHODS  -- USABLE BEFORE RUN */
 void
@@ -231,6 +418,24 @@ GtkWidget *
 sfcd_get_extra_widget              (SandboxFileChooserDialog  *dialog,
                                     GError                   **error);
 
+void
+sfcd_set_choices                   (SandboxFileChooserDialog  *dialog,
+                                    GVariant                  *choices,
+                                    GError                   **error);
+
+GVariant *
+sfcd_get_choice_values             (SandboxFileChooserDialog  *dialog,
+                                    GError                   **error);
+
+void
+sfcd_set_preview_func              (SandboxFileChooserDialog  *dialog,
+                                    gint                       width,
+                                    gint                       height,
+                                    SfcdPreviewFunc            func,
+                                    gpointer                   user_data,
+                                    GDestroyNotify             notify,
+                                    GError                   **error);
+
 void
 sfcd_select_filename               (SandboxFileChooserDialog  *dialog,
                                     const gchar               *filename,
@@ -366,6 +571,31 @@ GSList *
 sfcd_list_shortcut_folder_uris     (SandboxFileChooserDialog  *dialog,
                                     GError                   **error);
 
+gboolean
+sfcd_add_filter                    (SandboxFileChooserDialog  *dialog,
+                                    const gchar               *name,
+                                    const gchar * const       *patterns,
+                                    const gchar * const       *mime_types,
+                                    GError                   **error);
+
+gboolean
+sfcd_remove_filter                 (SandboxFileChooserDialog  *dialog,
+                                    const gchar               *name,
+                                    GError                   **error);
+
+GSList *
+sfcd_list_filters                  (SandboxFileChooserDialog  *dialog,
+                                    GError                   **error);
+
+void
+sfcd_set_filter                    (SandboxFileChooserDialog  *dialog,
+                                    const gchar               *name,
+                                    GError                   **error);
+
+gchar *
+sfcd_get_filter                    (SandboxFileChooserDialog  *dialog,
+                                    GError                   **error);
+
 
 /* DATA RERIEVAL METHODS */
 gchar *
@@ -392,6 +622,30 @@ GSList *
 sfcd_get_uris               (SandboxFileChooserDialog   *dialog,
                              GError                    **error);
 
+SfcdThumbnails *
+sfcd_get_thumbnails         (SandboxFileChooserDialog   *dialog,
+                             gint                        size,
+                             GError                    **error);
+
+guint
+sfcd_thumbnails_get_n_items (SfcdThumbnails             *thumbnails);
+
+const gchar *
+sfcd_thumbnails_get_uri     (SfcdThumbnails             *thumbnails,
+                             guint                       index_);
+
+cairo_surface_t *
+sfcd_thumbnails_get_surface (SfcdThumbnails             *thumbnails,
+                             guint                       index_);
+
+void
+sfcd_thumbnails_free        (SfcdThumbnails             *thumbnails);
+
+GVariant *
+sfcd_get_selection_info     (SandboxFileChooserDialog   *dialog,
+                             const gchar                *attributes,
+                             GError                    **error);
+
 gchar *
 sfcd_get_current_folder_uri (SandboxFileChooserDialog   *dialog,
                              GError                    **error);
@@ -417,32 +671,10 @@ sfcd_get_current_folder_uri (SandboxFileChooserDialog   *dialog,
  *   gtk_file_chooser_get_current_name ()
  * _____________________________________________________________________________
  * API CHANGE: replace the preview widget by a standalone sandboxable previewer
- * 
- * gtk_file_chooser_set_preview_widget () cannot be used because it's impossible
- * to let the client app access files to preview them -- any valuable info would
- * leak. Instead, the server must call a standalone and sandboxable bunch of
- * instructions that ultimately generate a preview. This preview app could be
- * queried with the currently selected filename(s), latest activated one(s), and
- * some custom-format information from the app -- the only thing that matters is
- * that it cannot talk back except in the form of some on-screen rendering.
- * 
- *   void	gtk_file_chooser_set_preview_widget ()
- *   GtkWidget *	gtk_file_chooser_get_preview_widget ()
- *   void	gtk_file_chooser_set_preview_widget_active ()
- *   gboolean	gtk_file_chooser_get_preview_widget_active ()
- *   void	gtk_file_chooser_set_use_preview_label ()
- *   gboolean	gtk_file_chooser_get_use_preview_label ()
- *   char *	gtk_file_chooser_get_preview_filename ()
- *   char *	gtk_file_chooser_get_preview_uri ()
- *   GFile *	gtk_file_chooser_get_preview_file ()
- * _____________________________________________________________________________
- * API CHANGE: make GtkFileFilter DBus-transportable, somehow
  *
- *   void	gtk_file_chooser_add_filter ()
- *   void	gtk_file_chooser_remove_filter ()
- *   GSList *	gtk_file_chooser_list_filters ()
- *   void	gtk_file_chooser_set_filter ()
- *   GtkFileFilter *	gtk_file_chooser_get_filter ()
+ * Partly done with sfcd_set_preview_func(): the client draws previews of the
+ * files the server hands it, into shared memory, and never learns their names.
+ * A standalone previewer that cannot talk back at all would still be safer.
  * _____________________________________________________________________________
  * API CHANGE: make GFile DBus-transportable, somehow -- or dump this
  *
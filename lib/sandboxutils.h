@@ -23,6 +23,7 @@
 #define __SANDBOX_UTILS_MAIN_HEADER_H__
 
 #include "sandboxutilscommon.h"
+#include "sandboxutilsledger.h"
 #include "sandboxutilsmarshals.h"
 #include "sandboxfilechooserdialog.h"
 #include "localfilechooserdialog.h"
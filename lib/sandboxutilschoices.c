@@ -0,0 +1,403 @@
+/*
+ * sandboxutilschoices.c: declarative option panels for dialogs
+ *
+ * Copyright (C) 2014 Steve Dodier-Lazaro <sidnioulz@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Steve Dodier-Lazaro <sidnioulz@gmail.com>
+ */
+
+#include <string.h>
+
+#include "sandboxutilschoices.h"
+#include "sandboxfilechooserdialog.h"
+
+/* What a choice widget needs to report its changes */
+typedef struct {
+  gchar                   *id;
+  SandboxUtilsChoicesFunc  func;
+  gpointer                 user_data;
+} SandboxUtilsChoiceBinding;
+
+static gboolean
+_sandboxutils_choices_fail (GError      **error,
+                            guint         row,
+                            const gchar  *reason)
+{
+  g_set_error (error,
+               g_quark_from_static_string (SFCD_ERROR_DOMAIN),
+               SFCD_ERROR_TOOLKIT_CALL_FAILED,
+               "SandboxUtilsChoices.Validate: row %u of the choices %s.\n",
+               row, reason);
+
+  return FALSE;
+}
+
+/* Tells whether @option is one of the options of a choice */
+static gboolean
+_sandboxutils_choices_has_option (GVariant    *options,
+                                  const gchar *option)
+{
+  GVariantIter  iter;
+  const gchar  *id;
+  const gchar  *label;
+
+  g_variant_iter_init (&iter, options);
+  while (g_variant_iter_next (&iter, "(&s&s)", &id, &label))
+    if (g_strcmp0 (id, option) == 0)
+      return TRUE;
+
+  return FALSE;
+}
+
+/*
+ * Checks that @choices is a valid description, see sandboxutilschoices.h, so
+ * that building it cannot fail. Returns %FALSE and sets @error otherwise.
+ */
+gboolean
+_sandboxutils_choices_validate (GVariant  *choices,
+                                GError   **error)
+{
+  GHashTable   *ids;
+  GVariantIter  iter;
+  GVariant     *row;
+  GVariant     *options;
+  GVariant     *value;
+  const gchar  *type;
+  const gchar  *id;
+  gboolean      bad_label;
+  gboolean      valid = TRUE;
+  guint         n     = 0;
+
+  g_return_val_if_fail (choices != NULL, FALSE);
+
+  if (!g_variant_is_of_type (choices, G_VARIANT_TYPE ("aa{sv}")))
+  {
+    g_set_error (error,
+                 g_quark_from_static_string (SFCD_ERROR_DOMAIN),
+                 SFCD_ERROR_TOOLKIT_CALL_FAILED,
+                 "SandboxUtilsChoices.Validate: choices must be of type aa{sv}, not %s.\n",
+                 g_variant_get_type_string (choices));
+    return FALSE;
+  }
+
+  if (g_variant_n_children (choices) > SANDBOXUTILS_CHOICES_MAX)
+  {
+    g_set_error (error,
+                 g_quark_from_static_string (SFCD_ERROR_DOMAIN),
+                 SFCD_ERROR_TOOLKIT_CALL_FAILED,
+                 "SandboxUtilsChoices.Validate: choices may not have more than %d rows.\n",
+                 SANDBOXUTILS_CHOICES_MAX);
+    return FALSE;
+  }
+
+  ids = g_hash_table_new (g_str_hash, g_str_equal);
+
+  g_variant_iter_init (&iter, choices);
+  while (valid && (row = g_variant_iter_next_value (&iter)) != NULL)
+  {
+    options   = NULL;
+    value     = NULL;
+    type      = NULL;
+    id        = NULL;
+    bad_label = FALSE;
+
+    if ((value = g_variant_lookup_value (row, "label", NULL)) != NULL)
+    {
+      bad_label = !g_variant_is_of_type (value, G_VARIANT_TYPE_STRING);
+      g_variant_unref (value);
+      value = NULL;
+    }
+
+    if (!g_variant_lookup (row, "type", "&s", &type))
+      valid = _sandboxutils_choices_fail (error, n, "has no type");
+    else if (bad_label)
+      valid = _sandboxutils_choices_fail (error, n, "has a label that is not a string");
+    else if (g_strcmp0 (type, "label") == 0)
+      ;
+    else if (g_strcmp0 (type, "toggle") != 0 && g_strcmp0 (type, "choice") != 0)
+      valid = _sandboxutils_choices_fail (error, n, "has an unknown type");
+    else if (!g_variant_lookup (row, "id", "&s", &id) || *id == '\0')
+      valid = _sandboxutils_choices_fail (error, n, "has no id");
+    else if (g_hash_table_contains (ids, id))
+      valid = _sandboxutils_choices_fail (error, n, "has the id of another row");
+    else
+    {
+      g_hash_table_add (ids, (gpointer) id);
+      value = g_variant_lookup_value (row, "value", NULL);
+
+      if (g_strcmp0 (type, "toggle") == 0)
+      {
+        if (value && !g_variant_is_of_type (value, G_VARIANT_TYPE_BOOLEAN))
+          valid = _sandboxutils_choices_fail (error, n, "is a toggle with a value that is not a boolean");
+      }
+      else if ((options = g_variant_lookup_value (row, "options", G_VARIANT_TYPE ("a(ss)"))) == NULL ||
+               g_variant_n_children (options) == 0)
+        valid = _sandboxutils_choices_fail (error, n, "is a choice without options");
+      else if (value && (!g_variant_is_of_type (value, G_VARIANT_TYPE_STRING) ||
+                         !_sandboxutils_choices_has_option (options, g_variant_get_string (value, NULL))))
+        valid = _sandboxutils_choices_fail (error, n, "is a choice with a value that is not one of its options");
+    }
+
+    if (options)
+      g_variant_unref (options);
+    if (value)
+      g_variant_unref (value);
+    g_variant_unref (row);
+    n++;
+  }
+
+  g_hash_table_unref (ids);
+
+  return valid;
+}
+
+/*
+ * Gets the initial values of a valid description, as a table of ids to
+ * #GVariant. Labels have no value.
+ */
+GHashTable *
+_sandboxutils_choices_get_defaults (GVariant *choices)
+{
+  GHashTable   *values;
+  GVariantIter  iter;
+  GVariant     *row;
+  GVariant     *value;
+  GVariant     *options;
+  const gchar  *type;
+  const gchar  *id;
+
+  values = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_variant_unref);
+
+  if (!choices)
+    return values;
+
+  g_variant_iter_init (&iter, choices);
+  while ((row = g_variant_iter_next_value (&iter)) != NULL)
+  {
+    if (g_variant_lookup (row, "type", "&s", &type) &&
+        g_variant_lookup (row, "id", "&s", &id) &&
+        g_strcmp0 (type, "label") != 0)
+    {
+      value = g_variant_lookup_value (row, "value", NULL);
+
+      if (!value && g_strcmp0 (type, "toggle") == 0)
+        value = g_variant_ref_sink (g_variant_new_boolean (FALSE));
+      else if (!value && (options = g_variant_lookup_value (row, "options", G_VARIANT_TYPE ("a(ss)"))) != NULL)
+      {
+        GVariant *first = g_variant_get_child_value (options, 0);
+
+        value = g_variant_get_child_value (first, 0);
+        g_variant_unref (first);
+        g_variant_unref (options);
+      }
+
+      if (value)
+        g_hash_table_insert (values, g_strdup (id), value);
+    }
+
+    g_variant_unref (row);
+  }
+
+  return values;
+}
+
+static void
+_sandboxutils_choice_binding_free (gpointer data,
+                                   GClosure *closure)
+{
+  SandboxUtilsChoiceBinding *binding = data;
+
+  g_free (binding->id);
+  g_free (binding);
+}
+
+static void
+_sandboxutils_choices_on_toggled (GtkToggleButton *button,
+                                  gpointer         data)
+{
+  SandboxUtilsChoiceBinding *binding = data;
+
+  binding->func (binding->id,
+                 g_variant_new_boolean (gtk_toggle_button_get_active (button)),
+                 binding->user_data);
+}
+
+static void
+_sandboxutils_choices_on_changed (GtkComboBox *combo,
+                                  gpointer     data)
+{
+  SandboxUtilsChoiceBinding *binding = data;
+  const gchar               *option  = gtk_combo_box_get_active_id (combo);
+
+  if (option)
+    binding->func (binding->id, g_variant_new_string (option), binding->user_data);
+}
+
+static void
+_sandboxutils_choices_bind (GtkWidget               *widget,
+                            const gchar             *signal,
+                            GCallback                callback,
+                            const gchar             *id,
+                            SandboxUtilsChoicesFunc  func,
+                            gpointer                 user_data)
+{
+  SandboxUtilsChoiceBinding *binding = g_malloc (sizeof (SandboxUtilsChoiceBinding));
+
+  binding->id        = g_strdup (id);
+  binding->func      = func;
+  binding->user_data = user_data;
+
+  g_signal_connect_data (widget, signal, callback, binding,
+                         _sandboxutils_choice_binding_free, 0);
+}
+
+/*
+ * Builds the widgets of a valid description, showing @values. @func is called
+ * with the id and new value of a row each time the user changes it, but not
+ * while the widgets are being built.
+ */
+GtkWidget *
+_sandboxutils_choices_build (GVariant                *choices,
+                             GHashTable              *values,
+                             SandboxUtilsChoicesFunc  func,
+                             gpointer                 user_data)
+{
+  GtkWidget    *grid;
+  GtkWidget    *widget;
+  GVariantIter  iter;
+  GVariantIter  option_iter;
+  GVariant     *row;
+  GVariant     *options;
+  GVariant     *value;
+  const gchar  *type;
+  const gchar  *id;
+  const gchar  *label;
+  const gchar  *option_id;
+  const gchar  *option_label;
+  gint          top = 0;
+
+  g_return_val_if_fail (choices != NULL, NULL);
+
+  grid = gtk_grid_new ();
+  gtk_grid_set_row_spacing (GTK_GRID (grid), 6);
+  gtk_grid_set_column_spacing (GTK_GRID (grid), 12);
+
+  g_variant_iter_init (&iter, choices);
+  while ((row = g_variant_iter_next_value (&iter)) != NULL)
+  {
+    if (!g_variant_lookup (row, "label", "&s", &label))
+      label = "";
+    if (!g_variant_lookup (row, "id", "&s", &id))
+      id = NULL;
+    g_variant_lookup (row, "type", "&s", &type);
+
+    value = id ? g_hash_table_lookup (values, id) : NULL;
+
+    if (g_strcmp0 (type, "toggle") == 0)
+    {
+      widget = gtk_check_button_new_with_mnemonic (label);
+      gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (widget),
+                                    value && g_variant_get_boolean (value));
+      _sandboxutils_choices_bind (widget, "toggled", G_CALLBACK (_sandboxutils_choices_on_toggled),
+                                  id, func, user_data);
+      gtk_grid_attach (GTK_GRID (grid), widget, 0, top, 2, 1);
+    }
+    else if (g_strcmp0 (type, "choice") == 0)
+    {
+      widget = gtk_label_new_with_mnemonic (label);
+      gtk_widget_set_halign (widget, GTK_ALIGN_START);
+      gtk_grid_attach (GTK_GRID (grid), widget, 0, top, 1, 1);
+
+      widget  = gtk_combo_box_text_new ();
+      options = g_variant_lookup_value (row, "options", G_VARIANT_TYPE ("a(ss)"));
+      g_variant_iter_init (&option_iter, options);
+      while (g_variant_iter_next (&option_iter, "(&s&s)", &option_id, &option_label))
+        gtk_combo_box_text_append (GTK_COMBO_BOX_TEXT (widget), option_id, option_label);
+      g_variant_unref (options);
+
+      if (value)
+        gtk_combo_box_set_active_id (GTK_COMBO_BOX (widget), g_variant_get_string (value, NULL));
+      _sandboxutils_choices_bind (widget, "changed", G_CALLBACK (_sandboxutils_choices_on_changed),
+                                  id, func, user_data);
+      gtk_grid_attach (GTK_GRID (grid), widget, 1, top, 1, 1);
+    }
+    else
+    {
+      widget = gtk_label_new (label);
+      gtk_widget_set_halign (widget, GTK_ALIGN_START);
+      gtk_label_set_line_wrap (GTK_LABEL (widget), TRUE);
+      gtk_grid_attach (GTK_GRID (grid), widget, 0, top, 2, 1);
+    }
+
+    g_variant_unref (row);
+    top++;
+  }
+
+  gtk_widget_show_all (grid);
+
+  return grid;
+}
+
+/* Packs @values into an a{sv}, sorted by id so that it reads the same everywhere */
+GVariant *
+_sandboxutils_choices_to_variant (GHashTable *values)
+{
+  GVariantBuilder  builder;
+  GList           *ids;
+  GList           *iter;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+
+  if (values)
+  {
+    ids = g_list_sort (g_hash_table_get_keys (values), (GCompareFunc) strcmp);
+    for (iter = ids; iter; iter = iter->next)
+      g_variant_builder_add (&builder, "{sv}", iter->data, g_hash_table_lookup (values, iter->data));
+    g_list_free (ids);
+  }
+
+  return g_variant_builder_end (&builder);
+}
+
+/* Applies the values of an a{sv} of @changes to @values, ignoring unknown ids */
+void
+_sandboxutils_choices_merge (GHashTable *values,
+                             GVariant   *changes)
+{
+  GVariantIter  iter;
+  GVariant     *value;
+  GVariant     *current;
+  gchar        *id;
+
+  g_return_if_fail (values != NULL);
+
+  if (!changes || !g_variant_is_of_type (changes, G_VARIANT_TYPE_VARDICT))
+    return;
+
+  g_variant_iter_init (&iter, changes);
+  while (g_variant_iter_next (&iter, "{sv}", &id, &value))
+  {
+    current = g_hash_table_lookup (values, id);
+
+    if (current && g_variant_is_of_type (value, g_variant_get_type (current)))
+      g_hash_table_insert (values, id, value);
+    else
+    {
+      g_free (id);
+      g_variant_unref (value);
+    }
+  }
+}
@@ -0,0 +1,71 @@
+/*
+ * sandboxutilschoices.h: declarative option panels for dialogs
+ *
+ * Copyright (C) 2014 Steve Dodier-Lazaro <sidnioulz@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Steve Dodier-Lazaro <sidnioulz@gmail.com>
+ */
+
+/*
+ * Private header, not installed. Choices are an option panel described with
+ * data rather than built by the application, so that the process showing the
+ * dialog can build it with its own widgets. A description is an aa{sv}, one
+ * dictionary per row of the panel:
+ *
+ *   "type"     s       "label", "toggle" or "choice"
+ *   "id"       s       identifies the value of toggles and choices
+ *   "label"    s       text shown next to the widget, or the label itself
+ *   "options"  a(ss)   ids and labels of the options of a choice
+ *   "value"    v       initial value: b for toggles, s for choices
+ *
+ * Values are kept in a table of ids to #GVariant, a boolean for toggles and
+ * the id of the selected option for choices. Choices start with their first
+ * option selected unless told otherwise.
+ */
+
+#ifndef __SANDBOX_UTILS_CHOICES_H__
+#define __SANDBOX_UTILS_CHOICES_H__
+
+#include <gtk/gtk.h>
+
+/* Most rows a panel may have, so that clients cannot flood the server */
+#define SANDBOXUTILS_CHOICES_MAX 32
+
+typedef void (*SandboxUtilsChoicesFunc) (const gchar *id,
+                                         GVariant    *value,
+                                         gpointer     user_data);
+
+gboolean
+_sandboxutils_choices_validate (GVariant  *choices,
+                                GError   **error);
+
+GHashTable *
+_sandboxutils_choices_get_defaults (GVariant *choices);
+
+GtkWidget *
+_sandboxutils_choices_build (GVariant                *choices,
+                             GHashTable              *values,
+                             SandboxUtilsChoicesFunc  func,
+                             gpointer                 user_data);
+
+GVariant *
+_sandboxutils_choices_to_variant (GHashTable *values);
+
+void
+_sandboxutils_choices_merge (GHashTable *values,
+                             GVariant   *changes);
+
+#endif /* __SANDBOX_UTILS_CHOICES_H__ */
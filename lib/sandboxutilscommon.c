@@ -41,6 +41,8 @@
 #include <syslog.h>
 
 #include "sandboxutilscommon.h"
+#include "sandboxutilsconnection.h"
+#include "remotefilechooserdialog.h"
 
 /**
  * _sandboxutils_error_get_message:
@@ -98,7 +100,8 @@ _sandboxutils_max (int a, int b)
   return a>b? a:b;
 }
 
-static gboolean _option_sandbox = TRUE;
+static gboolean _option_sandbox  = TRUE;
+static gboolean _option_fallback = FALSE;
 
 static GOptionEntry entries[] =
 {
@@ -110,6 +113,10 @@ static GOptionEntry entries[] =
     "sandbox", 0, 0, G_OPTION_ARG_NONE, &_option_sandbox,
     "Enables sandbox-compatible file choosers, running with higher privileges than the app", NULL
   },
+  {
+    "sandbox-fallback", 0, 0, G_OPTION_ARG_NONE, &_option_fallback,
+    "Use vanilla GTK+ widgets when sandbox-compatible file choosers are enabled but their server is not running", NULL
+  },
   {
     NULL, ' ', 0, 0, NULL,
     NULL, NULL
@@ -227,13 +234,70 @@ sandboxutils_set_sandboxed (gboolean sandbox)
   _option_sandbox = sandbox;
 }
 
+/**
+ * sandboxutils_get_fallback:
+ *
+ * Gets what Sandbox Utils widget constructors do when remote widgets are
+ * enabled but no server is running.
+ *
+ * Return value: the current #SandboxUtilsFallback
+ *
+ * Since: 0.7
+ */
+SandboxUtilsFallback
+sandboxutils_get_fallback ()
+{
+  return _option_fallback ? SANDBOXUTILS_FALLBACK_LOCAL : SANDBOXUTILS_FALLBACK_NONE;
+}
+
+/**
+ * sandboxutils_set_fallback:
+ * @fallback: what to do when no server is running
+ *
+ * Sets what Sandbox Utils widget constructors do when remote widgets are
+ * enabled but no server is running. By default, they fail right away rather
+ * than give the app's privileges to a widget meant to run outside its
+ * sandbox. Inside a sandbox, local widgets usually cannot see the user's
+ * files anyway.
+ *
+ * Since: 0.7
+ */
+void
+sandboxutils_set_fallback (SandboxUtilsFallback fallback)
+{
+  _option_fallback = (fallback == SANDBOXUTILS_FALLBACK_LOCAL);
+}
+
+/**
+ * sandboxutils_get_server_available:
+ *
+ * Gets whether the server providing remote widgets is running. The answer is
+ * cached and kept up to date by watching the server's bus name, so this is
+ * cheap to call. Only the first call may ask the bus, with a short timeout, if
+ * sandboxutils_init() was not called early enough to know already.
+ *
+ * Return value: %TRUE if the server is running, %FALSE otherwise or if the
+ * session bus is unreachable.
+ *
+ * Since: 0.7
+ */
+gboolean
+sandboxutils_get_server_available ()
+{
+  return _sandboxutils_server_get_available ();
+}
+
 /**
  * sandboxutils_init:
  * @argc: (inout): a pointer to the number of command line arguments
  * @argv: (array length=argc) (inout): a pointer to the array of
  *     command line arguments
  *
- * This is an alias to sandboxutils_parse_args().
+ * This is an alias to sandboxutils_parse_args(). When remote widgets are to be
+ * used, it also starts connecting to the session bus, looking for the server
+ * and creating the proxies of remote widgets in the background, so that
+ * creating the first widget does not have to wait for them. They become ready
+ * once the main loop runs.
  *
  * Since: 0.6
  */
@@ -242,5 +306,13 @@ sandboxutils_init (int *argc, char **argv[])
 {
   if (!sandboxutils_parse_args (argc, argv))
     sandboxutils_set_sandboxed (TRUE);
+
+  if (sandboxutils_get_sandboxed ())
+  {
+    // Registering the class makes it wait for the connection to get its proxy
+    g_type_class_ref (REMOTE_TYPE_FILE_CHOOSER_DIALOG);
+    _sandboxutils_server_watch ();
+    _sandboxutils_connection_prefetch ();
+  }
 }
 
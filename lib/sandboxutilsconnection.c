@@ -0,0 +1,319 @@
+/*
+ * sandboxutilsconnection.c: bus connection shared by remote widgets
+ *
+ * Copyright (C) 2014 Steve Dodier-Lazaro <sidnioulz@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Steve Dodier-Lazaro <sidnioulz@gmail.com>
+ */
+
+#include <syslog.h>
+
+#include "sandboxutilsconnection.h"
+#include "sandboxutilscommon.h"
+#include "sandboxfilechooserdialog.h"
+
+// How long a widget constructor may wait for the bus to tell whether the
+// server is there, when nothing is known yet
+#define SANDBOXUTILS_SERVER_PROBE_TIMEOUT 250
+
+typedef enum {
+  SANDBOXUTILS_SERVER_UNKNOWN     = 0,
+  SANDBOXUTILS_SERVER_AVAILABLE   = 1,
+  SANDBOXUTILS_SERVER_UNAVAILABLE = 2,
+} SandboxUtilsServerState;
+
+typedef struct {
+  SandboxUtilsConnectionReadyFunc func;
+  gpointer                        user_data;
+} SandboxUtilsConnectionWaiter;
+
+G_LOCK_DEFINE_STATIC (_connection);
+static GDBusConnection *_connection = NULL;
+static gboolean         _connecting = FALSE;
+static GSList          *_waiters    = NULL;
+
+G_LOCK_DEFINE_STATIC (_server);
+static SandboxUtilsServerState _server_state    = SANDBOXUTILS_SERVER_UNKNOWN;
+static gboolean                _server_watching = FALSE;
+
+static void
+_sandboxutils_connection_notify (GDBusConnection *connection,
+                                 GSList          *waiters)
+{
+  SandboxUtilsConnectionWaiter *waiter;
+  GSList                       *iter;
+
+  for (iter = waiters; iter; iter = iter->next)
+  {
+    waiter = iter->data;
+    waiter->func (connection, waiter->user_data);
+  }
+
+  g_slist_free_full (waiters, g_free);
+}
+
+static void
+_sandboxutils_connection_on_ready (GObject      *source,
+                                   GAsyncResult *res,
+                                   gpointer      user_data)
+{
+  GDBusConnection *connection;
+  GSList          *waiters = NULL;
+  GError          *error   = NULL;
+
+  connection = g_bus_get_finish (res, &error);
+
+  G_LOCK (_connection);
+  _connecting = FALSE;
+
+  if (connection)
+  {
+    // Someone may have needed it first and waited for it synchronously
+    if (!_connection)
+      _connection = g_object_ref (connection);
+
+    waiters  = _waiters;
+    _waiters = NULL;
+  }
+  G_UNLOCK (_connection);
+
+  if (connection)
+  {
+    _sandboxutils_connection_notify (connection, waiters);
+    g_object_unref (connection);
+  }
+  else
+  {
+    // Waiters stay registered, in case a later attempt succeeds
+    syslog (LOG_WARNING, "SandboxUtils._ConnectionOnReady: could not connect to the session bus (%s).\n",
+            _sandboxutils_error_get_message (error));
+    g_error_free (error);
+  }
+}
+
+/*
+ * Starts connecting to the session bus in the background, if not connected or
+ * connecting already. The handshake runs in a GDBus thread, and waiters are
+ * notified from the thread-default main context of the caller.
+ */
+void
+_sandboxutils_connection_prefetch (void)
+{
+  gboolean start;
+
+  G_LOCK (_connection);
+  start = !_connection && !_connecting;
+  _connecting = _connecting || start;
+  G_UNLOCK (_connection);
+
+  if (start)
+    g_bus_get (G_BUS_TYPE_SESSION, NULL, _sandboxutils_connection_on_ready, NULL);
+}
+
+/*
+ * Calls @func once connected to the session bus, right away if connected
+ * already. Does not start connecting: @func is called when something else
+ * does, either _sandboxutils_connection_prefetch() or a background connection
+ * that completes after _sandboxutils_connection_get() was used.
+ */
+void
+_sandboxutils_connection_when_ready (SandboxUtilsConnectionReadyFunc func,
+                                     gpointer                        user_data)
+{
+  SandboxUtilsConnectionWaiter *waiter;
+  GDBusConnection              *connection = NULL;
+
+  g_return_if_fail (func != NULL);
+
+  G_LOCK (_connection);
+  if (_connection)
+    connection = g_object_ref (_connection);
+  else
+  {
+    waiter = g_malloc (sizeof (SandboxUtilsConnectionWaiter));
+    waiter->func      = func;
+    waiter->user_data = user_data;
+    _waiters = g_slist_append (_waiters, waiter);
+  }
+  G_UNLOCK (_connection);
+
+  if (connection)
+  {
+    func (connection, user_data);
+    g_object_unref (connection);
+  }
+}
+
+/*
+ * Returns the shared connection, without a reference, connecting if needed.
+ * If a background connection is underway, this waits for it to complete
+ * rather than starting another handshake, as GDBus shares the bus singleton.
+ */
+GDBusConnection *
+_sandboxutils_connection_get (GError **error)
+{
+  GDBusConnection *connection;
+
+  G_LOCK (_connection);
+  connection = _connection;
+  G_UNLOCK (_connection);
+
+  if (connection)
+    return connection;
+
+  connection = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, error);
+  if (!connection)
+    return NULL;
+
+  G_LOCK (_connection);
+  if (!_connection)
+    _connection = connection;
+  else
+    g_object_unref (connection);
+  connection = _connection;
+  G_UNLOCK (_connection);
+
+  return connection;
+}
+
+static void
+_sandboxutils_server_set_state (SandboxUtilsServerState state)
+{
+  G_LOCK (_server);
+  if (_server_state != state)
+    syslog (LOG_DEBUG, "SandboxUtils._ServerSetState: the server is now %s.\n",
+            state == SANDBOXUTILS_SERVER_AVAILABLE ? "available" : "unavailable");
+  _server_state = state;
+  G_UNLOCK (_server);
+}
+
+static void
+_sandboxutils_server_on_appeared (GDBusConnection *connection,
+                                  const gchar     *name,
+                                  const gchar     *name_owner,
+                                  gpointer         user_data)
+{
+  _sandboxutils_server_set_state (SANDBOXUTILS_SERVER_AVAILABLE);
+}
+
+static void
+_sandboxutils_server_on_vanished (GDBusConnection *connection,
+                                  const gchar     *name,
+                                  gpointer         user_data)
+{
+  _sandboxutils_server_set_state (SANDBOXUTILS_SERVER_UNAVAILABLE);
+}
+
+static void
+_sandboxutils_server_watch_on (GDBusConnection *connection,
+                               gpointer         user_data)
+{
+  gboolean start;
+
+  G_LOCK (_server);
+  start = !_server_watching;
+  _server_watching = TRUE;
+  G_UNLOCK (_server);
+
+  if (!start)
+    return;
+
+  // Asks for the current owner asynchronously, then follows NameOwnerChanged
+  // for as long as the process lives
+  g_bus_watch_name_on_connection (connection,
+                                  SFCD_IFACE,
+                                  G_BUS_NAME_WATCHER_FLAGS_NONE,
+                                  _sandboxutils_server_on_appeared,
+                                  _sandboxutils_server_on_vanished,
+                                  NULL,
+                                  NULL);
+}
+
+/*
+ * Starts watching the server's bus name once connected, so that its
+ * availability is known without asking by the time a widget is created.
+ */
+void
+_sandboxutils_server_watch (void)
+{
+  _sandboxutils_connection_when_ready (_sandboxutils_server_watch_on, NULL);
+}
+
+/*
+ * Tells whether the server currently owns its bus name. The first time, if
+ * the watch has not answered yet, asks the bus directly with a short timeout.
+ * A timeout is reported as unavailable but not remembered, so the next call
+ * asks again.
+ */
+gboolean
+_sandboxutils_server_get_available (void)
+{
+  SandboxUtilsServerState  state;
+  GDBusConnection         *connection;
+  GVariant                *reply;
+  GError                  *error = NULL;
+  gboolean                 owned = FALSE;
+
+  G_LOCK (_server);
+  state = _server_state;
+  G_UNLOCK (_server);
+
+  if (state != SANDBOXUTILS_SERVER_UNKNOWN)
+    return state == SANDBOXUTILS_SERVER_AVAILABLE;
+
+  connection = _sandboxutils_connection_get (&error);
+  if (!connection)
+  {
+    syslog (LOG_WARNING, "SandboxUtils._ServerGetAvailable: could not connect to the session bus (%s).\n",
+            _sandboxutils_error_get_message (error));
+    g_error_free (error);
+    return FALSE;
+  }
+
+  // Keep the answer fresh from now on
+  _sandboxutils_server_watch_on (connection, NULL);
+
+  reply = g_dbus_connection_call_sync (connection,
+                                       "org.freedesktop.DBus",
+                                       "/org/freedesktop/DBus",
+                                       "org.freedesktop.DBus",
+                                       "NameHasOwner",
+                                       g_variant_new ("(s)", SFCD_IFACE),
+                                       G_VARIANT_TYPE ("(b)"),
+                                       G_DBUS_CALL_FLAGS_NONE,
+                                       SANDBOXUTILS_SERVER_PROBE_TIMEOUT,
+                                       NULL,
+                                       &error);
+  if (!reply)
+  {
+    syslog (LOG_WARNING, "SandboxUtils._ServerGetAvailable: could not tell whether the server is running (%s).\n",
+            _sandboxutils_error_get_message (error));
+    g_error_free (error);
+    return FALSE;
+  }
+
+  g_variant_get (reply, "(b)", &owned);
+  g_variant_unref (reply);
+
+  // Unless the watch answered in the meantime, which is more recent
+  G_LOCK (_server);
+  if (_server_state == SANDBOXUTILS_SERVER_UNKNOWN)
+    _server_state = owned ? SANDBOXUTILS_SERVER_AVAILABLE : SANDBOXUTILS_SERVER_UNAVAILABLE;
+  owned = (_server_state == SANDBOXUTILS_SERVER_AVAILABLE);
+  G_UNLOCK (_server);
+
+  return owned;
+}
@@ -0,0 +1,59 @@
+/*
+ * sandboxutilsconnection.h: bus connection shared by remote widgets
+ *
+ * Copyright (C) 2014 Steve Dodier-Lazaro <sidnioulz@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Steve Dodier-Lazaro <sidnioulz@gmail.com>
+ */
+
+/*
+ * Private header, not installed. All remote widget classes talk to the server
+ * over the same session bus connection. sandboxutils_init() starts connecting
+ * in the background, so that the D-Bus handshake is not on the critical path
+ * of applications; widget classes ask to be told when the connection is ready
+ * to create their proxies, and only wait for it if they are used before.
+ *
+ * Whether the server owns its bus name is also tracked here, so that widget
+ * constructors can tell right away whether remote widgets would work. The
+ * name is probed once, and the answer is kept up to date by watching the
+ * name's owner rather than asked again.
+ */
+
+#ifndef __SANDBOX_UTILS_CONNECTION_H__
+#define __SANDBOX_UTILS_CONNECTION_H__
+
+#include <gio/gio.h>
+
+typedef void (*SandboxUtilsConnectionReadyFunc) (GDBusConnection *connection,
+                                                 gpointer         user_data);
+
+void
+_sandboxutils_connection_prefetch (void);
+
+void
+_sandboxutils_connection_when_ready (SandboxUtilsConnectionReadyFunc func,
+                                     gpointer                        user_data);
+
+GDBusConnection *
+_sandboxutils_connection_get (GError **error);
+
+void
+_sandboxutils_server_watch (void);
+
+gboolean
+_sandboxutils_server_get_available (void);
+
+#endif /* __SANDBOX_UTILS_CONNECTION_H__ */
@@ -0,0 +1,144 @@
+/*
+ * sandboxutilsfileinfo.c: file attributes of the selection of dialogs
+ *
+ * Copyright (C) 2014 Steve Dodier-Lazaro <sidnioulz@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Steve Dodier-Lazaro <sidnioulz@gmail.com>
+ */
+
+#include <string.h>
+
+#include "sandboxutilsfileinfo.h"
+
+// What stat() and access() tell about a file, and nothing about others
+static const gchar *_sandboxutils_file_info_namespaces[] = {
+  "standard", "time", "access", "unix", NULL
+};
+
+/*
+ * Checks that @attributes, in the format of g_file_query_info(), only asks
+ * for attributes clients may know about.
+ */
+gboolean
+_sandboxutils_file_info_check_attributes (const gchar  *attributes,
+                                          GError      **error)
+{
+  gchar    **names;
+  gchar     *ns;
+  gboolean   allowed = TRUE;
+  guint      i, j;
+
+  g_return_val_if_fail (attributes != NULL, FALSE);
+
+  names = g_strsplit (attributes, ",", -1);
+
+  for (i = 0; allowed && names[i]; i++)
+  {
+    ns      = g_strstrip (names[i]);
+    allowed = FALSE;
+
+    // Either a whole namespace, as in "time::*", or one of its attributes
+    for (j = 0; !allowed && _sandboxutils_file_info_namespaces[j]; j++)
+      allowed = g_str_has_prefix (ns, _sandboxutils_file_info_namespaces[j]) &&
+                g_str_has_prefix (ns + strlen (_sandboxutils_file_info_namespaces[j]), "::") &&
+                ns[strlen (_sandboxutils_file_info_namespaces[j]) + 2] != '\0';
+
+    if (!allowed)
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_PERMISSION_DENIED,
+                   "SandboxUtilsFileInfo: attribute '%s' may not be queried, only those of the standard, time, access and unix namespaces may.\n",
+                   ns);
+  }
+
+  g_strfreev (names);
+
+  return allowed;
+}
+
+static GVariant *
+_sandboxutils_file_info_attribute_to_variant (GFileInfo   *info,
+                                              const gchar *name)
+{
+  switch (g_file_info_get_attribute_type (info, name))
+  {
+    case G_FILE_ATTRIBUTE_TYPE_STRING:
+      return g_variant_new_string (g_file_info_get_attribute_string (info, name));
+    case G_FILE_ATTRIBUTE_TYPE_BYTE_STRING:
+      return g_variant_new_bytestring (g_file_info_get_attribute_byte_string (info, name));
+    case G_FILE_ATTRIBUTE_TYPE_BOOLEAN:
+      return g_variant_new_boolean (g_file_info_get_attribute_boolean (info, name));
+    case G_FILE_ATTRIBUTE_TYPE_UINT32:
+      return g_variant_new_uint32 (g_file_info_get_attribute_uint32 (info, name));
+    case G_FILE_ATTRIBUTE_TYPE_INT32:
+      return g_variant_new_int32 (g_file_info_get_attribute_int32 (info, name));
+    case G_FILE_ATTRIBUTE_TYPE_UINT64:
+      return g_variant_new_uint64 (g_file_info_get_attribute_uint64 (info, name));
+    case G_FILE_ATTRIBUTE_TYPE_INT64:
+      return g_variant_new_int64 (g_file_info_get_attribute_int64 (info, name));
+    case G_FILE_ATTRIBUTE_TYPE_STRINGV:
+      return g_variant_new_strv ((const gchar * const *) g_file_info_get_attribute_stringv (info, name), -1);
+    default:
+      // Icons and other objects cannot travel over D-Bus
+      return NULL;
+  }
+}
+
+/*
+ * Queries @attributes of the file at @uri, without following symbolic links.
+ * Blocks, and may be called from any thread. Returns a floating (sa{sv}).
+ */
+GVariant *
+_sandboxutils_file_info_query (const gchar  *uri,
+                               const gchar  *attributes,
+                               GCancellable *cancellable)
+{
+  GVariantBuilder   builder;
+  GFileInfo        *info;
+  GError           *error = NULL;
+  GVariant         *value;
+  GFile            *file;
+  gchar           **names;
+  gchar            *path;
+  guint             i;
+
+  file = g_file_new_for_uri (uri);
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+
+  if ((path = g_file_get_path (file)) != NULL)
+    g_variant_builder_add (&builder, "{sv}", "filename", g_variant_new_string (path));
+
+  info = g_file_query_info (file, attributes, G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, cancellable, &error);
+
+  if (info)
+  {
+    names = g_file_info_list_attributes (info, NULL);
+    for (i = 0; names && names[i]; i++)
+      if ((value = _sandboxutils_file_info_attribute_to_variant (info, names[i])) != NULL)
+        g_variant_builder_add (&builder, "{sv}", names[i], value);
+
+    g_strfreev (names);
+    g_object_unref (info);
+  }
+  else
+  {
+    g_variant_builder_add (&builder, "{sv}", "error", g_variant_new_string (error->message));
+    g_error_free (error);
+  }
+
+  g_free (path);
+  g_object_unref (file);
+
+  return g_variant_new ("(sa{sv})", uri, &builder);
+}
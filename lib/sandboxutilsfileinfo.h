@@ -0,0 +1,48 @@
+/*
+ * sandboxutilsfileinfo.h: file attributes of the selection of dialogs
+ *
+ * Copyright (C) 2014 Steve Dodier-Lazaro <sidnioulz@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Steve Dodier-Lazaro <sidnioulz@gmail.com>
+ */
+
+/*
+ * Private header, not installed. Applications used to stat the files chosen
+ * in a dialog one by one, through their sandbox, after getting their names.
+ * The attributes they need are instead gathered along with the selection,
+ * and sent as an a(sa{sv}) of URIs and dictionaries. Each dictionary holds
+ * the file's name as "filename", the attributes that could be read under
+ * their GIO names, and "error" if the file could not be queried at all.
+ *
+ * Attributes are restricted to what stat() and access() tell, so that a
+ * client cannot learn about other files or users through them.
+ */
+
+#ifndef __SANDBOX_UTILS_FILE_INFO_H__
+#define __SANDBOX_UTILS_FILE_INFO_H__
+
+#include <gio/gio.h>
+
+gboolean
+_sandboxutils_file_info_check_attributes (const gchar  *attributes,
+                                          GError      **error);
+
+GVariant *
+_sandboxutils_file_info_query (const gchar  *uri,
+                               const gchar  *attributes,
+                               GCancellable *cancellable);
+
+#endif /* __SANDBOX_UTILS_FILE_INFO_H__ */
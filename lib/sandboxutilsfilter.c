@@ -0,0 +1,604 @@
+/*
+ * sandboxutilsfilter.c: compiled file filters for local dialogs
+ *
+ * Copyright (C) 2014 Steve Dodier-Lazaro <sidnioulz@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Steve Dodier-Lazaro <sidnioulz@gmail.com>
+ */
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sandboxutilsfilter.h"
+
+// States an automaton may build before starting over, which only happens
+// with many patterns full of wildcards
+#define SANDBOX_UTILS_FILTER_MAX_STATES 1024
+
+// How much of a file is read to guess its content type, as much as GIO does
+#define SANDBOX_UTILS_CONTENT_TYPE_SNIFF_SIZE 4096
+
+// Files whose content type is remembered, forgotten all at once when full
+#define SANDBOX_UTILS_CONTENT_TYPE_CACHE_SIZE 65536
+
+typedef enum {
+  SANDBOX_UTILS_GLOB_LITERAL,   /* one given character */
+  SANDBOX_UTILS_GLOB_ANY,       /* ? */
+  SANDBOX_UTILS_GLOB_CLASS,     /* [a-z], [!0-9] */
+  SANDBOX_UTILS_GLOB_STAR,      /* * */
+  SANDBOX_UTILS_GLOB_END,       /* end of a pattern, which is then matched */
+} SandboxUtilsGlobType;
+
+/* A step of a pattern, the states of the automaton being sets of such steps */
+typedef struct {
+  SandboxUtilsGlobType  type;
+  gunichar              c;
+  gboolean              negated;
+  GArray               *ranges;       /* gunichar pairs, of a class */
+} SandboxUtilsGlobItem;
+
+typedef struct {
+  guint                *positions;    /* sorted items to match next */
+  guint                 n_positions;  /* 0 for the state that matches nothing */
+  gboolean              accepting;
+  gint                  ascii[128];   /* next state per character, or -1 */
+  GHashTable           *wide;         /* other characters -> next state + 1 */
+} SandboxUtilsGlobState;
+
+struct _SandboxUtilsFilter
+{
+  GArray               *items;        /* SandboxUtilsGlobItem of all patterns */
+  GArray               *starts;       /* first item of each pattern */
+  GPtrArray            *states;       /* SandboxUtilsGlobState, built lazily */
+  GHashTable           *interned;     /* positions -> state index + 1 */
+  gint                  start;        /* state before reading, or -1 */
+  guint                 flushes;
+  GArray               *scratch;      /* positions of the state being built */
+  guint                *marks;        /* per item, generation it was added in */
+  guint                 generation;
+  gchar               **content_types;
+  GHashTable           *type_matches; /* interned content type -> 1 or 2 */
+};
+
+G_LOCK_DEFINE_STATIC (_content_types);
+static GHashTable *_content_types = NULL;  /* SandboxUtilsContentTypeKey -> interned type */
+
+typedef struct {
+  guint64               dev;
+  guint64               ino;
+  gint64                mtime;
+} SandboxUtilsContentTypeKey;
+
+static void
+_sandboxutils_filter_state_free (gpointer data)
+{
+  SandboxUtilsGlobState *state = data;
+
+  if (state->wide)
+    g_hash_table_unref (state->wide);
+  g_free (state->positions);
+  g_free (state);
+}
+
+/* Parses the class starting after the '[' at @p, returns where it ends */
+static const gchar *
+_sandboxutils_filter_parse_class (const gchar          *p,
+                                  SandboxUtilsGlobItem *item)
+{
+  gunichar first;
+  gunichar last;
+  gboolean leading = TRUE;
+
+  item->type   = SANDBOX_UTILS_GLOB_CLASS;
+  item->ranges = g_array_new (FALSE, FALSE, sizeof (gunichar));
+
+  if (*p == '!' || *p == '^')
+  {
+    item->negated = TRUE;
+    p++;
+  }
+
+  // A ']' right after the opening bracket is part of the class
+  while (*p && (*p != ']' || leading))
+  {
+    leading = FALSE;
+
+    if (*p == '\\' && p[1])
+      p++;
+    first = g_unichar_tolower (g_utf8_get_char (p));
+    p = g_utf8_next_char (p);
+    last = first;
+
+    if (*p == '-' && p[1] && p[1] != ']')
+    {
+      p++;
+      if (*p == '\\' && p[1])
+        p++;
+      last = g_unichar_tolower (g_utf8_get_char (p));
+      p = g_utf8_next_char (p);
+    }
+
+    g_array_append_val (item->ranges, first);
+    g_array_append_val (item->ranges, last);
+  }
+
+  // Unterminated, the '[' is taken literally as fnmatch() does
+  if (!*p)
+  {
+    g_array_unref (item->ranges);
+    item->ranges = NULL;
+    return NULL;
+  }
+
+  return p + 1;
+}
+
+static void
+_sandboxutils_filter_compile (SandboxUtilsFilter *filter,
+                              const gchar        *pattern)
+{
+  SandboxUtilsGlobItem  item;
+  const gchar          *p;
+  const gchar          *next;
+  const gchar          *end;
+  guint                 start = filter->items->len;
+
+  g_array_append_val (filter->starts, start);
+
+  for (p = pattern; *p; p = next)
+  {
+    memset (&item, 0, sizeof (item));
+    next = g_utf8_next_char (p);
+
+    if (*p == '*')
+    {
+      // Consecutive stars are one star
+      if (filter->items->len > start &&
+          g_array_index (filter->items, SandboxUtilsGlobItem, filter->items->len - 1).type == SANDBOX_UTILS_GLOB_STAR)
+        continue;
+      item.type = SANDBOX_UTILS_GLOB_STAR;
+    }
+    else if (*p == '?')
+      item.type = SANDBOX_UTILS_GLOB_ANY;
+    else if (*p == '[' && (end = _sandboxutils_filter_parse_class (next, &item)) != NULL)
+      next = end;
+    else
+    {
+      if (*p == '\\' && *next)
+      {
+        p    = next;
+        next = g_utf8_next_char (p);
+      }
+
+      item.type = SANDBOX_UTILS_GLOB_LITERAL;
+      item.c    = g_unichar_tolower (g_utf8_get_char (p));
+    }
+
+    g_array_append_val (filter->items, item);
+  }
+
+  memset (&item, 0, sizeof (item));
+  item.type = SANDBOX_UTILS_GLOB_END;
+  g_array_append_val (filter->items, item);
+}
+
+/* Starts building the positions of a new state */
+static void
+_sandboxutils_filter_begin (SandboxUtilsFilter *filter)
+{
+  g_array_set_size (filter->scratch, 0);
+
+  if (++filter->generation == 0)
+  {
+    memset (filter->marks, 0, filter->items->len * sizeof (guint));
+    filter->generation = 1;
+  }
+}
+
+/* Adds @position to the state being built, along with what a star may skip */
+static void
+_sandboxutils_filter_add (SandboxUtilsFilter *filter,
+                          guint               position)
+{
+  while (filter->marks[position] != filter->generation)
+  {
+    filter->marks[position] = filter->generation;
+    g_array_append_val (filter->scratch, position);
+
+    if (g_array_index (filter->items, SandboxUtilsGlobItem, position).type != SANDBOX_UTILS_GLOB_STAR)
+      break;
+
+    position++;
+  }
+}
+
+static gint
+_sandboxutils_filter_compare_positions (gconstpointer a,
+                                        gconstpointer b)
+{
+  guint pa = *(const guint *) a;
+  guint pb = *(const guint *) b;
+
+  return pa < pb ? -1 : pa > pb;
+}
+
+/* Returns the state with the positions being built, making it if needed */
+static gint
+_sandboxutils_filter_intern (SandboxUtilsFilter *filter)
+{
+  SandboxUtilsGlobState *state;
+  GBytes                *key;
+  gpointer               found;
+  guint                  i;
+
+  g_array_sort (filter->scratch, _sandboxutils_filter_compare_positions);
+  key = g_bytes_new (filter->scratch->data, filter->scratch->len * sizeof (guint));
+
+  if ((found = g_hash_table_lookup (filter->interned, key)) != NULL)
+  {
+    g_bytes_unref (key);
+    return GPOINTER_TO_INT (found) - 1;
+  }
+
+  // Start over rather than grow without bounds
+  if (filter->states->len >= SANDBOX_UTILS_FILTER_MAX_STATES)
+  {
+    g_ptr_array_set_size (filter->states, 0);
+    g_hash_table_remove_all (filter->interned);
+    filter->start = -1;
+    filter->flushes++;
+  }
+
+  state = g_malloc0 (sizeof (SandboxUtilsGlobState));
+  state->n_positions = filter->scratch->len;
+  state->positions   = g_malloc (filter->scratch->len * sizeof (guint) + 1);
+  memcpy (state->positions, filter->scratch->data, filter->scratch->len * sizeof (guint));
+  memset (state->ascii, -1, sizeof (state->ascii));
+
+  for (i = 0; i < state->n_positions && !state->accepting; i++)
+    state->accepting = g_array_index (filter->items, SandboxUtilsGlobItem, state->positions[i]).type == SANDBOX_UTILS_GLOB_END;
+
+  g_ptr_array_add (filter->states, state);
+  g_hash_table_insert (filter->interned, key, GINT_TO_POINTER (filter->states->len));
+
+  return filter->states->len - 1;
+}
+
+static gint
+_sandboxutils_filter_get_start (SandboxUtilsFilter *filter)
+{
+  guint i;
+
+  if (filter->start < 0)
+  {
+    _sandboxutils_filter_begin (filter);
+    for (i = 0; i < filter->starts->len; i++)
+      _sandboxutils_filter_add (filter, g_array_index (filter->starts, guint, i));
+    filter->start = _sandboxutils_filter_intern (filter);
+  }
+
+  return filter->start;
+}
+
+static gboolean
+_sandboxutils_filter_item_matches (SandboxUtilsGlobItem *item,
+                                   gunichar              c)
+{
+  gboolean in = FALSE;
+  guint    i;
+
+  switch (item->type)
+  {
+    case SANDBOX_UTILS_GLOB_LITERAL:
+      return item->c == c;
+
+    case SANDBOX_UTILS_GLOB_ANY:
+    case SANDBOX_UTILS_GLOB_STAR:
+      return TRUE;
+
+    case SANDBOX_UTILS_GLOB_CLASS:
+      for (i = 0; i + 1 < item->ranges->len && !in; i += 2)
+        in = g_array_index (item->ranges, gunichar, i) <= c && c <= g_array_index (item->ranges, gunichar, i + 1);
+      return in != item->negated;
+
+    default:
+      return FALSE;
+  }
+}
+
+/* The state reached from state @from by reading @c */
+static gint
+_sandboxutils_filter_step (SandboxUtilsFilter *filter,
+                           gint                from,
+                           gunichar            c)
+{
+  SandboxUtilsGlobState *state = g_ptr_array_index (filter->states, from);
+  SandboxUtilsGlobItem  *item;
+  gpointer               found;
+  guint                  flushes = filter->flushes;
+  guint                  i;
+  gint                   to;
+
+  if (c < 128 && state->ascii[c] >= 0)
+    return state->ascii[c];
+
+  if (c >= 128 && state->wide && (found = g_hash_table_lookup (state->wide, GUINT_TO_POINTER (c))) != NULL)
+    return GPOINTER_TO_INT (found) - 1;
+
+  _sandboxutils_filter_begin (filter);
+  for (i = 0; i < state->n_positions; i++)
+  {
+    item = &g_array_index (filter->items, SandboxUtilsGlobItem, state->positions[i]);
+    if (!_sandboxutils_filter_item_matches (item, c))
+      continue;
+
+    // A star stays where it is, anything else moves on
+    if (item->type == SANDBOX_UTILS_GLOB_STAR)
+      _sandboxutils_filter_add (filter, state->positions[i]);
+    else
+      _sandboxutils_filter_add (filter, state->positions[i] + 1);
+  }
+
+  to = _sandboxutils_filter_intern (filter);
+
+  // Unless @state was just freed to start over
+  if (flushes == filter->flushes)
+  {
+    if (c < 128)
+      state->ascii[c] = to;
+    else
+    {
+      if (!state->wide)
+        state->wide = g_hash_table_new (g_direct_hash, g_direct_equal);
+      g_hash_table_insert (state->wide, GUINT_TO_POINTER (c), GINT_TO_POINTER (to + 1));
+    }
+  }
+
+  return to;
+}
+
+static gboolean
+_sandboxutils_filter_match_name (SandboxUtilsFilter *filter,
+                                 const gchar        *name)
+{
+  SandboxUtilsGlobState *state;
+  const gchar           *p;
+  gunichar               c;
+  gint                   current;
+
+  current = _sandboxutils_filter_get_start (filter);
+
+  for (p = name; *p; )
+  {
+    if ((guchar) *p < 128)
+      c = g_ascii_tolower (*p++);
+    else
+    {
+      c = g_unichar_tolower (g_utf8_get_char (p));
+      p = g_utf8_next_char (p);
+    }
+
+    current = _sandboxutils_filter_step (filter, current, c);
+
+    // No pattern can match any more
+    state = g_ptr_array_index (filter->states, current);
+    if (!state->n_positions)
+      return FALSE;
+  }
+
+  state = g_ptr_array_index (filter->states, current);
+
+  return state->accepting;
+}
+
+/*
+ * Compiles @patterns, glob patterns as understood by GtkFileFilter, and
+ * @mime_types, which may end with a wildcard as in "image/*". Either may be
+ * %NULL. A filter with neither matches nothing. Filters are not thread-safe.
+ */
+SandboxUtilsFilter *
+_sandboxutils_filter_new (const gchar * const *patterns,
+                          const gchar * const *mime_types)
+{
+  SandboxUtilsFilter *filter;
+  guint               i;
+
+  filter = g_malloc0 (sizeof (SandboxUtilsFilter));
+  filter->items    = g_array_new (FALSE, FALSE, sizeof (SandboxUtilsGlobItem));
+  filter->starts   = g_array_new (FALSE, FALSE, sizeof (guint));
+  filter->states   = g_ptr_array_new_with_free_func (_sandboxutils_filter_state_free);
+  filter->interned = g_hash_table_new_full (g_bytes_hash, g_bytes_equal, (GDestroyNotify) g_bytes_unref, NULL);
+  filter->scratch  = g_array_new (FALSE, FALSE, sizeof (guint));
+  filter->start    = -1;
+
+  for (i = 0; patterns && patterns[i]; i++)
+    _sandboxutils_filter_compile (filter, patterns[i]);
+
+  filter->marks = g_new0 (guint, filter->items->len + 1);
+
+  filter->content_types = g_new0 (gchar *, (mime_types ? g_strv_length ((gchar **) mime_types) : 0) + 1);
+  for (i = 0; mime_types && mime_types[i]; i++)
+    filter->content_types[i] = g_content_type_from_mime_type (mime_types[i]);
+
+  // Content types are interned, so pointers are enough as keys
+  filter->type_matches = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+  return filter;
+}
+
+void
+_sandboxutils_filter_free (gpointer data)
+{
+  SandboxUtilsFilter   *filter = data;
+  SandboxUtilsGlobItem *item;
+  guint                 i;
+
+  if (!filter)
+    return;
+
+  for (i = 0; i < filter->items->len; i++)
+  {
+    item = &g_array_index (filter->items, SandboxUtilsGlobItem, i);
+    if (item->ranges)
+      g_array_unref (item->ranges);
+  }
+
+  g_array_unref (filter->items);
+  g_array_unref (filter->starts);
+  g_ptr_array_unref (filter->states);
+  g_hash_table_unref (filter->interned);
+  g_array_unref (filter->scratch);
+  g_free (filter->marks);
+  g_strfreev (filter->content_types);
+  g_hash_table_unref (filter->type_matches);
+  g_free (filter);
+}
+
+/* Tells whether matching needs the content type of files */
+gboolean
+_sandboxutils_filter_get_needs_content_type (SandboxUtilsFilter *filter)
+{
+  g_return_val_if_fail (filter != NULL, FALSE);
+
+  return filter->content_types[0] != NULL;
+}
+
+/*
+ * Tells whether a file matches, by its @display_name first, and then by its
+ * content type. @filename may be %NULL for files that are not local, whose
+ * content type is then guessed from their name only.
+ */
+gboolean
+_sandboxutils_filter_match (SandboxUtilsFilter *filter,
+                            const gchar        *filename,
+                            const gchar        *display_name)
+{
+  const gchar *type;
+  gpointer     found;
+  gboolean     matches = FALSE;
+  guint        i;
+
+  g_return_val_if_fail (filter != NULL, FALSE);
+
+  if (!display_name)
+    return FALSE;
+
+  if (filter->starts->len && _sandboxutils_filter_match_name (filter, display_name))
+    return TRUE;
+
+  if (!filter->content_types[0])
+    return FALSE;
+
+  type = _sandboxutils_content_type_get (filename, display_name);
+
+  if ((found = g_hash_table_lookup (filter->type_matches, type)) != NULL)
+    return GPOINTER_TO_INT (found) == 2;
+
+  for (i = 0; filter->content_types[i] && !matches; i++)
+    matches = g_content_type_is_a (type, filter->content_types[i]);
+
+  g_hash_table_insert (filter->type_matches, (gpointer) type, GINT_TO_POINTER (matches ? 2 : 1));
+
+  return matches;
+}
+
+static guint
+_sandboxutils_content_type_key_hash (gconstpointer data)
+{
+  const SandboxUtilsContentTypeKey *key = data;
+
+  return (guint) (key->ino ^ (key->ino >> 32) ^ (key->dev * 31) ^ key->mtime);
+}
+
+static gboolean
+_sandboxutils_content_type_key_equal (gconstpointer a,
+                                      gconstpointer b)
+{
+  return memcmp (a, b, sizeof (SandboxUtilsContentTypeKey)) == 0;
+}
+
+/*
+ * Returns the interned content type of a file, guessed from @display_name
+ * and, if that is not conclusive and @filename is given, from the start of
+ * the file. What is read from files is cached for the whole process, so that
+ * every dialog and filter benefits from it. Thread-safe.
+ */
+const gchar *
+_sandboxutils_content_type_get (const gchar *filename,
+                                const gchar *display_name)
+{
+  SandboxUtilsContentTypeKey  key;
+  SandboxUtilsContentTypeKey *stored;
+  struct stat                 st;
+  const gchar                *type;
+  guchar                      data[SANDBOX_UTILS_CONTENT_TYPE_SNIFF_SIZE];
+  gchar                      *guess;
+  gssize                      len;
+  gboolean                    uncertain = FALSE;
+  gint                        fd;
+
+  guess = g_content_type_guess (display_name, NULL, 0, &uncertain);
+  type  = g_intern_string (guess);
+  g_free (guess);
+
+  // Only regular files are worth reading, and FIFOs would block
+  if (!uncertain || !filename || stat (filename, &st) != 0 || !S_ISREG (st.st_mode))
+    return type;
+
+  memset (&key, 0, sizeof (key));
+  key.dev   = st.st_dev;
+  key.ino   = st.st_ino;
+  key.mtime = st.st_mtime;
+
+  G_LOCK (_content_types);
+  if (!_content_types)
+    _content_types = g_hash_table_new_full (_sandboxutils_content_type_key_hash,
+                                            _sandboxutils_content_type_key_equal,
+                                            g_free, NULL);
+  if ((guess = g_hash_table_lookup (_content_types, &key)) != NULL)
+    type = guess;
+  G_UNLOCK (_content_types);
+
+  if (guess)
+    return type;
+
+  fd = open (filename, O_RDONLY | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0)
+    return type;
+
+  len = read (fd, data, sizeof (data));
+  close (fd);
+
+  if (len < 0)
+    return type;
+
+  guess = g_content_type_guess (display_name, data, len, NULL);
+  type  = g_intern_string (guess);
+  g_free (guess);
+
+  stored  = g_malloc (sizeof (SandboxUtilsContentTypeKey));
+  *stored = key;
+
+  G_LOCK (_content_types);
+  if (g_hash_table_size (_content_types) >= SANDBOX_UTILS_CONTENT_TYPE_CACHE_SIZE)
+    g_hash_table_remove_all (_content_types);
+  g_hash_table_insert (_content_types, stored, (gpointer) type);
+  G_UNLOCK (_content_types);
+
+  return type;
+}
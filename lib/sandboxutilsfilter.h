@@ -0,0 +1,68 @@
+/*
+ * sandboxutilsfilter.h: compiled file filters for local dialogs
+ *
+ * Copyright (C) 2014 Steve Dodier-Lazaro <sidnioulz@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Steve Dodier-Lazaro <sidnioulz@gmail.com>
+ */
+
+/*
+ * Private header, not installed. GtkFileFilter tries each of its patterns in
+ * turn on every file with fnmatch(), and asks GIO for the content type of
+ * every file as soon as it has a MIME type rule, which reads the start of
+ * files whose name is not conclusive. Local dialogs use these filters instead,
+ * through a custom GtkFileFilter rule.
+ *
+ * All the glob patterns of a filter are compiled into a single automaton,
+ * which reads a file name once, one character at a time, whatever the number
+ * of patterns. Its states are built the first time they are reached and then
+ * reused, so matching costs a table lookup per character. Patterns ignore
+ * case, so that "*.jpg" also matches "IMG.JPG".
+ *
+ * Content types are guessed from file names, and files are only read when the
+ * name is not enough. What was read is cached for the whole process, keyed by
+ * device, inode and modification time, so that a file is read once however
+ * many dialogs and filters look at it. Whether a content type matches a
+ * filter's MIME types is remembered by the filter.
+ */
+
+#ifndef __SANDBOX_UTILS_FILTER_H__
+#define __SANDBOX_UTILS_FILTER_H__
+
+#include <gio/gio.h>
+
+typedef struct _SandboxUtilsFilter SandboxUtilsFilter;
+
+SandboxUtilsFilter *
+_sandboxutils_filter_new (const gchar * const *patterns,
+                          const gchar * const *mime_types);
+
+void
+_sandboxutils_filter_free (gpointer filter);
+
+gboolean
+_sandboxutils_filter_get_needs_content_type (SandboxUtilsFilter *filter);
+
+gboolean
+_sandboxutils_filter_match (SandboxUtilsFilter *filter,
+                            const gchar        *filename,
+                            const gchar        *display_name);
+
+const gchar *
+_sandboxutils_content_type_get (const gchar *filename,
+                                const gchar *display_name);
+
+#endif /* __SANDBOX_UTILS_FILTER_H__ */
@@ -0,0 +1,428 @@
+/*
+ * sandboxutilsledger.c: checking which files the user granted to which process
+ *
+ * Copyright (C) 2014 Steve Dodier-Lazaro <sidnioulz@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Steve Dodier-Lazaro <sidnioulz@gmail.com>
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <gio/gio.h>
+
+#include "sandboxutilsledger.h"
+#include "sandboxutilsledgerfile.h"
+
+#define SANDBOXUTILS_LEDGER_FNV_OFFSET 0xcbf29ce484222325ULL
+#define SANDBOXUTILS_LEDGER_FNV_PRIME  0x100000001b3ULL
+
+struct _SandboxUtilsLedger
+{
+  guint8                *base;
+  gsize                  size;
+};
+
+/* Path of the ledger, in the user's runtime directory */
+gchar *
+_sandboxutils_ledger_get_filename (void)
+{
+  return g_build_filename (g_get_user_runtime_dir (), "sandboxutils",
+                           SANDBOXUTILS_LEDGER_FILENAME, NULL);
+}
+
+gsize
+_sandboxutils_ledger_get_size (guint32 n_slots,
+                               guint32 capacity)
+{
+  return sizeof (SandboxUtilsLedgerHeader) +
+         (gsize) n_slots * sizeof (SandboxUtilsLedgerSlot) +
+         (gsize) capacity * sizeof (SandboxUtilsLedgerRecord);
+}
+
+/* Checks that a mapping of @size bytes holds a ledger that fits in it */
+gboolean
+_sandboxutils_ledger_check_header (guint8 *base,
+                                   gsize   size)
+{
+  SandboxUtilsLedgerHeader *header = (SandboxUtilsLedgerHeader *) base;
+
+  return size >= sizeof (SandboxUtilsLedgerHeader) &&
+         memcmp (header->magic, SANDBOXUTILS_LEDGER_MAGIC, sizeof (header->magic)) == 0 &&
+         header->version == SANDBOXUTILS_LEDGER_VERSION &&
+         header->n_slots != 0 && (header->n_slots & (header->n_slots - 1)) == 0 &&
+         size >= _sandboxutils_ledger_get_size (header->n_slots, header->capacity);
+}
+
+static inline guint64
+_sandboxutils_ledger_hash (guint64       hash,
+                           gconstpointer data,
+                           gsize         length)
+{
+  const guint8 *bytes = data;
+  gsize         i;
+
+  for (i = 0; i < length; i++)
+    hash = (hash ^ bytes[i]) * SANDBOXUTILS_LEDGER_FNV_PRIME;
+
+  return hash;
+}
+
+guint64
+_sandboxutils_ledger_key_for_inode (guint32 pid,
+                                    guint64 start_time,
+                                    guint64 dev,
+                                    guint64 ino)
+{
+  guint64 hash = _sandboxutils_ledger_hash (SANDBOXUTILS_LEDGER_FNV_OFFSET, "i", 1);
+
+  hash = _sandboxutils_ledger_hash (hash, &pid, sizeof (pid));
+  hash = _sandboxutils_ledger_hash (hash, &start_time, sizeof (start_time));
+  hash = _sandboxutils_ledger_hash (hash, &dev, sizeof (dev));
+  hash = _sandboxutils_ledger_hash (hash, &ino, sizeof (ino));
+
+  // 0 marks empty slots
+  return hash ? hash : 1;
+}
+
+guint64
+_sandboxutils_ledger_key_for_path (guint32      pid,
+                                   guint64      start_time,
+                                   const gchar *path)
+{
+  guint64 hash = _sandboxutils_ledger_hash (SANDBOXUTILS_LEDGER_FNV_OFFSET, "p", 1);
+
+  hash = _sandboxutils_ledger_hash (hash, &pid, sizeof (pid));
+  hash = _sandboxutils_ledger_hash (hash, &start_time, sizeof (start_time));
+  hash = _sandboxutils_ledger_hash (hash, path, strlen (path));
+
+  return hash ? hash : 1;
+}
+
+guint64
+_sandboxutils_ledger_checksum (const SandboxUtilsLedgerRecord *record)
+{
+  return _sandboxutils_ledger_hash (SANDBOXUTILS_LEDGER_FNV_OFFSET,
+                                    (const guint8 *) record + sizeof (record->checksum),
+                                    sizeof (SandboxUtilsLedgerRecord) - sizeof (record->checksum));
+}
+
+/* Tells whether @record is about that process and file, by path if given */
+gboolean
+_sandboxutils_ledger_record_matches (const SandboxUtilsLedgerRecord *record,
+                                     guint32                         pid,
+                                     guint64                         start_time,
+                                     guint64                         dev,
+                                     guint64                         ino,
+                                     const gchar                    *path)
+{
+  gsize length;
+
+  if (record->pid != pid || record->start_time != start_time)
+    return FALSE;
+
+  if (!path)
+    return record->ino != 0 && record->dev == dev && record->ino == ino;
+
+  // Truncated paths are not indexed, see sandboxutilsledgerfile.h
+  length = strlen (path);
+  return record->path_length == length && length < SANDBOXUTILS_LEDGER_PATH_MAX &&
+         strcmp (record->path, path) == 0;
+}
+
+/*
+ * Finds the latest record of a grant to a process, by inode, or by path if
+ * @path is given. Safe against the server appending to the ledger meanwhile.
+ */
+const SandboxUtilsLedgerRecord *
+_sandboxutils_ledger_find (guint8      *base,
+                           guint32      pid,
+                           guint64      start_time,
+                           guint64      dev,
+                           guint64      ino,
+                           const gchar *path)
+{
+  SandboxUtilsLedgerHeader *header  = (SandboxUtilsLedgerHeader *) base;
+  SandboxUtilsLedgerSlot   *slots   = _sandboxutils_ledger_get_slots (base);
+  SandboxUtilsLedgerRecord *records = _sandboxutils_ledger_get_records (base);
+  guint64                   key, found;
+  guint32                   mask    = header->n_slots - 1;
+  guint32                   i, probes, record;
+
+  key = path ? _sandboxutils_ledger_key_for_path (pid, start_time, path)
+             : _sandboxutils_ledger_key_for_inode (pid, start_time, dev, ino);
+
+  for (i = key & mask, probes = 0; probes < header->n_slots; i = (i + 1) & mask, probes++)
+  {
+    if ((found = __atomic_load_n (&slots[i].key, __ATOMIC_ACQUIRE)) == 0)
+      return NULL;
+
+    if (found != key)
+      continue;
+
+    // Records are committed before being indexed, so this one must be
+    record = __atomic_load_n (&slots[i].record, __ATOMIC_ACQUIRE);
+    if (record == 0 || record > MIN (__atomic_load_n (&header->n_records, __ATOMIC_ACQUIRE), header->capacity))
+      continue;
+
+    if (_sandboxutils_ledger_record_matches (&records[record - 1], pid, start_time, dev, ino, path))
+      return &records[record - 1];
+  }
+
+  return NULL;
+}
+
+static gboolean
+_sandboxutils_ledger_map (SandboxUtilsLedger  *ledger,
+                          GError             **error)
+{
+  struct stat  st;
+  gchar       *filename = _sandboxutils_ledger_get_filename ();
+  gint         fd;
+  int          saved;
+
+  if ((fd = open (filename, O_RDONLY | O_CLOEXEC)) == -1 || fstat (fd, &st) == -1)
+  {
+    saved = errno;
+    g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved),
+                 "SandboxUtilsLedger.Open: could not open '%s' (%s).\n", filename, g_strerror (saved));
+    if (fd != -1)
+      close (fd);
+    g_free (filename);
+    return FALSE;
+  }
+
+  ledger->size = st.st_size;
+  ledger->base = ledger->size ? mmap (NULL, ledger->size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+  close (fd);
+
+  if (ledger->base == MAP_FAILED || !_sandboxutils_ledger_check_header (ledger->base, ledger->size))
+  {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                 "SandboxUtilsLedger.Open: '%s' is not a grant ledger.\n", filename);
+    if (ledger->base != MAP_FAILED)
+      munmap (ledger->base, ledger->size);
+    ledger->base = NULL;
+    g_free (filename);
+    return FALSE;
+  }
+
+  g_free (filename);
+
+  return TRUE;
+}
+
+/* Maps the new ledger if the server replaced the one we have */
+static gboolean
+_sandboxutils_ledger_refresh (SandboxUtilsLedger *ledger)
+{
+  SandboxUtilsLedger fresh;
+
+  if (!__atomic_load_n (&((SandboxUtilsLedgerHeader *) ledger->base)->retired, __ATOMIC_ACQUIRE))
+    return TRUE;
+
+  if (!_sandboxutils_ledger_map (&fresh, NULL))
+    return FALSE;
+
+  munmap (ledger->base, ledger->size);
+  *ledger = fresh;
+
+  return TRUE;
+}
+
+/**
+ * sandboxutils_ledger_open:
+ * @error: a placeholder for a #GError
+ *
+ * Maps the ledger of grants read-only. The Sandbox Utils server records in
+ * it, for every process, the files the user chose in that process' dialogs.
+ * File mediation layers and policy daemons running outside sandboxes can
+ * then tell whether a process may access a file without asking the server,
+ * since lookups are done in memory shared with it.
+ *
+ * Return value: (transfer full): the ledger, to close with
+ *   sandboxutils_ledger_close(), or %NULL if the server has not written one
+ *
+ * Since: 0.7
+ **/
+SandboxUtilsLedger *
+sandboxutils_ledger_open (GError **error)
+{
+  SandboxUtilsLedger *ledger = g_malloc0 (sizeof (SandboxUtilsLedger));
+
+  if (!_sandboxutils_ledger_map (ledger, error))
+  {
+    g_free (ledger);
+    return NULL;
+  }
+
+  return ledger;
+}
+
+/**
+ * sandboxutils_ledger_get_process_start:
+ * @pid: the id of a process
+ *
+ * Gets when a process started, which tells it apart from processes that had
+ * the same pid before it. Grants are recorded for a pid and start time, and
+ * callers of sandboxutils_ledger_check() should keep the start time of the
+ * processes they watch rather than read it for every check.
+ *
+ * Return value: the start time of @pid, in clock ticks since boot, or 0 if
+ * the process does not exist
+ *
+ * Since: 0.7
+ **/
+guint64
+sandboxutils_ledger_get_process_start (guint32 pid)
+{
+  gchar    path[32];
+  gchar    buffer[1024];
+  gchar   *field;
+  gssize   n;
+  gint     fd, i;
+
+  g_snprintf (path, sizeof (path), "/proc/%u/stat", pid);
+  if ((fd = open (path, O_RDONLY | O_CLOEXEC)) == -1)
+    return 0;
+
+  n = read (fd, buffer, sizeof (buffer) - 1);
+  close (fd);
+  if (n <= 0)
+    return 0;
+  buffer[n] = '\0';
+
+  // The name of the process, in the second field, may hold spaces and parentheses
+  if ((field = strrchr (buffer, ')')) == NULL)
+    return 0;
+
+  // Skip to the space before the 22nd field, the start time
+  for (i = 2; i < 22 && field; i++)
+    field = strchr (field + 1, ' ');
+
+  return field ? g_ascii_strtoull (field + 1, NULL, 10) : 0;
+}
+
+static gboolean
+_sandboxutils_ledger_report (const SandboxUtilsLedgerRecord *record,
+                             SandboxUtilsLedgerMode         *mode,
+                             gint64                         *timestamp)
+{
+  if (!record)
+    return FALSE;
+
+  if (mode)
+    *mode = record->mode;
+  if (timestamp)
+    *timestamp = record->timestamp;
+
+  return TRUE;
+}
+
+/**
+ * sandboxutils_ledger_check:
+ * @ledger: a #SandboxUtilsLedger
+ * @pid: the id of a process
+ * @start_time: the start time of @pid, see sandboxutils_ledger_get_process_start()
+ * @dev: the device of a file
+ * @ino: the inode of that file
+ * @mode: (out) (allow-none): where to store how the file was granted
+ * @timestamp: (out) (allow-none): where to store when the file was last
+ *  granted, in microseconds since the Epoch
+ *
+ * Tells whether the user chose a file in one of the dialogs of a process.
+ * This only reads memory, and does not make any system call unless the
+ * server started a new ledger.
+ *
+ * Return value: %TRUE if the file was granted to the process
+ *
+ * Since: 0.7
+ **/
+gboolean
+sandboxutils_ledger_check (SandboxUtilsLedger      *ledger,
+                           guint32                  pid,
+                           guint64                  start_time,
+                           guint64                  dev,
+                           guint64                  ino,
+                           SandboxUtilsLedgerMode  *mode,
+                           gint64                  *timestamp)
+{
+  g_return_val_if_fail (ledger != NULL, FALSE);
+
+  if (!_sandboxutils_ledger_refresh (ledger))
+    return FALSE;
+
+  return _sandboxutils_ledger_report (_sandboxutils_ledger_find (ledger->base, pid, start_time, dev, ino, NULL),
+                                      mode, timestamp);
+}
+
+/**
+ * sandboxutils_ledger_check_path:
+ * @ledger: a #SandboxUtilsLedger
+ * @pid: the id of a process
+ * @start_time: the start time of @pid, see sandboxutils_ledger_get_process_start()
+ * @path: the absolute path of a file, as chosen in the dialog
+ * @mode: (out) (allow-none): where to store how the file was granted
+ * @timestamp: (out) (allow-none): where to store when the file was last
+ *  granted, in microseconds since the Epoch
+ *
+ * Tells whether the user chose a file in one of the dialogs of a process,
+ * by path. Prefer sandboxutils_ledger_check() for files that exist, since
+ * paths can be renamed under the user's feet; this is meant for files the
+ * user chose to save to, which did not exist when they were granted.
+ *
+ * Return value: %TRUE if the file was granted to the process
+ *
+ * Since: 0.7
+ **/
+gboolean
+sandboxutils_ledger_check_path (SandboxUtilsLedger      *ledger,
+                                guint32                  pid,
+                                guint64                  start_time,
+                                const gchar             *path,
+                                SandboxUtilsLedgerMode  *mode,
+                                gint64                  *timestamp)
+{
+  g_return_val_if_fail (ledger != NULL, FALSE);
+  g_return_val_if_fail (path != NULL, FALSE);
+
+  if (!_sandboxutils_ledger_refresh (ledger))
+    return FALSE;
+
+  return _sandboxutils_ledger_report (_sandboxutils_ledger_find (ledger->base, pid, start_time, 0, 0, path),
+                                      mode, timestamp);
+}
+
+/**
+ * sandboxutils_ledger_close:
+ * @ledger: a #SandboxUtilsLedger
+ *
+ * Unmaps and frees @ledger.
+ *
+ * Since: 0.7
+ **/
+void
+sandboxutils_ledger_close (SandboxUtilsLedger *ledger)
+{
+  g_return_if_fail (ledger != NULL);
+
+  munmap (ledger->base, ledger->size);
+  g_free (ledger);
+}
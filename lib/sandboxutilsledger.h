@@ -0,0 +1,78 @@
+/*
+ * sandboxutilsledger.h: checking which files the user granted to which process
+ *
+ * Copyright (C) 2014 Steve Dodier-Lazaro <sidnioulz@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Steve Dodier-Lazaro <sidnioulz@gmail.com>
+ */
+
+#ifndef __SANDBOX_UTILS_LEDGER_H__
+#define __SANDBOX_UTILS_LEDGER_H__
+
+#include <glib.h>
+
+/**
+ * SandboxUtilsLedgerMode:
+ * @SANDBOXUTILS_LEDGER_READ: the file was chosen in an open dialog
+ * @SANDBOXUTILS_LEDGER_WRITE: the file was chosen in a save dialog
+ *
+ * How a process was granted a file.
+ *
+ * Since: 0.7
+ */
+typedef enum {
+  SANDBOXUTILS_LEDGER_READ  = 1 << 0,
+  SANDBOXUTILS_LEDGER_WRITE = 1 << 1,
+} SandboxUtilsLedgerMode;
+
+/**
+ * SandboxUtilsLedger:
+ *
+ * A read-only mapping of the ledger in which the server records every file
+ * a user chose in a dialog, and for which process. Opened with
+ * sandboxutils_ledger_open(), and closed with sandboxutils_ledger_close().
+ *
+ * Since: 0.7
+ */
+typedef struct _SandboxUtilsLedger SandboxUtilsLedger;
+
+SandboxUtilsLedger *
+sandboxutils_ledger_open              (GError                 **error);
+
+guint64
+sandboxutils_ledger_get_process_start (guint32                  pid);
+
+gboolean
+sandboxutils_ledger_check             (SandboxUtilsLedger      *ledger,
+                                       guint32                  pid,
+                                       guint64                  start_time,
+                                       guint64                  dev,
+                                       guint64                  ino,
+                                       SandboxUtilsLedgerMode  *mode,
+                                       gint64                  *timestamp);
+
+gboolean
+sandboxutils_ledger_check_path        (SandboxUtilsLedger      *ledger,
+                                       guint32                  pid,
+                                       guint64                  start_time,
+                                       const gchar             *path,
+                                       SandboxUtilsLedgerMode  *mode,
+                                       gint64                  *timestamp);
+
+void
+sandboxutils_ledger_close             (SandboxUtilsLedger      *ledger);
+
+#endif /* __SANDBOX_UTILS_LEDGER_H__ */
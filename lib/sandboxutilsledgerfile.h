@@ -0,0 +1,143 @@
+/*
+ * sandboxutilsledgerfile.h: layout of the grant ledger
+ *
+ * Copyright (C) 2014 Steve Dodier-Lazaro <sidnioulz@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Steve Dodier-Lazaro <sidnioulz@gmail.com>
+ */
+
+/*
+ * Private header, not installed. The grant ledger is a file in the user's
+ * runtime directory, written by the server alone and mapped read-only by
+ * anyone who wants to know what was granted. It holds a header, an index
+ * and an append-only log of fixed-size records:
+ *
+ *   header | slots[n_slots] | records[capacity]
+ *
+ * A record is written and checksummed before n_records is raised past it,
+ * and only then indexed, so that readers never see half a record. The index
+ * is open-addressed and can be rebuilt from the records, which the server
+ * does when it starts so that a crash cannot leave it stale. Each record is
+ * indexed by its process and inode, and by its process and path for files
+ * that did not exist yet when they were chosen to be saved to. Processes are told apart by their pid and start
+ * time, so that a recycled pid does not inherit grants.
+ *
+ * When the log is full, the server starts a new ledger and marks the old one
+ * as retired, which tells readers to map the new one.
+ */
+
+#ifndef __SANDBOX_UTILS_LEDGER_FILE_H__
+#define __SANDBOX_UTILS_LEDGER_FILE_H__
+
+#include <glib.h>
+
+#define SANDBOXUTILS_LEDGER_MAGIC     "SULEDGR1"
+#define SANDBOXUTILS_LEDGER_VERSION   1
+#define SANDBOXUTILS_LEDGER_FILENAME  "grants.ledger"
+
+/* Room for paths in records, longer ones are truncated and only indexed by inode */
+#define SANDBOXUTILS_LEDGER_PATH_MAX  456
+
+typedef struct {
+  gchar                  magic[8];
+  guint32                version;
+  guint32                n_slots;       /* a power of two */
+  guint32                capacity;      /* records */
+  guint32                retired;       /* a newer ledger replaced this one */
+  guint64                n_records;     /* committed records */
+  guint8                 padding[32];
+} SandboxUtilsLedgerHeader;
+
+typedef struct {
+  guint64                key;           /* 0 for an empty slot */
+  guint32                record;        /* index of the record, plus one */
+  guint32                padding;
+} SandboxUtilsLedgerSlot;
+
+typedef struct {
+  guint64                checksum;      /* of everything below */
+  guint64                dev;
+  guint64                ino;           /* 0 if the file did not exist yet */
+  guint64                start_time;
+  gint64                 timestamp;     /* real time, in microseconds */
+  guint32                pid;
+  guint32                uid;
+  guint32                mode;          /* SandboxUtilsLedgerMode */
+  guint32                path_length;   /* before truncation */
+  gchar                  path[SANDBOXUTILS_LEDGER_PATH_MAX];
+} SandboxUtilsLedgerRecord;
+
+G_STATIC_ASSERT (sizeof (SandboxUtilsLedgerHeader) == 64);
+G_STATIC_ASSERT (sizeof (SandboxUtilsLedgerSlot) == 16);
+G_STATIC_ASSERT (sizeof (SandboxUtilsLedgerRecord) == 512);
+
+static inline SandboxUtilsLedgerSlot *
+_sandboxutils_ledger_get_slots (guint8 *base)
+{
+  return (SandboxUtilsLedgerSlot *) (base + sizeof (SandboxUtilsLedgerHeader));
+}
+
+static inline SandboxUtilsLedgerRecord *
+_sandboxutils_ledger_get_records (guint8 *base)
+{
+  SandboxUtilsLedgerHeader *header = (SandboxUtilsLedgerHeader *) base;
+
+  return (SandboxUtilsLedgerRecord *) (base + sizeof (SandboxUtilsLedgerHeader) +
+                                       (gsize) header->n_slots * sizeof (SandboxUtilsLedgerSlot));
+}
+
+gchar *
+_sandboxutils_ledger_get_filename (void);
+
+gsize
+_sandboxutils_ledger_get_size (guint32 n_slots,
+                               guint32 capacity);
+
+gboolean
+_sandboxutils_ledger_check_header (guint8 *base,
+                                   gsize   size);
+
+guint64
+_sandboxutils_ledger_key_for_inode (guint32 pid,
+                                    guint64 start_time,
+                                    guint64 dev,
+                                    guint64 ino);
+
+guint64
+_sandboxutils_ledger_key_for_path (guint32      pid,
+                                   guint64      start_time,
+                                   const gchar *path);
+
+guint64
+_sandboxutils_ledger_checksum (const SandboxUtilsLedgerRecord *record);
+
+gboolean
+_sandboxutils_ledger_record_matches (const SandboxUtilsLedgerRecord *record,
+                                     guint32                         pid,
+                                     guint64                         start_time,
+                                     guint64                         dev,
+                                     guint64                         ino,
+                                     const gchar                    *path);
+
+const SandboxUtilsLedgerRecord *
+_sandboxutils_ledger_find (guint8      *base,
+                           guint32      pid,
+                           guint64      start_time,
+                           guint64      dev,
+                           guint64      ino,
+                           const gchar *path);
+
+#endif /* __SANDBOX_UTILS_LEDGER_FILE_H__ */
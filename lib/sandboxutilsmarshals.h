@@ -36,6 +36,9 @@ extern void sandboxutils_marshal_VOID__STRING_INT_INT_BOOLEAN (GClosure     *clo
                                                                gpointer      invocation_hint,
                                                                gpointer      marshal_data);
 
+/* VOID:VARIANT (sandboxutilsmarshals.list:6) */
+#define sandboxutils_marshal_VOID__VARIANT	g_cclosure_marshal_VOID__VARIANT
+
 G_END_DECLS
 
 #endif /* __sandboxutils_marshal_MARSHAL_H__ */
@@ -0,0 +1,180 @@
+/*
+ * sandboxutilsshm.c: sealed shared memory between clients and the server
+ *
+ * Copyright (C) 2014 Steve Dodier-Lazaro <sidnioulz@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Steve Dodier-Lazaro <sidnioulz@gmail.com>
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <gio/gio.h>
+#include <cairo.h>
+
+#include "sandboxutilsshm.h"
+
+// Older C libraries know neither memfds nor seals, the kernel is what matters
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC       0x0001U
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS       (1024 + 9)
+#define F_GET_SEALS       (1024 + 10)
+#define F_SEAL_SEAL       0x0001
+#define F_SEAL_SHRINK     0x0002
+#define F_SEAL_GROW       0x0004
+#define F_SEAL_WRITE      0x0008
+#endif
+
+static gboolean
+_sandboxutils_shm_fail (GError      **error,
+                        const gchar  *what)
+{
+  int saved = errno;
+
+  g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved),
+               "SandboxUtilsShm: could not %s (%s).\n", what, g_strerror (saved));
+
+  return FALSE;
+}
+
+/*
+ * Creates a memfd of @size bytes and seals its size. Returns the file
+ * descriptor, closed on exec, or -1 on error. The memfd must then be sealed
+ * for good with _sandboxutils_shm_seal() before being sent.
+ */
+gint
+_sandboxutils_shm_new (const gchar  *name,
+                       gsize         size,
+                       GError      **error)
+{
+  gint fd;
+
+  g_return_val_if_fail (name != NULL, -1);
+  g_return_val_if_fail (size > 0, -1);
+
+  fd = syscall (SYS_memfd_create, name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd == -1)
+  {
+    _sandboxutils_shm_fail (error, "create a memfd");
+    return -1;
+  }
+
+  if (ftruncate (fd, size) == -1)
+  {
+    _sandboxutils_shm_fail (error, "size the memfd");
+    close (fd);
+    return -1;
+  }
+
+  if (fcntl (fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) == -1)
+  {
+    _sandboxutils_shm_fail (error, "seal the memfd");
+    close (fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+/*
+ * Forbids adding or removing seals on @fd. If @read_only, its contents are
+ * sealed too, which requires all writable mappings of it to be gone.
+ */
+gboolean
+_sandboxutils_shm_seal (gint      fd,
+                        gboolean  read_only,
+                        GError  **error)
+{
+  if (fcntl (fd, F_ADD_SEALS, F_SEAL_SEAL | (read_only ? F_SEAL_WRITE : 0)) == -1)
+    return _sandboxutils_shm_fail (error, "seal the memfd");
+
+  return TRUE;
+}
+
+/*
+ * Checks that @fd, received from another process, is a memfd of at least
+ * @size bytes that can no longer shrink. Anything else could be truncated
+ * while mapped, which would crash the process reading it.
+ */
+gboolean
+_sandboxutils_shm_check (gint     fd,
+                         gsize    size,
+                         GError **error)
+{
+  struct stat st;
+  gint        seals;
+
+  if ((seals = fcntl (fd, F_GET_SEALS)) == -1)
+    return _sandboxutils_shm_fail (error, "read the seals of the memfd");
+
+  if (!(seals & F_SEAL_SHRINK))
+  {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_PERMISSION_DENIED,
+                 "SandboxUtilsShm: the memfd can still shrink, refusing to map it.\n");
+    return FALSE;
+  }
+
+  if (fstat (fd, &st) == -1)
+    return _sandboxutils_shm_fail (error, "stat the memfd");
+
+  if (st.st_size < 0 || (gsize) st.st_size < size)
+  {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                 "SandboxUtilsShm: the memfd holds %" G_GINT64_FORMAT " bytes, %" G_GSIZE_FORMAT " expected.\n",
+                 (gint64) st.st_size, size);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/*
+ * Checks the size of an ARGB32 image shared between processes. @stride is
+ * the number of bytes from one row to the next, as cairo wants it.
+ */
+gboolean
+_sandboxutils_shm_check_image (gint     width,
+                               gint     height,
+                               gint     stride,
+                               GError **error)
+{
+  if (width <= 0 || height <= 0 ||
+      width > SANDBOXUTILS_SHM_MAX_IMAGE_SIZE || height > SANDBOXUTILS_SHM_MAX_IMAGE_SIZE)
+  {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                 "SandboxUtilsShm: images must be 1 to %d pixels wide and high, not %dx%d.\n",
+                 SANDBOXUTILS_SHM_MAX_IMAGE_SIZE, width, height);
+    return FALSE;
+  }
+
+  if (stride < cairo_format_stride_for_width (CAIRO_FORMAT_ARGB32, width) || stride % 4 != 0)
+  {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                 "SandboxUtilsShm: a stride of %d bytes does not fit rows of %d pixels.\n",
+                 stride, width);
+    return FALSE;
+  }
+
+  return TRUE;
+}
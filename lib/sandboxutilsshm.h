@@ -0,0 +1,58 @@
+/*
+ * sandboxutilsshm.h: sealed shared memory between clients and the server
+ *
+ * Copyright (C) 2014 Steve Dodier-Lazaro <sidnioulz@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Steve Dodier-Lazaro <sidnioulz@gmail.com>
+ */
+
+/*
+ * Private header, not installed. Large data goes between processes through
+ * memfds passed over D-Bus rather than in messages. The process that creates
+ * a memfd seals its size, so that the other side can map it without fearing
+ * a SIGBUS if the memfd is truncated under its feet.
+ */
+
+#ifndef __SANDBOX_UTILS_SHM_H__
+#define __SANDBOX_UTILS_SHM_H__
+
+#include <glib.h>
+
+/* Largest side of a shared image, so that clients cannot make us map GBs */
+#define SANDBOXUTILS_SHM_MAX_IMAGE_SIZE 1024
+
+gint
+_sandboxutils_shm_new (const gchar  *name,
+                       gsize         size,
+                       GError      **error);
+
+gboolean
+_sandboxutils_shm_seal (gint      fd,
+                        gboolean  read_only,
+                        GError  **error);
+
+gboolean
+_sandboxutils_shm_check (gint     fd,
+                         gsize    size,
+                         GError **error);
+
+gboolean
+_sandboxutils_shm_check_image (gint     width,
+                               gint     height,
+                               gint     stride,
+                               GError **error);
+
+#endif /* __SANDBOX_UTILS_SHM_H__ */
@@ -0,0 +1,227 @@
+/*
+ * sandboxutilsthumbnails.c: thumbnails of the files chosen in dialogs
+ *
+ * Copyright (C) 2014 Steve Dodier-Lazaro <sidnioulz@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Steve Dodier-Lazaro <sidnioulz@gmail.com>
+ */
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <gio/gio.h>
+
+#include "sandboxutilsthumbnails.h"
+#include "sandboxutilsshm.h"
+
+struct _SfcdThumbnails {
+  GPtrArray *uris;
+  GPtrArray *surfaces;  /* NULL for files without a thumbnail */
+  guchar    *data;      /* read-only mapping the surfaces point into, or NULL */
+  gsize      size;
+};
+
+static void
+_sandboxutils_thumbnails_surface_destroy (gpointer data)
+{
+  if (data)
+    cairo_surface_destroy (data);
+}
+
+SfcdThumbnails *
+_sandboxutils_thumbnails_new (void)
+{
+  SfcdThumbnails *thumbnails = g_malloc0 (sizeof (SfcdThumbnails));
+
+  thumbnails->uris     = g_ptr_array_new_with_free_func (g_free);
+  thumbnails->surfaces = g_ptr_array_new_with_free_func (_sandboxutils_thumbnails_surface_destroy);
+
+  return thumbnails;
+}
+
+/* Adds the thumbnail of @uri, taking over @surface, which may be NULL */
+void
+_sandboxutils_thumbnails_add (SfcdThumbnails  *thumbnails,
+                              const gchar     *uri,
+                              cairo_surface_t *surface)
+{
+  g_ptr_array_add (thumbnails->uris, g_strdup (uri));
+  g_ptr_array_add (thumbnails->surfaces, surface);
+}
+
+/*
+ * Maps the memfd @fd read-only and makes a surface for each thumbnail that
+ * @metadata describes. @fd is not kept, the caller still has to close it.
+ */
+SfcdThumbnails *
+_sandboxutils_thumbnails_new_from_fd (GVariant  *metadata,
+                                      gint       fd,
+                                      GError   **error)
+{
+  SfcdThumbnails *thumbnails;
+  GVariantIter    iter;
+  const gchar    *uri;
+  guint64         offset;
+  gint            width, height, stride;
+  gsize           size = 0;
+
+  g_return_val_if_fail (g_variant_is_of_type (metadata, G_VARIANT_TYPE ("a(stiii)")), NULL);
+
+  // Find out how much must be mapped, and check everything fits in it
+  g_variant_iter_init (&iter, metadata);
+  while (g_variant_iter_next (&iter, "(&stiii)", &uri, &offset, &width, &height, &stride))
+  {
+    if (width == 0)
+      continue;
+
+    if (!_sandboxutils_shm_check_image (width, height, stride, error) || offset % 4 != 0 ||
+        offset > G_MAXSIZE - (gsize) stride * height)
+    {
+      g_prefix_error (error, "SandboxUtilsThumbnails: thumbnail of '%s' is malformed -- ", uri);
+      return NULL;
+    }
+
+    size = MAX (size, offset + (gsize) stride * height);
+  }
+
+  if (size && !_sandboxutils_shm_check (fd, size, error))
+    return NULL;
+
+  thumbnails = _sandboxutils_thumbnails_new ();
+
+  if (size)
+  {
+    thumbnails->data = mmap (NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (thumbnails->data == MAP_FAILED)
+    {
+      int saved = errno;
+
+      thumbnails->data = NULL;
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved),
+                   "SandboxUtilsThumbnails: could not map the thumbnails (%s).\n",
+                   g_strerror (saved));
+      sfcd_thumbnails_free (thumbnails);
+      return NULL;
+    }
+    thumbnails->size = size;
+  }
+
+  // Cairo never writes to surfaces used as a source, the mapping can be read-only
+  g_variant_iter_init (&iter, metadata);
+  while (g_variant_iter_next (&iter, "(&stiii)", &uri, &offset, &width, &height, &stride))
+    _sandboxutils_thumbnails_add (thumbnails, uri,
+                                  width == 0 ? NULL :
+                                  cairo_image_surface_create_for_data (thumbnails->data + offset,
+                                                                       CAIRO_FORMAT_ARGB32,
+                                                                       width, height, stride));
+
+  return thumbnails;
+}
+
+/**
+ * sfcd_thumbnails_get_n_items:
+ * @thumbnails: a #SfcdThumbnails
+ *
+ * Gets the number of files in @thumbnails, including those without a
+ * thumbnail.
+ *
+ * Return value: the number of files
+ *
+ * Since: 0.7
+ **/
+guint
+sfcd_thumbnails_get_n_items (SfcdThumbnails *thumbnails)
+{
+  g_return_val_if_fail (thumbnails != NULL, 0);
+
+  return thumbnails->uris->len;
+}
+
+/**
+ * sfcd_thumbnails_get_uri:
+ * @thumbnails: a #SfcdThumbnails
+ * @index_: the index of a file, lower than sfcd_thumbnails_get_n_items()
+ *
+ * Gets the URI of the file at @index_ in @thumbnails.
+ *
+ * Return value: (transfer none): the URI of the file, owned by @thumbnails
+ *
+ * Since: 0.7
+ **/
+const gchar *
+sfcd_thumbnails_get_uri (SfcdThumbnails *thumbnails,
+                         guint           index_)
+{
+  g_return_val_if_fail (thumbnails != NULL, NULL);
+  g_return_val_if_fail (index_ < thumbnails->uris->len, NULL);
+
+  return g_ptr_array_index (thumbnails->uris, index_);
+}
+
+/**
+ * sfcd_thumbnails_get_surface:
+ * @thumbnails: a #SfcdThumbnails
+ * @index_: the index of a file, lower than sfcd_thumbnails_get_n_items()
+ *
+ * Gets the thumbnail of the file at @index_ in @thumbnails, as an ARGB32
+ * image surface to paint from. The surface points into memory shared with
+ * the server, which is read-only: do not draw on it, and copy it if you
+ * need it after freeing @thumbnails.
+ *
+ * Return value: (transfer none) (allow-none): the thumbnail, owned by
+ * @thumbnails, or %NULL if the file has none
+ *
+ * Since: 0.7
+ **/
+cairo_surface_t *
+sfcd_thumbnails_get_surface (SfcdThumbnails *thumbnails,
+                             guint           index_)
+{
+  g_return_val_if_fail (thumbnails != NULL, NULL);
+  g_return_val_if_fail (index_ < thumbnails->surfaces->len, NULL);
+
+  return g_ptr_array_index (thumbnails->surfaces, index_);
+}
+
+/**
+ * sfcd_thumbnails_free:
+ * @thumbnails: a #SfcdThumbnails
+ *
+ * Frees @thumbnails, and unmaps the memory its surfaces point into.
+ *
+ * Since: 0.7
+ **/
+void
+sfcd_thumbnails_free (SfcdThumbnails *thumbnails)
+{
+  guint i;
+
+  if (!thumbnails)
+    return;
+
+  // Surfaces referenced elsewhere must not read unmapped memory
+  for (i = 0; thumbnails->data && i < thumbnails->surfaces->len; i++)
+    if (g_ptr_array_index (thumbnails->surfaces, i))
+      cairo_surface_finish (g_ptr_array_index (thumbnails->surfaces, i));
+
+  g_ptr_array_unref (thumbnails->surfaces);
+  g_ptr_array_unref (thumbnails->uris);
+
+  if (thumbnails->data)
+    munmap (thumbnails->data, thumbnails->size);
+
+  g_free (thumbnails);
+}
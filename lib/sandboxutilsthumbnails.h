@@ -0,0 +1,55 @@
+/*
+ * sandboxutilsthumbnails.h: thumbnails of the files chosen in dialogs
+ *
+ * Copyright (C) 2014 Steve Dodier-Lazaro <sidnioulz@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Steve Dodier-Lazaro <sidnioulz@gmail.com>
+ */
+
+/*
+ * Private header, not installed. Thumbnails made by the server are packed
+ * into a single memfd, one ARGB32 image after the other, and described by
+ * an a(stiii) of URIs, offsets, widths, heights and strides. Clients map the
+ * memfd read-only and make cairo surfaces that point straight into it, so
+ * that thumbnails are never copied. Files without a thumbnail have a width
+ * of 0.
+ */
+
+#ifndef __SANDBOX_UTILS_THUMBNAILS_H__
+#define __SANDBOX_UTILS_THUMBNAILS_H__
+
+#include <glib.h>
+#include <cairo.h>
+
+#include "sandboxfilechooserdialog.h"
+
+/* Most files whose thumbnails can be asked for at once */
+#define SANDBOXUTILS_THUMBNAILS_MAX_FILES 64
+
+SfcdThumbnails *
+_sandboxutils_thumbnails_new (void);
+
+void
+_sandboxutils_thumbnails_add (SfcdThumbnails  *thumbnails,
+                              const gchar     *uri,
+                              cairo_surface_t *surface);
+
+SfcdThumbnails *
+_sandboxutils_thumbnails_new_from_fd (GVariant  *metadata,
+                                      gint       fd,
+                                      GError   **error);
+
+#endif /* __SANDBOX_UTILS_THUMBNAILS_H__ */
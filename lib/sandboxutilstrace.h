@@ -0,0 +1,79 @@
+/*
+ * sandboxutilstrace.h: static tracepoints for SandboxUtils
+ *
+ * Copyright (C) 2014 Steve Dodier-Lazaro <sidnioulz@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Steve Dodier-Lazaro <sidnioulz@gmail.com>
+ */
+
+/*
+ * Private header, not installed. When configured with --enable-usdt, the
+ * SU_TRACE* macros expand to USDT probes of the "sandboxutils" provider, which
+ * compile to a single nop until perf, bpftrace or SystemTap attach to them.
+ * Otherwise they expand to nothing, and their arguments are not evaluated.
+ *
+ * List the probes of a build with:
+ *   readelf -n .libs/libsandboxutils.so | grep -A2 stapsdt
+ * See the scripts in tracing/ for examples.
+ */
+
+#ifndef __SANDBOX_UTILS_TRACE_H__
+#define __SANDBOX_UTILS_TRACE_H__
+
+#include <glib.h>
+
+#ifdef SU_ENABLE_USDT
+
+#include <sys/sdt.h>
+
+#define SU_TRACE_ENABLED 1
+
+/* Timestamps only taken to be passed to probes */
+#define SU_TRACE_NOW() g_get_monotonic_time ()
+
+#define SU_TRACE0(name) \
+  DTRACE_PROBE (sandboxutils, name)
+#define SU_TRACE1(name, a) \
+  DTRACE_PROBE1 (sandboxutils, name, a)
+#define SU_TRACE2(name, a, b) \
+  DTRACE_PROBE2 (sandboxutils, name, a, b)
+#define SU_TRACE3(name, a, b, c) \
+  DTRACE_PROBE3 (sandboxutils, name, a, b, c)
+#define SU_TRACE4(name, a, b, c, d) \
+  DTRACE_PROBE4 (sandboxutils, name, a, b, c, d)
+
+#else /* SU_ENABLE_USDT */
+
+#define SU_TRACE_ENABLED 0
+
+#define SU_TRACE_NOW() ((gint64) 0)
+
+/* sizeof () keeps the arguments "used" without ever evaluating them */
+#define SU_TRACE0(name) \
+  do { } while (0)
+#define SU_TRACE1(name, a) \
+  do { (void) sizeof (a); } while (0)
+#define SU_TRACE2(name, a, b) \
+  do { (void) sizeof (a); (void) sizeof (b); } while (0)
+#define SU_TRACE3(name, a, b, c) \
+  do { (void) sizeof (a); (void) sizeof (b); (void) sizeof (c); } while (0)
+#define SU_TRACE4(name, a, b, c, d) \
+  do { (void) sizeof (a); (void) sizeof (b); (void) sizeof (c); \
+       (void) sizeof (d); } while (0)
+
+#endif /* SU_ENABLE_USDT */
+
+#endif /* __SANDBOX_UTILS_TRACE_H__ */
@@ -11,14 +11,86 @@
  */
 
 #include <gtk/gtkx.h>
+#include <gio/gunixfdlist.h>
 #include <syslog.h>
+#include <unistd.h>
 #include <sandboxutils.h>
 
 #include "sandboxfilechooserdialogdbuswrapper.h"
+#include "sandboxutilsscheduler.h"
+#include "sandboxutilsrecorder.h"
+#include "sandboxutilsspeculation.h"
+#include "sandboxutilsdircache.h"
+#include "sandboxutilsgrants.h"
+#include "sandboxutilspolicy.h"
+#include "sandboxutilspreview.h"
+#include "sandboxutilsselection.h"
+#include "sandboxutilsthumbnail.h"
+#include "sandboxutilsthumbnails.h"
+#include "sandboxutilsfileinfo.h"
+#include "sandboxutilstrace.h"
 
 static void on_handle_response_signal (SandboxFileChooserDialog *, gint, gint, gpointer);
 static void on_handle_destroy_signal (SandboxFileChooserDialog *, gpointer);
+static void on_handle_choices_changed_signal (SandboxFileChooserDialog *, GVariant *, gpointer);
+static guint _sfcd_dbus_wrapper_destroy_dialogs (SandboxUtilsClient *, GList *);
+
+static gboolean  _option_scripted            = FALSE;
+static gint      _option_scripted_response   = GTK_RESPONSE_ACCEPT;
+static gint      _option_scripted_think_time = 0;
+
+static GOptionEntry entries[] =
+{
+  {
+    "scripted", 0, 0, G_OPTION_ARG_NONE, &_option_scripted,
+    "Answer dialogs automatically instead of waiting for the user (for benchmarks and tests)", NULL
+  },
+  {
+    "scripted-response", 0, 0, G_OPTION_ARG_INT, &_option_scripted_response,
+    "Response given to dialogs in scripted mode (default: GTK_RESPONSE_ACCEPT)", "ID"
+  },
+  {
+    "scripted-think-time", 0, 0, G_OPTION_ARG_INT, &_option_scripted_think_time,
+    "Milliseconds before dialogs are answered in scripted mode (default: 0)", "MS"
+  },
+  {
+    NULL, ' ', 0, 0, NULL,
+    NULL, NULL
+  }
+};
+
+GOptionGroup *
+sfcd_dbus_wrapper_get_option_group ()
+{
+  GOptionGroup *group;
+
+  group = g_option_group_new ("scripted", "Scripted Mode", "Show scripted mode options", NULL, NULL);
+
+  g_option_group_add_entries (group, entries);
+  g_option_group_set_translation_domain (group, NULL);
+
+  return group;
+}
        
+/*
+ * Gets the client that made @invocation, as found when the call was
+ * authorised. The invocation holds a reference to it.
+ */
+static SandboxUtilsClient *
+_sfcd_dbus_wrapper_get_client (GDBusMethodInvocation *invocation)
+{
+  return g_object_get_data (G_OBJECT (invocation), "sfcd-client");
+}
+
+/*
+ * Gets the client that owns @sfcd, for signal handlers.
+ */
+static SandboxUtilsClient *
+_sfcd_dbus_wrapper_get_owner (SandboxFileChooserDialog *sfcd)
+{
+  return g_object_get_data (G_OBJECT (sfcd), "sfcd-client");
+}
+
 /*
  * TODO doc
  */
@@ -27,11 +99,14 @@ _sfcd_dbus_wrapper_lookup (SandboxUtilsClient  *cli,
                            const gchar         *dialog_id)
 {
   SandboxFileChooserDialog *sfcd = NULL;
+  gint64                    asked;
 
   g_return_val_if_fail (cli != NULL, NULL);
   g_return_val_if_fail (dialog_id != NULL, NULL);
 
+  asked = SU_TRACE_NOW ();
   g_mutex_lock (&cli->dialogsMutex);
+  SU_TRACE3 (lookup, dialog_id, SU_TRACE_NOW () - asked, FALSE);
   sfcd = g_hash_table_lookup (cli->dialogs, dialog_id);
 
 	if (sfcd == NULL)
@@ -59,8 +134,11 @@ _sfcd_dbus_wrapper_lookup_and_remove (SandboxUtilsClient  *cli,
                                       const gchar         *dialog_id)
 {
   SandboxFileChooserDialog *sfcd = NULL;
+  gint64                    asked;
 
+  asked = SU_TRACE_NOW ();
   g_mutex_lock (&cli->dialogsMutex);
+  SU_TRACE3 (lookup, dialog_id, SU_TRACE_NOW () - asked, TRUE);
   sfcd = g_hash_table_lookup (cli->dialogs, dialog_id);
 
 	if (sfcd == NULL)
@@ -74,6 +152,10 @@ _sfcd_dbus_wrapper_lookup_and_remove (SandboxUtilsClient  *cli,
     // Prevents the object from being deleted by a concurrent thread while in use
     g_object_ref (sfcd);
 
+    g_hash_table_remove (cli->abandoned, dialog_id);
+    g_hash_table_remove (cli->unconfirmed, dialog_id);
+    sandbox_utils_speculation_forget (sfcd);
+
     if (!g_hash_table_remove (cli->dialogs, dialog_id))
     {
 	    syslog (LOG_CRIT,
@@ -85,6 +167,7 @@ _sfcd_dbus_wrapper_lookup_and_remove (SandboxUtilsClient  *cli,
 
   g_signal_handlers_disconnect_matched (sfcd, G_SIGNAL_MATCH_FUNC, 0, 0, NULL, on_handle_destroy_signal, NULL);
   g_signal_handlers_disconnect_matched (sfcd, G_SIGNAL_MATCH_FUNC, 0, 0, NULL, on_handle_response_signal, NULL);
+  g_signal_handlers_disconnect_matched (sfcd, G_SIGNAL_MATCH_FUNC, 0, 0, NULL, on_handle_choices_changed_signal, NULL);
 
   g_mutex_unlock (&cli->dialogsMutex);
 
@@ -134,192 +217,1127 @@ _sfcd_dbus_wrapper_return_error (GDBusMethodInvocation    *invocation,
   g_error_free (error);
 }
 
-//TODO listen to signals on sfcd's and then emit GDBus signals
+/*
+ * Rejects a call because the client hit one of its limits. The error uses the
+ * SFCD error domain so that clients can tell it apart and back off.
+ */
+static void
+_sfcd_dbus_wrapper_return_limit_error (GDBusMethodInvocation    *invocation,
+                                       SandboxUtilsLimit         limit)
+{
+  const gchar *method = g_dbus_method_invocation_get_method_name (invocation);
+
+  SU_TRACE3 (handle_rejected, method,
+             g_dbus_method_invocation_get_sender (invocation), limit);
+
+  syslog (LOG_NOTICE,
+          "SfcdDbusWrapper.%s: client exceeded its limit of %s, call rejected.\n",
+          method, SandboxUtilsLimitPrintable[limit]);
+
+  g_dbus_method_invocation_return_error (invocation,
+                                         g_quark_from_static_string (SFCD_ERROR_DOMAIN),
+                                         SFCD_ERROR_LIMIT_EXCEEDED,
+                                         "SfcdDbusWrapper.%s: client exceeded its limit of %s.\n",
+                                         method,
+                                         SandboxUtilsLimitPrintable[limit]);
+}
+
+/*
+ * Maps a D-Bus method name to the class of methods sharing its rate limit.
+ */
+static SandboxUtilsCallClass
+_sfcd_dbus_wrapper_get_call_class (const gchar *method)
+{
+  if (g_strcmp0 (method, "New") == 0 ||
+      g_strcmp0 (method, "NewFromTemplate") == 0 ||
+      g_strcmp0 (method, "RegisterTemplate") == 0 ||
+      g_strcmp0 (method, "UnregisterTemplate") == 0 ||
+      g_strcmp0 (method, "Destroy") == 0 ||
+      g_strcmp0 (method, "Reset") == 0)
+    return SANDBOX_UTILS_CALL_LIFECYCLE;
+
+  if (g_strcmp0 (method, "Run") == 0 ||
+      g_strcmp0 (method, "Present") == 0 ||
+      g_strcmp0 (method, "CancelRun") == 0)
+    return SANDBOX_UTILS_CALL_INTERACTIVE;
+
+  if (g_str_has_prefix (method, "Get") || g_str_has_prefix (method, "List") ||
+      g_strcmp0 (method, "OpenPreviewFile") == 0 ||
+      g_strcmp0 (method, "CheckGrant") == 0)
+    return SANDBOX_UTILS_CALL_RETRIEVAL;
+
+  return SANDBOX_UTILS_CALL_CONFIG;
+}
+
+/*
+ * Relative cost of processing a call, used to share the main loop fairly
+ * between clients. Creating a dialog builds a whole GtkFileChooserDialog.
+ */
+static guint
+_sfcd_dbus_wrapper_get_call_cost (const gchar *method)
+{
+  if (g_strcmp0 (method, "New") == 0 || g_strcmp0 (method, "NewFromTemplate") == 0)
+    return 4;
+
+  if (g_strcmp0 (method, "Run") == 0)
+    return 2;
+
+  return 1;
+}
+
+/*
+ * Gets the time at which a call reached the server, or the current time if
+ * it was not recorded.
+ */
+static gint64
+_sfcd_dbus_wrapper_get_received_time (GDBusMethodInvocation *invocation)
+{
+  gint64 *received = g_object_get_data (G_OBJECT (invocation), "sfcd-received-time");
+
+  return received ? *received : g_get_monotonic_time ();
+}
+
+/*
+ * Gets the serial of the message of a call. Serials grow with each message a
+ * connection sends, so unlike the time calls reach us, they tell which of two
+ * calls of a client was sent first.
+ */
+static guint32
+_sfcd_dbus_wrapper_get_serial (GDBusMethodInvocation *invocation)
+{
+  return g_dbus_message_get_serial (g_dbus_method_invocation_get_message (invocation));
+}
+
+/*
+ * Tells whether the first argument of a method is the id of a dialog, rather
+ * than that of a template or the arguments of a new dialog.
+ */
+static gboolean
+_sfcd_dbus_wrapper_takes_dialog_id (const gchar *method)
+{
+  return g_strcmp0 (method, "New") != 0 &&
+         g_strcmp0 (method, "NewFromTemplate") != 0 &&
+         g_strcmp0 (method, "RegisterTemplate") != 0 &&
+         g_strcmp0 (method, "UnregisterTemplate") != 0 &&
+         g_strcmp0 (method, "CheckGrant") != 0;
+}
+
+/* A method call waiting in the scheduler, with the arguments of its handler */
+typedef struct {
+  guint                  signal_id;
+  guint                  n_values;
+  GValue                *values;
+  gboolean               dispatched;
+} SfcdDbusWrapperCall;
 
+/*
+ * Gets the id of the dialog a waiting call is about, or %NULL. Handlers of
+ * methods that pass file descriptors get them before the actual arguments.
+ */
+static const gchar *
+_sfcd_dbus_wrapper_call_get_dialog_id (SfcdDbusWrapperCall *call,
+                                       const gchar         *method)
+{
+  guint i = 2;
+
+  if (!_sfcd_dbus_wrapper_takes_dialog_id (method))
+    return NULL;
+
+  if (i < call->n_values && G_VALUE_HOLDS (&call->values[i], G_TYPE_UNIX_FD_LIST))
+    i++;
+
+  if (i < call->n_values && G_VALUE_HOLDS_STRING (&call->values[i]))
+    return g_value_get_string (&call->values[i]);
+
+  return NULL;
+}
+
+// Invocation currently being passed on to its actual handler
+static GDBusMethodInvocation *_sfcd_dbus_wrapper_replayed = NULL;
+
+/*
+ * Tells whether the client gave up on a call while it waited in the scheduler,
+ * in which case it is not worth processing. Calls that release resources are
+ * always processed. All methods but New and the template ones take the id of
+ * a dialog as their first argument.
+ */
+static gboolean
+_sfcd_dbus_wrapper_call_abandoned (SfcdDbusWrapperCall   *call,
+                                   SandboxUtilsClient    *cli,
+                                   GDBusMethodInvocation *invocation)
+{
+  const gchar *method    = g_dbus_method_invocation_get_method_name (invocation);
+  const gchar *dialog_id;
+
+  if (g_strcmp0 (method, "Destroy") == 0 || g_strcmp0 (method, "CancelRun") == 0)
+    return FALSE;
+
+  dialog_id = _sfcd_dbus_wrapper_call_get_dialog_id (call, method);
+
+  return sandbox_utils_client_is_abandoned (cli,
+                                            dialog_id ? dialog_id : "",
+                                            _sfcd_dbus_wrapper_get_serial (invocation));
+}
+
+/*
+ * Lets the speculation engine know that a dialog may have changed after a
+ * call was processed. Calls that only read a dialog do not count. Dialog
+ * creation and Destroy are taken care of by their handlers.
+ */
 static void
-on_handle_response_signal (SandboxFileChooserDialog *sfcd,
-                           gint                      response_id,
-                           gint                      state,
-                           gpointer                  user_data)
+_sfcd_dbus_wrapper_call_speculate (SfcdDbusWrapperCall   *call,
+                                   SandboxUtilsClient    *cli,
+                                   GDBusMethodInvocation *invocation)
 {
-  SfcdDbusWrapperInfo        *info       = user_data;
-  SandboxUtilsClient         *cli        = info->client;
-  const gchar                *dialog_id  = sfcd_get_id (sfcd);
+  const gchar              *method = g_dbus_method_invocation_get_method_name (invocation);
+  const gchar              *dialog_id;
+  SandboxFileChooserDialog *sfcd   = NULL;
 
-  if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
+  if (!sandbox_utils_speculation_get_enabled () ||
+      _sfcd_dbus_wrapper_get_call_class (method) == SANDBOX_UTILS_CALL_RETRIEVAL ||
+      g_strcmp0 (method, "Destroy") == 0)
+    return;
+
+  if ((dialog_id = _sfcd_dbus_wrapper_call_get_dialog_id (call, method)) == NULL)
+    return;
+
+  // Not found is not worth a warning here, the handler reported it already
+  g_mutex_lock (&cli->dialogsMutex);
+  sfcd = g_hash_table_lookup (cli->dialogs, dialog_id);
+  if (sfcd)
+    g_object_ref (sfcd);
+  g_mutex_unlock (&cli->dialogsMutex);
+
+  if (sfcd)
   {
-    sfcd_dbus_wrapper__emit_response (info->interface,
-                                     dialog_id,
-                                     response_id,
-                                     state);
+    sandbox_utils_speculation_touch (sfcd);
+    g_object_unref (sfcd);
   }
-  _sfcd_dbus_wrapper_lookup_finished (NULL, sfcd, dialog_id);
+}
 
-  return;
+static void
+_sfcd_dbus_wrapper_call_dispatch (gpointer data,
+                                  gpointer user_data)
+{
+  SfcdDbusWrapperCall        *call       = data;
+  SandboxUtilsClient         *cli        = user_data;
+  GDBusMethodInvocation      *previous   = _sfcd_dbus_wrapper_replayed;
+  GDBusMethodInvocation      *invocation = g_value_get_object (&call->values[1]);
+  GValue                      handled    = G_VALUE_INIT;
+  gint64                      entered;
+
+  if (_sfcd_dbus_wrapper_call_abandoned (call, cli, invocation))
+  {
+    SU_TRACE2 (handle_abandoned,
+               g_dbus_method_invocation_get_method_name (invocation),
+               g_dbus_method_invocation_get_sender (invocation));
+
+    syslog (LOG_DEBUG, "SfcdDbusWrapper.%s: client gave up on the call, skipped.\n",
+            g_dbus_method_invocation_get_method_name (invocation));
+
+    g_dbus_method_invocation_return_error (invocation,
+                                           G_DBUS_ERROR,
+                                           G_DBUS_ERROR_FAILED,
+                                           "SfcdDbusWrapper.%s: call abandoned by the client.\n",
+                                           g_dbus_method_invocation_get_method_name (invocation));
+    call->dispatched = TRUE;
+    return;
+  }
+
+  g_value_init (&handled, G_TYPE_BOOLEAN);
+
+  entered = SU_TRACE_NOW ();
+  SU_TRACE3 (handle_entry,
+             g_dbus_method_invocation_get_method_name (invocation),
+             g_dbus_method_invocation_get_sender (invocation),
+             entered - _sfcd_dbus_wrapper_get_received_time (invocation));
+
+  _sfcd_dbus_wrapper_replayed = invocation;
+  g_signal_emitv (call->values, call->signal_id, 0, &handled);
+  _sfcd_dbus_wrapper_replayed = previous;
+
+  SU_TRACE3 (handle_exit,
+             g_dbus_method_invocation_get_method_name (invocation),
+             g_dbus_method_invocation_get_sender (invocation),
+             SU_TRACE_NOW () - entered);
+
+  // Answer like GDBus would have if there had been no scheduler
+  if (!g_value_get_boolean (&handled))
+    g_dbus_method_invocation_return_error (invocation,
+                                           G_DBUS_ERROR,
+                                           G_DBUS_ERROR_UNKNOWN_METHOD,
+                                           "Method %s is not implemented on interface %s",
+                                           g_dbus_method_invocation_get_method_name (invocation),
+                                           g_dbus_method_invocation_get_interface_name (invocation));
+
+  call->dispatched = TRUE;
+  g_value_unset (&handled);
+
+  _sfcd_dbus_wrapper_call_speculate (call, cli, invocation);
 }
 
-// This method is called only when the user destroys the dialog via the WM,
-// which causes the local dialog being destroyed. For when the client app calls
-// the destroy method, see on_handle_destroy.
 static void
-on_handle_destroy_signal (SandboxFileChooserDialog *sfcd,
-                         gpointer                   user_data)
+_sfcd_dbus_wrapper_call_free (gpointer data)
 {
-  SfcdDbusWrapperInfo        *info       = user_data;
-  SandboxUtilsClient         *cli        = info->client;
-  const gchar                *dialog_id  = sfcd_get_id (sfcd);
+  SfcdDbusWrapperCall        *call       = data;
+  GDBusMethodInvocation      *invocation = g_value_get_object (&call->values[1]);
+  guint                       i;
 
-  if ((sfcd = _sfcd_dbus_wrapper_lookup_and_remove (cli, dialog_id)) != NULL)
+  // The client must not be left waiting for an answer that will never come
+  if (!call->dispatched)
+    g_dbus_method_invocation_return_error (invocation,
+                                           G_DBUS_ERROR,
+                                           G_DBUS_ERROR_FAILED,
+                                           "SfcdDbusWrapper.%s: call dropped before it could be processed.\n",
+                                           g_dbus_method_invocation_get_method_name (invocation));
+
+  for (i = 0; i < call->n_values; i++)
+    g_value_unset (&call->values[i]);
+
+  g_free (call->values);
+  g_free (call);
+}
+
+// Connected to every handle-* signal before the actual handlers. Calls are
+// stored along with their arguments and handed over to the scheduler. When the
+// scheduler replays a call, we let the actual handler take care of it.
+static void
+_sfcd_dbus_wrapper_schedule_marshal (GClosure     *closure,
+                                     GValue       *return_value,
+                                     guint         n_param_values,
+                                     const GValue *param_values,
+                                     gpointer      invocation_hint,
+                                     gpointer      marshal_data)
+{
+  SfcdDbusWrapperInfo        *info       = closure->data;
+  GSignalInvocationHint      *hint       = invocation_hint;
+  GDBusMethodInvocation      *invocation = g_value_get_object (&param_values[1]);
+  const gchar                *method     = g_dbus_method_invocation_get_method_name (invocation);
+  SfcdDbusWrapperCall        *call       = NULL;
+  guint                       i;
+
+  if (invocation != _sfcd_dbus_wrapper_replayed)
   {
-    sfcd_dbus_wrapper__emit_destroy (info->interface, dialog_id);
-    g_object_unref (sfcd);
+    SU_TRACE2 (handle_queued, method, _sfcd_dbus_wrapper_get_call_class (method));
+
+    call = g_malloc0 (sizeof (SfcdDbusWrapperCall));
+    call->signal_id = hint->signal_id;
+    call->n_values  = n_param_values;
+    call->values    = g_malloc0 (sizeof (GValue) * n_param_values);
+
+    for (i = 0; i < n_param_values; i++)
+    {
+      g_value_init (&call->values[i], G_VALUE_TYPE (&param_values[i]));
+      g_value_copy (&param_values[i], &call->values[i]);
+    }
+
+    sandbox_utils_scheduler_push (_sfcd_dbus_wrapper_get_client (invocation),
+                                  _sfcd_dbus_wrapper_get_call_class (method),
+                                  _sfcd_dbus_wrapper_get_call_cost (method),
+                                  _sfcd_dbus_wrapper_call_dispatch,
+                                  call,
+                                  _sfcd_dbus_wrapper_call_free);
   }
-  _sfcd_dbus_wrapper_lookup_finished (NULL, sfcd, dialog_id);
 
-  return;
+  if (return_value)
+    g_value_set_boolean (return_value, call != NULL);
 }
 
-static gboolean
-on_handle_new (SfcdDbusWrapper        *interface,
-               GDBusMethodInvocation  *invocation,
-               const gchar            *title,
-               const gchar            *parent_id,
-               const gint              action,
-               GVariant               *button_list,
-               gpointer                user_data)
+static void
+_sfcd_dbus_wrapper_connect_scheduler (SfcdDbusWrapperInfo *info)
 {
-  SfcdDbusWrapperInfo        *info       = user_data;
-  SandboxUtilsClient         *cli        = info->client;
-  SandboxFileChooserDialog   *sfcd       = NULL;
-  GtkWidget                  *dialog     = NULL;
-  gchar                      *dialog_id  = NULL;
-  GVariant                   *item       = NULL;
-  GVariantIter               *iter       = NULL;
-  GError                     *error      = NULL;
+  GSignalQuery  query;
+  GClosure     *closure;
+  guint        *ids;
+  guint         n_ids;
+  guint         i;
 
-  // Create a new Local SandboxUtils dialog
-  sfcd = lfcd_new_variant (title,
-                           parent_id,
-                           NULL,
-                           action,
-                           button_list);
+  ids = g_signal_list_ids (sfcd_dbus_wrapper__get_type (), &n_ids);
 
-  if (sfcd==NULL)
+  for (i = 0; i < n_ids; i++)
   {
-	  g_set_error (&error, g_quark_from_static_string (SFCD_ERROR_DOMAIN), SFCD_ERROR_CREATION,
-				  "SfcdDbusWrapper.Sfcd.New: could not allocate memory to create SandboxFileChooserDialog.\n");
-		_sfcd_dbus_wrapper_return_error (invocation, error);
+    g_signal_query (ids[i], &query);
 
-	  return TRUE;
+    if (g_str_has_prefix (query.signal_name, "handle-"))
+    {
+      closure = g_closure_new_simple (sizeof (GClosure), info);
+      g_closure_set_marshal (closure, _sfcd_dbus_wrapper_schedule_marshal);
+      g_signal_connect_closure_by_id (info->interface, ids[i], 0, closure, FALSE);
+    }
   }
 
-  // Connect to signals
-  g_signal_connect (sfcd, "destroy", (GCallback) on_handle_destroy_signal, info);
-  g_signal_connect (sfcd, "response", (GCallback) on_handle_response_signal, info);
+  g_free (ids);
+}
 
-  // Store dialog in the client's table and return its id
-  gchar *key = g_strdup (sfcd_get_id (sfcd));
+static void
+_sfcd_dbus_wrapper_on_call_finished (gpointer  data,
+                                     GObject  *where_the_invocation_was)
+{
+  sandbox_utils_client_end_call (data);
+  sandbox_utils_client_unref (data);
+}
 
-  g_mutex_lock (&cli->dialogsMutex);
-  g_object_ref (sfcd);
-  g_hash_table_insert (cli->dialogs, key, sfcd);
-  g_mutex_unlock (&cli->dialogsMutex);
+static void
+_sfcd_dbus_wrapper_confirm_dialog (SandboxUtilsClient    *cli,
+                                   GDBusMethodInvocation *invocation)
+{
+  GVariant *parameters = g_dbus_method_invocation_get_parameters (invocation);
+  GVariant *dialog_id;
 
-  sfcd_dbus_wrapper__complete_new (interface, invocation, key);
+  if (g_variant_n_children (parameters) == 0)
+    return;
 
-  return TRUE;
+  dialog_id = g_variant_get_child_value (parameters, 0);
+  if (g_variant_is_of_type (dialog_id, G_VARIANT_TYPE_STRING))
+    sandbox_utils_client_confirm_dialog (cli, g_variant_get_string (dialog_id, NULL));
+  g_variant_unref (dialog_id);
 }
 
+/* Dialogs to destroy on the main loop, as their client never knew of them */
+typedef struct {
+  SandboxUtilsClient *cli;
+  GList              *ids;
+} SfcdDbusWrapperOrphans;
+
 static gboolean
-on_handle_get_state (SfcdDbusWrapper        *interface,
-                     GDBusMethodInvocation  *invocation,
-                     const gchar            *dialog_id,
-                     gpointer                user_data)
+_sfcd_dbus_wrapper_on_orphans (gpointer data)
 {
-  SandboxFileChooserDialog   *sfcd       = NULL;
-  SfcdDbusWrapperInfo        *info       = user_data;
-  SandboxUtilsClient         *cli        = info->client;
+  SfcdDbusWrapperOrphans *orphans = data;
+  guint                   destroyed;
 
-  if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
-  {
-    SfcdState state = sfcd_get_state (sfcd);
-    sfcd_dbus_wrapper__complete_get_state (interface, invocation, state);
-  }
-  _sfcd_dbus_wrapper_lookup_finished (invocation, sfcd, dialog_id);
+  destroyed = _sfcd_dbus_wrapper_destroy_dialogs (orphans->cli, orphans->ids);
+  syslog (LOG_DEBUG, "SfcdDbusWrapper.DestroyOrphans: %s gave up on creating %u dialogs, destroyed.\n",
+          orphans->cli->sender, destroyed);
 
-  return TRUE;
+  g_list_free_full (orphans->ids, g_free);
+  sandbox_utils_client_unref (orphans->cli);
+  g_free (orphans);
+
+  return G_SOURCE_REMOVE;
 }
 
-// This method is called only when the client app calls the destroy method. We
-// send the destroy signal ourselves to the client because we need to remove the
-// dialog from the hash table (to prevent new methods being called on an object
-// being destroyed). Our signal handler to the local dialog's "destroy" will be
-// removed at the same time we remove the dialog from the hash table. For when
-// the user destroys the dialog via the WM, see on_handle_destroy_signal.
-static gboolean
-on_handle_destroy (SfcdDbusWrapper        *interface,
-                   GDBusMethodInvocation  *invocation,
-                   const gchar            *dialog_id,
-                   gpointer                user_data)
+/* Takes @ids over */
+static void
+_sfcd_dbus_wrapper_destroy_orphans (SandboxUtilsClient *cli,
+                                    GList              *ids)
 {
-  SandboxFileChooserDialog   *sfcd       = NULL;
-  SfcdDbusWrapperInfo        *info       = user_data;
-  SandboxUtilsClient         *cli        = info->client;
-
-  if ((sfcd = _sfcd_dbus_wrapper_lookup_and_remove (cli, dialog_id)) != NULL)
-  {
-    sfcd_destroy (sfcd);
-    sfcd_dbus_wrapper__complete_destroy (interface, invocation);
-    sfcd_dbus_wrapper__emit_destroy (info->interface, dialog_id);
-    g_object_unref (sfcd);
-  }
-  _sfcd_dbus_wrapper_lookup_finished (invocation, sfcd, dialog_id);
+  SfcdDbusWrapperOrphans *orphans = g_malloc (sizeof (SfcdDbusWrapperOrphans));
 
-  return TRUE;
+  orphans->cli = sandbox_utils_client_ref (cli);
+  orphans->ids = ids;
+  g_idle_add (_sfcd_dbus_wrapper_on_orphans, orphans);
 }
 
+// GDBus emits this in a worker thread before dispatching each method call to
+// the main loop, so we can reject excess calls early rather than letting them
+// queue up in the main loop. Returning FALSE makes the skeleton drop its
+// reference to the invocation, so answering it here takes one of our own.
 static gboolean
-on_handle_run (SfcdDbusWrapper        *interface,
-               GDBusMethodInvocation  *invocation,
-               const gchar            *dialog_id,
-               gpointer                user_data)
+on_authorize_method (GDBusInterfaceSkeleton   *interface,
+                     GDBusMethodInvocation    *invocation,
+                     gpointer                  user_data)
 {
-  SandboxFileChooserDialog   *sfcd       = NULL;
-  SfcdDbusWrapperInfo        *info       = user_data;
-  SandboxUtilsClient         *cli        = info->client;
-  GError                     *error      = NULL;
+  SandboxUtilsClient         *cli;
+  const gchar                *method     = g_dbus_method_invocation_get_method_name (invocation);
+  SandboxUtilsCallClass       klass      = _sfcd_dbus_wrapper_get_call_class (method);
+  gint64                      received   = g_get_monotonic_time ();
+
+  // Remember when the call reached us, before it waits for its turn
+  g_object_set_data_full (G_OBJECT (invocation),
+                          "sfcd-received-time",
+                          g_memdup (&received, sizeof (gint64)),
+                          g_free);
+
+  // Limits and dialogs belong to the bus name calling, so that apps cannot
+  // touch each other's dialogs nor lock each other out
+  cli = sandbox_utils_client_lookup (g_dbus_method_invocation_get_sender (invocation));
+  g_object_set_data_full (G_OBJECT (invocation), "sfcd-client", cli, sandbox_utils_client_unref);
+
+  // Handled right here rather than queued, so that the calls still queued that
+  // were sent before are skipped. Dialogs made by calls the client gave up on
+  // would otherwise never be destroyed, as it does not know their ids.
+  if (g_strcmp0 (method, "AbandonCalls") == 0)
+  {
+    const gchar *dialog_id = NULL;
+    GList       *orphans;
 
-  if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
+    g_variant_get (g_dbus_method_invocation_get_parameters (invocation), "(&s)", &dialog_id);
+    orphans = sandbox_utils_client_abandon_calls (cli, dialog_id, _sfcd_dbus_wrapper_get_serial (invocation));
+    if (orphans)
+      _sfcd_dbus_wrapper_destroy_orphans (cli, orphans);
+
+    g_object_ref (invocation);
+    sfcd_dbus_wrapper__complete_abandon_calls (SFCD_DBUS_WRAPPER_ (interface), invocation);
+    return FALSE;
+  }
+
+  // Naming a dialog shows the client learned about it
+  if (_sfcd_dbus_wrapper_takes_dialog_id (method))
+    _sfcd_dbus_wrapper_confirm_dialog (cli, invocation);
+
+  if (!sandbox_utils_client_consume_token (cli, klass))
   {
-    sfcd_run (sfcd, &error);
+    g_object_ref (invocation);
+    _sfcd_dbus_wrapper_return_limit_error (invocation, SANDBOX_UTILS_LIMIT_RATE);
+    return FALSE;
+  }
 
-    if (!error)
-      sfcd_dbus_wrapper__complete_run (interface, invocation);
-    else
-      _sfcd_dbus_wrapper_return_error (invocation, error);
+  if (!sandbox_utils_client_begin_call (cli))
+  {
+    // The call was never processed, it should not eat into the rate budget
+    sandbox_utils_client_refund_token (cli, klass);
+
+    g_object_ref (invocation);
+    _sfcd_dbus_wrapper_return_limit_error (invocation, SANDBOX_UTILS_LIMIT_IN_FLIGHT);
+    return FALSE;
   }
-  _sfcd_dbus_wrapper_lookup_finished (invocation, sfcd, dialog_id);
+
+  // The invocation is finalised once it has been answered, release our slot then
+  g_object_weak_ref (G_OBJECT (invocation), _sfcd_dbus_wrapper_on_call_finished,
+                     sandbox_utils_client_ref (cli));
 
   return TRUE;
 }
 
+// Plays the part of the user in scripted mode
 static gboolean
-on_handle_present (SfcdDbusWrapper        *interface,
-                   GDBusMethodInvocation  *invocation,
-                   const gchar            *dialog_id,
-                   gpointer                user_data)
+_sfcd_dbus_wrapper_scripted_respond (gpointer data)
 {
-  SandboxFileChooserDialog   *sfcd       = NULL;
-  SfcdDbusWrapperInfo        *info       = user_data;
-  SandboxUtilsClient         *cli        = info->client;
+  SandboxFileChooserDialog   *sfcd       = data;
   GError                     *error      = NULL;
 
-  if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
+  // The client may have cancelled or destroyed the dialog in the meantime
+  if (sfcd_is_running (sfcd))
+  {
+    lfcd_respond (sfcd, _option_scripted_response, &error);
+    if (error)
+      g_error_free (error);
+  }
+
+  return G_SOURCE_REMOVE;
+}
+
+/*
+ * Emits a signal of the interface to the client that owns a dialog only, for
+ * signals that carry what the user picked in it. The generated emitters would
+ * broadcast it to every app on the bus.
+ */
+static void
+_sfcd_dbus_wrapper_emit_to_owner (SfcdDbusWrapperInfo  *info,
+                                  SandboxUtilsClient   *cli,
+                                  const gchar          *signal_name,
+                                  GVariant             *parameters)
+{
+  GError *error = NULL;
+
+  g_variant_ref_sink (parameters);
+
+  // Peer-to-peer connections have no bus name, and only one peer to tell
+  if (info->connection &&
+      !g_dbus_connection_emit_signal (info->connection,
+                                      cli->sender[0] ? cli->sender : NULL,
+                                      SANDBOXUTILS_PATH,
+                                      SFCD_IFACE,
+                                      signal_name,
+                                      parameters,
+                                      &error))
+  {
+    syslog (LOG_WARNING, "SfcdDbusWrapper._EmitToOwner: could not send %s to %s (%s).\n",
+            signal_name, cli->sender, error->message);
+    g_error_free (error);
+  }
+
+  g_variant_unref (parameters);
+}
+
+static void
+on_handle_response_signal (SandboxFileChooserDialog *sfcd,
+                           gint                      response_id,
+                           gint                      state,
+                           gpointer                  user_data)
+{
+  SfcdDbusWrapperInfo        *info       = user_data;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_owner (sfcd);
+  const gchar                *dialog_id  = sfcd_get_id (sfcd);
+
+  if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
+  {
+    SfcdTimings  timings;
+    GVariant    *choices;
+    GError      *error = NULL;
+    GFile       *folder;
+    gchar       *uri;
+
+    // Clients then know the final choices without asking for them
+    if ((choices = sfcd_get_choice_values (sfcd, &error)) == NULL)
+    {
+      g_error_free (error);
+      choices = g_variant_ref_sink (g_variant_new_array (G_VARIANT_TYPE ("{sv}"), NULL, 0));
+    }
+
+    sfcd_get_timings (sfcd, &timings);
+    _sfcd_dbus_wrapper_emit_to_owner (info, cli, "Response",
+                                      g_variant_new ("(sii@a{sx}@a{sv})",
+                                                     dialog_id,
+                                                     response_id,
+                                                     state,
+                                                     _sfcd_timings_to_variant (&timings),
+                                                     choices));
+    g_variant_unref (choices);
+
+    // The client may now ask about the chosen files without a dialog
+    if (state == SFCD_DATA_RETRIEVAL)
+    {
+      GSList *filenames = sfcd_get_filenames (sfcd, &error);
+
+      // Other sandbox components, and the server itself, may then know that
+      // the process running the dialog was allowed to access them
+      switch (sfcd_get_action (sfcd, NULL))
+      {
+        case GTK_FILE_CHOOSER_ACTION_SAVE:
+        case GTK_FILE_CHOOSER_ACTION_CREATE_FOLDER:
+          sandbox_utils_grants_record (dialog_id, filenames,
+                                       SANDBOXUTILS_LEDGER_READ | SANDBOXUTILS_LEDGER_WRITE);
+          break;
+        default:
+          sandbox_utils_grants_record (dialog_id, filenames, SANDBOXUTILS_LEDGER_READ);
+          break;
+      }
+
+      g_slist_free_full (filenames, g_free);
+      g_clear_error (&error);
+    }
+
+    // Where the user ended up is where the next dialog is likely to start
+    if (sandbox_utils_dircache_get_enabled () &&
+        (uri = sfcd_get_current_folder_uri (sfcd, NULL)) != NULL)
+    {
+      folder = g_file_new_for_uri (uri);
+      sandbox_utils_dircache_load (folder, NULL);
+      g_object_unref (folder);
+      g_free (uri);
+    }
+  }
+  _sfcd_dbus_wrapper_lookup_finished (NULL, sfcd, dialog_id);
+
+  return;
+}
+
+static void
+on_handle_choices_changed_signal (SandboxFileChooserDialog *sfcd,
+                                  GVariant                 *changes,
+                                  gpointer                  user_data)
+{
+  SfcdDbusWrapperInfo        *info       = user_data;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_owner (sfcd);
+  const gchar                *dialog_id  = sfcd_get_id (sfcd);
+
+  // Changes are already coalesced by the dialog, pass them on as they come
+  if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
+    _sfcd_dbus_wrapper_emit_to_owner (info, cli, "ChoicesChanged",
+                                      g_variant_new ("(s@a{sv})", dialog_id, changes));
+  _sfcd_dbus_wrapper_lookup_finished (NULL, sfcd, dialog_id);
+
+  return;
+}
+
+// This method is called only when the user destroys the dialog via the WM,
+// which causes the local dialog being destroyed. For when the client app calls
+// the destroy method, see on_handle_destroy.
+static void
+on_handle_destroy_signal (SandboxFileChooserDialog *sfcd,
+                         gpointer                   user_data)
+{
+  SfcdDbusWrapperInfo        *info       = user_data;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_owner (sfcd);
+  const gchar                *dialog_id  = sfcd_get_id (sfcd);
+
+  if ((sfcd = _sfcd_dbus_wrapper_lookup_and_remove (cli, dialog_id)) != NULL)
+  {
+    sandbox_utils_grants_forget_dialog (dialog_id);
+    sfcd_dbus_wrapper__emit_destroy (info->interface, dialog_id);
+    g_object_unref (sfcd);
+  }
+  _sfcd_dbus_wrapper_lookup_finished (NULL, sfcd, dialog_id);
+
+  return;
+}
+
+/*
+ * Destroys the dialogs of @cli listed in @ids without telling the client,
+ * which is gone or never knew of them. Returns how many were destroyed.
+ */
+static guint
+_sfcd_dbus_wrapper_destroy_dialogs (SandboxUtilsClient *cli,
+                                    GList              *ids)
+{
+  SandboxFileChooserDialog   *sfcd;
+  GList                      *iter;
+  guint                       destroyed  = 0;
+
+  for (iter = ids; iter; iter = iter->next)
+  {
+    if ((sfcd = _sfcd_dbus_wrapper_lookup_and_remove (cli, iter->data)) != NULL)
+    {
+      sfcd_destroy (sfcd);
+      sandbox_utils_grants_forget_dialog (iter->data);
+      g_object_unref (sfcd);
+      _sfcd_dbus_wrapper_lookup_finished (NULL, sfcd, iter->data);
+      destroyed++;
+    }
+  }
+
+  return destroyed;
+}
+
+/*
+ * Destroys the dialogs of a client that left the bus and drops its calls still
+ * waiting to be processed, so that nothing it owned outlives it.
+ */
+static void
+_sfcd_dbus_wrapper_forget_client (const gchar *sender)
+{
+  SandboxUtilsClient         *cli;
+  GList                      *keys;
+  GList                      *ids;
+  guint                       destroyed;
+
+  if ((cli = sandbox_utils_client_remove (sender)) == NULL)
+    return;
+
+  sandbox_utils_scheduler_forget_client (cli);
+
+  // Ids are owned by the table, which shrinks as dialogs are removed
+  g_mutex_lock (&cli->dialogsMutex);
+  keys = g_hash_table_get_keys (cli->dialogs);
+  ids = g_list_copy_deep (keys, (GCopyFunc) g_strdup, NULL);
+  g_list_free (keys);
+  g_mutex_unlock (&cli->dialogsMutex);
+
+  destroyed = _sfcd_dbus_wrapper_destroy_dialogs (cli, ids);
+
+  syslog (LOG_INFO, "SfcdDbusWrapper.ForgetClient: %s left the bus, %u dialogs destroyed.\n",
+          sender, destroyed);
+
+  g_list_free_full (ids, g_free);
+  sandbox_utils_client_unref (cli);
+}
+
+static void
+on_name_owner_changed (GDBusConnection *connection,
+                       const gchar     *sender_name,
+                       const gchar     *object_path,
+                       const gchar     *interface_name,
+                       const gchar     *signal_name,
+                       GVariant        *parameters,
+                       gpointer         user_data)
+{
+  const gchar *name      = NULL;
+  const gchar *new_owner = NULL;
+
+  g_variant_get (parameters, "(&s&s&s)", &name, NULL, &new_owner);
+
+  // Unique names are never given out again, their clients can go for good
+  if (name[0] == ':' && new_owner[0] == '\0')
+    _sfcd_dbus_wrapper_forget_client (name);
+}
+
+/*
+ * Starts forwarding the signals of a newly created dialog to the client, and
+ * stores it in the client's table. Returns its id, owned by the table.
+ */
+static const gchar *
+_sfcd_dbus_wrapper_adopt (SfcdDbusWrapperInfo      *info,
+                          SandboxUtilsClient       *cli,
+                          GDBusMethodInvocation    *invocation,
+                          SandboxFileChooserDialog *sfcd)
+{
+  gchar              *key = g_strdup (sfcd_get_id (sfcd));
+  guint32             serial = _sfcd_dbus_wrapper_get_serial (invocation);
+  gpointer            abandoned;
+  gboolean            orphan;
+
+  // Signal handlers have no invocation to tell them whose dialog it is
+  g_object_set_data_full (G_OBJECT (sfcd), "sfcd-client",
+                          sandbox_utils_client_ref (cli),
+                          sandbox_utils_client_unref);
+
+  g_signal_connect (sfcd, "destroy", (GCallback) on_handle_destroy_signal, info);
+  g_signal_connect (sfcd, "response", (GCallback) on_handle_response_signal, info);
+  g_signal_connect (sfcd, "choices-changed", (GCallback) on_handle_choices_changed_signal, info);
+
+  // Until the client draws its own previews, if it ever does
+  sandbox_utils_preview_attach_builtin (sfcd);
+
+  // Vet what the user accepts before the client gets it
+  sandbox_utils_policy_attach (sfcd);
+
+  g_mutex_lock (&cli->dialogsMutex);
+  g_object_ref (sfcd);
+  g_hash_table_insert (cli->dialogs, key, sfcd);
+
+  // Until the client names it, it may give up on the call creating it. If it
+  // just did, while we were creating it, it will never learn about it.
+  orphan = g_hash_table_lookup_extended (cli->abandoned, "", NULL, &abandoned) &&
+           serial < GPOINTER_TO_UINT (abandoned);
+  if (!orphan)
+    g_hash_table_insert (cli->unconfirmed, g_strdup (key), GUINT_TO_POINTER (serial));
+  g_mutex_unlock (&cli->dialogsMutex);
+
+  if (orphan)
+    _sfcd_dbus_wrapper_destroy_orphans (cli, g_list_prepend (NULL, g_strdup (key)));
+
+  return key;
+}
+
+static gboolean
+on_handle_new (SfcdDbusWrapper        *interface,
+               GDBusMethodInvocation  *invocation,
+               const gchar            *title,
+               const gchar            *parent_id,
+               const gint              action,
+               GVariant               *button_list,
+               gpointer                user_data)
+{
+  SfcdDbusWrapperInfo        *info       = user_data;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
+  SandboxFileChooserDialog   *sfcd       = NULL;
+  GtkWidget                  *dialog     = NULL;
+  gchar                      *dialog_id  = NULL;
+  GVariant                   *item       = NULL;
+  GVariantIter               *iter       = NULL;
+  GError                     *error      = NULL;
+
+  if (!sandbox_utils_client_can_own_dialog (cli))
+  {
+    _sfcd_dbus_wrapper_return_limit_error (invocation, SANDBOX_UTILS_LIMIT_DIALOGS);
+    return TRUE;
+  }
+
+  // Create a new Local SandboxUtils dialog
+  sfcd = lfcd_new_variant (title,
+                           parent_id,
+                           NULL,
+                           action,
+                           button_list);
+
+  if (sfcd==NULL)
+  {
+	  g_set_error (&error, g_quark_from_static_string (SFCD_ERROR_DOMAIN), SFCD_ERROR_CREATION,
+				  "SfcdDbusWrapper.Sfcd.New: could not allocate memory to create SandboxFileChooserDialog.\n");
+		_sfcd_dbus_wrapper_return_error (invocation, error);
+
+	  return TRUE;
+  }
+
+  sfcd_dbus_wrapper__complete_new (interface, invocation,
+                                   _sfcd_dbus_wrapper_adopt (info, cli, invocation, sfcd));
+  sandbox_utils_speculation_touch (sfcd);
+
+  return TRUE;
+}
+
+static gboolean
+on_handle_register_template (SfcdDbusWrapper        *interface,
+                             GDBusMethodInvocation  *invocation,
+                             GVariant               *config,
+                             gpointer                user_data)
+{
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
+  SandboxUtilsTemplate       *tmpl       = NULL;
+  gchar                      *template_id = NULL;
+  GError                     *error      = NULL;
+
+  if ((tmpl = sandbox_utils_template_new (config, &error)) == NULL)
+  {
+    _sfcd_dbus_wrapper_return_error (invocation, error);
+    return TRUE;
+  }
+
+  if ((template_id = sandbox_utils_client_add_template (cli, tmpl)) == NULL)
+  {
+    _sfcd_dbus_wrapper_return_limit_error (invocation, SANDBOX_UTILS_LIMIT_TEMPLATES);
+    return TRUE;
+  }
+
+  sfcd_dbus_wrapper__complete_register_template (interface, invocation, template_id);
+  g_free (template_id);
+
+  return TRUE;
+}
+
+static gboolean
+on_handle_new_from_template (SfcdDbusWrapper        *interface,
+                             GDBusMethodInvocation  *invocation,
+                             const gchar            *template_id,
+                             GVariant               *overrides,
+                             gpointer                user_data)
+{
+  SfcdDbusWrapperInfo        *info       = user_data;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
+  SandboxUtilsTemplate       *tmpl       = NULL;
+  SandboxFileChooserDialog   *sfcd       = NULL;
+  GError                     *error      = NULL;
+
+  if ((tmpl = sandbox_utils_client_lookup_template (cli, template_id)) == NULL)
+  {
+    g_dbus_method_invocation_return_error (invocation,
+                                           G_DBUS_ERROR,
+                                           SFCD_ERROR_LOOKUP,
+                                           "SfcdDbusWrapper.NewFromTemplate: template '%s' was not found.\n",
+                                           template_id);
+    return TRUE;
+  }
+
+  if (!sandbox_utils_client_can_own_dialog (cli))
+  {
+    _sfcd_dbus_wrapper_return_limit_error (invocation, SANDBOX_UTILS_LIMIT_DIALOGS);
+  }
+  else if ((sfcd = sandbox_utils_template_instantiate (tmpl, overrides, &error)) == NULL)
+  {
+    _sfcd_dbus_wrapper_return_error (invocation, error);
+  }
+  else
+  {
+    sfcd_dbus_wrapper__complete_new_from_template (interface, invocation,
+                                                   _sfcd_dbus_wrapper_adopt (info, cli, invocation, sfcd));
+    sandbox_utils_speculation_touch (sfcd);
+  }
+
+  sandbox_utils_template_unref (tmpl);
+
+  return TRUE;
+}
+
+static gboolean
+on_handle_unregister_template (SfcdDbusWrapper        *interface,
+                               GDBusMethodInvocation  *invocation,
+                               const gchar            *template_id,
+                               gpointer                user_data)
+{
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
+
+  // Dialogs already created from the template are left alone
+  if (sandbox_utils_client_remove_template (cli, template_id))
+    sfcd_dbus_wrapper__complete_unregister_template (interface, invocation);
+  else
+    g_dbus_method_invocation_return_error (invocation,
+                                           G_DBUS_ERROR,
+                                           SFCD_ERROR_LOOKUP,
+                                           "SfcdDbusWrapper.UnregisterTemplate: template '%s' was not found.\n",
+                                           template_id);
+
+  return TRUE;
+}
+
+static gboolean
+on_handle_get_state (SfcdDbusWrapper        *interface,
+                     GDBusMethodInvocation  *invocation,
+                     const gchar            *dialog_id,
+                     gpointer                user_data)
+{
+  SandboxFileChooserDialog   *sfcd       = NULL;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
+
+  if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
+  {
+    SfcdState state = sfcd_get_state (sfcd);
+    sfcd_dbus_wrapper__complete_get_state (interface, invocation, state);
+  }
+  _sfcd_dbus_wrapper_lookup_finished (invocation, sfcd, dialog_id);
+
+  return TRUE;
+}
+
+// This method is called only when the client app calls the destroy method. We
+// send the destroy signal ourselves to the client because we need to remove the
+// dialog from the hash table (to prevent new methods being called on an object
+// being destroyed). Our signal handler to the local dialog's "destroy" will be
+// removed at the same time we remove the dialog from the hash table. For when
+// the user destroys the dialog via the WM, see on_handle_destroy_signal.
+static gboolean
+on_handle_destroy (SfcdDbusWrapper        *interface,
+                   GDBusMethodInvocation  *invocation,
+                   const gchar            *dialog_id,
+                   gpointer                user_data)
+{
+  SandboxFileChooserDialog   *sfcd       = NULL;
+  SfcdDbusWrapperInfo        *info       = user_data;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
+
+  if ((sfcd = _sfcd_dbus_wrapper_lookup_and_remove (cli, dialog_id)) != NULL)
+  {
+    sfcd_destroy (sfcd);
+    sandbox_utils_grants_forget_dialog (dialog_id);
+    sfcd_dbus_wrapper__complete_destroy (interface, invocation);
+    sfcd_dbus_wrapper__emit_destroy (info->interface, dialog_id);
+    g_object_unref (sfcd);
+  }
+  _sfcd_dbus_wrapper_lookup_finished (invocation, sfcd, dialog_id);
+
+  return TRUE;
+}
+
+static gboolean
+on_handle_run (SfcdDbusWrapper        *interface,
+               GDBusMethodInvocation  *invocation,
+               const gchar            *dialog_id,
+               const guint64           correlation_id,
+               const gint64            run_called,
+               gpointer                user_data)
+{
+  SandboxFileChooserDialog   *sfcd       = NULL;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
+  GError                     *error      = NULL;
+
+  if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
+  {
+    // Already running dialogs are left for sfcd_run to report
+    if (!sfcd_is_running (sfcd) && !sandbox_utils_client_can_run_dialog (cli))
+    {
+      _sfcd_dbus_wrapper_return_limit_error (invocation, SANDBOX_UTILS_LIMIT_RUNS);
+    }
+    else
+    {
+      lfcd_set_run_origin (sfcd,
+                           correlation_id,
+                           run_called,
+                           _sfcd_dbus_wrapper_get_received_time (invocation));
+      sfcd_run (sfcd, &error);
+
+      // Must be known before the user answers, to record what they choose
+      if (!error)
+        sandbox_utils_grants_watch_run (invocation, dialog_id);
+
+      if (!error && _option_scripted)
+        g_timeout_add_full (G_PRIORITY_DEFAULT,
+                            MAX (_option_scripted_think_time, 0),
+                            _sfcd_dbus_wrapper_scripted_respond,
+                            g_object_ref (sfcd),
+                            g_object_unref);
+
+      if (!error)
+        sfcd_dbus_wrapper__complete_run (interface, invocation);
+      else
+        _sfcd_dbus_wrapper_return_error (invocation, error);
+    }
+  }
+  _sfcd_dbus_wrapper_lookup_finished (invocation, sfcd, dialog_id);
+
+  return TRUE;
+}
+
+static gboolean
+on_handle_present (SfcdDbusWrapper        *interface,
+                   GDBusMethodInvocation  *invocation,
+                   const gchar            *dialog_id,
+                   gpointer                user_data)
+{
+  SandboxFileChooserDialog   *sfcd       = NULL;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
+  GError                     *error      = NULL;
+
+  if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
   {
     sfcd_present (sfcd, &error);
 
     if (!error)
-      sfcd_dbus_wrapper__complete_present (interface, invocation);
+      sfcd_dbus_wrapper__complete_present (interface, invocation);
+    else
+      _sfcd_dbus_wrapper_return_error (invocation, error);
+  }
+  _sfcd_dbus_wrapper_lookup_finished (invocation, sfcd, dialog_id);
+
+  return TRUE;
+}
+
+static gboolean
+on_handle_cancel_run (SfcdDbusWrapper        *interface,
+                      GDBusMethodInvocation  *invocation,
+                      const gchar            *dialog_id,
+                      gpointer                user_data)
+{
+  SandboxFileChooserDialog   *sfcd       = NULL;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
+  GError                     *error      = NULL;
+
+  if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
+  {
+    sfcd_cancel_run (sfcd, &error);
+
+    if (!error)
+      sfcd_dbus_wrapper__complete_cancel_run (interface, invocation);
+    else
+      _sfcd_dbus_wrapper_return_error (invocation, error);
+  }
+  _sfcd_dbus_wrapper_lookup_finished (invocation, sfcd, dialog_id);
+
+  return TRUE;
+}
+
+// Lets clients reuse a dialog instead of destroying it and creating another,
+// which would cost a whole new GtkFileChooserDialog.
+static gboolean
+on_handle_reset (SfcdDbusWrapper        *interface,
+                 GDBusMethodInvocation  *invocation,
+                 const gchar            *dialog_id,
+                 const guint             flags,
+                 gpointer                user_data)
+{
+  SandboxFileChooserDialog   *sfcd       = NULL;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
+  GError                     *error      = NULL;
+
+  if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
+  {
+    sfcd_reset (sfcd, flags, &error);
+
+    if (!error)
+      sfcd_dbus_wrapper__complete_reset (interface, invocation);
+    else
+      _sfcd_dbus_wrapper_return_error (invocation, error);
+  }
+  _sfcd_dbus_wrapper_lookup_finished (invocation, sfcd, dialog_id);
+
+  return TRUE;
+}
+
+static gboolean
+on_handle_set_extra_widget (SfcdDbusWrapper        *interface,
+                            GDBusMethodInvocation  *invocation,
+                            const gchar            *dialog_id,
+                            const gulong            widget_id,
+                            gpointer                user_data)
+{
+  SandboxFileChooserDialog   *sfcd       = NULL;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
+  GError                     *error      = NULL;
+
+  if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
+  {
+    GtkWidget *widget = NULL;
+
+    // There is a plug id, create a socket to embed it
+    if (widget_id != 0)
+    {
+      // Set the extra widget through GtkSocket/GtkPlug
+      widget = gtk_socket_new ();
+      sfcd_set_extra_widget (sfcd, widget, &error);
+      
+      //TODO connect to plug signals?
+
+      // Set the remote parent's id to whatever was passed to us
+      gtk_socket_add_id (GTK_SOCKET (widget), widget_id);
+      gtk_widget_show_all (widget);
+    }
+    // Else just unset the widget once and for all
+    else
+    {
+      sfcd_set_extra_widget (sfcd, NULL, &error);
+    }
+
+    if (!error)
+      sfcd_dbus_wrapper__complete_set_extra_widget (interface, invocation);
     else
       _sfcd_dbus_wrapper_return_error (invocation, error);
   }
@@ -329,110 +1347,540 @@ on_handle_present (SfcdDbusWrapper        *interface,
 }
 
 static gboolean
-on_handle_cancel_run (SfcdDbusWrapper        *interface,
-                      GDBusMethodInvocation  *invocation,
-                      const gchar            *dialog_id,
-                      gpointer                user_data)
+on_handle_get_extra_widget (SfcdDbusWrapper        *interface,
+                            GDBusMethodInvocation  *invocation,
+                            const gchar            *dialog_id,
+                            gpointer                user_data)
+{
+  SandboxFileChooserDialog   *sfcd       = NULL;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
+  GError                     *error      = NULL;
+
+  if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
+  {
+    GtkWidget *widget = sfcd_get_extra_widget (sfcd, &error);
+    gulong widget_id = 0;
+
+    if (widget)
+    {
+      if (GTK_IS_SOCKET (widget))
+      {
+        GdkWindow *win = gtk_socket_get_plug_window (GTK_SOCKET (widget));
+        if (win)
+          widget_id = GDK_WINDOW_XID (win);
+      }
+      else
+        syslog (LOG_DEBUG, "SfcdDbusWrapper.Sfcd.OnHandleGetExtraWidget: dialog '%s' does not contain a socket, cannot proceed.\n",
+                dialog_id);
+    }
+
+    if (!error)
+      sfcd_dbus_wrapper__complete_get_extra_widget (interface, invocation, widget_id);
+    else
+      _sfcd_dbus_wrapper_return_error (invocation, error);
+  }
+  _sfcd_dbus_wrapper_lookup_finished (invocation, sfcd, dialog_id);
+
+  return TRUE;
+}
+
+static gboolean
+on_handle_set_choices (SfcdDbusWrapper        *interface,
+                       GDBusMethodInvocation  *invocation,
+                       const gchar            *dialog_id,
+                       GVariant               *choices,
+                       gpointer                user_data)
+{
+  SandboxFileChooserDialog   *sfcd       = NULL;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
+  GError                     *error      = NULL;
+
+  if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
+  {
+    sfcd_set_choices (sfcd, choices, &error);
+
+    if (!error)
+      sfcd_dbus_wrapper__complete_set_choices (interface, invocation);
+    else
+      _sfcd_dbus_wrapper_return_error (invocation, error);
+  }
+  _sfcd_dbus_wrapper_lookup_finished (invocation, sfcd, dialog_id);
+
+  return TRUE;
+}
+
+static gboolean
+on_handle_get_choice_values (SfcdDbusWrapper        *interface,
+                             GDBusMethodInvocation  *invocation,
+                             const gchar            *dialog_id,
+                             gpointer                user_data)
+{
+  SandboxFileChooserDialog   *sfcd       = NULL;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
+  GError                     *error      = NULL;
+
+  if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
+  {
+    GVariant *values = sfcd_get_choice_values (sfcd, &error);
+
+    if (!error)
+    {
+      sfcd_dbus_wrapper__complete_get_choice_values (interface, invocation, values);
+      g_variant_unref (values);
+    }
+    else
+      _sfcd_dbus_wrapper_return_error (invocation, error);
+  }
+  _sfcd_dbus_wrapper_lookup_finished (invocation, sfcd, dialog_id);
+
+  return TRUE;
+}
+
+// Rings the client drawing the preview of a dialog, it fetches the file itself
+static void
+_sfcd_dbus_wrapper_on_preview_requested (SandboxFileChooserDialog *sfcd,
+                                         gpointer                  user_data)
+{
+  SfcdDbusWrapperInfo *info = user_data;
+
+  sfcd_dbus_wrapper__emit_preview_requested (info->interface, sfcd_get_id (sfcd));
+}
+
+static gboolean
+on_handle_set_preview_buffer (SfcdDbusWrapper        *interface,
+                              GDBusMethodInvocation  *invocation,
+                              GUnixFDList            *fd_list,
+                              const gchar            *dialog_id,
+                              gint                    buffer,
+                              gint                    width,
+                              gint                    height,
+                              gint                    stride,
+                              gpointer                user_data)
 {
   SandboxFileChooserDialog   *sfcd       = NULL;
   SfcdDbusWrapperInfo        *info       = user_data;
-  SandboxUtilsClient         *cli        = info->client;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
+  GError                     *error      = NULL;
+
+  if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
+  {
+    gint fd = -1;
+
+    if (fd_list)
+      fd = g_unix_fd_list_get (fd_list, buffer, &error);
+    else
+      g_set_error (&error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                   "SfcdDbusWrapper.SetPreviewBuffer: no file descriptor was sent for dialog '%s'.\n",
+                   dialog_id);
+
+    if (fd != -1)
+    {
+      // Previews are only ever handed to the client that will draw them
+      sandbox_utils_preview_attach (sfcd,
+                                    g_dbus_method_invocation_get_sender (invocation),
+                                    fd, width, height, stride,
+                                    _sfcd_dbus_wrapper_on_preview_requested,
+                                    info,
+                                    &error);
+      close (fd);
+    }
+
+    if (!error)
+      sfcd_dbus_wrapper__complete_set_preview_buffer (interface, invocation, NULL);
+    else
+      _sfcd_dbus_wrapper_return_error (invocation, error);
+  }
+  _sfcd_dbus_wrapper_lookup_finished (invocation, sfcd, dialog_id);
+
+  return TRUE;
+}
+
+static gboolean
+on_handle_unset_preview_buffer (SfcdDbusWrapper        *interface,
+                                GDBusMethodInvocation  *invocation,
+                                const gchar            *dialog_id,
+                                gpointer                user_data)
+{
+  SandboxFileChooserDialog   *sfcd       = NULL;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
+  GError                     *error      = NULL;
+
+  if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
+  {
+    sandbox_utils_preview_detach (sfcd, g_dbus_method_invocation_get_sender (invocation), &error);
+
+    if (!error)
+      sfcd_dbus_wrapper__complete_unset_preview_buffer (interface, invocation);
+    else
+      _sfcd_dbus_wrapper_return_error (invocation, error);
+  }
+  _sfcd_dbus_wrapper_lookup_finished (invocation, sfcd, dialog_id);
+
+  return TRUE;
+}
+
+static gboolean
+on_handle_open_preview_file (SfcdDbusWrapper        *interface,
+                             GDBusMethodInvocation  *invocation,
+                             GUnixFDList            *fd_list,
+                             const gchar            *dialog_id,
+                             gpointer                user_data)
+{
+  SandboxFileChooserDialog   *sfcd       = NULL;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
+  GError                     *error      = NULL;
+
+  if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
+  {
+    guint64      serial = 0;
+    GUnixFDList *out;
+    gint         fd;
+
+    fd = sandbox_utils_preview_open (sfcd, g_dbus_method_invocation_get_sender (invocation),
+                                     &serial, &error);
+
+    if (!error)
+    {
+      // The list takes the descriptor over and closes it once sent
+      out = g_unix_fd_list_new_from_array (&fd, 1);
+      sfcd_dbus_wrapper__complete_open_preview_file (interface, invocation, out, serial, 0);
+      g_object_unref (out);
+    }
+    else
+      _sfcd_dbus_wrapper_return_error (invocation, error);
+  }
+  _sfcd_dbus_wrapper_lookup_finished (invocation, sfcd, dialog_id);
+
+  return TRUE;
+}
+
+static gboolean
+on_handle_preview_damage (SfcdDbusWrapper        *interface,
+                          GDBusMethodInvocation  *invocation,
+                          const gchar            *dialog_id,
+                          guint64                 serial,
+                          gboolean                active,
+                          GVariant               *rects,
+                          gpointer                user_data)
+{
+  SandboxFileChooserDialog   *sfcd       = NULL;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
   GError                     *error      = NULL;
 
-  if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
-  {
-    sfcd_cancel_run (sfcd, &error);
+  if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
+  {
+    sandbox_utils_preview_damage (sfcd, g_dbus_method_invocation_get_sender (invocation),
+                                  serial, active, rects, &error);
+
+    if (!error)
+      sfcd_dbus_wrapper__complete_preview_damage (interface, invocation);
+    else
+      _sfcd_dbus_wrapper_return_error (invocation, error);
+  }
+  _sfcd_dbus_wrapper_lookup_finished (invocation, sfcd, dialog_id);
+
+  return TRUE;
+}
+
+/* A GetThumbnails call waiting for its thumbnails to be made */
+typedef struct {
+  SfcdDbusWrapper        *interface;
+  GDBusMethodInvocation  *invocation;
+  gchar                 **uris;       /* asked for by URI, to be checked first */
+  gint                    size;
+} SfcdDbusWrapperThumbnailsCall;
+
+static void
+_sfcd_dbus_wrapper_on_thumbnails_packed (GVariant  *metadata,
+                                         gint       fd,
+                                         GError    *error,
+                                         gpointer   user_data)
+{
+  SfcdDbusWrapperThumbnailsCall *call = user_data;
+  GUnixFDList                   *out;
+
+  if (error)
+    _sfcd_dbus_wrapper_return_error (call->invocation, error);
+  else
+  {
+    // The list takes the descriptor over
+    out = g_unix_fd_list_new_from_array (&fd, 1);
+    sfcd_dbus_wrapper__complete_get_thumbnails (call->interface, call->invocation, out, metadata, 0);
+    g_object_unref (out);
+  }
+
+  g_strfreev (call->uris);
+  g_free (call);
+}
+
+// Otherwise thumbnails would tell what any file the server can read holds, so
+// files asked for by URI must have been granted to the very process asking
+static void
+_sfcd_dbus_wrapper_on_thumbnails_caller (guint32   pid,
+                                         guint32   uid,
+                                         guint64   start_time,
+                                         GError   *error,
+                                         gpointer  user_data)
+{
+  SfcdDbusWrapperThumbnailsCall *call    = user_data;
+  GError                        *refusal = NULL;
+  gchar                         *path;
+  guint                          i;
+
+  if (error)
+    refusal = g_error_copy (error);
+
+  for (i = 0; !refusal && call->uris[i]; i++)
+  {
+    path = g_filename_from_uri (call->uris[i], NULL, NULL);
+
+    // The pid may belong to another process by now, which has other grants
+    if (!path || !sandbox_utils_grants_check_process (pid, start_time, path, NULL, NULL))
+      g_set_error (&refusal,
+                   g_quark_from_static_string (SFCD_ERROR_DOMAIN),
+                   SFCD_ERROR_FORBIDDEN_QUERY,
+                   "SfcdDbusWrapper.GetThumbnails: '%s' was not granted to the calling process.\n",
+                   call->uris[i]);
+
+    g_free (path);
+  }
+
+  if (refusal)
+  {
+    _sfcd_dbus_wrapper_return_error (call->invocation, refusal);
+    g_strfreev (call->uris);
+    g_free (call);
+    return;
+  }
+
+  // Answered once all thumbnails are made, the main loop goes on meanwhile
+  sandbox_utils_thumbnail_pack ((const gchar * const *) call->uris, call->size,
+                                _sfcd_dbus_wrapper_on_thumbnails_packed, call);
+}
+
+static gboolean
+on_handle_get_thumbnails (SfcdDbusWrapper        *interface,
+                          GDBusMethodInvocation  *invocation,
+                          GUnixFDList            *fd_list,
+                          const gchar            *dialog_id,
+                          const gchar * const    *uris,
+                          gint                    size,
+                          gpointer                user_data)
+{
+  SandboxFileChooserDialog      *sfcd       = NULL;
+  SandboxUtilsClient            *cli        = _sfcd_dbus_wrapper_get_client (invocation);
+  SfcdDbusWrapperThumbnailsCall *call;
+  GError                        *error      = NULL;
+  GPtrArray                     *wanted;
+  GSList                        *list, *iter;
+
+  wanted = g_ptr_array_new_with_free_func (g_free);
+
+  if (size <= 0 || size > SANDBOX_UTILS_THUMBNAIL_LARGE)
+  {
+    g_set_error (&error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                 "SfcdDbusWrapper.GetThumbnails: thumbnails must be 1 to %d pixels wide, not %d.\n",
+                 SANDBOX_UTILS_THUMBNAIL_LARGE, size);
+  }
+  else if (dialog_id[0] != '\0')
+  {
+    if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
+    {
+      list = sfcd_get_uris (sfcd, &error);
+
+      for (iter = list; iter && wanted->len < SANDBOXUTILS_THUMBNAILS_MAX_FILES; iter = iter->next)
+        g_ptr_array_add (wanted, g_strdup (iter->data));
+
+      g_slist_free_full (list, g_free);
+    }
+    _sfcd_dbus_wrapper_lookup_finished (invocation, sfcd, dialog_id);
+
+    if (!sfcd)
+    {
+      g_ptr_array_unref (wanted);
+      return TRUE;
+    }
+  }
+  else if (g_strv_length ((gchar **) uris) > SANDBOXUTILS_THUMBNAILS_MAX_FILES)
+  {
+    g_set_error (&error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                 "SfcdDbusWrapper.GetThumbnails: at most %d files may be asked for at once.\n",
+                 SANDBOXUTILS_THUMBNAILS_MAX_FILES);
+  }
+  else if (!sandbox_utils_grants_get_enabled ())
+  {
+    g_set_error (&error,
+                 g_quark_from_static_string (SFCD_ERROR_DOMAIN),
+                 SFCD_ERROR_FORBIDDEN_QUERY,
+                 "SfcdDbusWrapper.GetThumbnails: files can only be asked for by URI when the grant ledger is on.\n");
+  }
+  else
+  {
+    call = g_malloc (sizeof (SfcdDbusWrapperThumbnailsCall));
+    call->interface  = interface;
+    call->invocation = invocation;
+    call->uris       = g_strdupv ((gchar **) uris);
+    call->size       = size;
+
+    // Which process asks is only known from the bus, the call goes on there
+    sandbox_utils_grants_identify (invocation, _sfcd_dbus_wrapper_on_thumbnails_caller, call);
+    g_ptr_array_unref (wanted);
+    return TRUE;
+  }
+
+  if (error)
+  {
+    _sfcd_dbus_wrapper_return_error (invocation, error);
+    g_ptr_array_unref (wanted);
+    return TRUE;
+  }
+
+  g_ptr_array_add (wanted, NULL);
+
+  call = g_malloc (sizeof (SfcdDbusWrapperThumbnailsCall));
+  call->interface  = interface;
+  call->invocation = invocation;
+  call->uris       = NULL;
+  call->size       = size;
+
+  // Answered once all thumbnails are made, the main loop goes on meanwhile
+  sandbox_utils_thumbnail_pack ((const gchar * const *) wanted->pdata, size,
+                                _sfcd_dbus_wrapper_on_thumbnails_packed, call);
+  g_ptr_array_unref (wanted);
 
-    if (!error)
-      sfcd_dbus_wrapper__complete_cancel_run (interface, invocation);
-    else
-      _sfcd_dbus_wrapper_return_error (invocation, error);
+  return TRUE;
+}
+
+/* A CheckGrant call waiting for its caller to be identified */
+typedef struct {
+  SfcdDbusWrapper        *interface;
+  GDBusMethodInvocation  *invocation;
+  guint32                 pid;
+  gchar                  *path;
+} SfcdDbusWrapperCheckGrantCall;
+
+// Processes may only learn about their own grants, or a confined app could
+// find out which files were given to the others. Components outside of
+// sandboxes read the ledger itself.
+static void
+_sfcd_dbus_wrapper_on_check_grant_caller (guint32   pid,
+                                          guint32   uid,
+                                          guint64   start_time,
+                                          GError   *error,
+                                          gpointer  user_data)
+{
+  SfcdDbusWrapperCheckGrantCall *call      = user_data;
+  GError                        *refusal   = NULL;
+  SandboxUtilsLedgerMode         mode      = 0;
+  gint64                         timestamp = 0;
+  gboolean                       granted;
+
+  if (error)
+    refusal = g_error_copy (error);
+  else if (pid != call->pid)
+    g_set_error (&refusal,
+                 g_quark_from_static_string (SFCD_ERROR_DOMAIN),
+                 SFCD_ERROR_FORBIDDEN_QUERY,
+                 "SfcdDbusWrapper.CheckGrant: process %u may not ask about the grants of process %u.\n",
+                 pid, call->pid);
+
+  if (refusal)
+    _sfcd_dbus_wrapper_return_error (call->invocation, refusal);
+  else
+  {
+    granted = sandbox_utils_grants_check_process (pid, start_time, call->path, &mode, &timestamp);
+    sfcd_dbus_wrapper__complete_check_grant (call->interface, call->invocation, granted, mode, timestamp);
   }
-  _sfcd_dbus_wrapper_lookup_finished (invocation, sfcd, dialog_id);
 
-  return TRUE;
+  g_free (call->path);
+  g_free (call);
 }
 
 static gboolean
-on_handle_set_extra_widget (SfcdDbusWrapper        *interface,
-                            GDBusMethodInvocation  *invocation,
-                            const gchar            *dialog_id,
-                            const gulong            widget_id,
-                            gpointer                user_data)
+on_handle_check_grant (SfcdDbusWrapper        *interface,
+                       GDBusMethodInvocation  *invocation,
+                       guint                   pid,
+                       const gchar            *path,
+                       gpointer                user_data)
 {
-  SandboxFileChooserDialog   *sfcd       = NULL;
-  SfcdDbusWrapperInfo        *info       = user_data;
-  SandboxUtilsClient         *cli        = info->client;
-  GError                     *error      = NULL;
+  SfcdDbusWrapperCheckGrantCall *call;
 
-  if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
-  {
-    GtkWidget *widget = NULL;
+  call = g_malloc (sizeof (SfcdDbusWrapperCheckGrantCall));
+  call->interface  = interface;
+  call->invocation = invocation;
+  call->pid        = pid;
+  call->path       = g_strdup (path);
 
-    // There is a plug id, create a socket to embed it
-    if (widget_id != 0)
-    {
-      // Set the extra widget through GtkSocket/GtkPlug
-      widget = gtk_socket_new ();
-      sfcd_set_extra_widget (sfcd, widget, &error);
-      
-      //TODO connect to plug signals?
+  // Which process asks is only known from the bus, the call goes on there
+  sandbox_utils_grants_identify (invocation, _sfcd_dbus_wrapper_on_check_grant_caller, call);
 
-      // Set the remote parent's id to whatever was passed to us
-      gtk_socket_add_id (GTK_SOCKET (widget), widget_id);
-      gtk_widget_show_all (widget);
-    }
-    // Else just unset the widget once and for all
-    else
-    {
-      sfcd_set_extra_widget (sfcd, NULL, &error);
-    }
+  return TRUE;
+}
 
-    if (!error)
-      sfcd_dbus_wrapper__complete_set_extra_widget (interface, invocation);
-    else
-      _sfcd_dbus_wrapper_return_error (invocation, error);
-  }
-  _sfcd_dbus_wrapper_lookup_finished (invocation, sfcd, dialog_id);
+/* A GetSelectionInfo call waiting for its files to be queried */
+typedef struct {
+  SfcdDbusWrapper        *interface;
+  GDBusMethodInvocation  *invocation;
+} SfcdDbusWrapperSelectionInfoCall;
 
-  return TRUE;
+static void
+_sfcd_dbus_wrapper_on_selection_info (GVariant *files,
+                                      gpointer  user_data)
+{
+  SfcdDbusWrapperSelectionInfoCall *call = user_data;
+
+  sfcd_dbus_wrapper__complete_get_selection_info (call->interface, call->invocation, files);
+  g_free (call);
 }
 
 static gboolean
-on_handle_get_extra_widget (SfcdDbusWrapper        *interface,
-                            GDBusMethodInvocation  *invocation,
-                            const gchar            *dialog_id,
-                            gpointer                user_data)
+on_handle_get_selection_info (SfcdDbusWrapper        *interface,
+                              GDBusMethodInvocation  *invocation,
+                              const gchar            *dialog_id,
+                              const gchar            *attributes,
+                              gpointer                user_data)
 {
-  SandboxFileChooserDialog   *sfcd       = NULL;
-  SfcdDbusWrapperInfo        *info       = user_data;
-  SandboxUtilsClient         *cli        = info->client;
-  GError                     *error      = NULL;
+  SandboxFileChooserDialog         *sfcd       = NULL;
+  SandboxUtilsClient               *cli        = _sfcd_dbus_wrapper_get_client (invocation);
+  SfcdDbusWrapperSelectionInfoCall *call;
+  GError                           *error      = NULL;
+  GPtrArray                        *uris;
+  GSList                           *list, *iter;
+
+  uris = g_ptr_array_new_with_free_func (g_free);
 
   if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
   {
-    GtkWidget *widget = sfcd_get_extra_widget (sfcd, &error);
-    gulong widget_id = 0;
-
-    if (widget)
+    if (_sandboxutils_file_info_check_attributes (attributes, &error))
     {
-      if (GTK_IS_SOCKET (widget))
-      {
-        GdkWindow *win = gtk_socket_get_plug_window (GTK_SOCKET (widget));
-        if (win)
-          widget_id = GDK_WINDOW_XID (win);
-      }
-      else
-        syslog (LOG_DEBUG, "SfcdDbusWrapper.Sfcd.OnHandleGetExtraWidget: dialog '%s' does not contain a socket, cannot proceed.\n",
-                dialog_id);
+      list = sfcd_get_uris (sfcd, &error);
+
+      for (iter = list; iter; iter = iter->next)
+        g_ptr_array_add (uris, g_strdup (iter->data));
+
+      g_slist_free_full (list, g_free);
     }
+  }
+  _sfcd_dbus_wrapper_lookup_finished (invocation, sfcd, dialog_id);
 
-    if (!error)
-      sfcd_dbus_wrapper__complete_get_extra_widget (interface, invocation, widget_id);
-    else
+  if (!sfcd || error)
+  {
+    if (error)
       _sfcd_dbus_wrapper_return_error (invocation, error);
+    g_ptr_array_unref (uris);
+    return TRUE;
   }
-  _sfcd_dbus_wrapper_lookup_finished (invocation, sfcd, dialog_id);
+
+  g_ptr_array_add (uris, NULL);
+
+  call = g_malloc (sizeof (SfcdDbusWrapperSelectionInfoCall));
+  call->interface  = interface;
+  call->invocation = invocation;
+
+  // Answered once every file is queried, the main loop goes on meanwhile
+  sandbox_utils_selection_query_info ((const gchar * const *) uris->pdata, attributes,
+                                      _sfcd_dbus_wrapper_on_selection_info, call);
+  g_ptr_array_unref (uris);
 
   return TRUE;
 }
@@ -445,8 +1893,7 @@ on_handle_select_filename (SfcdDbusWrapper        *interface,
                            gpointer                user_data)
 {
   SandboxFileChooserDialog   *sfcd       = NULL;
-  SfcdDbusWrapperInfo        *info       = user_data;
-  SandboxUtilsClient         *cli        = info->client;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
   GError                     *error      = NULL;
 
   if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
@@ -471,8 +1918,7 @@ on_handle_unselect_filename (SfcdDbusWrapper        *interface,
                              gpointer                user_data)
 {
   SandboxFileChooserDialog   *sfcd       = NULL;
-  SfcdDbusWrapperInfo        *info       = user_data;
-  SandboxUtilsClient         *cli        = info->client;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
   GError                     *error      = NULL;
 
   if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
@@ -496,8 +1942,7 @@ on_handle_select_all (SfcdDbusWrapper        *interface,
                       gpointer                user_data)
 {
   SandboxFileChooserDialog   *sfcd       = NULL;
-  SfcdDbusWrapperInfo        *info       = user_data;
-  SandboxUtilsClient         *cli        = info->client;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
   GError                     *error      = NULL;
 
   if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
@@ -521,8 +1966,7 @@ on_handle_unselect_all (SfcdDbusWrapper        *interface,
                         gpointer                user_data)
 {
   SandboxFileChooserDialog   *sfcd       = NULL;
-  SfcdDbusWrapperInfo        *info       = user_data;
-  SandboxUtilsClient         *cli        = info->client;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
   GError                     *error      = NULL;
 
   if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
@@ -547,8 +1991,7 @@ on_handle_select_uri (SfcdDbusWrapper        *interface,
                       gpointer                user_data)
 {
   SandboxFileChooserDialog   *sfcd       = NULL;
-  SfcdDbusWrapperInfo        *info       = user_data;
-  SandboxUtilsClient         *cli        = info->client;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
   GError                     *error      = NULL;
 
   if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
@@ -573,8 +2016,7 @@ on_handle_unselect_uri (SfcdDbusWrapper        *interface,
                         gpointer                user_data)
 {
   SandboxFileChooserDialog   *sfcd       = NULL;
-  SfcdDbusWrapperInfo        *info       = user_data;
-  SandboxUtilsClient         *cli        = info->client;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
   GError                     *error      = NULL;
 
   if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
@@ -599,8 +2041,7 @@ on_handle_set_action (SfcdDbusWrapper        *interface,
                       gpointer                user_data)
 {
   SandboxFileChooserDialog   *sfcd       = NULL;
-  SfcdDbusWrapperInfo        *info       = user_data;
-  SandboxUtilsClient         *cli        = info->client;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
   GError                     *error      = NULL;
 
   if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
@@ -624,8 +2065,7 @@ on_handle_get_action (SfcdDbusWrapper        *interface,
                       gpointer                user_data)
 {
   SandboxFileChooserDialog   *sfcd       = NULL;
-  SfcdDbusWrapperInfo        *info       = user_data;
-  SandboxUtilsClient         *cli        = info->client;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
   GError                     *error      = NULL;
 
   if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
@@ -650,8 +2090,7 @@ on_handle_set_local_only (SfcdDbusWrapper        *interface,
                           gpointer                user_data)
 {
   SandboxFileChooserDialog   *sfcd       = NULL;
-  SfcdDbusWrapperInfo        *info       = user_data;
-  SandboxUtilsClient         *cli        = info->client;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
   GError                     *error      = NULL;
 
   if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
@@ -675,8 +2114,7 @@ on_handle_get_local_only (SfcdDbusWrapper        *interface,
                           gpointer                user_data)
 {
   SandboxFileChooserDialog   *sfcd       = NULL;
-  SfcdDbusWrapperInfo        *info       = user_data;
-  SandboxUtilsClient         *cli        = info->client;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
   GError                     *error      = NULL;
 
   if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
@@ -701,8 +2139,7 @@ on_handle_set_select_multiple (SfcdDbusWrapper        *interface,
                                gpointer                user_data)
 {
   SandboxFileChooserDialog   *sfcd       = NULL;
-  SfcdDbusWrapperInfo        *info       = user_data;
-  SandboxUtilsClient         *cli        = info->client;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
   GError                     *error      = NULL;
 
   if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
@@ -726,8 +2163,7 @@ on_handle_get_select_multiple (SfcdDbusWrapper        *interface,
                                gpointer                user_data)
 {
   SandboxFileChooserDialog   *sfcd       = NULL;
-  SfcdDbusWrapperInfo        *info       = user_data;
-  SandboxUtilsClient         *cli        = info->client;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
   GError                     *error      = NULL;
 
   if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
@@ -752,8 +2188,7 @@ on_handle_set_show_hidden (SfcdDbusWrapper        *interface,
                            gpointer                user_data)
 {
   SandboxFileChooserDialog   *sfcd       = NULL;
-  SfcdDbusWrapperInfo        *info       = user_data;
-  SandboxUtilsClient         *cli        = info->client;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
   GError                     *error      = NULL;
 
   if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
@@ -777,8 +2212,7 @@ on_handle_get_show_hidden (SfcdDbusWrapper        *interface,
                            gpointer                user_data)
 {
   SandboxFileChooserDialog   *sfcd       = NULL;
-  SfcdDbusWrapperInfo        *info       = user_data;
-  SandboxUtilsClient         *cli        = info->client;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
   GError                     *error      = NULL;
 
   if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
@@ -803,8 +2237,7 @@ on_handle_set_do_overwrite_confirmation (SfcdDbusWrapper        *interface,
                                          gpointer                user_data)
 {
   SandboxFileChooserDialog   *sfcd       = NULL;
-  SfcdDbusWrapperInfo        *info       = user_data;
-  SandboxUtilsClient         *cli        = info->client;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
   GError                     *error      = NULL;
 
   if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
@@ -828,8 +2261,7 @@ on_handle_get_do_overwrite_confirmation (SfcdDbusWrapper        *interface,
                                          gpointer                user_data)
 {
   SandboxFileChooserDialog   *sfcd       = NULL;
-  SfcdDbusWrapperInfo        *info       = user_data;
-  SandboxUtilsClient         *cli        = info->client;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
   GError                     *error      = NULL;
 
   if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
@@ -854,8 +2286,7 @@ on_handle_set_create_folders (SfcdDbusWrapper        *interface,
                               gpointer                user_data)
 {
   SandboxFileChooserDialog   *sfcd       = NULL;
-  SfcdDbusWrapperInfo        *info       = user_data;
-  SandboxUtilsClient         *cli        = info->client;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
   GError                     *error      = NULL;
 
   if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
@@ -879,8 +2310,7 @@ on_handle_get_create_folders (SfcdDbusWrapper        *interface,
                               gpointer                user_data)
 {
   SandboxFileChooserDialog   *sfcd       = NULL;
-  SfcdDbusWrapperInfo        *info       = user_data;
-  SandboxUtilsClient         *cli        = info->client;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
   GError                     *error      = NULL;
 
   if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
@@ -905,8 +2335,7 @@ on_handle_set_current_name (SfcdDbusWrapper        *interface,
                            gpointer                user_data)
 {
   SandboxFileChooserDialog   *sfcd       = NULL;
-  SfcdDbusWrapperInfo        *info       = user_data;
-  SandboxUtilsClient         *cli        = info->client;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
   GError                     *error      = NULL;
 
   if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
@@ -931,8 +2360,7 @@ on_handle_set_filename (SfcdDbusWrapper        *interface,
                         gpointer                user_data)
 {
   SandboxFileChooserDialog   *sfcd       = NULL;
-  SfcdDbusWrapperInfo        *info       = user_data;
-  SandboxUtilsClient         *cli        = info->client;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
   GError                     *error      = NULL;
 
   if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
@@ -957,8 +2385,7 @@ on_handle_set_current_folder (SfcdDbusWrapper        *interface,
                               gpointer                user_data)
 {
   SandboxFileChooserDialog   *sfcd       = NULL;
-  SfcdDbusWrapperInfo        *info       = user_data;
-  SandboxUtilsClient         *cli        = info->client;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
   GError                     *error      = NULL;
 
   if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
@@ -983,8 +2410,7 @@ on_handle_set_uri (SfcdDbusWrapper        *interface,
                    gpointer                user_data)
 {
   SandboxFileChooserDialog   *sfcd       = NULL;
-  SfcdDbusWrapperInfo        *info       = user_data;
-  SandboxUtilsClient         *cli        = info->client;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
   GError                     *error      = NULL;
 
   if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
@@ -1009,8 +2435,7 @@ on_handle_set_current_folder_uri (SfcdDbusWrapper        *interface,
                                   gpointer                user_data)
 {
   SandboxFileChooserDialog   *sfcd       = NULL;
-  SfcdDbusWrapperInfo        *info       = user_data;
-  SandboxUtilsClient         *cli        = info->client;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
   GError                     *error      = NULL;
 
   if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
@@ -1035,8 +2460,7 @@ on_handle_add_shortcut_folder (SfcdDbusWrapper        *interface,
                                gpointer                user_data)
 {
   SandboxFileChooserDialog   *sfcd       = NULL;
-  SfcdDbusWrapperInfo        *info       = user_data;
-  SandboxUtilsClient         *cli        = info->client;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
   GError                     *error      = NULL;
 
   if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
@@ -1061,8 +2485,7 @@ on_handle_remove_shortcut_folder (SfcdDbusWrapper        *interface,
                                   gpointer                user_data)
 {
   SandboxFileChooserDialog   *sfcd       = NULL;
-  SfcdDbusWrapperInfo        *info       = user_data;
-  SandboxUtilsClient         *cli        = info->client;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
   GError                     *error      = NULL;
 
   if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
@@ -1086,8 +2509,7 @@ on_handle_list_shortcut_folders (SfcdDbusWrapper        *interface,
                                  gpointer                user_data)
 {
   SandboxFileChooserDialog   *sfcd       = NULL;
-  SfcdDbusWrapperInfo        *info       = user_data;
-  SandboxUtilsClient         *cli        = info->client;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
   GError                     *error      = NULL;
 
   if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
@@ -1128,8 +2550,7 @@ on_handle_add_shortcut_folder_uri (SfcdDbusWrapper        *interface,
                                    gpointer                user_data)
 {
   SandboxFileChooserDialog   *sfcd       = NULL;
-  SfcdDbusWrapperInfo        *info       = user_data;
-  SandboxUtilsClient         *cli        = info->client;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
   GError                     *error      = NULL;
 
   if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
@@ -1154,8 +2575,7 @@ on_handle_remove_shortcut_folder_uri (SfcdDbusWrapper        *interface,
                                       gpointer                user_data)
 {
   SandboxFileChooserDialog   *sfcd       = NULL;
-  SfcdDbusWrapperInfo        *info       = user_data;
-  SandboxUtilsClient         *cli        = info->client;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
   GError                     *error      = NULL;
 
   if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
@@ -1179,8 +2599,7 @@ on_handle_list_shortcut_folder_uris (SfcdDbusWrapper        *interface,
                                      gpointer                user_data)
 {
   SandboxFileChooserDialog   *sfcd       = NULL;
-  SfcdDbusWrapperInfo        *info       = user_data;
-  SandboxUtilsClient         *cli        = info->client;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
   GError                     *error      = NULL;
 
   if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
@@ -1213,6 +2632,151 @@ on_handle_list_shortcut_folder_uris (SfcdDbusWrapper        *interface,
   return TRUE;
 }
 
+static gboolean
+on_handle_add_filter (SfcdDbusWrapper        *interface,
+                      GDBusMethodInvocation  *invocation,
+                      const gchar            *dialog_id,
+                      const gchar            *name,
+                      const gchar * const    *patterns,
+                      const gchar * const    *mime_types,
+                      gpointer                user_data)
+{
+  SandboxFileChooserDialog   *sfcd       = NULL;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
+  GError                     *error      = NULL;
+
+  if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
+  {
+    sfcd_add_filter (sfcd, name, patterns, mime_types, &error);
+
+    if (!error)
+      sfcd_dbus_wrapper__complete_add_filter (interface, invocation);
+    else
+      _sfcd_dbus_wrapper_return_error (invocation, error);
+  }
+  _sfcd_dbus_wrapper_lookup_finished (invocation, sfcd, dialog_id);
+
+  return TRUE;
+}
+
+static gboolean
+on_handle_remove_filter (SfcdDbusWrapper        *interface,
+                         GDBusMethodInvocation  *invocation,
+                         const gchar            *dialog_id,
+                         const gchar            *name,
+                         gpointer                user_data)
+{
+  SandboxFileChooserDialog   *sfcd       = NULL;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
+  GError                     *error      = NULL;
+
+  if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
+  {
+    sfcd_remove_filter (sfcd, name, &error);
+
+    if (!error)
+      sfcd_dbus_wrapper__complete_remove_filter (interface, invocation);
+    else
+      _sfcd_dbus_wrapper_return_error (invocation, error);
+  }
+  _sfcd_dbus_wrapper_lookup_finished (invocation, sfcd, dialog_id);
+
+  return TRUE;
+}
+
+static gboolean
+on_handle_list_filters (SfcdDbusWrapper        *interface,
+                        GDBusMethodInvocation  *invocation,
+                        const gchar            *dialog_id,
+                        gpointer                user_data)
+{
+  SandboxFileChooserDialog   *sfcd       = NULL;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
+  GError                     *error      = NULL;
+
+  if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
+  {
+    GSList *list = sfcd_list_filters (sfcd, &error);
+
+    if (!error)
+    {
+      // Allocate for the list and a NULL element at the end
+      const gchar **dbus_list = g_malloc (sizeof (gchar *) * (g_slist_length (list) + 1));
+
+      GSList *iter = list;
+      guint32 ind  = 0;
+      while (iter)
+      {
+        dbus_list[ind++] = iter->data;
+        iter = iter->next;
+      }
+      dbus_list[ind] = NULL;
+
+      sfcd_dbus_wrapper__complete_list_filters (interface, invocation, dbus_list);
+      g_free (dbus_list);
+      g_slist_free_full (list, g_free);
+    }
+    else
+      _sfcd_dbus_wrapper_return_error (invocation, error);
+  }
+  _sfcd_dbus_wrapper_lookup_finished (invocation, sfcd, dialog_id);
+
+  return TRUE;
+}
+
+static gboolean
+on_handle_set_filter (SfcdDbusWrapper        *interface,
+                      GDBusMethodInvocation  *invocation,
+                      const gchar            *dialog_id,
+                      const gchar            *name,
+                      gpointer                user_data)
+{
+  SandboxFileChooserDialog   *sfcd       = NULL;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
+  GError                     *error      = NULL;
+
+  if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
+  {
+    sfcd_set_filter (sfcd, name, &error);
+
+    if (!error)
+      sfcd_dbus_wrapper__complete_set_filter (interface, invocation);
+    else
+      _sfcd_dbus_wrapper_return_error (invocation, error);
+  }
+  _sfcd_dbus_wrapper_lookup_finished (invocation, sfcd, dialog_id);
+
+  return TRUE;
+}
+
+static gboolean
+on_handle_get_filter (SfcdDbusWrapper        *interface,
+                      GDBusMethodInvocation  *invocation,
+                      const gchar            *dialog_id,
+                      gpointer                user_data)
+{
+  SandboxFileChooserDialog   *sfcd       = NULL;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
+  GError                     *error      = NULL;
+
+  if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
+  {
+    gchar *name = sfcd_get_filter (sfcd, &error);
+
+    // D-Bus strings cannot be NULL, dialogs without a filter send ""
+    if (!error)
+    {
+      sfcd_dbus_wrapper__complete_get_filter (interface, invocation, name ? name : "");
+      g_free (name);
+    }
+    else
+      _sfcd_dbus_wrapper_return_error (invocation, error);
+  }
+  _sfcd_dbus_wrapper_lookup_finished (invocation, sfcd, dialog_id);
+
+  return TRUE;
+}
+
 static gboolean
 on_handle_get_current_name (SfcdDbusWrapper        *interface,
                             GDBusMethodInvocation  *invocation,
@@ -1220,8 +2784,7 @@ on_handle_get_current_name (SfcdDbusWrapper        *interface,
                             gpointer                user_data)
 {
   SandboxFileChooserDialog   *sfcd       = NULL;
-  SfcdDbusWrapperInfo        *info       = user_data;
-  SandboxUtilsClient         *cli        = info->client;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
   GError                     *error      = NULL;
 
   if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
@@ -1248,8 +2811,7 @@ on_handle_get_filename (SfcdDbusWrapper        *interface,
                         gpointer                user_data)
 {
   SandboxFileChooserDialog   *sfcd       = NULL;
-  SfcdDbusWrapperInfo        *info       = user_data;
-  SandboxUtilsClient         *cli        = info->client;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
   GError                     *error      = NULL;
 
   if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
@@ -1276,8 +2838,7 @@ on_handle_get_filenames (SfcdDbusWrapper        *interface,
                          gpointer                user_data)
 {
   SandboxFileChooserDialog   *sfcd       = NULL;
-  SfcdDbusWrapperInfo        *info       = user_data;
-  SandboxUtilsClient         *cli        = info->client;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
   GError                     *error      = NULL;
 
   if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
@@ -1317,8 +2878,7 @@ on_handle_get_current_folder (SfcdDbusWrapper        *interface,
                               gpointer                user_data)
 {
   SandboxFileChooserDialog   *sfcd       = NULL;
-  SfcdDbusWrapperInfo        *info       = user_data;
-  SandboxUtilsClient         *cli        = info->client;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
   GError                     *error      = NULL;
 
   if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
@@ -1345,8 +2905,7 @@ on_handle_get_uri (SfcdDbusWrapper        *interface,
                    gpointer                user_data)
 {
   SandboxFileChooserDialog   *sfcd       = NULL;
-  SfcdDbusWrapperInfo        *info       = user_data;
-  SandboxUtilsClient         *cli        = info->client;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
   GError                     *error      = NULL;
 
   if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
@@ -1373,8 +2932,7 @@ on_handle_get_uris (SfcdDbusWrapper        *interface,
                     gpointer                user_data)
 {
   SandboxFileChooserDialog   *sfcd       = NULL;
-  SfcdDbusWrapperInfo        *info       = user_data;
-  SandboxUtilsClient         *cli        = info->client;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
   GError                     *error      = NULL;
 
   if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
@@ -1414,8 +2972,7 @@ on_handle_get_current_folder_uri (SfcdDbusWrapper        *interface,
                                   gpointer                user_data)
 {
   SandboxFileChooserDialog   *sfcd       = NULL;
-  SfcdDbusWrapperInfo        *info       = user_data;
-  SandboxUtilsClient         *cli        = info->client;
+  SandboxUtilsClient         *cli        = _sfcd_dbus_wrapper_get_client (invocation);
   GError                     *error      = NULL;
 
   if ((sfcd = _sfcd_dbus_wrapper_lookup (cli, dialog_id)) != NULL)
@@ -1443,20 +3000,52 @@ sfcd_dbus_on_bus_acquired (GDBusConnection *connection,
   SfcdDbusWrapperInfo *info  = user_data;
   GError              *error = NULL;
 
-  // TODO replace __get_client by something remotely related to DBus authentication
-
   info->interface = sfcd_dbus_wrapper__skeleton_new ();
 
+  // Clients are known by their unique name, forget them once it goes away
+  info->connection = g_object_ref (connection);
+  info->owner_watch_id = g_dbus_connection_signal_subscribe (connection,
+                                                             "org.freedesktop.DBus",
+                                                             "org.freedesktop.DBus",
+                                                             "NameOwnerChanged",
+                                                             "/org/freedesktop/DBus",
+                                                             NULL,
+                                                             G_DBUS_SIGNAL_FLAGS_NONE,
+                                                             on_name_owner_changed,
+                                                             info,
+                                                             NULL);
+
+  // Record client calls if asked to, before any call can reach us
+  sandbox_utils_recorder_attach (connection);
+
+  g_signal_connect (info->interface, "g-authorize-method", G_CALLBACK (on_authorize_method), info);
+
+  // Must come before the handlers so that calls go through the scheduler first
+  _sfcd_dbus_wrapper_connect_scheduler (info);
+
   g_signal_connect (info->interface, "handle-new", G_CALLBACK (on_handle_new), info);
+  g_signal_connect (info->interface, "handle-register-template", G_CALLBACK (on_handle_register_template), info);
+  g_signal_connect (info->interface, "handle-new-from-template", G_CALLBACK (on_handle_new_from_template), info);
+  g_signal_connect (info->interface, "handle-unregister-template", G_CALLBACK (on_handle_unregister_template), info);
   g_signal_connect (info->interface, "handle-destroy", G_CALLBACK (on_handle_destroy), info);
   g_signal_connect (info->interface, "handle-get-state", G_CALLBACK (on_handle_get_state), info);
   g_signal_connect (info->interface, "handle-run", G_CALLBACK (on_handle_run), info);
   g_signal_connect (info->interface, "handle-present", G_CALLBACK (on_handle_present), info);
   g_signal_connect (info->interface, "handle-cancel-run", G_CALLBACK (on_handle_cancel_run), info);
+  g_signal_connect (info->interface, "handle-reset", G_CALLBACK (on_handle_reset), info);
   g_signal_connect (info->interface, "handle-set-extra-widget", G_CALLBACK (on_handle_set_extra_widget), info);
   g_signal_connect (info->interface, "handle-get-extra-widget", G_CALLBACK (on_handle_get_extra_widget), info);
+  g_signal_connect (info->interface, "handle-set-choices", G_CALLBACK (on_handle_set_choices), info);
+  g_signal_connect (info->interface, "handle-get-choice-values", G_CALLBACK (on_handle_get_choice_values), info);
+  g_signal_connect (info->interface, "handle-set-preview-buffer", G_CALLBACK (on_handle_set_preview_buffer), info);
+  g_signal_connect (info->interface, "handle-unset-preview-buffer", G_CALLBACK (on_handle_unset_preview_buffer), info);
+  g_signal_connect (info->interface, "handle-open-preview-file", G_CALLBACK (on_handle_open_preview_file), info);
+  g_signal_connect (info->interface, "handle-preview-damage", G_CALLBACK (on_handle_preview_damage), info);
+  g_signal_connect (info->interface, "handle-get-thumbnails", G_CALLBACK (on_handle_get_thumbnails), info);
+  g_signal_connect (info->interface, "handle-get-selection-info", G_CALLBACK (on_handle_get_selection_info), info);
+  g_signal_connect (info->interface, "handle-check-grant", G_CALLBACK (on_handle_check_grant), info);
   g_signal_connect (info->interface, "handle-select-filename", G_CALLBACK (on_handle_select_filename), info);
-  g_signal_connect (info->interface, "handle-select-filename", G_CALLBACK (on_handle_unselect_filename), info);
+  g_signal_connect (info->interface, "handle-unselect-filename", G_CALLBACK (on_handle_unselect_filename), info);
   g_signal_connect (info->interface, "handle-select-all", G_CALLBACK (on_handle_select_all), info);
   g_signal_connect (info->interface, "handle-unselect-all", G_CALLBACK (on_handle_unselect_all), info);
   g_signal_connect (info->interface, "handle-select-uri", G_CALLBACK (on_handle_select_uri), info);
@@ -1484,6 +3073,11 @@ sfcd_dbus_on_bus_acquired (GDBusConnection *connection,
   g_signal_connect (info->interface, "handle-add-shortcut-folder-uri", G_CALLBACK (on_handle_add_shortcut_folder_uri), info);
   g_signal_connect (info->interface, "handle-remove-shortcut-folder-uri", G_CALLBACK (on_handle_remove_shortcut_folder_uri), info);
   g_signal_connect (info->interface, "handle-list-shortcut-folder-uris", G_CALLBACK (on_handle_list_shortcut_folder_uris), info);
+  g_signal_connect (info->interface, "handle-add-filter", G_CALLBACK (on_handle_add_filter), info);
+  g_signal_connect (info->interface, "handle-remove-filter", G_CALLBACK (on_handle_remove_filter), info);
+  g_signal_connect (info->interface, "handle-list-filters", G_CALLBACK (on_handle_list_filters), info);
+  g_signal_connect (info->interface, "handle-set-filter", G_CALLBACK (on_handle_set_filter), info);
+  g_signal_connect (info->interface, "handle-get-filter", G_CALLBACK (on_handle_get_filter), info);
   g_signal_connect (info->interface, "handle-get-current-name", G_CALLBACK (on_handle_get_current_name), info);
   g_signal_connect (info->interface, "handle-get-filename", G_CALLBACK (on_handle_get_filename), info);
   g_signal_connect (info->interface, "handle-get-filenames", G_CALLBACK (on_handle_get_filenames), info);
@@ -1530,7 +3124,8 @@ sfcd_dbus_info_new ()
 
   i->owner_id  = 0;
   i->interface = NULL;
-  i->client = NULL;
+  i->connection = NULL;
+  i->owner_watch_id = 0;
 
   return i;
 }
@@ -1554,8 +3149,6 @@ sfcd_dbus_wrapper_dbus_init ()
                                    sfcd_dbus_wrapper_dbus_shutdown);
 
   g_assert (info->owner_id != 0);
-  
-  info->client = _get_client ();
 
   return info;
 }
@@ -1571,7 +3164,11 @@ sfcd_dbus_wrapper_dbus_shutdown (gpointer data)
   g_object_unref (info->interface);
   
   //TODO notify client of interface shutdown
-  info->client = NULL;
+  if (info->connection)
+  {
+    g_dbus_connection_signal_unsubscribe (info->connection, info->owner_watch_id);
+    g_object_unref (info->connection);
+  }
 
   g_free (info);
 }
@@ -21,12 +21,16 @@
 typedef struct {
   guint                  owner_id;
   SfcdDbusWrapper       *interface;
-  SandboxUtilsClient    *client;
+  GDBusConnection       *connection;
+  guint                  owner_watch_id;  /* NameOwnerChanged subscription */
 } SfcdDbusWrapperInfo;
 
 
 //TODO move to sandboxutilsdbus.h
 
+GOptionGroup *
+sfcd_dbus_wrapper_get_option_group ();
+
 SfcdDbusWrapperInfo *
 sfcd_dbus_wrapper_dbus_init ();
 
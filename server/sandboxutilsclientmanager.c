@@ -10,66 +10,623 @@
  * 
  */
 #include <string.h>
+#include <syslog.h>
 
 #include "sandboxutilsclientmanager.h"
+#include "localfilechooserdialog.h"
 
 //TODO connect/disconnect methods where a client introduces themselves by giving
 // access to their STDOUT and STDERR fds. Later we'll use that to help them log
 // what happens to their calls to sandboxutilsd.
 
+static gint _option_max_dialogs    = 32;
+static gint _option_max_runs       = 4;
+static gint _option_max_in_flight  = 16;
+static gint _option_max_templates  = 16;
+static gint _option_rates[SANDBOX_UTILS_CALL_LAST] = {5, 20, 200, 400};
+
+static GOptionEntry entries[] =
+{
+  {
+    "client-max-dialogs", 0, 0, G_OPTION_ARG_INT, &_option_max_dialogs,
+    "Maximum number of live dialogs per client (0 for unlimited)", "N"
+  },
+  {
+    "client-max-runs", 0, 0, G_OPTION_ARG_INT, &_option_max_runs,
+    "Maximum number of dialogs a client may run at the same time (0 for unlimited)", "N"
+  },
+  {
+    "client-max-in-flight", 0, 0, G_OPTION_ARG_INT, &_option_max_in_flight,
+    "Maximum number of calls per client being processed at the same time (0 for unlimited)", "N"
+  },
+  {
+    "client-max-templates", 0, 0, G_OPTION_ARG_INT, &_option_max_templates,
+    "Maximum number of dialog templates per client (0 for unlimited)", "N"
+  },
+  {
+    "client-lifecycle-rate", 0, 0, G_OPTION_ARG_INT, &_option_rates[SANDBOX_UTILS_CALL_LIFECYCLE],
+    "Dialog creations and destructions allowed per second and per client (0 for unlimited)", "N"
+  },
+  {
+    "client-interactive-rate", 0, 0, G_OPTION_ARG_INT, &_option_rates[SANDBOX_UTILS_CALL_INTERACTIVE],
+    "Run, Present and CancelRun calls allowed per second and per client (0 for unlimited)", "N"
+  },
+  {
+    "client-config-rate", 0, 0, G_OPTION_ARG_INT, &_option_rates[SANDBOX_UTILS_CALL_CONFIG],
+    "Configuration calls allowed per second and per client (0 for unlimited)", "N"
+  },
+  {
+    "client-retrieval-rate", 0, 0, G_OPTION_ARG_INT, &_option_rates[SANDBOX_UTILS_CALL_RETRIEVAL],
+    "Data retrieval calls allowed per second and per client (0 for unlimited)", "N"
+  },
+  {
+    NULL, ' ', 0, 0, NULL,
+    NULL, NULL
+  }
+};
+
+GOptionGroup *
+sandbox_utils_client_get_option_group ()
+{
+  GOptionGroup *group;
+
+  group = g_option_group_new ("client", "Per-client Limits", "Show per-client limits options", NULL, NULL);
+
+  g_option_group_add_entries (group, entries);
+  g_option_group_set_translation_domain (group, NULL);
+
+  return group;
+}
+
+// Clients by the unique bus name they call from, touched by GDBus worker threads
+static GHashTable *_clients     = NULL;
+static GMutex      _clientsLock;
+
 static SandboxUtilsClient *
-sandbox_utils_client_new ()
+sandbox_utils_client_new (const gchar *sender)
 {
   SandboxUtilsClient *cli = g_malloc (sizeof (SandboxUtilsClient));
+  guint               i;
   memset (cli, 0, sizeof (SandboxUtilsClient));
 
+  cli->sender   = g_strdup (sender);
+  cli->refCount = 1;
+
   cli->dialogs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  cli->abandoned = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  cli->unconfirmed = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  cli->templates = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, sandbox_utils_template_unref);
   g_mutex_init (&cli->dialogsMutex);
 
+  cli->templateLimits = MAX (_option_max_templates, 0);
+  cli->ownLimits      = MAX (_option_max_dialogs, 0);
+  cli->runLimits      = MAX (_option_max_runs, 0);
+  cli->inFlightLimits = MAX (_option_max_in_flight, 0);
+
+  // Buckets start full so that a freshly started client is not penalised
+  for (i = 0; i < SANDBOX_UTILS_CALL_LAST; i++)
+  {
+    cli->buckets[i].rate       = MAX (_option_rates[i], 0);
+    cli->buckets[i].burst      = cli->buckets[i].rate * 2;
+    cli->buckets[i].tokens     = cli->buckets[i].burst;
+    cli->buckets[i].lastRefill = g_get_monotonic_time ();
+  }
+
+  g_mutex_init (&cli->limitsMutex);
+
   return cli;
 }
 
 static void
 sandbox_utils_client_destroy (SandboxUtilsClient *cli)
 {
-  //TODO verify the client was disconnected properly
+  syslog (LOG_INFO,
+          "SandboxUtilsClient.Destroy: %s: limit hits: %u %s, %u %s, %u %s, %u %s, %u %s.\n",
+          cli->sender,
+          cli->limitHits[SANDBOX_UTILS_LIMIT_DIALOGS], SandboxUtilsLimitPrintable[SANDBOX_UTILS_LIMIT_DIALOGS],
+          cli->limitHits[SANDBOX_UTILS_LIMIT_RUNS], SandboxUtilsLimitPrintable[SANDBOX_UTILS_LIMIT_RUNS],
+          cli->limitHits[SANDBOX_UTILS_LIMIT_RATE], SandboxUtilsLimitPrintable[SANDBOX_UTILS_LIMIT_RATE],
+          cli->limitHits[SANDBOX_UTILS_LIMIT_IN_FLIGHT], SandboxUtilsLimitPrintable[SANDBOX_UTILS_LIMIT_IN_FLIGHT],
+          cli->limitHits[SANDBOX_UTILS_LIMIT_TEMPLATES], SandboxUtilsLimitPrintable[SANDBOX_UTILS_LIMIT_TEMPLATES]);
 
+  g_mutex_clear (&cli->limitsMutex);
   g_mutex_clear (&cli->dialogsMutex);
 
   if (cli->dialogs)
     g_hash_table_unref (cli->dialogs);
 
+  if (cli->abandoned)
+    g_hash_table_unref (cli->abandoned);
+
+  if (cli->unconfirmed)
+    g_hash_table_unref (cli->unconfirmed);
+
+  if (cli->templates)
+    g_hash_table_unref (cli->templates);
+
+  g_free (cli->sender);
   g_free (cli);
 }
 
 
-static SandboxUtilsClient **
-__get_client ()
+SandboxUtilsClient *
+sandbox_utils_client_ref (SandboxUtilsClient *cli)
 {
-  static SandboxUtilsClient *cli = NULL;
+  g_return_val_if_fail (cli != NULL, NULL);
+
+  g_atomic_int_inc (&cli->refCount);
+
+  return cli;
+}
+
+void
+sandbox_utils_client_unref (gpointer data)
+{
+  SandboxUtilsClient *cli = data;
+
+  g_return_if_fail (cli != NULL);
+
+  if (g_atomic_int_dec_and_test (&cli->refCount))
+    sandbox_utils_client_destroy (cli);
+}
+
+/*
+ * Returns a new reference to the client calling from the bus name @sender,
+ * which is created on its first call. Limits are enforced per client, so that
+ * an app that floods the server only ever locks itself out.
+ */
+SandboxUtilsClient *
+sandbox_utils_client_lookup (const gchar *sender)
+{
+  SandboxUtilsClient *cli;
+
+  // Peer-to-peer connections have no bus name, they are a single client
+  if (!sender)
+    sender = "";
+
+  g_mutex_lock (&_clientsLock);
+
+  if (!_clients)
+    _clients = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, sandbox_utils_client_unref);
 
-  return &cli;
+  if ((cli = g_hash_table_lookup (_clients, sender)) == NULL)
+  {
+    cli = sandbox_utils_client_new (sender);
+    g_hash_table_insert (_clients, cli->sender, cli);
+  }
+
+  sandbox_utils_client_ref (cli);
+
+  g_mutex_unlock (&_clientsLock);
+
+  return cli;
 }
 
+/*
+ * Forgets the client calling from @sender, after it left the bus. Returns the
+ * reference the table held, for the caller to release the client's dialogs
+ * and drop, or %NULL if the client never called.
+ */
 SandboxUtilsClient *
-_get_client ()
+sandbox_utils_client_remove (const gchar *sender)
+{
+  SandboxUtilsClient *cli = NULL;
+
+  g_return_val_if_fail (sender != NULL, NULL);
+
+  g_mutex_lock (&_clientsLock);
+  if (_clients && (cli = g_hash_table_lookup (_clients, sender)) != NULL)
+    g_hash_table_steal (_clients, sender);
+  g_mutex_unlock (&_clientsLock);
+
+  return cli;
+}
+
+/*
+ * Forgets all clients, when the server stops.
+ */
+void
+sandbox_utils_client_remove_all ()
+{
+  g_mutex_lock (&_clientsLock);
+  if (_clients)
+    g_hash_table_unref (_clients);
+  _clients = NULL;
+  g_mutex_unlock (&_clientsLock);
+}
+
+/*
+ * Returns new references to all the clients, in a list to free with
+ * g_list_free_full() and sandbox_utils_client_unref().
+ */
+GList *
+sandbox_utils_client_list ()
+{
+  GList *clients = NULL;
+
+  g_mutex_lock (&_clientsLock);
+  if (_clients)
+    clients = g_hash_table_get_values (_clients);
+  g_list_foreach (clients, (GFunc) sandbox_utils_client_ref, NULL);
+  g_mutex_unlock (&_clientsLock);
+
+  return clients;
+}
+
+/*
+ * Tells whether the client may create one more dialog. Called before creating
+ * the dialog, so that a misbehaving client cannot make us allocate widgets.
+ */
+gboolean
+sandbox_utils_client_can_own_dialog (SandboxUtilsClient *cli)
+{
+  gboolean allowed;
+
+  g_return_val_if_fail (cli != NULL, FALSE);
+
+  g_mutex_lock (&cli->dialogsMutex);
+  allowed = cli->ownLimits == 0 || g_hash_table_size (cli->dialogs) < cli->ownLimits;
+  g_mutex_unlock (&cli->dialogsMutex);
+
+  if (!allowed)
+    sandbox_utils_client_record_hit (cli, SANDBOX_UTILS_LIMIT_DIALOGS);
+
+  return allowed;
+}
+
+/*
+ * Tells whether the client may run one more dialog. The number of running
+ * dialogs is computed on demand since it is bounded by ownLimits anyway, and
+ * this spares us from tracking every way a dialog can stop running.
+ */
+gboolean
+sandbox_utils_client_can_run_dialog (SandboxUtilsClient *cli)
+{
+  GHashTableIter  iter;
+  gpointer        value;
+  guint32         running = 0;
+  gboolean        allowed;
+
+  g_return_val_if_fail (cli != NULL, FALSE);
+
+  if (cli->runLimits == 0)
+    return TRUE;
+
+  g_mutex_lock (&cli->dialogsMutex);
+  g_hash_table_iter_init (&iter, cli->dialogs);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    if (sfcd_is_running (value))
+      running++;
+  g_mutex_unlock (&cli->dialogsMutex);
+
+  allowed = running < cli->runLimits;
+
+  if (!allowed)
+    sandbox_utils_client_record_hit (cli, SANDBOX_UTILS_LIMIT_RUNS);
+
+  return allowed;
+}
+
+/*
+ * Takes a token from the bucket of @klass, after refilling it for the time
+ * elapsed since the last call. Returns %FALSE if the bucket is empty.
+ */
+gboolean
+sandbox_utils_client_consume_token (SandboxUtilsClient    *cli,
+                                    SandboxUtilsCallClass  klass)
+{
+  SandboxUtilsTokenBucket *bucket;
+  gint64                   now;
+  gboolean                 allowed = TRUE;
+
+  g_return_val_if_fail (cli != NULL, FALSE);
+  g_return_val_if_fail (klass < SANDBOX_UTILS_CALL_LAST, FALSE);
+
+  g_mutex_lock (&cli->limitsMutex);
+  bucket = &cli->buckets[klass];
+
+  if (bucket->rate > 0)
+  {
+    now = g_get_monotonic_time ();
+    bucket->tokens = MIN (bucket->burst,
+                          bucket->tokens + bucket->rate * (now - bucket->lastRefill) / G_TIME_SPAN_SECOND);
+    bucket->lastRefill = now;
+
+    if (bucket->tokens >= 1)
+      bucket->tokens -= 1;
+    else
+    {
+      allowed = FALSE;
+      cli->limitHits[SANDBOX_UTILS_LIMIT_RATE]++;
+    }
+  }
+
+  g_mutex_unlock (&cli->limitsMutex);
+
+  return allowed;
+}
+
+/*
+ * Gives back the token taken for a call that was rejected for another reason,
+ * so that calls the server never processed do not count against the client.
+ */
+void
+sandbox_utils_client_refund_token (SandboxUtilsClient    *cli,
+                                   SandboxUtilsCallClass  klass)
+{
+  SandboxUtilsTokenBucket *bucket;
+
+  g_return_if_fail (cli != NULL);
+  g_return_if_fail (klass < SANDBOX_UTILS_CALL_LAST);
+
+  g_mutex_lock (&cli->limitsMutex);
+  bucket = &cli->buckets[klass];
+  if (bucket->rate > 0)
+    bucket->tokens = MIN (bucket->burst, bucket->tokens + 1);
+  g_mutex_unlock (&cli->limitsMutex);
+}
+
+/*
+ * Reserves an in-flight slot for a call that is about to be dispatched.
+ * Called from GDBus worker threads, which are shared by all clients, so calls
+ * are rejected right away when all slots are taken rather than waiting for
+ * one and holding back the messages of other clients.
+ */
+gboolean
+sandbox_utils_client_begin_call (SandboxUtilsClient *cli)
+{
+  gboolean allowed;
+
+  g_return_val_if_fail (cli != NULL, FALSE);
+
+  g_mutex_lock (&cli->limitsMutex);
+
+  allowed = cli->inFlightLimits == 0 || cli->inFlight < cli->inFlightLimits;
+
+  if (allowed)
+    cli->inFlight++;
+  else
+    cli->limitHits[SANDBOX_UTILS_LIMIT_IN_FLIGHT]++;
+
+  g_mutex_unlock (&cli->limitsMutex);
+
+  return allowed;
+}
+
+/*
+ * Releases an in-flight slot reserved with sandbox_utils_client_begin_call().
+ */
+void
+sandbox_utils_client_end_call (SandboxUtilsClient *cli)
+{
+  g_return_if_fail (cli != NULL);
+
+  g_mutex_lock (&cli->limitsMutex);
+  if (cli->inFlight > 0)
+    cli->inFlight--;
+  g_mutex_unlock (&cli->limitsMutex);
+}
+
+void
+sandbox_utils_client_record_hit (SandboxUtilsClient *cli,
+                                 SandboxUtilsLimit   limit)
+{
+  g_return_if_fail (cli != NULL);
+  g_return_if_fail (limit < SANDBOX_UTILS_LIMIT_LAST);
+
+  g_mutex_lock (&cli->limitsMutex);
+  cli->limitHits[limit]++;
+  g_mutex_unlock (&cli->limitsMutex);
+}
+
+guint32
+sandbox_utils_client_get_hits (SandboxUtilsClient *cli,
+                               SandboxUtilsLimit   limit)
+{
+  guint32 hits;
+
+  g_return_val_if_fail (cli != NULL, 0);
+  g_return_val_if_fail (limit < SANDBOX_UTILS_LIMIT_LAST, 0);
+
+  g_mutex_lock (&cli->limitsMutex);
+  hits = cli->limitHits[limit];
+  g_mutex_unlock (&cli->limitsMutex);
+
+  return hits;
+}
+
+/*
+ * Destroys the widgets of the dialogs of all clients that are being
+ * configured, to be rebuilt when next used. Returns how many dialogs were
+ * hibernated. Meant to be registered as a shrinker, see sandboxutilsmemory.h.
+ */
+guint
+sandbox_utils_client_hibernate_dialogs (gpointer data)
+{
+  SandboxUtilsClient *cli;
+  GList              *clients   = sandbox_utils_client_list ();
+  GList              *dialogs   = NULL;
+  GList              *some;
+  GList              *iter;
+  guint               hibernated = 0;
+
+  // Hibernating takes each dialog's lock, so do not hold the tables meanwhile
+  for (iter = clients; iter; iter = iter->next)
+  {
+    cli = iter->data;
+
+    g_mutex_lock (&cli->dialogsMutex);
+    some = g_hash_table_get_values (cli->dialogs);
+    g_list_foreach (some, (GFunc) g_object_ref, NULL);
+    g_mutex_unlock (&cli->dialogsMutex);
+
+    dialogs = g_list_concat (some, dialogs);
+  }
+
+  g_list_free_full (clients, sandbox_utils_client_unref);
+
+  for (iter = dialogs; iter; iter = iter->next)
+  {
+    if (LOCAL_IS_FILE_CHOOSER_DIALOG (iter->data) && lfcd_hibernate (iter->data))
+      hibernated++;
+  }
+
+  g_list_free_full (dialogs, g_object_unref);
+
+  return hibernated;
+}
+
+/*
+ * Remembers that the client gave up on the calls it made for @dialog_id
+ * before the AbandonCalls call of serial @serial, because they were cancelled
+ * or timed out on its side. Serials grow with each message of a connection,
+ * so they tell what was sent first however calls reach the main loop. An
+ * empty @dialog_id stands for calls that create dialogs. Ids of dialogs the
+ * client does not own are ignored, so that it cannot make the table grow.
+ *
+ * Returns the ids of the dialogs created before that the client never named
+ * in a call since, and so never learned about, for the caller to destroy.
+ */
+GList *
+sandbox_utils_client_abandon_calls (SandboxUtilsClient *cli,
+                                    const gchar        *dialog_id,
+                                    guint32             serial)
+{
+  GHashTableIter  iter;
+  GList          *orphans = NULL;
+  gpointer        key;
+  gpointer        value;
+
+  g_return_val_if_fail (cli != NULL, NULL);
+  g_return_val_if_fail (dialog_id != NULL, NULL);
+
+  g_mutex_lock (&cli->dialogsMutex);
+  if (dialog_id[0] == '\0' || g_hash_table_contains (cli->dialogs, dialog_id))
+    g_hash_table_insert (cli->abandoned,
+                         g_strdup (dialog_id),
+                         GUINT_TO_POINTER (serial));
+
+  if (dialog_id[0] == '\0')
+  {
+    g_hash_table_iter_init (&iter, cli->unconfirmed);
+    while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      if (GPOINTER_TO_UINT (value) < serial)
+      {
+        orphans = g_list_prepend (orphans, g_strdup (key));
+        g_hash_table_iter_remove (&iter);
+      }
+    }
+  }
+  g_mutex_unlock (&cli->dialogsMutex);
+
+  return orphans;
+}
+
+/*
+ * Tells whether a call for @dialog_id of serial @serial was given up on by
+ * the client since.
+ */
+gboolean
+sandbox_utils_client_is_abandoned (SandboxUtilsClient *cli,
+                                   const gchar        *dialog_id,
+                                   guint32             serial)
 {
-  SandboxUtilsClient **cli = __get_client ();
+  gpointer  when;
+  gboolean  abandoned;
 
-  if (!*cli)
-    *cli = sandbox_utils_client_new ();
+  g_return_val_if_fail (cli != NULL, FALSE);
+  g_return_val_if_fail (dialog_id != NULL, FALSE);
 
-  return *cli;
+  g_mutex_lock (&cli->dialogsMutex);
+  abandoned = g_hash_table_lookup_extended (cli->abandoned, dialog_id, NULL, &when) &&
+              serial < GPOINTER_TO_UINT (when);
+  g_mutex_unlock (&cli->dialogsMutex);
+
+  return abandoned;
 }
 
+/*
+ * Remembers that the client knows about @dialog_id, as it named it in a call.
+ */
 void
-_reset_client ()
+sandbox_utils_client_confirm_dialog (SandboxUtilsClient *cli,
+                                     const gchar        *dialog_id)
 {
-  SandboxUtilsClient **cli = __get_client ();
+  g_return_if_fail (cli != NULL);
+  g_return_if_fail (dialog_id != NULL);
 
-  if (*cli)
+  g_mutex_lock (&cli->dialogsMutex);
+  g_hash_table_remove (cli->unconfirmed, dialog_id);
+  g_mutex_unlock (&cli->dialogsMutex);
+}
+
+/*
+ * Stores @tmpl, taking over the caller's reference, and returns its new id.
+ * Returns %NULL and drops @tmpl if the client has too many templates already.
+ */
+gchar *
+sandbox_utils_client_add_template (SandboxUtilsClient   *cli,
+                                   SandboxUtilsTemplate *tmpl)
+{
+  gchar *template_id = NULL;
+
+  g_return_val_if_fail (cli != NULL, NULL);
+  g_return_val_if_fail (tmpl != NULL, NULL);
+
+  g_mutex_lock (&cli->dialogsMutex);
+  if (cli->templateLimits == 0 || g_hash_table_size (cli->templates) < cli->templateLimits)
+  {
+    // Not a dialog id, so that the two are never mistaken for one another
+    template_id = g_strdup_printf ("template-%u", cli->templateCounter++);
+    g_hash_table_insert (cli->templates, g_strdup (template_id), tmpl);
+  }
+  g_mutex_unlock (&cli->dialogsMutex);
+
+  if (!template_id)
   {
-    sandbox_utils_client_destroy (*cli);
-    *cli = NULL;
+    sandbox_utils_client_record_hit (cli, SANDBOX_UTILS_LIMIT_TEMPLATES);
+    sandbox_utils_template_unref (tmpl);
   }
+
+  return template_id;
+}
+
+/*
+ * Returns a new reference to the client's template @template_id, or %NULL.
+ */
+SandboxUtilsTemplate *
+sandbox_utils_client_lookup_template (SandboxUtilsClient *cli,
+                                      const gchar        *template_id)
+{
+  SandboxUtilsTemplate *tmpl;
+
+  g_return_val_if_fail (cli != NULL, NULL);
+
+  g_mutex_lock (&cli->dialogsMutex);
+  tmpl = g_hash_table_lookup (cli->templates, template_id);
+  if (tmpl)
+    sandbox_utils_template_ref (tmpl);
+  g_mutex_unlock (&cli->dialogsMutex);
+
+  return tmpl;
+}
+
+/*
+ * Forgets the client's template @template_id. Dialogs created from it are
+ * left untouched. Returns whether there was such a template.
+ */
+gboolean
+sandbox_utils_client_remove_template (SandboxUtilsClient *cli,
+                                      const gchar        *template_id)
+{
+  gboolean removed;
+
+  g_return_val_if_fail (cli != NULL, FALSE);
+
+  g_mutex_lock (&cli->dialogsMutex);
+  removed = g_hash_table_remove (cli->templates, template_id);
+  g_mutex_unlock (&cli->dialogsMutex);
+
+  return removed;
 }
@@ -18,24 +18,157 @@
 
 #include <gio/gio.h>
 #include "sandboxfilechooserdialog.h"
+#include "sandboxutilstemplate.h"
 
+/* Classes of methods that share a rate limit */
+typedef enum {
+  SANDBOX_UTILS_CALL_LIFECYCLE   = 0, /* New, Destroy, Reset */
+  SANDBOX_UTILS_CALL_INTERACTIVE = 1, /* Run, Present, CancelRun */
+  SANDBOX_UTILS_CALL_CONFIG      = 2, /* Setters, selection, shortcuts */
+  SANDBOX_UTILS_CALL_RETRIEVAL   = 3, /* Getters and lists */
+  SANDBOX_UTILS_CALL_LAST        = 4,
+} SandboxUtilsCallClass;
 
-/* Hello there, client */
+static const
+gchar *SandboxUtilsCallClassPrintable[5] = {"lifecycle",
+                                            "interactive",
+                                            "configuration",
+                                            "retrieval",
+                                            NULL};
+
+/* Limits enforced on each client, and for which hits are counted */
+typedef enum {
+  SANDBOX_UTILS_LIMIT_DIALOGS    = 0, /* Live dialogs owned by the client */
+  SANDBOX_UTILS_LIMIT_RUNS       = 1, /* Dialogs running at the same time */
+  SANDBOX_UTILS_LIMIT_RATE       = 2, /* Token bucket of a method class */
+  SANDBOX_UTILS_LIMIT_IN_FLIGHT  = 3, /* Calls accepted but not answered yet */
+  SANDBOX_UTILS_LIMIT_TEMPLATES  = 4, /* Dialog templates registered by the client */
+  SANDBOX_UTILS_LIMIT_LAST       = 5,
+} SandboxUtilsLimit;
+
+static const
+gchar *SandboxUtilsLimitPrintable[6] = {"live dialogs",
+                                        "concurrent runs",
+                                        "call rate",
+                                        "in-flight calls",
+                                        "templates",
+                                        NULL};
+
+/* Token bucket, refilled lazily whenever a token is requested */
+typedef struct _SandboxUtilsTokenBucket
+{
+  gdouble                rate;      /* tokens per second, 0 for unlimited */
+  gdouble                burst;     /* bucket capacity */
+  gdouble                tokens;
+  gint64                 lastRefill;
+} SandboxUtilsTokenBucket;
+
+/* Hello there, client. One per unique bus name calling the server. */
 typedef struct _SandboxUtilsClient
 {
+  gchar                 *sender;    /* unique bus name, "" for peer-to-peer */
+  gint                   refCount;  /* atomic */
   GHashTable            *dialogs;
-  const guint32          ownLimits;
-  const guint32          runLimits;
+  GHashTable            *abandoned; /* dialog id -> serial of last AbandonCalls */
+  GHashTable            *unconfirmed; /* dialog id -> serial of the call that
+                                         created it, until the client names it */
+  GHashTable            *templates; /* template id -> SandboxUtilsTemplate */
+  guint32                templateLimits;
+  guint32                templateCounter;
+  guint32                ownLimits;
+  guint32                runLimits;
   GMutex                 dialogsMutex;
+
+  /* Protected by limitsMutex, accessed from GDBus worker threads */
+  guint32                inFlightLimits;
+  guint32                inFlight;
+  SandboxUtilsTokenBucket buckets[SANDBOX_UTILS_CALL_LAST];
+  guint32                limitHits[SANDBOX_UTILS_LIMIT_LAST];
+  GMutex                 limitsMutex;
+
+  /* Main loop only, managed by the scheduler */
+  GQueue                 pending[SANDBOX_UTILS_CALL_LAST];
+  guint                  deficit[SANDBOX_UTILS_CALL_LAST];
 } SandboxUtilsClient;
 
 
-// Temporary client -- later we'll use a hash table based on client IDs
 SandboxUtilsClient *
-_get_client ();
+sandbox_utils_client_ref (SandboxUtilsClient *cli);
+
+void
+sandbox_utils_client_unref (gpointer cli);
+
+SandboxUtilsClient *
+sandbox_utils_client_lookup (const gchar *sender);
+
+SandboxUtilsClient *
+sandbox_utils_client_remove (const gchar *sender);
+
+void
+sandbox_utils_client_remove_all ();
+
+GList *
+sandbox_utils_client_list ();
+
+GOptionGroup *
+sandbox_utils_client_get_option_group ();
+
+gboolean
+sandbox_utils_client_can_own_dialog (SandboxUtilsClient *cli);
+
+gboolean
+sandbox_utils_client_can_run_dialog (SandboxUtilsClient *cli);
+
+gboolean
+sandbox_utils_client_consume_token (SandboxUtilsClient    *cli,
+                                    SandboxUtilsCallClass  klass);
 
 void
-_reset_client ();
+sandbox_utils_client_refund_token (SandboxUtilsClient    *cli,
+                                   SandboxUtilsCallClass  klass);
+
+gboolean
+sandbox_utils_client_begin_call (SandboxUtilsClient *cli);
+
+void
+sandbox_utils_client_end_call (SandboxUtilsClient *cli);
+
+void
+sandbox_utils_client_record_hit (SandboxUtilsClient *cli,
+                                 SandboxUtilsLimit   limit);
+
+guint32
+sandbox_utils_client_get_hits (SandboxUtilsClient *cli,
+                               SandboxUtilsLimit   limit);
+
+guint
+sandbox_utils_client_hibernate_dialogs (gpointer cli);
+
+GList *
+sandbox_utils_client_abandon_calls (SandboxUtilsClient *cli,
+                                    const gchar        *dialog_id,
+                                    guint32             serial);
+
+gboolean
+sandbox_utils_client_is_abandoned (SandboxUtilsClient *cli,
+                                   const gchar        *dialog_id,
+                                   guint32             serial);
+
+void
+sandbox_utils_client_confirm_dialog (SandboxUtilsClient *cli,
+                                     const gchar        *dialog_id);
+
+gchar *
+sandbox_utils_client_add_template (SandboxUtilsClient   *cli,
+                                   SandboxUtilsTemplate *tmpl);
+
+SandboxUtilsTemplate *
+sandbox_utils_client_lookup_template (SandboxUtilsClient *cli,
+                                      const gchar        *template_id);
+
+gboolean
+sandbox_utils_client_remove_template (SandboxUtilsClient *cli,
+                                      const gchar        *template_id);
 
 
 #endif /* #ifndef _SANDBOX_UTILS_CLIENT_H */
@@ -0,0 +1,649 @@
+/* SandboxUtils -- Sandbox Utilities Filename Completion
+ * Copyright (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>, 2014
+ *
+ * Under GPLv3
+ *
+ ***
+ *
+ * Completes file names from an index of known folders. See
+ * sandboxutilscompletion.h.
+ *
+ */
+#include <string.h>
+
+#include "sandboxutilscompletion.h"
+#include "sandboxutilstrace.h"
+
+// Names starting with the typed text always rank before other matches
+#define SANDBOX_UTILS_COMPLETION_PREFIX_SCORE 4000
+#define SANDBOX_UTILS_COMPLETION_FUZZY_SCORE  2000
+
+// Nodes implied by the path of indexed files, but not indexed themselves
+#define SANDBOX_UTILS_COMPLETION_NOT_INDEXED G_MAXUINT
+
+typedef struct _SandboxUtilsCompletionNode SandboxUtilsCompletionNode;
+
+/* A path component. Children are sorted by key, then by name */
+struct _SandboxUtilsCompletionNode
+{
+  gchar                       *name;
+  gchar                       *key;          /* casefolded name, or name itself */
+  SandboxUtilsCompletionNode  *parent;
+  SandboxUtilsCompletionNode **children;
+  guint                        n_children;
+  guint                        index;        /* in _indexed */
+  GFileType                    type;
+  goffset                      size;
+  gint64                       mtime;
+};
+
+/* A candidate being ranked */
+typedef struct {
+  SandboxUtilsCompletionNode *node;
+  gint                        score;
+} SandboxUtilsCompletionMatch;
+
+static SandboxUtilsCompletionNode _root =
+{
+  (gchar *) "", (gchar *) "", NULL, NULL, 0, SANDBOX_UTILS_COMPLETION_NOT_INDEXED, G_FILE_TYPE_DIRECTORY, 0, 0
+};
+
+static GPtrArray *_indexed    = NULL;  /* every indexed node, in no order */
+static guint      _generation = 0;     /* bumped on every change */
+
+// Matches of the last query across all folders, reused when the next query
+// extends it, as long as the index did not change in between
+static gchar     *_last_key        = NULL;
+static GPtrArray *_last_matches    = NULL;
+static guint      _last_generation = 0;
+
+static gchar *
+_sandbox_utils_completion_casefold (gchar *name)
+{
+  gchar *key = g_utf8_casefold (name, -1);
+
+  if (strcmp (key, name) == 0)
+  {
+    g_free (key);
+    return name;
+  }
+
+  return key;
+}
+
+static gint
+_sandbox_utils_completion_compare (const gchar                *key,
+                                   const gchar                *name,
+                                   SandboxUtilsCompletionNode *node)
+{
+  gint result = strcmp (key, node->key);
+
+  return result ? result : strcmp (name, node->name);
+}
+
+/* Position of the first child of @parent not sorting before @key and @name */
+static guint
+_sandbox_utils_completion_lower_bound (SandboxUtilsCompletionNode *parent,
+                                       const gchar                *key,
+                                       const gchar                *name)
+{
+  guint low  = 0;
+  guint high = parent->n_children;
+  guint mid;
+
+  while (low < high)
+  {
+    mid = low + (high - low) / 2;
+    if (_sandbox_utils_completion_compare (key, name, parent->children[mid]) > 0)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+
+  return low;
+}
+
+static SandboxUtilsCompletionNode *
+_sandbox_utils_completion_get_child (SandboxUtilsCompletionNode *parent,
+                                     const gchar                *name,
+                                     gboolean                    create)
+{
+  SandboxUtilsCompletionNode *child;
+  gchar                      *copy;
+  gchar                      *key;
+  guint                       pos;
+
+  copy = g_strdup (name);
+  key  = _sandbox_utils_completion_casefold (copy);
+  pos  = _sandbox_utils_completion_lower_bound (parent, key, name);
+
+  if (pos < parent->n_children && strcmp (parent->children[pos]->name, name) == 0)
+  {
+    child = parent->children[pos];
+  }
+  else if (create)
+  {
+    child = g_malloc0 (sizeof (SandboxUtilsCompletionNode));
+    child->name   = copy;
+    child->key    = key;
+    child->parent = parent;
+    child->index  = SANDBOX_UTILS_COMPLETION_NOT_INDEXED;
+    child->type   = G_FILE_TYPE_DIRECTORY;
+
+    parent->children = g_realloc_n (parent->children, parent->n_children + 1, sizeof (gpointer));
+    memmove (parent->children + pos + 1, parent->children + pos,
+             (parent->n_children - pos) * sizeof (gpointer));
+    parent->children[pos] = child;
+    parent->n_children++;
+
+    return child;
+  }
+  else
+  {
+    child = NULL;
+  }
+
+  if (key != copy)
+    g_free (key);
+  g_free (copy);
+
+  return child;
+}
+
+/* Finds the node of an absolute @path, creating missing ones if asked to */
+static SandboxUtilsCompletionNode *
+_sandbox_utils_completion_lookup (const gchar *path,
+                                  gboolean     create)
+{
+  SandboxUtilsCompletionNode  *node = &_root;
+  gchar                      **components;
+  guint                        i;
+
+  if (!path || !g_path_is_absolute (path))
+    return NULL;
+
+  components = g_strsplit (path, G_DIR_SEPARATOR_S, -1);
+
+  for (i = 0; node && components[i]; i++)
+  {
+    if (components[i][0] == '\0' || strcmp (components[i], ".") == 0)
+      continue;
+
+    if (strcmp (components[i], "..") == 0)
+      node = node->parent ? node->parent : node;
+    else
+      node = _sandbox_utils_completion_get_child (node, components[i], create);
+  }
+
+  g_strfreev (components);
+
+  return node;
+}
+
+static void
+_sandbox_utils_completion_index (SandboxUtilsCompletionNode *node)
+{
+  if (!_indexed)
+    _indexed = g_ptr_array_new ();
+
+  if (node->index == SANDBOX_UTILS_COMPLETION_NOT_INDEXED)
+  {
+    node->index = _indexed->len;
+    g_ptr_array_add (_indexed, node);
+  }
+}
+
+static void
+_sandbox_utils_completion_unindex (SandboxUtilsCompletionNode *node)
+{
+  SandboxUtilsCompletionNode *last;
+
+  if (node->index == SANDBOX_UTILS_COMPLETION_NOT_INDEXED)
+    return;
+
+  // Order does not matter, fill the hole with the last node
+  last = g_ptr_array_index (_indexed, _indexed->len - 1);
+  g_ptr_array_index (_indexed, node->index) = last;
+  last->index = node->index;
+  g_ptr_array_set_size (_indexed, _indexed->len - 1);
+
+  node->index = SANDBOX_UTILS_COMPLETION_NOT_INDEXED;
+}
+
+static void
+_sandbox_utils_completion_free_node (SandboxUtilsCompletionNode *node)
+{
+  guint i;
+
+  for (i = 0; i < node->n_children; i++)
+    _sandbox_utils_completion_free_node (node->children[i]);
+
+  _sandbox_utils_completion_unindex (node);
+
+  if (node->key != node->name)
+    g_free (node->key);
+  g_free (node->name);
+  g_free (node->children);
+  g_free (node);
+}
+
+static void
+_sandbox_utils_completion_detach (SandboxUtilsCompletionNode *node)
+{
+  SandboxUtilsCompletionNode *parent = node->parent;
+  guint                       pos;
+
+  pos = _sandbox_utils_completion_lower_bound (parent, node->key, node->name);
+  g_return_if_fail (pos < parent->n_children && parent->children[pos] == node);
+
+  memmove (parent->children + pos, parent->children + pos + 1,
+           (parent->n_children - pos - 1) * sizeof (gpointer));
+  parent->n_children--;
+}
+
+/* Frees @node and its ancestors while they are neither indexed nor needed */
+static void
+_sandbox_utils_completion_prune (SandboxUtilsCompletionNode *node)
+{
+  SandboxUtilsCompletionNode *parent;
+
+  while (node != &_root &&
+         node->n_children == 0 &&
+         node->index == SANDBOX_UTILS_COMPLETION_NOT_INDEXED)
+  {
+    parent = node->parent;
+    _sandbox_utils_completion_detach (node);
+    _sandbox_utils_completion_free_node (node);
+    node = parent;
+  }
+}
+
+/* Adds or updates a file, whose parent folders need not be indexed */
+void
+sandbox_utils_completion_add (const gchar *path,
+                              GFileType    type,
+                              goffset      size,
+                              gint64       mtime)
+{
+  SandboxUtilsCompletionNode *node;
+
+  node = _sandbox_utils_completion_lookup (path, TRUE);
+  if (!node || node == &_root)
+    return;
+
+  node->type  = type;
+  node->size  = size;
+  node->mtime = mtime;
+
+  _sandbox_utils_completion_index (node);
+  _generation++;
+}
+
+/* Removes a file that no longer exists, along with its children */
+void
+sandbox_utils_completion_remove (const gchar *path)
+{
+  SandboxUtilsCompletionNode *node;
+  SandboxUtilsCompletionNode *parent;
+
+  node = _sandbox_utils_completion_lookup (path, FALSE);
+  if (!node || node == &_root)
+    return;
+
+  parent = node->parent;
+  _sandbox_utils_completion_detach (node);
+  _sandbox_utils_completion_free_node (node);
+  _sandbox_utils_completion_prune (parent);
+
+  _generation++;
+}
+
+/*
+ * Stops completing a file that may still exist, e.g. because its folder is no
+ * longer cached. Its children stay indexed if they were indexed separately.
+ */
+void
+sandbox_utils_completion_forget (const gchar *path)
+{
+  SandboxUtilsCompletionNode *node;
+
+  node = _sandbox_utils_completion_lookup (path, FALSE);
+  if (!node || node == &_root)
+    return;
+
+  _sandbox_utils_completion_unindex (node);
+  _sandbox_utils_completion_prune (node);
+
+  _generation++;
+}
+
+/*
+ * Scores how well @key matches @frag (both casefolded): names that start with
+ * @frag first, then names containing its characters in order, preferably
+ * close together and at the start of words. Returns -1 if @key does not match.
+ */
+static gint
+_sandbox_utils_completion_match (const gchar *key,
+                                 const gchar *frag,
+                                 gsize        frag_len)
+{
+  const gchar *p     = key;
+  const gchar *found;
+  const gchar *c;
+  const gchar *next;
+  gchar        utf8[8];
+  gint         score = SANDBOX_UTILS_COMPLETION_FUZZY_SCORE;
+  gint         gaps  = 0;
+
+  if (strncmp (key, frag, frag_len) == 0)
+    return SANDBOX_UTILS_COMPLETION_PREFIX_SCORE - MIN ((gint) strlen (key + frag_len), 1000);
+
+  for (c = frag; *c; c = next)
+  {
+    next = g_utf8_next_char (c);
+
+    // Characters are looked for whole, not byte by byte
+    if (next - c == 1)
+    {
+      found = strchr (p, *c);
+    }
+    else
+    {
+      memcpy (utf8, c, next - c);
+      utf8[next - c] = '\0';
+      found = strstr (p, utf8);
+    }
+
+    if (!found)
+      return -1;
+
+    if (c == frag)
+      score -= 2 * (found - key);
+    else
+      gaps += found - p;
+
+    if (found == key || strchr (" ._-", found[-1]))
+      score += 20;
+
+    p = found + (next - c);
+  }
+
+  return CLAMP (score - 8 * gaps, 1, SANDBOX_UTILS_COMPLETION_PREFIX_SCORE - 1001);
+}
+
+static gint
+_sandbox_utils_completion_match_compare (const SandboxUtilsCompletionMatch *a,
+                                         const SandboxUtilsCompletionMatch *b)
+{
+  if (a->score != b->score)
+    return b->score - a->score;
+
+  if (a->node->mtime != b->node->mtime)
+    return a->node->mtime < b->node->mtime ? 1 : -1;
+
+  return strcmp (a->node->name, b->node->name);
+}
+
+/* Recent files and folders are more likely to be wanted */
+static gint
+_sandbox_utils_completion_rank (SandboxUtilsCompletionNode *node,
+                                gint                        score,
+                                gint64                      now)
+{
+  if (now - node->mtime < 24 * 3600)
+    score += 150;
+  else if (now - node->mtime < 7 * 24 * 3600)
+    score += 75;
+
+  if (node->type == G_FILE_TYPE_DIRECTORY)
+    score += 25;
+
+  return score;
+}
+
+/* Keeps the @max best matches in @best, sorted */
+static void
+_sandbox_utils_completion_keep (GArray                     *best,
+                                guint                       max,
+                                SandboxUtilsCompletionNode *node,
+                                gint                        score)
+{
+  SandboxUtilsCompletionMatch  match = { node, score };
+  guint                        low   = 0;
+  guint                        high  = best->len;
+  guint                        mid;
+
+  if (best->len == max &&
+      _sandbox_utils_completion_match_compare (&match, &g_array_index (best, SandboxUtilsCompletionMatch, max - 1)) >= 0)
+    return;
+
+  while (low < high)
+  {
+    mid = low + (high - low) / 2;
+    if (_sandbox_utils_completion_match_compare (&match, &g_array_index (best, SandboxUtilsCompletionMatch, mid)) > 0)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+
+  g_array_insert_val (best, low, match);
+  if (best->len > max)
+    g_array_set_size (best, max);
+}
+
+static gchar *
+_sandbox_utils_completion_get_path (SandboxUtilsCompletionNode *node)
+{
+  GString *path = g_string_new (NULL);
+
+  for (; node != &_root; node = node->parent)
+  {
+    g_string_prepend (path, node->name);
+    g_string_prepend_c (path, G_DIR_SEPARATOR);
+  }
+
+  return g_string_free (path, FALSE);
+}
+
+/* Ranks the children of @folder against @frag, returns how many were looked at */
+static guint
+_sandbox_utils_completion_query_folder (SandboxUtilsCompletionNode *folder,
+                                        const gchar                *frag,
+                                        gint64                      now,
+                                        GArray                     *best,
+                                        guint                       max)
+{
+  SandboxUtilsCompletionNode *child;
+  gsize                       frag_len = strlen (frag);
+  gint                        score;
+  guint                       i;
+
+  for (i = 0; i < folder->n_children; i++)
+  {
+    child = folder->children[i];
+    if (child->index == SANDBOX_UTILS_COMPLETION_NOT_INDEXED)
+      continue;
+
+    if ((score = _sandbox_utils_completion_match (child->key, frag, frag_len)) >= 0)
+      _sandbox_utils_completion_keep (best, max, child,
+                                      _sandbox_utils_completion_rank (child, score, now));
+  }
+
+  return folder->n_children;
+}
+
+/* Ranks all indexed files not in @skip against @frag */
+static guint
+_sandbox_utils_completion_query_all (SandboxUtilsCompletionNode *skip,
+                                     const gchar                *frag,
+                                     gint64                      now,
+                                     GArray                     *best,
+                                     guint                       max)
+{
+  SandboxUtilsCompletionNode *node;
+  GPtrArray                  *candidates;
+  GPtrArray                  *matches;
+  gsize                       frag_len = strlen (frag);
+  gint                        score;
+  guint                       i;
+
+  if (!_indexed || frag_len == 0)
+    return 0;
+
+  // Whatever matches "abc" also matched "ab"
+  if (_last_key && _last_generation == _generation && g_str_has_prefix (frag, _last_key))
+    candidates = _last_matches;
+  else
+    candidates = _indexed;
+
+  matches = g_ptr_array_new ();
+
+  for (i = 0; i < candidates->len; i++)
+  {
+    node = g_ptr_array_index (candidates, i);
+    if ((score = _sandbox_utils_completion_match (node->key, frag, frag_len)) < 0)
+      continue;
+
+    g_ptr_array_add (matches, node);
+    if (node->parent != skip)
+      _sandbox_utils_completion_keep (best, max, node,
+                                      _sandbox_utils_completion_rank (node, score, now));
+  }
+
+  i = candidates->len;
+
+  g_free (_last_key);
+  if (_last_matches)
+    g_ptr_array_unref (_last_matches);
+  _last_key        = g_strdup (frag);
+  _last_matches    = matches;
+  _last_generation = _generation;
+
+  return i;
+}
+
+/*
+ * Completes @text, which is either an absolute path, a path starting with ~/,
+ * or a path relative to @folder. Text ending with a name that is not in a
+ * subfolder is also completed from all indexed folders, after the matches
+ * found in @folder. Returns at most @max_results #SandboxUtilsCompletion, best
+ * first. Free with g_ptr_array_unref().
+ */
+GPtrArray *
+sandbox_utils_completion_query (const gchar *folder,
+                                const gchar *text,
+                                guint        max_results)
+{
+  SandboxUtilsCompletionNode  *scope = NULL;
+  SandboxUtilsCompletionMatch *match;
+  SandboxUtilsCompletion      *completion;
+  GPtrArray                   *results;
+  GArray                      *best;
+  gchar                       *full  = NULL;
+  gchar                       *dir;
+  gchar                       *frag;
+  gchar                       *slash;
+  gint64                       now   = g_get_real_time () / G_USEC_PER_SEC;
+  gint64                       started;
+  guint                        looked = 0;
+  guint                        local;
+  guint                        i;
+
+  results = g_ptr_array_new_with_free_func ((GDestroyNotify) sandbox_utils_completion_free);
+  if (!text || max_results == 0)
+    return results;
+
+  started = SU_TRACE_NOW ();
+  best    = g_array_sized_new (FALSE, FALSE, sizeof (SandboxUtilsCompletionMatch), max_results + 1);
+
+  if (g_str_has_prefix (text, "~/"))
+    full = g_build_filename (g_get_home_dir (), text + 2, NULL);
+  else if (g_path_is_absolute (text))
+    full = g_strdup (text);
+  else if (folder)
+    full = g_strconcat (folder, G_DIR_SEPARATOR_S, text, NULL);
+
+  // Complete the last component in the folder named by the rest
+  if (full)
+  {
+    slash = strrchr (full, G_DIR_SEPARATOR);
+    dir   = slash == full ? g_strdup (G_DIR_SEPARATOR_S) : g_strndup (full, slash - full);
+    frag  = g_utf8_casefold (slash + 1, -1);
+
+    scope = _sandbox_utils_completion_lookup (dir, FALSE);
+    if (scope)
+      looked += _sandbox_utils_completion_query_folder (scope, frag, now, best, max_results);
+
+    g_free (dir);
+    g_free (frag);
+  }
+
+  // Then look for the name anywhere else
+  local = best->len;
+  if (local < max_results && !strchr (text, G_DIR_SEPARATOR) && text[0] != '~')
+  {
+    GArray *others = g_array_sized_new (FALSE, FALSE, sizeof (SandboxUtilsCompletionMatch), max_results + 1);
+
+    frag    = g_utf8_casefold (text, -1);
+    looked += _sandbox_utils_completion_query_all (scope, frag, now, others, max_results - local);
+    g_array_append_vals (best, others->data, others->len);
+    g_array_free (others, TRUE);
+    g_free (frag);
+  }
+
+  for (i = 0; i < best->len; i++)
+  {
+    match      = &g_array_index (best, SandboxUtilsCompletionMatch, i);
+    completion = g_malloc (sizeof (SandboxUtilsCompletion));
+
+    completion->path  = _sandbox_utils_completion_get_path (match->node);
+    completion->type  = match->node->type;
+    completion->size  = match->node->size;
+    completion->mtime = match->node->mtime;
+    completion->score = match->score;
+
+    g_ptr_array_add (results, completion);
+  }
+
+  SU_TRACE3 (completion_query, looked, results->len, SU_TRACE_NOW () - started);
+
+  g_array_free (best, TRUE);
+  g_free (full);
+
+  return results;
+}
+
+void
+sandbox_utils_completion_free (SandboxUtilsCompletion *completion)
+{
+  if (!completion)
+    return;
+
+  g_free (completion->path);
+  g_free (completion);
+}
+
+/* Empties the index */
+void
+sandbox_utils_completion_clear ()
+{
+  guint i;
+
+  for (i = 0; i < _root.n_children; i++)
+    _sandbox_utils_completion_free_node (_root.children[i]);
+
+  g_free (_root.children);
+  _root.children   = NULL;
+  _root.n_children = 0;
+
+  g_clear_pointer (&_last_key, g_free);
+  g_clear_pointer (&_last_matches, g_ptr_array_unref);
+  _generation++;
+}
+
+/* Number of files that can be completed */
+guint
+sandbox_utils_completion_get_size ()
+{
+  return _indexed ? _indexed->len : 0;
+}
@@ -0,0 +1,65 @@
+/* SandboxUtils -- Sandbox Utilities Filename Completion
+ * Copyright (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>, 2014
+ *
+ * Under GPLv3
+ *
+ ***
+ *
+ * Completes file names typed in the server's dialogs from an in-memory index
+ * of the folders users work in, rather than by listing folders as they type
+ * (see mockups/sfcd-autocompletion). The index is a trie of path components
+ * whose children are kept sorted, so that names starting with what was typed
+ * are found by binary search. Names that merely contain the typed characters
+ * in order (e.g. "rprt" for "report.odt") are matched too, ranked after
+ * prefixes.
+ *
+ * Relative text is completed in a given folder first, then across all indexed
+ * folders. Queries that extend the previous one only look at the previous
+ * matches, so typing one more character costs little even on a large index.
+ *
+ * The index is fed by the directory cache and kept up to date along with it.
+ * Everything happens on the main loop. Completions are never sent to clients,
+ * as they would tell confined applications what files exist.
+ *
+ */
+#ifndef _SANDBOX_UTILS_COMPLETION_H
+#define _SANDBOX_UTILS_COMPLETION_H
+
+#include <gio/gio.h>
+
+/* A completion, with the metadata shown next to it */
+typedef struct {
+  gchar                 *path;
+  GFileType              type;
+  goffset                size;
+  gint64                 mtime;         /* seconds since the Epoch */
+  gint                   score;         /* higher is better */
+} SandboxUtilsCompletion;
+
+void
+sandbox_utils_completion_add (const gchar *path,
+                              GFileType    type,
+                              goffset      size,
+                              gint64       mtime);
+
+void
+sandbox_utils_completion_remove (const gchar *path);
+
+void
+sandbox_utils_completion_forget (const gchar *path);
+
+GPtrArray *
+sandbox_utils_completion_query (const gchar *folder,
+                                const gchar *text,
+                                guint        max_results);
+
+void
+sandbox_utils_completion_free (SandboxUtilsCompletion *completion);
+
+void
+sandbox_utils_completion_clear ();
+
+guint
+sandbox_utils_completion_get_size ();
+
+#endif /* #ifndef _SANDBOX_UTILS_COMPLETION_H */
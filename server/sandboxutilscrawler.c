@@ -0,0 +1,319 @@
+/* SandboxUtils -- Sandbox Utilities Crawler
+ * Copyright (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>, 2014
+ *
+ * Under GPLv3
+ *
+ ***
+ *
+ * Lists every file under a set of local folders. See sandboxutilscrawler.h.
+ *
+ */
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include "sandboxutilscrawler.h"
+
+// See ioprio_set(2), not wrapped by the C library
+#define SANDBOX_UTILS_CRAWLER_IOPRIO_WHO_PROCESS 1
+#define SANDBOX_UTILS_CRAWLER_IOPRIO_CLASS_IDLE  3
+#define SANDBOX_UTILS_CRAWLER_IOPRIO_CLASS_SHIFT 13
+
+// How long a thread with nothing to do waits before looking for work again
+#define SANDBOX_UTILS_CRAWLER_IDLE_WAIT 500
+
+// Most threads worth having, as the disk is the bottleneck beyond that
+#define SANDBOX_UTILS_CRAWLER_MAX_THREADS 16
+
+/* Folders a thread has to read, the most recently found last */
+typedef struct {
+  GMutex                    lock;
+  GQueue                    folders;
+} SandboxUtilsCrawlerQueue;
+
+typedef struct {
+  SandboxUtilsCrawlerQueue *queues;
+  guint                     n_threads;
+  gint                      pending;      /* folders queued or being read */
+  GCancellable             *cancellable;
+  GMutex                    rate_lock;
+  gint64                    rate_next;    /* when the next folder may be read */
+  gint64                    rate_interval;
+} SandboxUtilsCrawl;
+
+typedef struct {
+  SandboxUtilsCrawl        *crawl;
+  guint                     n;
+  GPtrArray                *found;
+  SandboxUtilsCrawlerStats  stats;
+} SandboxUtilsCrawlerWorker;
+
+static void
+_sandbox_utils_crawler_set_idle_priority (void)
+{
+#if defined (__linux__) && defined (SYS_ioprio_set)
+  // Applies to the calling thread only
+  syscall (SYS_ioprio_set,
+           SANDBOX_UTILS_CRAWLER_IOPRIO_WHO_PROCESS, 0,
+           SANDBOX_UTILS_CRAWLER_IOPRIO_CLASS_IDLE << SANDBOX_UTILS_CRAWLER_IOPRIO_CLASS_SHIFT);
+#endif
+}
+
+static void
+_sandbox_utils_crawler_push (SandboxUtilsCrawl *crawl,
+                             guint              n,
+                             gchar             *folder)
+{
+  g_atomic_int_inc (&crawl->pending);
+
+  g_mutex_lock (&crawl->queues[n].lock);
+  g_queue_push_tail (&crawl->queues[n].folders, folder);
+  g_mutex_unlock (&crawl->queues[n].lock);
+}
+
+/* Takes a folder from the worker's own queue, else from another one */
+static gchar *
+_sandbox_utils_crawler_pop (SandboxUtilsCrawlerWorker *worker)
+{
+  SandboxUtilsCrawl        *crawl = worker->crawl;
+  SandboxUtilsCrawlerQueue *queue;
+  gchar                    *folder;
+  guint                     i;
+
+  queue = &crawl->queues[worker->n];
+  g_mutex_lock (&queue->lock);
+  folder = g_queue_pop_tail (&queue->folders);
+  g_mutex_unlock (&queue->lock);
+
+  for (i = 1; !folder && i < crawl->n_threads; i++)
+  {
+    queue = &crawl->queues[(worker->n + i) % crawl->n_threads];
+    g_mutex_lock (&queue->lock);
+    folder = g_queue_pop_head (&queue->folders);
+    g_mutex_unlock (&queue->lock);
+
+    if (folder)
+      worker->stats.steals++;
+  }
+
+  return folder;
+}
+
+/* Waits until reading one more folder keeps the crawl within its rate */
+static void
+_sandbox_utils_crawler_throttle (SandboxUtilsCrawl *crawl)
+{
+  gint64 now;
+  gint64 wait = 0;
+
+  if (!crawl->rate_interval)
+    return;
+
+  g_mutex_lock (&crawl->rate_lock);
+  now = g_get_monotonic_time ();
+  if (crawl->rate_next > now)
+  {
+    wait = crawl->rate_next - now;
+    crawl->rate_next += crawl->rate_interval;
+  }
+  else
+    crawl->rate_next = now + crawl->rate_interval;
+  g_mutex_unlock (&crawl->rate_lock);
+
+  if (wait)
+    g_usleep (wait);
+}
+
+static void
+_sandbox_utils_crawler_read (SandboxUtilsCrawlerWorker *worker,
+                             const gchar               *folder)
+{
+  struct dirent *entry;
+  struct stat    st;
+  DIR           *dir;
+  gchar         *path;
+  gboolean       is_folder;
+
+  dir = opendir (folder);
+  if (!dir)
+  {
+    worker->stats.errors++;
+    return;
+  }
+
+  worker->stats.folders++;
+
+  while ((entry = readdir (dir)) != NULL)
+  {
+    // Also skips . and ..
+    if (entry->d_name[0] == '.')
+      continue;
+
+    if (entry->d_type != DT_UNKNOWN)
+      is_folder = (entry->d_type == DT_DIR);
+    else
+      is_folder = fstatat (dirfd (dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 &&
+                  S_ISDIR (st.st_mode);
+
+    path = g_build_filename (folder, entry->d_name, NULL);
+    g_ptr_array_add (worker->found, path);
+    worker->stats.files++;
+
+    if (is_folder)
+      _sandbox_utils_crawler_push (worker->crawl, worker->n, g_strdup (path));
+  }
+
+  closedir (dir);
+}
+
+static gpointer
+_sandbox_utils_crawler_work (gpointer data)
+{
+  SandboxUtilsCrawlerWorker *worker = data;
+  SandboxUtilsCrawl         *crawl  = worker->crawl;
+  gchar                     *folder;
+
+  _sandbox_utils_crawler_set_idle_priority ();
+
+  while (!g_cancellable_is_cancelled (crawl->cancellable))
+  {
+    folder = _sandbox_utils_crawler_pop (worker);
+    if (!folder)
+    {
+      // Others are still reading folders that may lead to more work
+      if (g_atomic_int_get (&crawl->pending) == 0)
+        break;
+
+      g_usleep (SANDBOX_UTILS_CRAWLER_IDLE_WAIT);
+      continue;
+    }
+
+    _sandbox_utils_crawler_throttle (crawl);
+    _sandbox_utils_crawler_read (worker, folder);
+    g_free (folder);
+
+    g_atomic_int_add (&crawl->pending, -1);
+  }
+
+  return NULL;
+}
+
+static gint
+_sandbox_utils_crawler_compare (gconstpointer a,
+                                gconstpointer b)
+{
+  return strcmp (*(const gchar **) a, *(const gchar **) b);
+}
+
+/*
+ * Lists every file and folder under @roots, local folders given as absolute
+ * paths, with @n_threads threads reading at most @rate folders per second in
+ * total (0 for no limit). Returns the sorted paths of everything found, the
+ * roots themselves excepted, or NULL if cancelled. Blocks until done, so
+ * call it from a thread of its own.
+ */
+GPtrArray *
+sandbox_utils_crawler_run (const gchar * const      *roots,
+                           guint                     n_threads,
+                           guint                     rate,
+                           GCancellable             *cancellable,
+                           SandboxUtilsCrawlerStats *stats,
+                           GError                  **error)
+{
+  SandboxUtilsCrawlerWorker *workers;
+  SandboxUtilsCrawl          crawl;
+  GPtrArray                 *found;
+  GThread                  **threads;
+  gchar                     *folder;
+  gint64                     started = g_get_monotonic_time ();
+  guint                      i;
+  guint                      j;
+
+  g_return_val_if_fail (roots != NULL, NULL);
+
+  n_threads = CLAMP (n_threads, 1, SANDBOX_UTILS_CRAWLER_MAX_THREADS);
+
+  memset (&crawl, 0, sizeof (crawl));
+  crawl.queues        = g_new0 (SandboxUtilsCrawlerQueue, n_threads);
+  crawl.n_threads     = n_threads;
+  crawl.cancellable   = cancellable;
+  crawl.rate_interval = rate ? G_USEC_PER_SEC / rate : 0;
+  g_mutex_init (&crawl.rate_lock);
+
+  for (i = 0; i < n_threads; i++)
+  {
+    g_mutex_init (&crawl.queues[i].lock);
+    g_queue_init (&crawl.queues[i].folders);
+  }
+
+  // Deal roots out, so that every thread starts with some work
+  for (i = 0; roots[i]; i++)
+    _sandbox_utils_crawler_push (&crawl, i % n_threads, g_strdup (roots[i]));
+
+  workers = g_new0 (SandboxUtilsCrawlerWorker, n_threads);
+  threads = g_new0 (GThread *, n_threads);
+
+  for (i = 0; i < n_threads; i++)
+  {
+    workers[i].crawl = &crawl;
+    workers[i].n     = i;
+    workers[i].found = g_ptr_array_new_with_free_func (g_free);
+    threads[i] = g_thread_new ("sandboxutils-crawler", _sandbox_utils_crawler_work, &workers[i]);
+  }
+
+  found = g_ptr_array_new_with_free_func (g_free);
+  if (stats)
+    memset (stats, 0, sizeof (SandboxUtilsCrawlerStats));
+
+  for (i = 0; i < n_threads; i++)
+  {
+    g_thread_join (threads[i]);
+
+    // Paths move over without being copied
+    for (j = 0; j < workers[i].found->len; j++)
+      g_ptr_array_add (found, g_ptr_array_index (workers[i].found, j));
+    g_ptr_array_set_free_func (workers[i].found, NULL);
+    g_ptr_array_unref (workers[i].found);
+
+    if (stats)
+    {
+      stats->folders += workers[i].stats.folders;
+      stats->files   += workers[i].stats.files;
+      stats->errors  += workers[i].stats.errors;
+      stats->steals  += workers[i].stats.steals;
+    }
+  }
+
+  // Folders left over from a cancelled crawl
+  for (i = 0; i < n_threads; i++)
+  {
+    while ((folder = g_queue_pop_head (&crawl.queues[i].folders)) != NULL)
+      g_free (folder);
+    g_mutex_clear (&crawl.queues[i].lock);
+  }
+
+  g_mutex_clear (&crawl.rate_lock);
+  g_free (crawl.queues);
+  g_free (threads);
+  g_free (workers);
+
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+  {
+    g_ptr_array_unref (found);
+    return NULL;
+  }
+
+  // Stable ids, and names of a folder next to each other in the index
+  g_ptr_array_sort (found, _sandbox_utils_crawler_compare);
+
+  if (stats)
+    stats->duration = g_get_monotonic_time () - started;
+
+  return found;
+}
@@ -0,0 +1,43 @@
+/* SandboxUtils -- Sandbox Utilities Crawler
+ * Copyright (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>, 2014
+ *
+ * Under GPLv3
+ *
+ ***
+ *
+ * Lists every file under a set of local folders, with a pool of threads. Each
+ * thread keeps its own queue of folders to read, pushes the subfolders it
+ * finds onto it and takes the most recent one back, so that it walks down a
+ * branch of the tree while its entries are still in the kernel's caches. A
+ * thread whose queue runs dry steals the oldest folder of another queue, the
+ * one highest up its branch and the most likely to lead to more work.
+ *
+ * Reading folders can be throttled to a number per second, and threads ask
+ * the kernel for idle I/O priority where it supports it, so that a crawl does
+ * not slow down the user's own work. Hidden files and folders are skipped, and
+ * symbolic links are not followed.
+ *
+ */
+#ifndef _SANDBOX_UTILS_CRAWLER_H
+#define _SANDBOX_UTILS_CRAWLER_H
+
+#include <gio/gio.h>
+
+/* What a crawl went through */
+typedef struct {
+  guint64                folders;       /* folders read */
+  guint64                files;         /* paths found, folders included */
+  guint64                errors;        /* folders that could not be read */
+  guint64                steals;        /* folders taken from another thread */
+  gint64                 duration;      /* microseconds */
+} SandboxUtilsCrawlerStats;
+
+GPtrArray *
+sandbox_utils_crawler_run (const gchar * const      *roots,
+                           guint                     n_threads,
+                           guint                     rate,
+                           GCancellable             *cancellable,
+                           SandboxUtilsCrawlerStats *stats,
+                           GError                  **error);
+
+#endif /* #ifndef _SANDBOX_UTILS_CRAWLER_H */
@@ -28,6 +28,17 @@
 #include "sandboxutilscommon.h"
 #include "sandboxfilechooserdialog.h"
 #include "sandboxfilechooserdialogdbuswrapper.h"
+#include "sandboxutilsscheduler.h"
+#include "sandboxutilsrecorder.h"
+#include "sandboxutilsmemory.h"
+#include "sandboxutilsspeculation.h"
+#include "sandboxutilsdircache.h"
+#include "sandboxutilsgrants.h"
+#include "sandboxutilspolicy.h"
+#include "sandboxutilssearch.h"
+#include "sandboxutilsselection.h"
+#include "sandboxutilstemplate.h"
+#include "sandboxutilsthumbnail.h"
 
 
 static gboolean
@@ -53,9 +64,11 @@ main (int argc, char *argv[])
 {
   // Internal to the server
   GMainLoop           *loop;
-	SandboxUtilsClient  *cli;
+	GList               *clients;
 	SfcdDbusWrapperInfo *sfcd_wrapper;
 	struct sigaction     action;
+  GOptionContext      *context;
+  GError              *error = NULL;
 	
 #ifndef NDEBUG
   mtrace ();
@@ -64,6 +77,30 @@ main (int argc, char *argv[])
   // Initialise sandboxutils settings
   sandboxutils_set_sandboxed (FALSE);
 
+  // Parse GTK+ options and those of each server module
+  context = g_option_context_new (NULL);
+  g_option_context_add_group (context, gtk_get_option_group (TRUE));
+  g_option_context_add_group (context, sandbox_utils_client_get_option_group ());
+  g_option_context_add_group (context, sandbox_utils_recorder_get_option_group ());
+  g_option_context_add_group (context, sfcd_dbus_wrapper_get_option_group ());
+  g_option_context_add_group (context, sandbox_utils_memory_get_option_group ());
+  g_option_context_add_group (context, sandbox_utils_speculation_get_option_group ());
+  g_option_context_add_group (context, sandbox_utils_dircache_get_option_group ());
+  g_option_context_add_group (context, sandbox_utils_search_get_option_group ());
+  g_option_context_add_group (context, sandbox_utils_template_get_option_group ());
+  g_option_context_add_group (context, sandbox_utils_thumbnail_get_option_group ());
+  g_option_context_add_group (context, sandbox_utils_selection_get_option_group ());
+  g_option_context_add_group (context, sandbox_utils_grants_get_option_group ());
+  g_option_context_add_group (context, sandbox_utils_policy_get_option_group ());
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+  {
+    g_printerr ("%s\n", _sandboxutils_error_get_message (error));
+    g_error_free (error);
+    g_option_context_free (context);
+    return EXIT_FAILURE;
+  }
+  g_option_context_free (context);
+
   // Initialise GTK for later
   gtk_init (&argc, &argv);
 
@@ -79,8 +116,31 @@ main (int argc, char *argv[])
   // Initialise the interface providing SandboxFileChooserDialog
   sfcd_wrapper = sfcd_dbus_wrapper_dbus_init ();
 
-	// Temporary client
-	cli = _get_client ();
+  // Give idle dialogs' and caches' memory back when the system runs low on it
+  sandbox_utils_memory_add_shrinker ("dialogs", sandbox_utils_client_hibernate_dialogs, NULL);
+  sandbox_utils_memory_add_shrinker ("speculation", sandbox_utils_speculation_shrink, NULL);
+  sandbox_utils_memory_add_shrinker ("dircache", sandbox_utils_dircache_shrink, NULL);
+  sandbox_utils_memory_add_shrinker ("templates", sandbox_utils_template_drop_spares, NULL);
+  sandbox_utils_memory_add_shrinker ("thumbnails", sandbox_utils_thumbnail_shrink, NULL);
+  sandbox_utils_memory_monitor_start ();
+
+  // Start listing the folders dialogs usually open in
+  sandbox_utils_dircache_prefill ();
+
+  // Open the name index, and crawl the search roots if it is stale
+  sandbox_utils_search_start ();
+
+  // Start the threads making thumbnails for preview panes
+  sandbox_utils_thumbnail_start ();
+
+  // Start the threads querying the attributes of chosen files
+  sandbox_utils_selection_start ();
+
+  // Open the ledger of files granted to processes, recovering it after a crash
+  sandbox_utils_grants_start ();
+
+  // Compile the rules chosen files are checked against
+  sandbox_utils_policy_start ();
 	
   // Notify systemd of readiness and start the loop
   loop = g_main_loop_new (NULL, FALSE);
@@ -88,8 +148,25 @@ main (int argc, char *argv[])
   sd_notify(0, "READY=1");
   g_main_loop_run (loop);
 
-  // Clean up the client
-  _reset_client ();
+  // Stop shrinking before the clients go away
+  sandbox_utils_memory_monitor_stop ();
+
+  // Stop crawling, decoding and querying, and release folder monitors
+  sandbox_utils_search_stop ();
+  sandbox_utils_thumbnail_stop ();
+  sandbox_utils_selection_stop ();
+  sandbox_utils_grants_stop ();
+  sandbox_utils_policy_stop ();
+  sandbox_utils_dircache_clear ();
+
+  // Clean up the clients, dropping the calls they left behind first
+  clients = sandbox_utils_client_list ();
+  g_list_foreach (clients, (GFunc) sandbox_utils_scheduler_forget_client, NULL);
+  g_list_free_full (clients, sandbox_utils_client_unref);
+  sandbox_utils_client_remove_all ();
+
+  // Flush the recording of client calls, if any
+  sandbox_utils_recorder_stop ();
 
   // Close the SandboxFileChooserDialog interface
   // sfcd_dbus_wrapper_dbus_shutdown (sfcd_wrapper);
@@ -0,0 +1,696 @@
+/* SandboxUtils -- Sandbox Utilities Directory Cache
+ * Copyright (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>, 2014
+ *
+ * Under GPLv3
+ *
+ ***
+ *
+ * Caches the listing of recently used folders. See sandboxutilsdircache.h.
+ *
+ */
+#include <string.h>
+#include <syslog.h>
+
+#include "sandboxutilsdircache.h"
+#include "sandboxutilscompletion.h"
+#include "sandboxutilssearch.h"
+#include "sandboxutilstrace.h"
+
+// Same attributes as GtkFileChooserWidget, the content type being guessed
+// from file names only, as sniffing contents would read every file
+#define SANDBOX_UTILS_DIR_CACHE_ATTRIBUTES \
+  "standard::name,standard::display-name,standard::type,standard::size," \
+  "standard::fast-content-type,time::modified"
+
+// Files read per batch when loading a folder
+#define SANDBOX_UTILS_DIR_CACHE_BATCH 100
+
+// How often folders that were not used for long are looked for
+#define SANDBOX_UTILS_DIR_CACHE_SWEEP_INTERVAL 60
+
+static gboolean _option_disabled = FALSE;
+static gint     _option_folders  = 64;
+static gint     _option_budget   = 16;
+static gint     _option_max_age  = 240;
+
+static GOptionEntry entries[] =
+{
+  {
+    "no-dircache", 0, 0, G_OPTION_ARG_NONE, &_option_disabled,
+    "Do not keep the listing of recently used folders in memory", NULL
+  },
+  {
+    "dircache-folders", 0, 0, G_OPTION_ARG_INT, &_option_folders,
+    "Maximum number of folders whose listing is kept (default: 64)", "N"
+  },
+  {
+    "dircache-budget", 0, 0, G_OPTION_ARG_INT, &_option_budget,
+    "Megabytes of memory that folder listings may use (default: 16)", "MB"
+  },
+  {
+    "dircache-max-age", 0, 0, G_OPTION_ARG_INT, &_option_max_age,
+    "Minutes after which an unused folder listing is forgotten (default: 240)", "MIN"
+  },
+  {
+    NULL, ' ', 0, 0, NULL,
+    NULL, NULL
+  }
+};
+
+/* A cached folder. Pending I/O holds references, see _dir_unref */
+typedef struct {
+  gint                   ref_count;
+  gchar                 *uri;
+  gchar                 *path;          /* NULL if not a local folder */
+  GFile                 *file;
+  GHashTable            *entries;       /* name -> SandboxUtilsDirEntry */
+  GFileMonitor          *monitor;
+  GCancellable          *loading;       /* until loaded, NULL afterwards */
+  GList                 *link;          /* in _lru, NULL once evicted */
+  gint64                 bytes;
+  gint64                 last_used;
+  gint64                 load_started;
+} SandboxUtilsDirectory;
+
+static GHashTable                *_directories = NULL;  /* uri -> directory */
+static GQueue                     _lru         = G_QUEUE_INIT;  /* least recently used first */
+static guint                      _sweep_id    = 0;
+static SandboxUtilsDirCacheStats  _stats;
+
+GOptionGroup *
+sandbox_utils_dircache_get_option_group ()
+{
+  GOptionGroup *group;
+
+  group = g_option_group_new ("dircache", "Directory Cache", "Show directory cache options", NULL, NULL);
+
+  g_option_group_add_entries (group, entries);
+  g_option_group_set_translation_domain (group, NULL);
+
+  return group;
+}
+
+gboolean
+sandbox_utils_dircache_get_enabled ()
+{
+  return !_option_disabled;
+}
+
+static gint64
+_sandbox_utils_dircache_entry_size (SandboxUtilsDirEntry *entry)
+{
+  // The entry, its strings and its share of the hash table's arrays
+  return sizeof (SandboxUtilsDirEntry) + 4 * sizeof (gpointer) +
+         strlen (entry->name) + 1 +
+         (entry->display_name != entry->name ? strlen (entry->display_name) + 1 : 0);
+}
+
+static void
+_sandbox_utils_dircache_entry_free (gpointer data)
+{
+  SandboxUtilsDirEntry *entry = data;
+
+  if (entry->display_name != entry->name)
+    g_free (entry->display_name);
+  g_free (entry->name);
+  g_free (entry);
+}
+
+static SandboxUtilsDirectory *
+_sandbox_utils_dircache_dir_ref (SandboxUtilsDirectory *dir)
+{
+  g_atomic_int_inc (&dir->ref_count);
+
+  return dir;
+}
+
+static void
+_sandbox_utils_dircache_dir_unref (SandboxUtilsDirectory *dir)
+{
+  if (!g_atomic_int_dec_and_test (&dir->ref_count))
+    return;
+
+  g_hash_table_unref (dir->entries);
+  g_object_unref (dir->file);
+  g_free (dir->path);
+  g_free (dir->uri);
+  g_free (dir);
+}
+
+static void
+_sandbox_utils_dircache_set_bytes (SandboxUtilsDirectory *dir,
+                                   gint64                 delta)
+{
+  dir->bytes   += delta;
+  _stats.bytes += delta;
+}
+
+/* Makes the completion engine add, remove or forget a file of @dir */
+static void
+_sandbox_utils_dircache_complete (SandboxUtilsDirectory *dir,
+                                  const gchar           *name,
+                                  SandboxUtilsDirEntry  *entry,
+                                  gboolean               deleted)
+{
+  gchar *path;
+
+  if (!dir->path)
+    return;
+
+  path = g_build_filename (dir->path, name, NULL);
+
+  if (entry)
+    sandbox_utils_completion_add (path, entry->type, entry->size, entry->mtime);
+  else if (deleted)
+    sandbox_utils_completion_remove (path);
+  else
+    sandbox_utils_completion_forget (path);
+
+  g_free (path);
+}
+
+/* Tells the name search about a file that changed after @dir was loaded */
+static void
+_sandbox_utils_dircache_notify_search (SandboxUtilsDirectory *dir,
+                                       const gchar           *name,
+                                       gboolean               exists)
+{
+  gchar *path;
+
+  if (!dir->path || !sandbox_utils_search_get_enabled ())
+    return;
+
+  path = g_build_filename (dir->path, name, NULL);
+  sandbox_utils_search_file_changed (path, exists);
+  g_free (path);
+}
+
+/* Forgets @dir, stopping its monitor and any load under way */
+static void
+_sandbox_utils_dircache_evict (SandboxUtilsDirectory *dir,
+                               gboolean               counted)
+{
+  GHashTableIter iter;
+  gpointer       name;
+
+  if (!dir->link)
+    return;
+
+  SU_TRACE2 (dircache_evict, dir->uri, dir->bytes);
+
+  g_queue_delete_link (&_lru, dir->link);
+  dir->link = NULL;
+
+  if (dir->loading)
+  {
+    g_cancellable_cancel (dir->loading);
+    g_object_unref (dir->loading);
+    dir->loading = NULL;
+  }
+
+  if (dir->monitor)
+  {
+    g_file_monitor_cancel (dir->monitor);
+    g_object_unref (dir->monitor);
+    dir->monitor = NULL;
+    _stats.watches--;
+  }
+
+  // The files may still exist, but will no longer be kept up to date
+  g_hash_table_iter_init (&iter, dir->entries);
+  while (g_hash_table_iter_next (&iter, &name, NULL))
+    _sandbox_utils_dircache_complete (dir, name, NULL, FALSE);
+
+  _stats.folders--;
+  _stats.entries -= g_hash_table_size (dir->entries);
+  _stats.bytes   -= dir->bytes;
+  if (counted)
+    _stats.evictions++;
+
+  // Drops the cache's own reference
+  g_hash_table_remove (_directories, dir->uri);
+}
+
+/* Evicts folders unused for too long, then folders over the limits */
+static void
+_sandbox_utils_dircache_enforce (void)
+{
+  SandboxUtilsDirectory *dir;
+  gint64                 oldest = g_get_monotonic_time () - (gint64) _option_max_age * 60 * G_TIME_SPAN_SECOND;
+  gint64                 budget = (gint64) _option_budget * 1024 * 1024;
+
+  while ((dir = g_queue_peek_head (&_lru)) != NULL && dir->last_used < oldest)
+    _sandbox_utils_dircache_evict (dir, FALSE);
+
+  while ((dir = g_queue_peek_head (&_lru)) != NULL &&
+         (g_queue_get_length (&_lru) > (guint) MAX (_option_folders, 0) || _stats.bytes > budget))
+    _sandbox_utils_dircache_evict (dir, TRUE);
+}
+
+static gboolean
+_sandbox_utils_dircache_sweep (gpointer data)
+{
+  _sandbox_utils_dircache_enforce ();
+
+  if (g_queue_is_empty (&_lru))
+  {
+    _sweep_id = 0;
+    return G_SOURCE_REMOVE;
+  }
+
+  return G_SOURCE_CONTINUE;
+}
+
+/* Marks @dir as the most recently used folder */
+static void
+_sandbox_utils_dircache_touch (SandboxUtilsDirectory *dir)
+{
+  dir->last_used = g_get_monotonic_time ();
+
+  g_queue_unlink (&_lru, dir->link);
+  g_queue_push_tail_link (&_lru, dir->link);
+}
+
+static gboolean
+_sandbox_utils_dircache_drop_entry (SandboxUtilsDirectory *dir,
+                                    const gchar           *name)
+{
+  SandboxUtilsDirEntry *entry;
+
+  entry = g_hash_table_lookup (dir->entries, name);
+  if (!entry)
+    return FALSE;
+
+  _sandbox_utils_dircache_set_bytes (dir, -_sandbox_utils_dircache_entry_size (entry));
+  _stats.entries--;
+
+  return g_hash_table_remove (dir->entries, name);
+}
+
+/* Removes a file that was deleted or moved away */
+static void
+_sandbox_utils_dircache_remove_entry (SandboxUtilsDirectory *dir,
+                                      const gchar           *name)
+{
+  if (_sandbox_utils_dircache_drop_entry (dir, name))
+  {
+    _sandbox_utils_dircache_complete (dir, name, NULL, TRUE);
+    _sandbox_utils_dircache_notify_search (dir, name, FALSE);
+  }
+}
+
+static void
+_sandbox_utils_dircache_set_entry (SandboxUtilsDirectory *dir,
+                                   GFileInfo             *info)
+{
+  SandboxUtilsDirEntry *entry;
+  const gchar          *display_name;
+
+  _sandbox_utils_dircache_drop_entry (dir, g_file_info_get_name (info));
+
+  entry = g_malloc (sizeof (SandboxUtilsDirEntry));
+  entry->name         = g_strdup (g_file_info_get_name (info));
+  entry->type         = g_file_info_get_file_type (info);
+  entry->size         = g_file_info_get_size (info);
+  entry->mtime        = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+  entry->content_type = g_intern_string (g_file_info_get_attribute_string (info, G_FILE_ATTRIBUTE_STANDARD_FAST_CONTENT_TYPE));
+
+  // Most display names are the name itself, no need to keep it twice
+  display_name = g_file_info_get_display_name (info);
+  if (display_name && g_strcmp0 (display_name, entry->name) != 0)
+    entry->display_name = g_strdup (display_name);
+  else
+    entry->display_name = entry->name;
+
+  g_hash_table_insert (dir->entries, entry->name, entry);
+
+  _sandbox_utils_dircache_set_bytes (dir, _sandbox_utils_dircache_entry_size (entry));
+  _stats.entries++;
+
+  _sandbox_utils_dircache_complete (dir, entry->name, entry, FALSE);
+}
+
+static void
+_sandbox_utils_dircache_on_refreshed (GObject      *source,
+                                      GAsyncResult *res,
+                                      gpointer      user_data)
+{
+  SandboxUtilsDirectory *dir   = user_data;
+  GFileInfo             *info;
+  GError                *error = NULL;
+  gchar                 *name;
+
+  info = g_file_query_info_finish (G_FILE (source), res, &error);
+
+  if (dir->link)
+  {
+    if (info)
+    {
+      _sandbox_utils_dircache_set_entry (dir, info);
+      _sandbox_utils_dircache_notify_search (dir, g_file_info_get_name (info), TRUE);
+    }
+    else if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+    {
+      name = g_file_get_basename (G_FILE (source));
+      _sandbox_utils_dircache_remove_entry (dir, name);
+      g_free (name);
+    }
+  }
+
+  g_clear_object (&info);
+  g_clear_error (&error);
+  _sandbox_utils_dircache_dir_unref (dir);
+}
+
+/* Reads the metadata of @file again, as it changed in @dir */
+static void
+_sandbox_utils_dircache_refresh (SandboxUtilsDirectory *dir,
+                                 GFile                 *file)
+{
+  g_file_query_info_async (file,
+                           SANDBOX_UTILS_DIR_CACHE_ATTRIBUTES,
+                           G_FILE_QUERY_INFO_NONE,
+                           G_PRIORITY_LOW,
+                           NULL,
+                           _sandbox_utils_dircache_on_refreshed,
+                           _sandbox_utils_dircache_dir_ref (dir));
+}
+
+static void
+_sandbox_utils_dircache_on_changed (GFileMonitor      *monitor,
+                                    GFile             *file,
+                                    GFile             *other_file,
+                                    GFileMonitorEvent  event,
+                                    gpointer           user_data)
+{
+  SandboxUtilsDirectory *dir = user_data;
+  gchar                 *name;
+
+  // The folder itself went away
+  if (g_file_equal (file, dir->file))
+  {
+    if (event == G_FILE_MONITOR_EVENT_DELETED ||
+        event == G_FILE_MONITOR_EVENT_MOVED_OUT ||
+        event == G_FILE_MONITOR_EVENT_UNMOUNTED)
+      _sandbox_utils_dircache_evict (dir, FALSE);
+    return;
+  }
+
+  switch (event)
+  {
+    case G_FILE_MONITOR_EVENT_DELETED:
+    case G_FILE_MONITOR_EVENT_MOVED_OUT:
+    case G_FILE_MONITOR_EVENT_RENAMED:
+      name = g_file_get_basename (file);
+      _sandbox_utils_dircache_remove_entry (dir, name);
+      g_free (name);
+
+      if (event == G_FILE_MONITOR_EVENT_RENAMED && other_file)
+        _sandbox_utils_dircache_refresh (dir, other_file);
+      break;
+
+    // Plain CHANGED events come by the dozen while a file is written
+    case G_FILE_MONITOR_EVENT_CREATED:
+    case G_FILE_MONITOR_EVENT_MOVED_IN:
+    case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+    case G_FILE_MONITOR_EVENT_ATTRIBUTE_CHANGED:
+      _sandbox_utils_dircache_refresh (dir, file);
+      break;
+
+    default:
+      break;
+  }
+}
+
+static void
+_sandbox_utils_dircache_loaded (SandboxUtilsDirectory *dir)
+{
+  g_object_unref (dir->loading);
+  dir->loading = NULL;
+
+  SU_TRACE4 (dircache_loaded, dir->uri, g_hash_table_size (dir->entries), dir->bytes,
+             g_get_monotonic_time () - dir->load_started);
+
+  syslog (LOG_DEBUG, "SandboxUtilsDirCache.Loaded: cached %u files of '%s' (%" G_GINT64_FORMAT " bytes, %" G_GINT64_FORMAT " in total).\n",
+          g_hash_table_size (dir->entries), dir->uri, dir->bytes, _stats.bytes);
+
+  _sandbox_utils_dircache_enforce ();
+}
+
+static void
+_sandbox_utils_dircache_on_next_files (GObject      *source,
+                                       GAsyncResult *res,
+                                       gpointer      user_data)
+{
+  GFileEnumerator       *enumerator = G_FILE_ENUMERATOR (source);
+  SandboxUtilsDirectory *dir        = user_data;
+  GList                 *files;
+  GList                 *iter;
+  GError                *error      = NULL;
+
+  files = g_file_enumerator_next_files_finish (enumerator, res, &error);
+
+  if (dir->link && !error)
+  {
+    for (iter = files; iter; iter = iter->next)
+      _sandbox_utils_dircache_set_entry (dir, iter->data);
+
+    if (files)
+    {
+      g_file_enumerator_next_files_async (enumerator,
+                                          SANDBOX_UTILS_DIR_CACHE_BATCH,
+                                          G_PRIORITY_LOW,
+                                          dir->loading,
+                                          _sandbox_utils_dircache_on_next_files,
+                                          dir);
+      g_list_free_full (files, g_object_unref);
+      return;
+    }
+
+    _sandbox_utils_dircache_loaded (dir);
+  }
+  else if (dir->link)
+  {
+    // An incomplete listing would be worse than none
+    _sandbox_utils_dircache_evict (dir, FALSE);
+  }
+
+  g_list_free_full (files, g_object_unref);
+  g_clear_error (&error);
+  g_object_unref (enumerator);
+  _sandbox_utils_dircache_dir_unref (dir);
+}
+
+static void
+_sandbox_utils_dircache_on_enumerated (GObject      *source,
+                                       GAsyncResult *res,
+                                       gpointer      user_data)
+{
+  GFileEnumerator       *enumerator;
+  SandboxUtilsDirectory *dir = user_data;
+
+  enumerator = g_file_enumerate_children_finish (G_FILE (source), res, NULL);
+
+  if (enumerator && dir->link)
+  {
+    g_file_enumerator_next_files_async (enumerator,
+                                        SANDBOX_UTILS_DIR_CACHE_BATCH,
+                                        G_PRIORITY_LOW,
+                                        dir->loading,
+                                        _sandbox_utils_dircache_on_next_files,
+                                        dir);
+    return;
+  }
+
+  if (dir->link)
+    _sandbox_utils_dircache_evict (dir, FALSE);
+
+  g_clear_object (&enumerator);
+  _sandbox_utils_dircache_dir_unref (dir);
+}
+
+/*
+ * Makes sure @folder is cached, loading it in the background if it is not.
+ * If @cancellable is cancelled before the load completes, the load stops and
+ * nothing is cached. Returns %TRUE if @folder was loaded already.
+ */
+gboolean
+sandbox_utils_dircache_load (GFile        *folder,
+                             GCancellable *cancellable)
+{
+  SandboxUtilsDirectory *dir;
+  GFileMonitor          *monitor;
+  gchar                 *uri;
+
+  g_return_val_if_fail (G_IS_FILE (folder), FALSE);
+
+  if (_option_disabled)
+    return FALSE;
+
+  if (!_directories)
+    _directories = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                          (GDestroyNotify) _sandbox_utils_dircache_dir_unref);
+
+  uri = g_file_get_uri (folder);
+  dir = g_hash_table_lookup (_directories, uri);
+
+  if (dir)
+  {
+    g_free (uri);
+    _sandbox_utils_dircache_touch (dir);
+
+    SU_TRACE2 (dircache_lookup, dir->uri, dir->loading == NULL);
+    if (dir->loading)
+      return FALSE;
+
+    _stats.hits++;
+    return TRUE;
+  }
+
+  _stats.misses++;
+  SU_TRACE2 (dircache_lookup, uri, FALSE);
+
+  // Watch first, so that changes made while listing are not missed
+  monitor = g_file_monitor_directory (folder, G_FILE_MONITOR_WATCH_MOVES, NULL, NULL);
+  if (!monitor)
+  {
+    syslog (LOG_DEBUG, "SandboxUtilsDirCache.Load: '%s' cannot be monitored, will not be cached.\n", uri);
+    g_free (uri);
+    return FALSE;
+  }
+
+  dir = g_malloc0 (sizeof (SandboxUtilsDirectory));
+  dir->ref_count    = 1;
+  dir->uri          = uri;
+  dir->path         = g_file_get_path (folder);
+  dir->file         = g_object_ref (folder);
+  dir->entries      = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, _sandbox_utils_dircache_entry_free);
+  dir->monitor      = monitor;
+  dir->loading      = cancellable ? g_object_ref (cancellable) : g_cancellable_new ();
+  dir->last_used    = g_get_monotonic_time ();
+  dir->load_started = dir->last_used;
+
+  g_signal_connect (monitor, "changed", G_CALLBACK (_sandbox_utils_dircache_on_changed), dir);
+
+  g_hash_table_insert (_directories, dir->uri, dir);
+  g_queue_push_tail (&_lru, dir);
+  dir->link = g_queue_peek_tail_link (&_lru);
+
+  _stats.folders++;
+  _stats.watches++;
+
+  if (!_sweep_id)
+    _sweep_id = g_timeout_add_seconds (SANDBOX_UTILS_DIR_CACHE_SWEEP_INTERVAL, _sandbox_utils_dircache_sweep, NULL);
+
+  g_file_enumerate_children_async (folder,
+                                   SANDBOX_UTILS_DIR_CACHE_ATTRIBUTES,
+                                   G_FILE_QUERY_INFO_NONE,
+                                   G_PRIORITY_LOW,
+                                   dir->loading,
+                                   _sandbox_utils_dircache_on_enumerated,
+                                   _sandbox_utils_dircache_dir_ref (dir));
+
+  return FALSE;
+}
+
+/*
+ * Returns the listing of @folder, a table of file names to
+ * #SandboxUtilsDirEntry, or %NULL if @folder is not loaded. The table is kept
+ * up to date from the main loop, so it must not be held across iterations of
+ * the main loop. Free with g_hash_table_unref().
+ */
+GHashTable *
+sandbox_utils_dircache_lookup (GFile *folder)
+{
+  SandboxUtilsDirectory *dir = NULL;
+  gchar                 *uri;
+
+  g_return_val_if_fail (G_IS_FILE (folder), NULL);
+
+  if (_directories)
+  {
+    uri = g_file_get_uri (folder);
+    dir = g_hash_table_lookup (_directories, uri);
+    SU_TRACE2 (dircache_lookup, uri, dir && !dir->loading);
+    g_free (uri);
+  }
+
+  if (!dir || dir->loading)
+  {
+    _stats.misses++;
+    return NULL;
+  }
+
+  _stats.hits++;
+  _sandbox_utils_dircache_touch (dir);
+
+  return g_hash_table_ref (dir->entries);
+}
+
+/* Loads the folders most dialogs start in */
+void
+sandbox_utils_dircache_prefill ()
+{
+  const gchar *paths[3];
+  GFile       *folder;
+  guint        i;
+
+  paths[0] = g_get_home_dir ();
+  paths[1] = g_get_user_special_dir (G_USER_DIRECTORY_DOCUMENTS);
+  paths[2] = g_get_user_special_dir (G_USER_DIRECTORY_DOWNLOAD);
+
+  for (i = 0; i < G_N_ELEMENTS (paths); i++)
+  {
+    if (!paths[i])
+      continue;
+
+    folder = g_file_new_for_path (paths[i]);
+    sandbox_utils_dircache_load (folder, NULL);
+    g_object_unref (folder);
+  }
+}
+
+/* Forgets all folders, and logs how well the cache did */
+void
+sandbox_utils_dircache_clear ()
+{
+  sandbox_utils_dircache_shrink (NULL);
+
+  if (_sweep_id)
+  {
+    g_source_remove (_sweep_id);
+    _sweep_id = 0;
+  }
+
+  if (_stats.hits || _stats.misses)
+    syslog (LOG_INFO,
+            "SandboxUtilsDirCache.Clear: %" G_GUINT64_FORMAT " hits and %" G_GUINT64_FORMAT " misses, %" G_GUINT64_FORMAT " folders evicted.\n",
+            _stats.hits, _stats.misses, _stats.evictions);
+}
+
+/*
+ * Shrinker for sandbox_utils_memory_add_shrinker(). Forgets all folders, and
+ * releases their monitors.
+ */
+guint
+sandbox_utils_dircache_shrink (gpointer data)
+{
+  SandboxUtilsDirectory *dir;
+  guint                  released = 0;
+
+  while ((dir = g_queue_peek_head (&_lru)) != NULL)
+  {
+    _sandbox_utils_dircache_evict (dir, FALSE);
+    released++;
+  }
+
+  return released;
+}
+
+void
+sandbox_utils_dircache_get_stats (SandboxUtilsDirCacheStats *stats)
+{
+  g_return_if_fail (stats != NULL);
+
+  *stats = _stats;
+}
@@ -0,0 +1,72 @@
+/* SandboxUtils -- Sandbox Utilities Directory Cache
+ * Copyright (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>, 2014
+ *
+ * Under GPLv3
+ *
+ ***
+ *
+ * Keeps the listing of recently used folders, shared by all dialogs and
+ * clients of the server, so that a folder is read from disk once rather than
+ * every time a dialog needs it. Folders are loaded in the background, then
+ * kept up to date with a GFileMonitor (inotify for local folders) rather than
+ * read again.
+ *
+ * The cache holds a bounded number of folders and bytes, and forgets folders
+ * that were not used for a while, the least recently used first. Folders that
+ * cannot be monitored are not kept, as their listing would go stale.
+ *
+ * Everything happens on the main loop.
+ *
+ */
+#ifndef _SANDBOX_UTILS_DIR_CACHE_H
+#define _SANDBOX_UTILS_DIR_CACHE_H
+
+#include <gio/gio.h>
+
+/* What the cache knows of a file, as listed in its folder */
+typedef struct {
+  gchar                 *name;          /* on-disk name, also the key */
+  gchar                 *display_name;
+  GFileType              type;
+  goffset                size;
+  gint64                 mtime;         /* seconds since the Epoch */
+  const gchar           *content_type;  /* interned, guessed from the name */
+} SandboxUtilsDirEntry;
+
+/* How well the cache does, since the server started */
+typedef struct {
+  guint64                hits;          /* lookups of loaded folders */
+  guint64                misses;        /* lookups that required a load */
+  guint64                evictions;     /* folders forgotten before being unused for long */
+  guint                  folders;       /* folders currently cached */
+  guint                  entries;       /* files currently listed */
+  guint                  watches;       /* file monitors, i.e. inotify watches */
+  gint64                 bytes;         /* estimated memory used by listings */
+} SandboxUtilsDirCacheStats;
+
+GOptionGroup *
+sandbox_utils_dircache_get_option_group ();
+
+gboolean
+sandbox_utils_dircache_get_enabled ();
+
+gboolean
+sandbox_utils_dircache_load (GFile        *folder,
+                             GCancellable *cancellable);
+
+GHashTable *
+sandbox_utils_dircache_lookup (GFile *folder);
+
+void
+sandbox_utils_dircache_prefill ();
+
+void
+sandbox_utils_dircache_clear ();
+
+guint
+sandbox_utils_dircache_shrink (gpointer data);
+
+void
+sandbox_utils_dircache_get_stats (SandboxUtilsDirCacheStats *stats);
+
+#endif /* #ifndef _SANDBOX_UTILS_DIR_CACHE_H */
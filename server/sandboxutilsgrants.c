@@ -0,0 +1,690 @@
+/* SandboxUtils -- Sandbox Utilities Grant Ledger
+ * Copyright (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>, 2014
+ *
+ * Under GPLv3
+ *
+ ***
+ *
+ * Writes the ledger of files granted to processes. See sandboxutilsgrants.h.
+ *
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sandboxutilsgrants.h"
+#include "sandboxutilscommon.h"
+#include "sandboxutilsledgerfile.h"
+
+static gboolean _option_disabled = FALSE;
+static gint     _option_capacity = 16384;
+
+static GOptionEntry entries[] =
+{
+  {
+    "no-grant-ledger", 0, 0, G_OPTION_ARG_NONE, &_option_disabled,
+    "Do not record which files were granted to which process", NULL
+  },
+  {
+    "grant-ledger-capacity", 0, 0, G_OPTION_ARG_INT, &_option_capacity,
+    "Number of grants the ledger holds before a new one is started (default: 16384)", "N"
+  },
+  {
+    NULL, ' ', 0, 0, NULL,
+    NULL, NULL
+  }
+};
+
+/* A grant made before the process running the dialog was known */
+typedef struct {
+  gchar                  *path;
+  SandboxUtilsLedgerMode  mode;
+} SandboxUtilsGrantsQueued;
+
+/* The process that runs a dialog */
+typedef struct {
+  guint32                pid;
+  guint32                uid;
+  guint64                start_time;  /* 0 while being identified */
+  GSList                *queued;      /* SandboxUtilsGrantsQueued, latest first */
+} SandboxUtilsGrantsClient;
+
+static GHashTable *_clients  = NULL;  /* dialog id -> SandboxUtilsGrantsClient */
+static gchar      *_filename = NULL;
+static guint8     *_base     = NULL;
+static gsize       _size     = 0;
+
+static void
+_sandbox_utils_grants_queued_free (gpointer data)
+{
+  SandboxUtilsGrantsQueued *queued = data;
+
+  g_free (queued->path);
+  g_free (queued);
+}
+
+static void
+_sandbox_utils_grants_client_free (gpointer data)
+{
+  SandboxUtilsGrantsClient *client = data;
+
+  g_slist_free_full (client->queued, _sandbox_utils_grants_queued_free);
+  g_free (client);
+}
+
+GOptionGroup *
+sandbox_utils_grants_get_option_group ()
+{
+  GOptionGroup *group;
+
+  group = g_option_group_new ("grants", "Grant Ledger", "Show grant ledger options", NULL, NULL);
+
+  g_option_group_add_entries (group, entries);
+  g_option_group_set_translation_domain (group, NULL);
+
+  return group;
+}
+
+gboolean
+sandbox_utils_grants_get_enabled ()
+{
+  return !_option_disabled;
+}
+
+/*
+ * Points a slot of @key at record @index, or moves the slot already pointing
+ * at an older grant of the same file to the same process.
+ */
+static void
+_sandbox_utils_grants_index_key (guint8   *base,
+                                 guint64   key,
+                                 guint32   index,
+                                 gboolean  by_path)
+{
+  SandboxUtilsLedgerHeader *header  = (SandboxUtilsLedgerHeader *) base;
+  SandboxUtilsLedgerSlot   *slots   = _sandboxutils_ledger_get_slots (base);
+  SandboxUtilsLedgerRecord *records = _sandboxutils_ledger_get_records (base);
+  SandboxUtilsLedgerRecord *record  = &records[index];
+  guint32                   mask    = header->n_slots - 1;
+  guint32                   i;
+
+  // Slots are four times as many as records, so an empty one is always found
+  for (i = key & mask; ; i = (i + 1) & mask)
+  {
+    if (slots[i].key == 0)
+    {
+      slots[i].record = index + 1;
+      __atomic_store_n (&slots[i].key, key, __ATOMIC_RELEASE);
+      return;
+    }
+
+    if (slots[i].key == key &&
+        _sandboxutils_ledger_record_matches (&records[slots[i].record - 1],
+                                             record->pid, record->start_time,
+                                             record->dev, record->ino,
+                                             by_path ? record->path : NULL))
+    {
+      __atomic_store_n (&slots[i].record, index + 1, __ATOMIC_RELEASE);
+      return;
+    }
+  }
+}
+
+static void
+_sandbox_utils_grants_index (guint8  *base,
+                             guint32  index)
+{
+  SandboxUtilsLedgerRecord *record = &_sandboxutils_ledger_get_records (base)[index];
+
+  if (record->ino)
+    _sandbox_utils_grants_index_key (base,
+                                     _sandboxutils_ledger_key_for_inode (record->pid, record->start_time,
+                                                                         record->dev, record->ino),
+                                     index, FALSE);
+
+  if (record->path_length < SANDBOXUTILS_LEDGER_PATH_MAX)
+    _sandbox_utils_grants_index_key (base,
+                                     _sandboxutils_ledger_key_for_path (record->pid, record->start_time,
+                                                                        record->path),
+                                     index, TRUE);
+}
+
+/* Writes @record at the end of the log of @base, then indexes it */
+static void
+_sandbox_utils_grants_commit (guint8                         *base,
+                              const SandboxUtilsLedgerRecord *record)
+{
+  SandboxUtilsLedgerHeader *header = (SandboxUtilsLedgerHeader *) base;
+  guint32                   index  = header->n_records;
+
+  memcpy (&_sandboxutils_ledger_get_records (base)[index], record, sizeof (SandboxUtilsLedgerRecord));
+  __atomic_store_n (&header->n_records, index + 1, __ATOMIC_RELEASE);
+  _sandbox_utils_grants_index (base, index);
+}
+
+/*
+ * Creates an empty ledger next to the current one, to be published with
+ * _sandbox_utils_grants_publish() once filled. Its magic is written last so
+ * that a ledger left half-initialised by a crash is never read.
+ */
+static guint8 *
+_sandbox_utils_grants_create (guint32   capacity,
+                              gsize    *size,
+                              gchar   **tmp)
+{
+  SandboxUtilsLedgerHeader *header;
+  guint32                   n_slots = 1;
+  guint8                   *base;
+  gint                      fd;
+
+  while (n_slots < capacity * 4)
+    n_slots <<= 1;
+
+  *size = _sandboxutils_ledger_get_size (n_slots, capacity);
+  *tmp  = g_strconcat (_filename, ".XXXXXX", NULL);
+
+  // Grants tell what the user works on, other users must not read them
+  if ((fd = g_mkstemp_full (*tmp, O_RDWR | O_CLOEXEC, 0600)) == -1)
+    goto fail;
+
+  if (ftruncate (fd, *size) == -1 ||
+      (base = mmap (NULL, *size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+  {
+    int saved = errno;
+
+    close (fd);
+    unlink (*tmp);
+    errno = saved;
+    goto fail;
+  }
+  close (fd);
+
+  header = (SandboxUtilsLedgerHeader *) base;
+  header->version  = SANDBOXUTILS_LEDGER_VERSION;
+  header->n_slots  = n_slots;
+  header->capacity = capacity;
+  __atomic_thread_fence (__ATOMIC_RELEASE);
+  memcpy (header->magic, SANDBOXUTILS_LEDGER_MAGIC, sizeof (header->magic));
+
+  return base;
+
+fail:
+  syslog (LOG_WARNING, "SandboxUtilsGrants.Create: could not create a ledger in '%s' (%s).\n",
+          _filename, g_strerror (errno));
+  g_free (*tmp);
+  *tmp = NULL;
+
+  return NULL;
+}
+
+/* Replaces the current ledger with @base, and tells readers to move on */
+static gboolean
+_sandbox_utils_grants_publish (guint8 *base,
+                               gsize   size,
+                               gchar  *tmp)
+{
+  if (rename (tmp, _filename) == -1)
+  {
+    syslog (LOG_WARNING, "SandboxUtilsGrants.Publish: could not replace '%s' (%s).\n",
+            _filename, g_strerror (errno));
+    munmap (base, size);
+    unlink (tmp);
+    g_free (tmp);
+    return FALSE;
+  }
+  g_free (tmp);
+
+  if (_base)
+  {
+    __atomic_store_n (&((SandboxUtilsLedgerHeader *) _base)->retired, 1, __ATOMIC_RELEASE);
+    munmap (_base, _size);
+  }
+
+  _base = base;
+  _size = size;
+
+  return TRUE;
+}
+
+/*
+ * Starts a new ledger once the current one is full, keeping the latest grant
+ * of each file to each process still running. The new ledger grows if those
+ * would fill more than half of it.
+ */
+static gboolean
+_sandbox_utils_grants_rotate (void)
+{
+  SandboxUtilsLedgerHeader *header  = (SandboxUtilsLedgerHeader *) _base;
+  SandboxUtilsLedgerRecord *records = _sandboxutils_ledger_get_records (_base);
+  SandboxUtilsLedgerRecord *record;
+  GHashTable               *running;
+  GArray                   *kept;
+  gpointer                  start;
+  guint8                   *base;
+  guint32                   capacity = header->capacity;
+  gsize                     size;
+  gchar                    *tmp;
+  gboolean                  rotated  = FALSE;
+  guint32                   i;
+
+  running = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_free);
+  kept    = g_array_new (FALSE, FALSE, sizeof (guint32));
+
+  for (i = 0; i < header->n_records; i++)
+  {
+    record = &records[i];
+
+    if ((start = g_hash_table_lookup (running, GUINT_TO_POINTER (record->pid))) == NULL)
+    {
+      start = g_new (guint64, 1);
+      *(guint64 *) start = sandboxutils_ledger_get_process_start (record->pid);
+      g_hash_table_insert (running, GUINT_TO_POINTER (record->pid), start);
+    }
+
+    // Only records still pointed at by the index are the latest of their file
+    if (*(guint64 *) start == record->start_time &&
+        (_sandboxutils_ledger_find (_base, record->pid, record->start_time, record->dev, record->ino, NULL) == record ||
+         (record->path_length < SANDBOXUTILS_LEDGER_PATH_MAX &&
+          _sandboxutils_ledger_find (_base, record->pid, record->start_time, 0, 0, record->path) == record)))
+      g_array_append_val (kept, i);
+  }
+
+  while (kept->len > capacity / 2)
+    capacity *= 2;
+
+  if ((base = _sandbox_utils_grants_create (capacity, &size, &tmp)) != NULL)
+  {
+    for (i = 0; i < kept->len; i++)
+      _sandbox_utils_grants_commit (base, &records[g_array_index (kept, guint32, i)]);
+
+    syslog (LOG_INFO, "SandboxUtilsGrants.Rotate: ledger full, %u grants to running processes kept.\n",
+            kept->len);
+
+    rotated = _sandbox_utils_grants_publish (base, size, tmp);
+  }
+
+  g_array_unref (kept);
+  g_hash_table_unref (running);
+
+  return rotated;
+}
+
+/*
+ * Maps the ledger left by a previous run, drops records torn by a crash and
+ * rebuilds the index from the others.
+ */
+static gboolean
+_sandbox_utils_grants_recover (void)
+{
+  SandboxUtilsLedgerHeader *header;
+  SandboxUtilsLedgerRecord *records;
+  struct stat               st;
+  guint8                   *base;
+  guint32                   n, valid;
+  gint                      fd;
+
+  if ((fd = open (_filename, O_RDWR | O_CLOEXEC | O_NOFOLLOW)) == -1)
+    return FALSE;
+
+  if (fstat (fd, &st) == -1 || !S_ISREG (st.st_mode) || st.st_uid != getuid () ||
+      st.st_size < (off_t) sizeof (SandboxUtilsLedgerHeader) ||
+      (base = mmap (NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+  {
+    close (fd);
+    return FALSE;
+  }
+  close (fd);
+
+  header = (SandboxUtilsLedgerHeader *) base;
+  if (!_sandboxutils_ledger_check_header (base, st.st_size) || header->retired)
+  {
+    munmap (base, st.st_size);
+    return FALSE;
+  }
+
+  records = _sandboxutils_ledger_get_records (base);
+  n       = MIN (header->n_records, header->capacity);
+
+  for (valid = 0; valid < n && records[valid].checksum == _sandboxutils_ledger_checksum (&records[valid]); valid++)
+    ;
+
+  if (valid < header->n_records)
+    syslog (LOG_WARNING, "SandboxUtilsGrants.Recover: %" G_GUINT64_FORMAT " torn or corrupt grants dropped.\n",
+            header->n_records - valid);
+
+  // Readers may miss grants until the index is rebuilt, never see wrong ones
+  header->n_records = 0;
+  memset (_sandboxutils_ledger_get_slots (base), 0, (gsize) header->n_slots * sizeof (SandboxUtilsLedgerSlot));
+  for (n = 0; n < valid; n++)
+  {
+    __atomic_store_n (&header->n_records, n + 1, __ATOMIC_RELEASE);
+    _sandbox_utils_grants_index (base, n);
+  }
+
+  _base = base;
+  _size = st.st_size;
+
+  syslog (LOG_DEBUG, "SandboxUtilsGrants.Recover: %u grants recovered from '%s'.\n", valid, _filename);
+
+  return TRUE;
+}
+
+static void
+_sandbox_utils_grants_append (const SandboxUtilsGrantsClient *client,
+                              const gchar                    *path,
+                              SandboxUtilsLedgerMode          mode)
+{
+  SandboxUtilsLedgerHeader *header = (SandboxUtilsLedgerHeader *) _base;
+  SandboxUtilsLedgerRecord  record;
+  struct stat               st;
+
+  if (header->n_records >= header->capacity && !_sandbox_utils_grants_rotate ())
+    return;
+
+  memset (&record, 0, sizeof (SandboxUtilsLedgerRecord));
+
+  // Files chosen to be saved to may not exist yet, they are found by path
+  if (stat (path, &st) == 0)
+  {
+    record.dev = st.st_dev;
+    record.ino = st.st_ino;
+  }
+
+  record.start_time  = client->start_time;
+  record.timestamp   = g_get_real_time ();
+  record.pid         = client->pid;
+  record.uid         = client->uid;
+  record.mode        = mode;
+  record.path_length = strlen (path);
+  g_strlcpy (record.path, path, SANDBOXUTILS_LEDGER_PATH_MAX);
+  record.checksum    = _sandboxutils_ledger_checksum (&record);
+
+  _sandbox_utils_grants_commit (_base, &record);
+}
+
+void
+sandbox_utils_grants_start ()
+{
+  guint8 *base;
+  gchar  *folder;
+  gchar  *tmp;
+  gsize   size;
+
+  if (_option_disabled || _base)
+    return;
+
+  _filename = _sandboxutils_ledger_get_filename ();
+  _clients  = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, _sandbox_utils_grants_client_free);
+
+  folder = g_path_get_dirname (_filename);
+  g_mkdir_with_parents (folder, 0700);
+  g_free (folder);
+
+  if (!_sandbox_utils_grants_recover () &&
+      (base = _sandbox_utils_grants_create (CLAMP (_option_capacity, 64, 1 << 20), &size, &tmp)) != NULL)
+    _sandbox_utils_grants_publish (base, size, tmp);
+
+  if (!_base)
+    syslog (LOG_WARNING, "SandboxUtilsGrants.Start: grants will not be recorded.\n");
+}
+
+void
+sandbox_utils_grants_stop ()
+{
+  if (_base)
+  {
+    // The ledger stays for readers, and for the next run to recover
+    msync (_base, _size, MS_ASYNC);
+    munmap (_base, _size);
+    _base = NULL;
+    _size = 0;
+  }
+
+  if (_clients)
+    g_hash_table_unref (_clients);
+  _clients = NULL;
+
+  g_free (_filename);
+  _filename = NULL;
+}
+
+/* A request for the credentials of a caller */
+typedef struct {
+  SandboxUtilsGrantsIdentifyFunc  func;
+  gpointer                        user_data;
+} SandboxUtilsGrantsIdentifyCall;
+
+static void
+_sandbox_utils_grants_on_credentials (GObject      *source,
+                                      GAsyncResult *res,
+                                      gpointer      user_data)
+{
+  SandboxUtilsGrantsIdentifyCall *call        = user_data;
+  GVariant                       *result;
+  GVariant                       *credentials;
+  GError                         *error       = NULL;
+  guint32                         pid         = 0;
+  guint32                         uid         = 0;
+  guint64                         start_time  = 0;
+
+  if ((result = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source), res, &error)) != NULL)
+  {
+    credentials = g_variant_get_child_value (result, 0);
+    g_variant_lookup (credentials, "ProcessID", "u", &pid);
+    g_variant_lookup (credentials, "UnixUserID", "u", &uid);
+    g_variant_unref (credentials);
+    g_variant_unref (result);
+
+    if (!pid || (start_time = sandboxutils_ledger_get_process_start (pid)) == 0)
+      g_set_error (&error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                   "SandboxUtilsGrants.Identify: the bus does not know which process the caller is.\n");
+  }
+
+  call->func (pid, uid, start_time, error, call->user_data);
+
+  if (error)
+    g_error_free (error);
+  g_free (call);
+}
+
+/*
+ * Finds out which process made @invocation, from the credentials of its bus
+ * connection, and calls @func on the main loop with it. The error passed to
+ * @func, if any, is freed once it returns.
+ */
+void
+sandbox_utils_grants_identify (GDBusMethodInvocation          *invocation,
+                               SandboxUtilsGrantsIdentifyFunc  func,
+                               gpointer                        user_data)
+{
+  SandboxUtilsGrantsIdentifyCall *call;
+  const gchar                    *sender = g_dbus_method_invocation_get_sender (invocation);
+
+  g_return_if_fail (func != NULL);
+
+  call = g_malloc (sizeof (SandboxUtilsGrantsIdentifyCall));
+  call->func      = func;
+  call->user_data = user_data;
+
+  g_dbus_connection_call (g_dbus_method_invocation_get_connection (invocation),
+                          "org.freedesktop.DBus",
+                          "/org/freedesktop/DBus",
+                          "org.freedesktop.DBus",
+                          "GetConnectionCredentials",
+                          g_variant_new ("(s)", sender ? sender : ""),
+                          G_VARIANT_TYPE ("(a{sv})"),
+                          G_DBUS_CALL_FLAGS_NONE,
+                          -1,
+                          NULL,
+                          _sandbox_utils_grants_on_credentials,
+                          call);
+}
+
+static void
+_sandbox_utils_grants_on_run_identified (guint32   pid,
+                                         guint32   uid,
+                                         guint64   start_time,
+                                         GError   *error,
+                                         gpointer  user_data)
+{
+  SandboxUtilsGrantsClient *client    = NULL;
+  SandboxUtilsGrantsQueued *queued;
+  gchar                    *dialog_id = user_data;
+  GSList                   *iter;
+
+  // The server may have stopped recording, or the dialog be gone, meanwhile
+  if (_clients)
+    client = g_hash_table_lookup (_clients, dialog_id);
+
+  if (client && error)
+  {
+    syslog (LOG_WARNING, "SandboxUtilsGrants.WatchRun: could not identify the process running dialog %s, %u grants are not recorded -- %s\n",
+            dialog_id, g_slist_length (client->queued), _sandboxutils_error_get_message (error));
+    g_hash_table_remove (_clients, dialog_id);
+  }
+  else if (client)
+  {
+    client->pid        = pid;
+    client->uid        = uid;
+    client->start_time = start_time;
+
+    // What the user chose while we were asking the bus is granted now
+    client->queued = g_slist_reverse (client->queued);
+    for (iter = client->queued; _base && iter; iter = iter->next)
+    {
+      queued = iter->data;
+      _sandbox_utils_grants_append (client, queued->path, queued->mode);
+    }
+    g_slist_free_full (client->queued, _sandbox_utils_grants_queued_free);
+    client->queued = NULL;
+  }
+
+  g_free (dialog_id);
+}
+
+/*
+ * Finds out which process asked to run a dialog, so that what the user
+ * chooses in it is granted to it. Grants made before the bus answers wait
+ * for it, so none are lost however fast the dialog is answered.
+ */
+void
+sandbox_utils_grants_watch_run (GDBusMethodInvocation *invocation,
+                                const gchar           *dialog_id)
+{
+  if (!_base || !g_dbus_method_invocation_get_sender (invocation))
+    return;
+
+  // Dialogs belong to one connection, a dialog run again has the same process
+  if (g_hash_table_contains (_clients, dialog_id))
+    return;
+
+  g_hash_table_insert (_clients, g_strdup (dialog_id), g_malloc0 (sizeof (SandboxUtilsGrantsClient)));
+  sandbox_utils_grants_identify (invocation, _sandbox_utils_grants_on_run_identified, g_strdup (dialog_id));
+}
+
+void
+sandbox_utils_grants_forget_dialog (const gchar *dialog_id)
+{
+  if (_clients)
+    g_hash_table_remove (_clients, dialog_id);
+}
+
+/*
+ * Records that the files at @filenames, chosen in @dialog_id, are granted to
+ * the process that ran it.
+ */
+void
+sandbox_utils_grants_record (const gchar            *dialog_id,
+                             GSList                 *filenames,
+                             SandboxUtilsLedgerMode  mode)
+{
+  SandboxUtilsGrantsClient *client;
+  SandboxUtilsGrantsQueued *queued;
+  GSList                   *iter;
+
+  if (!_base)
+    return;
+
+  client = g_hash_table_lookup (_clients, dialog_id);
+  if (!client)
+  {
+    syslog (LOG_WARNING, "SandboxUtilsGrants.Record: the process running dialog %s is unknown, its grants are not recorded.\n",
+            dialog_id);
+    return;
+  }
+
+  for (iter = filenames; iter; iter = iter->next)
+  {
+    if (!g_path_is_absolute (iter->data))
+      continue;
+
+    if (client->start_time)
+      _sandbox_utils_grants_append (client, iter->data, mode);
+    else
+    {
+      queued = g_malloc (sizeof (SandboxUtilsGrantsQueued));
+      queued->path = g_strdup (iter->data);
+      queued->mode = mode;
+      client->queued = g_slist_prepend (client->queued, queued);
+    }
+  }
+}
+
+/*
+ * Tells whether @path was granted to the running process @pid, by inode if
+ * the file exists and by path otherwise.
+ */
+gboolean
+sandbox_utils_grants_check (guint32                  pid,
+                            const gchar             *path,
+                            SandboxUtilsLedgerMode  *mode,
+                            gint64                  *timestamp)
+{
+  guint64 start_time;
+
+  if ((start_time = sandboxutils_ledger_get_process_start (pid)) == 0)
+    return FALSE;
+
+  return sandbox_utils_grants_check_process (pid, start_time, path, mode, timestamp);
+}
+
+/*
+ * Tells whether @path was granted to the process @pid that started at
+ * @start_time, as found by sandbox_utils_grants_identify(). Refuses if @pid
+ * is now another process, whose grants would otherwise be looked at.
+ */
+gboolean
+sandbox_utils_grants_check_process (guint32                  pid,
+                                    guint64                  start_time,
+                                    const gchar             *path,
+                                    SandboxUtilsLedgerMode  *mode,
+                                    gint64                  *timestamp)
+{
+  const SandboxUtilsLedgerRecord *record = NULL;
+  struct stat                     st;
+
+  g_return_val_if_fail (path != NULL, FALSE);
+
+  if (!_base || !start_time || sandboxutils_ledger_get_process_start (pid) != start_time)
+    return FALSE;
+
+  if (stat (path, &st) == 0)
+    record = _sandboxutils_ledger_find (_base, pid, start_time, st.st_dev, st.st_ino, NULL);
+
+  if (!record)
+    record = _sandboxutils_ledger_find (_base, pid, start_time, 0, 0, path);
+
+  if (!record)
+    return FALSE;
+
+  if (mode)
+    *mode = record->mode;
+  if (timestamp)
+    *timestamp = record->timestamp;
+
+  return TRUE;
+}
@@ -0,0 +1,80 @@
+/* SandboxUtils -- Sandbox Utilities Grant Ledger
+ * Copyright (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>, 2014
+ *
+ * Under GPLv3
+ *
+ ***
+ *
+ * Records every file the user chooses in a dialog, along with the process
+ * that ran the dialog, how the file was chosen and when. Other sandbox
+ * components, like file mediation layers and policy daemons, can then tell
+ * whether a process may access a file without asking the user again.
+ *
+ * Grants are appended to a ledger in the user's runtime directory, which
+ * other processes map read-only with sandboxutils_ledger_open() and look up
+ * without any system call. The ledger survives crashes of the server, whose
+ * index is rebuilt from the log when it starts again. See
+ * lib/sandboxutilsledgerfile.h for its layout. Grants can also be checked
+ * with the CheckGrant method.
+ *
+ * Processes are identified by the credentials of the bus connection that
+ * asked to run the dialog, fetched from the bus when the dialog is run. Files
+ * chosen before the bus answers are recorded once it does.
+ *
+ */
+#ifndef _SANDBOX_UTILS_GRANTS_H
+#define _SANDBOX_UTILS_GRANTS_H
+
+#include <gio/gio.h>
+#include "sandboxutilsledger.h"
+
+/* Called on the main loop with the process that made a call, or an error */
+typedef void (*SandboxUtilsGrantsIdentifyFunc) (guint32   pid,
+                                                guint32   uid,
+                                                guint64   start_time,
+                                                GError   *error,
+                                                gpointer  user_data);
+
+GOptionGroup *
+sandbox_utils_grants_get_option_group ();
+
+gboolean
+sandbox_utils_grants_get_enabled ();
+
+void
+sandbox_utils_grants_start ();
+
+void
+sandbox_utils_grants_stop ();
+
+void
+sandbox_utils_grants_identify (GDBusMethodInvocation          *invocation,
+                               SandboxUtilsGrantsIdentifyFunc  func,
+                               gpointer                        user_data);
+
+void
+sandbox_utils_grants_watch_run (GDBusMethodInvocation *invocation,
+                                const gchar           *dialog_id);
+
+void
+sandbox_utils_grants_forget_dialog (const gchar *dialog_id);
+
+void
+sandbox_utils_grants_record (const gchar            *dialog_id,
+                             GSList                 *filenames,
+                             SandboxUtilsLedgerMode  mode);
+
+gboolean
+sandbox_utils_grants_check (guint32                  pid,
+                            const gchar             *path,
+                            SandboxUtilsLedgerMode  *mode,
+                            gint64                  *timestamp);
+
+gboolean
+sandbox_utils_grants_check_process (guint32                  pid,
+                                    guint64                  start_time,
+                                    const gchar             *path,
+                                    SandboxUtilsLedgerMode  *mode,
+                                    gint64                  *timestamp);
+
+#endif /* #ifndef _SANDBOX_UTILS_GRANTS_H */
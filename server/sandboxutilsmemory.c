@@ -0,0 +1,238 @@
+/* SandboxUtils -- Sandbox Utilities Memory Pressure Handling
+ * Copyright (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>, 2014
+ *
+ * Under GPLv3
+ *
+ ***
+ *
+ * Shrinks the server on low memory warnings. See sandboxutilsmemory.h.
+ *
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include "sandboxutilsmemory.h"
+#include "sandboxutilstrace.h"
+
+// Warnings keep coming while memory is low; shrinking again right away would
+// only burn CPU, unless things got worse
+#define SANDBOX_UTILS_MEMORY_SHRINK_INTERVAL (10 * G_TIME_SPAN_SECOND)
+
+static gboolean _option_no_shrink = FALSE;
+
+static GOptionEntry entries[] =
+{
+  {
+    "no-low-memory-shrink", 0, 0, G_OPTION_ARG_NONE, &_option_no_shrink,
+    "Do not release idle dialogs and caches when the system runs low on memory", NULL
+  },
+  {
+    NULL, ' ', 0, 0, NULL,
+    NULL, NULL
+  }
+};
+
+typedef struct {
+  gchar                  *name;
+  SandboxUtilsShrinkFunc  func;
+  gpointer                data;
+} SandboxUtilsShrinker;
+
+static GSList                  *_shrinkers       = NULL;
+static SandboxUtilsMemoryStats  _stats;
+static GObject                 *_monitor         = NULL;
+static gulong                   _monitor_handler = 0;
+static gint64                   _last_shrink     = 0;
+static gint                     _last_level      = 0;
+
+GOptionGroup *
+sandbox_utils_memory_get_option_group ()
+{
+  GOptionGroup *group;
+
+  group = g_option_group_new ("memory", "Memory Pressure", "Show memory pressure options", NULL, NULL);
+
+  g_option_group_add_entries (group, entries);
+  g_option_group_set_translation_domain (group, NULL);
+
+  return group;
+}
+
+/*
+ * Registers @func to be called from the main loop when memory runs low. There
+ * is no way to unregister, so @data must live as long as the server.
+ */
+void
+sandbox_utils_memory_add_shrinker (const gchar            *name,
+                                   SandboxUtilsShrinkFunc  func,
+                                   gpointer                data)
+{
+  SandboxUtilsShrinker *shrinker;
+
+  g_return_if_fail (name != NULL);
+  g_return_if_fail (func != NULL);
+
+  shrinker = g_malloc (sizeof (SandboxUtilsShrinker));
+  shrinker->name = g_strdup (name);
+  shrinker->func = func;
+  shrinker->data = data;
+
+  _shrinkers = g_slist_append (_shrinkers, shrinker);
+}
+
+static gint64
+_sandbox_utils_memory_read_heap ()
+{
+#if defined (__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+  struct mallinfo2 info = mallinfo2 ();
+
+  return (gint64) info.uordblks + (gint64) info.hblkhd;
+#elif defined (__GLIBC__)
+  struct mallinfo info = mallinfo ();
+
+  return (gint64) info.uordblks + (gint64) info.hblkhd;
+#else
+  return 0;
+#endif
+}
+
+static gint64
+_sandbox_utils_memory_read_rss ()
+{
+  gchar   *contents = NULL;
+  gchar  **fields;
+  gint64   rss      = 0;
+
+  // statm is in pages: size, then resident
+  if (g_file_get_contents ("/proc/self/statm", &contents, NULL, NULL))
+  {
+    fields = g_strsplit (contents, " ", 3);
+    if (fields[0] && fields[1])
+      rss = g_ascii_strtoll (fields[1], NULL, 10) * sysconf (_SC_PAGESIZE);
+    g_strfreev (fields);
+  }
+
+  g_free (contents);
+
+  return rss;
+}
+
+/* Resident memory of the server, in bytes, or 0 if it cannot be read */
+gint64
+sandbox_utils_memory_get_rss ()
+{
+  return _sandbox_utils_memory_read_rss ();
+}
+
+/*
+ * Releases everything the server can do without right now. Called on low
+ * memory warnings, and can be called directly e.g. after many dialogs were
+ * destroyed.
+ */
+void
+sandbox_utils_memory_shrink ()
+{
+  SandboxUtilsShrinker *shrinker;
+  GSList               *iter;
+  guint                 released;
+  guint                 items = 0;
+  gint64                heap;
+  gint64                rss;
+
+  heap = _sandbox_utils_memory_read_heap ();
+  rss  = _sandbox_utils_memory_read_rss ();
+
+  for (iter = _shrinkers; iter; iter = iter->next)
+  {
+    shrinker = iter->data;
+    released = shrinker->func (shrinker->data);
+    items   += released;
+
+    syslog (LOG_DEBUG, "SandboxUtilsMemory.Shrink: '%s' released %u items.\n",
+            shrinker->name, released);
+  }
+
+#ifdef __GLIBC__
+  malloc_trim (0);
+#endif
+
+  heap = MAX (heap - _sandbox_utils_memory_read_heap (), 0);
+  rss  = MAX (rss - _sandbox_utils_memory_read_rss (), 0);
+
+  _stats.shrinks++;
+  _stats.items      += items;
+  _stats.heap_bytes += heap;
+  _stats.rss_bytes  += rss;
+
+  SU_TRACE3 (memory_shrink, items, heap, rss);
+
+  syslog (LOG_INFO,
+          "SandboxUtilsMemory.Shrink: released %u items, %" G_GINT64_FORMAT " heap bytes and %" G_GINT64_FORMAT " resident bytes (%" G_GINT64_FORMAT " and %" G_GINT64_FORMAT " since start).\n",
+          items, heap, rss, _stats.heap_bytes, _stats.rss_bytes);
+}
+
+#if GLIB_CHECK_VERSION (2, 64, 0)
+static void
+_sandbox_utils_memory_on_warning (GMemoryMonitor             *monitor,
+                                  GMemoryMonitorWarningLevel  level,
+                                  gpointer                    user_data)
+{
+  gint64 now = g_get_monotonic_time ();
+
+  if (level <= _last_level && now - _last_shrink < SANDBOX_UTILS_MEMORY_SHRINK_INTERVAL)
+    return;
+
+  syslog (LOG_NOTICE, "SandboxUtilsMemory.OnWarning: the system is low on memory (level %d), shrinking.\n",
+          level);
+
+  _last_level  = level;
+  _last_shrink = now;
+
+  sandbox_utils_memory_shrink ();
+}
+#endif
+
+/* Starts listening to low memory warnings, unless disabled by the user */
+void
+sandbox_utils_memory_monitor_start ()
+{
+  if (_option_no_shrink || _monitor)
+    return;
+
+#if GLIB_CHECK_VERSION (2, 64, 0)
+  _monitor = G_OBJECT (g_memory_monitor_dup_default ());
+  _monitor_handler = g_signal_connect (_monitor, "low-memory-warning",
+                                       G_CALLBACK (_sandbox_utils_memory_on_warning), NULL);
+#else
+  syslog (LOG_INFO, "SandboxUtilsMemory.MonitorStart: GLib is too old to report low memory, will not shrink.\n");
+#endif
+}
+
+void
+sandbox_utils_memory_monitor_stop ()
+{
+  if (_monitor)
+  {
+    g_signal_handler_disconnect (_monitor, _monitor_handler);
+    g_object_unref (_monitor);
+    _monitor = NULL;
+  }
+
+  if (_stats.shrinks)
+    syslog (LOG_INFO,
+            "SandboxUtilsMemory.MonitorStop: shrank %u times, released %" G_GUINT64_FORMAT " items, %" G_GINT64_FORMAT " heap bytes and %" G_GINT64_FORMAT " resident bytes.\n",
+            _stats.shrinks, _stats.items, _stats.heap_bytes, _stats.rss_bytes);
+}
+
+void
+sandbox_utils_memory_get_stats (SandboxUtilsMemoryStats *stats)
+{
+  g_return_if_fail (stats != NULL);
+
+  *stats = _stats;
+}
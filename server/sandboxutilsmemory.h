@@ -0,0 +1,56 @@
+/* SandboxUtils -- Sandbox Utilities Memory Pressure Handling
+ * Copyright (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>, 2014
+ *
+ * Under GPLv3
+ *
+ ***
+ *
+ * Makes the server give memory back when the system runs low on it, before
+ * the OOM killer has to pick a victim. Low memory warnings come from
+ * GMemoryMonitor, which relies on PSI or on the low-memory-monitor daemon.
+ *
+ * On a warning, every registered shrinker gets to release what it can (idle
+ * dialog widgets, caches, pools), and free heap pages are then given back to
+ * the system with malloc_trim().
+ *
+ */
+#ifndef _SANDBOX_UTILS_MEMORY_H
+#define _SANDBOX_UTILS_MEMORY_H
+
+#include <gio/gio.h>
+
+/* Releases memory held by @data, returns the number of items released */
+typedef guint (*SandboxUtilsShrinkFunc) (gpointer data);
+
+/* What was reclaimed since the server started */
+typedef struct {
+  guint                  shrinks;        /* times the server was shrunk */
+  guint64                items;          /* items released by shrinkers */
+  gint64                 heap_bytes;     /* heap given back, according to malloc */
+  gint64                 rss_bytes;      /* drop in resident memory */
+} SandboxUtilsMemoryStats;
+
+GOptionGroup *
+sandbox_utils_memory_get_option_group ();
+
+void
+sandbox_utils_memory_add_shrinker (const gchar            *name,
+                                   SandboxUtilsShrinkFunc  func,
+                                   gpointer                data);
+
+void
+sandbox_utils_memory_monitor_start ();
+
+void
+sandbox_utils_memory_monitor_stop ();
+
+void
+sandbox_utils_memory_shrink ();
+
+void
+sandbox_utils_memory_get_stats (SandboxUtilsMemoryStats *stats);
+
+gint64
+sandbox_utils_memory_get_rss ();
+
+#endif /* #ifndef _SANDBOX_UTILS_MEMORY_H */
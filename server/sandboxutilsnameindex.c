@@ -0,0 +1,532 @@
+/* SandboxUtils -- Sandbox Utilities File Name Index
+ * Copyright (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>, 2014
+ *
+ * Under GPLv3
+ *
+ ***
+ *
+ * Writes and reads memory-mapped file name indexes. See
+ * sandboxutilsnameindex.h for what they contain.
+ *
+ */
+#define _GNU_SOURCE
+#include <string.h>
+
+#include "sandboxutilsnameindex.h"
+
+#define SANDBOX_UTILS_NAME_INDEX_MAGIC   "SUNI"
+#define SANDBOX_UTILS_NAME_INDEX_VERSION 1
+
+/* Start of the file. Section offsets are counted from the start of the file */
+typedef struct {
+  gchar    magic[4];
+  guint32  version;
+  guint32  n_paths;
+  guint32  n_tokens;
+  guint64  path_starts;   /* guint32 [n_paths], offsets in strings */
+  guint64  name_starts;   /* guint32 [n_paths], offsets in names */
+  guint64  names;
+  guint64  names_size;
+  guint64  tokens;        /* SandboxUtilsNameIndexToken [n_tokens] */
+  guint64  strings;       /* paths and tokens, NUL terminated */
+  guint64  strings_size;
+} SandboxUtilsNameIndexHeader;
+
+typedef struct {
+  guint32  token;         /* offset in strings */
+  guint32  id;
+} SandboxUtilsNameIndexToken;
+
+struct _SandboxUtilsNameIndex
+{
+  GMappedFile                       *file;
+  const SandboxUtilsNameIndexHeader *header;
+  const guint32                     *path_starts;
+  const guint32                     *name_starts;
+  const gchar                       *names;
+  const SandboxUtilsNameIndexToken  *tokens;
+  const gchar                       *strings;
+};
+
+/* A token of a name, while writing */
+typedef struct {
+  const gchar *token;     /* owned by the table of distinct tokens */
+  guint32      rank;      /* of the token among sorted distinct tokens */
+  guint32      id;
+} SandboxUtilsNameIndexPending;
+
+/* Appends @data to @buffer at a multiple of 8 bytes, returns its offset */
+static guint64
+_sandbox_utils_name_index_append (GByteArray    *buffer,
+                                  gconstpointer  data,
+                                  gsize          size)
+{
+  static const guint8 padding[8] = { 0 };
+  guint64             offset;
+
+  if (buffer->len % 8)
+    g_byte_array_append (buffer, padding, 8 - buffer->len % 8);
+
+  offset = buffer->len;
+  g_byte_array_append (buffer, data, size);
+
+  return offset;
+}
+
+static gint
+_sandbox_utils_name_index_compare_strings (gconstpointer a,
+                                           gconstpointer b)
+{
+  return strcmp (*(const gchar **) a, *(const gchar **) b);
+}
+
+static gint
+_sandbox_utils_name_index_compare_pending (gconstpointer a,
+                                           gconstpointer b)
+{
+  const SandboxUtilsNameIndexPending *pa = a;
+  const SandboxUtilsNameIndexPending *pb = b;
+
+  if (pa->rank != pb->rank)
+    return pa->rank < pb->rank ? -1 : 1;
+
+  return pa->id < pb->id ? -1 : pa->id > pb->id;
+}
+
+/* Adds the words of @key, a casefolded name, to @pending */
+static void
+_sandbox_utils_name_index_tokenize (const gchar *key,
+                                    guint32      id,
+                                    GHashTable  *distinct,
+                                    GArray      *pending)
+{
+  SandboxUtilsNameIndexPending  entry;
+  const gchar                  *start;
+  const gchar                  *p;
+  gchar                        *token;
+  gpointer                      interned;
+  guint                         first = pending->len;
+  guint                         i;
+  gboolean                      seen;
+
+  for (p = key; *p; )
+  {
+    // Words are runs of letters and digits
+    while (*p && !g_unichar_isalnum (g_utf8_get_char (p)))
+      p = g_utf8_next_char (p);
+
+    start = p;
+    while (*p && g_unichar_isalnum (g_utf8_get_char (p)))
+      p = g_utf8_next_char (p);
+
+    if (p == start)
+      continue;
+
+    token = g_strndup (start, p - start);
+    if (g_hash_table_lookup_extended (distinct, token, &interned, NULL))
+      g_free (token);
+    else
+    {
+      g_hash_table_add (distinct, token);
+      interned = token;
+    }
+
+    // Names have a handful of words, a linear search is enough
+    for (seen = FALSE, i = first; i < pending->len && !seen; i++)
+      seen = (g_array_index (pending, SandboxUtilsNameIndexPending, i).token == interned);
+
+    if (!seen)
+    {
+      entry.token = interned;
+      entry.rank  = 0;
+      entry.id    = id;
+      g_array_append_val (pending, entry);
+    }
+  }
+}
+
+/*
+ * Writes an index of @paths, an array of absolute paths whose positions become
+ * their ids, to @filename. The file is replaced atomically, so that a previous
+ * index remains valid for whoever has it mapped. Can be called from any thread.
+ */
+gboolean
+sandbox_utils_name_index_write (GPtrArray    *paths,
+                                const gchar  *filename,
+                                GError      **error)
+{
+  SandboxUtilsNameIndexHeader   header;
+  SandboxUtilsNameIndexPending *entry;
+  SandboxUtilsNameIndexToken   *tokens;
+  GByteArray                   *strings;
+  GByteArray                   *names;
+  GByteArray                   *buffer;
+  GArray                       *path_starts;
+  GArray                       *name_starts;
+  GArray                       *pending;
+  GHashTable                   *distinct;
+  GHashTable                   *ranks;
+  GPtrArray                    *sorted;
+  GHashTableIter                iter;
+  const gchar                  *path;
+  const gchar                  *base;
+  gchar                        *key;
+  guint32                      *token_starts;
+  guint32                       offset;
+  gboolean                      written;
+  guint                         i;
+
+  g_return_val_if_fail (paths != NULL, FALSE);
+  g_return_val_if_fail (filename != NULL, FALSE);
+
+  strings     = g_byte_array_new ();
+  names       = g_byte_array_new ();
+  path_starts = g_array_sized_new (FALSE, FALSE, sizeof (guint32), paths->len);
+  name_starts = g_array_sized_new (FALSE, FALSE, sizeof (guint32), paths->len);
+  pending     = g_array_sized_new (FALSE, FALSE, sizeof (SandboxUtilsNameIndexPending), paths->len * 3);
+  distinct    = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  for (i = 0; i < paths->len; i++)
+  {
+    path = g_ptr_array_index (paths, i);
+    base = strrchr (path, G_DIR_SEPARATOR);
+    base = base && base[1] ? base + 1 : path;
+    key  = g_utf8_casefold (base, -1);
+
+    offset = strings->len;
+    g_array_append_val (path_starts, offset);
+    g_byte_array_append (strings, (const guint8 *) path, strlen (path) + 1);
+
+    offset = names->len;
+    g_array_append_val (name_starts, offset);
+    g_byte_array_append (names, (const guint8 *) key, strlen (key) + 1);
+
+    _sandbox_utils_name_index_tokenize (key, i, distinct, pending);
+    g_free (key);
+  }
+
+  // Distinct tokens go after the paths, in sorted order, so that sorting the
+  // (token, id) pairs only compares integers
+  sorted = g_ptr_array_sized_new (g_hash_table_size (distinct));
+  g_hash_table_iter_init (&iter, distinct);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &key, NULL))
+    g_ptr_array_add (sorted, key);
+  g_ptr_array_sort (sorted, _sandbox_utils_name_index_compare_strings);
+
+  ranks        = g_hash_table_new (g_direct_hash, g_direct_equal);
+  token_starts = g_new (guint32, sorted->len + 1);
+  for (i = 0; i < sorted->len; i++)
+  {
+    key = g_ptr_array_index (sorted, i);
+    g_hash_table_insert (ranks, key, GUINT_TO_POINTER (i));
+    token_starts[i] = strings->len;
+    g_byte_array_append (strings, (const guint8 *) key, strlen (key) + 1);
+  }
+
+  for (i = 0; i < pending->len; i++)
+  {
+    entry = &g_array_index (pending, SandboxUtilsNameIndexPending, i);
+    entry->rank = GPOINTER_TO_UINT (g_hash_table_lookup (ranks, entry->token));
+  }
+  g_array_sort (pending, _sandbox_utils_name_index_compare_pending);
+
+  tokens = g_new (SandboxUtilsNameIndexToken, pending->len + 1);
+  for (i = 0; i < pending->len; i++)
+  {
+    entry = &g_array_index (pending, SandboxUtilsNameIndexPending, i);
+    tokens[i].token = token_starts[entry->rank];
+    tokens[i].id    = entry->id;
+  }
+
+  if (strings->len >= G_MAXUINT32 || names->len >= G_MAXUINT32 || pending->len >= G_MAXUINT32)
+  {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_NO_SPACE,
+                 "Too many files to index (%u paths)", paths->len);
+    written = FALSE;
+  }
+  else
+  {
+    memset (&header, 0, sizeof (header));
+    memcpy (header.magic, SANDBOX_UTILS_NAME_INDEX_MAGIC, 4);
+    header.version      = SANDBOX_UTILS_NAME_INDEX_VERSION;
+    header.n_paths      = paths->len;
+    header.n_tokens     = pending->len;
+    header.names_size   = names->len;
+    header.strings_size = strings->len;
+
+    buffer = g_byte_array_sized_new (sizeof (header) + strings->len + names->len +
+                                     paths->len * 2 * sizeof (guint32) +
+                                     pending->len * sizeof (SandboxUtilsNameIndexToken) + 64);
+    g_byte_array_append (buffer, (const guint8 *) &header, sizeof (header));
+
+    header.path_starts = _sandbox_utils_name_index_append (buffer, path_starts->data, path_starts->len * sizeof (guint32));
+    header.name_starts = _sandbox_utils_name_index_append (buffer, name_starts->data, name_starts->len * sizeof (guint32));
+    header.names       = _sandbox_utils_name_index_append (buffer, names->data, names->len);
+    header.tokens      = _sandbox_utils_name_index_append (buffer, tokens, pending->len * sizeof (SandboxUtilsNameIndexToken));
+    header.strings     = _sandbox_utils_name_index_append (buffer, strings->data, strings->len);
+    memcpy (buffer->data, &header, sizeof (header));
+
+    written = g_file_set_contents (filename, (const gchar *) buffer->data, buffer->len, error);
+    g_byte_array_unref (buffer);
+  }
+
+  g_free (tokens);
+  g_free (token_starts);
+  g_hash_table_unref (ranks);
+  g_ptr_array_unref (sorted);
+  g_hash_table_unref (distinct);
+  g_array_unref (pending);
+  g_array_unref (name_starts);
+  g_array_unref (path_starts);
+  g_byte_array_unref (names);
+  g_byte_array_unref (strings);
+
+  return written;
+}
+
+static gboolean
+_sandbox_utils_name_index_section_valid (gsize   file_size,
+                                         guint64 offset,
+                                         guint64 size)
+{
+  return offset >= sizeof (SandboxUtilsNameIndexHeader) && offset % 8 == 0 &&
+         offset <= file_size && size <= file_size - offset;
+}
+
+/*
+ * Maps the index stored in @filename. Everything that later lookups rely on
+ * is checked here, so that a truncated or corrupt file is rejected rather
+ * than read out of bounds.
+ */
+SandboxUtilsNameIndex *
+sandbox_utils_name_index_open (const gchar  *filename,
+                               GError      **error)
+{
+  const SandboxUtilsNameIndexHeader *header;
+  SandboxUtilsNameIndex             *index;
+  GMappedFile                       *file;
+  const gchar                       *contents;
+  gsize                              size;
+  gboolean                           valid;
+  guint                              i;
+
+  g_return_val_if_fail (filename != NULL, NULL);
+
+  file = g_mapped_file_new (filename, FALSE, error);
+  if (!file)
+    return NULL;
+
+  contents = g_mapped_file_get_contents (file);
+  size     = g_mapped_file_get_length (file);
+  header   = (const SandboxUtilsNameIndexHeader *) contents;
+
+  valid = size >= sizeof (SandboxUtilsNameIndexHeader) &&
+          memcmp (header->magic, SANDBOX_UTILS_NAME_INDEX_MAGIC, 4) == 0 &&
+          header->version == SANDBOX_UTILS_NAME_INDEX_VERSION;
+
+  valid = valid &&
+          _sandbox_utils_name_index_section_valid (size, header->path_starts, (guint64) header->n_paths * sizeof (guint32)) &&
+          _sandbox_utils_name_index_section_valid (size, header->name_starts, (guint64) header->n_paths * sizeof (guint32)) &&
+          _sandbox_utils_name_index_section_valid (size, header->names, header->names_size) &&
+          _sandbox_utils_name_index_section_valid (size, header->tokens, (guint64) header->n_tokens * sizeof (SandboxUtilsNameIndexToken)) &&
+          _sandbox_utils_name_index_section_valid (size, header->strings, header->strings_size);
+
+  // Strings must be terminated, and offsets must point within their blocks
+  valid = valid &&
+          (header->names_size == 0 || contents[header->names + header->names_size - 1] == '\0') &&
+          (header->strings_size == 0 || contents[header->strings + header->strings_size - 1] == '\0');
+
+  if (!valid)
+  {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                 "%s is not a valid file name index", filename);
+    g_mapped_file_unref (file);
+    return NULL;
+  }
+
+  index = g_malloc (sizeof (SandboxUtilsNameIndex));
+  index->file        = file;
+  index->header      = header;
+  index->path_starts = (const guint32 *) (contents + header->path_starts);
+  index->name_starts = (const guint32 *) (contents + header->name_starts);
+  index->names       = contents + header->names;
+  index->tokens      = (const SandboxUtilsNameIndexToken *) (contents + header->tokens);
+  index->strings     = contents + header->strings;
+
+  for (i = 0; valid && i < header->n_paths; i++)
+    valid = index->path_starts[i] < header->strings_size &&
+            index->name_starts[i] < header->names_size &&
+            (i == 0 || index->name_starts[i] > index->name_starts[i - 1]);
+
+  for (i = 0; valid && i < header->n_tokens; i++)
+    valid = index->tokens[i].token < header->strings_size &&
+            index->tokens[i].id < header->n_paths;
+
+  if (!valid)
+  {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                 "%s is not a valid file name index", filename);
+    sandbox_utils_name_index_free (index);
+    return NULL;
+  }
+
+  return index;
+}
+
+void
+sandbox_utils_name_index_free (SandboxUtilsNameIndex *index)
+{
+  if (!index)
+    return;
+
+  g_mapped_file_unref (index->file);
+  g_free (index);
+}
+
+guint
+sandbox_utils_name_index_get_size (SandboxUtilsNameIndex *index)
+{
+  g_return_val_if_fail (index != NULL, 0);
+
+  return index->header->n_paths;
+}
+
+const gchar *
+sandbox_utils_name_index_get_path (SandboxUtilsNameIndex *index,
+                                   guint                  id)
+{
+  g_return_val_if_fail (index != NULL, NULL);
+  g_return_val_if_fail (id < index->header->n_paths, NULL);
+
+  return index->strings + index->path_starts[id];
+}
+
+/*
+ * Returns the ids of up to @max_results names with a word starting with
+ * @prefix, which must be casefolded, in id order within each word.
+ */
+GArray *
+sandbox_utils_name_index_find_token (SandboxUtilsNameIndex *index,
+                                     const gchar           *prefix,
+                                     guint                  max_results)
+{
+  GArray     *ids;
+  GHashTable *seen;
+  gsize       len;
+  guint       low;
+  guint       high;
+  guint       middle;
+  guint32     id;
+
+  g_return_val_if_fail (index != NULL, NULL);
+  g_return_val_if_fail (prefix != NULL, NULL);
+
+  ids = g_array_new (FALSE, FALSE, sizeof (guint));
+  len = strlen (prefix);
+  if (!len)
+    return ids;
+
+  // First token not sorted before the prefix
+  for (low = 0, high = index->header->n_tokens; low < high; )
+  {
+    middle = low + (high - low) / 2;
+    if (strcmp (index->strings + index->tokens[middle].token, prefix) < 0)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+
+  // A name with two words starting with the prefix appears twice
+  seen = g_hash_table_new (g_direct_hash, g_direct_equal);
+  for (; low < index->header->n_tokens && ids->len < max_results; low++)
+  {
+    if (strncmp (index->strings + index->tokens[low].token, prefix, len) != 0)
+      break;
+
+    id = index->tokens[low].id;
+    if (g_hash_table_add (seen, GUINT_TO_POINTER (id)))
+      g_array_append_val (ids, id);
+  }
+  g_hash_table_unref (seen);
+
+  return ids;
+}
+
+/* Returns the id of the name that the names block holds at @position */
+static guint
+_sandbox_utils_name_index_get_id_at (SandboxUtilsNameIndex *index,
+                                     guint32                position)
+{
+  guint low;
+  guint high;
+  guint middle;
+
+  // Last name starting at or before the position
+  for (low = 0, high = index->header->n_paths; high - low > 1; )
+  {
+    middle = low + (high - low) / 2;
+    if (index->name_starts[middle] <= position)
+      low = middle;
+    else
+      high = middle;
+  }
+
+  return low;
+}
+
+/*
+ * Returns the ids of up to @max_results names containing @text, which must be
+ * casefolded, in id order. This scans every name, but as a single block of
+ * memory, which takes a few milliseconds for a million names.
+ */
+GArray *
+sandbox_utils_name_index_find_substring (SandboxUtilsNameIndex *index,
+                                         const gchar           *text,
+                                         guint                  max_results)
+{
+  GArray      *ids;
+  const gchar *end;
+  const gchar *p;
+  gsize        len;
+  guint        id;
+
+  g_return_val_if_fail (index != NULL, NULL);
+  g_return_val_if_fail (text != NULL, NULL);
+
+  ids = g_array_new (FALSE, FALSE, sizeof (guint));
+  len = strlen (text);
+  if (!len || !index->header->n_paths)
+    return ids;
+
+  end = index->names + index->header->names_size;
+  for (p = index->names; ids->len < max_results && p < end; )
+  {
+    p = memmem (p, end - p, text, len);
+    if (!p)
+      break;
+
+    id = _sandbox_utils_name_index_get_id_at (index, p - index->names);
+    g_array_append_val (ids, id);
+
+    // Carry on with the next name
+    if (id + 1 < index->header->n_paths)
+      p = index->names + index->name_starts[id + 1];
+    else
+      p = end;
+  }
+
+  return ids;
+}
+
+/* Tells whether the name with @id contains @text, which must be casefolded */
+gboolean
+sandbox_utils_name_index_name_contains (SandboxUtilsNameIndex *index,
+                                        guint                  id,
+                                        const gchar           *text)
+{
+  g_return_val_if_fail (index != NULL, FALSE);
+  g_return_val_if_fail (id < index->header->n_paths, FALSE);
+  g_return_val_if_fail (text != NULL, FALSE);
+
+  return strstr (index->names + index->name_starts[id], text) != NULL;
+}
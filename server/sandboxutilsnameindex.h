@@ -0,0 +1,64 @@
+/* SandboxUtils -- Sandbox Utilities File Name Index
+ * Copyright (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>, 2014
+ *
+ * Under GPLv3
+ *
+ ***
+ *
+ * A read-only index of file paths, stored in a file and memory-mapped, which
+ * finds files by name without touching the file system. The file holds:
+ *
+ *  - every path, in no particular order, each with a numeric id;
+ *  - the casefolded base name of every path, packed in id order and NUL
+ *    separated, so that substrings are found by scanning a single block of
+ *    memory;
+ *  - a table of (token, id) pairs sorted by token, where tokens are the words
+ *    of base names, so that words and word prefixes are found by binary
+ *    search.
+ *
+ * Numbers are stored in the byte order of the machine that wrote the file,
+ * which is the machine reading it, as indexes live in the user's cache.
+ *
+ */
+#ifndef _SANDBOX_UTILS_NAME_INDEX_H
+#define _SANDBOX_UTILS_NAME_INDEX_H
+
+#include <gio/gio.h>
+
+typedef struct _SandboxUtilsNameIndex SandboxUtilsNameIndex;
+
+gboolean
+sandbox_utils_name_index_write (GPtrArray    *paths,
+                                const gchar  *filename,
+                                GError      **error);
+
+SandboxUtilsNameIndex *
+sandbox_utils_name_index_open (const gchar  *filename,
+                               GError      **error);
+
+void
+sandbox_utils_name_index_free (SandboxUtilsNameIndex *index);
+
+guint
+sandbox_utils_name_index_get_size (SandboxUtilsNameIndex *index);
+
+const gchar *
+sandbox_utils_name_index_get_path (SandboxUtilsNameIndex *index,
+                                   guint                  id);
+
+GArray *
+sandbox_utils_name_index_find_token (SandboxUtilsNameIndex *index,
+                                     const gchar           *prefix,
+                                     guint                  max_results);
+
+GArray *
+sandbox_utils_name_index_find_substring (SandboxUtilsNameIndex *index,
+                                         const gchar           *text,
+                                         guint                  max_results);
+
+gboolean
+sandbox_utils_name_index_name_contains (SandboxUtilsNameIndex *index,
+                                        guint                  id,
+                                        const gchar           *text);
+
+#endif /* #ifndef _SANDBOX_UTILS_NAME_INDEX_H */
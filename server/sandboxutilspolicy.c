@@ -0,0 +1,606 @@
+/* SandboxUtils -- Sandbox Utilities Selection Policy
+ * Copyright (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>, 2014
+ *
+ * Under GPLv3
+ *
+ ***
+ *
+ * Checks chosen files against the selection policy. See sandboxutilspolicy.h.
+ *
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "sandboxutilspolicy.h"
+#include "localfilechooserdialog.h"
+
+// Older C libraries do not know openat2(), the kernel is what matters
+#ifndef SYS_openat2
+#define SYS_openat2           437
+#endif
+
+#ifndef RESOLVE_NO_SYMLINKS
+#define RESOLVE_NO_MAGICLINKS 0x02
+#define RESOLVE_NO_SYMLINKS   0x04
+#endif
+
+// Files a thread checks before taking more
+#define SANDBOX_UTILS_POLICY_CHUNK 64
+
+// Refused files named to the user, the others are only counted
+#define SANDBOX_UTILS_POLICY_MAX_REPORTED 5
+
+/* Argument of openat2(), under our own name since libcs may define it */
+typedef struct {
+  guint64                flags;
+  guint64                mode;
+  guint64                resolve;
+} SandboxUtilsPolicyOpenHow;
+
+typedef enum {
+  SANDBOX_UTILS_POLICY_NONE  = 0,
+  SANDBOX_UTILS_POLICY_ALLOW = 1,
+  SANDBOX_UTILS_POLICY_DENY  = 2,
+} SandboxUtilsPolicyVerdict;
+
+/* A path component in the tree of rules */
+typedef struct {
+  GHashTable                *children;  /* component -> node, or NULL */
+  SandboxUtilsPolicyVerdict  verdict;   /* of the rule ending here, if any */
+} SandboxUtilsPolicyNode;
+
+/* The files of one validation, shared by the threads checking them */
+typedef struct {
+  gchar                    **paths;
+  gchar                    **reasons;   /* why each file is refused, or NULL */
+  gint                       n_paths;
+  gint                       next;      /* atomic, first file not taken yet */
+  guint                      running;   /* threads of the pool still at it */
+  GMutex                     lock;
+  GCond                      done;
+} SandboxUtilsPolicyBatch;
+
+static gboolean  _option_disabled = FALSE;
+static gchar    *_option_file     = NULL;
+static gint      _option_threads  = 4;
+
+static GOptionEntry entries[] =
+{
+  {
+    "no-policy", 0, 0, G_OPTION_ARG_NONE, &_option_disabled,
+    "Do not check the files users choose before returning them", NULL
+  },
+  {
+    "policy-file", 0, 0, G_OPTION_ARG_FILENAME, &_option_file,
+    "Rules on where chosen files may come from (default: $XDG_CONFIG_HOME/sandboxutils/policy)", "FILE"
+  },
+  {
+    "policy-threads", 0, 0, G_OPTION_ARG_INT, &_option_threads,
+    "Number of threads checking chosen files (default: 4)", "N"
+  },
+  {
+    NULL, ' ', 0, 0, NULL,
+    NULL, NULL
+  }
+};
+
+// Used when the user wrote no policy of their own
+static const gchar *_default_rules =
+  "allow /\n"
+  "deny /proc\n"
+  "deny /sys\n"
+  "deny ~/.ssh\n"
+  "deny ~/.gnupg\n"
+  "deny ~/.pki\n"
+  "deny ~/.local/share/keyrings\n";
+
+// Set up by sandbox_utils_policy_start(), read-only afterwards
+static SandboxUtilsPolicyNode *_root             = NULL;
+static gboolean                _refuse_hard_links = FALSE;
+static GThreadPool            *_pool             = NULL;
+static gint                    _no_openat2       = 0;  /* atomic */
+
+GOptionGroup *
+sandbox_utils_policy_get_option_group ()
+{
+  GOptionGroup *group;
+
+  group = g_option_group_new ("policy", "Selection Policy", "Show selection policy options", NULL, NULL);
+
+  g_option_group_add_entries (group, entries);
+  g_option_group_set_translation_domain (group, NULL);
+
+  return group;
+}
+
+gboolean
+sandbox_utils_policy_get_enabled ()
+{
+  return !_option_disabled;
+}
+
+static void
+_sandbox_utils_policy_node_free (gpointer data)
+{
+  SandboxUtilsPolicyNode *node = data;
+
+  if (node->children)
+    g_hash_table_unref (node->children);
+  g_free (node);
+}
+
+static void
+_sandbox_utils_policy_add_rule (const gchar               *path,
+                                SandboxUtilsPolicyVerdict  verdict)
+{
+  SandboxUtilsPolicyNode  *node = _root;
+  SandboxUtilsPolicyNode  *child;
+  gchar                  **components;
+  guint                    i;
+
+  components = g_strsplit (path, "/", -1);
+
+  for (i = 0; components[i]; i++)
+  {
+    if (components[i][0] == '\0' || g_strcmp0 (components[i], ".") == 0)
+      continue;
+
+    if (!node->children)
+      node->children = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                              _sandbox_utils_policy_node_free);
+
+    if ((child = g_hash_table_lookup (node->children, components[i])) == NULL)
+    {
+      child = g_malloc0 (sizeof (SandboxUtilsPolicyNode));
+      g_hash_table_insert (node->children, g_strdup (components[i]), child);
+    }
+
+    node = child;
+  }
+
+  node->verdict = verdict;
+  g_strfreev (components);
+}
+
+/* Compiles the rules in @contents into the tree, see sandboxutilspolicy.h */
+static void
+_sandbox_utils_policy_compile (const gchar *contents,
+                               const gchar *origin)
+{
+  SandboxUtilsPolicyVerdict   verdict;
+  gchar                     **lines;
+  gchar                      *line, *path, *expanded, *resolved;
+  guint                       i, n_rules = 0;
+
+  _root = g_malloc0 (sizeof (SandboxUtilsPolicyNode));
+
+  lines = g_strsplit (contents, "\n", -1);
+  for (i = 0; lines[i]; i++)
+  {
+    line = g_strstrip (lines[i]);
+    if (line[0] == '\0' || line[0] == '#')
+      continue;
+
+    if (g_strcmp0 (line, "refuse-hard-links") == 0)
+    {
+      _refuse_hard_links = TRUE;
+      continue;
+    }
+
+    if (g_str_has_prefix (line, "allow ") || g_str_has_prefix (line, "allow\t"))
+      verdict = SANDBOX_UTILS_POLICY_ALLOW;
+    else if (g_str_has_prefix (line, "deny ") || g_str_has_prefix (line, "deny\t"))
+      verdict = SANDBOX_UTILS_POLICY_DENY;
+    else
+      verdict = SANDBOX_UTILS_POLICY_NONE;
+
+    path = verdict == SANDBOX_UTILS_POLICY_NONE ? NULL
+                                                : g_strchug (line + strlen (verdict == SANDBOX_UTILS_POLICY_ALLOW ? "allow" : "deny"));
+
+    expanded = path && (path[0] == '~' && (path[1] == '/' || path[1] == '\0')) ?
+               g_build_filename (g_get_home_dir (), path + 1, NULL) : g_strdup (path);
+
+    if (!expanded || !g_path_is_absolute (expanded) || strstr (expanded, "/..") != NULL)
+    {
+      syslog (LOG_WARNING, "SandboxUtilsPolicy.Compile: ignoring line %u of %s, '%s'.\n", i + 1, origin, line);
+      g_free (expanded);
+      continue;
+    }
+
+    // Rules are matched against resolved paths, so they must be resolved too
+    if ((resolved = realpath (expanded, NULL)) != NULL)
+    {
+      _sandbox_utils_policy_add_rule (resolved, verdict);
+      free (resolved);
+    }
+    else
+      _sandbox_utils_policy_add_rule (expanded, verdict);
+
+    g_free (expanded);
+    n_rules++;
+  }
+  g_strfreev (lines);
+
+  syslog (LOG_DEBUG, "SandboxUtilsPolicy.Compile: %u rules read from %s, hard links are %s.\n",
+          n_rules, origin, _refuse_hard_links ? "refused" : "allowed");
+}
+
+/* Gets the verdict of the most specific rule about the resolved @path */
+static SandboxUtilsPolicyVerdict
+_sandbox_utils_policy_lookup (const gchar *path)
+{
+  SandboxUtilsPolicyNode    *node    = _root;
+  SandboxUtilsPolicyVerdict  verdict = _root->verdict;
+  gchar                      component[NAME_MAX + 1];
+  const gchar               *start, *end;
+  gsize                      length;
+
+  for (start = path; *start; start = end)
+  {
+    while (*start == '/')
+      start++;
+
+    end    = strchrnul (start, '/');
+    length = end - start;
+
+    if (length == 0 || length > NAME_MAX || !node->children)
+      break;
+
+    memcpy (component, start, length);
+    component[length] = '\0';
+
+    if ((node = g_hash_table_lookup (node->children, component)) == NULL)
+      break;
+
+    if (node->verdict != SANDBOX_UTILS_POLICY_NONE)
+      verdict = node->verdict;
+  }
+
+  return verdict;
+}
+
+/* Tells whether @path is absolute with no empty, "." or ".." component */
+static gboolean
+_sandbox_utils_policy_is_normal (const gchar *path)
+{
+  const gchar *c = path;
+
+  if (*c != '/')
+    return FALSE;
+
+  while (*c)
+  {
+    c++;
+
+    if (*c == '/' ||
+        (c[0] == '.' && (c[1] == '/' || c[1] == '\0')) ||
+        (c[0] == '.' && c[1] == '.' && (c[2] == '/' || c[2] == '\0')))
+      return FALSE;
+
+    c = strchrnul (c, '/');
+  }
+
+  return TRUE;
+}
+
+/*
+ * Opens @path without following symbolic links, then following them if that
+ * fails, in which case @via_symlink is set. Kernels without openat2() just
+ * follow them, and set @via_symlink so that the path gets resolved.
+ */
+static gint
+_sandbox_utils_policy_open (const gchar *path,
+                            gboolean    *via_symlink)
+{
+  SandboxUtilsPolicyOpenHow how = { O_PATH | O_CLOEXEC, 0, RESOLVE_NO_SYMLINKS | RESOLVE_NO_MAGICLINKS };
+  gint                      fd;
+
+  *via_symlink = FALSE;
+
+  if (!g_atomic_int_get (&_no_openat2))
+  {
+    if ((fd = syscall (SYS_openat2, AT_FDCWD, path, &how, sizeof (how))) != -1)
+      return fd;
+
+    if (errno == ELOOP)
+    {
+      *via_symlink = TRUE;
+      how.resolve  = RESOLVE_NO_MAGICLINKS;
+      return syscall (SYS_openat2, AT_FDCWD, path, &how, sizeof (how));
+    }
+
+    if (errno != ENOSYS)
+      return -1;
+
+    g_atomic_int_set (&_no_openat2, 1);
+  }
+
+  *via_symlink = TRUE;
+
+  return open (path, O_PATH | O_CLOEXEC);
+}
+
+/* Gets the path that @fd was opened at, with all links resolved */
+static gchar *
+_sandbox_utils_policy_resolve (gint fd)
+{
+  gchar link[32];
+
+  g_snprintf (link, sizeof (link), "/proc/self/fd/%d", fd);
+
+  return g_file_read_link (link, NULL);
+}
+
+static gboolean
+_sandbox_utils_policy_stat (gint     fd,
+                            mode_t  *mode,
+                            nlink_t *nlink)
+{
+  struct stat  st;
+#ifdef STATX_TYPE
+  struct statx stx;
+
+  // Only what is checked is asked for, which spares network filesystems
+  if (statx (fd, "", AT_EMPTY_PATH | AT_STATX_SYNC_AS_STAT, STATX_TYPE | STATX_NLINK, &stx) == 0)
+  {
+    *mode  = stx.stx_mode;
+    *nlink = stx.stx_nlink;
+    return TRUE;
+  }
+
+  if (errno != ENOSYS)
+    return FALSE;
+#endif
+
+  if (fstat (fd, &st) == -1)
+    return FALSE;
+
+  *mode  = st.st_mode;
+  *nlink = st.st_nlink;
+
+  return TRUE;
+}
+
+/* Checks one chosen file, returning why it is refused or NULL */
+static gchar *
+_sandbox_utils_policy_check (const gchar *path)
+{
+  gboolean  via_symlink;
+  gchar    *canonical = NULL;
+  gchar    *reason    = NULL;
+  gchar    *parent, *resolved, *name;
+  mode_t    mode;
+  nlink_t   nlink;
+  gint      fd;
+  int       saved;
+
+  if (!g_path_is_absolute (path))
+    return g_strdup_printf ("%s is not an absolute path", path);
+
+  if ((fd = _sandbox_utils_policy_open (path, &via_symlink)) == -1)
+  {
+    saved = errno;
+
+    if (saved != ENOENT)
+      return g_strdup_printf ("%s cannot be accessed (%s)", path, g_strerror (saved));
+
+    // Saving to it would create a file wherever the link points
+    if (via_symlink && !g_atomic_int_get (&_no_openat2))
+      return g_strdup_printf ("%s is a link to a file that does not exist", path);
+
+    // Files to be saved to do not exist yet, their folder is checked instead
+    parent = g_path_get_dirname (path);
+    name   = g_path_get_basename (path);
+
+    if ((fd = _sandbox_utils_policy_open (parent, &via_symlink)) == -1)
+      reason = g_strdup_printf ("%s cannot be accessed (%s)", parent, g_strerror (errno));
+    else
+    {
+      if ((resolved = _sandbox_utils_policy_resolve (fd)) != NULL)
+        canonical = g_build_filename (resolved, name, NULL);
+      g_free (resolved);
+      close (fd);
+    }
+
+    g_free (name);
+    g_free (parent);
+  }
+  else
+  {
+    if (!_sandbox_utils_policy_stat (fd, &mode, &nlink))
+      reason = g_strdup_printf ("%s cannot be accessed (%s)", path, g_strerror (errno));
+    else if (S_ISCHR (mode) || S_ISBLK (mode))
+      reason = g_strdup_printf ("%s is a device", path);
+    else if (S_ISFIFO (mode) || S_ISSOCK (mode))
+      reason = g_strdup_printf ("%s is a pipe or a socket", path);
+    else if (S_ISREG (mode) && nlink > 1 && _refuse_hard_links)
+      reason = g_strdup_printf ("%s also has other names, elsewhere", path);
+    else
+      canonical = via_symlink || !_sandbox_utils_policy_is_normal (path) ?
+                  _sandbox_utils_policy_resolve (fd) : g_strdup (path);
+
+    close (fd);
+  }
+
+  if (!reason && !canonical)
+    reason = g_strdup_printf ("%s cannot be resolved", path);
+
+  if (!reason && _sandbox_utils_policy_lookup (canonical) != SANDBOX_UTILS_POLICY_ALLOW)
+    reason = g_strcmp0 (canonical, path) != 0 ?
+             g_strdup_printf ("%s leads to %s, where files may not be chosen from", path, canonical) :
+             g_strdup_printf ("%s is in a folder files may not be chosen from", path);
+
+  g_free (canonical);
+
+  return reason;
+}
+
+/* Checks files of @batch, a chunk at a time, until none is left */
+static void
+_sandbox_utils_policy_run (SandboxUtilsPolicyBatch *batch)
+{
+  gint start, i;
+
+  while ((start = g_atomic_int_add (&batch->next, SANDBOX_UTILS_POLICY_CHUNK)) < batch->n_paths)
+    for (i = start; i < MIN (start + SANDBOX_UTILS_POLICY_CHUNK, batch->n_paths); i++)
+      batch->reasons[i] = _sandbox_utils_policy_check (batch->paths[i]);
+}
+
+static void
+_sandbox_utils_policy_work (gpointer data,
+                            gpointer pool_data)
+{
+  SandboxUtilsPolicyBatch *batch = data;
+
+  _sandbox_utils_policy_run (batch);
+
+  g_mutex_lock (&batch->lock);
+  if (--batch->running == 0)
+    g_cond_signal (&batch->done);
+  g_mutex_unlock (&batch->lock);
+}
+
+/*
+ * LfcdValidateFunc refusing files that break the policy. Blocks the thread
+ * running GTK+ while files are checked, with help from the pool for large
+ * selections.
+ */
+gboolean
+sandbox_utils_policy_validate (SandboxFileChooserDialog  *sfcd,
+                               GSList                    *filenames,
+                               gchar                    **message,
+                               gpointer                   user_data)
+{
+  SandboxUtilsPolicyBatch  batch;
+  GString                 *report = NULL;
+  GSList                  *iter;
+  gint64                   started = g_get_monotonic_time ();
+  guint                    refused = 0;
+  guint                    helpers, i;
+
+  if (!_root)
+    return TRUE;
+
+  batch.n_paths = g_slist_length (filenames);
+  batch.paths   = g_new (gchar *, MAX (batch.n_paths, 1));
+  batch.reasons = g_new0 (gchar *, MAX (batch.n_paths, 1));
+  batch.next    = 0;
+
+  for (iter = filenames, i = 0; iter; iter = iter->next, i++)
+    batch.paths[i] = iter->data;
+
+  g_mutex_init (&batch.lock);
+  g_cond_init (&batch.done);
+
+  // This thread checks files too, helpers only come for larger selections
+  helpers = _pool ? MIN ((guint) g_thread_pool_get_max_threads (_pool),
+                         (guint) MAX (batch.n_paths - 1, 0) / SANDBOX_UTILS_POLICY_CHUNK) : 0;
+  batch.running = helpers;
+  for (i = 0; i < helpers; i++)
+    g_thread_pool_push (_pool, &batch, NULL);
+
+  _sandbox_utils_policy_run (&batch);
+
+  g_mutex_lock (&batch.lock);
+  while (batch.running)
+    g_cond_wait (&batch.done, &batch.lock);
+  g_mutex_unlock (&batch.lock);
+
+  for (i = 0; i < (guint) batch.n_paths; i++)
+  {
+    if (!batch.reasons[i])
+      continue;
+
+    if (refused++ < SANDBOX_UTILS_POLICY_MAX_REPORTED)
+    {
+      if (!report)
+        report = g_string_new (NULL);
+      else
+        g_string_append_c (report, '\n');
+      g_string_append (report, batch.reasons[i]);
+    }
+
+    g_free (batch.reasons[i]);
+  }
+
+  if (refused > SANDBOX_UTILS_POLICY_MAX_REPORTED)
+    g_string_append_printf (report, "\nand %u other files.", refused - SANDBOX_UTILS_POLICY_MAX_REPORTED);
+
+  syslog (LOG_DEBUG, "SandboxUtilsPolicy.Validate: %d files checked for dialog '%s' in %" G_GINT64_FORMAT " us, %u refused.\n",
+          batch.n_paths, sfcd ? sfcd_get_id (sfcd) : "none", g_get_monotonic_time () - started, refused);
+
+  if (report && message)
+    *message = g_string_free (report, FALSE);
+  else if (report)
+    g_string_free (report, TRUE);
+
+  g_cond_clear (&batch.done);
+  g_mutex_clear (&batch.lock);
+  g_free (batch.reasons);
+  g_free (batch.paths);
+
+  return refused == 0;
+}
+
+/* Makes @sfcd check what the user chooses in it against the policy */
+void
+sandbox_utils_policy_attach (SandboxFileChooserDialog *sfcd)
+{
+  if (_root)
+    lfcd_set_validate_func (sfcd, sandbox_utils_policy_validate, NULL, NULL);
+}
+
+void
+sandbox_utils_policy_start ()
+{
+  GError *error    = NULL;
+  gchar  *filename = NULL;
+  gchar  *contents = NULL;
+
+  if (_option_disabled || _root)
+    return;
+
+  filename = _option_file ? g_strdup (_option_file)
+                          : g_build_filename (g_get_user_config_dir (), "sandboxutils", "policy", NULL);
+
+  if (g_file_get_contents (filename, &contents, NULL, &error))
+    _sandbox_utils_policy_compile (contents, filename);
+  else
+  {
+    // Only a policy asked for on the command line is missed
+    if (_option_file)
+      syslog (LOG_ERR, "SandboxUtilsPolicy.Start: could not read the policy, using the default one -- %s\n",
+              error->message);
+    g_error_free (error);
+
+    _sandbox_utils_policy_compile (_default_rules, "the default policy");
+  }
+
+  _pool = g_thread_pool_new (_sandbox_utils_policy_work, NULL,
+                             CLAMP (_option_threads, 1, 32), FALSE, NULL);
+
+  g_free (contents);
+  g_free (filename);
+}
+
+void
+sandbox_utils_policy_stop ()
+{
+  if (_pool)
+    g_thread_pool_free (_pool, FALSE, TRUE);
+  _pool = NULL;
+
+  if (_root)
+    _sandbox_utils_policy_node_free (_root);
+  _root = NULL;
+
+  _refuse_hard_links = FALSE;
+}
@@ -0,0 +1,58 @@
+/* SandboxUtils -- Sandbox Utilities Selection Policy
+ * Copyright (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>, 2014
+ *
+ * Under GPLv3
+ *
+ ***
+ *
+ * Vets the files a user accepts in a dialog before they are handed to the
+ * client. A user can be tricked into choosing a link that leads out of the
+ * folders apps are meant to see, or a device; the dialog refuses those and
+ * lets the user choose again.
+ *
+ * Every chosen path is opened without following symbolic links, and opened
+ * again following them only if that fails, so that the path it resolves to
+ * is what gets checked. Special files are refused, and so are files with more
+ * than one name if the policy refuses hard links, as their other names could
+ * be anywhere on the filesystem. Resolved paths are then matched against the
+ * rules of a policy file, compiled once into a tree of path components, the
+ * most specific rule winning:
+ *
+ *   # Where chosen files may come from
+ *   allow /
+ *   deny ~/.ssh
+ *   deny ~/.gnupg
+ *   refuse-hard-links
+ *
+ * Files are checked in parallel by a pool of threads along with the thread
+ * running the dialog, so that accepting thousands of files stays quick.
+ *
+ */
+#ifndef _SANDBOX_UTILS_POLICY_H
+#define _SANDBOX_UTILS_POLICY_H
+
+#include <gio/gio.h>
+#include "sandboxfilechooserdialog.h"
+
+GOptionGroup *
+sandbox_utils_policy_get_option_group ();
+
+gboolean
+sandbox_utils_policy_get_enabled ();
+
+void
+sandbox_utils_policy_start ();
+
+void
+sandbox_utils_policy_stop ();
+
+void
+sandbox_utils_policy_attach (SandboxFileChooserDialog *sfcd);
+
+gboolean
+sandbox_utils_policy_validate (SandboxFileChooserDialog  *sfcd,
+                               GSList                    *filenames,
+                               gchar                    **message,
+                               gpointer                   user_data);
+
+#endif /* #ifndef _SANDBOX_UTILS_POLICY_H */
@@ -0,0 +1,459 @@
+/* SandboxUtils -- Sandbox Utilities Client-Rendered Previews
+ * Copyright (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>, 2014
+ *
+ * Under GPLv3
+ *
+ ***
+ *
+ * Previews drawn by clients into shared memory, or by the server from
+ * thumbnails of images. See sandboxutilspreview.h.
+ *
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sandboxutilspreview.h"
+#include "sandboxutilsshm.h"
+#include "sandboxutilsthumbnail.h"
+#include "localfilechooserdialog.h"
+
+#define SANDBOX_UTILS_PREVIEW_KEY "sandbox-utils-preview"
+
+// How long a client may take to draw a preview before the next file is asked
+// for anyway, in ms. Slow clients then see their late damage ignored.
+#define SANDBOX_UTILS_PREVIEW_TIMEOUT 500
+
+// Most damaged parts reported at once, past which the whole image is repainted
+#define SANDBOX_UTILS_PREVIEW_MAX_RECTS 64
+
+/* The server's own preview, showing thumbnails of images */
+typedef struct {
+  SandboxFileChooserDialog *sfcd;       /* dialog showing the preview, not owned */
+  cairo_surface_t          *surface;
+  GCancellable             *loading;    /* thumbnail of the highlighted file */
+} SandboxUtilsPreviewBuiltin;
+
+typedef struct {
+  SandboxFileChooserDialog *sfcd;       /* dialog showing the preview, not owned */
+  gchar                    *owner;      /* unique bus name of the drawing client */
+  guchar                   *data;       /* read-only mapping of the client's memfd */
+  gsize                     size;
+  cairo_surface_t          *surface;    /* image surface over the mapping */
+  SandboxUtilsPreviewFunc   func;
+  gpointer                  user_data;
+  gchar                    *filename;   /* file highlighted last, or NULL */
+  guint64                   serial;     /* changes with the highlighted file */
+  guint64                   opened;     /* serial last handed to the client */
+  gboolean                  ringing;    /* client asked for a preview, not done */
+  guint                     timeout_id;
+} SandboxUtilsPreview;
+
+static void
+_sandbox_utils_preview_free (gpointer data)
+{
+  SandboxUtilsPreview *preview = data;
+
+  if (preview->timeout_id)
+    g_source_remove (preview->timeout_id);
+
+  // The dialog let go of the surface already, nothing paints from it anymore
+  cairo_surface_finish (preview->surface);
+  cairo_surface_destroy (preview->surface);
+  munmap (preview->data, preview->size);
+
+  g_free (preview->owner);
+  g_free (preview->filename);
+  g_free (preview);
+}
+
+static gboolean _sandbox_utils_preview_on_timeout (gpointer data);
+
+/* Asks the client for the preview of the highlighted file, if not drawn yet */
+static void
+_sandbox_utils_preview_ring (SandboxUtilsPreview *preview)
+{
+  if (preview->ringing || !preview->filename || preview->opened == preview->serial)
+    return;
+
+  preview->ringing    = TRUE;
+  preview->timeout_id = g_timeout_add (SANDBOX_UTILS_PREVIEW_TIMEOUT,
+                                       _sandbox_utils_preview_on_timeout,
+                                       preview);
+
+  preview->func (preview->sfcd, preview->user_data);
+}
+
+/* The client is done with its preview, or took too long to be waited for */
+static void
+_sandbox_utils_preview_done (SandboxUtilsPreview *preview)
+{
+  if (preview->timeout_id)
+    g_source_remove (preview->timeout_id);
+
+  preview->timeout_id = 0;
+  preview->ringing    = FALSE;
+}
+
+static gboolean
+_sandbox_utils_preview_on_timeout (gpointer data)
+{
+  SandboxUtilsPreview *preview = data;
+
+  syslog (LOG_DEBUG, "SandboxUtilsPreview.OnTimeout: client '%s' is slow to draw the preview of dialog '%s'.\n",
+          preview->owner, sfcd_get_id (preview->sfcd));
+
+  preview->timeout_id = 0;
+  preview->ringing    = FALSE;
+  _sandbox_utils_preview_ring (preview);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Called by the dialog when the user highlights another file */
+static void
+_sandbox_utils_preview_on_update (SandboxFileChooserDialog *sfcd,
+                                  const gchar              *filename,
+                                  gpointer                  user_data)
+{
+  SandboxUtilsPreview *preview = user_data;
+
+  // Folders and special files have no preview. GTK+ just listed the folder,
+  // so this stat is served from the kernel cache
+  g_free (preview->filename);
+  preview->filename = filename && g_file_test (filename, G_FILE_TEST_IS_REGULAR) ?
+                      g_strdup (filename) : NULL;
+  preview->serial++;
+
+  // While the client draws, only the file highlighted last is remembered
+  _sandbox_utils_preview_ring (preview);
+}
+
+/* Gets the preview of @sfcd, provided that @owner is the client drawing it */
+static SandboxUtilsPreview *
+_sandbox_utils_preview_get (SandboxFileChooserDialog  *sfcd,
+                            const gchar               *owner,
+                            GError                   **error)
+{
+  SandboxUtilsPreview *preview = g_object_get_data (G_OBJECT (sfcd), SANDBOX_UTILS_PREVIEW_KEY);
+
+  if (!preview || g_strcmp0 (preview->owner, owner) != 0)
+  {
+    g_set_error (error,
+                 g_quark_from_static_string (SFCD_ERROR_DOMAIN),
+                 SFCD_ERROR_FORBIDDEN_QUERY,
+                 "SandboxUtilsPreview: dialog '%s' has no preview buffer set by '%s'.\n",
+                 sfcd_get_id (sfcd), owner);
+    return NULL;
+  }
+
+  return preview;
+}
+
+/*
+ * Shows the image held in the memfd @fd in the preview area of @sfcd, and
+ * starts asking the client @owner for previews. The memfd must have its
+ * size sealed, and is mapped read-only. @fd is not kept, the caller still
+ * has to close it.
+ */
+gboolean
+sandbox_utils_preview_attach (SandboxFileChooserDialog  *sfcd,
+                              const gchar               *owner,
+                              gint                       fd,
+                              gint                       width,
+                              gint                       height,
+                              gint                       stride,
+                              SandboxUtilsPreviewFunc    func,
+                              gpointer                   user_data,
+                              GError                   **error)
+{
+  SandboxUtilsPreview *preview;
+  GError              *tmp_error = NULL;
+  gsize                size;
+  guchar              *data;
+
+  g_return_val_if_fail (LOCAL_IS_FILE_CHOOSER_DIALOG (sfcd), FALSE);
+  g_return_val_if_fail (owner != NULL, FALSE);
+  g_return_val_if_fail (func != NULL, FALSE);
+
+  if (!_sandboxutils_shm_check_image (width, height, stride, error))
+    return FALSE;
+
+  size = (gsize) stride * height;
+  if (!_sandboxutils_shm_check (fd, size, error))
+    return FALSE;
+
+  data = mmap (NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  if (data == MAP_FAILED)
+  {
+    int saved = errno;
+
+    g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved),
+                 "SandboxUtilsPreview.Attach: could not map the preview buffer (%s).\n",
+                 g_strerror (saved));
+    return FALSE;
+  }
+
+  preview = g_malloc0 (sizeof (SandboxUtilsPreview));
+  preview->sfcd      = sfcd;
+  preview->owner     = g_strdup (owner);
+  preview->data      = data;
+  preview->size      = size;
+  preview->func      = func;
+  preview->user_data = user_data;
+
+  // Cairo never writes to surfaces used as a source, the mapping can be read-only
+  preview->surface = cairo_image_surface_create_for_data (data, CAIRO_FORMAT_ARGB32,
+                                                          width, height, stride);
+
+  lfcd_set_preview_surface (sfcd, preview->surface, _sandbox_utils_preview_on_update,
+                            preview, NULL, &tmp_error);
+
+  if (tmp_error)
+  {
+    g_propagate_error (error, tmp_error);
+    _sandbox_utils_preview_free (preview);
+    return FALSE;
+  }
+
+  // Replaces the previous preview, which the dialog already let go of
+  g_object_set_data_full (G_OBJECT (sfcd), SANDBOX_UTILS_PREVIEW_KEY,
+                          preview, _sandbox_utils_preview_free);
+
+  syslog (LOG_DEBUG, "SandboxUtilsPreview.Attach: dialog '%s' shows a %dx%d preview drawn by '%s'.\n",
+          sfcd_get_id (sfcd), width, height, owner);
+
+  return TRUE;
+}
+
+/* Removes the preview area of @sfcd, if drawn by @owner */
+gboolean
+sandbox_utils_preview_detach (SandboxFileChooserDialog  *sfcd,
+                              const gchar               *owner,
+                              GError                   **error)
+{
+  GError *tmp_error = NULL;
+
+  if (!_sandbox_utils_preview_get (sfcd, owner, error))
+    return FALSE;
+
+  lfcd_set_preview_surface (sfcd, NULL, NULL, NULL, NULL, &tmp_error);
+
+  if (tmp_error)
+  {
+    g_propagate_error (error, tmp_error);
+    return FALSE;
+  }
+
+  g_object_set_data (G_OBJECT (sfcd), SANDBOX_UTILS_PREVIEW_KEY, NULL);
+
+  // Back to the server's own previews
+  sandbox_utils_preview_attach_builtin (sfcd);
+
+  return TRUE;
+}
+
+static void
+_sandbox_utils_preview_builtin_free (gpointer data)
+{
+  SandboxUtilsPreviewBuiltin *builtin = data;
+
+  // A thumbnail on its way must not be painted anymore
+  if (builtin->loading)
+  {
+    g_cancellable_cancel (builtin->loading);
+    g_object_unref (builtin->loading);
+  }
+
+  cairo_surface_destroy (builtin->surface);
+  g_free (builtin);
+}
+
+static void
+_sandbox_utils_preview_builtin_on_thumbnail (GdkPixbuf *thumbnail,
+                                             gpointer   user_data)
+{
+  SandboxUtilsPreviewBuiltin *builtin = user_data;
+  cairo_t                    *cr;
+
+  g_clear_object (&builtin->loading);
+
+  if (!thumbnail)
+  {
+    lfcd_damage_preview (builtin->sfcd, FALSE, NULL, 0);
+    return;
+  }
+
+  cr = cairo_create (builtin->surface);
+  cairo_set_operator (cr, CAIRO_OPERATOR_CLEAR);
+  cairo_paint (cr);
+  cairo_set_operator (cr, CAIRO_OPERATOR_OVER);
+
+  // Centred horizontally, at the top like GTK+ places preview widgets
+  gdk_cairo_set_source_pixbuf (cr, thumbnail,
+                               (SANDBOX_UTILS_THUMBNAIL_LARGE - gdk_pixbuf_get_width (thumbnail)) / 2,
+                               0);
+  cairo_paint (cr);
+  cairo_destroy (cr);
+
+  lfcd_damage_preview (builtin->sfcd, TRUE, NULL, 0);
+}
+
+/* Called by the dialog when the user highlights another file */
+static void
+_sandbox_utils_preview_builtin_on_update (SandboxFileChooserDialog *sfcd,
+                                          const gchar              *filename,
+                                          gpointer                  user_data)
+{
+  SandboxUtilsPreviewBuiltin *builtin = user_data;
+
+  // The previous file's thumbnail is dropped from the queue, or stops decoding
+  if (builtin->loading)
+  {
+    g_cancellable_cancel (builtin->loading);
+    g_clear_object (&builtin->loading);
+  }
+
+  if (!filename)
+    return;
+
+  builtin->loading = g_cancellable_new ();
+  sandbox_utils_thumbnail_request (filename, SANDBOX_UTILS_THUMBNAIL_LARGE, builtin->loading,
+                                   _sandbox_utils_preview_builtin_on_thumbnail, builtin);
+}
+
+/*
+ * Shows thumbnails of the images the user highlights in @sfcd, made by the
+ * server. Replaced by previews drawn by a client when it sets a buffer.
+ */
+void
+sandbox_utils_preview_attach_builtin (SandboxFileChooserDialog *sfcd)
+{
+  SandboxUtilsPreviewBuiltin *builtin;
+  GError                     *error = NULL;
+
+  g_return_if_fail (LOCAL_IS_FILE_CHOOSER_DIALOG (sfcd));
+
+  if (!sandbox_utils_thumbnail_get_enabled ())
+    return;
+
+  builtin = g_malloc0 (sizeof (SandboxUtilsPreviewBuiltin));
+  builtin->sfcd    = sfcd;
+  builtin->surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+                                                 SANDBOX_UTILS_THUMBNAIL_LARGE,
+                                                 SANDBOX_UTILS_THUMBNAIL_LARGE);
+
+  // The dialog frees the preview once replaced, or when it goes away
+  lfcd_set_preview_surface (sfcd, builtin->surface, _sandbox_utils_preview_builtin_on_update,
+                            builtin, _sandbox_utils_preview_builtin_free, &error);
+
+  if (error)
+  {
+    syslog (LOG_WARNING, "SandboxUtilsPreview.AttachBuiltin: dialog '%s' will show no thumbnails -- %s",
+            sfcd_get_id (sfcd), _sandboxutils_error_get_message (error));
+    g_error_free (error);
+  }
+}
+
+/*
+ * Opens the file highlighted in @sfcd for @owner to draw its preview, and
+ * gets the @serial to report damage with. Returns a read-only descriptor
+ * for the caller to send and close, or -1 if there is nothing to preview.
+ */
+gint
+sandbox_utils_preview_open (SandboxFileChooserDialog  *sfcd,
+                            const gchar               *owner,
+                            guint64                   *serial,
+                            GError                   **error)
+{
+  SandboxUtilsPreview *preview;
+  struct stat          st;
+  gint                 fd = -1;
+
+  g_return_val_if_fail (serial != NULL, -1);
+
+  if ((preview = _sandbox_utils_preview_get (sfcd, owner, error)) == NULL)
+    return -1;
+
+  // Not blocking on FIFOs, devices are not worth a preview anyway
+  if (preview->filename)
+    fd = open (preview->filename, O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NONBLOCK);
+
+  if (fd != -1 && (fstat (fd, &st) == -1 || !S_ISREG (st.st_mode)))
+  {
+    close (fd);
+    fd = -1;
+    errno = EINVAL;
+  }
+
+  preview->opened = preview->serial;
+  *serial         = preview->serial;
+
+  if (fd == -1)
+  {
+    int saved = preview->filename ? errno : ENOENT;
+
+    g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved),
+                 "SandboxUtilsPreview.Open: the file highlighted in dialog '%s' cannot be previewed (%s).\n",
+                 sfcd_get_id (sfcd), g_strerror (saved));
+
+    // The preview area stays hidden, the client may be needed for another file
+    _sandbox_utils_preview_done (preview);
+    _sandbox_utils_preview_ring (preview);
+  }
+
+  return fd;
+}
+
+/*
+ * Repaints the parts of the preview of @sfcd listed in @rects, an a(iiii) of
+ * x, y, width and height, drawn by @owner for the file of @serial. Damage to
+ * the preview of a file that is no longer highlighted is ignored.
+ */
+gboolean
+sandbox_utils_preview_damage (SandboxFileChooserDialog  *sfcd,
+                              const gchar               *owner,
+                              guint64                    serial,
+                              gboolean                   active,
+                              GVariant                  *rects,
+                              GError                   **error)
+{
+  SandboxUtilsPreview   *preview;
+  cairo_rectangle_int_t *damage = NULL;
+  GVariantIter           iter;
+  gsize                  n_rects;
+  guint                  i = 0;
+
+  if ((preview = _sandbox_utils_preview_get (sfcd, owner, error)) == NULL)
+    return FALSE;
+
+  if (serial == preview->opened)
+    _sandbox_utils_preview_done (preview);
+
+  if (serial == preview->serial)
+  {
+    n_rects = g_variant_n_children (rects);
+
+    if (n_rects <= SANDBOX_UTILS_PREVIEW_MAX_RECTS)
+    {
+      damage = g_newa (cairo_rectangle_int_t, n_rects + 1);
+
+      g_variant_iter_init (&iter, rects);
+      while (g_variant_iter_next (&iter, "(iiii)",
+                                  &damage[i].x, &damage[i].y,
+                                  &damage[i].width, &damage[i].height))
+        i++;
+    }
+
+    lfcd_damage_preview (sfcd, active, damage, i);
+  }
+
+  _sandbox_utils_preview_ring (preview);
+
+  return TRUE;
+}
@@ -0,0 +1,69 @@
+/* SandboxUtils -- Sandbox Utilities Client-Rendered Previews
+ * Copyright (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>, 2014
+ *
+ * Under GPLv3
+ *
+ ***
+ *
+ * Lets clients draw the previews of the files highlighted in their dialogs,
+ * for formats only they understand, without telling them file names.
+ *
+ * The client shares a sealed memfd holding an ARGB32 image with
+ * SetPreviewBuffer, which the dialog maps read-only and shows in its preview
+ * area. When the user highlights a file, the client is rung with the
+ * PreviewRequested signal, fetches a read-only descriptor of the file with
+ * OpenPreviewFile, draws into the memfd and tells which parts changed with
+ * PreviewDamage. The image is painted straight from the shared mapping.
+ *
+ * Only one preview is asked for at a time. Files the user moves past while
+ * the client draws are skipped, so that previews keep up with the keyboard
+ * however slow the client is, and only the file highlighted last is drawn.
+ *
+ * Dialogs whose client draws no previews show thumbnails of images made by
+ * the server instead, see sandboxutilsthumbnail.h.
+ *
+ */
+#ifndef _SANDBOX_UTILS_PREVIEW_H
+#define _SANDBOX_UTILS_PREVIEW_H
+
+#include <gio/gio.h>
+#include "sandboxfilechooserdialog.h"
+
+/* Tells the client that owns @sfcd's preview to call OpenPreviewFile */
+typedef void (*SandboxUtilsPreviewFunc) (SandboxFileChooserDialog *sfcd,
+                                         gpointer                  user_data);
+
+gboolean
+sandbox_utils_preview_attach (SandboxFileChooserDialog  *sfcd,
+                              const gchar               *owner,
+                              gint                       fd,
+                              gint                       width,
+                              gint                       height,
+                              gint                       stride,
+                              SandboxUtilsPreviewFunc    func,
+                              gpointer                   user_data,
+                              GError                   **error);
+
+void
+sandbox_utils_preview_attach_builtin (SandboxFileChooserDialog *sfcd);
+
+gboolean
+sandbox_utils_preview_detach (SandboxFileChooserDialog  *sfcd,
+                              const gchar               *owner,
+                              GError                   **error);
+
+gint
+sandbox_utils_preview_open (SandboxFileChooserDialog  *sfcd,
+                            const gchar               *owner,
+                            guint64                   *serial,
+                            GError                   **error);
+
+gboolean
+sandbox_utils_preview_damage (SandboxFileChooserDialog  *sfcd,
+                              const gchar               *owner,
+                              guint64                    serial,
+                              gboolean                   active,
+                              GVariant                  *rects,
+                              GError                   **error);
+
+#endif /* #ifndef _SANDBOX_UTILS_PREVIEW_H */
@@ -0,0 +1,445 @@
+/* SandboxUtils -- Sandbox Utilities Call Recorder
+ * Copyright (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>, 2014
+ *
+ * Under GPLv3
+ *
+ ***
+ *
+ * Records the traffic of the SandboxFileChooserDialog interface. See
+ * sandboxutilsrecorder.h for the format of recordings.
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+
+#include "sandboxutilsrecorder.h"
+#include "sandboxfilechooserdialog.h"
+#include "sandboxfilechooserdialogdbusobject.h"
+
+static gchar    *_option_record_file = NULL;
+static gboolean  _option_anonymise   = FALSE;
+
+static GOptionEntry entries[] =
+{
+  {
+    "record", 0, 0, G_OPTION_ARG_FILENAME, &_option_record_file,
+    "Record calls made by clients to FILE, for use with sfcd-replay", "FILE"
+  },
+  {
+    "record-anonymise", 0, 0, G_OPTION_ARG_NONE, &_option_anonymise,
+    "Replace all strings but ids and field names with salted hashes in recordings", NULL
+  },
+  {
+    NULL, ' ', 0, 0, NULL,
+    NULL, NULL
+  }
+};
+
+typedef struct {
+  GMutex            lock;
+  GDBusConnection  *connection;
+  guint             filter_id;
+  FILE             *file;
+  gint64            start;
+  guchar            salt[16];
+  GHashTable       *clients;   // unique bus name -> anonymous client name
+  GHashTable       *pending;   // "<unique name> <serial>" -> method awaiting a reply
+} SandboxUtilsRecorder;
+
+static SandboxUtilsRecorder *_recorder = NULL;
+
+// Arguments that never identify the user or their files, recorded as they are.
+// Ids are made up by the server, and replays need them to find dialogs again.
+static const gchar *_recorder_kept_args[] =
+{
+  "dialog_id",
+  "template_id",
+  "mime_types",
+  "attributes",
+  NULL
+};
+
+GOptionGroup *
+sandbox_utils_recorder_get_option_group ()
+{
+  GOptionGroup *group;
+
+  group = g_option_group_new ("record", "Call Recording", "Show call recording options", NULL, NULL);
+
+  g_option_group_add_entries (group, entries);
+  g_option_group_set_translation_domain (group, NULL);
+
+  return group;
+}
+
+static gboolean
+_sandbox_utils_recorder_is_extension (const gchar *ext)
+{
+  const gchar *c;
+
+  // Dots in plain text, e.g. "Save as... (PDF)", do not make extensions
+  if (!ext || ext[1] == '\0' || strlen (ext) > 8)
+    return FALSE;
+
+  for (c = ext + 1; *c; c++)
+    if (!g_ascii_isalnum (*c))
+      return FALSE;
+
+  return TRUE;
+}
+
+static void
+_sandbox_utils_recorder_append_component (GString     *out,
+                                          const gchar *component)
+{
+  const gchar *ext  = strrchr (component, '.');
+  gchar       *hash;
+
+  // Hidden files have no extension, they just start with a dot
+  if (ext == component || !_sandbox_utils_recorder_is_extension (ext))
+    ext = NULL;
+
+  hash = g_compute_hmac_for_data (G_CHECKSUM_SHA256,
+                                  _recorder->salt, sizeof (_recorder->salt),
+                                  (const guchar *) component,
+                                  ext ? (gsize) (ext - component) : strlen (component));
+
+  g_string_append_len (out, hash, 12);
+  if (ext)
+    g_string_append (out, ext);
+
+  g_free (hash);
+}
+
+// Keeps the scheme of URIs, the depth of paths and file extensions, so that
+// replays exercise the same code paths, but hides all names.
+static gchar *
+_sandbox_utils_recorder_anonymise_path (const gchar *path)
+{
+  const gchar  *start      = path;
+  const gchar  *scheme_end = strstr (path, "://");
+  GString      *out        = g_string_new (NULL);
+  gchar       **parts;
+  guint         i;
+
+  if (scheme_end)
+  {
+    g_string_append_len (out, path, scheme_end + 3 - path);
+    start = scheme_end + 3;
+  }
+
+  parts = g_strsplit (start, "/", -1);
+  for (i = 0; parts[i]; i++)
+  {
+    if (i > 0)
+      g_string_append_c (out, '/');
+
+    if (parts[i][0] != '\0')
+      _sandbox_utils_recorder_append_component (out, parts[i]);
+  }
+  g_strfreev (parts);
+
+  return g_string_free (out, FALSE);
+}
+
+// Hides every string in @value. Numbers, booleans and enum values are kept, and
+// so are dictionary keys, which name fields rather than hold what the user typed.
+static GVariant *
+_sandbox_utils_recorder_anonymise (GVariant *value)
+{
+  GVariantBuilder  builder;
+  GVariantIter     iter;
+  GVariant        *child;
+  GVariant        *result;
+  const gchar     *str;
+  gboolean         key;
+
+  if (g_variant_is_of_type (value, G_VARIANT_TYPE_STRING))
+  {
+    str = g_variant_get_string (value, NULL);
+
+    // Empty strings often mean "none", replays must see them as such
+    if (str[0] == '\0')
+      return g_variant_ref (value);
+
+    return g_variant_ref_sink (g_variant_new_take_string (_sandbox_utils_recorder_anonymise_path (str)));
+  }
+
+  if (!g_variant_is_container (value))
+    return g_variant_ref (value);
+
+  key = g_variant_is_of_type (value, G_VARIANT_TYPE_DICT_ENTRY);
+
+  g_variant_builder_init (&builder, g_variant_get_type (value));
+  g_variant_iter_init (&iter, value);
+  while ((child = g_variant_iter_next_value (&iter)))
+  {
+    result = key ? g_variant_ref (child) : _sandbox_utils_recorder_anonymise (child);
+    g_variant_builder_add_value (&builder, result);
+    g_variant_unref (result);
+    g_variant_unref (child);
+    key = FALSE;
+  }
+
+  return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
+static gboolean
+_sandbox_utils_recorder_is_kept (GDBusArgInfo **args,
+                                 gsize          index)
+{
+  gsize i;
+  gsize kept;
+
+  // Unknown arguments are hidden
+  for (i = 0; args && args[i]; i++)
+  {
+    if (i != index)
+      continue;
+
+    for (kept = 0; _recorder_kept_args[kept]; kept++)
+      if (g_strcmp0 (_recorder_kept_args[kept], args[i]->name) == 0)
+        return TRUE;
+  }
+
+  return FALSE;
+}
+
+// Hides the arguments of a message body, except those in _recorder_kept_args.
+// @args describes the body, or is %NULL if unknown.
+static GVariant *
+_sandbox_utils_recorder_anonymise_body (GVariant      *body,
+                                        GDBusArgInfo **args)
+{
+  GVariantBuilder  builder;
+  GVariant        *child;
+  GVariant        *result;
+  gsize            i;
+
+  if (!g_variant_is_of_type (body, G_VARIANT_TYPE_TUPLE))
+    return _sandbox_utils_recorder_anonymise (body);
+
+  g_variant_builder_init (&builder, g_variant_get_type (body));
+  for (i = 0; i < g_variant_n_children (body); i++)
+  {
+    child  = g_variant_get_child_value (body, i);
+    result = _sandbox_utils_recorder_is_kept (args, i) ?
+               g_variant_ref (child) : _sandbox_utils_recorder_anonymise (child);
+    g_variant_builder_add_value (&builder, result);
+    g_variant_unref (result);
+    g_variant_unref (child);
+  }
+
+  return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
+static GDBusArgInfo **
+_sandbox_utils_recorder_get_args (const gchar *kind,
+                                  const gchar *member)
+{
+  GDBusInterfaceInfo *iface = sfcd_dbus_wrapper__interface_info ();
+  GDBusMethodInfo    *method;
+  GDBusSignalInfo    *signal;
+
+  if (!member)
+    return NULL;
+
+  if (g_strcmp0 (kind, "signal") == 0)
+  {
+    signal = g_dbus_interface_info_lookup_signal (iface, member);
+    return signal ? signal->args : NULL;
+  }
+
+  method = g_dbus_interface_info_lookup_method (iface, member);
+  if (!method)
+    return NULL;
+
+  return g_strcmp0 (kind, "call") == 0 ? method->in_args : method->out_args;
+}
+
+static const gchar *
+_sandbox_utils_recorder_get_client (const gchar *unique_name)
+{
+  gchar *client = g_hash_table_lookup (_recorder->clients, unique_name);
+
+  if (!client)
+  {
+    client = g_strdup_printf ("c%u", g_hash_table_size (_recorder->clients));
+    g_hash_table_insert (_recorder->clients, g_strdup (unique_name), client);
+  }
+
+  return client;
+}
+
+/*
+ * Writes an event. @member is the method or signal the body belongs to, which
+ * tells what its arguments are when anonymising.
+ */
+static void
+_sandbox_utils_recorder_write (const gchar  *kind,
+                               const gchar  *client,
+                               guint32       serial,
+                               const gchar  *name,
+                               const gchar  *member,
+                               GVariant     *body)
+{
+  GVariant *recorded = NULL;
+  gchar    *printed  = NULL;
+
+  if (body)
+  {
+    recorded = _option_anonymise ?
+                 _sandbox_utils_recorder_anonymise_body (body, _sandbox_utils_recorder_get_args (kind, member)) :
+                 g_variant_ref (body);
+    printed  = g_variant_print (recorded, TRUE);
+    g_variant_unref (recorded);
+  }
+
+  fprintf (_recorder->file, "%s\t%" G_GINT64_FORMAT "\t%s\t%u\t%s\t%s\n",
+           kind,
+           g_get_monotonic_time () - _recorder->start,
+           client,
+           serial,
+           name,
+           printed ? printed : "()");
+
+  g_free (printed);
+}
+
+// Runs in the GDBus worker thread, for each message going in or out
+static GDBusMessage *
+_sandbox_utils_recorder_filter (GDBusConnection *connection,
+                                GDBusMessage    *message,
+                                gboolean         incoming,
+                                gpointer         user_data)
+{
+  GDBusMessageType  type = g_dbus_message_get_message_type (message);
+  const gchar      *peer;
+  gchar            *key;
+  gchar            *member;
+
+  g_mutex_lock (&_recorder->lock);
+
+  if (!_recorder->file)
+  {
+    g_mutex_unlock (&_recorder->lock);
+    return message;
+  }
+
+  if (incoming && type == G_DBUS_MESSAGE_TYPE_METHOD_CALL &&
+      g_strcmp0 (g_dbus_message_get_interface (message), SFCD_IFACE) == 0)
+  {
+    peer = g_dbus_message_get_sender (message);
+    _sandbox_utils_recorder_write ("call",
+                                   _sandbox_utils_recorder_get_client (peer),
+                                   g_dbus_message_get_serial (message),
+                                   g_dbus_message_get_member (message),
+                                   g_dbus_message_get_member (message),
+                                   g_dbus_message_get_body (message));
+
+    g_hash_table_insert (_recorder->pending,
+                         g_strdup_printf ("%s %u", peer, g_dbus_message_get_serial (message)),
+                         g_strdup (g_dbus_message_get_member (message)));
+  }
+  else if (!incoming && (type == G_DBUS_MESSAGE_TYPE_METHOD_RETURN ||
+                         type == G_DBUS_MESSAGE_TYPE_ERROR))
+  {
+    peer = g_dbus_message_get_destination (message);
+    key  = g_strdup_printf ("%s %u", peer, g_dbus_message_get_reply_serial (message));
+
+    // Only record replies to the calls we recorded
+    if ((member = g_hash_table_lookup (_recorder->pending, key)) != NULL)
+    {
+      _sandbox_utils_recorder_write ("reply",
+                                     _sandbox_utils_recorder_get_client (peer),
+                                     g_dbus_message_get_reply_serial (message),
+                                     type == G_DBUS_MESSAGE_TYPE_ERROR ?
+                                       g_dbus_message_get_error_name (message) : "ok",
+                                     // Errors only carry a message
+                                     type == G_DBUS_MESSAGE_TYPE_ERROR ? NULL : member,
+                                     g_dbus_message_get_body (message));
+      g_hash_table_remove (_recorder->pending, key);
+    }
+    g_free (key);
+  }
+  else if (!incoming && type == G_DBUS_MESSAGE_TYPE_SIGNAL &&
+           g_strcmp0 (g_dbus_message_get_interface (message), SFCD_IFACE) == 0)
+  {
+    _sandbox_utils_recorder_write ("signal",
+                                   "-",
+                                   0,
+                                   g_dbus_message_get_member (message),
+                                   g_dbus_message_get_member (message),
+                                   g_dbus_message_get_body (message));
+  }
+
+  g_mutex_unlock (&_recorder->lock);
+
+  return message;
+}
+
+void
+sandbox_utils_recorder_attach (GDBusConnection *connection)
+{
+  guint32 *salt;
+  guint    i;
+
+  if (!_option_record_file || _recorder)
+    return;
+
+  _recorder = g_malloc0 (sizeof (SandboxUtilsRecorder));
+  g_mutex_init (&_recorder->lock);
+
+  _recorder->file = fopen (_option_record_file, "w");
+  if (!_recorder->file)
+  {
+    syslog (LOG_ERR, "SandboxUtilsRecorder.Attach: could not open '%s' for writing, calls will not be recorded.\n",
+            _option_record_file);
+    g_mutex_clear (&_recorder->lock);
+    g_free (_recorder);
+    _recorder = NULL;
+    return;
+  }
+
+  // A fresh salt per recording, so hashed names cannot be looked up elsewhere
+  salt = (guint32 *) _recorder->salt;
+  for (i = 0; i < sizeof (_recorder->salt) / sizeof (guint32); i++)
+    salt[i] = g_random_int ();
+
+  _recorder->start   = g_get_monotonic_time ();
+  _recorder->clients = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  _recorder->pending = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+  fprintf (_recorder->file, "%s\n", SANDBOX_UTILS_RECORDER_HEADER);
+  _recorder->connection = g_object_ref (connection);
+  _recorder->filter_id  = g_dbus_connection_add_filter (connection, _sandbox_utils_recorder_filter, NULL, NULL);
+
+  syslog (LOG_INFO, "SandboxUtilsRecorder.Attach: recording calls to '%s'%s.\n",
+          _option_record_file, _option_anonymise ? " with anonymised arguments" : "");
+}
+
+void
+sandbox_utils_recorder_stop ()
+{
+  if (!_recorder)
+    return;
+
+  if (_recorder->connection)
+  {
+    g_dbus_connection_remove_filter (_recorder->connection, _recorder->filter_id);
+    g_clear_object (&_recorder->connection);
+  }
+
+  // The filter may still be running in the GDBus worker thread, and does
+  // nothing once the file is closed, so the recorder itself stays around
+  g_mutex_lock (&_recorder->lock);
+  if (_recorder->file)
+  {
+    fclose (_recorder->file);
+    _recorder->file = NULL;
+  }
+  g_clear_pointer (&_recorder->clients, g_hash_table_unref);
+  g_clear_pointer (&_recorder->pending, g_hash_table_unref);
+  g_mutex_unlock (&_recorder->lock);
+}
@@ -0,0 +1,41 @@
+/* SandboxUtils -- Sandbox Utilities Call Recorder
+ * Copyright (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>, 2014
+ *
+ * Under GPLv3
+ *
+ ***
+ *
+ * Records the method calls received by the server, their replies and the
+ * signals it emits, so that real traffic can be replayed later with
+ * sfcd-replay. Each line of a recording is an event:
+ *
+ *   <kind>\t<usec>\t<client>\t<serial>\t<name>\t<body>
+ *
+ * where kind is "call", "reply" or "signal", usec counts microseconds since
+ * the recording started, client is an anonymous name given to each peer in
+ * order of appearance ("-" for signals), serial is the D-Bus serial of a call
+ * (or of the call being replied to), name is the method or signal name (or
+ * "ok" or the error name for replies) and body is the message body in GVariant
+ * text format. With --record-anonymise, every string argument is replaced
+ * with a salted hash, keeping the depth of paths and file extensions, except
+ * for dialog and template ids, MIME types, attribute lists and dictionary
+ * keys. Numbers, booleans and enum values are always kept.
+ *
+ */
+#ifndef _SANDBOX_UTILS_RECORDER_H
+#define _SANDBOX_UTILS_RECORDER_H
+
+#include <gio/gio.h>
+
+#define SANDBOX_UTILS_RECORDER_HEADER "# sandboxutilsd recording v1"
+
+GOptionGroup *
+sandbox_utils_recorder_get_option_group ();
+
+void
+sandbox_utils_recorder_attach (GDBusConnection *connection);
+
+void
+sandbox_utils_recorder_stop ();
+
+#endif /* #ifndef _SANDBOX_UTILS_RECORDER_H */
@@ -0,0 +1,280 @@
+/* SandboxUtils -- Sandbox Utilities Request Scheduler
+ * Copyright (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>, 2014
+ * 
+ * Under GPLv3
+ * 
+ *** 
+ * 
+ * Orders the calls received from clients before they are processed on the
+ * main loop. Calls are queued per client and per call class. Classes are
+ * drained with weighted priorities, interactive calls first, and clients are
+ * served fairly within a class with deficit round robin.
+ * 
+ * Only one job is processed per main loop iteration, so that input events and
+ * the painting of running dialogs are not held back by a burst of calls. Jobs
+ * that the user is not waiting for run just after GTK+ has painted.
+ * 
+ */
+#include <gtk/gtk.h>
+
+#include "sandboxutilsscheduler.h"
+
+// Priority of the source processing interactive and background jobs
+#define SANDBOX_UTILS_SCHEDULER_INTERACTIVE_PRIORITY  G_PRIORITY_DEFAULT
+#define SANDBOX_UTILS_SCHEDULER_BACKGROUND_PRIORITY   (GDK_PRIORITY_REDRAW + 10)
+
+// Credit a client receives each time its turn comes in a class queue. Must be
+// at least as large as the cost of the most expensive job.
+#define SANDBOX_UTILS_SCHEDULER_QUANTUM 4
+
+// Order in which classes are considered, and how many jobs of each class may
+// run before classes that are further behind get a turn
+static const SandboxUtilsCallClass
+_scheduler_class_order[SANDBOX_UTILS_CALL_LAST] = {SANDBOX_UTILS_CALL_INTERACTIVE,
+                                                   SANDBOX_UTILS_CALL_LIFECYCLE,
+                                                   SANDBOX_UTILS_CALL_CONFIG,
+                                                   SANDBOX_UTILS_CALL_RETRIEVAL};
+
+static const guint
+_scheduler_class_weights[SANDBOX_UTILS_CALL_LAST] = {4,  /* lifecycle */
+                                                     8,  /* interactive */
+                                                     2,  /* configuration */
+                                                     1}; /* retrieval */
+
+typedef struct _SandboxUtilsScheduler
+{
+  GQueue                 active[SANDBOX_UTILS_CALL_LAST]; /* clients with jobs */
+  guint                  credits[SANDBOX_UTILS_CALL_LAST];
+  guint                  sourceId;
+  gint                   sourcePriority;
+} SandboxUtilsScheduler;
+
+static SandboxUtilsScheduler *
+_get_scheduler ()
+{
+  static SandboxUtilsScheduler scheduler;
+
+  return &scheduler;
+}
+
+static void
+_sandbox_utils_job_free (SandboxUtilsJob *job)
+{
+  if (job->destroy)
+    job->destroy (job->data);
+
+  sandbox_utils_client_unref (job->client);
+  g_free (job);
+}
+
+/*
+ * Picks the class to serve next. Classes are visited by order of priority and
+ * each may be served as many times as its weight before the credits of all
+ * classes are replenished, so that bulk retrieval cannot starve.
+ */
+static gboolean
+_sandbox_utils_scheduler_pick_class (SandboxUtilsScheduler *sched,
+                                     SandboxUtilsCallClass *klass)
+{
+  SandboxUtilsCallClass k;
+  gboolean              pending = FALSE;
+  guint                 i;
+
+  for (i = 0; i < SANDBOX_UTILS_CALL_LAST; i++)
+  {
+    k = _scheduler_class_order[i];
+
+    if (!g_queue_is_empty (&sched->active[k]))
+    {
+      pending = TRUE;
+
+      if (sched->credits[k] > 0)
+      {
+        sched->credits[k]--;
+        *klass = k;
+        return TRUE;
+      }
+    }
+  }
+
+  if (!pending)
+    return FALSE;
+
+  // Every class with pending jobs spent its credits, start a new round
+  for (i = 0; i < SANDBOX_UTILS_CALL_LAST; i++)
+    sched->credits[i] = _scheduler_class_weights[i];
+
+  return _sandbox_utils_scheduler_pick_class (sched, klass);
+}
+
+/*
+ * Deficit round robin between the clients that have jobs in @klass.
+ */
+static SandboxUtilsJob *
+_sandbox_utils_scheduler_pop_job (SandboxUtilsScheduler *sched,
+                                  SandboxUtilsCallClass  klass)
+{
+  SandboxUtilsClient *cli;
+  SandboxUtilsJob    *job;
+
+  while ((cli = g_queue_peek_head (&sched->active[klass])) != NULL)
+  {
+    job = g_queue_peek_head (&cli->pending[klass]);
+
+    if (cli->deficit[klass] >= job->cost)
+    {
+      g_queue_pop_head (&cli->pending[klass]);
+      cli->deficit[klass] -= job->cost;
+
+      // Idle clients do not get to hoard credit
+      if (g_queue_is_empty (&cli->pending[klass]))
+      {
+        cli->deficit[klass] = 0;
+        g_queue_pop_head (&sched->active[klass]);
+      }
+
+      return job;
+    }
+
+    // This client's turn is over, it will get more credit on its next turn
+    g_queue_pop_head (&sched->active[klass]);
+    cli->deficit[klass] += SANDBOX_UTILS_SCHEDULER_QUANTUM;
+    g_queue_push_tail (&sched->active[klass], cli);
+  }
+
+  return NULL;
+}
+
+static gboolean _sandbox_utils_scheduler_dispatch (gpointer);
+
+/*
+ * Makes sure a source will process the next job, at a priority matching the
+ * most urgent class with pending jobs.
+ */
+static void
+_sandbox_utils_scheduler_wake_up (SandboxUtilsScheduler *sched)
+{
+  gint priority = SANDBOX_UTILS_SCHEDULER_BACKGROUND_PRIORITY;
+  gint i;
+
+  for (i = 0; i < SANDBOX_UTILS_CALL_LAST; i++)
+    if (!g_queue_is_empty (&sched->active[i]))
+      break;
+
+  if (i == SANDBOX_UTILS_CALL_LAST)
+    return;
+
+  if (!g_queue_is_empty (&sched->active[SANDBOX_UTILS_CALL_INTERACTIVE]))
+    priority = SANDBOX_UTILS_SCHEDULER_INTERACTIVE_PRIORITY;
+
+  if (sched->sourceId != 0)
+  {
+    // Lower values mean higher priorities
+    if (sched->sourcePriority <= priority)
+      return;
+
+    g_source_remove (sched->sourceId);
+  }
+
+  sched->sourcePriority = priority;
+  sched->sourceId = g_idle_add_full (priority,
+                                     _sandbox_utils_scheduler_dispatch,
+                                     sched,
+                                     NULL);
+}
+
+static gboolean
+_sandbox_utils_scheduler_dispatch (gpointer data)
+{
+  SandboxUtilsScheduler *sched = data;
+  SandboxUtilsCallClass  klass;
+  SandboxUtilsJob       *job   = NULL;
+
+  sched->sourceId = 0;
+
+  if (_sandbox_utils_scheduler_pick_class (sched, &klass))
+    job = _sandbox_utils_scheduler_pop_job (sched, klass);
+
+  // Schedule the next job first, in case this one runs a nested main loop
+  _sandbox_utils_scheduler_wake_up (sched);
+
+  if (job)
+  {
+    job->func (job->data, job->client);
+    _sandbox_utils_job_free (job);
+  }
+
+  return G_SOURCE_REMOVE;
+}
+
+/*
+ * Queues a job for @cli, which is kept alive until the job is done. @func will
+ * be called from the main loop with @data and @cli, after which @destroy is
+ * called on @data. If the job is dropped, only @destroy is called. Must be
+ * called from the main loop's thread.
+ */
+void
+sandbox_utils_scheduler_push (SandboxUtilsClient    *cli,
+                              SandboxUtilsCallClass  klass,
+                              guint                  cost,
+                              GFunc                  func,
+                              gpointer               data,
+                              GDestroyNotify         destroy)
+{
+  SandboxUtilsScheduler *sched = _get_scheduler ();
+  SandboxUtilsJob       *job;
+
+  g_return_if_fail (cli != NULL);
+  g_return_if_fail (klass < SANDBOX_UTILS_CALL_LAST);
+  g_return_if_fail (func != NULL);
+
+  job = g_malloc (sizeof (SandboxUtilsJob));
+  job->client  = sandbox_utils_client_ref (cli);
+  job->klass   = klass;
+  job->cost    = CLAMP (cost, 1, SANDBOX_UTILS_SCHEDULER_QUANTUM);
+  job->func    = func;
+  job->data    = data;
+  job->destroy = destroy;
+
+  // Newly active clients can be served as soon as their turn comes
+  if (g_queue_is_empty (&cli->pending[klass]))
+  {
+    cli->deficit[klass] = SANDBOX_UTILS_SCHEDULER_QUANTUM;
+    g_queue_push_tail (&sched->active[klass], cli);
+  }
+
+  g_queue_push_tail (&cli->pending[klass], job);
+
+  _sandbox_utils_scheduler_wake_up (sched);
+}
+
+/*
+ * Drops all the jobs of a client that is going away.
+ */
+void
+sandbox_utils_scheduler_forget_client (SandboxUtilsClient *cli)
+{
+  SandboxUtilsScheduler *sched = _get_scheduler ();
+  SandboxUtilsJob       *job;
+  guint                  i;
+
+  g_return_if_fail (cli != NULL);
+
+  for (i = 0; i < SANDBOX_UTILS_CALL_LAST; i++)
+  {
+    g_queue_remove (&sched->active[i], cli);
+
+    while ((job = g_queue_pop_head (&cli->pending[i])) != NULL)
+      _sandbox_utils_job_free (job);
+
+    cli->deficit[i] = 0;
+  }
+
+  if (sched->sourceId != 0)
+  {
+    g_source_remove (sched->sourceId);
+    sched->sourceId = 0;
+  }
+
+  _sandbox_utils_scheduler_wake_up (sched);
+}
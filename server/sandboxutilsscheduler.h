@@ -0,0 +1,42 @@
+/* SandboxUtils -- Sandbox Utilities Request Scheduler
+ * Copyright (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>, 2014
+ * 
+ * Under GPLv3
+ * 
+ *** 
+ * 
+ * Orders the calls received from clients before they are processed on the
+ * main loop. Calls are queued per client and per call class. Classes are
+ * drained with weighted priorities, interactive calls first, and clients are
+ * served fairly within a class with deficit round robin.
+ * 
+ */
+#ifndef _SANDBOX_UTILS_SCHEDULER_H
+#define _SANDBOX_UTILS_SCHEDULER_H
+
+#include <gio/gio.h>
+#include "sandboxutilsclientmanager.h"
+
+/* A unit of work waiting to be processed on behalf of a client */
+typedef struct _SandboxUtilsJob
+{
+  SandboxUtilsClient    *client;
+  SandboxUtilsCallClass  klass;
+  guint                  cost;
+  GFunc                  func;      /* called with data and client */
+  gpointer               data;
+  GDestroyNotify         destroy;   /* called with data once done or dropped */
+} SandboxUtilsJob;
+
+void
+sandbox_utils_scheduler_push (SandboxUtilsClient    *cli,
+                              SandboxUtilsCallClass  klass,
+                              guint                  cost,
+                              GFunc                  func,
+                              gpointer               data,
+                              GDestroyNotify         destroy);
+
+void
+sandbox_utils_scheduler_forget_client (SandboxUtilsClient *cli);
+
+#endif /* #ifndef _SANDBOX_UTILS_SCHEDULER_H */
@@ -0,0 +1,585 @@
+/* SandboxUtils -- Sandbox Utilities Search
+ * Copyright (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>, 2014
+ *
+ * Under GPLv3
+ *
+ ***
+ *
+ * Finds files by name under the search roots. See sandboxutilssearch.h.
+ *
+ */
+#include <string.h>
+#include <syslog.h>
+#include <glib/gstdio.h>
+
+#include "sandboxutilssearch.h"
+#include "sandboxutilscommon.h"
+#include "sandboxutilscrawler.h"
+#include "sandboxutilsnameindex.h"
+#include "sandboxutilstrace.h"
+
+#define SANDBOX_UTILS_SEARCH_CACHE_FOLDER "sandboxutils"
+#define SANDBOX_UTILS_SEARCH_INDEX_NAME   "names.idx"
+
+// Seconds after startup before a stale index is crawled again, so that the
+// crawl does not compete with the session starting up
+#define SANDBOX_UTILS_SEARCH_STARTUP_DELAY 60
+
+// Changes kept in memory beyond which the roots are crawled again right away
+#define SANDBOX_UTILS_SEARCH_MAX_CHANGES 50000
+
+static gboolean   _option_enabled = FALSE;
+static gchar    **_option_roots   = NULL;
+static gint       _option_threads = 2;
+static gint       _option_rate    = 200;
+static gint       _option_rescan  = 6;
+
+static GOptionEntry entries[] =
+{
+  {
+    "search-index", 0, 0, G_OPTION_ARG_NONE, &_option_enabled,
+    "Index the names of files under the search roots, to find them by name", NULL
+  },
+  {
+    "search-root", 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &_option_roots,
+    "Folder whose files are indexed, can be repeated (default: the home folder)", "PATH"
+  },
+  {
+    "search-threads", 0, 0, G_OPTION_ARG_INT, &_option_threads,
+    "Number of threads reading folders while crawling (default: 2)", "N"
+  },
+  {
+    "search-rate", 0, 0, G_OPTION_ARG_INT, &_option_rate,
+    "Folders read per second while crawling, 0 for no limit (default: 200)", "N"
+  },
+  {
+    "search-rescan", 0, 0, G_OPTION_ARG_INT, &_option_rescan,
+    "Hours between two crawls of the search roots (default: 6)", "HOURS"
+  },
+  {
+    NULL, ' ', 0, 0, NULL,
+    NULL, NULL
+  }
+};
+
+/* A crawl under way, owned by its task */
+typedef struct {
+  gchar                    **roots;
+  gchar                     *filename;
+  guint                      n_threads;
+  guint                      rate;
+  gint64                     started;
+  SandboxUtilsCrawlerStats   stats;
+} SandboxUtilsSearchCrawl;
+
+static gchar                 **_roots      = NULL;
+static gchar                  *_filename   = NULL;
+static SandboxUtilsNameIndex  *_index      = NULL;
+static GHashTable             *_added      = NULL;  /* path -> gint64 when noticed */
+static GHashTable             *_removed    = NULL;  /* path -> gint64 when noticed */
+static GCancellable           *_crawling   = NULL;
+static guint                   _startup_id = 0;
+static guint                   _rescan_id  = 0;
+
+GOptionGroup *
+sandbox_utils_search_get_option_group ()
+{
+  GOptionGroup *group;
+
+  group = g_option_group_new ("search", "Name Search", "Show name search options", NULL, NULL);
+
+  g_option_group_add_entries (group, entries);
+  g_option_group_set_translation_domain (group, NULL);
+
+  return group;
+}
+
+gboolean
+sandbox_utils_search_get_enabled ()
+{
+  return _option_enabled;
+}
+
+/* Tells whether @path is @folder or in it, @folder having no trailing slash */
+static gboolean
+_sandbox_utils_search_is_in (const gchar *path,
+                             const gchar *folder)
+{
+  gsize len = strlen (folder);
+
+  return strncmp (path, folder, len) == 0 && (path[len] == '\0' || path[len] == G_DIR_SEPARATOR);
+}
+
+/* Tells whether the crawler would index @path: under a root and not hidden */
+static gboolean
+_sandbox_utils_search_is_indexed (const gchar *path)
+{
+  guint i;
+
+  for (i = 0; _roots && _roots[i]; i++)
+    if (_sandbox_utils_search_is_in (path, _roots[i]))
+      return path[strlen (_roots[i])] != '\0' &&
+             strstr (path + strlen (_roots[i]), G_DIR_SEPARATOR_S ".") == NULL;
+
+  return FALSE;
+}
+
+/* Absolute roots without trailing slashes, none of which is in another */
+static gchar **
+_sandbox_utils_search_get_roots (void)
+{
+  GPtrArray *roots = g_ptr_array_new ();
+  gchar     *root;
+  gsize      len;
+  guint      i;
+  guint      j;
+
+  if (!_option_roots || !_option_roots[0])
+    g_ptr_array_add (roots, g_strdup (g_get_home_dir ()));
+
+  for (i = 0; _option_roots && _option_roots[i]; i++)
+  {
+    if (!g_path_is_absolute (_option_roots[i]))
+    {
+      syslog (LOG_WARNING, "SandboxUtilsSearch.GetRoots: '%s' is not an absolute path, ignoring it.\n",
+              _option_roots[i]);
+      continue;
+    }
+
+    root = g_strdup (_option_roots[i]);
+    len  = strlen (root);
+    while (len > 1 && root[len - 1] == G_DIR_SEPARATOR)
+      root[--len] = '\0';
+
+    g_ptr_array_add (roots, root);
+  }
+
+  // Roots within others would have their files indexed twice
+  for (i = 0; i < roots->len; i++)
+    for (j = 0; j < roots->len; j++)
+      if (i != j && g_ptr_array_index (roots, i) && g_ptr_array_index (roots, j) &&
+          _sandbox_utils_search_is_in (g_ptr_array_index (roots, i), g_ptr_array_index (roots, j)))
+      {
+        g_free (g_ptr_array_index (roots, i));
+        g_ptr_array_index (roots, i) = NULL;
+      }
+
+  for (i = 0; i < roots->len; )
+    if (g_ptr_array_index (roots, i))
+      i++;
+    else
+      g_ptr_array_remove_index (roots, i);
+
+  g_ptr_array_add (roots, NULL);
+
+  return (gchar **) g_ptr_array_free (roots, FALSE);
+}
+
+static void
+_sandbox_utils_search_crawl_free (gpointer data)
+{
+  SandboxUtilsSearchCrawl *crawl = data;
+
+  g_strfreev (crawl->roots);
+  g_free (crawl->filename);
+  g_free (crawl);
+}
+
+static void
+_sandbox_utils_search_crawl_thread (GTask        *task,
+                                    gpointer      source,
+                                    gpointer      task_data,
+                                    GCancellable *cancellable)
+{
+  SandboxUtilsSearchCrawl *crawl = task_data;
+  GPtrArray               *paths;
+  GError                  *error = NULL;
+
+  paths = sandbox_utils_crawler_run ((const gchar * const *) crawl->roots,
+                                     crawl->n_threads, crawl->rate,
+                                     cancellable, &crawl->stats, &error);
+
+  if (paths && sandbox_utils_name_index_write (paths, crawl->filename, &error))
+    g_task_return_boolean (task, TRUE);
+  else
+    g_task_return_error (task, error);
+
+  if (paths)
+    g_ptr_array_unref (paths);
+}
+
+static gboolean
+_sandbox_utils_search_is_older (gpointer key,
+                                gpointer value,
+                                gpointer user_data)
+{
+  return *(gint64 *) value < *(gint64 *) user_data;
+}
+
+static void
+_sandbox_utils_search_on_crawled (GObject      *source,
+                                  GAsyncResult *res,
+                                  gpointer      user_data)
+{
+  SandboxUtilsSearchCrawl *crawl = g_task_get_task_data (G_TASK (res));
+  SandboxUtilsNameIndex   *index = NULL;
+  GError                  *error = NULL;
+
+  if (!g_task_propagate_boolean (G_TASK (res), &error))
+  {
+    // Stopped on purpose, and the server may be gone already
+    if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    {
+      g_error_free (error);
+      return;
+    }
+
+    syslog (LOG_WARNING, "SandboxUtilsSearch.OnCrawled: could not index the search roots (%s).\n",
+            _sandboxutils_error_get_message (error));
+    g_clear_error (&error);
+  }
+  else
+  {
+    index = sandbox_utils_name_index_open (crawl->filename, &error);
+    if (!index)
+    {
+      syslog (LOG_WARNING, "SandboxUtilsSearch.OnCrawled: could not open the new index (%s).\n",
+              _sandboxutils_error_get_message (error));
+      g_clear_error (&error);
+    }
+  }
+
+  g_clear_object (&_crawling);
+
+  if (!index)
+    return;
+
+  sandbox_utils_name_index_free (_index);
+  _index = index;
+
+  // The crawl saw what changed before it started
+  g_hash_table_foreach_remove (_added, _sandbox_utils_search_is_older, &crawl->started);
+  g_hash_table_foreach_remove (_removed, _sandbox_utils_search_is_older, &crawl->started);
+
+  SU_TRACE3 (search_indexed, sandbox_utils_name_index_get_size (_index),
+             crawl->stats.folders, crawl->stats.duration);
+
+  syslog (LOG_INFO, "SandboxUtilsSearch.OnCrawled: indexed %u files in %" G_GUINT64_FORMAT " folders in %.1f s "
+          "(%" G_GUINT64_FORMAT " unreadable, %" G_GUINT64_FORMAT " stolen).\n",
+          sandbox_utils_name_index_get_size (_index), crawl->stats.folders,
+          crawl->stats.duration / (gdouble) G_TIME_SPAN_SECOND,
+          crawl->stats.errors, crawl->stats.steals);
+}
+
+/* Crawls the roots in a thread, unless a crawl is under way already */
+static void
+_sandbox_utils_search_crawl (void)
+{
+  SandboxUtilsSearchCrawl *crawl;
+  GTask                   *task;
+
+  if (_crawling)
+    return;
+
+  crawl = g_malloc0 (sizeof (SandboxUtilsSearchCrawl));
+  crawl->roots     = g_strdupv (_roots);
+  crawl->filename  = g_strdup (_filename);
+  crawl->n_threads = MAX (_option_threads, 1);
+  crawl->rate      = MAX (_option_rate, 0);
+  crawl->started   = g_get_monotonic_time ();
+
+  _crawling = g_cancellable_new ();
+  task = g_task_new (NULL, _crawling, _sandbox_utils_search_on_crawled, NULL);
+  g_task_set_task_data (task, crawl, _sandbox_utils_search_crawl_free);
+  g_task_run_in_thread (task, _sandbox_utils_search_crawl_thread);
+  g_object_unref (task);
+}
+
+static gboolean
+_sandbox_utils_search_on_startup (gpointer data)
+{
+  _startup_id = 0;
+  _sandbox_utils_search_crawl ();
+
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+_sandbox_utils_search_on_rescan (gpointer data)
+{
+  _sandbox_utils_search_crawl ();
+
+  return G_SOURCE_CONTINUE;
+}
+
+/*
+ * Opens the index left by a previous run, and schedules crawls: soon if the
+ * index is missing or older than the rescan interval, then periodically.
+ */
+void
+sandbox_utils_search_start ()
+{
+  GStatBuf  st;
+  GError   *error    = NULL;
+  gchar    *folder;
+  gint64    interval = (gint64) MAX (_option_rescan, 1) * 3600;
+  gboolean  stale;
+
+  if (!_option_enabled || _filename)
+    return;
+
+  _roots = _sandbox_utils_search_get_roots ();
+  if (!_roots[0])
+  {
+    syslog (LOG_WARNING, "SandboxUtilsSearch.Start: no folder to index, name search is disabled.\n");
+    g_strfreev (_roots);
+    _roots = NULL;
+    return;
+  }
+
+  folder    = g_build_filename (g_get_user_cache_dir (), SANDBOX_UTILS_SEARCH_CACHE_FOLDER, NULL);
+  _filename = g_build_filename (folder, SANDBOX_UTILS_SEARCH_INDEX_NAME, NULL);
+  g_mkdir_with_parents (folder, 0700);
+  g_free (folder);
+
+  _added   = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  _removed = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+  _index = sandbox_utils_name_index_open (_filename, &error);
+  if (!_index)
+  {
+    syslog (LOG_DEBUG, "SandboxUtilsSearch.Start: no index to start with (%s).\n", _sandboxutils_error_get_message (error));
+    g_clear_error (&error);
+  }
+
+  stale = !_index || g_stat (_filename, &st) != 0 || st.st_mtime + interval < g_get_real_time () / G_USEC_PER_SEC;
+  if (stale)
+    _startup_id = g_timeout_add_seconds (_index ? SANDBOX_UTILS_SEARCH_STARTUP_DELAY : 1,
+                                         _sandbox_utils_search_on_startup, NULL);
+
+  _rescan_id = g_timeout_add_seconds (interval, _sandbox_utils_search_on_rescan, NULL);
+}
+
+void
+sandbox_utils_search_stop ()
+{
+  if (_crawling)
+  {
+    g_cancellable_cancel (_crawling);
+    g_clear_object (&_crawling);
+  }
+
+  if (_startup_id)
+    g_source_remove (_startup_id);
+  if (_rescan_id)
+    g_source_remove (_rescan_id);
+  _startup_id = 0;
+  _rescan_id  = 0;
+
+  sandbox_utils_name_index_free (_index);
+  _index = NULL;
+
+  g_clear_pointer (&_added, g_hash_table_unref);
+  g_clear_pointer (&_removed, g_hash_table_unref);
+  g_strfreev (_roots);
+  _roots = NULL;
+  g_free (_filename);
+  _filename = NULL;
+}
+
+/*
+ * Records that @path was created or changed (@exists) or went away, until
+ * the next crawl. The directory cache calls this as its monitors notice
+ * changes. Paths that the crawler would not index are ignored.
+ */
+void
+sandbox_utils_search_file_changed (const gchar *path,
+                                   gboolean     exists)
+{
+  gint64 *noticed;
+
+  if (!_filename || !path || !_sandbox_utils_search_is_indexed (path))
+    return;
+
+  noticed  = g_malloc (sizeof (gint64));
+  *noticed = g_get_monotonic_time ();
+
+  if (exists)
+  {
+    g_hash_table_remove (_removed, path);
+    g_hash_table_insert (_added, g_strdup (path), noticed);
+  }
+  else
+  {
+    g_hash_table_remove (_added, path);
+    g_hash_table_insert (_removed, g_strdup (path), noticed);
+  }
+
+  if (g_hash_table_size (_added) + g_hash_table_size (_removed) > SANDBOX_UTILS_SEARCH_MAX_CHANGES)
+    _sandbox_utils_search_crawl ();
+}
+
+/* Tells whether @path, or a folder it is in, went away since the crawl */
+static gboolean
+_sandbox_utils_search_is_removed (const gchar *path)
+{
+  gchar    *ancestor;
+  gchar    *slash;
+  gboolean  removed;
+
+  if (!g_hash_table_size (_removed))
+    return FALSE;
+
+  ancestor = g_strdup (path);
+  removed  = g_hash_table_contains (_removed, ancestor);
+
+  while (!removed && (slash = strrchr (ancestor, G_DIR_SEPARATOR)) != NULL && slash != ancestor)
+  {
+    *slash  = '\0';
+    removed = g_hash_table_contains (_removed, ancestor);
+  }
+
+  g_free (ancestor);
+
+  return removed;
+}
+
+typedef struct {
+  const gchar  *folder;
+  gchar       **words;
+  GPtrArray    *results;
+  GHashTable   *seen;
+  guint         max_results;
+} SandboxUtilsSearchQuery;
+
+static void
+_sandbox_utils_search_add (SandboxUtilsSearchQuery *query,
+                           const gchar             *path)
+{
+  if (query->results->len >= query->max_results ||
+      (query->folder && !_sandbox_utils_search_is_in (path, query->folder)) ||
+      g_hash_table_contains (query->seen, path) ||
+      !_sandbox_utils_search_is_indexed (path) ||
+      _sandbox_utils_search_is_removed (path))
+    return;
+
+  g_hash_table_add (query->seen, (gpointer) path);
+  g_ptr_array_add (query->results, g_strdup (path));
+}
+
+/* Adds the indexed names among @ids that contain every word */
+static void
+_sandbox_utils_search_add_ids (SandboxUtilsSearchQuery *query,
+                               GArray                  *ids)
+{
+  guint id;
+  guint i;
+  guint j;
+
+  for (i = 0; i < ids->len && query->results->len < query->max_results; i++)
+  {
+    id = g_array_index (ids, guint, i);
+
+    for (j = 0; query->words[j]; j++)
+      if (!sandbox_utils_name_index_name_contains (_index, id, query->words[j]))
+        break;
+
+    if (!query->words[j])
+      _sandbox_utils_search_add (query, sandbox_utils_name_index_get_path (_index, id));
+  }
+
+  g_array_unref (ids);
+}
+
+/*
+ * Returns the paths of up to @max_results files whose name contains every
+ * word of @text, ignoring case, optionally only within @folder. Files that
+ * changed since the last crawl come first, then files with a word starting
+ * with the longest word of @text, then files merely containing it.
+ */
+GPtrArray *
+sandbox_utils_search_query (const gchar *folder,
+                            const gchar *text,
+                            guint        max_results)
+{
+  SandboxUtilsSearchQuery  query;
+  GHashTableIter           iter;
+  const gchar             *path;
+  const gchar             *longest = NULL;
+  gchar                   *key;
+  gchar                   *name;
+  gint64                   started = g_get_monotonic_time ();
+  guint                    limit;
+  guint                    i;
+  guint                    j;
+
+  g_return_val_if_fail (text != NULL, NULL);
+
+  query.folder      = folder;
+  query.results     = g_ptr_array_new_with_free_func (g_free);
+  query.seen        = g_hash_table_new (g_str_hash, g_str_equal);
+  query.max_results = max_results;
+
+  key = g_utf8_casefold (text, -1);
+  query.words = g_strsplit_set (key, " \t", -1);
+  g_free (key);
+
+  // Drop empty words left by repeated spaces
+  for (i = 0, j = 0; query.words[i]; i++)
+    if (query.words[i][0])
+      query.words[j++] = query.words[i];
+    else
+      g_free (query.words[i]);
+  query.words[j] = NULL;
+
+  for (i = 0; query.words[i]; i++)
+    if (!longest || strlen (query.words[i]) > strlen (longest))
+      longest = query.words[i];
+
+  if (!_filename || !longest)
+    goto out;
+
+  g_hash_table_iter_init (&iter, _added);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &path, NULL))
+  {
+    name = g_path_get_basename (path);
+    key  = g_utf8_casefold (name, -1);
+
+    for (i = 0; query.words[i]; i++)
+      if (!strstr (key, query.words[i]))
+        break;
+
+    if (!query.words[i])
+      _sandbox_utils_search_add (&query, path);
+
+    g_free (key);
+    g_free (name);
+  }
+
+  if (_index)
+  {
+    // Results get filtered, only bound the scans when nothing will be
+    limit = (folder || query.words[1] || g_hash_table_size (_removed)) ? G_MAXUINT : max_results;
+
+    _sandbox_utils_search_add_ids (&query, sandbox_utils_name_index_find_token (_index, longest, limit));
+    _sandbox_utils_search_add_ids (&query, sandbox_utils_name_index_find_substring (_index, longest, limit == G_MAXUINT ? limit : limit + query.results->len));
+  }
+
+out:
+  SU_TRACE3 (search_query, text, query.results->len, g_get_monotonic_time () - started);
+
+  g_hash_table_unref (query.seen);
+  g_strfreev (query.words);
+
+  return query.results;
+}
+
+/* Number of files the index and recent changes know of */
+guint
+sandbox_utils_search_get_size ()
+{
+  if (!_filename)
+    return 0;
+
+  return (_index ? sandbox_utils_name_index_get_size (_index) : 0) + g_hash_table_size (_added);
+}
@@ -0,0 +1,51 @@
+/* SandboxUtils -- Sandbox Utilities Search
+ * Copyright (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>, 2014
+ *
+ * Under GPLv3
+ *
+ ***
+ *
+ * Finds files by name under a set of configured folders, the search roots,
+ * without an external indexer and without walking folders at search time.
+ *
+ * The roots are crawled in the background by sandboxutilscrawler.c, and their
+ * paths written to a file name index in the user's cache (see
+ * sandboxutilsnameindex.h), which is memory-mapped and answers queries in
+ * milliseconds. Changes that the directory cache's monitors notice under the
+ * roots are kept in memory and merged into results until the next crawl
+ * replaces the index. The previous index is used right away when the server
+ * starts, and roots are crawled again every few hours.
+ *
+ * Everything but the crawl happens on the main loop.
+ *
+ */
+#ifndef _SANDBOX_UTILS_SEARCH_H
+#define _SANDBOX_UTILS_SEARCH_H
+
+#include <gio/gio.h>
+
+GOptionGroup *
+sandbox_utils_search_get_option_group ();
+
+gboolean
+sandbox_utils_search_get_enabled ();
+
+void
+sandbox_utils_search_start ();
+
+void
+sandbox_utils_search_stop ();
+
+void
+sandbox_utils_search_file_changed (const gchar *path,
+                                   gboolean     exists);
+
+GPtrArray *
+sandbox_utils_search_query (const gchar *folder,
+                            const gchar *text,
+                            guint        max_results);
+
+guint
+sandbox_utils_search_get_size ();
+
+#endif /* #ifndef _SANDBOX_UTILS_SEARCH_H */
@@ -0,0 +1,171 @@
+/* SandboxUtils -- Sandbox Utilities Selection Info
+ * Copyright (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>, 2014
+ *
+ * Under GPLv3
+ *
+ ***
+ *
+ * Queries the files of a selection in parallel. See sandboxutilsselection.h.
+ *
+ */
+#include <syslog.h>
+
+#include "sandboxutilsselection.h"
+#include "sandboxutilsfileinfo.h"
+
+static gint _option_threads = 4;
+
+static GOptionEntry entries[] =
+{
+  {
+    "selection-info-threads", 0, 0, G_OPTION_ARG_INT, &_option_threads,
+    "Number of threads querying the attributes of chosen files (default: 4)", "N"
+  },
+  {
+    NULL, ' ', 0, 0, NULL,
+    NULL, NULL
+  }
+};
+
+/* The files of one query, answered once the last of them is done */
+typedef struct {
+  gchar                         **uris;
+  gchar                          *attributes;
+  GVariant                      **results;
+  guint                           n_uris;
+  gint                            pending;    /* atomic */
+  SandboxUtilsSelectionInfoFunc   func;
+  gpointer                        user_data;
+} SandboxUtilsSelectionBatch;
+
+/* One file of a batch, for a thread to query */
+typedef struct {
+  SandboxUtilsSelectionBatch     *batch;
+  guint                           index;
+} SandboxUtilsSelectionJob;
+
+static GThreadPool *_pool = NULL;
+
+GOptionGroup *
+sandbox_utils_selection_get_option_group ()
+{
+  GOptionGroup *group;
+
+  group = g_option_group_new ("selection", "Selection Info", "Show selection info options", NULL, NULL);
+
+  g_option_group_add_entries (group, entries);
+  g_option_group_set_translation_domain (group, NULL);
+
+  return group;
+}
+
+static gboolean
+_sandbox_utils_selection_finish (gpointer data)
+{
+  SandboxUtilsSelectionBatch *batch = data;
+  GVariantBuilder             builder;
+  guint                       i;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(sa{sv})"));
+  for (i = 0; i < batch->n_uris; i++)
+  {
+    g_variant_builder_add_value (&builder, batch->results[i]);
+    g_variant_unref (batch->results[i]);
+  }
+
+  batch->func (g_variant_builder_end (&builder), batch->user_data);
+
+  g_free (batch->results);
+  g_free (batch->attributes);
+  g_strfreev (batch->uris);
+  g_free (batch);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+_sandbox_utils_selection_work (gpointer data,
+                               gpointer pool_data)
+{
+  SandboxUtilsSelectionJob   *job   = data;
+  SandboxUtilsSelectionBatch *batch = job->batch;
+
+  // Each thread writes its own slot, the last one hands the batch back
+  batch->results[job->index] = g_variant_ref_sink (_sandboxutils_file_info_query (batch->uris[job->index],
+                                                                                  batch->attributes,
+                                                                                  NULL));
+  g_free (job);
+
+  if (g_atomic_int_dec_and_test (&batch->pending))
+    g_idle_add (_sandbox_utils_selection_finish, batch);
+}
+
+/*
+ * Queries @attributes of the files at @uris on the thread pool, and calls
+ * @func on the main loop with them, in the order of @uris. @attributes must
+ * have been checked with _sandboxutils_file_info_check_attributes().
+ */
+void
+sandbox_utils_selection_query_info (const gchar * const           *uris,
+                                    const gchar                   *attributes,
+                                    SandboxUtilsSelectionInfoFunc  func,
+                                    gpointer                       user_data)
+{
+  SandboxUtilsSelectionBatch *batch;
+  SandboxUtilsSelectionJob   *job;
+  guint                       i;
+
+  g_return_if_fail (uris != NULL);
+  g_return_if_fail (attributes != NULL);
+  g_return_if_fail (func != NULL);
+
+  batch = g_malloc0 (sizeof (SandboxUtilsSelectionBatch));
+  batch->uris       = g_strdupv ((gchar **) uris);
+  batch->attributes = g_strdup (attributes);
+  batch->n_uris     = g_strv_length (batch->uris);
+  batch->results    = g_new0 (GVariant *, MAX (batch->n_uris, 1));
+  batch->func       = func;
+  batch->user_data  = user_data;
+
+  // Held until every job is pushed, so that the batch is not finished early
+  batch->pending = batch->n_uris + 1;
+
+  for (i = 0; i < batch->n_uris; i++)
+  {
+    job = g_malloc (sizeof (SandboxUtilsSelectionJob));
+    job->batch = batch;
+    job->index = i;
+
+    if (_pool)
+      g_thread_pool_push (_pool, job, NULL);
+    else
+      _sandbox_utils_selection_work (job, NULL);
+  }
+
+  if (g_atomic_int_dec_and_test (&batch->pending))
+    g_idle_add (_sandbox_utils_selection_finish, batch);
+}
+
+void
+sandbox_utils_selection_start ()
+{
+  if (_pool)
+    return;
+
+  _pool = g_thread_pool_new (_sandbox_utils_selection_work, NULL,
+                             CLAMP (_option_threads, 1, 32), FALSE, NULL);
+
+  syslog (LOG_DEBUG, "SandboxUtilsSelection.Start: querying files on %d threads.\n",
+          CLAMP (_option_threads, 1, 32));
+}
+
+void
+sandbox_utils_selection_stop ()
+{
+  if (!_pool)
+    return;
+
+  // Queries already pushed are completed so that no batch is left hanging
+  g_thread_pool_free (_pool, FALSE, TRUE);
+  _pool = NULL;
+}
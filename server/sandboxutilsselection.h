@@ -0,0 +1,42 @@
+/* SandboxUtils -- Sandbox Utilities Selection Info
+ * Copyright (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>, 2014
+ *
+ * Under GPLv3
+ *
+ ***
+ *
+ * Gathers the attributes of the files chosen in a dialog, for clients that
+ * would otherwise stat them one by one through their sandbox once the dialog
+ * returned. Files are queried in parallel by a pool of threads, so that a
+ * large selection or a slow network folder costs the time of the slowest
+ * file rather than the sum of all, and the main loop never waits on them.
+ *
+ * Only attributes of the standard, time, access and unix namespaces can be
+ * asked for, see lib/sandboxutilsfileinfo.h.
+ *
+ */
+#ifndef _SANDBOX_UTILS_SELECTION_H
+#define _SANDBOX_UTILS_SELECTION_H
+
+#include <gio/gio.h>
+
+/* Called on the main loop with an a(sa{sv}) of URIs and their attributes */
+typedef void (*SandboxUtilsSelectionInfoFunc) (GVariant *files,
+                                               gpointer  user_data);
+
+GOptionGroup *
+sandbox_utils_selection_get_option_group ();
+
+void
+sandbox_utils_selection_start ();
+
+void
+sandbox_utils_selection_stop ();
+
+void
+sandbox_utils_selection_query_info (const gchar * const           *uris,
+                                    const gchar                   *attributes,
+                                    SandboxUtilsSelectionInfoFunc  func,
+                                    gpointer                       user_data);
+
+#endif /* #ifndef _SANDBOX_UTILS_SELECTION_H */
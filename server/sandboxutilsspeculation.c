@@ -0,0 +1,367 @@
+/* SandboxUtils -- Sandbox Utilities Speculative Realisation
+ * Copyright (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>, 2014
+ *
+ * Under GPLv3
+ *
+ ***
+ *
+ * Realises idle dialogs ahead of Run. See sandboxutilsspeculation.h.
+ *
+ */
+#include <syslog.h>
+
+#include "sandboxutilsspeculation.h"
+#include "sandboxutilsmemory.h"
+#include "sandboxutilsdircache.h"
+#include "sandboxutilstrace.h"
+#include "localfilechooserdialog.h"
+
+// Realising a dialog can look free when the heap had room to spare already;
+// charge at least this much so that the budget still means something
+#define SANDBOX_UTILS_SPECULATION_MIN_COST (512 * 1024)
+
+// Folder entries read per batch when reading a folder ahead
+#define SANDBOX_UTILS_SPECULATION_BATCH 64
+
+#define SANDBOX_UTILS_SPECULATION_ATTRIBUTES "standard::*,time::modified"
+
+static gboolean _option_enabled = FALSE;
+static gint     _option_delay   = 300;
+static gint     _option_budget  = 64;
+
+static GOptionEntry entries[] =
+{
+  {
+    "speculative-realize", 0, 0, G_OPTION_ARG_NONE, &_option_enabled,
+    "Realise dialogs and read their folder while clients configure them, so they show faster", NULL
+  },
+  {
+    "speculative-delay", 0, 0, G_OPTION_ARG_INT, &_option_delay,
+    "Milliseconds a dialog must be left untouched before it is realised (default: 300)", "MS"
+  },
+  {
+    "speculative-budget", 0, 0, G_OPTION_ARG_INT, &_option_budget,
+    "Megabytes of memory that realised dialogs may use before they are run (default: 64)", "MB"
+  },
+  {
+    NULL, ' ', 0, 0, NULL,
+    NULL, NULL
+  }
+};
+
+/* What was done ahead of time for a dialog still being configured */
+typedef struct {
+  SandboxFileChooserDialog *sfcd;        /* not owned, see _on_finalized */
+  guint                     timeout_id;  /* pending realisation, or 0 */
+  GCancellable             *warming;     /* folder being read, or NULL */
+  gint64                    charged;     /* bytes charged to the budget */
+  GList                    *link;        /* in _prepared if realised by us */
+} SandboxUtilsSpeculation;
+
+static GHashTable *_speculations = NULL;
+static GQueue      _prepared     = G_QUEUE_INIT;  /* least recently prepared first */
+static gint64      _charged      = 0;
+static gint64      _estimate     = SANDBOX_UTILS_SPECULATION_MIN_COST;
+
+GOptionGroup *
+sandbox_utils_speculation_get_option_group ()
+{
+  GOptionGroup *group;
+
+  group = g_option_group_new ("speculation", "Speculative Realisation", "Show speculative realisation options", NULL, NULL);
+
+  g_option_group_add_entries (group, entries);
+  g_option_group_set_translation_domain (group, NULL);
+
+  return group;
+}
+
+gboolean
+sandbox_utils_speculation_get_enabled ()
+{
+  return _option_enabled;
+}
+
+static void
+_sandbox_utils_speculation_uncharge (SandboxUtilsSpeculation *spec)
+{
+  if (spec->link)
+  {
+    g_queue_delete_link (&_prepared, spec->link);
+    spec->link = NULL;
+  }
+
+  _charged     -= spec->charged;
+  spec->charged = 0;
+}
+
+static void
+_sandbox_utils_speculation_cancel (SandboxUtilsSpeculation *spec)
+{
+  if (spec->timeout_id)
+  {
+    g_source_remove (spec->timeout_id);
+    spec->timeout_id = 0;
+  }
+
+  if (spec->warming)
+  {
+    g_cancellable_cancel (spec->warming);
+    g_object_unref (spec->warming);
+    spec->warming = NULL;
+  }
+}
+
+static void
+_sandbox_utils_speculation_free (gpointer data)
+{
+  SandboxUtilsSpeculation *spec = data;
+
+  _sandbox_utils_speculation_cancel (spec);
+  _sandbox_utils_speculation_uncharge (spec);
+
+  g_free (spec);
+}
+
+static void
+_sandbox_utils_speculation_on_finalized (gpointer  data,
+                                         GObject  *where_the_dialog_was)
+{
+  g_hash_table_remove (_speculations, where_the_dialog_was);
+}
+
+/* Unrealises a dialog we prepared, returns whether its widget was unrealised */
+static gboolean
+_sandbox_utils_speculation_unprepare (SandboxUtilsSpeculation *spec)
+{
+  gboolean unprepared;
+
+  unprepared = lfcd_unprepare (spec->sfcd);
+  _sandbox_utils_speculation_uncharge (spec);
+
+  SU_TRACE2 (speculation_unprepare, sfcd_get_id (spec->sfcd), unprepared);
+
+  return unprepared;
+}
+
+static void
+_sandbox_utils_speculation_on_next_files (GObject      *source,
+                                          GAsyncResult *res,
+                                          gpointer      user_data)
+{
+  GFileEnumerator *enumerator  = G_FILE_ENUMERATOR (source);
+  GCancellable    *cancellable = user_data;
+  GList           *files;
+
+  // Entries are only read to get them cached, GTK+ will read them again
+  files = g_file_enumerator_next_files_finish (enumerator, res, NULL);
+
+  if (files && !g_cancellable_is_cancelled (cancellable))
+  {
+    g_list_free_full (files, g_object_unref);
+    g_file_enumerator_next_files_async (enumerator,
+                                        SANDBOX_UTILS_SPECULATION_BATCH,
+                                        G_PRIORITY_LOW,
+                                        cancellable,
+                                        _sandbox_utils_speculation_on_next_files,
+                                        cancellable);
+    return;
+  }
+
+  g_list_free_full (files, g_object_unref);
+  g_object_unref (enumerator);
+  g_object_unref (cancellable);
+}
+
+static void
+_sandbox_utils_speculation_on_enumerated (GObject      *source,
+                                          GAsyncResult *res,
+                                          gpointer      user_data)
+{
+  GFileEnumerator *enumerator;
+  GCancellable    *cancellable = user_data;
+
+  enumerator = g_file_enumerate_children_finish (G_FILE (source), res, NULL);
+  if (!enumerator)
+  {
+    g_object_unref (cancellable);
+    return;
+  }
+
+  g_file_enumerator_next_files_async (enumerator,
+                                      SANDBOX_UTILS_SPECULATION_BATCH,
+                                      G_PRIORITY_LOW,
+                                      cancellable,
+                                      _sandbox_utils_speculation_on_next_files,
+                                      cancellable);
+}
+
+/*
+ * Reads the dialog's current folder in the background, at a lower priority
+ * than client calls, so that the file system and GVfs have it cached by the
+ * time the dialog shows it.
+ */
+static void
+_sandbox_utils_speculation_warm (SandboxUtilsSpeculation *spec)
+{
+  GFile *folder;
+  gchar *uri;
+
+  uri = sfcd_get_current_folder_uri (spec->sfcd, NULL);
+  if (!uri)
+    return;
+
+  folder        = g_file_new_for_uri (uri);
+  spec->warming = g_cancellable_new ();
+
+  // The directory cache reads it once for all dialogs, and keeps it fresh
+  if (sandbox_utils_dircache_get_enabled ())
+    sandbox_utils_dircache_load (folder, spec->warming);
+  else
+    g_file_enumerate_children_async (folder,
+                                     SANDBOX_UTILS_SPECULATION_ATTRIBUTES,
+                                     G_FILE_QUERY_INFO_NONE,
+                                     G_PRIORITY_LOW,
+                                     spec->warming,
+                                     _sandbox_utils_speculation_on_enumerated,
+                                     g_object_ref (spec->warming));
+
+  SU_TRACE1 (speculation_warm, sfcd_get_id (spec->sfcd));
+
+  g_object_unref (folder);
+  g_free (uri);
+}
+
+static gboolean
+_sandbox_utils_speculation_on_idle (gpointer data)
+{
+  SandboxUtilsSpeculation *spec   = data;
+  gint64                   budget = (gint64) _option_budget * 1024 * 1024;
+  gint64                   before;
+  gint64                   cost;
+
+  spec->timeout_id = 0;
+
+  if (sfcd_get_state (spec->sfcd) != SFCD_CONFIGURATION)
+    return G_SOURCE_REMOVE;
+
+  if (spec->link)
+  {
+    // Still prepared from an earlier wait, only its folder may have changed
+    g_queue_unlink (&_prepared, spec->link);
+    g_queue_push_tail_link (&_prepared, spec->link);
+  }
+  else
+  {
+    // Make room by giving up on the dialogs that have waited for longest
+    while (_charged + _estimate > budget && !g_queue_is_empty (&_prepared))
+      _sandbox_utils_speculation_unprepare (g_queue_peek_head (&_prepared));
+
+    if (_charged + _estimate > budget)
+    {
+      syslog (LOG_DEBUG, "SandboxUtilsSpeculation.OnIdle: no room left to prepare dialog '%s'.\n",
+              sfcd_get_id (spec->sfcd));
+      return G_SOURCE_REMOVE;
+    }
+
+    before = sandbox_utils_memory_get_rss ();
+    if (lfcd_prepare (spec->sfcd))
+    {
+      cost = MAX (sandbox_utils_memory_get_rss () - before, SANDBOX_UTILS_SPECULATION_MIN_COST);
+
+      spec->charged = cost;
+      _charged     += cost;
+      _estimate     = (3 * _estimate + cost) / 4;
+
+      g_queue_push_tail (&_prepared, spec);
+      spec->link = g_queue_peek_tail_link (&_prepared);
+
+      SU_TRACE2 (speculation_prepare, sfcd_get_id (spec->sfcd), cost);
+
+      syslog (LOG_DEBUG, "SandboxUtilsSpeculation.OnIdle: prepared dialog '%s' for %" G_GINT64_FORMAT " bytes (%" G_GINT64_FORMAT " bytes charged in total).\n",
+              sfcd_get_id (spec->sfcd), cost, _charged);
+    }
+  }
+
+  _sandbox_utils_speculation_warm (spec);
+
+  return G_SOURCE_REMOVE;
+}
+
+/*
+ * Tells the speculation engine that a client made a call that may have changed
+ * @sfcd. Work under way for @sfcd is cancelled, and @sfcd is prepared again
+ * once left alone for long enough, unless it is no longer being configured.
+ * Must be called from the main loop.
+ */
+void
+sandbox_utils_speculation_touch (SandboxFileChooserDialog *sfcd)
+{
+  SandboxUtilsSpeculation *spec;
+
+  if (!_option_enabled || !LOCAL_IS_FILE_CHOOSER_DIALOG (sfcd))
+    return;
+
+  if (!_speculations)
+    _speculations = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, _sandbox_utils_speculation_free);
+
+  spec = g_hash_table_lookup (_speculations, sfcd);
+  if (!spec)
+  {
+    spec = g_malloc0 (sizeof (SandboxUtilsSpeculation));
+    spec->sfcd = sfcd;
+    g_object_weak_ref (G_OBJECT (sfcd), _sandbox_utils_speculation_on_finalized, NULL);
+    g_hash_table_insert (_speculations, sfcd, spec);
+  }
+
+  if (spec->warming)
+    SU_TRACE1 (speculation_cancel, sfcd_get_id (sfcd));
+
+  _sandbox_utils_speculation_cancel (spec);
+
+  // A running dialog is no longer speculative: its memory is in actual use
+  if (sfcd_get_state (sfcd) != SFCD_CONFIGURATION)
+  {
+    _sandbox_utils_speculation_uncharge (spec);
+    return;
+  }
+
+  spec->timeout_id = g_timeout_add (MAX (_option_delay, 0), _sandbox_utils_speculation_on_idle, spec);
+}
+
+/* Stops preparing @sfcd, e.g. because it is being destroyed */
+void
+sandbox_utils_speculation_forget (SandboxFileChooserDialog *sfcd)
+{
+  if (!_speculations || !g_hash_table_contains (_speculations, sfcd))
+    return;
+
+  g_object_weak_unref (G_OBJECT (sfcd), _sandbox_utils_speculation_on_finalized, NULL);
+  g_hash_table_remove (_speculations, sfcd);
+}
+
+/*
+ * Shrinker for sandbox_utils_memory_add_shrinker(). Cancels all speculative
+ * work and unrealises the dialogs that were prepared but not run yet.
+ */
+guint
+sandbox_utils_speculation_shrink (gpointer data)
+{
+  SandboxUtilsSpeculation *spec;
+  GHashTableIter           iter;
+  guint                    released = 0;
+
+  if (!_speculations)
+    return 0;
+
+  g_hash_table_iter_init (&iter, _speculations);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &spec))
+  {
+    _sandbox_utils_speculation_cancel (spec);
+
+    if (spec->link && _sandbox_utils_speculation_unprepare (spec))
+      released++;
+  }
+
+  return released;
+}
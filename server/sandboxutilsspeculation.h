@@ -0,0 +1,41 @@
+/* SandboxUtils -- Sandbox Utilities Speculative Realisation
+ * Copyright (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>, 2014
+ *
+ * Under GPLv3
+ *
+ ***
+ *
+ * Prepares dialogs for running while their client is still configuring them.
+ * When enabled, a dialog left untouched for a short while after a change to
+ * its configuration gets its widget realised off-screen (windows, style and
+ * size allocation) and its current folder read ahead, into the directory
+ * cache when enabled, so that Run only has to map it.
+ *
+ * Any further change to the dialog's configuration cancels the folder reading
+ * and restarts the wait. Prepared dialogs are charged the resident memory
+ * they cost, and the least recently prepared ones are unrealised when the
+ * budget is exhausted or when the system runs low on memory.
+ *
+ */
+#ifndef _SANDBOX_UTILS_SPECULATION_H
+#define _SANDBOX_UTILS_SPECULATION_H
+
+#include <gio/gio.h>
+#include "sandboxfilechooserdialog.h"
+
+GOptionGroup *
+sandbox_utils_speculation_get_option_group ();
+
+gboolean
+sandbox_utils_speculation_get_enabled ();
+
+void
+sandbox_utils_speculation_touch (SandboxFileChooserDialog *sfcd);
+
+void
+sandbox_utils_speculation_forget (SandboxFileChooserDialog *sfcd);
+
+guint
+sandbox_utils_speculation_shrink (gpointer data);
+
+#endif /* #ifndef _SANDBOX_UTILS_SPECULATION_H */
@@ -0,0 +1,505 @@
+/* SandboxUtils -- Sandbox Utilities Dialog Templates
+ * Copyright (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>, 2014
+ *
+ * Under GPLv3
+ *
+ ***
+ *
+ * Dialog configurations registered by clients. See sandboxutilstemplate.h.
+ *
+ */
+#include <string.h>
+#include <syslog.h>
+
+#include "sandboxutilstemplate.h"
+#include "sandboxutilstrace.h"
+#include "localfilechooserdialog.h"
+
+static gboolean _option_spares = FALSE;
+
+static GOptionEntry entries[] =
+{
+  {
+    "template-spares", 0, 0, G_OPTION_ARG_NONE, &_option_spares,
+    "Keep a dialog built ahead for each template in use, so that NewFromTemplate returns at once", NULL
+  },
+  {
+    NULL, ' ', 0, 0, NULL,
+    NULL, NULL
+  }
+};
+
+/* Keys of a template, in the order they are applied to dialogs */
+typedef struct {
+  const gchar *key;
+  const gchar *type;
+  gboolean     overridable;
+} SandboxUtilsTemplateKey;
+
+static const SandboxUtilsTemplateKey _keys[] =
+{
+  { "title",                     "s",        TRUE  },
+  { "parent",                    "s",        TRUE  },
+  { "action",                    "i",        FALSE },
+  { "buttons",                   "a{sv}",    FALSE },
+  { "local-only",                "b",        TRUE  },
+  { "select-multiple",           "b",        TRUE  },
+  { "show-hidden",               "b",        TRUE  },
+  { "do-overwrite-confirmation", "b",        TRUE  },
+  { "create-folders",            "b",        TRUE  },
+  { "shortcut-folders",          "as",       TRUE  },
+  { "shortcut-folder-uris",      "as",       TRUE  },
+  { "filters",                   "a(sasas)", TRUE  },
+  { "filter",                    "s",        TRUE  },
+  { "current-folder",            "s",        TRUE  },
+  { "current-folder-uri",        "s",        TRUE  },
+  { "current-name",              "s",        TRUE  },
+  { NULL,                        NULL,       FALSE }
+};
+
+struct _SandboxUtilsTemplate
+{
+  gint                       ref_count;
+  GVariant                  *config;    /* validated a{sv} */
+  gchar                     *title;
+  gchar                     *parent;
+  GtkFileChooserAction       action;
+  GVariant                  *buttons;   /* validated a{sv}, as taken by New */
+  SandboxFileChooserDialog  *spare;     /* dialog built ahead, or NULL */
+  guint                      spare_id;  /* idle building the spare, or 0 */
+};
+
+static GHashTable *_spared = NULL;      /* templates that have a spare */
+
+GOptionGroup *
+sandbox_utils_template_get_option_group ()
+{
+  GOptionGroup *group;
+
+  group = g_option_group_new ("template", "Dialog Templates", "Show dialog template options", NULL, NULL);
+
+  g_option_group_add_entries (group, entries);
+  g_option_group_set_translation_domain (group, NULL);
+
+  return group;
+}
+
+/* Same as the check made by local dialogs when adding buttons */
+static gboolean
+_sandbox_utils_template_is_accept_response_id (gint response_id)
+{
+  return (response_id == GTK_RESPONSE_ACCEPT
+       || response_id == GTK_RESPONSE_OK
+       || response_id == GTK_RESPONSE_YES
+       || response_id == GTK_RESPONSE_APPLY);
+}
+
+static gboolean
+_sandbox_utils_template_validate_buttons (GVariant  *buttons,
+                                          GError   **error)
+{
+  GVariantIter  iter;
+  GVariant     *value;
+  gchar        *label;
+
+  g_variant_iter_init (&iter, buttons);
+  while (!*error && g_variant_iter_next (&iter, "{sv}", &label, &value))
+  {
+    if (!g_variant_is_of_type (value, G_VARIANT_TYPE_INT32))
+      g_set_error (error,
+                   g_quark_from_static_string (SFCD_ERROR_DOMAIN),
+                   SFCD_ERROR_CREATION,
+                   "SandboxUtilsTemplate.Validate: the response id of button '%s' is not an int32.\n",
+                   label);
+
+    // Refused now rather than silently left out of every dialog
+    else if (_sandbox_utils_template_is_accept_response_id (g_variant_get_int32 (value)) &&
+             !sfcd_is_accept_label (label))
+      g_set_error (error,
+                   g_quark_from_static_string (SFCD_ERROR_DOMAIN),
+                   SFCD_ERROR_CREATION,
+                   "SandboxUtilsTemplate.Validate: button '%s' cannot have acceptance response id %d, as its label is not known to convey acceptance.\n",
+                   label,
+                   g_variant_get_int32 (value));
+
+    g_variant_unref (value);
+    g_free (label);
+  }
+
+  return *error == NULL;
+}
+
+/*
+ * Checks that @config only holds known keys with the right types, so that
+ * dialogs are never configured half-way. @overrides tells whether @config
+ * overrides a template whose dialogs have @action.
+ */
+static gboolean
+_sandbox_utils_template_validate (GVariant              *config,
+                                  gboolean               overrides,
+                                  GtkFileChooserAction   action,
+                                  GError               **error)
+{
+  const SandboxUtilsTemplateKey *k;
+  GVariantIter                   iter;
+  GVariant                      *value;
+  gchar                         *key;
+
+  if (!g_variant_is_of_type (config, G_VARIANT_TYPE_VARDICT))
+  {
+    g_set_error (error,
+                 g_quark_from_static_string (SFCD_ERROR_DOMAIN),
+                 SFCD_ERROR_CREATION,
+                 "SandboxUtilsTemplate.Validate: configuration is of type '%s' instead of 'a{sv}'.\n",
+                 g_variant_get_type_string (config));
+    return FALSE;
+  }
+
+  g_variant_iter_init (&iter, config);
+  while (!*error && g_variant_iter_next (&iter, "{sv}", &key, &value))
+  {
+    for (k = _keys; k->key && g_strcmp0 (k->key, key) != 0; k++);
+
+    if (!k->key)
+      g_set_error (error,
+                   g_quark_from_static_string (SFCD_ERROR_DOMAIN),
+                   SFCD_ERROR_CREATION,
+                   "SandboxUtilsTemplate.Validate: unknown key '%s'.\n",
+                   key);
+    else if (overrides && !k->overridable)
+      g_set_error (error,
+                   g_quark_from_static_string (SFCD_ERROR_DOMAIN),
+                   SFCD_ERROR_CREATION,
+                   "SandboxUtilsTemplate.Validate: key '%s' cannot be overridden, register another template instead.\n",
+                   key);
+    else if (!g_variant_is_of_type (value, G_VARIANT_TYPE (k->type)))
+      g_set_error (error,
+                   g_quark_from_static_string (SFCD_ERROR_DOMAIN),
+                   SFCD_ERROR_CREATION,
+                   "SandboxUtilsTemplate.Validate: key '%s' is of type '%s' instead of '%s'.\n",
+                   key,
+                   g_variant_get_type_string (value),
+                   k->type);
+    else if (g_strcmp0 (key, "action") == 0 &&
+             (g_variant_get_int32 (value) < GTK_FILE_CHOOSER_ACTION_OPEN ||
+              g_variant_get_int32 (value) > GTK_FILE_CHOOSER_ACTION_CREATE_FOLDER))
+      g_set_error (error,
+                   g_quark_from_static_string (SFCD_ERROR_DOMAIN),
+                   SFCD_ERROR_CREATION,
+                   "SandboxUtilsTemplate.Validate: %d is not a valid action.\n",
+                   g_variant_get_int32 (value));
+
+    // Only save dialogs have a name typed in by the user
+    else if (g_strcmp0 (key, "current-name") == 0 &&
+             action != GTK_FILE_CHOOSER_ACTION_SAVE &&
+             action != GTK_FILE_CHOOSER_ACTION_CREATE_FOLDER)
+      g_set_error (error,
+                   g_quark_from_static_string (SFCD_ERROR_DOMAIN),
+                   SFCD_ERROR_CREATION,
+                   "SandboxUtilsTemplate.Validate: key 'current-name' is only allowed in save dialogs.\n");
+    else if (g_strcmp0 (key, "buttons") == 0)
+      _sandbox_utils_template_validate_buttons (value, error);
+
+    g_variant_unref (value);
+    g_free (key);
+  }
+
+  return *error == NULL;
+}
+
+/* Applies the keys of @config that are not given when building dialogs */
+static gboolean
+_sandbox_utils_template_apply (SandboxFileChooserDialog  *sfcd,
+                               GVariant                  *config,
+                               GError                   **error)
+{
+  const SandboxUtilsTemplateKey  *k;
+  GVariantIter                    iter;
+  GVariant                       *value;
+  const gchar                    *s;
+  const gchar                   **patterns;
+  const gchar                   **mime_types;
+
+  for (k = _keys; k->key && !*error; k++)
+  {
+    if ((value = g_variant_lookup_value (config, k->key, G_VARIANT_TYPE (k->type))) == NULL)
+      continue;
+
+    if (g_strcmp0 (k->key, "local-only") == 0)
+      sfcd_set_local_only (sfcd, g_variant_get_boolean (value), error);
+    else if (g_strcmp0 (k->key, "select-multiple") == 0)
+      sfcd_set_select_multiple (sfcd, g_variant_get_boolean (value), error);
+    else if (g_strcmp0 (k->key, "show-hidden") == 0)
+      sfcd_set_show_hidden (sfcd, g_variant_get_boolean (value), error);
+    else if (g_strcmp0 (k->key, "do-overwrite-confirmation") == 0)
+      sfcd_set_do_overwrite_confirmation (sfcd, g_variant_get_boolean (value), error);
+    else if (g_strcmp0 (k->key, "create-folders") == 0)
+      sfcd_set_create_folders (sfcd, g_variant_get_boolean (value), error);
+    else if (g_strcmp0 (k->key, "shortcut-folders") == 0)
+    {
+      g_variant_iter_init (&iter, value);
+      while (!*error && g_variant_iter_next (&iter, "&s", &s))
+        sfcd_add_shortcut_folder (sfcd, s, error);
+    }
+    else if (g_strcmp0 (k->key, "shortcut-folder-uris") == 0)
+    {
+      g_variant_iter_init (&iter, value);
+      while (!*error && g_variant_iter_next (&iter, "&s", &s))
+        sfcd_add_shortcut_folder_uri (sfcd, s, error);
+    }
+    else if (g_strcmp0 (k->key, "filters") == 0)
+    {
+      g_variant_iter_init (&iter, value);
+      while (!*error && g_variant_iter_next (&iter, "(&s^a&s^a&s)", &s, &patterns, &mime_types))
+      {
+        sfcd_add_filter (sfcd, s, patterns, mime_types, error);
+        g_free (patterns);
+        g_free (mime_types);
+      }
+    }
+    else if (g_strcmp0 (k->key, "filter") == 0)
+      sfcd_set_filter (sfcd, g_variant_get_string (value, NULL), error);
+    else if (g_strcmp0 (k->key, "current-folder") == 0)
+      sfcd_set_current_folder (sfcd, g_variant_get_string (value, NULL), error);
+    else if (g_strcmp0 (k->key, "current-folder-uri") == 0)
+      sfcd_set_current_folder_uri (sfcd, g_variant_get_string (value, NULL), error);
+    else if (g_strcmp0 (k->key, "current-name") == 0)
+      sfcd_set_current_name (sfcd, g_variant_get_string (value, NULL), error);
+
+    // The title, parent, action and buttons are given when building the dialog
+    g_variant_unref (value);
+  }
+
+  return *error == NULL;
+}
+
+static SandboxFileChooserDialog *
+_sandbox_utils_template_build (SandboxUtilsTemplate  *tmpl,
+                               const gchar           *title,
+                               const gchar           *parent,
+                               GError               **error)
+{
+  SandboxFileChooserDialog *sfcd;
+
+  sfcd = lfcd_new_variant (title, parent, NULL, tmpl->action, tmpl->buttons);
+  if (sfcd == NULL)
+  {
+    g_set_error (error,
+                 g_quark_from_static_string (SFCD_ERROR_DOMAIN),
+                 SFCD_ERROR_CREATION,
+                 "SandboxUtilsTemplate.Build: could not allocate memory to create SandboxFileChooserDialog.\n");
+    return NULL;
+  }
+
+  if (!_sandbox_utils_template_apply (sfcd, tmpl->config, error))
+  {
+    g_object_unref (sfcd);
+    return NULL;
+  }
+
+  return sfcd;
+}
+
+static void
+_sandbox_utils_template_drop_spare (SandboxUtilsTemplate *tmpl)
+{
+  if (tmpl->spare_id)
+  {
+    g_source_remove (tmpl->spare_id);
+    tmpl->spare_id = 0;
+  }
+
+  if (tmpl->spare)
+  {
+    g_object_unref (tmpl->spare);
+    tmpl->spare = NULL;
+  }
+}
+
+static gboolean
+_sandbox_utils_template_on_spare (gpointer data)
+{
+  SandboxUtilsTemplate *tmpl  = data;
+  GError               *error = NULL;
+
+  tmpl->spare_id = 0;
+  tmpl->spare    = _sandbox_utils_template_build (tmpl, tmpl->title, tmpl->parent, &error);
+
+  if (tmpl->spare)
+  {
+    if (!_spared)
+      _spared = g_hash_table_new (g_direct_hash, g_direct_equal);
+    g_hash_table_add (_spared, tmpl);
+
+    syslog (LOG_DEBUG, "SandboxUtilsTemplate.OnSpare: dialog '%s' ('%s') was built ahead.\n",
+            sfcd_get_id (tmpl->spare), tmpl->title);
+  }
+  else
+  {
+    syslog (LOG_WARNING, "SandboxUtilsTemplate.OnSpare: could not build a dialog ahead -- %s",
+            _sandboxutils_error_get_message (error));
+    g_error_free (error);
+  }
+
+  return G_SOURCE_REMOVE;
+}
+
+/*
+ * Validates @config, see sandboxutilstemplate.h for its keys. Returns a new
+ * template, or %NULL and sets @error if @config is not valid.
+ */
+SandboxUtilsTemplate *
+sandbox_utils_template_new (GVariant  *config,
+                            GError   **error)
+{
+  SandboxUtilsTemplate *tmpl;
+  GtkFileChooserAction  action = GTK_FILE_CHOOSER_ACTION_OPEN;
+  const gchar          *title  = NULL;
+  const gchar          *parent = "(null)";
+  GVariant             *buttons;
+
+  g_return_val_if_fail (config != NULL, NULL);
+  g_return_val_if_fail (error != NULL && *error == NULL, NULL);
+
+  if (g_variant_is_of_type (config, G_VARIANT_TYPE_VARDICT))
+    g_variant_lookup (config, "action", "i", &action);
+
+  if (!_sandbox_utils_template_validate (config, FALSE, action, error))
+    return NULL;
+
+  g_variant_lookup (config, "title", "&s", &title);
+  g_variant_lookup (config, "parent", "&s", &parent);
+
+  buttons = g_variant_lookup_value (config, "buttons", G_VARIANT_TYPE_VARDICT);
+  if (!buttons)
+    buttons = g_variant_ref_sink (g_variant_new_array (G_VARIANT_TYPE ("{sv}"), NULL, 0));
+
+  tmpl = g_malloc0 (sizeof (SandboxUtilsTemplate));
+  tmpl->ref_count = 1;
+  tmpl->config    = g_variant_ref_sink (config);
+  tmpl->title     = g_strdup (title);
+  tmpl->parent    = g_strdup (parent);
+  tmpl->action    = action;
+  tmpl->buttons   = buttons;
+
+  return tmpl;
+}
+
+SandboxUtilsTemplate *
+sandbox_utils_template_ref (SandboxUtilsTemplate *tmpl)
+{
+  g_return_val_if_fail (tmpl != NULL, NULL);
+
+  g_atomic_int_inc (&tmpl->ref_count);
+
+  return tmpl;
+}
+
+void
+sandbox_utils_template_unref (gpointer data)
+{
+  SandboxUtilsTemplate *tmpl = data;
+
+  g_return_if_fail (tmpl != NULL);
+
+  if (!g_atomic_int_dec_and_test (&tmpl->ref_count))
+    return;
+
+  if (_spared)
+    g_hash_table_remove (_spared, tmpl);
+
+  _sandbox_utils_template_drop_spare (tmpl);
+
+  g_variant_unref (tmpl->config);
+  g_variant_unref (tmpl->buttons);
+  g_free (tmpl->title);
+  g_free (tmpl->parent);
+  g_free (tmpl);
+}
+
+/*
+ * Creates a dialog from @tmpl, with @overrides (may be %NULL) applied on top.
+ * The dialog built ahead is handed out when there is one and @overrides do
+ * not change its title or parent. Returns a new dialog, or %NULL and sets
+ * @error. Main loop only.
+ */
+SandboxFileChooserDialog *
+sandbox_utils_template_instantiate (SandboxUtilsTemplate  *tmpl,
+                                    GVariant              *overrides,
+                                    GError               **error)
+{
+  SandboxFileChooserDialog *sfcd    = NULL;
+  const gchar              *title;
+  const gchar              *parent;
+  gboolean                  spared  = FALSE;
+  gint64                    started = SU_TRACE_NOW ();
+
+  g_return_val_if_fail (tmpl != NULL, NULL);
+  g_return_val_if_fail (error != NULL && *error == NULL, NULL);
+
+  title  = tmpl->title;
+  parent = tmpl->parent;
+
+  if (overrides)
+  {
+    if (!_sandbox_utils_template_validate (overrides, TRUE, tmpl->action, error))
+      return NULL;
+
+    g_variant_lookup (overrides, "title", "&s", &title);
+    g_variant_lookup (overrides, "parent", "&s", &parent);
+  }
+
+  // The spare was built with the template's own title and parent
+  if (tmpl->spare && title == tmpl->title && parent == tmpl->parent)
+  {
+    sfcd        = tmpl->spare;
+    tmpl->spare = NULL;
+    spared      = TRUE;
+
+    if (_spared)
+      g_hash_table_remove (_spared, tmpl);
+  }
+  else if ((sfcd = _sandbox_utils_template_build (tmpl, title, parent, error)) == NULL)
+    return NULL;
+
+  if (overrides && !_sandbox_utils_template_apply (sfcd, overrides, error))
+  {
+    g_object_unref (sfcd);
+    return NULL;
+  }
+
+  // Build the next one once the main loop has nothing better to do
+  if (_option_spares && !tmpl->spare && !tmpl->spare_id)
+    tmpl->spare_id = g_idle_add_full (G_PRIORITY_LOW, _sandbox_utils_template_on_spare, tmpl, NULL);
+
+  SU_TRACE2 (template_instantiate, spared, SU_TRACE_NOW () - started);
+
+  return sfcd;
+}
+
+/*
+ * Destroys the dialogs built ahead for templates, which are built again when
+ * the templates are next used. Returns how many were destroyed. Meant to be
+ * registered as a shrinker, see sandboxutilsmemory.h.
+ */
+guint
+sandbox_utils_template_drop_spares (gpointer data)
+{
+  SandboxUtilsTemplate *tmpl;
+  GHashTableIter        iter;
+  guint                 dropped = 0;
+
+  if (!_spared)
+    return 0;
+
+  g_hash_table_iter_init (&iter, _spared);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &tmpl, NULL))
+  {
+    _sandbox_utils_template_drop_spare (tmpl);
+    dropped++;
+  }
+
+  g_hash_table_remove_all (_spared);
+
+  return dropped;
+}
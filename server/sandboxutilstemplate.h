@@ -0,0 +1,69 @@
+/* SandboxUtils -- Sandbox Utilities Dialog Templates
+ * Copyright (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>, 2014
+ *
+ * Under GPLv3
+ *
+ ***
+ *
+ * Dialog configurations that clients register once with RegisterTemplate and
+ * then create dialogs from with NewFromTemplate, instead of sending the same
+ * title, buttons, shortcut folders, filters and options for every dialog.
+ *
+ * A template is an a{sv} dictionary, validated when registered so that
+ * creating a dialog from it cannot fail half-way. It holds:
+ *
+ *   "title"                      s       title of the dialog
+ *   "parent"                     s       id of a remote parent window
+ *   "action"                     i       a #GtkFileChooserAction
+ *   "buttons"                    a{sv}   labels and int32 response ids, as in New
+ *   "local-only"                 b
+ *   "select-multiple"            b
+ *   "show-hidden"                b
+ *   "do-overwrite-confirmation"  b
+ *   "create-folders"             b
+ *   "current-folder"             s       local path
+ *   "current-folder-uri"         s
+ *   "current-name"               s
+ *   "shortcut-folders"           as      local paths
+ *   "shortcut-folder-uris"       as
+ *   "filters"                    a(sasas) name, patterns and MIME types
+ *   "filter"                     s       name of the filter to select
+ *
+ * NewFromTemplate takes the same keys but "action" and "buttons" as
+ * overrides. Single values replace the template's, while shortcut folders
+ * and filters are added to the template's.
+ *
+ * With --template-spares, a template that was used keeps one dialog built
+ * and configured ahead, which the next NewFromTemplate call hands out.
+ *
+ */
+#ifndef _SANDBOX_UTILS_TEMPLATE_H
+#define _SANDBOX_UTILS_TEMPLATE_H
+
+#include <gio/gio.h>
+#include "sandboxfilechooserdialog.h"
+
+typedef struct _SandboxUtilsTemplate SandboxUtilsTemplate;
+
+GOptionGroup *
+sandbox_utils_template_get_option_group ();
+
+SandboxUtilsTemplate *
+sandbox_utils_template_new (GVariant  *config,
+                            GError   **error);
+
+SandboxUtilsTemplate *
+sandbox_utils_template_ref (SandboxUtilsTemplate *tmpl);
+
+void
+sandbox_utils_template_unref (gpointer tmpl);
+
+SandboxFileChooserDialog *
+sandbox_utils_template_instantiate (SandboxUtilsTemplate  *tmpl,
+                                    GVariant              *overrides,
+                                    GError               **error);
+
+guint
+sandbox_utils_template_drop_spares (gpointer data);
+
+#endif /* #ifndef _SANDBOX_UTILS_TEMPLATE_H */
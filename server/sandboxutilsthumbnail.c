@@ -0,0 +1,852 @@
+/* SandboxUtils -- Sandbox Utilities Thumbnails
+ * Copyright (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>, 2014
+ *
+ * Under GPLv3
+ *
+ ***
+ *
+ * Makes and caches thumbnails of images. See sandboxutilsthumbnail.h.
+ *
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <gdk/gdk.h>
+
+#include "sandboxutilsthumbnail.h"
+#include "sandboxutilscommon.h"
+#include "sandboxutilsshm.h"
+
+// Bytes read at a time when decoding, between which cancellation is checked
+#define SANDBOX_UTILS_THUMBNAIL_CHUNK 65536
+
+// Images larger than this are not worth the wait, in bytes
+#define SANDBOX_UTILS_THUMBNAIL_MAX_FILE (128 * 1024 * 1024)
+
+// Where thumbnails start in a pack, so that each is aligned for SIMD loads
+#define SANDBOX_UTILS_THUMBNAIL_PACK_ALIGN 64
+
+static gboolean _option_disabled = FALSE;
+static gint     _option_threads  = 2;
+static gint     _option_budget   = 32;
+
+static GOptionEntry entries[] =
+{
+  {
+    "no-thumbnails", 0, 0, G_OPTION_ARG_NONE, &_option_disabled,
+    "Do not show thumbnails of images in dialogs", NULL
+  },
+  {
+    "thumbnail-threads", 0, 0, G_OPTION_ARG_INT, &_option_threads,
+    "Number of threads decoding images (default: 2)", "N"
+  },
+  {
+    "thumbnail-budget", 0, 0, G_OPTION_ARG_INT, &_option_budget,
+    "Megabytes of memory that thumbnails may use (default: 32)", "MB"
+  },
+  {
+    NULL, ' ', 0, 0, NULL,
+    NULL, NULL
+  }
+};
+
+/* A thumbnail kept in memory */
+typedef struct {
+  gchar                      *key;
+  GdkPixbuf                  *pixbuf;
+  gint64                      bytes;
+  GList                      *link;       /* in _lru */
+} SandboxUtilsThumbnailEntry;
+
+/* A request waiting for, or being decoded by, a thread */
+typedef struct {
+  gchar                      *path;
+  gint                        size;
+  gint                        order;      /* most recent requests come first */
+  GCancellable               *cancellable;
+  SandboxUtilsThumbnailFunc   func;
+  gpointer                    user_data;
+  GdkPixbuf                  *thumbnail;
+} SandboxUtilsThumbnailJob;
+
+/* Thumbnails being made for a client, to be packed once all are there */
+typedef struct {
+  gchar                         **uris;
+  GdkPixbuf                     **thumbnails;
+  guint                           n_uris;
+  guint                           pending;
+  SandboxUtilsThumbnailPackFunc   func;
+  gpointer                        user_data;
+} SandboxUtilsThumbnailPack;
+
+/* Where a thumbnail goes in its pack */
+typedef struct {
+  SandboxUtilsThumbnailPack      *pack;
+  guint                           index;
+} SandboxUtilsThumbnailSlot;
+
+// Threads use the memory cache, _lock protects it along with the stats
+static GMutex                      _lock;
+static GHashTable                 *_entries    = NULL;  /* key -> entry */
+static GQueue                      _lru        = G_QUEUE_INIT;  /* most recently used first */
+static SandboxUtilsThumbnailStats  _stats;
+
+// Set up by sandbox_utils_thumbnail_start(), read-only afterwards
+static GThreadPool                *_pool       = NULL;
+static GHashTable                 *_mime_types = NULL;  /* those gdk-pixbuf can read */
+static gchar                      *_cache_dir  = NULL;
+static gint                        _order      = 0;
+
+GOptionGroup *
+sandbox_utils_thumbnail_get_option_group ()
+{
+  GOptionGroup *group;
+
+  group = g_option_group_new ("thumbnail", "Thumbnails", "Show thumbnail options", NULL, NULL);
+
+  g_option_group_add_entries (group, entries);
+  g_option_group_set_translation_domain (group, NULL);
+
+  return group;
+}
+
+gboolean
+sandbox_utils_thumbnail_get_enabled ()
+{
+  return !_option_disabled;
+}
+
+static void
+_sandbox_utils_thumbnail_entry_free (gpointer data)
+{
+  SandboxUtilsThumbnailEntry *entry = data;
+
+  g_object_unref (entry->pixbuf);
+  g_free (entry->key);
+  g_free (entry);
+}
+
+/* Forgets the least recently used thumbnail, with _lock held */
+static void
+_sandbox_utils_thumbnail_evict (void)
+{
+  SandboxUtilsThumbnailEntry *entry = g_queue_pop_tail (&_lru);
+
+  _stats.bytes -= entry->bytes;
+  _stats.entries--;
+  g_hash_table_remove (_entries, entry->key);
+}
+
+static GdkPixbuf *
+_sandbox_utils_thumbnail_cache_lookup (const gchar *key)
+{
+  SandboxUtilsThumbnailEntry *entry;
+  GdkPixbuf                  *pixbuf = NULL;
+
+  g_mutex_lock (&_lock);
+  if ((entry = g_hash_table_lookup (_entries, key)) != NULL)
+  {
+    g_queue_unlink (&_lru, entry->link);
+    g_queue_push_head_link (&_lru, entry->link);
+    pixbuf = g_object_ref (entry->pixbuf);
+    _stats.hits++;
+  }
+  g_mutex_unlock (&_lock);
+
+  return pixbuf;
+}
+
+static void
+_sandbox_utils_thumbnail_cache_insert (const gchar *key,
+                                       GdkPixbuf   *pixbuf)
+{
+  SandboxUtilsThumbnailEntry *entry;
+  gint64                      budget = (gint64) _option_budget * 1024 * 1024;
+
+  entry = g_malloc0 (sizeof (SandboxUtilsThumbnailEntry));
+  entry->key    = g_strdup (key);
+  entry->pixbuf = g_object_ref (pixbuf);
+  entry->bytes  = sizeof (SandboxUtilsThumbnailEntry) + strlen (key) + 1 +
+                  sizeof (GdkPixbuf *) * 4 + gdk_pixbuf_get_byte_length (pixbuf);
+
+  g_mutex_lock (&_lock);
+
+  // Another thread may have made the same thumbnail in the meantime
+  if (g_hash_table_contains (_entries, key))
+  {
+    g_mutex_unlock (&_lock);
+    _sandbox_utils_thumbnail_entry_free (entry);
+    return;
+  }
+
+  g_queue_push_head (&_lru, entry);
+  entry->link = g_queue_peek_head_link (&_lru);
+  g_hash_table_insert (_entries, entry->key, entry);
+  _stats.bytes += entry->bytes;
+  _stats.entries++;
+
+  while (_stats.bytes > budget && _lru.length > 1)
+  {
+    _sandbox_utils_thumbnail_evict ();
+    _stats.evictions++;
+  }
+
+  g_mutex_unlock (&_lock);
+}
+
+/* Scales @pixbuf down to fit in @size, taking over the reference */
+static GdkPixbuf *
+_sandbox_utils_thumbnail_fit (GdkPixbuf *pixbuf,
+                              gint       size)
+{
+  GdkPixbuf *scaled;
+  gint       width  = gdk_pixbuf_get_width (pixbuf);
+  gint       height = gdk_pixbuf_get_height (pixbuf);
+  gdouble    scale;
+
+  if (width <= size && height <= size)
+    return pixbuf;
+
+  scale  = MIN ((gdouble) size / width, (gdouble) size / height);
+  scaled = gdk_pixbuf_scale_simple (pixbuf,
+                                    MAX (1, (gint) (width * scale)),
+                                    MAX (1, (gint) (height * scale)),
+                                    GDK_INTERP_BILINEAR);
+  g_object_unref (pixbuf);
+
+  return scaled;
+}
+
+/* Path of the thumbnail of @uri in the freedesktop.org thumbnail cache */
+static gchar *
+_sandbox_utils_thumbnail_get_cache_path (const gchar *uri,
+                                         gint         bucket)
+{
+  gchar *md5  = g_compute_checksum_for_string (G_CHECKSUM_MD5, uri, -1);
+  gchar *name = g_strconcat (md5, ".png", NULL);
+  gchar *path;
+
+  path = g_build_filename (_cache_dir,
+                           bucket == SANDBOX_UTILS_THUMBNAIL_NORMAL ? "normal" : "large",
+                           name,
+                           NULL);
+  g_free (name);
+  g_free (md5);
+
+  return path;
+}
+
+/* Reads a cached thumbnail, provided that it was made from the current file */
+static GdkPixbuf *
+_sandbox_utils_thumbnail_read_cached (const gchar *cache_path,
+                                      struct stat *st)
+{
+  GdkPixbuf   *pixbuf;
+  const gchar *mtime;
+  const gchar *size;
+
+  if ((pixbuf = gdk_pixbuf_new_from_file (cache_path, NULL)) == NULL)
+    return NULL;
+
+  mtime = gdk_pixbuf_get_option (pixbuf, "tEXt::Thumb::MTime");
+  size  = gdk_pixbuf_get_option (pixbuf, "tEXt::Thumb::Size");
+
+  if (!mtime || g_ascii_strtoll (mtime, NULL, 10) != (gint64) st->st_mtime ||
+      (size && g_ascii_strtoll (size, NULL, 10) != (gint64) st->st_size))
+  {
+    g_object_unref (pixbuf);
+    return NULL;
+  }
+
+  return pixbuf;
+}
+
+/* Adds a thumbnail to the freedesktop.org thumbnail cache, atomically */
+static void
+_sandbox_utils_thumbnail_write_cached (GdkPixbuf   *pixbuf,
+                                       const gchar *cache_path,
+                                       const gchar *uri,
+                                       struct stat *st)
+{
+  gchar *folder = g_path_get_dirname (cache_path);
+  gchar *tmp    = g_strconcat (cache_path, ".XXXXXX", NULL);
+  gchar *mtime  = g_strdup_printf ("%" G_GINT64_FORMAT, (gint64) st->st_mtime);
+  gchar *size   = g_strdup_printf ("%" G_GINT64_FORMAT, (gint64) st->st_size);
+  gint   fd;
+
+  // Other users must not see what this one looks at
+  if (g_mkdir_with_parents (folder, 0700) == 0 &&
+      (fd = g_mkstemp_full (tmp, O_RDWR | O_CLOEXEC, 0600)) != -1)
+  {
+    close (fd);
+
+    if (!gdk_pixbuf_save (pixbuf, tmp, "png", NULL,
+                          "tEXt::Thumb::URI", uri,
+                          "tEXt::Thumb::MTime", mtime,
+                          "tEXt::Thumb::Size", size,
+                          "tEXt::Software", SANDBOXUTILS_NAME,
+                          NULL) ||
+        rename (tmp, cache_path) == -1)
+      unlink (tmp);
+  }
+
+  g_free (size);
+  g_free (mtime);
+  g_free (tmp);
+  g_free (folder);
+}
+
+static void
+_sandbox_utils_thumbnail_on_size_prepared (GdkPixbufLoader *loader,
+                                           gint             width,
+                                           gint             height,
+                                           gpointer         user_data)
+{
+  gint    size = GPOINTER_TO_INT (user_data);
+  gdouble scale;
+
+  // Loaders like JPEG's then decode at a fraction of the size, much faster
+  if (width > size || height > size)
+  {
+    scale = MIN ((gdouble) size / width, (gdouble) size / height);
+    gdk_pixbuf_loader_set_size (loader,
+                                MAX (1, (gint) (width * scale)),
+                                MAX (1, (gint) (height * scale)));
+  }
+}
+
+/* Decodes the image at @path into a thumbnail, chunk by chunk */
+static GdkPixbuf *
+_sandbox_utils_thumbnail_decode (const gchar   *path,
+                                 gint           size,
+                                 GCancellable  *cancellable,
+                                 GError       **error)
+{
+  GdkPixbufLoader *loader;
+  GdkPixbuf       *pixbuf = NULL;
+  GError          *tmp_error = NULL;
+  guchar          *buffer;
+  gssize           n;
+  gint             fd;
+
+  if ((fd = open (path, O_RDONLY | O_CLOEXEC | O_NOCTTY)) == -1)
+  {
+    int saved = errno;
+
+    g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved),
+                 "SandboxUtilsThumbnail.Decode: could not open '%s' (%s).\n",
+                 path, g_strerror (saved));
+    return NULL;
+  }
+
+  loader = gdk_pixbuf_loader_new ();
+  g_signal_connect (loader, "size-prepared",
+                    G_CALLBACK (_sandbox_utils_thumbnail_on_size_prepared),
+                    GINT_TO_POINTER (size));
+
+  buffer = g_malloc (SANDBOX_UTILS_THUMBNAIL_CHUNK);
+
+  while (!g_cancellable_set_error_if_cancelled (cancellable, &tmp_error))
+  {
+    n = read (fd, buffer, SANDBOX_UTILS_THUMBNAIL_CHUNK);
+
+    if (n == -1 && errno == EINTR)
+      continue;
+
+    if (n == -1)
+    {
+      int saved = errno;
+
+      g_set_error (&tmp_error, G_IO_ERROR, g_io_error_from_errno (saved),
+                   "SandboxUtilsThumbnail.Decode: could not read '%s' (%s).\n",
+                   path, g_strerror (saved));
+      break;
+    }
+
+    if (n == 0 || !gdk_pixbuf_loader_write (loader, buffer, n, &tmp_error))
+      break;
+  }
+
+  g_free (buffer);
+  close (fd);
+
+  // The loader must be closed either way, its error only matters if all went well
+  if (gdk_pixbuf_loader_close (loader, tmp_error ? NULL : &tmp_error) &&
+      (pixbuf = gdk_pixbuf_loader_get_pixbuf (loader)) != NULL)
+    pixbuf = gdk_pixbuf_apply_embedded_orientation (pixbuf);
+
+  g_object_unref (loader);
+
+  if (tmp_error)
+  {
+    g_clear_object (&pixbuf);
+    g_propagate_error (error, tmp_error);
+    return NULL;
+  }
+
+  if (!pixbuf)
+  {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                 "SandboxUtilsThumbnail.Decode: '%s' holds no image.\n", path);
+    return NULL;
+  }
+
+  // Not every loader obeys gdk_pixbuf_loader_set_size()
+  return _sandbox_utils_thumbnail_fit (pixbuf, size);
+}
+
+static gboolean
+_sandbox_utils_thumbnail_is_image (const gchar *path)
+{
+  gchar    *type = g_content_type_guess (path, NULL, 0, NULL);
+  gchar    *mime = g_content_type_get_mime_type (type);
+  gboolean  is_image;
+
+  is_image = mime && g_hash_table_contains (_mime_types, mime);
+
+  g_free (mime);
+  g_free (type);
+
+  return is_image;
+}
+
+/*
+ * Gets a thumbnail of the image at @path that fits in a square of @size
+ * pixels, from memory, from the thumbnail cache or by decoding the image.
+ * Blocks, and is meant to be called from a thread. Returns NULL with @error
+ * set if the file is not an image that can be read, or on cancellation.
+ */
+GdkPixbuf *
+sandbox_utils_thumbnail_load (const gchar   *path,
+                              gint           size,
+                              GCancellable  *cancellable,
+                              GError       **error)
+{
+  GdkPixbuf   *pixbuf = NULL;
+  GError      *tmp_error = NULL;
+  struct stat  st;
+  gchar       *key;
+  gchar       *uri;
+  gchar       *cache_path;
+  gint         bucket;
+
+  g_return_val_if_fail (path != NULL, NULL);
+  g_return_val_if_fail (size > 0, NULL);
+  g_return_val_if_fail (_pool != NULL, NULL);
+
+  if (stat (path, &st) == -1 || !S_ISREG (st.st_mode))
+  {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_REGULAR_FILE,
+                 "SandboxUtilsThumbnail.Load: '%s' is not a regular file.\n", path);
+    return NULL;
+  }
+
+  // Thumbnails are made at the sizes of the thumbnail cache, then scaled down
+  bucket = size <= SANDBOX_UTILS_THUMBNAIL_NORMAL ? SANDBOX_UTILS_THUMBNAIL_NORMAL
+                                                  : SANDBOX_UTILS_THUMBNAIL_LARGE;
+  key = g_strdup_printf ("%" G_GUINT64_FORMAT ":%" G_GUINT64_FORMAT ":%" G_GINT64_FORMAT ":%" G_GINT64_FORMAT ":%d",
+                         (guint64) st.st_dev, (guint64) st.st_ino,
+                         (gint64) st.st_mtime, (gint64) st.st_size, bucket);
+
+  if ((pixbuf = _sandbox_utils_thumbnail_cache_lookup (key)) != NULL)
+  {
+    g_free (key);
+    return _sandbox_utils_thumbnail_fit (pixbuf, size);
+  }
+
+  uri        = g_filename_to_uri (path, NULL, NULL);
+  cache_path = uri ? _sandbox_utils_thumbnail_get_cache_path (uri, bucket) : NULL;
+
+  if (cache_path && (pixbuf = _sandbox_utils_thumbnail_read_cached (cache_path, &st)) != NULL)
+  {
+    g_mutex_lock (&_lock);
+    _stats.disk_hits++;
+    g_mutex_unlock (&_lock);
+  }
+  else if (!uri || !_sandbox_utils_thumbnail_is_image (path) ||
+           st.st_size > SANDBOX_UTILS_THUMBNAIL_MAX_FILE)
+  {
+    g_set_error (&tmp_error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                 "SandboxUtilsThumbnail.Load: no thumbnail can be made for '%s'.\n", path);
+  }
+  else if ((pixbuf = _sandbox_utils_thumbnail_decode (path, bucket, cancellable, &tmp_error)) != NULL)
+  {
+    // Thumbnails of thumbnails are not cached, as the specification asks
+    if (!g_str_has_prefix (path, _cache_dir))
+      _sandbox_utils_thumbnail_write_cached (pixbuf, cache_path, uri, &st);
+
+    g_mutex_lock (&_lock);
+    _stats.decoded++;
+    g_mutex_unlock (&_lock);
+  }
+
+  if (pixbuf)
+    _sandbox_utils_thumbnail_cache_insert (key, pixbuf);
+  else if (!g_error_matches (tmp_error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+  {
+    g_mutex_lock (&_lock);
+    _stats.failures++;
+    g_mutex_unlock (&_lock);
+  }
+
+  if (tmp_error)
+    g_propagate_error (error, tmp_error);
+
+  g_free (cache_path);
+  g_free (uri);
+  g_free (key);
+
+  return pixbuf ? _sandbox_utils_thumbnail_fit (pixbuf, size) : NULL;
+}
+
+static void
+_sandbox_utils_thumbnail_job_free (SandboxUtilsThumbnailJob *job)
+{
+  if (job->thumbnail)
+    g_object_unref (job->thumbnail);
+  if (job->cancellable)
+    g_object_unref (job->cancellable);
+  g_free (job->path);
+  g_free (job);
+}
+
+static gboolean
+_sandbox_utils_thumbnail_deliver (gpointer data)
+{
+  SandboxUtilsThumbnailJob *job = data;
+
+  // Requesters cancel on the main loop too, so this cannot race
+  if (!g_cancellable_is_cancelled (job->cancellable))
+    job->func (job->thumbnail, job->user_data);
+
+  _sandbox_utils_thumbnail_job_free (job);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+_sandbox_utils_thumbnail_work (gpointer data,
+                               gpointer pool_data)
+{
+  SandboxUtilsThumbnailJob *job = data;
+
+  // The user moved on before this request's turn came
+  if (g_cancellable_is_cancelled (job->cancellable))
+  {
+    g_mutex_lock (&_lock);
+    _stats.dropped++;
+    g_mutex_unlock (&_lock);
+  }
+  else
+    job->thumbnail = sandbox_utils_thumbnail_load (job->path, job->size, job->cancellable, NULL);
+
+  g_idle_add (_sandbox_utils_thumbnail_deliver, job);
+}
+
+static gint
+_sandbox_utils_thumbnail_compare_jobs (gconstpointer a,
+                                       gconstpointer b,
+                                       gpointer      user_data)
+{
+  const SandboxUtilsThumbnailJob *job_a = a;
+  const SandboxUtilsThumbnailJob *job_b = b;
+
+  return job_b->order - job_a->order;
+}
+
+/*
+ * Makes a thumbnail of @path on a thread, and calls @func with it on the main
+ * loop. @func is not called if @cancellable gets cancelled first, which must
+ * be done from the main loop. Requests made last are served first.
+ */
+void
+sandbox_utils_thumbnail_request (const gchar               *path,
+                                 gint                       size,
+                                 GCancellable              *cancellable,
+                                 SandboxUtilsThumbnailFunc  func,
+                                 gpointer                   user_data)
+{
+  SandboxUtilsThumbnailJob *job;
+
+  g_return_if_fail (path != NULL);
+  g_return_if_fail (func != NULL);
+  g_return_if_fail (_pool != NULL);
+
+  job = g_malloc0 (sizeof (SandboxUtilsThumbnailJob));
+  job->path        = g_strdup (path);
+  job->size        = size;
+  job->order       = ++_order;
+  job->cancellable = cancellable ? g_object_ref (cancellable) : g_cancellable_new ();
+  job->func        = func;
+  job->user_data   = user_data;
+
+  g_thread_pool_push (_pool, job, NULL);
+}
+
+/* Copies the thumbnails of @pack into a memfd, sealed once written */
+static gint
+_sandbox_utils_thumbnail_pack_write (SandboxUtilsThumbnailPack  *pack,
+                                     GVariant                  **metadata,
+                                     GError                    **error)
+{
+  GVariantBuilder  builder;
+  cairo_surface_t *surface;
+  cairo_t         *cr;
+  GdkPixbuf       *pixbuf;
+  guchar          *data;
+  gsize           *offsets;
+  gsize            size = 0;
+  gint             width, height, stride;
+  gint             fd;
+  guint            i;
+
+  offsets = g_newa (gsize, pack->n_uris);
+  for (i = 0; i < pack->n_uris; i++)
+  {
+    offsets[i] = size;
+    if ((pixbuf = pack->thumbnails[i]) != NULL)
+    {
+      stride = cairo_format_stride_for_width (CAIRO_FORMAT_ARGB32, gdk_pixbuf_get_width (pixbuf));
+      size  += (stride * gdk_pixbuf_get_height (pixbuf) + SANDBOX_UTILS_THUMBNAIL_PACK_ALIGN - 1) &
+               ~(SANDBOX_UTILS_THUMBNAIL_PACK_ALIGN - 1);
+    }
+  }
+
+  // Even with no thumbnail at all, so that clients always get a descriptor
+  if ((fd = _sandboxutils_shm_new ("sandboxutils-thumbnails", MAX (size, 1), error)) == -1)
+    return -1;
+
+  data = mmap (NULL, MAX (size, 1), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (data == MAP_FAILED)
+  {
+    int saved = errno;
+
+    g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved),
+                 "SandboxUtilsThumbnail.Pack: could not map the thumbnails (%s).\n",
+                 g_strerror (saved));
+    close (fd);
+    return -1;
+  }
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(stiii)"));
+
+  for (i = 0; i < pack->n_uris; i++)
+  {
+    width = height = stride = 0;
+
+    if ((pixbuf = pack->thumbnails[i]) != NULL)
+    {
+      width   = gdk_pixbuf_get_width (pixbuf);
+      height  = gdk_pixbuf_get_height (pixbuf);
+      stride  = cairo_format_stride_for_width (CAIRO_FORMAT_ARGB32, width);
+
+      // Premultiplied and in native byte order, as cairo wants it on the other side
+      surface = cairo_image_surface_create_for_data (data + offsets[i], CAIRO_FORMAT_ARGB32,
+                                                     width, height, stride);
+      cr = cairo_create (surface);
+      gdk_cairo_set_source_pixbuf (cr, pixbuf, 0, 0);
+      cairo_paint (cr);
+      cairo_destroy (cr);
+      cairo_surface_finish (surface);
+      cairo_surface_destroy (surface);
+    }
+
+    g_variant_builder_add (&builder, "(stiii)", pack->uris[i], (guint64) offsets[i],
+                           width, height, stride);
+  }
+
+  munmap (data, MAX (size, 1));
+
+  // Nothing can change the thumbnails once the client has them
+  if (!_sandboxutils_shm_seal (fd, TRUE, error))
+  {
+    g_variant_builder_clear (&builder);
+    close (fd);
+    return -1;
+  }
+
+  *metadata = g_variant_builder_end (&builder);
+
+  return fd;
+}
+
+static void
+_sandbox_utils_thumbnail_pack_finish (SandboxUtilsThumbnailPack *pack)
+{
+  GVariant *metadata = NULL;
+  GError   *error    = NULL;
+  gint      fd;
+  guint     i;
+
+  fd = _sandbox_utils_thumbnail_pack_write (pack, &metadata, &error);
+  pack->func (metadata, fd, error, pack->user_data);
+
+  for (i = 0; i < pack->n_uris; i++)
+    if (pack->thumbnails[i])
+      g_object_unref (pack->thumbnails[i]);
+
+  g_free (pack->thumbnails);
+  g_strfreev (pack->uris);
+  g_free (pack);
+}
+
+static void
+_sandbox_utils_thumbnail_on_packed (GdkPixbuf *thumbnail,
+                                    gpointer   user_data)
+{
+  SandboxUtilsThumbnailSlot *slot = user_data;
+  SandboxUtilsThumbnailPack *pack = slot->pack;
+
+  if (thumbnail)
+    pack->thumbnails[slot->index] = g_object_ref (thumbnail);
+  g_free (slot);
+
+  if (--pack->pending == 0)
+    _sandbox_utils_thumbnail_pack_finish (pack);
+}
+
+/*
+ * Makes thumbnails of the files at @uris that fit in @size, in parallel, and
+ * calls @func on the main loop with all of them packed into one memfd. The
+ * a(stiii) metadata gives the URI, offset, width, height and stride of each
+ * ARGB32 thumbnail, files without one having a width of 0.
+ */
+void
+sandbox_utils_thumbnail_pack (const gchar * const           *uris,
+                              gint                           size,
+                              SandboxUtilsThumbnailPackFunc  func,
+                              gpointer                       user_data)
+{
+  SandboxUtilsThumbnailPack *pack;
+  SandboxUtilsThumbnailSlot *slot;
+  gchar                     *path;
+  guint                      i;
+
+  g_return_if_fail (uris != NULL);
+  g_return_if_fail (func != NULL);
+
+  pack = g_malloc0 (sizeof (SandboxUtilsThumbnailPack));
+  pack->uris       = g_strdupv ((gchar **) uris);
+  pack->n_uris     = g_strv_length (pack->uris);
+  pack->thumbnails = g_new0 (GdkPixbuf *, MAX (pack->n_uris, 1));
+  pack->func       = func;
+  pack->user_data  = user_data;
+
+  // Held until every request is made, so that the pack is not finished early
+  pack->pending = 1;
+
+  for (i = 0; _pool && i < pack->n_uris; i++)
+  {
+    if ((path = g_filename_from_uri (pack->uris[i], NULL, NULL)) == NULL)
+      continue;
+
+    slot = g_malloc (sizeof (SandboxUtilsThumbnailSlot));
+    slot->pack  = pack;
+    slot->index = i;
+
+    pack->pending++;
+    sandbox_utils_thumbnail_request (path, size, NULL, _sandbox_utils_thumbnail_on_packed, slot);
+    g_free (path);
+  }
+
+  if (--pack->pending == 0)
+    _sandbox_utils_thumbnail_pack_finish (pack);
+}
+
+void
+sandbox_utils_thumbnail_start ()
+{
+  GSList  *formats, *l;
+  gchar  **mime_types;
+  guint    i;
+
+  if (_option_disabled || _pool)
+    return;
+
+  _entries    = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, _sandbox_utils_thumbnail_entry_free);
+  _mime_types = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  _cache_dir  = g_build_filename (g_get_user_cache_dir (), "thumbnails", NULL);
+
+  formats = gdk_pixbuf_get_formats ();
+  for (l = formats; l; l = l->next)
+  {
+    if (gdk_pixbuf_format_is_disabled (l->data))
+      continue;
+
+    mime_types = gdk_pixbuf_format_get_mime_types (l->data);
+    for (i = 0; mime_types && mime_types[i]; i++)
+      g_hash_table_add (_mime_types, g_strdup (mime_types[i]));
+    g_strfreev (mime_types);
+  }
+  g_slist_free (formats);
+
+  _pool = g_thread_pool_new (_sandbox_utils_thumbnail_work, NULL,
+                             CLAMP (_option_threads, 1, 16), FALSE, NULL);
+  g_thread_pool_set_sort_function (_pool, _sandbox_utils_thumbnail_compare_jobs, NULL);
+
+  syslog (LOG_DEBUG, "SandboxUtilsThumbnail.Start: %u image types can be thumbnailed.\n",
+          g_hash_table_size (_mime_types));
+}
+
+void
+sandbox_utils_thumbnail_stop ()
+{
+  if (!_pool)
+    return;
+
+  // Requests still queued are dropped, the one being decoded is waited for
+  g_thread_pool_free (_pool, TRUE, TRUE);
+  _pool = NULL;
+
+  sandbox_utils_thumbnail_shrink (NULL);
+
+  if (_stats.hits || _stats.disk_hits || _stats.decoded)
+    syslog (LOG_INFO,
+            "SandboxUtilsThumbnail.Stop: %" G_GUINT64_FORMAT " hits, %" G_GUINT64_FORMAT " read from the thumbnail cache and %" G_GUINT64_FORMAT " decoded, %" G_GUINT64_FORMAT " stale requests dropped.\n",
+            _stats.hits, _stats.disk_hits, _stats.decoded, _stats.dropped);
+
+  g_hash_table_unref (_entries);
+  g_hash_table_unref (_mime_types);
+  g_free (_cache_dir);
+  _entries    = NULL;
+  _mime_types = NULL;
+  _cache_dir  = NULL;
+}
+
+/*
+ * Shrinker for sandbox_utils_memory_add_shrinker(). Forgets all thumbnails,
+ * the thumbnail cache on disk still has them.
+ */
+guint
+sandbox_utils_thumbnail_shrink (gpointer data)
+{
+  guint released = 0;
+
+  if (!_entries)
+    return 0;
+
+  g_mutex_lock (&_lock);
+  while (_lru.length)
+  {
+    _sandbox_utils_thumbnail_evict ();
+    released++;
+  }
+  g_mutex_unlock (&_lock);
+
+  return released;
+}
+
+void
+sandbox_utils_thumbnail_get_stats (SandboxUtilsThumbnailStats *stats)
+{
+  g_return_if_fail (stats != NULL);
+
+  g_mutex_lock (&_lock);
+  *stats = _stats;
+  g_mutex_unlock (&_lock);
+}
@@ -0,0 +1,96 @@
+/* SandboxUtils -- Sandbox Utilities Thumbnails
+ * Copyright (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>, 2014
+ *
+ * Under GPLv3
+ *
+ ***
+ *
+ * Makes thumbnails of images for all dialogs and clients of the server.
+ * Images are decoded and downscaled by a pool of threads, so that the main
+ * loop never waits on a large photo. Requests wait in a queue, the most
+ * recent first, and those cancelled before a thread picks them up are
+ * dropped without being decoded. Decoding stops as soon as its request is
+ * cancelled, e.g. because the user highlighted another file.
+ *
+ * Thumbnails are kept in memory, the least recently used being forgotten
+ * first beyond a budget, and identified by the inode, modification time and
+ * size of their file so that a changed file is never shown stale. Below that
+ * sits the freedesktop.org thumbnail cache (~/.cache/thumbnails), which is
+ * read before decoding anything and written to afterwards, and shared with
+ * file managers.
+ *
+ * Thumbnails can also be packed into a sealed memfd for clients to map, so
+ * that they need not read and decode images through their sandbox.
+ *
+ */
+#ifndef _SANDBOX_UTILS_THUMBNAIL_H
+#define _SANDBOX_UTILS_THUMBNAIL_H
+
+#include <gio/gio.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+/* Sizes of the freedesktop.org thumbnail cache, thumbnails fit in a square */
+#define SANDBOX_UTILS_THUMBNAIL_NORMAL 128
+#define SANDBOX_UTILS_THUMBNAIL_LARGE  256
+
+/* Called on the main loop with the thumbnail, or NULL if there is none */
+typedef void (*SandboxUtilsThumbnailFunc) (GdkPixbuf *thumbnail,
+                                           gpointer   user_data);
+
+/* Called on the main loop with the thumbnails of a pack, or with an error
+ * to free. @fd is a sealed memfd for the callee to close. */
+typedef void (*SandboxUtilsThumbnailPackFunc) (GVariant  *metadata,
+                                               gint       fd,
+                                               GError    *error,
+                                               gpointer   user_data);
+
+/* How well thumbnails are served, since the server started */
+typedef struct {
+  guint64                hits;          /* found in memory */
+  guint64                disk_hits;     /* found in the thumbnail cache */
+  guint64                decoded;       /* made from their image */
+  guint64                failures;      /* files with no thumbnail */
+  guint64                dropped;       /* requests cancelled before decoding */
+  guint64                evictions;     /* thumbnails forgotten for lack of room */
+  guint                  entries;       /* thumbnails currently in memory */
+  gint64                 bytes;         /* memory used by them */
+} SandboxUtilsThumbnailStats;
+
+GOptionGroup *
+sandbox_utils_thumbnail_get_option_group ();
+
+gboolean
+sandbox_utils_thumbnail_get_enabled ();
+
+void
+sandbox_utils_thumbnail_start ();
+
+void
+sandbox_utils_thumbnail_stop ();
+
+GdkPixbuf *
+sandbox_utils_thumbnail_load (const gchar   *path,
+                              gint           size,
+                              GCancellable  *cancellable,
+                              GError       **error);
+
+void
+sandbox_utils_thumbnail_request (const gchar               *path,
+                                 gint                       size,
+                                 GCancellable              *cancellable,
+                                 SandboxUtilsThumbnailFunc  func,
+                                 gpointer                   user_data);
+
+void
+sandbox_utils_thumbnail_pack (const gchar * const           *uris,
+                              gint                           size,
+                              SandboxUtilsThumbnailPackFunc  func,
+                              gpointer                       user_data);
+
+guint
+sandbox_utils_thumbnail_shrink (gpointer data);
+
+void
+sandbox_utils_thumbnail_get_stats (SandboxUtilsThumbnailStats *stats);
+
+#endif /* #ifndef _SANDBOX_UTILS_THUMBNAIL_H */
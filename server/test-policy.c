@@ -0,0 +1,151 @@
+/* SandboxUtils -- Selection Policy Tests
+ * Copyright (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>, 2014
+ *
+ * Under GPLv3
+ *
+ ***
+ *
+ * Checks which chosen files the selection policy lets through, in a
+ * temporary home folder.
+ *
+ */
+// Tests check every assertion, whatever the build flags
+#undef G_DISABLE_ASSERT
+
+#include <string.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+
+#include "sandboxutilspolicy.h"
+
+static gchar *_home   = NULL;
+static gchar *_policy = NULL;
+
+static gboolean
+_test_policy_validate (const gchar  *rules,
+                       gchar       **message,
+                       ...) G_GNUC_NULL_TERMINATED;
+
+/* Compiles @rules as the policy, then checks the paths after @message, in the home */
+static gboolean
+_test_policy_validate (const gchar  *rules,
+                       gchar       **message,
+                       ...)
+{
+  GSList      *filenames = NULL;
+  const gchar *path;
+  gboolean     valid;
+  va_list      args;
+
+  g_assert (g_file_set_contents (_policy, rules, -1, NULL));
+  sandbox_utils_policy_start ();
+
+  va_start (args, message);
+  while ((path = va_arg (args, const gchar *)) != NULL)
+    filenames = g_slist_append (filenames, g_build_filename (_home, path, NULL));
+  va_end (args);
+
+  valid = sandbox_utils_policy_validate (NULL, filenames, message, NULL);
+
+  sandbox_utils_policy_stop ();
+  g_slist_free_full (filenames, g_free);
+
+  return valid;
+}
+
+static void
+test_hard_link_allowed (void)
+{
+  gchar *message = NULL;
+
+  g_assert (_test_policy_validate ("allow /\ndeny ~/.ssh\n", &message,
+                                   "notes.txt", "notes-link.txt", NULL));
+  g_assert (message == NULL);
+}
+
+static void
+test_hard_link_refused (void)
+{
+  gchar *message = NULL;
+
+  g_assert (!_test_policy_validate ("allow /\nrefuse-hard-links\n", &message,
+                                    "notes-link.txt", NULL));
+  g_assert (message != NULL && strstr (message, "other names") != NULL);
+  g_free (message);
+}
+
+static void
+test_denied_folder (void)
+{
+  gchar *message = NULL;
+
+  g_assert (!_test_policy_validate ("allow /\ndeny ~/.ssh\n", &message,
+                                    ".ssh/id_rsa", NULL));
+  g_assert (message != NULL);
+  g_free (message);
+
+  g_assert (_test_policy_validate ("allow /\ndeny ~/.ssh\nallow ~/.ssh/id_rsa\n", NULL,
+                                   ".ssh/id_rsa", NULL));
+}
+
+int
+main (int argc, char **argv)
+{
+  GOptionContext *context;
+  gchar          *notes, *linked, *ssh, *key, *option;
+  gchar          *args[3];
+  gchar         **parsed = args;
+  gint            n_args = 2;
+  int             status;
+
+  g_test_init (&argc, &argv, NULL);
+
+  // The policy expands ~ with the home folder, so it must be set first
+  _home = g_dir_make_tmp ("sandboxutils-test-policy-XXXXXX", NULL);
+  g_assert (_home != NULL);
+  g_setenv ("HOME", _home, TRUE);
+
+  _policy = g_build_filename (_home, "policy", NULL);
+  notes   = g_build_filename (_home, "notes.txt", NULL);
+  linked  = g_build_filename (_home, "notes-link.txt", NULL);
+  ssh     = g_build_filename (_home, ".ssh", NULL);
+  key     = g_build_filename (ssh, "id_rsa", NULL);
+
+  g_assert (g_file_set_contents (notes, "notes", -1, NULL));
+  g_assert (link (notes, linked) == 0);
+  g_assert (g_mkdir (ssh, 0700) == 0);
+  g_assert (g_file_set_contents (key, "key", -1, NULL));
+
+  option  = g_strconcat ("--policy-file=", _policy, NULL);
+  args[0] = argv[0];
+  args[1] = option;
+  args[2] = NULL;
+
+  context = g_option_context_new (NULL);
+  g_option_context_add_group (context, sandbox_utils_policy_get_option_group ());
+  g_assert (g_option_context_parse (context, &n_args, &parsed, NULL));
+  g_option_context_free (context);
+
+  g_test_add_func ("/policy/hard-link-allowed", test_hard_link_allowed);
+  g_test_add_func ("/policy/hard-link-refused", test_hard_link_refused);
+  g_test_add_func ("/policy/denied-folder", test_denied_folder);
+
+  status = g_test_run ();
+
+  g_unlink (key);
+  g_rmdir (ssh);
+  g_unlink (linked);
+  g_unlink (notes);
+  g_unlink (_policy);
+  g_rmdir (_home);
+
+  g_free (option);
+  g_free (key);
+  g_free (ssh);
+  g_free (linked);
+  g_free (notes);
+  g_free (_policy);
+  g_free (_home);
+
+  return status;
+}
@@ -0,0 +1,263 @@
+/* SandboxUtils -- Filename Completion Benchmark
+ * Copyright (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>, 2014
+ *
+ * Under GPLv3
+ *
+ ***
+ *
+ * Measures how long the server's completion engine takes to answer each
+ * keystroke. A synthetic index of made-up folders and files is built, then
+ * names picked from it are typed one character at a time, either in full
+ * (prefix matches) or with letters left out (fuzzy matches), both within
+ * their folder and across all folders.
+ *
+ * With --max-latency=MS, fails when the 99th percentile of any kind of query
+ * exceeds MS milliseconds.
+ *
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include <gio/gio.h>
+
+#include "sandboxutils.h"
+#include "sandboxutilscompletion.h"
+#include "sfcdbench.h"
+
+static gint      _option_entries     = 1000000;
+static gint      _option_folders     = 2000;
+static gint      _option_names       = 200;
+static gint      _option_results     = 10;
+static gdouble   _option_max_latency = 0;
+static gboolean  _option_json        = FALSE;
+
+static GOptionEntry entries[] =
+{
+  {
+    "entries", 'n', 0, G_OPTION_ARG_INT, &_option_entries,
+    "Number of files in the index (default: 1000000)", "N"
+  },
+  {
+    "folders", 'f', 0, G_OPTION_ARG_INT, &_option_folders,
+    "Number of folders the files are spread across (default: 2000)", "N"
+  },
+  {
+    "names", 'q', 0, G_OPTION_ARG_INT, &_option_names,
+    "Number of names typed for each kind of query (default: 200)", "N"
+  },
+  {
+    "results", 'r', 0, G_OPTION_ARG_INT, &_option_results,
+    "Number of completions asked for (default: 10)", "N"
+  },
+  {
+    "max-latency", 'm', 0, G_OPTION_ARG_DOUBLE, &_option_max_latency,
+    "Fail if the 99th percentile of a kind of query exceeds this many milliseconds", "MS"
+  },
+  {
+    "json", 'j', 0, G_OPTION_ARG_NONE, &_option_json,
+    "Print the report in JSON", NULL
+  },
+  {
+    NULL, ' ', 0, 0, NULL,
+    NULL, NULL
+  }
+};
+
+static const gchar *_words[] = {
+  "report", "invoice", "holiday", "draft", "Budget", "notes", "photo", "scan",
+  "letter", "thesis", "chapter", "figure", "meeting", "minutes", "contract",
+  "backup", "Project", "slides", "summary", "review", "paper", "data",
+  "results", "final", "old", "copy", "IMG", "DSC", "screenshot", "recipe",
+};
+
+static const gchar *_extensions[] = {
+  ".odt", ".pdf", ".jpg", ".png", ".txt", ".c", ".h", ".ods", ".tar.gz", "",
+};
+
+static gchar *
+_complbench_make_name (GRand *rand)
+{
+  return g_strdup_printf ("%s-%s %u%s",
+                          _words[g_rand_int_range (rand, 0, G_N_ELEMENTS (_words))],
+                          _words[g_rand_int_range (rand, 0, G_N_ELEMENTS (_words))],
+                          g_rand_int_range (rand, 0, 100000),
+                          _extensions[g_rand_int_range (rand, 0, G_N_ELEMENTS (_extensions))]);
+}
+
+/* Leaves out every third letter, as users do when typing fuzzy queries */
+static gchar *
+_complbench_make_fuzzy (const gchar *name)
+{
+  GString *fuzzy = g_string_new (NULL);
+  guint    i;
+
+  for (i = 0; name[i]; i++)
+    if (i % 3 != 1)
+      g_string_append_c (fuzzy, name[i]);
+
+  return g_string_free (fuzzy, FALSE);
+}
+
+/* Types @text one character at a time, timing each query */
+static void
+_complbench_type (GHashTable  *stats,
+                  const gchar *kind,
+                  const gchar *folder,
+                  const gchar *prefix,
+                  const gchar *text)
+{
+  GPtrArray *results;
+  gchar     *typed;
+  gint64     started;
+  gsize      len;
+
+  for (len = 1; len <= strlen (text); len++)
+  {
+    typed = g_strdup_printf ("%s%.*s", prefix, (gint) len, text);
+
+    started = g_get_monotonic_time ();
+    results = sandbox_utils_completion_query (folder, typed, _option_results);
+    sfcd_bench_stats_add (stats, kind, g_get_monotonic_time () - started, FALSE);
+
+    g_ptr_array_unref (results);
+    g_free (typed);
+  }
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext  *context;
+  GError          *error    = NULL;
+  GHashTable      *stats;
+  GHashTableIter   iter;
+  SfcdBenchStats  *kind;
+  GRand           *rand;
+  GPtrArray       *folders;
+  GPtrArray       *picked;
+  GString         *json;
+  gchar           *name;
+  gchar           *path;
+  gchar           *fuzzy;
+  gint64           started;
+  gint64           build_us;
+  gint64           p99;
+  gint64           now      = g_get_real_time () / G_USEC_PER_SEC;
+  gboolean         failed   = FALSE;
+  gint             i;
+
+  context = g_option_context_new ("- measure the latency of filename completion");
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+  {
+    g_printerr ("%s\n", _sandboxutils_error_get_message (error));
+    g_error_free (error);
+    g_option_context_free (context);
+    return EXIT_FAILURE;
+  }
+  g_option_context_free (context);
+
+  _option_folders = MAX (_option_folders, 1);
+  rand    = g_rand_new_with_seed (42);
+  folders = g_ptr_array_new_with_free_func (g_free);
+  picked  = g_ptr_array_new_with_free_func (g_free);
+
+  // Folders nested a few levels deep under a made-up home
+  for (i = 0; i < _option_folders; i++)
+  {
+    if (i < 10)
+      path = g_strdup_printf ("/home/user/%s", _words[i]);
+    else
+      path = g_strdup_printf ("%s/%s %d", (gchar *) g_ptr_array_index (folders, g_rand_int_range (rand, 0, i)),
+                              _words[g_rand_int_range (rand, 0, G_N_ELEMENTS (_words))], i);
+
+    g_ptr_array_add (folders, path);
+  }
+
+  started = g_get_monotonic_time ();
+
+  for (i = 0; i < _option_folders; i++)
+    sandbox_utils_completion_add (g_ptr_array_index (folders, i), G_FILE_TYPE_DIRECTORY, 0, now);
+
+  for (i = 0; i < _option_entries; i++)
+  {
+    name = _complbench_make_name (rand);
+    path = g_build_filename (g_ptr_array_index (folders, g_rand_int_range (rand, 0, _option_folders)), name, NULL);
+
+    sandbox_utils_completion_add (path, G_FILE_TYPE_REGULAR,
+                                  g_rand_int_range (rand, 0, 1 << 24),
+                                  now - g_rand_int_range (rand, 0, 365 * 24 * 3600));
+
+    if (picked->len < (guint) MAX (_option_names, 0))
+      g_ptr_array_add (picked, path);
+    else
+      g_free (path);
+
+    g_free (name);
+  }
+
+  build_us = g_get_monotonic_time () - started;
+  stats    = sfcd_bench_stats_table_new ();
+
+  for (i = 0; i < (gint) picked->len; i++)
+  {
+    path  = g_path_get_dirname (g_ptr_array_index (picked, i));
+    name  = g_path_get_basename (g_ptr_array_index (picked, i));
+    fuzzy = _complbench_make_fuzzy (name);
+
+    _complbench_type (stats, "folder-prefix", path, "", name);
+    _complbench_type (stats, "folder-fuzzy", path, "", fuzzy);
+    _complbench_type (stats, "absolute-path", NULL, path, G_DIR_SEPARATOR_S);
+    _complbench_type (stats, "global-prefix", NULL, "", name);
+    _complbench_type (stats, "global-fuzzy", NULL, "", fuzzy);
+
+    g_free (fuzzy);
+    g_free (name);
+    g_free (path);
+  }
+
+  if (_option_json)
+  {
+    json = g_string_new (NULL);
+    g_string_append_printf (json,
+                            "{\"tool\": \"sfcd-complbench\", \"version\": \"%s\", "
+                            "\"entries\": %u, \"folders\": %d, \"build_us\": %" G_GINT64_FORMAT ", "
+                            "\"methods\": ",
+                            SANDBOXUTILS_VERSION,
+                            sandbox_utils_completion_get_size (), _option_folders, build_us);
+    sfcd_bench_stats_append_json (stats, json);
+    g_string_append (json, "}\n");
+    fputs (json->str, stdout);
+    g_string_free (json, TRUE);
+  }
+  else
+  {
+    printf ("Indexed %u files in %d folders in %.3f s, per keystroke latencies:\n\n",
+            sandbox_utils_completion_get_size (), _option_folders,
+            build_us / (gdouble) G_TIME_SPAN_SECOND);
+    sfcd_bench_stats_print (stats, stdout);
+  }
+
+  if (_option_max_latency > 0)
+  {
+    g_hash_table_iter_init (&iter, stats);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &kind))
+    {
+      p99 = sfcd_bench_stats_percentile (kind, 99);
+      if (p99 > _option_max_latency * 1000)
+      {
+        g_printerr ("%s: 99th percentile is %.3f ms, above %.3f ms\n",
+                    kind->name, p99 / 1000.0, _option_max_latency);
+        failed = TRUE;
+      }
+    }
+  }
+
+  g_hash_table_unref (stats);
+  g_ptr_array_unref (picked);
+  g_ptr_array_unref (folders);
+  g_rand_free (rand);
+  sandbox_utils_completion_clear ();
+
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,748 @@
+/* SandboxUtils -- Load Generator
+ * Copyright (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>, 2014
+ *
+ * Under GPLv3
+ *
+ ***
+ *
+ * Simulates many sandboxed clients using the server at the same time, to
+ * measure its throughput and how it behaves under contention. Each client is
+ * a separate worker process (RemoteFileChooserDialog shares one connection
+ * per process) that goes through the life of dialogs with the real client
+ * library: New, a mix of configuration calls, optionally Run, a mix of
+ * retrieval calls and Destroy.
+ *
+ * Dialogs can only be run against a server that answers them by itself, see
+ * sandboxutilsd --scripted.
+ *
+ * With --flooders, the clients run once alone and once more while other
+ * clients keep the server busy with calls, to check that the scheduler still
+ * serves everyone in turn.
+ *
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <gio/gio.h>
+
+#include "sandboxutils.h"
+#include "sfcdbench.h"
+
+#define SFCD_LOADGEN_RUN_TIMEOUT (30 * G_TIME_SPAN_SECOND)
+
+static gint      _option_clients     = 4;
+static gint      _option_iterations  = 100;
+static gint      _option_configure   = 4;
+static gint      _option_retrieve    = 4;
+static gdouble   _option_run_ratio   = 0.0;
+static gboolean  _option_private_bus = FALSE;
+static gchar    *_option_daemon      = NULL;
+static gboolean  _option_json        = FALSE;
+static gint      _option_flooders    = 0;
+static gint      _option_flood_depth = 64;
+static gdouble   _option_slowdown    = 0.0;
+static gint      _option_worker      = -1;
+static gboolean  _option_flooder     = FALSE;
+
+static GOptionEntry entries[] =
+{
+  {
+    "clients", 'c', 0, G_OPTION_ARG_INT, &_option_clients,
+    "Number of simulated clients, each with its own connection (default: 4)", "N"
+  },
+  {
+    "iterations", 'i', 0, G_OPTION_ARG_INT, &_option_iterations,
+    "Number of dialogs each client goes through (default: 100)", "N"
+  },
+  {
+    "configure-calls", 0, 0, G_OPTION_ARG_INT, &_option_configure,
+    "Configuration calls made on each dialog (default: 4)", "N"
+  },
+  {
+    "retrieval-calls", 0, 0, G_OPTION_ARG_INT, &_option_retrieve,
+    "Retrieval calls made on each dialog (default: 4)", "N"
+  },
+  {
+    "run-ratio", 'r', 0, G_OPTION_ARG_DOUBLE, &_option_run_ratio,
+    "Fraction of dialogs that get run, needs a scripted server (default: 0)", "F"
+  },
+  {
+    "private-bus", 'p', 0, G_OPTION_ARG_NONE, &_option_private_bus,
+    "Run on a private bus with its own server instead of the session bus", NULL
+  },
+  {
+    "daemon", 'd', 0, G_OPTION_ARG_STRING, &_option_daemon,
+    "Command line of the server to start on the private bus (default: sandboxutilsd --scripted without limits)", "CMD"
+  },
+  {
+    "json", 'j', 0, G_OPTION_ARG_NONE, &_option_json,
+    "Print the report in JSON", NULL
+  },
+  {
+    "flooders", 'f', 0, G_OPTION_ARG_INT, &_option_flooders,
+    "Clients flooding the server with calls during a second run of the others (default: 0)", "N"
+  },
+  {
+    "flood-depth", 0, 0, G_OPTION_ARG_INT, &_option_flood_depth,
+    "Calls each flooding client keeps waiting for an answer (default: 64)", "N"
+  },
+  {
+    "max-slowdown", 0, 0, G_OPTION_ARG_DOUBLE, &_option_slowdown,
+    "Fail if flooding makes a method of the other clients this many times slower at the median", "F"
+  },
+  {
+    "worker", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_INT, &_option_worker,
+    "Run as the given simulated client and write samples to stdout", "N"
+  },
+  {
+    "flooder", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_NONE, &_option_flooder,
+    "Run as a flooding client until killed", NULL
+  },
+  {
+    NULL, ' ', 0, 0, NULL,
+    NULL, NULL
+  }
+};
+
+/* Calls a worker makes, in the order given by the mix */
+typedef enum {
+  LOADGEN_SET_LOCAL_ONLY,
+  LOADGEN_SET_SELECT_MULTIPLE,
+  LOADGEN_SET_SHOW_HIDDEN,
+  LOADGEN_SET_CURRENT_FOLDER,
+  LOADGEN_CONFIGURE_LAST
+} LoadgenConfigureCall;
+
+typedef enum {
+  LOADGEN_GET_ACTION,
+  LOADGEN_GET_LOCAL_ONLY,
+  LOADGEN_GET_SELECT_MULTIPLE,
+  LOADGEN_GET_CURRENT_FOLDER,
+  LOADGEN_RETRIEVE_LAST
+} LoadgenRetrieveCall;
+
+static const gchar *LoadgenConfigurePrintable[LOADGEN_CONFIGURE_LAST] =
+  {"SetLocalOnly", "SetSelectMultiple", "SetShowHidden", "SetCurrentFolder"};
+
+static const gchar *LoadgenRetrievePrintable[LOADGEN_RETRIEVE_LAST] =
+  {"GetAction", "GetLocalOnly", "GetSelectMultiple", "GetCurrentFolder"};
+
+static GString *_samples = NULL;
+
+/* A run waiting for the server to answer it */
+typedef struct {
+  GMainLoop *loop;
+  gboolean   responded;
+} LoadgenRun;
+
+/* A dialog whose client sends a new call as soon as one is answered */
+typedef struct {
+  GDBusConnection *connection;
+  const gchar     *id;
+} LoadgenFlood;
+
+static void
+_loadgen_sample (const gchar *method,
+                 gint64       started,
+                 GError     **error)
+{
+  g_string_append_printf (_samples, "%s\t%" G_GINT64_FORMAT "\t%d\n",
+                          method, g_get_monotonic_time () - started, *error != NULL);
+  g_clear_error (error);
+}
+
+static void
+_loadgen_on_response (SandboxFileChooserDialog *sfcd,
+                      gint                      response_id,
+                      gint                      state,
+                      gpointer                  user_data)
+{
+  LoadgenRun *run = user_data;
+
+  run->responded = TRUE;
+  g_main_loop_quit (run->loop);
+}
+
+static gboolean
+_loadgen_on_run_timeout (gpointer user_data)
+{
+  LoadgenRun *run = user_data;
+
+  g_main_loop_quit (run->loop);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+_loadgen_configure (SandboxFileChooserDialog  *sfcd,
+                    guint                      call,
+                    GError                   **error)
+{
+  switch (call)
+  {
+    case LOADGEN_SET_LOCAL_ONLY:
+      sfcd_set_local_only (sfcd, TRUE, error);
+      break;
+    case LOADGEN_SET_SELECT_MULTIPLE:
+      sfcd_set_select_multiple (sfcd, TRUE, error);
+      break;
+    case LOADGEN_SET_SHOW_HIDDEN:
+      sfcd_set_show_hidden (sfcd, FALSE, error);
+      break;
+    case LOADGEN_SET_CURRENT_FOLDER:
+      sfcd_set_current_folder (sfcd, g_get_tmp_dir (), error);
+      break;
+  }
+}
+
+static void
+_loadgen_retrieve (SandboxFileChooserDialog  *sfcd,
+                   guint                      call,
+                   GError                   **error)
+{
+  switch (call)
+  {
+    case LOADGEN_GET_ACTION:
+      sfcd_get_action (sfcd, error);
+      break;
+    case LOADGEN_GET_LOCAL_ONLY:
+      sfcd_get_local_only (sfcd, error);
+      break;
+    case LOADGEN_GET_SELECT_MULTIPLE:
+      sfcd_get_select_multiple (sfcd, error);
+      break;
+    case LOADGEN_GET_CURRENT_FOLDER:
+      g_free (sfcd_get_current_folder (sfcd, error));
+      break;
+  }
+}
+
+/* Runs the dialog and waits for the server to answer it */
+static void
+_loadgen_run (SandboxFileChooserDialog  *sfcd,
+              GError                   **error)
+{
+  LoadgenRun run     = {g_main_loop_new (NULL, FALSE), FALSE};
+  gboolean   failed;
+  gint64     started;
+  gulong     handler;
+  guint      timeout;
+
+  handler = g_signal_connect (sfcd, "response", G_CALLBACK (_loadgen_on_response), &run);
+
+  started = g_get_monotonic_time ();
+  sfcd_run (sfcd, error);
+  failed = (*error != NULL);
+  _loadgen_sample ("Run", started, error);
+
+  if (!failed)
+  {
+    timeout = g_timeout_add_seconds (SFCD_LOADGEN_RUN_TIMEOUT / G_TIME_SPAN_SECOND,
+                                     _loadgen_on_run_timeout, &run);
+    g_main_loop_run (run.loop);
+    if (run.responded)
+      g_source_remove (timeout);
+
+    // Includes the think time of the scripted server
+    g_string_append_printf (_samples, "RunToResponse\t%" G_GINT64_FORMAT "\t%d\n",
+                            g_get_monotonic_time () - started, !run.responded);
+  }
+
+  g_signal_handler_disconnect (sfcd, handler);
+  g_main_loop_unref (run.loop);
+}
+
+static int
+_loadgen_worker (gint worker)
+{
+  SandboxFileChooserDialog *sfcd;
+  GError                   *error = NULL;
+  GRand                    *rand  = g_rand_new_with_seed (worker);
+  gint64                    started;
+  gint64                    began = g_get_monotonic_time ();
+  gint                      iteration;
+  gint                      call;
+
+  sandboxutils_set_sandboxed (TRUE);
+  _samples = g_string_new (NULL);
+
+  for (iteration = 0; iteration < _option_iterations; iteration++)
+  {
+    started = g_get_monotonic_time ();
+    sfcd = sfcd_new ("sfcd-loadgen", NULL, GTK_FILE_CHOOSER_ACTION_OPEN,
+                     "_Cancel", GTK_RESPONSE_CANCEL,
+                     "_Open", GTK_RESPONSE_ACCEPT,
+                     NULL);
+    g_string_append_printf (_samples, "New\t%" G_GINT64_FORMAT "\t%d\n",
+                            g_get_monotonic_time () - started, sfcd == NULL);
+    if (!sfcd)
+      continue;
+
+    for (call = 0; call < _option_configure; call++)
+    {
+      started = g_get_monotonic_time ();
+      _loadgen_configure (sfcd, call % LOADGEN_CONFIGURE_LAST, &error);
+      _loadgen_sample (LoadgenConfigurePrintable[call % LOADGEN_CONFIGURE_LAST], started, &error);
+    }
+
+    if (g_rand_double (rand) < _option_run_ratio)
+      _loadgen_run (sfcd, &error);
+
+    for (call = 0; call < _option_retrieve; call++)
+    {
+      started = g_get_monotonic_time ();
+      _loadgen_retrieve (sfcd, call % LOADGEN_RETRIEVE_LAST, &error);
+      _loadgen_sample (LoadgenRetrievePrintable[call % LOADGEN_RETRIEVE_LAST], started, &error);
+    }
+
+    started = g_get_monotonic_time ();
+    sfcd_destroy (sfcd);
+    g_string_append_printf (_samples, "Destroy\t%" G_GINT64_FORMAT "\t0\n",
+                            g_get_monotonic_time () - started);
+  }
+
+  g_string_append_printf (_samples, "elapsed\t%" G_GINT64_FORMAT "\t0\n",
+                          g_get_monotonic_time () - began);
+
+  // Only written once done, so that a slow reader cannot hold the worker back
+  fwrite (_samples->str, 1, _samples->len, stdout);
+  fflush (stdout);
+
+  g_string_free (_samples, TRUE);
+  g_rand_free (rand);
+
+  return EXIT_SUCCESS;
+}
+
+static void _loadgen_flood_send (LoadgenFlood *flood);
+
+static void
+_loadgen_flood_on_reply (GObject      *source,
+                         GAsyncResult *result,
+                         gpointer      user_data)
+{
+  GVariant *reply;
+
+  reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source), result, NULL);
+  if (reply)
+    g_variant_unref (reply);
+
+  _loadgen_flood_send (user_data);
+}
+
+static void
+_loadgen_flood_send (LoadgenFlood *flood)
+{
+  // Bypasses the client library, which would wait for each answer
+  g_dbus_connection_call (flood->connection,
+                          SFCD_IFACE,
+                          SANDBOXUTILS_PATH,
+                          SFCD_IFACE,
+                          "GetAction",
+                          g_variant_new ("(s)", flood->id),
+                          NULL,
+                          G_DBUS_CALL_FLAGS_NONE,
+                          -1,
+                          NULL,
+                          _loadgen_flood_on_reply,
+                          flood);
+}
+
+/*
+ * Keeps the server busy with calls on a dialog of its own, from the same
+ * connection as the dialog so that they come from a single sender, until
+ * killed. Writes a line once the flood is underway.
+ */
+static int
+_loadgen_flooder ()
+{
+  SandboxFileChooserDialog *sfcd;
+  LoadgenFlood              flood;
+  GMainLoop                *loop;
+  GError                   *error = NULL;
+  gint                      i;
+
+  sandboxutils_set_sandboxed (TRUE);
+
+  sfcd = sfcd_new ("sfcd-loadgen flooder", NULL, GTK_FILE_CHOOSER_ACTION_OPEN,
+                   "_Cancel", GTK_RESPONSE_CANCEL,
+                   "_Open", GTK_RESPONSE_ACCEPT,
+                   NULL);
+  flood.connection = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, &error);
+  if (!sfcd || !flood.connection)
+  {
+    g_printerr ("Could not start flooding: %s\n",
+                error ? _sandboxutils_error_get_message (error) : "no dialog");
+    g_clear_error (&error);
+    return EXIT_FAILURE;
+  }
+
+  flood.id = sfcd_get_id (sfcd);
+  for (i = 0; i < MAX (_option_flood_depth, 1); i++)
+    _loadgen_flood_send (&flood);
+
+  puts ("flooding");
+  fflush (stdout);
+
+  loop = g_main_loop_new (NULL, FALSE);
+  g_main_loop_run (loop);
+
+  return EXIT_SUCCESS;
+}
+
+/* Reads the samples of a worker into the stats, returns its running time */
+static gint64
+_loadgen_collect (gint         fd,
+                  GHashTable  *stats)
+{
+  GIOChannel  *channel = g_io_channel_unix_new (fd);
+  gchar       *line    = NULL;
+  gchar      **fields;
+  gint64       elapsed = 0;
+
+  while (g_io_channel_read_line (channel, &line, NULL, NULL, NULL) == G_IO_STATUS_NORMAL)
+  {
+    g_strchomp (line);
+    fields = g_strsplit (line, "\t", 3);
+
+    if (g_strv_length (fields) == 3)
+    {
+      if (g_strcmp0 (fields[0], "elapsed") == 0)
+        elapsed = g_ascii_strtoll (fields[1], NULL, 10);
+      else
+        sfcd_bench_stats_add (stats, fields[0],
+                              g_ascii_strtoll (fields[1], NULL, 10),
+                              g_strcmp0 (fields[2], "0") != 0);
+    }
+
+    g_strfreev (fields);
+    g_free (line);
+  }
+
+  g_io_channel_shutdown (channel, FALSE, NULL);
+  g_io_channel_unref (channel);
+
+  return elapsed;
+}
+
+static void
+_loadgen_count (gpointer key,
+                gpointer value,
+                gpointer user_data)
+{
+  SfcdBenchStats *stats  = value;
+  guint          *totals = user_data;
+
+  // Runs are counted once, as Run calls
+  if (g_strcmp0 (stats->name, "RunToResponse") == 0)
+    return;
+
+  totals[0] += stats->samples->len;
+  totals[1] += stats->errors;
+}
+
+/* Runs all simulated clients to completion, returns the slowest one's time */
+static gint64
+_loadgen_run_clients (gchar       **worker_argv,
+                      GHashTable   *stats)
+{
+  GError  *error   = NULL;
+  GPid    *workers = g_malloc0 (sizeof (GPid) * _option_clients);
+  gint    *outputs = g_malloc0 (sizeof (gint) * _option_clients);
+  gint64   slowest = 0;
+  gint     i;
+
+  for (i = 0; i < _option_clients; i++)
+  {
+    g_free (worker_argv[1]);
+    worker_argv[1] = g_strdup_printf ("--worker=%d", i);
+
+    if (!g_spawn_async_with_pipes (NULL, worker_argv, NULL,
+                                   G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_SEARCH_PATH,
+                                   NULL, NULL, &workers[i], NULL, &outputs[i], NULL, &error))
+    {
+      g_printerr ("Could not start client %d: %s\n", i, _sandboxutils_error_get_message (error));
+      g_clear_error (&error);
+      outputs[i] = -1;
+    }
+  }
+
+  for (i = 0; i < _option_clients; i++)
+  {
+    if (outputs[i] < 0)
+      continue;
+
+    slowest = MAX (slowest, _loadgen_collect (outputs[i], stats));
+    waitpid (workers[i], NULL, 0);
+    g_spawn_close_pid (workers[i]);
+  }
+
+  g_free (workers);
+  g_free (outputs);
+
+  return slowest;
+}
+
+static void _loadgen_stop_flooders (GPid *flooders);
+
+/*
+ * Starts the flooding clients and waits for all of them to be flooding.
+ * Returns %NULL if one of them could not start.
+ */
+static GPid *
+_loadgen_start_flooders (const gchar *self)
+{
+  GIOChannel  *channel;
+  GError      *error    = NULL;
+  GPid        *flooders = g_malloc0 (sizeof (GPid) * _option_flooders);
+  gchar       *line;
+  gchar       *flooder_argv[4];
+  gboolean     flooding = TRUE;
+  gint         output;
+  gint         i;
+
+  flooder_argv[0] = (gchar *) self;
+  flooder_argv[1] = "--flooder";
+  flooder_argv[2] = g_strdup_printf ("--flood-depth=%d", _option_flood_depth);
+  flooder_argv[3] = NULL;
+
+  for (i = 0; flooding && i < _option_flooders; i++)
+  {
+    if (!g_spawn_async_with_pipes (NULL, flooder_argv, NULL,
+                                   G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_SEARCH_PATH,
+                                   NULL, NULL, &flooders[i], NULL, &output, NULL, &error))
+    {
+      g_printerr ("Could not start flooder %d: %s\n", i, _sandboxutils_error_get_message (error));
+      g_clear_error (&error);
+      flooding = FALSE;
+      continue;
+    }
+
+    channel = g_io_channel_unix_new (output);
+    line = NULL;
+    if (g_io_channel_read_line (channel, &line, NULL, NULL, NULL) != G_IO_STATUS_NORMAL)
+    {
+      g_printerr ("Flooder %d did not start flooding\n", i);
+      flooding = FALSE;
+    }
+    g_free (line);
+    g_io_channel_shutdown (channel, FALSE, NULL);
+    g_io_channel_unref (channel);
+  }
+
+  g_free (flooder_argv[2]);
+
+  if (!flooding)
+  {
+    _loadgen_stop_flooders (flooders);
+    return NULL;
+  }
+
+  return flooders;
+}
+
+static void
+_loadgen_stop_flooders (GPid *flooders)
+{
+  gint i;
+
+  for (i = 0; i < _option_flooders; i++)
+  {
+    if (flooders[i] <= 0)
+      continue;
+
+    kill (flooders[i], SIGTERM);
+    waitpid (flooders[i], NULL, 0);
+    g_spawn_close_pid (flooders[i]);
+  }
+
+  g_free (flooders);
+}
+
+/*
+ * Returns how many times slower the median latency of the method that
+ * suffered most from flooding got, and its name in @method.
+ */
+static gdouble
+_loadgen_get_slowdown (GHashTable   *alone,
+                       GHashTable   *flooded,
+                       const gchar **method)
+{
+  GHashTableIter  iter;
+  SfcdBenchStats *before;
+  SfcdBenchStats *after;
+  gdouble         slowdown;
+  gdouble         worst   = 0.0;
+
+  g_hash_table_iter_init (&iter, alone);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &before))
+  {
+    // Includes the think time of the scripted server
+    if (g_strcmp0 (before->name, "RunToResponse") == 0)
+      continue;
+
+    after = g_hash_table_lookup (flooded, before->name);
+    if (!after || after->samples->len == 0 || before->samples->len == 0)
+      continue;
+
+    slowdown = sfcd_bench_stats_percentile (after, 50) /
+               (gdouble) MAX (sfcd_bench_stats_percentile (before, 50), 1);
+    if (slowdown > worst)
+    {
+      worst = slowdown;
+      *method = after->name;
+    }
+  }
+
+  return worst;
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext  *context;
+  GError          *error   = NULL;
+  GHashTable      *stats;
+  GHashTable      *alone   = NULL;
+  SfcdBenchBus     bus;
+  GPid            *flooders;
+  gchar          **worker_argv;
+  GString         *json;
+  const gchar     *method  = NULL;
+  gboolean         failed  = FALSE;
+  gdouble          slowdown = 0.0;
+  gint64           started;
+  gint64           elapsed;
+  gint64           slowest;
+  guint            totals[2] = {0, 0};
+
+  context = g_option_context_new ("- simulate many clients of sandboxutilsd");
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+  {
+    g_printerr ("%s\n", _sandboxutils_error_get_message (error));
+    g_error_free (error);
+    g_option_context_free (context);
+    return EXIT_FAILURE;
+  }
+  g_option_context_free (context);
+
+  if (_option_worker >= 0)
+    return _loadgen_worker (_option_worker);
+  if (_option_flooder)
+    return _loadgen_flooder ();
+
+  memset (&bus, 0, sizeof (SfcdBenchBus));
+  if (_option_private_bus &&
+      !sfcd_bench_bus_up (&bus, _option_daemon ? _option_daemon : "sandboxutilsd --scripted " SFCD_BENCH_NO_LIMITS, &error))
+  {
+    g_printerr ("Could not start a private bus: %s\n", _sandboxutils_error_get_message (error));
+    g_error_free (error);
+    return EXIT_FAILURE;
+  }
+
+  _option_clients = MAX (_option_clients, 1);
+  _option_flooders = MAX (_option_flooders, 0);
+
+  // Workers are fresh processes rather than forks, so each one gets its own
+  // bus connection and none inherits the state of the GDBus worker thread
+  worker_argv = g_malloc0 (sizeof (gchar *) * 9);
+  worker_argv[0] = g_strdup (argv[0]);
+  worker_argv[2] = g_strdup_printf ("--iterations=%d", _option_iterations);
+  worker_argv[3] = g_strdup_printf ("--configure-calls=%d", _option_configure);
+  worker_argv[4] = g_strdup_printf ("--retrieval-calls=%d", _option_retrieve);
+  worker_argv[5] = g_malloc0 (G_ASCII_DTOSTR_BUF_SIZE + 16);
+  strcpy (worker_argv[5], "--run-ratio=");
+  g_ascii_dtostr (worker_argv[5] + strlen ("--run-ratio="), G_ASCII_DTOSTR_BUF_SIZE, _option_run_ratio);
+
+  // The same clients run alone first, for their latencies to compare to
+  if (_option_flooders > 0)
+  {
+    alone = sfcd_bench_stats_table_new ();
+    _loadgen_run_clients (worker_argv, alone);
+  }
+
+  flooders = NULL;
+  if (_option_flooders > 0 && (flooders = _loadgen_start_flooders (argv[0])) == NULL)
+  {
+    g_hash_table_unref (alone);
+    g_strfreev (worker_argv);
+    sfcd_bench_bus_down (&bus);
+    return EXIT_FAILURE;
+  }
+
+  stats = sfcd_bench_stats_table_new ();
+  started = g_get_monotonic_time ();
+  slowest = _loadgen_run_clients (worker_argv, stats);
+  elapsed = MAX (g_get_monotonic_time () - started, 1);
+  g_hash_table_foreach (stats, _loadgen_count, totals);
+
+  if (flooders)
+  {
+    _loadgen_stop_flooders (flooders);
+    slowdown = _loadgen_get_slowdown (alone, stats, &method);
+  }
+
+  if (_option_json)
+  {
+    json = g_string_new (NULL);
+    g_string_append_printf (json,
+                            "{\"tool\": \"sfcd-loadgen\", \"version\": \"%s\", "
+                            "\"clients\": %d, \"iterations\": %d, \"configure_calls\": %d, "
+                            "\"retrieval_calls\": %d, \"run_ratio\": %.3f, "
+                            "\"elapsed_us\": %" G_GINT64_FORMAT ", \"slowest_client_us\": %" G_GINT64_FORMAT ", "
+                            "\"calls\": %u, \"errors\": %u, \"calls_per_second\": %.1f, \"methods\": ",
+                            SANDBOXUTILS_VERSION,
+                            _option_clients, _option_iterations, _option_configure,
+                            _option_retrieve, _option_run_ratio,
+                            elapsed, slowest,
+                            totals[0], totals[1], totals[0] * (gdouble) G_TIME_SPAN_SECOND / elapsed);
+    sfcd_bench_stats_append_json (stats, json);
+    if (alone)
+    {
+      g_string_append_printf (json, ", \"flooders\": %d, \"flood_depth\": %d, "
+                              "\"slowdown\": %.2f, \"slowest_method\": \"%s\", \"alone_methods\": ",
+                              _option_flooders, _option_flood_depth,
+                              slowdown, method ? method : "");
+      sfcd_bench_stats_append_json (alone, json);
+    }
+    g_string_append (json, "}\n");
+    fputs (json->str, stdout);
+    g_string_free (json, TRUE);
+  }
+  else
+  {
+    printf ("%d clients made %u calls in %.3f s: %.1f calls/s, %u errors (%.2f%%)\n\n",
+            _option_clients, totals[0], elapsed / (gdouble) G_TIME_SPAN_SECOND,
+            totals[0] * (gdouble) G_TIME_SPAN_SECOND / elapsed,
+            totals[1], totals[0] ? 100.0 * totals[1] / totals[0] : 0.0);
+    sfcd_bench_stats_print (stats, stdout);
+
+    if (alone)
+    {
+      printf ("\nThe same clients alone:\n\n");
+      sfcd_bench_stats_print (alone, stdout);
+      printf ("\nWith %d flooding clients, %s got %.2f times slower at the median\n",
+              _option_flooders, method ? method : "no method", slowdown);
+    }
+  }
+
+  if (_option_slowdown > 0 && slowdown > _option_slowdown)
+  {
+    g_printerr ("%s: %.2f times slower with %d flooding clients, above %.2f\n",
+                method, slowdown, _option_flooders, _option_slowdown);
+    failed = TRUE;
+  }
+
+  g_hash_table_unref (stats);
+  if (alone)
+    g_hash_table_unref (alone);
+  g_strfreev (worker_argv);
+
+  sfcd_bench_bus_down (&bus);
+
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
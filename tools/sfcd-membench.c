@@ -0,0 +1,572 @@
+/* SandboxUtils -- Memory Footprint Benchmark
+ * Copyright (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>, 2014
+ *
+ * Under GPLv3
+ *
+ ***
+ *
+ * Measures what dialogs cost in memory: idle, running and with a GtkSocket
+ * extra widget on the server side, SandboxUtilsClient bookkeeping, and
+ * RemoteFileChooserDialog on the client side. Dialogs are created and
+ * destroyed in cycles to check that memory goes back to where it was.
+ *
+ * Costs within this process come from malloc's count of bytes in use, which
+ * is exact; the RSS taken from /proc/<pid>/smaps_rollup is also reported, and
+ * is the only measure available for the server when it runs in its own
+ * process. Leaks are reported as the slope of memory use over cycles, per
+ * dialog.
+ *
+ * With --baselines=FILE, fails when a cost exceeds its baseline by more than
+ * the tolerance. Baselines are written with --write-baselines=FILE.
+ *
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+
+#include <gio/gio.h>
+
+#include "sandboxutils.h"
+#include "sandboxutilsclientmanager.h"
+#include "sfcdbench.h"
+
+// Costs may exceed baselines by this many bytes regardless of the tolerance,
+// so that near-zero baselines such as leaks do not fail on noise
+#define SFCD_MEMBENCH_SLACK 1024
+
+static gint      _option_dialogs      = 50;
+static gint      _option_cycles       = 5;
+static gboolean  _option_private_bus  = FALSE;
+static gchar    *_option_daemon       = NULL;
+static gchar    *_option_baselines    = NULL;
+static gchar    *_option_write        = NULL;
+static gdouble   _option_tolerance    = 0.2;
+static gboolean  _option_json         = FALSE;
+
+static GOptionEntry entries[] =
+{
+  {
+    "dialogs", 'n', 0, G_OPTION_ARG_INT, &_option_dialogs,
+    "Number of dialogs alive at the same time in each pattern (default: 50)", "N"
+  },
+  {
+    "cycles", 'c', 0, G_OPTION_ARG_INT, &_option_cycles,
+    "Number of create and destroy cycles used to measure leaks (default: 5)", "N"
+  },
+  {
+    "private-bus", 'p', 0, G_OPTION_ARG_NONE, &_option_private_bus,
+    "Also measure remote dialogs, against a server on a private bus", NULL
+  },
+  {
+    "daemon", 'd', 0, G_OPTION_ARG_STRING, &_option_daemon,
+    "Command line of the server to start on the private bus (default: sandboxutilsd without limits)", "CMD"
+  },
+  {
+    "baselines", 'b', 0, G_OPTION_ARG_FILENAME, &_option_baselines,
+    "Fail if costs exceed the baselines recorded in FILE", "FILE"
+  },
+  {
+    "write-baselines", 'w', 0, G_OPTION_ARG_FILENAME, &_option_write,
+    "Record the measured costs as baselines in FILE", "FILE"
+  },
+  {
+    "tolerance", 't', 0, G_OPTION_ARG_DOUBLE, &_option_tolerance,
+    "Fraction by which costs may exceed baselines (default: 0.2)", "F"
+  },
+  {
+    "json", 'j', 0, G_OPTION_ARG_NONE, &_option_json,
+    "Print the report in JSON", NULL
+  },
+  {
+    NULL, ' ', 0, 0, NULL,
+    NULL, NULL
+  }
+};
+
+typedef enum {
+  MEMBENCH_LFCD_IDLE,
+  MEMBENCH_LFCD_IDLE_RSS,
+  MEMBENCH_LFCD_RUNNING,
+  MEMBENCH_EXTRA_WIDGET_SOCKET,
+  MEMBENCH_CLIENT,
+  MEMBENCH_LFCD_LEAK,
+  MEMBENCH_LFCD_LEAK_RSS,
+  MEMBENCH_RFCD,
+  MEMBENCH_SERVER_DIALOG_RSS,
+  MEMBENCH_SERVER_LEAK_RSS,
+  MEMBENCH_LAST
+} MembenchMetric;
+
+static const gchar *MembenchMetricPrintable[MEMBENCH_LAST] = {
+  "lfcd_idle_bytes",
+  "lfcd_idle_rss_bytes",
+  "lfcd_running_extra_bytes",
+  "extra_widget_socket_bytes",
+  "client_bytes",
+  "lfcd_leak_bytes_per_dialog",
+  "lfcd_leak_rss_bytes_per_dialog",
+  "rfcd_bytes",
+  "server_dialog_rss_bytes",
+  "server_leak_rss_bytes_per_dialog",
+};
+
+static gint64   _results[MEMBENCH_LAST];
+static gboolean _measured[MEMBENCH_LAST];
+
+/* Memory use of a process at some point */
+typedef struct {
+  gint64 heap;  // bytes in use according to malloc, this process only
+  gint64 rss;
+} MembenchSample;
+
+static void
+_membench_set (MembenchMetric metric,
+               gint64         value)
+{
+  _results[metric]  = value;
+  _measured[metric] = TRUE;
+}
+
+static gint64
+_membench_read_rss (GPid pid)
+{
+  gchar   *path;
+  gchar   *contents = NULL;
+  gchar   *line;
+  gint64   rss      = 0;
+
+  path = pid ? g_strdup_printf ("/proc/%d/smaps_rollup", pid) : g_strdup ("/proc/self/smaps_rollup");
+
+  // smaps_rollup appeared in Linux 4.14, VmRSS is a coarser fallback
+  if (!g_file_get_contents (path, &contents, NULL, NULL))
+  {
+    g_free (path);
+    path = pid ? g_strdup_printf ("/proc/%d/status", pid) : g_strdup ("/proc/self/status");
+    g_file_get_contents (path, &contents, NULL, NULL);
+  }
+
+  if (contents)
+  {
+    line = strstr (contents, "\nRss:");
+    if (!line)
+      line = strstr (contents, "\nVmRSS:");
+
+    if (line)
+      rss = g_ascii_strtoll (strchr (line, ':') + 1, NULL, 10) * 1024;
+  }
+
+  g_free (contents);
+  g_free (path);
+
+  return rss;
+}
+
+static gint64
+_membench_read_heap ()
+{
+#if defined (__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+  struct mallinfo2 info = mallinfo2 ();
+#else
+  struct mallinfo info = mallinfo ();
+#endif
+
+  return (gint64) info.uordblks + (gint64) info.hblkhd;
+}
+
+/* Lets pending work run, gives free memory back to the system and samples */
+static void
+_membench_sample (GPid            pid,
+                  MembenchSample *sample)
+{
+  while (g_main_context_iteration (NULL, FALSE));
+  malloc_trim (0);
+
+  sample->heap = _membench_read_heap ();
+  sample->rss  = _membench_read_rss (pid);
+}
+
+/* Least squares slope of samples taken at regular intervals */
+static gint64
+_membench_slope (const gint64 *values,
+                 gint          n)
+{
+  gdouble mean_x = (n - 1) / 2.0;
+  gdouble mean_y = 0;
+  gdouble num    = 0;
+  gdouble den    = 0;
+  gint    i;
+
+  if (n < 2)
+    return 0;
+
+  for (i = 0; i < n; i++)
+    mean_y += values[i];
+  mean_y /= n;
+
+  for (i = 0; i < n; i++)
+  {
+    num += (i - mean_x) * (values[i] - mean_y);
+    den += (i - mean_x) * (i - mean_x);
+  }
+
+  return (gint64) (num / den);
+}
+
+static SandboxFileChooserDialog **
+_membench_create (gboolean with_socket)
+{
+  SandboxFileChooserDialog **dialogs = g_malloc0 (sizeof (gpointer) * _option_dialogs);
+  GError                    *error   = NULL;
+  gint                       i;
+
+  for (i = 0; i < _option_dialogs; i++)
+  {
+    dialogs[i] = sfcd_new ("sfcd-membench", NULL, GTK_FILE_CHOOSER_ACTION_OPEN,
+                           "_Cancel", GTK_RESPONSE_CANCEL,
+                           "_Open", GTK_RESPONSE_ACCEPT,
+                           NULL);
+
+    if (with_socket && dialogs[i])
+    {
+      sfcd_set_extra_widget (dialogs[i], gtk_socket_new (), &error);
+      g_clear_error (&error);
+    }
+  }
+
+  return dialogs;
+}
+
+static void
+_membench_destroy (SandboxFileChooserDialog **dialogs)
+{
+  gint i;
+
+  for (i = 0; i < _option_dialogs; i++)
+    if (dialogs[i])
+      sfcd_destroy (dialogs[i]);
+
+  g_free (dialogs);
+}
+
+/* Waits for running dialogs to be answered */
+typedef struct {
+  GMainLoop                 *loop;
+  SandboxFileChooserDialog **dialogs;
+  gint                       answered;
+  MembenchSample             running;
+} MembenchRun;
+
+static void
+_membench_on_response (SandboxFileChooserDialog *sfcd,
+                       gint                      response_id,
+                       gint                      state,
+                       gpointer                  user_data)
+{
+  MembenchRun *run = user_data;
+
+  if (++run->answered == _option_dialogs)
+    g_main_loop_quit (run->loop);
+}
+
+// Runs inside the innermost dialog loop, once all dialogs are shown
+static gboolean
+_membench_on_all_running (gpointer user_data)
+{
+  MembenchRun *run   = user_data;
+  GError      *error = NULL;
+  gint         i;
+
+  malloc_trim (0);
+  run->running.heap = _membench_read_heap ();
+  run->running.rss  = _membench_read_rss (0);
+
+  for (i = _option_dialogs - 1; i >= 0; i--)
+  {
+    lfcd_respond (run->dialogs[i], GTK_RESPONSE_CANCEL, &error);
+    g_clear_error (&error);
+  }
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+_membench_local ()
+{
+  SandboxFileChooserDialog **dialogs;
+  MembenchSample             before;
+  MembenchSample             after;
+  MembenchRun                run;
+  GError                    *error = NULL;
+  gint64                    *heaps;
+  gint64                    *rsses;
+  gint                       i;
+
+  sandboxutils_set_sandboxed (FALSE);
+
+  // Warm up GTK+ and the type system so they do not count as dialog costs
+  _membench_destroy (_membench_create (TRUE));
+  _membench_sample (0, &before);
+
+  dialogs = _membench_create (FALSE);
+  _membench_sample (0, &after);
+  _membench_set (MEMBENCH_LFCD_IDLE, (after.heap - before.heap) / _option_dialogs);
+  _membench_set (MEMBENCH_LFCD_IDLE_RSS, (after.rss - before.rss) / _option_dialogs);
+
+  // Run all dialogs at once, and answer them once they are all up
+  memset (&run, 0, sizeof (MembenchRun));
+  run.loop    = g_main_loop_new (NULL, FALSE);
+  run.dialogs = dialogs;
+  for (i = 0; i < _option_dialogs; i++)
+  {
+    g_signal_connect (dialogs[i], "response", G_CALLBACK (_membench_on_response), &run);
+    sfcd_run (dialogs[i], &error);
+    g_clear_error (&error);
+  }
+  g_timeout_add (500, _membench_on_all_running, &run);
+  g_main_loop_run (run.loop);
+  g_main_loop_unref (run.loop);
+  _membench_set (MEMBENCH_LFCD_RUNNING, (run.running.heap - after.heap) / _option_dialogs);
+
+  _membench_destroy (dialogs);
+  _membench_sample (0, &before);
+
+  dialogs = _membench_create (TRUE);
+  _membench_sample (0, &after);
+  _membench_set (MEMBENCH_EXTRA_WIDGET_SOCKET,
+                 (after.heap - before.heap) / _option_dialogs - _results[MEMBENCH_LFCD_IDLE]);
+  _membench_destroy (dialogs);
+
+  // Memory should not grow from one cycle to the next
+  heaps = g_malloc0 (sizeof (gint64) * MAX (_option_cycles, 1));
+  rsses = g_malloc0 (sizeof (gint64) * MAX (_option_cycles, 1));
+  for (i = 0; i < _option_cycles; i++)
+  {
+    _membench_destroy (_membench_create (FALSE));
+    _membench_sample (0, &after);
+    heaps[i] = after.heap;
+    rsses[i] = after.rss;
+  }
+  _membench_set (MEMBENCH_LFCD_LEAK, _membench_slope (heaps, _option_cycles) / _option_dialogs);
+  _membench_set (MEMBENCH_LFCD_LEAK_RSS, _membench_slope (rsses, _option_cycles) / _option_dialogs);
+  g_free (heaps);
+  g_free (rsses);
+}
+
+static void
+_membench_client ()
+{
+  SandboxUtilsClient *cli;
+  MembenchSample      before;
+  MembenchSample      after;
+
+  // Once first, so that the table of clients is not counted
+  sandbox_utils_client_unref (sandbox_utils_client_lookup (":membench.0"));
+
+  _membench_sample (0, &before);
+  cli = sandbox_utils_client_lookup (":membench.1");
+  _membench_sample (0, &after);
+  sandbox_utils_client_unref (cli);
+  sandbox_utils_client_remove_all ();
+
+  _membench_set (MEMBENCH_CLIENT, after.heap - before.heap);
+}
+
+static void
+_membench_remote (GPid server)
+{
+  SandboxFileChooserDialog **dialogs;
+  MembenchSample             before;
+  MembenchSample             after;
+  MembenchSample             server_before;
+  MembenchSample             server_after;
+  gint64                    *rsses;
+  gint                       i;
+
+  sandboxutils_set_sandboxed (TRUE);
+
+  // Warm up the proxy, and the server
+  _membench_destroy (_membench_create (FALSE));
+
+  _membench_sample (0, &before);
+  _membench_sample (server, &server_before);
+  dialogs = _membench_create (FALSE);
+  _membench_sample (0, &after);
+  _membench_sample (server, &server_after);
+
+  _membench_set (MEMBENCH_RFCD, (after.heap - before.heap) / _option_dialogs);
+  _membench_set (MEMBENCH_SERVER_DIALOG_RSS, (server_after.rss - server_before.rss) / _option_dialogs);
+  _membench_destroy (dialogs);
+
+  rsses = g_malloc0 (sizeof (gint64) * MAX (_option_cycles, 1));
+  for (i = 0; i < _option_cycles; i++)
+  {
+    _membench_destroy (_membench_create (FALSE));
+    _membench_sample (server, &server_after);
+    rsses[i] = server_after.rss;
+  }
+  _membench_set (MEMBENCH_SERVER_LEAK_RSS, _membench_slope (rsses, _option_cycles) / _option_dialogs);
+  g_free (rsses);
+}
+
+/* Compares results to baselines, returns the number of regressions */
+static guint
+_membench_check (GString *report)
+{
+  GHashTable  *baselines = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  gchar       *contents  = NULL;
+  gchar      **lines;
+  gchar      **fields;
+  gpointer     value;
+  gint64       baseline;
+  gint64       allowed;
+  guint        failed    = 0;
+  guint        i;
+
+  if (!g_file_get_contents (_option_baselines, &contents, NULL, NULL))
+  {
+    g_printerr ("Could not read baselines from '%s'.\n", _option_baselines);
+    g_hash_table_unref (baselines);
+    return 1;
+  }
+
+  lines = g_strsplit (contents, "\n", -1);
+  for (i = 0; lines[i]; i++)
+  {
+    if (lines[i][0] == '#')
+      continue;
+
+    fields = g_strsplit (lines[i], " ", 2);
+    if (g_strv_length (fields) == 2)
+      g_hash_table_insert (baselines, g_strdup (fields[0]),
+                           GSIZE_TO_POINTER (g_ascii_strtoll (fields[1], NULL, 10) + 1));
+    g_strfreev (fields);
+  }
+  g_strfreev (lines);
+  g_free (contents);
+
+  for (i = 0; i < MEMBENCH_LAST; i++)
+  {
+    value = g_hash_table_lookup (baselines, MembenchMetricPrintable[i]);
+    if (!_measured[i] || !value)
+      continue;
+
+    baseline = (gint64) GPOINTER_TO_SIZE (value) - 1;
+    allowed  = (gint64) (MAX (baseline, 0) * (1.0 + _option_tolerance)) + SFCD_MEMBENCH_SLACK;
+
+    if (_results[i] > allowed)
+    {
+      failed++;
+      g_string_append_printf (report, "%s is %" G_GINT64_FORMAT " bytes, over its baseline of %" G_GINT64_FORMAT " bytes\n",
+                              MembenchMetricPrintable[i], _results[i], baseline);
+    }
+  }
+
+  g_hash_table_unref (baselines);
+
+  return failed;
+}
+
+static gboolean
+_membench_write (GError **error)
+{
+  GString  *out = g_string_new ("# sfcd-membench baselines, in bytes\n");
+  gboolean  written;
+  guint     i;
+
+  for (i = 0; i < MEMBENCH_LAST; i++)
+    if (_measured[i])
+      g_string_append_printf (out, "%s %" G_GINT64_FORMAT "\n", MembenchMetricPrintable[i], _results[i]);
+
+  written = g_file_set_contents (_option_write, out->str, out->len, error);
+  g_string_free (out, TRUE);
+
+  return written;
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext  *context;
+  GError          *error   = NULL;
+  SfcdBenchBus     bus;
+  GString         *regressions;
+  gboolean         first   = TRUE;
+  guint            failed  = 0;
+  guint            i;
+
+  context = g_option_context_new ("- measure the memory footprint of dialogs");
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+  {
+    g_printerr ("%s\n", _sandboxutils_error_get_message (error));
+    g_error_free (error);
+    g_option_context_free (context);
+    return EXIT_FAILURE;
+  }
+  g_option_context_free (context);
+
+  _option_dialogs = MAX (_option_dialogs, 1);
+
+  // The private bus must be up before anything connects to the session bus
+  memset (&bus, 0, sizeof (SfcdBenchBus));
+  if (_option_private_bus &&
+      !sfcd_bench_bus_up (&bus, _option_daemon ? _option_daemon : "sandboxutilsd " SFCD_BENCH_NO_LIMITS, &error))
+  {
+    g_printerr ("Could not start a private bus: %s\n", _sandboxutils_error_get_message (error));
+    g_error_free (error);
+    return EXIT_FAILURE;
+  }
+
+  // Keep the accessibility bridge out of our measurements
+  g_setenv ("NO_AT_BRIDGE", "1", TRUE);
+  if (!gtk_init_check (&argc, &argv))
+  {
+    g_printerr ("Could not open a display, GTK+ dialogs cannot be measured.\n");
+    sfcd_bench_bus_down (&bus);
+    return EXIT_FAILURE;
+  }
+
+  _membench_local ();
+  _membench_client ();
+  if (_option_private_bus)
+    _membench_remote (bus.daemon);
+
+  sfcd_bench_bus_down (&bus);
+
+  regressions = g_string_new (NULL);
+  if (_option_baselines)
+    failed = _membench_check (regressions);
+
+  if (_option_json)
+  {
+    printf ("{\"tool\": \"sfcd-membench\", \"version\": \"%s\", \"dialogs\": %d, \"cycles\": %d, "
+            "\"regressions\": %u, \"costs\": {",
+            SANDBOXUTILS_VERSION, _option_dialogs, _option_cycles, failed);
+    for (i = 0; i < MEMBENCH_LAST; i++)
+      if (_measured[i])
+      {
+        printf ("%s\"%s\": %" G_GINT64_FORMAT, first ? "" : ", ", MembenchMetricPrintable[i], _results[i]);
+        first = FALSE;
+      }
+    printf ("}}\n");
+  }
+  else
+  {
+    for (i = 0; i < MEMBENCH_LAST; i++)
+      if (_measured[i])
+        printf ("%-34s %10" G_GINT64_FORMAT "\n", MembenchMetricPrintable[i], _results[i]);
+  }
+
+  if (failed)
+    g_printerr ("\n%u regression(s):\n%s", failed, regressions->str);
+  g_string_free (regressions, TRUE);
+
+  if (_option_write && !_membench_write (&error))
+  {
+    g_printerr ("Could not write baselines: %s\n", _sandboxutils_error_get_message (error));
+    g_error_free (error);
+    return EXIT_FAILURE;
+  }
+
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
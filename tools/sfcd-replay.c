@@ -0,0 +1,486 @@
+/* SandboxUtils -- Call Recording Replayer
+ * Copyright (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>, 2014
+ *
+ * Under GPLv3
+ *
+ ***
+ *
+ * Replays a recording made with `sandboxutilsd --record=FILE` against a
+ * server, and reports per-method latency percentiles. Each recorded client
+ * gets its own connection and makes its calls in order, waiting for each
+ * reply like RemoteFileChooserDialog does. Recorded dialog and template ids
+ * are mapped to the ids handed out by the server during the replay.
+ *
+ * Dialogs that get run during a replay still need an answer; use a server
+ * with no user in front of it only for recordings that do not run dialogs.
+ *
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include <gio/gio.h>
+
+#include "sandboxutilscommon.h"
+#include "sandboxfilechooserdialog.h"
+#include "sfcdbench.h"
+
+static gdouble   _option_speed       = 1.0;
+static gint      _option_scale       = 1;
+static gboolean  _option_private_bus = FALSE;
+static gchar    *_option_daemon      = NULL;
+static gboolean  _option_json        = FALSE;
+
+static GOptionEntry entries[] =
+{
+  {
+    "speed", 's', 0, G_OPTION_ARG_DOUBLE, &_option_speed,
+    "Replay F times faster than recorded, or as fast as possible if 0 (default: 1)", "F"
+  },
+  {
+    "scale", 'n', 0, G_OPTION_ARG_INT, &_option_scale,
+    "Replay each recorded client N times in parallel (default: 1)", "N"
+  },
+  {
+    "private-bus", 'p', 0, G_OPTION_ARG_NONE, &_option_private_bus,
+    "Replay on a private bus with its own server instead of the session bus", NULL
+  },
+  {
+    "daemon", 'd', 0, G_OPTION_ARG_STRING, &_option_daemon,
+    "Command line of the server to start on the private bus (default: sandboxutilsd)", "CMD"
+  },
+  {
+    "json", 'j', 0, G_OPTION_ARG_NONE, &_option_json,
+    "Print the report in JSON", NULL
+  },
+  {
+    NULL, ' ', 0, 0, NULL,
+    NULL, NULL
+  }
+};
+
+/* A call made by a recorded client */
+typedef struct {
+  gint64    time;
+  gchar    *method;
+  GVariant *body;
+  gchar    *recorded_id;  // dialog or template id returned in the recording
+} ReplayCall;
+
+/* All the calls of a recorded client, in order */
+typedef struct {
+  gchar     *name;
+  GPtrArray *calls;
+} ReplayScript;
+
+typedef struct {
+  ReplayScript    *script;
+  GDBusConnection *connection;
+  GHashTable      *ids;       // recorded id -> replayed id
+  guint            next;
+  gint64           sent;
+} ReplayClient;
+
+static GHashTable *_stats     = NULL;
+static GMainLoop  *_loop      = NULL;
+static gint64      _start     = 0;
+static guint       _running   = 0;
+
+static void
+_replay_call_free (gpointer data)
+{
+  ReplayCall *call = data;
+
+  g_free (call->method);
+  g_variant_unref (call->body);
+  g_free (call->recorded_id);
+  g_free (call);
+}
+
+static void
+_replay_script_free (gpointer data)
+{
+  ReplayScript *script = data;
+
+  g_free (script->name);
+  g_ptr_array_unref (script->calls);
+  g_free (script);
+}
+
+static void
+_replay_client_free (gpointer data)
+{
+  ReplayClient *client = data;
+
+  g_clear_object (&client->connection);
+  g_hash_table_unref (client->ids);
+  g_free (client);
+}
+
+/* Loads a recording into one script per client */
+static GPtrArray *
+_replay_load (const gchar  *path,
+              GError      **error)
+{
+  GPtrArray     *scripts;
+  GHashTable    *by_name;
+  GHashTable    *pending;
+  ReplayScript  *script;
+  ReplayCall    *call;
+  gchar         *contents;
+  gchar        **lines;
+  gchar        **fields;
+  gchar         *key;
+  guint          i;
+
+  if (!g_file_get_contents (path, &contents, NULL, error))
+    return NULL;
+
+  if (!g_str_has_prefix (contents, "# sandboxutilsd recording v1"))
+  {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                 "'%s' is not a sandboxutilsd recording", path);
+    g_free (contents);
+    return NULL;
+  }
+
+  scripts = g_ptr_array_new_with_free_func (_replay_script_free);
+  by_name = g_hash_table_new (g_str_hash, g_str_equal);
+  pending = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  lines   = g_strsplit (contents, "\n", -1);
+  g_free (contents);
+
+  for (i = 1; lines[i]; i++)
+  {
+    fields = g_strsplit (lines[i], "\t", 6);
+
+    if (g_strv_length (fields) != 6)
+    {
+      g_strfreev (fields);
+      continue;
+    }
+
+    key = g_strdup_printf ("%s %s", fields[2], fields[3]);
+
+    if (g_strcmp0 (fields[0], "call") == 0)
+    {
+      script = g_hash_table_lookup (by_name, fields[2]);
+      if (!script)
+      {
+        script = g_malloc0 (sizeof (ReplayScript));
+        script->name  = g_strdup (fields[2]);
+        script->calls = g_ptr_array_new_with_free_func (_replay_call_free);
+        g_hash_table_insert (by_name, script->name, script);
+        g_ptr_array_add (scripts, script);
+      }
+
+      call = g_malloc0 (sizeof (ReplayCall));
+      call->time   = g_ascii_strtoll (fields[1], NULL, 10);
+      call->method = g_strdup (fields[4]);
+      call->body   = g_variant_parse (NULL, fields[5], NULL, NULL, NULL);
+
+      if (!call->body)
+      {
+        g_printerr ("Skipping call on line %u, its arguments could not be parsed.\n", i + 1);
+        g_free (call->method);
+        g_free (call);
+      }
+      else
+      {
+        g_ptr_array_add (script->calls, call);
+        g_hash_table_insert (pending, key, call);
+        key = NULL;
+      }
+    }
+    else if (g_strcmp0 (fields[0], "reply") == 0)
+    {
+      call = g_hash_table_lookup (pending, key);
+
+      // Remember which dialog and template ids were handed out, later calls
+      // refer to them
+      if (call && (g_strcmp0 (call->method, "New") == 0 ||
+                   g_strcmp0 (call->method, "NewFromTemplate") == 0 ||
+                   g_strcmp0 (call->method, "RegisterTemplate") == 0) &&
+          g_strcmp0 (fields[4], "ok") == 0)
+      {
+        GVariant *reply = g_variant_parse (G_VARIANT_TYPE ("(s)"), fields[5], NULL, NULL, NULL);
+        if (reply)
+        {
+          g_variant_get (reply, "(s)", &call->recorded_id);
+          g_variant_unref (reply);
+        }
+      }
+
+      g_hash_table_remove (pending, key);
+    }
+
+    g_free (key);
+    g_strfreev (fields);
+  }
+
+  g_strfreev (lines);
+  g_hash_table_unref (pending);
+  g_hash_table_unref (by_name);
+
+  return scripts;
+}
+
+/*
+ * Points the call to the dialogs of this replay rather than the recorded ones.
+ * Returns a new reference.
+ */
+static GVariant *
+_replay_prepare_body (ReplayClient *client,
+                      ReplayCall   *call)
+{
+  GVariantBuilder  builder;
+  GVariant        *child;
+  const gchar     *replayed;
+  gsize            i;
+  gsize            n;
+
+  if (g_strcmp0 (call->method, "New") == 0 ||
+      g_variant_n_children (call->body) == 0)
+    return g_variant_ref (call->body);
+
+  n = g_variant_n_children (call->body);
+  g_variant_builder_init (&builder, g_variant_get_type (call->body));
+
+  for (i = 0; i < n; i++)
+  {
+    child = g_variant_get_child_value (call->body, i);
+
+    if (i == 0 && g_variant_is_of_type (child, G_VARIANT_TYPE_STRING))
+    {
+      replayed = g_hash_table_lookup (client->ids, g_variant_get_string (child, NULL));
+      if (replayed)
+      {
+        g_variant_unref (child);
+        child = g_variant_ref_sink (g_variant_new_string (replayed));
+      }
+    }
+    // Run times are relative to the recorded client's clock, use ours
+    else if (i == 2 && g_strcmp0 (call->method, "Run") == 0)
+    {
+      g_variant_unref (child);
+      child = g_variant_ref_sink (g_variant_new_int64 (g_get_monotonic_time ()));
+    }
+
+    g_variant_builder_add_value (&builder, child);
+    g_variant_unref (child);
+  }
+
+  return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
+static void _replay_client_schedule (ReplayClient *client);
+
+static void
+_replay_client_on_reply (GObject      *source,
+                         GAsyncResult *res,
+                         gpointer      user_data)
+{
+  ReplayClient *client = user_data;
+  ReplayCall   *call   = g_ptr_array_index (client->script->calls, client->next);
+  GError       *error  = NULL;
+  GVariant     *reply;
+  gchar        *id;
+
+  reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source), res, &error);
+  sfcd_bench_stats_add (_stats, call->method, g_get_monotonic_time () - client->sent, reply == NULL);
+
+  if (reply)
+  {
+    if (call->recorded_id && g_variant_is_of_type (reply, G_VARIANT_TYPE ("(s)")))
+    {
+      g_variant_get (reply, "(s)", &id);
+      g_hash_table_insert (client->ids, g_strdup (call->recorded_id), id);
+    }
+
+    g_variant_unref (reply);
+  }
+  else
+  {
+    g_error_free (error);
+  }
+
+  client->next++;
+  _replay_client_schedule (client);
+}
+
+static gboolean
+_replay_client_send (gpointer data)
+{
+  ReplayClient *client = data;
+  ReplayCall   *call   = g_ptr_array_index (client->script->calls, client->next);
+  GVariant     *body   = _replay_prepare_body (client, call);
+
+  client->sent = g_get_monotonic_time ();
+  g_dbus_connection_call (client->connection,
+                          SFCD_IFACE,
+                          SANDBOXUTILS_PATH,
+                          SFCD_IFACE,
+                          call->method,
+                          body,
+                          NULL,
+                          G_DBUS_CALL_FLAGS_NONE,
+                          -1,
+                          NULL,
+                          _replay_client_on_reply,
+                          client);
+  g_variant_unref (body);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Sends the next call of a client once it is due */
+static void
+_replay_client_schedule (ReplayClient *client)
+{
+  ReplayCall *call;
+  gint64      delay = 0;
+
+  if (client->next >= client->script->calls->len)
+  {
+    if (--_running == 0)
+      g_main_loop_quit (_loop);
+    return;
+  }
+
+  call = g_ptr_array_index (client->script->calls, client->next);
+
+  if (_option_speed > 0)
+    delay = _start + (gint64) (call->time / _option_speed) - g_get_monotonic_time ();
+
+  if (delay > 0)
+    g_timeout_add (delay / G_TIME_SPAN_MILLISECOND, _replay_client_send, client);
+  else
+    _replay_client_send (client);
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext  *context;
+  GError          *error   = NULL;
+  GPtrArray       *scripts;
+  GPtrArray       *clients;
+  ReplayClient    *client;
+  SfcdBenchBus     bus;
+  GString         *json;
+  gchar           *address;
+  gint64           elapsed;
+  guint            calls   = 0;
+  guint            i;
+  gint             copy;
+
+  context = g_option_context_new ("RECORDING - replay calls recorded by sandboxutilsd");
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error) || argc != 2)
+  {
+    g_printerr ("%s\n", error ? _sandboxutils_error_get_message (error) : "Exactly one recording must be given.");
+    g_clear_error (&error);
+    g_option_context_free (context);
+    return EXIT_FAILURE;
+  }
+  g_option_context_free (context);
+
+  scripts = _replay_load (argv[1], &error);
+  if (!scripts)
+  {
+    g_printerr ("Could not load recording: %s\n", _sandboxutils_error_get_message (error));
+    g_error_free (error);
+    return EXIT_FAILURE;
+  }
+
+  memset (&bus, 0, sizeof (SfcdBenchBus));
+  if (_option_private_bus &&
+      !sfcd_bench_bus_up (&bus, _option_daemon ? _option_daemon : "sandboxutilsd", &error))
+  {
+    g_printerr ("Could not start a private bus: %s\n", _sandboxutils_error_get_message (error));
+    g_error_free (error);
+    g_ptr_array_unref (scripts);
+    return EXIT_FAILURE;
+  }
+
+  address = g_dbus_address_get_for_bus_sync (G_BUS_TYPE_SESSION, NULL, &error);
+  if (!address)
+  {
+    g_printerr ("Could not find the session bus: %s\n", _sandboxutils_error_get_message (error));
+    g_error_free (error);
+    g_ptr_array_unref (scripts);
+    sfcd_bench_bus_down (&bus);
+    return EXIT_FAILURE;
+  }
+
+  // Each client gets its own connection so the server sees distinct peers
+  clients = g_ptr_array_new_with_free_func (_replay_client_free);
+  for (i = 0; i < scripts->len; i++)
+  {
+    for (copy = 0; copy < MAX (_option_scale, 1); copy++)
+    {
+      client = g_malloc0 (sizeof (ReplayClient));
+      client->script     = g_ptr_array_index (scripts, i);
+      client->ids        = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+      client->connection = g_dbus_connection_new_for_address_sync (address,
+                                                                   G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+                                                                   G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+                                                                   NULL, NULL, &error);
+      if (!client->connection)
+      {
+        g_printerr ("Could not connect client %s: %s\n", client->script->name, _sandboxutils_error_get_message (error));
+        g_error_free (error);
+        _replay_client_free (client);
+        g_ptr_array_unref (clients);
+        g_ptr_array_unref (scripts);
+        g_free (address);
+        sfcd_bench_bus_down (&bus);
+        return EXIT_FAILURE;
+      }
+
+      calls += client->script->calls->len;
+      g_ptr_array_add (clients, client);
+    }
+  }
+  g_free (address);
+
+  _stats   = sfcd_bench_stats_table_new ();
+  _loop    = g_main_loop_new (NULL, FALSE);
+  _running = clients->len;
+  _start   = g_get_monotonic_time ();
+
+  for (i = 0; i < clients->len; i++)
+    _replay_client_schedule (g_ptr_array_index (clients, i));
+
+  if (_running)
+    g_main_loop_run (_loop);
+
+  elapsed = MAX (g_get_monotonic_time () - _start, 1);
+
+  if (_option_json)
+  {
+    json = g_string_new (NULL);
+    g_string_append_printf (json, "{\"recording\": \"%s\", \"clients\": %u, \"calls\": %u, "
+                                  "\"elapsed_us\": %" G_GINT64_FORMAT ", \"methods\": ",
+                            argv[1], clients->len, calls, elapsed);
+    sfcd_bench_stats_append_json (_stats, json);
+    g_string_append (json, "}\n");
+    fputs (json->str, stdout);
+    g_string_free (json, TRUE);
+  }
+  else
+  {
+    printf ("Replayed %u calls from %u clients in %.3f s (%.1f calls/s)\n\n",
+            calls, clients->len, elapsed / (gdouble) G_TIME_SPAN_SECOND,
+            calls * (gdouble) G_TIME_SPAN_SECOND / elapsed);
+    sfcd_bench_stats_print (_stats, stdout);
+  }
+
+  g_ptr_array_unref (clients);
+  g_ptr_array_unref (scripts);
+  g_hash_table_unref (_stats);
+  g_main_loop_unref (_loop);
+
+  sfcd_bench_bus_down (&bus);
+
+  return EXIT_SUCCESS;
+}
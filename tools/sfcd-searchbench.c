@@ -0,0 +1,238 @@
+/* SandboxUtils -- Name Search Benchmark
+ * Copyright (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>, 2014
+ *
+ * Under GPLv3
+ *
+ ***
+ *
+ * Measures how long the server's crawler takes to index real folders, and how
+ * long the resulting name index takes to answer queries. The folders given on
+ * the command line (the home folder by default) are crawled into a temporary
+ * index, then parts of names picked from it are looked up, both as word
+ * prefixes and as substrings.
+ *
+ * With --max-latency=MS, fails when the 99th percentile of any kind of query
+ * exceeds MS milliseconds.
+ *
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#include "sandboxutils.h"
+#include "sandboxutilscrawler.h"
+#include "sandboxutilsnameindex.h"
+#include "sfcdbench.h"
+
+static gint      _option_threads     = 4;
+static gint      _option_rate        = 0;
+static gint      _option_queries     = 500;
+static gint      _option_results     = 50;
+static gdouble   _option_max_latency = 0;
+static gboolean  _option_json        = FALSE;
+
+static GOptionEntry entries[] =
+{
+  {
+    "threads", 't', 0, G_OPTION_ARG_INT, &_option_threads,
+    "Number of threads reading folders (default: 4)", "N"
+  },
+  {
+    "rate", 'r', 0, G_OPTION_ARG_INT, &_option_rate,
+    "Folders read per second, 0 for no limit (default: 0)", "N"
+  },
+  {
+    "queries", 'q', 0, G_OPTION_ARG_INT, &_option_queries,
+    "Number of queries of each kind (default: 500)", "N"
+  },
+  {
+    "results", 'n', 0, G_OPTION_ARG_INT, &_option_results,
+    "Number of files asked for per query (default: 50)", "N"
+  },
+  {
+    "max-latency", 'm', 0, G_OPTION_ARG_DOUBLE, &_option_max_latency,
+    "Fail if the 99th percentile of a kind of query exceeds this many milliseconds", "MS"
+  },
+  {
+    "json", 'j', 0, G_OPTION_ARG_NONE, &_option_json,
+    "Print the report in JSON", NULL
+  },
+  {
+    NULL, ' ', 0, 0, NULL,
+    NULL, NULL
+  }
+};
+
+/* Takes @len characters of the casefolded base name of @path from @start */
+static gchar *
+_searchbench_make_query (const gchar *path,
+                         glong        start,
+                         glong        len)
+{
+  gchar *name;
+  gchar *key;
+  gchar *query;
+  glong  chars;
+
+  name  = g_path_get_basename (path);
+  key   = g_utf8_casefold (name, -1);
+  chars = g_utf8_strlen (key, -1);
+
+  start = MIN (start, MAX (chars - len, 0));
+  query = g_utf8_substring (key, start, MIN (start + len, chars));
+
+  g_free (key);
+  g_free (name);
+
+  return query;
+}
+
+int
+main (int argc, char *argv[])
+{
+  SandboxUtilsCrawlerStats  crawled;
+  SandboxUtilsNameIndex    *index;
+  GOptionContext           *context;
+  GError                   *error    = NULL;
+  GHashTable               *stats;
+  GHashTableIter            iter;
+  SfcdBenchStats           *kind;
+  GPtrArray                *paths;
+  GArray                   *ids;
+  GRand                    *rand;
+  GString                  *json;
+  const gchar              *path;
+  const gchar              *home[]   = { g_get_home_dir (), NULL };
+  const gchar * const      *roots;
+  gchar                    *folder;
+  gchar                    *filename;
+  gchar                    *query;
+  gint64                    started;
+  gint64                    write_us;
+  gint64                    p99;
+  gboolean                  failed   = FALSE;
+  guint                     size;
+  gint                      i;
+
+  context = g_option_context_new ("[FOLDER...] - measure crawling and name search");
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+  {
+    g_printerr ("%s\n", _sandboxutils_error_get_message (error));
+    g_error_free (error);
+    g_option_context_free (context);
+    return EXIT_FAILURE;
+  }
+  g_option_context_free (context);
+
+  roots = argc > 1 ? (const gchar * const *) argv + 1 : home;
+
+  folder = g_dir_make_tmp ("sfcd-searchbench-XXXXXX", &error);
+  if (!folder)
+  {
+    g_printerr ("%s\n", _sandboxutils_error_get_message (error));
+    g_error_free (error);
+    return EXIT_FAILURE;
+  }
+  filename = g_build_filename (folder, "names.idx", NULL);
+
+  paths = sandbox_utils_crawler_run (roots, MAX (_option_threads, 1), MAX (_option_rate, 0),
+                                     NULL, &crawled, &error);
+
+  started = g_get_monotonic_time ();
+  if (!paths || !sandbox_utils_name_index_write (paths, filename, &error) ||
+      !(index = sandbox_utils_name_index_open (filename, &error)))
+  {
+    g_printerr ("%s\n", _sandboxutils_error_get_message (error));
+    g_error_free (error);
+    if (paths)
+      g_ptr_array_unref (paths);
+    g_unlink (filename);
+    g_rmdir (folder);
+    return EXIT_FAILURE;
+  }
+  write_us = g_get_monotonic_time () - started;
+  g_ptr_array_unref (paths);
+
+  size  = sandbox_utils_name_index_get_size (index);
+  stats = sfcd_bench_stats_table_new ();
+  rand  = g_rand_new_with_seed (42);
+
+  for (i = 0; size && i < _option_queries; i++)
+  {
+    path = sandbox_utils_name_index_get_path (index, g_rand_int_range (rand, 0, size));
+
+    // What users type when they remember how a name starts
+    query   = _searchbench_make_query (path, 0, g_rand_int_range (rand, 2, 6));
+    started = g_get_monotonic_time ();
+    ids     = sandbox_utils_name_index_find_token (index, query, _option_results);
+    sfcd_bench_stats_add (stats, "token-prefix", g_get_monotonic_time () - started, FALSE);
+    g_array_unref (ids);
+    g_free (query);
+
+    // And when they remember a part of it
+    query   = _searchbench_make_query (path, g_rand_int_range (rand, 0, 8), g_rand_int_range (rand, 3, 8));
+    started = g_get_monotonic_time ();
+    ids     = sandbox_utils_name_index_find_substring (index, query, _option_results);
+    sfcd_bench_stats_add (stats, "substring", g_get_monotonic_time () - started, FALSE);
+    g_array_unref (ids);
+    g_free (query);
+
+    // Rare text, so that every name gets scanned
+    started = g_get_monotonic_time ();
+    ids     = sandbox_utils_name_index_find_substring (index, "\x01", _option_results);
+    sfcd_bench_stats_add (stats, "full-scan", g_get_monotonic_time () - started, FALSE);
+    g_array_unref (ids);
+  }
+
+  if (_option_json)
+  {
+    json = g_string_new (NULL);
+    g_string_append_printf (json,
+                            "{\"tool\": \"sfcd-searchbench\", \"version\": \"%s\", "
+                            "\"files\": %u, \"folders\": %" G_GUINT64_FORMAT ", \"threads\": %d, "
+                            "\"crawl_us\": %" G_GINT64_FORMAT ", \"write_us\": %" G_GINT64_FORMAT ", "
+                            "\"steals\": %" G_GUINT64_FORMAT ", \"methods\": ",
+                            SANDBOXUTILS_VERSION, size, crawled.folders, MAX (_option_threads, 1),
+                            crawled.duration, write_us, crawled.steals);
+    sfcd_bench_stats_append_json (stats, json);
+    g_string_append (json, "}\n");
+    fputs (json->str, stdout);
+    g_string_free (json, TRUE);
+  }
+  else
+  {
+    printf ("Crawled %" G_GUINT64_FORMAT " folders with %d threads in %.3f s (%" G_GUINT64_FORMAT " stolen, %" G_GUINT64_FORMAT " unreadable)\n"
+            "Indexed %u files in %.3f s, query latencies:\n\n",
+            crawled.folders, MAX (_option_threads, 1), crawled.duration / (gdouble) G_TIME_SPAN_SECOND,
+            crawled.steals, crawled.errors, size, write_us / (gdouble) G_TIME_SPAN_SECOND);
+    sfcd_bench_stats_print (stats, stdout);
+  }
+
+  if (_option_max_latency > 0)
+  {
+    g_hash_table_iter_init (&iter, stats);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &kind))
+    {
+      p99 = sfcd_bench_stats_percentile (kind, 99);
+      if (p99 > _option_max_latency * 1000)
+      {
+        g_printerr ("%s: 99th percentile is %.3f ms, above %.3f ms\n",
+                    kind->name, p99 / 1000.0, _option_max_latency);
+        failed = TRUE;
+      }
+    }
+  }
+
+  g_hash_table_unref (stats);
+  g_rand_free (rand);
+  sandbox_utils_name_index_free (index);
+  g_unlink (filename);
+  g_rmdir (folder);
+  g_free (filename);
+  g_free (folder);
+
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
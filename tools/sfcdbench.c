@@ -0,0 +1,269 @@
+/* SandboxUtils -- Benchmark helpers
+ * Copyright (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>, 2014
+ *
+ * Under GPLv3
+ *
+ ***
+ *
+ * See sfcdbench.h.
+ *
+ */
+#include <signal.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "sfcdbench.h"
+#include "sandboxfilechooserdialog.h"
+
+// How long to wait for the server to show up on a private bus
+#define SFCD_BENCH_DAEMON_TIMEOUT (10 * G_TIME_SPAN_SECOND)
+
+static void
+_sfcd_bench_stats_free (gpointer data)
+{
+  SfcdBenchStats *stats = data;
+
+  g_free (stats->name);
+  g_array_unref (stats->samples);
+  g_free (stats);
+}
+
+GHashTable *
+sfcd_bench_stats_table_new ()
+{
+  return g_hash_table_new_full (g_str_hash, g_str_equal, NULL, _sfcd_bench_stats_free);
+}
+
+void
+sfcd_bench_stats_add (GHashTable  *table,
+                      const gchar *name,
+                      gint64       latency,
+                      gboolean     failed)
+{
+  SfcdBenchStats *stats = g_hash_table_lookup (table, name);
+
+  if (!stats)
+  {
+    stats = g_malloc0 (sizeof (SfcdBenchStats));
+    stats->name    = g_strdup (name);
+    stats->samples = g_array_new (FALSE, FALSE, sizeof (gint64));
+    g_hash_table_insert (table, stats->name, stats);
+  }
+
+  g_array_append_val (stats->samples, latency);
+  stats->sorted = FALSE;
+
+  if (failed)
+    stats->errors++;
+}
+
+static gint
+_sfcd_bench_compare_samples (gconstpointer a,
+                             gconstpointer b)
+{
+  gint64 x = *(const gint64 *) a;
+  gint64 y = *(const gint64 *) b;
+
+  return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/* Nearest-rank percentile, 0 if there are no samples */
+gint64
+sfcd_bench_stats_percentile (SfcdBenchStats *stats,
+                             gdouble         percentile)
+{
+  guint rank;
+
+  if (stats->samples->len == 0)
+    return 0;
+
+  if (!stats->sorted)
+  {
+    g_array_sort (stats->samples, _sfcd_bench_compare_samples);
+    stats->sorted = TRUE;
+  }
+
+  rank = (guint) (percentile / 100.0 * stats->samples->len + 0.999999);
+  rank = CLAMP (rank, 1, stats->samples->len);
+
+  return g_array_index (stats->samples, gint64, rank - 1);
+}
+
+static GList *
+_sfcd_bench_stats_sorted_names (GHashTable *table)
+{
+  return g_list_sort (g_hash_table_get_keys (table), (GCompareFunc) g_strcmp0);
+}
+
+void
+sfcd_bench_stats_print (GHashTable *table,
+                        FILE       *out)
+{
+  GList          *names = _sfcd_bench_stats_sorted_names (table);
+  GList          *iter;
+  SfcdBenchStats *stats;
+
+  fprintf (out, "%-28s %8s %7s %10s %10s %10s %10s\n",
+           "method", "calls", "errors", "p50 (us)", "p90 (us)", "p99 (us)", "max (us)");
+
+  for (iter = names; iter; iter = iter->next)
+  {
+    stats = g_hash_table_lookup (table, iter->data);
+    fprintf (out, "%-28s %8u %7u %10" G_GINT64_FORMAT " %10" G_GINT64_FORMAT " %10" G_GINT64_FORMAT " %10" G_GINT64_FORMAT "\n",
+             stats->name,
+             stats->samples->len,
+             stats->errors,
+             sfcd_bench_stats_percentile (stats, 50),
+             sfcd_bench_stats_percentile (stats, 90),
+             sfcd_bench_stats_percentile (stats, 99),
+             sfcd_bench_stats_percentile (stats, 100));
+  }
+
+  g_list_free (names);
+}
+
+void
+sfcd_bench_stats_append_json (GHashTable *table,
+                              GString    *json)
+{
+  GList          *names = _sfcd_bench_stats_sorted_names (table);
+  GList          *iter;
+  SfcdBenchStats *stats;
+
+  g_string_append (json, "{");
+
+  for (iter = names; iter; iter = iter->next)
+  {
+    stats = g_hash_table_lookup (table, iter->data);
+    g_string_append_printf (json,
+                            "%s\"%s\": {\"calls\": %u, \"errors\": %u, "
+                            "\"p50_us\": %" G_GINT64_FORMAT ", \"p90_us\": %" G_GINT64_FORMAT ", "
+                            "\"p99_us\": %" G_GINT64_FORMAT ", \"max_us\": %" G_GINT64_FORMAT "}",
+                            iter == names ? "" : ", ",
+                            stats->name,
+                            stats->samples->len,
+                            stats->errors,
+                            sfcd_bench_stats_percentile (stats, 50),
+                            sfcd_bench_stats_percentile (stats, 90),
+                            sfcd_bench_stats_percentile (stats, 99),
+                            sfcd_bench_stats_percentile (stats, 100));
+  }
+
+  g_string_append (json, "}");
+  g_list_free (names);
+}
+
+static gboolean
+_sfcd_bench_bus_wait_for_server (GError **error)
+{
+  GDBusConnection *connection;
+  GVariant        *reply;
+  gchar           *address;
+  gboolean         owned   = FALSE;
+  gint64           expires = g_get_monotonic_time () + SFCD_BENCH_DAEMON_TIMEOUT;
+
+  // Not the shared session bus connection, which callers may want to set up
+  // differently, or which would be unusable in forked processes
+  address = g_dbus_address_get_for_bus_sync (G_BUS_TYPE_SESSION, NULL, error);
+  if (!address)
+    return FALSE;
+
+  connection = g_dbus_connection_new_for_address_sync (address,
+                                                       G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+                                                       G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+                                                       NULL, NULL, error);
+  g_free (address);
+  if (!connection)
+    return FALSE;
+
+  while (!owned && g_get_monotonic_time () < expires)
+  {
+    reply = g_dbus_connection_call_sync (connection,
+                                         "org.freedesktop.DBus",
+                                         "/org/freedesktop/DBus",
+                                         "org.freedesktop.DBus",
+                                         "NameHasOwner",
+                                         g_variant_new ("(s)", SFCD_IFACE),
+                                         G_VARIANT_TYPE ("(b)"),
+                                         G_DBUS_CALL_FLAGS_NONE,
+                                         -1,
+                                         NULL,
+                                         error);
+    if (!reply)
+      break;
+
+    g_variant_get (reply, "(b)", &owned);
+    g_variant_unref (reply);
+
+    if (!owned)
+      g_usleep (50 * G_TIME_SPAN_MILLISECOND);
+  }
+
+  g_object_unref (connection);
+
+  if (!owned && error && !*error)
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+                 "the server did not show up on the private bus");
+
+  return owned;
+}
+
+/*
+ * Starts a private dbus-daemon, points this process' session bus to it and
+ * runs the server on it. Must be called before connecting to the session bus.
+ */
+gboolean
+sfcd_bench_bus_up (SfcdBenchBus  *bus,
+                   const gchar   *daemon_cmdline,
+                   GError       **error)
+{
+  gchar **argv = NULL;
+
+  memset (bus, 0, sizeof (SfcdBenchBus));
+
+  if (!g_shell_parse_argv (daemon_cmdline, NULL, &argv, error))
+    return FALSE;
+
+  bus->dbus = g_test_dbus_new (G_TEST_DBUS_NONE);
+  g_test_dbus_up (bus->dbus);
+
+  if (!g_spawn_async (NULL, argv, NULL,
+                      G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD,
+                      NULL, NULL, &bus->daemon, error))
+  {
+    g_strfreev (argv);
+    sfcd_bench_bus_down (bus);
+    return FALSE;
+  }
+
+  g_strfreev (argv);
+
+  if (!_sfcd_bench_bus_wait_for_server (error))
+  {
+    sfcd_bench_bus_down (bus);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+void
+sfcd_bench_bus_down (SfcdBenchBus *bus)
+{
+  if (bus->daemon)
+  {
+    // The server cleans up and flushes its recording, if any, on SIGINT
+    kill (bus->daemon, SIGINT);
+    waitpid (bus->daemon, NULL, 0);
+    g_spawn_close_pid (bus->daemon);
+    bus->daemon = 0;
+  }
+
+  if (bus->dbus)
+  {
+    g_test_dbus_down (bus->dbus);
+    g_object_unref (bus->dbus);
+    bus->dbus = NULL;
+  }
+}
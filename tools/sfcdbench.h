@@ -0,0 +1,69 @@
+/* SandboxUtils -- Benchmark helpers
+ * Copyright (c) Steve Dodier-Lazaro <sidnioulz@gmail.com>, 2014
+ *
+ * Under GPLv3
+ *
+ ***
+ *
+ * Helpers shared by the benchmark tools: latency statistics per method, and
+ * a private session bus with its own sandboxutilsd so that benchmarks do not
+ * disturb, or get disturbed by, the user's session.
+ *
+ */
+#ifndef _SFCD_BENCH_H
+#define _SFCD_BENCH_H
+
+#include <stdio.h>
+#include <gio/gio.h>
+
+/* Latencies of one kind of call, in microseconds */
+typedef struct {
+  gchar   *name;
+  GArray  *samples;
+  guint    errors;
+  gboolean sorted;
+} SfcdBenchStats;
+
+GHashTable *
+sfcd_bench_stats_table_new ();
+
+void
+sfcd_bench_stats_add (GHashTable  *table,
+                      const gchar *name,
+                      gint64       latency,
+                      gboolean     failed);
+
+gint64
+sfcd_bench_stats_percentile (SfcdBenchStats *stats,
+                             gdouble         percentile);
+
+void
+sfcd_bench_stats_print (GHashTable *table,
+                        FILE       *out);
+
+void
+sfcd_bench_stats_append_json (GHashTable *table,
+                              GString    *json);
+
+/* Server options lifting per-client limits, which benchmarks would hit. The
+ * make targets rely on the tools' default server command lines for them. */
+#define SFCD_BENCH_NO_LIMITS \
+  "--client-max-dialogs=0 --client-max-runs=0 --client-max-in-flight=0 " \
+  "--client-lifecycle-rate=0 --client-interactive-rate=0 " \
+  "--client-config-rate=0 --client-retrieval-rate=0"
+
+/* A private bus running its own server */
+typedef struct {
+  GTestDBus *dbus;
+  GPid       daemon;
+} SfcdBenchBus;
+
+gboolean
+sfcd_bench_bus_up (SfcdBenchBus  *bus,
+                   const gchar   *daemon_cmdline,
+                   GError       **error);
+
+void
+sfcd_bench_bus_down (SfcdBenchBus *bus);
+
+#endif /* #ifndef _SFCD_BENCH_H */